@@ -10,6 +10,9 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "configuration.h"
 
@@ -19,10 +22,18 @@ struct ConfigurationPrivate
     GKeyFile *key_file;
     GList *sources;
     GHashTable *key_sources;
+
+    /* Files and directories read while loading, to check snapshots against */
+    GList *watched_paths;
+
+    /* Messages produced while loading, replayed when loaded from a snapshot */
+    GList *load_messages;
+
     GHashTable *lightdm_keys;
     GHashTable *seat_keys;
     GHashTable *xdmcp_keys;
     GHashTable *vnc_keys;
+    GHashTable *vnc_client_keys;
 };
 
 typedef enum
@@ -44,6 +55,31 @@ config_get_instance (void)
     return configuration_instance;
 }
 
+/**
+ * config_cleanup:
+ *
+ * Free the shared configuration, e.g. in a process that no longer needs it.
+ **/
+void
+config_cleanup (void)
+{
+    g_clear_object (&configuration_instance);
+}
+
+/**
+ * config_new:
+ *
+ * Create an empty configuration, e.g. to load a new copy of the configuration
+ * into before applying it with config_copy().
+ *
+ * Return value: (transfer full): a new #Configuration
+ **/
+Configuration *
+config_new (void)
+{
+    return g_object_new (CONFIGURATION_TYPE, NULL);
+}
+
 gboolean
 config_load_from_file (Configuration *config, const gchar *path, GList **messages, GError **error)
 {
@@ -76,6 +112,8 @@ config_load_from_file (Configuration *config, const gchar *path, GList **message
             known_keys = config->priv->xdmcp_keys;
         else if (strcmp (group, "VNCServer") == 0)
             known_keys = config->priv->vnc_keys;
+        else if (g_str_has_prefix (group, "VNCServer:"))
+            known_keys = config->priv->vnc_client_keys;
         else if (messages)
             *messages = g_list_append (*messages, g_strdup_printf ("  Unknown group [%s] in configuration", group));
 
@@ -129,8 +167,17 @@ compare_strings (gconstpointer a, gconstpointer b)
 }
 
 static void
-load_config_directory (const gchar *path, GList **messages)
+watch_path (Configuration *config, const gchar *path)
+{
+    config->priv->watched_paths = g_list_append (config->priv->watched_paths, g_strdup (path));
+}
+
+static void
+load_config_directory (Configuration *config, const gchar *path, GList **messages)
 {
+    /* Adding or removing a file changes the directory */
+    watch_path (config, path);
+
     /* Find configuration files */
     g_autoptr(GError) error = NULL;
     GDir *dir = g_dir_open (path, 0, &error);
@@ -157,7 +204,7 @@ load_config_directory (const gchar *path, GList **messages)
             if (messages)
                 *messages = g_list_append (*messages, g_strdup_printf ("Loading configuration from %s", conf_path));
             g_autoptr(GError) conf_error = NULL;
-            config_load_from_file (config_get_instance (), conf_path, messages, &conf_error);
+            config_load_from_file (config, conf_path, messages, &conf_error);
             if (conf_error && !g_error_matches (conf_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
                 g_printerr ("Failed to load configuration from %s: %s\n", filename, conf_error->message);
         }
@@ -168,7 +215,7 @@ load_config_directory (const gchar *path, GList **messages)
 }
 
 static void
-load_config_directories (const gchar * const *dirs, GList **messages)
+load_config_directories (Configuration *config, const gchar * const *dirs, GList **messages)
 {
     /* Load in reverse order, because XDG_* fields are preference-ordered and the directories in front should override directories in back. */
     for (gint i = g_strv_length ((gchar **)dirs) - 1; i >= 0; i--)
@@ -176,7 +223,7 @@ load_config_directories (const gchar * const *dirs, GList **messages)
         g_autofree gchar *full_dir = g_build_filename (dirs[i], "lightdm", "lightdm.conf.d", NULL);
         if (messages)
             *messages = g_list_append (*messages, g_strdup_printf ("Loading configuration dirs from %s", full_dir));
-        load_config_directory (full_dir, messages);
+        load_config_directory (config, full_dir, messages);
     }
 }
 
@@ -185,8 +232,10 @@ config_load_from_standard_locations (Configuration *config, const gchar *config_
 {
     g_return_val_if_fail (config->priv->dir == NULL, FALSE);
 
-    load_config_directories (g_get_system_data_dirs (), messages);
-    load_config_directories (g_get_system_config_dirs (), messages);
+    guint n_previous_messages = messages ? g_list_length (*messages) : 0;
+
+    load_config_directories (config, g_get_system_data_dirs (), messages);
+    load_config_directories (config, g_get_system_config_dirs (), messages);
 
     g_autofree gchar *config_d_dir = NULL;
     g_autofree gchar *path = NULL;
@@ -204,12 +253,21 @@ config_load_from_standard_locations (Configuration *config, const gchar *config_
     }
 
     if (config_d_dir)
-        load_config_directory (config_d_dir, messages);
+        load_config_directory (config, config_d_dir, messages);
 
     if (messages)
         *messages = g_list_append (*messages, g_strdup_printf ("Loading configuration from %s", path));
+    watch_path (config, path);
     g_autoptr(GError) error = NULL;
-    if (!config_load_from_file (config, path, messages, &error))
+    gboolean loaded = config_load_from_file (config, path, messages, &error);
+    if (messages)
+    {
+        g_list_free_full (config->priv->load_messages, g_free);
+        config->priv->load_messages = NULL;
+        for (GList *link = g_list_nth (*messages, n_previous_messages); link; link = link->next)
+            config->priv->load_messages = g_list_append (config->priv->load_messages, g_strdup (link->data));
+    }
+    if (!loaded)
     {
         gboolean is_empty = error && g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
 
@@ -224,6 +282,192 @@ config_load_from_standard_locations (Configuration *config, const gchar *config_
     return TRUE;
 }
 
+/* Snapshot format version, identity, watched paths with modification time and size, directory, messages and (group, key, value, source) */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_TYPE "(usa(sxx)sasa(ssss))"
+
+/* Snapshots are only valid for the same configuration path and search directories */
+static gchar *
+make_snapshot_identity (const gchar *config_path)
+{
+    g_autofree gchar *data_dirs = g_strjoinv (":", (gchar **) g_get_system_data_dirs ());
+    g_autofree gchar *config_dirs = g_strjoinv (":", (gchar **) g_get_system_config_dirs ());
+    return g_strdup_printf ("%s\n%s\n%s", config_path ? config_path : "", data_dirs, config_dirs);
+}
+
+static void
+get_path_stamp (const gchar *path, gint64 *mtime, gint64 *size)
+{
+    GStatBuf info;
+    if (g_stat (path, &info) < 0)
+    {
+        *mtime = -1;
+        *size = -1;
+        return;
+    }
+
+#ifdef __linux__
+    *mtime = (gint64) info.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + info.st_mtim.tv_nsec;
+#else
+    *mtime = info.st_mtime;
+#endif
+    *size = info.st_size;
+}
+
+/**
+ * config_save_snapshot:
+ * @config: A #Configuration
+ * @path: File to write the snapshot to
+ * @config_path: (allow-none): The configuration path @config was loaded with
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write the values in @config to a binary snapshot that can be loaded with
+ * config_load_snapshot() without parsing any configuration files. The files and
+ * directories @config was loaded from are recorded so a stale snapshot is
+ * detected.
+ *
+ * Return value: %TRUE if the snapshot was written
+ **/
+gboolean
+config_save_snapshot (Configuration *config, const gchar *path, const gchar *config_path, GError **error)
+{
+    g_autofree gchar *identity = make_snapshot_identity (config_path);
+
+    GVariantBuilder watched;
+    g_variant_builder_init (&watched, G_VARIANT_TYPE ("a(sxx)"));
+    for (GList *link = config->priv->watched_paths; link; link = link->next)
+    {
+        gint64 mtime, size;
+        get_path_stamp (link->data, &mtime, &size);
+        g_variant_builder_add (&watched, "(sxx)", link->data, mtime, size);
+    }
+
+    GVariantBuilder messages;
+    g_variant_builder_init (&messages, G_VARIANT_TYPE ("as"));
+    for (GList *link = config->priv->load_messages; link; link = link->next)
+        g_variant_builder_add (&messages, "s", link->data);
+
+    GVariantBuilder values;
+    g_variant_builder_init (&values, G_VARIANT_TYPE ("a(ssss)"));
+    g_auto(GStrv) groups = g_key_file_get_groups (config->priv->key_file, NULL);
+    for (int i = 0; groups[i]; i++)
+    {
+        g_auto(GStrv) keys = g_key_file_get_keys (config->priv->key_file, groups[i], NULL, NULL);
+        for (int j = 0; keys && keys[j]; j++)
+        {
+            g_autofree gchar *value = g_key_file_get_value (config->priv->key_file, groups[i], keys[j], NULL);
+            const gchar *source = config_get_source (config, groups[i], keys[j]);
+            g_variant_builder_add (&values, "(ssss)", groups[i], keys[j], value ? value : "", source ? source : "");
+        }
+    }
+
+    g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_new ("(us@a(sxx)s@as@a(ssss))",
+                                                                      SNAPSHOT_VERSION,
+                                                                      identity,
+                                                                      g_variant_builder_end (&watched),
+                                                                      config->priv->dir ? config->priv->dir : "",
+                                                                      g_variant_builder_end (&messages),
+                                                                      g_variant_builder_end (&values)));
+    return g_file_set_contents (path, g_variant_get_data (snapshot), g_variant_get_size (snapshot), error);
+}
+
+/**
+ * config_load_snapshot:
+ * @config: An empty #Configuration
+ * @path: Snapshot to load
+ * @config_path: (allow-none): The configuration path the snapshot must have been made for
+ * @validate: %TRUE to reject the snapshot if any file it was made from has changed
+ * @messages: (allow-none): location to add the messages from the original load to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a snapshot written by config_save_snapshot(). The snapshot is mapped
+ * read-only, so it is shared between processes that load the same file.
+ *
+ * Return value: %TRUE if the snapshot was loaded
+ **/
+gboolean
+config_load_snapshot (Configuration *config, const gchar *path, const gchar *config_path, gboolean validate, GList **messages, GError **error)
+{
+    g_return_val_if_fail (config->priv->dir == NULL, FALSE);
+
+    g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, error);
+    if (!file)
+        return FALSE;
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_TYPE), bytes, FALSE));
+
+    guint32 version;
+    const gchar *identity, *dir;
+    g_autoptr(GVariant) watched = NULL;
+    g_autoptr(GVariantIter) snapshot_messages = NULL;
+    g_autoptr(GVariantIter) values = NULL;
+    g_variant_get (snapshot, "(u&s@a(sxx)&sasa(ssss))", &version, &identity, &watched, &dir, &snapshot_messages, &values);
+    if (version != SNAPSHOT_VERSION)
+    {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Unsupported configuration snapshot version %u", version);
+        return FALSE;
+    }
+
+    if (validate)
+    {
+        g_autofree gchar *expected_identity = make_snapshot_identity (config_path);
+        if (strcmp (identity, expected_identity) != 0)
+        {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Configuration snapshot is for different locations");
+            return FALSE;
+        }
+
+        GVariantIter iter;
+        const gchar *watched_path;
+        gint64 mtime, size;
+        g_variant_iter_init (&iter, watched);
+        while (g_variant_iter_next (&iter, "(&sxx)", &watched_path, &mtime, &size))
+        {
+            gint64 current_mtime, current_size;
+            get_path_stamp (watched_path, &current_mtime, &current_size);
+            if (current_mtime != mtime || current_size != size)
+            {
+                g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s has changed since configuration snapshot", watched_path);
+                return FALSE;
+            }
+        }
+    }
+
+    GVariantIter iter;
+    const gchar *watched_path;
+    g_variant_iter_init (&iter, watched);
+    while (g_variant_iter_next (&iter, "(&sxx)", &watched_path, NULL, NULL))
+        watch_path (config, watched_path);
+
+    const gchar *message;
+    while (g_variant_iter_next (snapshot_messages, "&s", &message))
+    {
+        config->priv->load_messages = g_list_append (config->priv->load_messages, g_strdup (message));
+        if (messages)
+            *messages = g_list_append (*messages, g_strdup (message));
+    }
+
+    const gchar *group, *key, *value, *source;
+    while (g_variant_iter_next (values, "(&s&s&s&s)", &group, &key, &value, &source))
+    {
+        g_key_file_set_value (config->priv->key_file, group, key, value);
+        if (source[0] == '\0')
+            continue;
+
+        GList *link = g_list_find_custom (config->priv->sources, source, (GCompareFunc) g_strcmp0);
+        if (!link)
+        {
+            config->priv->sources = g_list_append (config->priv->sources, g_strdup (source));
+            link = g_list_last (config->priv->sources);
+        }
+        g_hash_table_insert (config->priv->key_sources, g_strdup_printf ("%s]%s", group, key), link->data);
+    }
+
+    config->priv->dir = g_strdup (dir);
+
+    return TRUE;
+}
+
 const gchar *
 config_get_directory (Configuration *config)
 {
@@ -261,6 +505,116 @@ config_get_source (Configuration *config, const gchar *section, const gchar *key
     return g_hash_table_lookup (config->priv->key_sources, k);
 }
 
+static void
+add_group_keys (GHashTable *keys, GKeyFile *key_file, const gchar *group)
+{
+    g_auto(GStrv) group_keys = g_key_file_get_keys (key_file, group, NULL, NULL);
+    for (int i = 0; group_keys && group_keys[i]; i++)
+        g_hash_table_add (keys, g_strdup (group_keys[i]));
+}
+
+/**
+ * config_get_changed_keys:
+ * @config: A #Configuration
+ * @other: A #Configuration to compare to
+ * @section: The section to compare
+ *
+ * Find the keys in @section that have different values (or are only set) in
+ * one of the configurations.
+ *
+ * Return value: (transfer full): a %NULL terminated array of key names
+ **/
+gchar **
+config_get_changed_keys (Configuration *config, Configuration *other, const gchar *section)
+{
+    g_autoptr(GHashTable) keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    add_group_keys (keys, config->priv->key_file, section);
+    add_group_keys (keys, other->priv->key_file, section);
+
+    GPtrArray *changed = g_ptr_array_new ();
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init (&iter, keys);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        g_autofree gchar *value = g_key_file_get_value (config->priv->key_file, section, key, NULL);
+        g_autofree gchar *other_value = g_key_file_get_value (other->priv->key_file, section, key, NULL);
+        if (g_strcmp0 (value, other_value) != 0)
+            g_ptr_array_add (changed, g_strdup (key));
+    }
+    g_ptr_array_add (changed, NULL);
+
+    return (gchar **) g_ptr_array_free (changed, FALSE);
+}
+
+/**
+ * config_get_changed_groups:
+ * @config: A #Configuration
+ * @other: A #Configuration to compare to
+ *
+ * Find the sections that contain any changed keys.
+ *
+ * Return value: (transfer full): a %NULL terminated array of section names
+ **/
+gchar **
+config_get_changed_groups (Configuration *config, Configuration *other)
+{
+    g_autoptr(GHashTable) groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_auto(GStrv) config_groups = g_key_file_get_groups (config->priv->key_file, NULL);
+    g_auto(GStrv) other_groups = g_key_file_get_groups (other->priv->key_file, NULL);
+    for (int i = 0; config_groups[i]; i++)
+        g_hash_table_add (groups, g_strdup (config_groups[i]));
+    for (int i = 0; other_groups[i]; i++)
+        g_hash_table_add (groups, g_strdup (other_groups[i]));
+
+    GPtrArray *changed = g_ptr_array_new ();
+    GHashTableIter iter;
+    gpointer group;
+    g_hash_table_iter_init (&iter, groups);
+    while (g_hash_table_iter_next (&iter, &group, NULL))
+    {
+        g_auto(GStrv) keys = config_get_changed_keys (config, other, group);
+        if (keys[0])
+            g_ptr_array_add (changed, g_strdup (group));
+    }
+    g_ptr_array_add (changed, NULL);
+
+    return (gchar **) g_ptr_array_free (changed, FALSE);
+}
+
+/**
+ * config_copy:
+ * @config: A #Configuration
+ * @source: The #Configuration to copy from
+ *
+ * Replace the values and sources in @config with those from @source.
+ **/
+void
+config_copy (Configuration *config, Configuration *source)
+{
+    g_autofree gchar *data = g_key_file_to_data (source->priv->key_file, NULL, NULL);
+    g_key_file_free (config->priv->key_file);
+    config->priv->key_file = g_key_file_new ();
+    g_key_file_load_from_data (config->priv->key_file, data, -1, G_KEY_FILE_NONE, NULL);
+
+    g_list_free_full (config->priv->sources, g_free);
+    config->priv->sources = NULL;
+    for (GList *link = source->priv->sources; link; link = link->next)
+        config->priv->sources = g_list_append (config->priv->sources, g_strdup (link->data));
+
+    /* Point the key sources at our copies of the source paths */
+    g_hash_table_remove_all (config->priv->key_sources);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init (&iter, source->priv->key_sources);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        GList *link = g_list_find_custom (config->priv->sources, value, (GCompareFunc) g_strcmp0);
+        if (link)
+            g_hash_table_insert (config->priv->key_sources, g_strdup (key), link->data);
+    }
+}
+
 void
 config_set_string (Configuration *config, const gchar *section, const gchar *key, const gchar *value)
 {
@@ -328,16 +682,23 @@ config_init (Configuration *config)
     config->priv->seat_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
     config->priv->xdmcp_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
     config->priv->vnc_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
+    config->priv->vnc_client_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
 
     /* Build up tables of known keys */
     g_hash_table_insert (config->priv->lightdm_keys, "start-default-seat", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "greeter-user", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "greeter-readahead", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "minimum-display-number", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "minimum-vt", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "lock-memory", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "reuse-authentication-session", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "greeter-host-socket", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "user-authority-in-system-dir", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "user-authority-in-runtime-dir", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "guest-account-script", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "guest-account-pool-size", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "logind-check-graphical", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "logind-settle-time", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "log-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "run-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "cache-directory", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -345,7 +706,23 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->lightdm_keys, "remote-sessions-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "greeters-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "backup-logs", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-max-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-level", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-format", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-subsystem-levels", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "compress-old-logs", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-capture-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-capture-rate", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "accounting-batch-interval", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "accounting-sync", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "dbus-service", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "login-trace-file", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "greeter-trace-directory", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "max-session-greeters", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "shutdown-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "max-process-launches", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "notify-ready", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "stall-report-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "logind-load-seats", GINT_TO_POINTER (KEY_DEPRECATED));
 
     g_hash_table_insert (config->priv->seat_keys, "type", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -354,19 +731,27 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->seat_keys, "pam-greeter-service", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-backend", GINT_TO_POINTER (KEY_DEPRECATED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-command", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "xserver-display-fd", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xmir-command", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-config", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-layout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-allow-tcp", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "xserver-background", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-share", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "xserver-recycle", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-hostname", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-display-number", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "xserver-connect-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdmcp-manager", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdmcp-port", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdmcp-key", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "unity-compositor-command", GINT_TO_POINTER (KEY_DEPRECATED));
     g_hash_table_insert (config->priv->seat_keys, "unity-compositor-timeout", GINT_TO_POINTER (KEY_DEPRECATED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-session", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "fallback-greeter-session", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-restart-limit", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-ping-interval", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-ping-limit", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-hide-users", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-allow-guest", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-show-manual-login", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -377,18 +762,31 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->seat_keys, "guest-session", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "session-wrapper", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-wrapper", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-shared", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "guest-wrapper", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "display-setup-script", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "display-stopped-script", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-setup-script", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "session-setup-script", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "session-cleanup-script", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "session-cleanup-script-background", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "script-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-guest", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-user", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-user-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-in-background", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-session", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "exit-on-failure", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "early-authentication", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "session-child-pool-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "standby-greeter", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "freeze-idle-greeter", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "resource-cpu-affinity", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "resource-nice", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "resource-io-priority", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "resource-cpu-quota", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "resource-memory-max", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "resource-sample-interval", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdg-seat", GINT_TO_POINTER (KEY_DEPRECATED));
 
     g_hash_table_insert (config->priv->xdmcp_keys, "enabled", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -396,6 +794,15 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->xdmcp_keys, "listen-address", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->xdmcp_keys, "key", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->xdmcp_keys, "hostname", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "max-launches", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "priority-display-classes", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "liveness-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "greeter-idle-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "worker-threads", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "report-load", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "max-sessions", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "busy-load", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "busy-delay", GINT_TO_POINTER (KEY_SUPPORTED));
 
     g_hash_table_insert (config->priv->vnc_keys, "enabled", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->vnc_keys, "command", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -404,6 +811,15 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->vnc_keys, "width", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->vnc_keys, "height", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->vnc_keys, "depth", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "max-launches", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "rate-limit", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "admission-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "pool-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "greeter-idle-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+
+    g_hash_table_insert (config->priv->vnc_client_keys, "width", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_client_keys, "height", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_client_keys, "depth", GINT_TO_POINTER (KEY_SUPPORTED));
 }
 
 static void
@@ -415,10 +831,13 @@ config_finalize (GObject *object)
     g_clear_pointer (&self->priv->key_file, g_key_file_free);
     g_list_free_full (self->priv->sources, g_free);
     g_hash_table_destroy (self->priv->key_sources);
+    g_list_free_full (self->priv->watched_paths, g_free);
+    g_list_free_full (self->priv->load_messages, g_free);
     g_hash_table_destroy (self->priv->lightdm_keys);
     g_hash_table_destroy (self->priv->seat_keys);
     g_hash_table_destroy (self->priv->xdmcp_keys);
     g_hash_table_destroy (self->priv->vnc_keys);
+    g_hash_table_destroy (self->priv->vnc_client_keys);
 
     G_OBJECT_CLASS (config_parent_class)->finalize (object);
 }
@@ -34,12 +34,22 @@ typedef struct
 
 GType config_get_type (void);
 
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Configuration, g_object_unref)
+
 Configuration *config_get_instance (void);
 
+void config_cleanup (void);
+
+Configuration *config_new (void);
+
 gboolean config_load_from_file (Configuration *config, const gchar *path, GList **messages, GError **error);
 
 gboolean config_load_from_standard_locations (Configuration *config, const gchar *config_path, GList **messages);
 
+gboolean config_save_snapshot (Configuration *config, const gchar *path, const gchar *config_path, GError **error);
+
+gboolean config_load_snapshot (Configuration *config, const gchar *path, const gchar *config_path, gboolean validate, GList **messages, GError **error);
+
 const gchar *config_get_directory (Configuration *config);
 
 gchar **config_get_groups (Configuration *config);
@@ -52,6 +62,12 @@ GList *config_get_sources (Configuration *config);
 
 const gchar *config_get_source (Configuration *config, const gchar *section, const gchar *key);
 
+gchar **config_get_changed_groups (Configuration *config, Configuration *other);
+
+gchar **config_get_changed_keys (Configuration *config, Configuration *other, const gchar *section);
+
+void config_copy (Configuration *config, Configuration *source);
+
 void config_set_string (Configuration *config, const gchar *section, const gchar *key, const gchar *value);
 
 gchar *config_get_string (Configuration *config, const gchar *section, const gchar *key);
@@ -10,40 +10,293 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "dmrc.h"
 #include "configuration.h"
 #include "privileges.h"
 #include "user-list.h"
 
-GKeyFile *
-dmrc_load (CommonUser *user)
+/* Largest .dmrc file that will be read from a home directory */
+#define MAX_DMRC_SIZE 65536
+
+/* Format of the cache: version and (user name, .dmrc contents) sorted by user name */
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(ua(ss))"
+
+/* The cache shared between threads, reloaded when the file is replaced */
+static GMutex cache_lock;
+static gchar *cache_path = NULL;
+static GMappedFile *cache_file = NULL;
+static GVariant *cache_entries = NULL;
+static dev_t cache_dev;
+static ino_t cache_ino;
+
+static const gchar *
+get_cache_path (void)
 {
-    g_autoptr(GKeyFile) dmrc_file = g_key_file_new ();
+    if (!cache_path)
+    {
+        g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+        cache_path = g_build_filename (cache_dir, "dmrc.cache", NULL);
+    }
 
-    /* Load from the user directory, if this fails (e.g. the user directory
-     * is not yet mounted) then load from the cache */
-    g_autofree gchar *path = g_build_filename (common_user_get_home_directory (user), ".dmrc", NULL);
+    return cache_path;
+}
+
+/* Old location of the cache, one file per user */
+static gchar *
+get_legacy_cache_path (const gchar *username)
+{
+    g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", username);
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, "dmrc", filename, NULL);
+}
+
+/* Map the cache if it has changed since it was last mapped.  Must be called with cache_lock held */
+static void
+update_cache (void)
+{
+    const gchar *path = get_cache_path ();
+
+    struct stat info;
+    if (stat (path, &info) < 0)
+    {
+        g_clear_pointer (&cache_entries, g_variant_unref);
+        g_clear_pointer (&cache_file, g_mapped_file_unref);
+        return;
+    }
+
+    /* The file is always replaced, never modified in place */
+    if (cache_file && info.st_dev == cache_dev && info.st_ino == cache_ino)
+        return;
+
+    g_clear_pointer (&cache_entries, g_variant_unref);
+    g_clear_pointer (&cache_file, g_mapped_file_unref);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, &error);
+    if (!file)
+    {
+        g_warning ("Failed to load DMRC cache %s: %s", path, error->message);
+        return;
+    }
+
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+    guint32 version;
+    g_autoptr(GVariant) entries = NULL;
+    g_variant_get (cache, "(u@a(ss))", &version, &entries);
+    if (version != CACHE_VERSION)
+    {
+        g_debug ("Ignoring DMRC cache %s with unknown version %u", path, version);
+        return;
+    }
+
+    cache_file = g_steal_pointer (&file);
+    cache_entries = g_steal_pointer (&entries);
+    cache_dev = info.st_dev;
+    cache_ino = info.st_ino;
+}
+
+/* Binary search for a user, returns TRUE if found, otherwise @index is where they would be inserted.
+ * Must be called with cache_lock held */
+static gboolean
+find_entry (const gchar *username, gsize *index)
+{
+    gsize lower = 0, upper = cache_entries ? g_variant_n_children (cache_entries) : 0;
+    while (lower < upper)
+    {
+        gsize middle = lower + (upper - lower) / 2;
+        const gchar *name;
+        g_variant_get_child (cache_entries, middle, "(&s&s)", &name, NULL);
+        int d = strcmp (username, name);
+        if (d == 0)
+        {
+            *index = middle;
+            return TRUE;
+        }
+        if (d < 0)
+            upper = middle;
+        else
+            lower = middle + 1;
+    }
+
+    *index = lower;
+    return FALSE;
+}
+
+/* Load the cached settings for a user.  This can be called from any thread */
+gboolean
+dmrc_load_from_cache (GKeyFile *dmrc_file, const gchar *username)
+{
+    g_autofree gchar *data = NULL;
+
+    g_mutex_lock (&cache_lock);
+    update_cache ();
+    gsize index;
+    if (find_entry (username, &index))
+        g_variant_get_child (cache_entries, index, "(&ss)", NULL, &data);
+    g_mutex_unlock (&cache_lock);
+
+    if (data)
+        return g_key_file_load_from_data (dmrc_file, data, -1, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    /* Fall back to a cache from an older version */
+    g_autofree gchar *legacy_path = get_legacy_cache_path (username);
+    return g_key_file_load_from_file (dmrc_file, legacy_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+}
+
+static void
+save_to_cache (const gchar *username, const gchar *data)
+{
+    g_mutex_lock (&cache_lock);
+
+    update_cache ();
+
+    /* Copy the other users, inserting this one in order */
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+    gsize index;
+    gboolean replace = find_entry (username, &index);
+    gsize n_entries = cache_entries ? g_variant_n_children (cache_entries) : 0;
+    for (gsize i = 0; i < n_entries; i++)
+    {
+        if (i == index)
+        {
+            g_variant_builder_add (&builder, "(ss)", username, data);
+            if (replace)
+                continue;
+        }
+        g_autoptr(GVariant) entry = g_variant_get_child_value (cache_entries, i);
+        g_variant_builder_add_value (&builder, entry);
+    }
+    if (index == n_entries)
+        g_variant_builder_add (&builder, "(ss)", username, data);
+
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new ("(u@a(ss))", CACHE_VERSION, g_variant_builder_end (&builder)));
+
+    /* Written to a temporary file and renamed, so readers see either the old or new cache */
+    const gchar *path = get_cache_path ();
+    g_autofree gchar *dir = g_path_get_dirname (path);
+    if (g_mkdir_with_parents (dir, 0700) < 0)
+        g_warning ("Failed to make DMRC cache directory %s: %s", dir, strerror (errno));
+    g_autoptr(GError) error = NULL;
+    if (!g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), &error))
+        g_warning ("Failed to write DMRC cache %s: %s", path, error->message);
+
+    g_mutex_unlock (&cache_lock);
+
+    /* The old cache file is no longer needed */
+    g_autofree gchar *legacy_path = get_legacy_cache_path (username);
+    unlink (legacy_path);
+}
+
+/* Read ~/.dmrc as root without changing credentials, so this is safe to use from any thread.
+ * Symlinks and files not owned by the user are refused so they can't be used to read other files */
+static gboolean
+load_user_file_as_root (GKeyFile *dmrc_file, const gchar *home_directory, uid_t uid, gboolean *denied)
+{
+    int dir_fd = open (home_directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+    {
+        /* e.g. NFS home directories that map root to nobody */
+        if (errno == EACCES || errno == EPERM)
+            *denied = TRUE;
+        return FALSE;
+    }
+    int fd = openat (dir_fd, ".dmrc", O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    int open_errno = errno;
+    close (dir_fd);
+    if (fd < 0)
+    {
+        if (open_errno == ELOOP)
+            g_debug ("Ignoring %s/.dmrc, it is a symbolic link", home_directory);
+        else if (open_errno == EACCES || open_errno == EPERM)
+            *denied = TRUE;
+        return FALSE;
+    }
+
+    struct stat info;
+    if (fstat (fd, &info) < 0 || !S_ISREG (info.st_mode) || info.st_uid != uid || info.st_size > MAX_DMRC_SIZE)
+    {
+        g_debug ("Ignoring %s/.dmrc, it is not a regular file owned by the user", home_directory);
+        close (fd);
+        return FALSE;
+    }
+
+    g_autofree gchar *data = g_malloc (info.st_size + 1);
+    gsize length = 0;
+    while (length < (gsize) info.st_size)
+    {
+        ssize_t n_read = read (fd, data + length, info.st_size - length);
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read <= 0)
+            break;
+        length += n_read;
+    }
+    close (fd);
+    data[length] = '\0';
+
+    return g_key_file_load_from_data (dmrc_file, data, length, G_KEY_FILE_KEEP_COMMENTS, NULL);
+}
+
+/* Load ~/.dmrc for a user.  This doesn't change credentials so can be called from any thread.
+ * @denied is set if root isn't allowed to read the file, in which case dmrc_load_user_file_as_user can be tried */
+gboolean
+dmrc_load_user_file (GKeyFile *dmrc_file, const gchar *home_directory, uid_t uid, gboolean *denied)
+{
+    *denied = FALSE;
+
+    if (!home_directory)
+        return FALSE;
+
+    if (geteuid () == 0)
+        return load_user_file_as_root (dmrc_file, home_directory, uid, denied);
+
+    g_autofree gchar *path = g_build_filename (home_directory, ".dmrc", NULL);
+    return g_key_file_load_from_file (dmrc_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+}
+
+/* Load ~/.dmrc with the user's credentials, for files root can't read.
+ * This changes the credentials of the whole process so must only be called from the main thread */
+gboolean
+dmrc_load_user_file_as_user (GKeyFile *dmrc_file, const gchar *home_directory, uid_t uid, gid_t gid)
+{
+    if (!home_directory)
+        return FALSE;
+
+    g_autofree gchar *path = g_build_filename (home_directory, ".dmrc", NULL);
 
     /* Guard against privilege escalation through symlinks, etc. */
     gboolean drop_privileges = geteuid () == 0;
     if (drop_privileges)
-        privileges_drop (common_user_get_uid (user), common_user_get_gid (user));
-    gboolean have_dmrc = g_key_file_load_from_file (dmrc_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+        privileges_drop (uid, gid);
+    gboolean result = g_key_file_load_from_file (dmrc_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
     if (drop_privileges)
         privileges_reclaim ();
 
-    /* If no ~/.dmrc, then load from the cache */
-    if (!have_dmrc)
-    {
-        g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", common_user_get_name (user));
-        g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
-        g_autofree gchar *cache_path = g_build_filename (cache_dir, "dmrc", filename, NULL);
+    return result;
+}
 
-        g_key_file_load_from_file (dmrc_file, cache_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
-    }
+GKeyFile *
+dmrc_load (CommonUser *user)
+{
+    g_autoptr(GKeyFile) dmrc_file = g_key_file_new ();
+
+    /* Load from the user directory, if this fails (e.g. the user directory
+     * is not yet mounted) then load from the cache */
+    const gchar *home_directory = common_user_get_home_directory (user);
+    gboolean denied;
+    gboolean have_dmrc = dmrc_load_user_file (dmrc_file, home_directory, common_user_get_uid (user), &denied);
+    if (!have_dmrc && denied)
+        have_dmrc = dmrc_load_user_file_as_user (dmrc_file, home_directory, common_user_get_uid (user), common_user_get_gid (user));
+    if (!have_dmrc)
+        dmrc_load_from_cache (dmrc_file, common_user_get_name (user));
 
     return g_steal_pointer (&dmrc_file);
 }
@@ -67,12 +320,15 @@ dmrc_save (GKeyFile *dmrc_file, CommonUser *user)
         privileges_reclaim ();
 
     /* Update the .dmrc cache */
-    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
-    g_autofree gchar *dmrc_cache_dir = g_build_filename (cache_dir, "dmrc", NULL);
-    if (g_mkdir_with_parents (dmrc_cache_dir, 0700) < 0)
-        g_warning ("Failed to make DMRC cache directory %s: %s", dmrc_cache_dir, strerror (errno));
+    save_to_cache (common_user_get_name (user), data);
+}
 
-    g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", common_user_get_name (user));
-    g_autofree gchar *cache_path = g_build_filename (dmrc_cache_dir, filename, NULL);
-    g_file_set_contents (cache_path, data, length, NULL);
+void
+dmrc_cleanup (void)
+{
+    g_mutex_lock (&cache_lock);
+    g_clear_pointer (&cache_entries, g_variant_unref);
+    g_clear_pointer (&cache_file, g_mapped_file_unref);
+    g_clear_pointer (&cache_path, g_free);
+    g_mutex_unlock (&cache_lock);
 }
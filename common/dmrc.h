@@ -13,14 +13,23 @@
 #define DMRC_H_
 
 #include <glib.h>
+#include <sys/types.h>
 #include "user-list.h"
 
 G_BEGIN_DECLS
 
+gboolean dmrc_load_from_cache (GKeyFile *dmrc_file, const gchar *username);
+
+gboolean dmrc_load_user_file (GKeyFile *dmrc_file, const gchar *home_directory, uid_t uid, gboolean *denied);
+
+gboolean dmrc_load_user_file_as_user (GKeyFile *dmrc_file, const gchar *home_directory, uid_t uid, gid_t gid);
+
 GKeyFile *dmrc_load (CommonUser *user);
 
 void dmrc_save (GKeyFile *dmrc_file, CommonUser *user);
 
+void dmrc_cleanup (void);
+
 G_END_DECLS
 
 #endif /* DMRC_H_ */
@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+#include <locale.h>
+#include <libintl.h>
+#include <sys/stat.h>
+
+#include "locale-names.h"
+
+#define LOCALE_DIR "/usr/lib/locale"
+#define LOCALE_ARCHIVE LOCALE_DIR "/locale-archive"
+
+/* glibc locale archive header */
+#define LOCALE_ARCHIVE_MAGIC 0xde020109
+typedef struct
+{
+    guint32 magic;
+    guint32 serial;
+    guint32 namehash_offset;
+    guint32 namehash_used;
+    guint32 namehash_size;
+    guint32 string_offset;
+    guint32 string_used;
+    guint32 string_size;
+    guint32 locrectab_offset;
+    guint32 locrectab_used;
+    guint32 locrectab_size;
+    guint32 sumhash_offset;
+    guint32 sumhash_used;
+    guint32 sumhash_size;
+} LocaleArchiveHeader;
+
+typedef struct
+{
+    guint32 hashval;
+    guint32 name_offset;
+    guint32 locrec_offset;
+} LocaleArchiveName;
+
+/* Each locale record has a reference count then an (offset, length) for each category */
+#define LOCALE_N_CATEGORIES 13
+#define LOCALE_CATEGORY_IDENTIFICATION 12
+
+/* Magic number at the start of LC_IDENTIFICATION data and the index of the fields we want */
+#define IDENTIFICATION_MAGIC (0x20031115 ^ LOCALE_CATEGORY_IDENTIFICATION)
+#define IDENTIFICATION_LANGUAGE 7
+#define IDENTIFICATION_TERRITORY 8
+
+/* Format of the name cache, bump the version when changing the type */
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(usta{s(ss)})"
+
+/* Language and territory names (in English) for each installed locale */
+typedef struct
+{
+    gchar *language;
+    gchar *territory;
+} LocaleInfo;
+
+static GHashTable *locale_info = NULL;
+
+/* Translated names loaded from a cache */
+static GMappedFile *cache_file = NULL;
+static GVariant *cache_names = NULL;
+
+/* Sorted locale codes */
+static GPtrArray *codes = NULL;
+
+static void
+locale_info_free (LocaleInfo *info)
+{
+    g_free (info->language);
+    g_free (info->territory);
+    g_free (info);
+}
+
+static gchar *
+get_identification_string (const guint8 *data, gsize length, guint32 n_strings, guint32 index)
+{
+    if (index >= n_strings)
+        return NULL;
+
+    guint32 offset;
+    memcpy (&offset, data + 8 + index * sizeof (guint32), sizeof (guint32));
+    if (offset >= length || !memchr (data + offset, '\0', length - offset))
+        return NULL;
+
+    const gchar *value = (const gchar *) data + offset;
+    if (value[0] == '\0')
+        return NULL;
+
+    return g_strdup (value);
+}
+
+/* Read the English language and territory names out of LC_IDENTIFICATION data */
+static LocaleInfo *
+parse_identification (const guint8 *data, gsize length)
+{
+    LocaleInfo *info = g_malloc0 (sizeof (LocaleInfo));
+
+    guint32 magic, n_strings;
+    if (length < 8)
+        return info;
+    memcpy (&magic, data, sizeof (guint32));
+    memcpy (&n_strings, data + 4, sizeof (guint32));
+    if (magic != IDENTIFICATION_MAGIC || n_strings > (length - 8) / sizeof (guint32))
+        return info;
+
+    info->language = get_identification_string (data, length, n_strings, IDENTIFICATION_LANGUAGE);
+    info->territory = get_identification_string (data, length, n_strings, IDENTIFICATION_TERRITORY);
+    if (g_strcmp0 (info->territory, "ISO") == 0)
+        g_clear_pointer (&info->territory, g_free);
+
+    return info;
+}
+
+static void
+add_locale (const gchar *code, LocaleInfo *info)
+{
+    if (g_hash_table_contains (locale_info, code))
+    {
+        locale_info_free (info);
+        return;
+    }
+    g_hash_table_insert (locale_info, g_strdup (code), info);
+}
+
+static void
+load_locale_archive (void)
+{
+    g_autoptr(GMappedFile) file = g_mapped_file_new (LOCALE_ARCHIVE, FALSE, NULL);
+    if (!file)
+        return;
+
+    const guint8 *data = (const guint8 *) g_mapped_file_get_contents (file);
+    gsize length = g_mapped_file_get_length (file);
+
+    LocaleArchiveHeader header;
+    if (length < sizeof (header))
+        return;
+    memcpy (&header, data, sizeof (header));
+    if (header.magic != LOCALE_ARCHIVE_MAGIC ||
+        header.namehash_offset > length ||
+        header.namehash_size > (length - header.namehash_offset) / sizeof (LocaleArchiveName))
+        return;
+
+    for (guint32 i = 0; i < header.namehash_size; i++)
+    {
+        LocaleArchiveName entry;
+        memcpy (&entry, data + header.namehash_offset + i * sizeof (LocaleArchiveName), sizeof (entry));
+        if (entry.locrec_offset == 0 || entry.name_offset >= length ||
+            !memchr (data + entry.name_offset, '\0', length - entry.name_offset))
+            continue;
+        const gchar *code = (const gchar *) data + entry.name_offset;
+
+        guint32 record[1 + LOCALE_N_CATEGORIES * 2];
+        if (entry.locrec_offset > length || length - entry.locrec_offset < sizeof (record))
+            continue;
+        memcpy (record, data + entry.locrec_offset, sizeof (record));
+        guint32 offset = record[1 + LOCALE_CATEGORY_IDENTIFICATION * 2];
+        guint32 size = record[2 + LOCALE_CATEGORY_IDENTIFICATION * 2];
+        if (offset > length || size > length - offset)
+            add_locale (code, g_malloc0 (sizeof (LocaleInfo)));
+        else
+            add_locale (code, parse_identification (data + offset, size));
+    }
+}
+
+static void
+load_locale_directories (void)
+{
+    g_autoptr(GDir) dir = g_dir_open (LOCALE_DIR, 0, NULL);
+    if (!dir)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        g_autofree gchar *path = g_build_filename (LOCALE_DIR, name, "LC_IDENTIFICATION", NULL);
+        g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, NULL);
+        if (!file)
+            continue;
+
+        add_locale (name, parse_identification ((const guint8 *) g_mapped_file_get_contents (file), g_mapped_file_get_length (file)));
+    }
+}
+
+static gint
+compare_codes (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*((const gchar **) a), *((const gchar **) b));
+}
+
+/* Find the installed locales and their names in one pass, without running 'locale -a' or changing the process locale */
+static void
+load_locale_info (void)
+{
+    if (locale_info)
+        return;
+
+    locale_info = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) locale_info_free);
+    load_locale_archive ();
+    load_locale_directories ();
+}
+
+static void
+load_codes (void)
+{
+    if (codes)
+        return;
+
+    codes = g_ptr_array_new_with_free_func (g_free);
+    if (cache_names)
+    {
+        GVariantIter iter;
+        const gchar *code;
+        g_variant_iter_init (&iter, cache_names);
+        while (g_variant_iter_next (&iter, "{&s(&s&s)}", &code, NULL, NULL))
+            g_ptr_array_add (codes, g_strdup (code));
+    }
+    else
+    {
+        load_locale_info ();
+
+        GHashTableIter iter;
+        gpointer key;
+        g_hash_table_iter_init (&iter, locale_info);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+            g_ptr_array_add (codes, g_strdup (key));
+    }
+    g_ptr_array_sort (codes, compare_codes);
+}
+
+/* Identifies the installed locales, so a cache can be checked without loading them */
+static guint64
+get_locale_stamp (void)
+{
+    guint64 stamp = 0;
+    struct stat info;
+    if (stat (LOCALE_ARCHIVE, &info) == 0)
+        stamp = MAX (stamp, (guint64) info.st_mtime);
+    if (stat (LOCALE_DIR, &info) == 0)
+        stamp = MAX (stamp, (guint64) info.st_mtime);
+    return stamp;
+}
+
+static const gchar *
+get_messages_locale (void)
+{
+    const gchar *locale = setlocale (LC_MESSAGES, NULL);
+    return locale ? locale : "";
+}
+
+static GVariant *
+open_cache (const gchar *path, GMappedFile **file)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) f = g_mapped_file_new (path, FALSE, &error);
+    if (!f)
+    {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Failed to load locale name cache %s: %s", path, error->message);
+        return NULL;
+    }
+
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (f);
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+    guint32 version;
+    const gchar *messages_locale;
+    guint64 stamp;
+    g_autoptr(GVariant) names = NULL;
+    g_variant_get (cache, "(u&st@a{s(ss)})", &version, &messages_locale, &stamp, &names);
+    if (version != CACHE_VERSION ||
+        g_strcmp0 (messages_locale, get_messages_locale ()) != 0 ||
+        stamp != get_locale_stamp ())
+    {
+        g_debug ("Ignoring out of date locale name cache %s", path);
+        return NULL;
+    }
+
+    *file = g_steal_pointer (&f);
+    return g_steal_pointer (&names);
+}
+
+/**
+ * common_locale_names_load_cache:
+ * @path: File written by common_locale_names_save_cache()
+ *
+ * Use translated names from a cache.  The cache is only used if it was written
+ * for the current messages locale and the installed locales have not changed
+ * since.  This must be called before any locales are looked up.
+ *
+ * Return value: %TRUE if the cache was loaded.
+ **/
+gboolean
+common_locale_names_load_cache (const gchar *path)
+{
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    if (cache_names || codes)
+        return FALSE;
+
+    cache_names = open_cache (path, &cache_file);
+    if (!cache_names)
+        return FALSE;
+
+    g_debug ("Loaded %zu locale names from cache %s", g_variant_n_children (cache_names), path);
+
+    return TRUE;
+}
+
+/**
+ * common_locale_names_save_cache:
+ * @path: File to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write the installed locales and their names, translated into the current
+ * messages locale, to a file that can be loaded with
+ * common_locale_names_load_cache().  The file is not rewritten if it is
+ * already up to date.
+ *
+ * Return value: %TRUE if the cache is up to date.
+ **/
+gboolean
+common_locale_names_save_cache (const gchar *path, GError **error)
+{
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    g_autoptr(GMappedFile) existing_file = NULL;
+    g_autoptr(GVariant) existing = open_cache (path, &existing_file);
+    if (existing)
+        return TRUE;
+
+    /* Store the names as UTF-8 regardless of the current character set */
+    bind_textdomain_codeset ("iso_639_3", "UTF-8");
+    bind_textdomain_codeset ("iso_3166", "UTF-8");
+
+    load_locale_info ();
+    load_codes ();
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(ss)}"));
+    for (guint i = 0; i < codes->len; i++)
+    {
+        const gchar *code = g_ptr_array_index (codes, i);
+        LocaleInfo *info = g_hash_table_lookup (locale_info, code);
+        if (!info)
+            continue;
+        g_variant_builder_add (&builder, "{s(ss)}", code,
+                               info->language ? dgettext ("iso_639_3", info->language) : "",
+                               info->territory ? dgettext ("iso_3166", info->territory) : "");
+    }
+
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new ("(ust@a{s(ss)})", CACHE_VERSION, get_messages_locale (), get_locale_stamp (), g_variant_builder_end (&builder)));
+    return g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), error);
+}
+
+/**
+ * common_locale_names_get_codes:
+ *
+ * Get the installed locales.
+ *
+ * Return value: (transfer none) (element-type utf8): the sorted locale codes.
+ **/
+GPtrArray *
+common_locale_names_get_codes (void)
+{
+    load_codes ();
+    return codes;
+}
+
+static gboolean
+is_utf8 (const gchar *code)
+{
+    return g_strrstr (code, ".utf8") || g_strrstr (code, ".UTF-8");
+}
+
+/* Get an installed locale matching this code */
+static const gchar *
+find_code (const gchar *code)
+{
+    load_codes ();
+
+    g_autofree gchar *language = NULL;
+    if (is_utf8 (code))
+    {
+        /* Installed locales use the normalized codeset name */
+        g_auto(GStrv) tokens = g_strsplit (code, ".UTF-8", 2);
+        g_autofree gchar *name = g_strjoinv (".utf8", tokens);
+        for (guint i = 0; i < codes->len; i++)
+        {
+            const gchar *loc = g_ptr_array_index (codes, i);
+            if (strcmp (loc, name) == 0)
+                return loc;
+        }
+        return NULL;
+    }
+
+    const char *at = strchr (code, '@');
+    if (at)
+        language = g_strndup (code, at - code);
+    else
+        language = g_strdup (code);
+
+    for (guint i = 0; i < codes->len; i++)
+    {
+        const gchar *loc = g_ptr_array_index (codes, i);
+        if (!g_strrstr (loc, ".utf8"))
+            continue;
+        if (g_str_has_prefix (loc, language))
+            return loc;
+    }
+
+    return NULL;
+}
+
+static gchar *
+empty_to_null (const gchar *value)
+{
+    return value[0] != '\0' ? g_strdup (value) : NULL;
+}
+
+/**
+ * common_locale_names_lookup:
+ * @code: A locale code
+ * @name: (out) (allow-none): location to store the translated language name or %NULL if not known
+ * @territory: (out) (allow-none): location to store the translated territory name or %NULL if not known
+ *
+ * Get the names of an installed locale matching @code.
+ *
+ * Return value: %TRUE if a matching locale is installed.
+ **/
+gboolean
+common_locale_names_lookup (const gchar *code, gchar **name, gchar **territory)
+{
+    g_return_val_if_fail (code != NULL, FALSE);
+
+    const gchar *loc = find_code (code);
+    if (!loc)
+        return FALSE;
+
+    if (cache_names)
+    {
+        const gchar *cached_name, *cached_territory;
+        if (!g_variant_lookup (cache_names, loc, "(&s&s)", &cached_name, &cached_territory))
+            return FALSE;
+        if (name)
+            *name = empty_to_null (cached_name);
+        if (territory)
+            *territory = empty_to_null (cached_territory);
+        return TRUE;
+    }
+
+    load_locale_info ();
+    LocaleInfo *info = g_hash_table_lookup (locale_info, loc);
+    if (!info)
+        return FALSE;
+    if (name)
+        *name = info->language ? g_strdup (dgettext ("iso_639_3", info->language)) : NULL;
+    if (territory)
+        *territory = info->territory ? g_strdup (dgettext ("iso_3166", info->territory)) : NULL;
+
+    return TRUE;
+}
+
+void
+common_locale_names_cleanup (void)
+{
+    g_clear_pointer (&locale_info, g_hash_table_unref);
+    g_clear_pointer (&codes, g_ptr_array_unref);
+    g_clear_pointer (&cache_names, g_variant_unref);
+    g_clear_pointer (&cache_file, g_mapped_file_unref);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_LOCALE_NAMES_H_
+#define COMMON_LOCALE_NAMES_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean common_locale_names_load_cache (const gchar *path);
+
+gboolean common_locale_names_save_cache (const gchar *path, GError **error);
+
+GPtrArray *common_locale_names_get_codes (void);
+
+gboolean common_locale_names_lookup (const gchar *code, gchar **name, gchar **territory);
+
+void common_locale_names_cleanup (void);
+
+G_END_DECLS
+
+#endif /* COMMON_LOCALE_NAMES_H_ */
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include "metrics.h"
+
+typedef enum
+{
+    METRIC_COUNTER,
+    METRIC_HISTOGRAM
+} MetricType;
+
+typedef struct
+{
+    const gchar *name;
+    MetricType type;
+    const gchar *help;
+} MetricInfo;
+
+/* Metrics that can be recorded, in the order they are reported */
+static const MetricInfo metric_info[] =
+{
+    { "lightdm_authentication_attempts_total", METRIC_COUNTER, "Completed authentications by result" },
+    { "lightdm_authentication_duration_seconds", METRIC_HISTOGRAM, "Time from starting authentication to getting the result" },
+    { "lightdm_greeter_messages_total", METRIC_COUNTER, "Greeter protocol messages by direction" },
+    { "lightdm_greeter_bytes_total", METRIC_COUNTER, "Greeter protocol bytes by direction" },
+    { "lightdm_xdmcp_packets_total", METRIC_COUNTER, "XDMCP packets by direction and opcode" },
+    { "lightdm_vnc_connections_total", METRIC_COUNTER, "VNC connections by result" },
+    { "lightdm_vnc_launch_duration_seconds", METRIC_HISTOGRAM, "Time from accepting a VNC connection to its X server being ready" },
+    { "lightdm_display_server_start_duration_seconds", METRIC_HISTOGRAM, "Time from starting a display server to it being ready" },
+    { "lightdm_process_spawns_total", METRIC_COUNTER, "Child processes started by method" },
+    { "lightdm_process_stop_duration_seconds", METRIC_HISTOGRAM, "Time from asking a child process to stop to it exiting, by whether it had to be killed" },
+    { "lightdm_user_list_load_duration_seconds", METRIC_HISTOGRAM, "Time to load the user list by source" },
+    { "lightdm_nss_lookup_duration_seconds", METRIC_HISTOGRAM, "Time taken by password database lookups by kind of lookup" },
+    { "lightdm_nss_cache_lookups_total", METRIC_COUNTER, "Password database lookups by whether they were answered from the cache" },
+};
+
+/* Upper bounds of the histogram buckets in seconds, the last bucket is +Inf */
+static const gdouble bucket_bounds[] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30 };
+#define N_BUCKETS G_N_ELEMENTS (bucket_bounds)
+
+typedef struct
+{
+    /* Counter value or number of observations */
+    guint64 count;
+
+    /* Sum of observations */
+    gdouble sum;
+
+    /* Observations in each bucket (not cumulative) */
+    guint64 buckets[N_BUCKETS];
+} MetricSeries;
+
+/* Series for each metric keyed by label string, metrics can be recorded from any thread */
+static GMutex series_lock;
+static GHashTable *series[G_N_ELEMENTS (metric_info)];
+
+static gint
+get_metric_index (const gchar *name, MetricType type)
+{
+    for (gsize i = 0; i < G_N_ELEMENTS (metric_info); i++)
+        if (strcmp (metric_info[i].name, name) == 0 && metric_info[i].type == type)
+            return i;
+
+    g_warning ("Unknown metric %s", name);
+    return -1;
+}
+
+static MetricSeries *
+get_series (gint index, const gchar *labels)
+{
+    if (!series[index])
+        series[index] = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    if (!labels)
+        labels = "";
+    MetricSeries *s = g_hash_table_lookup (series[index], labels);
+    if (!s)
+    {
+        s = g_new0 (MetricSeries, 1);
+        g_hash_table_insert (series[index], g_strdup (labels), s);
+    }
+
+    return s;
+}
+
+/**
+ * common_metrics_add:
+ * @name: Name of a counter metric
+ * @labels: (allow-none): Prometheus label pairs, e.g. "result=\"success\"" or %NULL
+ * @value: Amount to add
+ *
+ * Add to a counter.
+ **/
+void
+common_metrics_add (const gchar *name, const gchar *labels, guint64 value)
+{
+    gint index = get_metric_index (name, METRIC_COUNTER);
+    if (index < 0)
+        return;
+
+    g_mutex_lock (&series_lock);
+    get_series (index, labels)->count += value;
+    g_mutex_unlock (&series_lock);
+}
+
+/**
+ * common_metrics_observe:
+ * @name: Name of a histogram metric
+ * @labels: (allow-none): Prometheus label pairs or %NULL
+ * @value: Observed value in seconds
+ *
+ * Record a value in a histogram.
+ **/
+void
+common_metrics_observe (const gchar *name, const gchar *labels, gdouble value)
+{
+    gint index = get_metric_index (name, METRIC_HISTOGRAM);
+    if (index < 0)
+        return;
+
+    g_mutex_lock (&series_lock);
+    MetricSeries *s = get_series (index, labels);
+    s->count++;
+    s->sum += value;
+    for (gsize i = 0; i < N_BUCKETS; i++)
+    {
+        if (value <= bucket_bounds[i])
+        {
+            s->buckets[i]++;
+            break;
+        }
+    }
+    g_mutex_unlock (&series_lock);
+}
+
+/**
+ * common_metrics_observe_since:
+ * @name: Name of a histogram metric
+ * @labels: (allow-none): Prometheus label pairs or %NULL
+ * @start_time: Time the measured operation started from g_get_monotonic_time()
+ *
+ * Record the time elapsed since @start_time in a histogram.
+ **/
+void
+common_metrics_observe_since (const gchar *name, const gchar *labels, gint64 start_time)
+{
+    common_metrics_observe (name, labels, (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC);
+}
+
+static void
+append_sample (GString *text, const gchar *name, const gchar *suffix, const gchar *labels, const gchar *extra_label, const gchar *value)
+{
+    g_string_append_printf (text, "%s%s", name, suffix);
+    if (labels[0] != '\0' || extra_label)
+    {
+        g_string_append_c (text, '{');
+        g_string_append (text, labels);
+        if (labels[0] != '\0' && extra_label)
+            g_string_append_c (text, ',');
+        if (extra_label)
+            g_string_append (text, extra_label);
+        g_string_append_c (text, '}');
+    }
+    g_string_append_printf (text, " %s\n", value);
+}
+
+static void
+append_series (GString *text, const MetricInfo *info, const gchar *labels, MetricSeries *s)
+{
+    gchar value[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (info->type == METRIC_COUNTER)
+    {
+        g_snprintf (value, sizeof (value), "%" G_GUINT64_FORMAT, s->count);
+        append_sample (text, info->name, "", labels, NULL, value);
+        return;
+    }
+
+    guint64 cumulative = 0;
+    for (gsize i = 0; i < N_BUCKETS; i++)
+    {
+        gchar bound[G_ASCII_DTOSTR_BUF_SIZE];
+        g_ascii_dtostr (bound, sizeof (bound), bucket_bounds[i]);
+        g_autofree gchar *le = g_strdup_printf ("le=\"%s\"", bound);
+        cumulative += s->buckets[i];
+        g_snprintf (value, sizeof (value), "%" G_GUINT64_FORMAT, cumulative);
+        append_sample (text, info->name, "_bucket", labels, le, value);
+    }
+    g_snprintf (value, sizeof (value), "%" G_GUINT64_FORMAT, s->count);
+    append_sample (text, info->name, "_bucket", labels, "le=\"+Inf\"", value);
+    append_sample (text, info->name, "_count", labels, NULL, value);
+    g_ascii_dtostr (value, sizeof (value), s->sum);
+    append_sample (text, info->name, "_sum", labels, NULL, value);
+}
+
+/**
+ * common_metrics_to_text:
+ *
+ * Get the recorded metrics in the Prometheus text exposition format.
+ *
+ * Return value: (transfer full): The metrics text.
+ **/
+gchar *
+common_metrics_to_text (void)
+{
+    GString *text = g_string_new ("");
+
+    g_mutex_lock (&series_lock);
+    for (gsize i = 0; i < G_N_ELEMENTS (metric_info); i++)
+    {
+        const MetricInfo *info = &metric_info[i];
+
+        if (!series[i] || g_hash_table_size (series[i]) == 0)
+            continue;
+
+        g_string_append_printf (text, "# HELP %s %s\n", info->name, info->help);
+        g_string_append_printf (text, "# TYPE %s %s\n", info->name, info->type == METRIC_COUNTER ? "counter" : "histogram");
+
+        /* Sort the series so the output is stable */
+        g_autoptr(GList) labels = g_list_sort (g_hash_table_get_keys (series[i]), (GCompareFunc) strcmp);
+        for (GList *link = labels; link; link = link->next)
+            append_series (text, info, link->data, g_hash_table_lookup (series[i], link->data));
+    }
+    g_mutex_unlock (&series_lock);
+
+    return g_string_free (text, FALSE);
+}
+
+void
+common_metrics_cleanup (void)
+{
+    g_mutex_lock (&series_lock);
+    for (gsize i = 0; i < G_N_ELEMENTS (metric_info); i++)
+        g_clear_pointer (&series[i], g_hash_table_unref);
+    g_mutex_unlock (&series_lock);
+}
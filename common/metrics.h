@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_METRICS_H_
+#define COMMON_METRICS_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void common_metrics_add (const gchar *name, const gchar *labels, guint64 value);
+
+void common_metrics_observe (const gchar *name, const gchar *labels, gdouble value);
+
+void common_metrics_observe_since (const gchar *name, const gchar *labels, gint64 start_time);
+
+gchar *common_metrics_to_text (void);
+
+void common_metrics_cleanup (void);
+
+G_END_DECLS
+
+#endif /* COMMON_METRICS_H_ */
@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "nss.h"
+
+/* Seconds to keep the result of a lookup, users that don't exist are checked again sooner */
+#define USER_CACHE_TTL 60
+#define MISSING_USER_CACHE_TTL 5
+
+/* Largest number of results to keep, so lookups of many different names can't grow the cache forever */
+#define MAX_CACHE_ENTRIES 1024
+
+typedef struct
+{
+    /* Entry or NULL if there is no such user */
+    CommonPasswd *entry;
+    gint64 expiry_time;
+} CacheEntry;
+
+typedef enum
+{
+    LOOKUP_BY_NAME,
+    LOOKUP_ALL
+} LookupType;
+
+typedef struct
+{
+    LookupType type;
+    gchar *name;
+} LookupRequest;
+
+/* Results shared between the main thread and the worker, keyed by "name:<name>" or "uid:<uid>" */
+static GMutex cache_lock;
+static GHashTable *cache = NULL;
+
+/* getpwent() keeps its position in global state */
+static GMutex enumerate_lock;
+
+/* A single worker so a slow name service can only hold up other lookups, not the main loop */
+static GThreadPool *worker = NULL;
+
+static CommonPasswd *
+copy_passwd (const struct passwd *entry)
+{
+    CommonPasswd *copy = g_new0 (CommonPasswd, 1);
+    copy->pw_name = g_strdup (entry->pw_name);
+    copy->pw_passwd = g_strdup (entry->pw_passwd);
+    copy->pw_uid = entry->pw_uid;
+    copy->pw_gid = entry->pw_gid;
+    copy->pw_gecos = g_strdup (entry->pw_gecos ? entry->pw_gecos : "");
+    copy->pw_dir = g_strdup (entry->pw_dir);
+    copy->pw_shell = g_strdup (entry->pw_shell);
+    return copy;
+}
+
+/**
+ * common_nss_passwd_free:
+ * @entry: (allow-none): A password entry returned from this module
+ *
+ * Free a password entry.
+ **/
+void
+common_nss_passwd_free (CommonPasswd *entry)
+{
+    if (!entry)
+        return;
+
+    g_free (entry->pw_name);
+    g_free (entry->pw_passwd);
+    g_free (entry->pw_gecos);
+    g_free (entry->pw_dir);
+    g_free (entry->pw_shell);
+    g_free (entry);
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+    common_nss_passwd_free (entry->entry);
+    g_free (entry);
+}
+
+/* Get a copy of a cached result, returns FALSE if not cached */
+static gboolean
+cache_lookup (const gchar *key, CommonPasswd **entry)
+{
+    g_mutex_lock (&cache_lock);
+    CacheEntry *cached = cache ? g_hash_table_lookup (cache, key) : NULL;
+    gboolean found = cached && g_get_monotonic_time () < cached->expiry_time;
+    if (found)
+        *entry = cached->entry ? copy_passwd (cached->entry) : NULL;
+    g_mutex_unlock (&cache_lock);
+
+    common_metrics_add ("lightdm_nss_cache_lookups_total", found ? "result=\"hit\"" : "result=\"miss\"", 1);
+
+    return found;
+}
+
+static gboolean
+cache_entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    CacheEntry *cached = value;
+    gint64 *now = user_data;
+    return *now >= cached->expiry_time;
+}
+
+static void
+cache_store (const gchar *key, const struct passwd *entry)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    CacheEntry *cached = g_new0 (CacheEntry, 1);
+    cached->entry = entry ? copy_passwd (entry) : NULL;
+    cached->expiry_time = now + (entry ? USER_CACHE_TTL : MISSING_USER_CACHE_TTL) * G_USEC_PER_SEC;
+
+    g_mutex_lock (&cache_lock);
+    if (!cache)
+        cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) cache_entry_free);
+
+    /* Make room by dropping old results, or everything if they are all still fresh */
+    if (g_hash_table_size (cache) >= MAX_CACHE_ENTRIES && !g_hash_table_contains (cache, key))
+    {
+        g_hash_table_foreach_remove (cache, cache_entry_expired, &now);
+        if (g_hash_table_size (cache) >= MAX_CACHE_ENTRIES)
+            g_hash_table_remove_all (cache);
+    }
+
+    g_hash_table_insert (cache, g_strdup (key), cached);
+    g_mutex_unlock (&cache_lock);
+}
+
+static glong
+get_buffer_size (void)
+{
+    glong size = sysconf (_SC_GETPW_R_SIZE_MAX);
+    return size > 0 ? size : 1024;
+}
+
+static CommonPasswd *
+lookup_user_by_name (const gchar *name)
+{
+    gint64 start_time = g_get_monotonic_time ();
+
+    glong size = get_buffer_size ();
+    g_autofree gchar *buffer = NULL;
+    struct passwd entry, *result = NULL;
+    int e;
+    while (TRUE)
+    {
+        buffer = g_realloc (buffer, size);
+        e = getpwnam_r (name, &entry, buffer, size, &result);
+        if (e == ERANGE && size < 1024 * 1024)
+        {
+            size *= 2;
+            continue;
+        }
+        if (e != 0)
+            g_warning ("Failed to get password entry for %s: %s", name, strerror (e));
+        break;
+    }
+
+    common_metrics_observe_since ("lightdm_nss_lookup_duration_seconds", "lookup=\"name\"", start_time);
+
+    /* Failures (e.g. EIO from a network name service) are tried again next time */
+    if (e == 0)
+    {
+        g_autofree gchar *key = g_strdup_printf ("name:%s", name);
+        cache_store (key, result);
+    }
+
+    return result ? copy_passwd (result) : NULL;
+}
+
+static CommonPasswd *
+lookup_user_by_uid (uid_t uid)
+{
+    gint64 start_time = g_get_monotonic_time ();
+
+    glong size = get_buffer_size ();
+    g_autofree gchar *buffer = NULL;
+    struct passwd entry, *result = NULL;
+    int e;
+    while (TRUE)
+    {
+        buffer = g_realloc (buffer, size);
+        e = getpwuid_r (uid, &entry, buffer, size, &result);
+        if (e == ERANGE && size < 1024 * 1024)
+        {
+            size *= 2;
+            continue;
+        }
+        if (e != 0)
+            g_warning ("Failed to get password entry for UID %u: %s", (guint) uid, strerror (e));
+        break;
+    }
+
+    common_metrics_observe_since ("lightdm_nss_lookup_duration_seconds", "lookup=\"uid\"", start_time);
+
+    if (e == 0)
+    {
+        g_autofree gchar *key = g_strdup_printf ("uid:%u", (guint) uid);
+        cache_store (key, result);
+    }
+
+    return result ? copy_passwd (result) : NULL;
+}
+
+static GPtrArray *
+lookup_all_users (void)
+{
+    gint64 start_time = g_get_monotonic_time ();
+
+    GPtrArray *entries = g_ptr_array_new_with_free_func ((GDestroyNotify) common_nss_passwd_free);
+
+    g_mutex_lock (&enumerate_lock);
+    setpwent ();
+    while (TRUE)
+    {
+        errno = 0;
+        struct passwd *entry = getpwent ();
+        if (!entry)
+            break;
+        g_ptr_array_add (entries, copy_passwd (entry));
+    }
+    if (errno != 0)
+        g_warning ("Failed to read password database: %s", strerror (errno));
+    endpwent ();
+    g_mutex_unlock (&enumerate_lock);
+
+    common_metrics_observe_since ("lightdm_nss_lookup_duration_seconds", "lookup=\"all\"", start_time);
+
+    return entries;
+}
+
+static void
+lookup_request_free (LookupRequest *request)
+{
+    g_free (request->name);
+    g_free (request);
+}
+
+static void
+worker_cb (gpointer data, gpointer user_data)
+{
+    g_autoptr(GTask) task = data;
+    LookupRequest *request = g_task_get_task_data (task);
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    switch (request->type)
+    {
+    case LOOKUP_BY_NAME:
+        g_task_return_pointer (task, lookup_user_by_name (request->name), (GDestroyNotify) common_nss_passwd_free);
+        break;
+    case LOOKUP_ALL:
+        g_task_return_pointer (task, lookup_all_users (), (GDestroyNotify) g_ptr_array_unref);
+        break;
+    }
+}
+
+static void
+run_in_worker (GTask *task, LookupType type, const gchar *name)
+{
+    if (!worker)
+        worker = g_thread_pool_new (worker_cb, NULL, 1, FALSE, NULL);
+
+    LookupRequest *request = g_new0 (LookupRequest, 1);
+    request->type = type;
+    request->name = g_strdup (name);
+    g_task_set_task_data (task, request, (GDestroyNotify) lookup_request_free);
+
+    g_thread_pool_push (worker, g_object_ref (task), NULL);
+}
+
+/**
+ * common_nss_get_user_by_name:
+ * @name: Name of the user to look up
+ *
+ * Get the password entry for a user, using a recent result if there is one.
+ * This blocks while the name service is queried, use
+ * common_nss_get_user_by_name_async() from the main loop where possible.
+ *
+ * Return value: (transfer full) (allow-none): The entry or %NULL if there is no such user.
+ **/
+CommonPasswd *
+common_nss_get_user_by_name (const gchar *name)
+{
+    g_return_val_if_fail (name != NULL, NULL);
+
+    g_autofree gchar *key = g_strdup_printf ("name:%s", name);
+    CommonPasswd *entry;
+    if (cache_lookup (key, &entry))
+        return entry;
+
+    return lookup_user_by_name (name);
+}
+
+/**
+ * common_nss_get_user_by_uid:
+ * @uid: UID of the user to look up
+ *
+ * Get the password entry for a user, using a recent result if there is one.
+ *
+ * Return value: (transfer full) (allow-none): The entry or %NULL if there is no such user.
+ **/
+CommonPasswd *
+common_nss_get_user_by_uid (uid_t uid)
+{
+    g_autofree gchar *key = g_strdup_printf ("uid:%u", (guint) uid);
+    CommonPasswd *entry;
+    if (cache_lookup (key, &entry))
+        return entry;
+
+    return lookup_user_by_uid (uid);
+}
+
+/**
+ * common_nss_get_user_by_name_async:
+ * @name: Name of the user to look up
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the lookup is complete.
+ * @user_data: data to pass to the @callback.
+ *
+ * Get the password entry for a user in the NSS worker thread. Call
+ * common_nss_get_user_finish() from @callback to get the result.
+ **/
+void
+common_nss_get_user_by_name_async (const gchar *name, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail (name != NULL);
+
+    g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+
+    g_autofree gchar *key = g_strdup_printf ("name:%s", name);
+    CommonPasswd *entry;
+    if (cache_lookup (key, &entry))
+    {
+        g_task_return_pointer (task, entry, (GDestroyNotify) common_nss_passwd_free);
+        return;
+    }
+
+    run_in_worker (task, LOOKUP_BY_NAME, name);
+}
+
+/**
+ * common_nss_get_user_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with common_nss_get_user_by_name_async().
+ *
+ * Return value: (transfer full) (allow-none): The entry or %NULL if there is no such user.
+ **/
+CommonPasswd *
+common_nss_get_user_finish (GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * common_nss_get_all_users:
+ *
+ * Get every entry in the password database.
+ *
+ * Return value: (transfer full) (element-type CommonPasswd): The entries.
+ **/
+GPtrArray *
+common_nss_get_all_users (void)
+{
+    return lookup_all_users ();
+}
+
+/**
+ * common_nss_get_all_users_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the entries have been read.
+ * @user_data: data to pass to the @callback.
+ *
+ * Read the password database in the NSS worker thread. Call
+ * common_nss_get_all_users_finish() from @callback to get the result.
+ **/
+void
+common_nss_get_all_users_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+    run_in_worker (task, LOOKUP_ALL, NULL);
+}
+
+/**
+ * common_nss_get_all_users_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with common_nss_get_all_users_async().
+ *
+ * Return value: (transfer full) (element-type CommonPasswd): The entries or %NULL on error.
+ **/
+GPtrArray *
+common_nss_get_all_users_finish (GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * common_nss_clear_cache:
+ *
+ * Forget all cached results, e.g. when the password database has changed.
+ **/
+void
+common_nss_clear_cache (void)
+{
+    g_mutex_lock (&cache_lock);
+    if (cache)
+        g_hash_table_remove_all (cache);
+    g_mutex_unlock (&cache_lock);
+}
+
+void
+common_nss_cleanup (void)
+{
+    if (worker)
+        g_thread_pool_free (worker, FALSE, TRUE);
+    worker = NULL;
+
+    g_mutex_lock (&cache_lock);
+    g_clear_pointer (&cache, g_hash_table_unref);
+    g_mutex_unlock (&cache_lock);
+}
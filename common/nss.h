@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_NSS_H_
+#define COMMON_NSS_H_
+
+#include <pwd.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct passwd CommonPasswd;
+
+CommonPasswd *common_nss_get_user_by_name (const gchar *name);
+
+CommonPasswd *common_nss_get_user_by_uid (uid_t uid);
+
+void common_nss_get_user_by_name_async (const gchar *name, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+CommonPasswd *common_nss_get_user_finish (GAsyncResult *result, GError **error);
+
+GPtrArray *common_nss_get_all_users (void);
+
+void common_nss_get_all_users_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+GPtrArray *common_nss_get_all_users_finish (GAsyncResult *result, GError **error);
+
+void common_nss_clear_cache (void);
+
+void common_nss_passwd_free (CommonPasswd *entry);
+
+void common_nss_cleanup (void);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (CommonPasswd, common_nss_passwd_free)
+
+G_END_DECLS
+
+#endif /* COMMON_NSS_H_ */
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+
+#include "session-index.h"
+
+typedef struct
+{
+    /* Directory containing .desktop files */
+    gchar *path;
+
+    /* Session type to use when a file doesn't specify one */
+    const gchar *default_session_type;
+
+    /* Watch for files being added, changed or removed */
+    GFileMonitor *monitor;
+
+    /* TRUE if the directory needs to be scanned again */
+    gboolean dirty;
+
+    /* Session files in this directory in the order they were read */
+    GList *sessions;
+
+    /* Session files keyed by name */
+    GHashTable *sessions_by_key;
+} SessionDirectory;
+
+/* Format of session index snapshots, bump the version when changing the type */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_FILE_TYPE "(sts)"
+#define SNAPSHOT_DIRECTORY_TYPE "(sta" SNAPSHOT_FILE_TYPE ")"
+#define SNAPSHOT_TYPE "(ua" SNAPSHOT_DIRECTORY_TYPE ")"
+
+/* Directories that have been indexed, keyed by path */
+static GHashTable *directories = NULL;
+
+/* Called when an indexed directory changes */
+static CommonSessionIndexChangedFunc changed_func = NULL;
+static gpointer changed_func_data = NULL;
+
+static void
+session_file_free (CommonSessionFile *session)
+{
+    g_free (session->key);
+    g_free (session->path);
+    g_free (session->session_type);
+    g_free (session->command);
+    g_key_file_unref (session->key_file);
+    g_free (session);
+}
+
+static void
+directory_clear (SessionDirectory *directory)
+{
+    g_hash_table_remove_all (directory->sessions_by_key);
+    g_list_free_full (directory->sessions, (GDestroyNotify) session_file_free);
+    directory->sessions = NULL;
+}
+
+static void
+directory_free (SessionDirectory *directory)
+{
+    directory_clear (directory);
+    g_hash_table_unref (directory->sessions_by_key);
+    g_clear_object (&directory->monitor);
+    g_free (directory->path);
+    g_free (directory);
+}
+
+static void
+directory_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, SessionDirectory *directory)
+{
+    /* Rescan the next time the directory is used */
+    if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+        event_type == G_FILE_MONITOR_EVENT_CREATED ||
+        event_type == G_FILE_MONITOR_EVENT_DELETED ||
+        event_type == G_FILE_MONITOR_EVENT_MOVED_IN ||
+        event_type == G_FILE_MONITOR_EVENT_MOVED_OUT ||
+        event_type == G_FILE_MONITOR_EVENT_RENAMED)
+    {
+        directory->dirty = TRUE;
+        if (changed_func)
+            changed_func (changed_func_data);
+    }
+}
+
+static void
+add_session (SessionDirectory *directory, const gchar *key, gchar *path, GKeyFile *key_file)
+{
+    CommonSessionFile *session = g_malloc0 (sizeof (CommonSessionFile));
+    session->key = g_strdup (key);
+    session->path = path;
+    session->session_type = g_key_file_get_string (key_file, G_KEY_FILE_DESKTOP_GROUP, "X-LightDM-Session-Type", NULL);
+    if (!session->session_type)
+        session->session_type = g_strdup (directory->default_session_type);
+    session->command = g_key_file_get_string (key_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
+    session->key_file = key_file;
+
+    directory->sessions = g_list_append (directory->sessions, session);
+    g_hash_table_insert (directory->sessions_by_key, session->key, session);
+}
+
+static void
+load_directory (SessionDirectory *directory)
+{
+    directory_clear (directory);
+    directory->dirty = FALSE;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GDir) dir = g_dir_open (directory->path, 0, &error);
+    if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Failed to open sessions directory: %s", error->message);
+    if (!dir)
+        return;
+
+    const gchar *filename;
+    while ((filename = g_dir_read_name (dir)))
+    {
+        if (!g_str_has_suffix (filename, ".desktop"))
+            continue;
+
+        g_autofree gchar *path = g_build_filename (directory->path, filename, NULL);
+        g_autoptr(GKeyFile) key_file = g_key_file_new ();
+        g_autoptr(GError) e = NULL;
+        if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &e))
+        {
+            g_warning ("Failed to load session file %s: %s:", path, e->message);
+            continue;
+        }
+
+        g_autofree gchar *key = g_strndup (filename, strlen (filename) - strlen (".desktop"));
+        add_session (directory, key, g_steal_pointer (&path), g_steal_pointer (&key_file));
+    }
+}
+
+static SessionDirectory *
+lookup_directory (const gchar *path)
+{
+    if (!directories)
+        directories = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) directory_free);
+
+    SessionDirectory *directory = g_hash_table_lookup (directories, path);
+    if (!directory)
+    {
+        directory = g_malloc0 (sizeof (SessionDirectory));
+        directory->path = g_strdup (path);
+        directory->default_session_type = g_str_has_suffix (path, "/wayland-sessions") ? "wayland" : "x";
+        directory->sessions_by_key = g_hash_table_new (g_str_hash, g_str_equal);
+        directory->dirty = TRUE;
+
+        g_autoptr(GFile) file = g_file_new_for_path (path);
+        directory->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        if (directory->monitor)
+            g_signal_connect (directory->monitor, "changed", G_CALLBACK (directory_changed_cb), directory);
+
+        g_hash_table_insert (directories, directory->path, directory);
+    }
+
+    return directory;
+}
+
+static SessionDirectory *
+get_directory (const gchar *path)
+{
+    SessionDirectory *directory = lookup_directory (path);
+
+    /* Without a monitor we can't know if the directory is current */
+    if (directory->dirty || !directory->monitor)
+        load_directory (directory);
+
+    return directory;
+}
+
+/**
+ * common_session_index_lookup:
+ * @sessions_dirs: Colon separated list of directories to search
+ * @name: Name of the session
+ *
+ * Find the first session file with the given name that has a command to run.
+ * The result is valid until the index is next used.
+ *
+ * Return value: The session file or %NULL if none found.
+ **/
+CommonSessionFile *
+common_session_index_lookup (const gchar *sessions_dirs, const gchar *name)
+{
+    g_return_val_if_fail (sessions_dirs != NULL, NULL);
+    g_return_val_if_fail (name != NULL, NULL);
+
+    g_auto(GStrv) dirs = g_strsplit (sessions_dirs, ":", -1);
+    for (int i = 0; dirs[i]; i++)
+    {
+        SessionDirectory *directory = get_directory (dirs[i]);
+        CommonSessionFile *session = g_hash_table_lookup (directory->sessions_by_key, name);
+        if (session && session->command)
+            return session;
+    }
+
+    return NULL;
+}
+
+/**
+ * common_session_index_get_sessions:
+ * @sessions_dirs: Colon separated list of directories to search
+ *
+ * Get all the session files in the given directories. The files are valid
+ * until the index is next used.
+ *
+ * Return value: A list of #CommonSessionFile, free the list with g_list_free().
+ **/
+GList *
+common_session_index_get_sessions (const gchar *sessions_dirs)
+{
+    g_return_val_if_fail (sessions_dirs != NULL, NULL);
+
+    g_auto(GStrv) dirs = g_strsplit (sessions_dirs, ":", -1);
+    GList *sessions = NULL;
+    for (int i = 0; dirs[i]; i++)
+    {
+        SessionDirectory *directory = get_directory (dirs[i]);
+        sessions = g_list_concat (sessions, g_list_copy (directory->sessions));
+    }
+
+    return sessions;
+}
+
+/**
+ * common_session_index_set_changed_func:
+ * @func: (allow-none): function to call when session files are added, changed or removed
+ * @user_data: data to pass to @func
+ *
+ * Set a function to be notified when an indexed directory changes. The
+ * function is called for each change, the directory is only scanned again
+ * the next time it is used.
+ **/
+void
+common_session_index_set_changed_func (CommonSessionIndexChangedFunc func, gpointer user_data)
+{
+    changed_func = func;
+    changed_func_data = user_data;
+}
+
+/* Modification time in microseconds, or 0 if the file doesn't exist */
+static guint64
+get_mtime (const gchar *path)
+{
+    struct stat info;
+    if (stat (path, &info) != 0)
+        return 0;
+    return (guint64) info.st_mtim.tv_sec * G_USEC_PER_SEC + info.st_mtim.tv_nsec / 1000;
+}
+
+/**
+ * common_session_index_save_snapshot:
+ * @sessions_dirs: Colon separated list of directories to save
+ * @path: File to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write the session files in the given directories to a file that can be
+ * loaded with common_session_index_load_snapshot().
+ *
+ * Return value: %TRUE if the snapshot was written.
+ **/
+gboolean
+common_session_index_save_snapshot (const gchar *sessions_dirs, const gchar *path, GError **error)
+{
+    g_return_val_if_fail (sessions_dirs != NULL, FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" SNAPSHOT_DIRECTORY_TYPE));
+    g_auto(GStrv) dirs = g_strsplit (sessions_dirs, ":", -1);
+    for (int i = 0; dirs[i]; i++)
+    {
+        SessionDirectory *directory = get_directory (dirs[i]);
+
+        GVariantBuilder files_builder;
+        g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a" SNAPSHOT_FILE_TYPE));
+        for (GList *link = directory->sessions; link; link = link->next)
+        {
+            CommonSessionFile *session = link->data;
+            g_autofree gchar *data = g_key_file_to_data (session->key_file, NULL, NULL);
+            g_variant_builder_add (&files_builder, SNAPSHOT_FILE_TYPE, session->key, get_mtime (session->path), data);
+        }
+        g_variant_builder_add (&builder, SNAPSHOT_DIRECTORY_TYPE, directory->path, get_mtime (directory->path), &files_builder);
+    }
+
+    g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_new ("(u@a" SNAPSHOT_DIRECTORY_TYPE ")", SNAPSHOT_VERSION, g_variant_builder_end (&builder)));
+    return g_file_set_contents (path, g_variant_get_data (snapshot), g_variant_get_size (snapshot), error);
+}
+
+/* Use a directory from a snapshot if neither it nor any of its files have changed since */
+static void
+load_snapshot_directory (GVariant *value)
+{
+    const gchar *path;
+    guint64 mtime;
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get (value, "(&sta" SNAPSHOT_FILE_TYPE ")", &path, &mtime, &iter);
+
+    SessionDirectory *directory = lookup_directory (path);
+    if (!directory->dirty || !directory->monitor || mtime == 0 || get_mtime (path) != mtime)
+        return;
+
+    directory_clear (directory);
+    const gchar *key, *data;
+    guint64 file_mtime;
+    while (g_variant_iter_next (iter, "(&st&s)", &key, &file_mtime, &data))
+    {
+        g_autofree gchar *filename = g_strdup_printf ("%s.desktop", key);
+        g_autofree gchar *file_path = g_build_filename (path, filename, NULL);
+        g_autoptr(GKeyFile) key_file = g_key_file_new ();
+        if (get_mtime (file_path) != file_mtime ||
+            !g_key_file_load_from_data (key_file, data, -1, G_KEY_FILE_NONE, NULL))
+        {
+            g_debug ("Session snapshot of %s is out of date", path);
+            directory_clear (directory);
+            return;
+        }
+
+        add_session (directory, key, g_steal_pointer (&file_path), g_steal_pointer (&key_file));
+    }
+
+    directory->dirty = FALSE;
+}
+
+/**
+ * common_session_index_load_snapshot:
+ * @path: File written by common_session_index_save_snapshot()
+ *
+ * Populate the index from a snapshot.  Directories that have changed since
+ * the snapshot was written are ignored and scanned as normal when used.
+ *
+ * Return value: %TRUE if the snapshot was loaded.
+ **/
+gboolean
+common_session_index_load_snapshot (const gchar *path)
+{
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, &error);
+    if (!file)
+    {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Failed to load session snapshot %s: %s", path, error->message);
+        return FALSE;
+    }
+
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_TYPE), bytes, FALSE));
+    guint32 version;
+    g_autoptr(GVariant) dirs = NULL;
+    g_variant_get (snapshot, "(u@a" SNAPSHOT_DIRECTORY_TYPE ")", &version, &dirs);
+    if (version != SNAPSHOT_VERSION)
+    {
+        g_debug ("Ignoring session snapshot %s with version %u", path, version);
+        return FALSE;
+    }
+
+    gsize n_dirs = g_variant_n_children (dirs);
+    for (gsize i = 0; i < n_dirs; i++)
+    {
+        g_autoptr(GVariant) value = g_variant_get_child_value (dirs, i);
+        load_snapshot_directory (value);
+    }
+
+    return TRUE;
+}
+
+void
+common_session_index_cleanup (void)
+{
+    g_clear_pointer (&directories, g_hash_table_unref);
+    changed_func = NULL;
+    changed_func_data = NULL;
+}
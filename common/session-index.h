@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_SESSION_INDEX_H_
+#define COMMON_SESSION_INDEX_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+    /* Name of the session, i.e. the filename without .desktop */
+    gchar *key;
+
+    /* Path to the .desktop file */
+    gchar *path;
+
+    /* Session type, either from the file or the default for its directory */
+    gchar *session_type;
+
+    /* Command to run or NULL if the file has no Exec key */
+    gchar *command;
+
+    /* Contents of the file */
+    GKeyFile *key_file;
+} CommonSessionFile;
+
+typedef void (*CommonSessionIndexChangedFunc) (gpointer user_data);
+
+CommonSessionFile *common_session_index_lookup (const gchar *sessions_dirs, const gchar *name);
+
+GList *common_session_index_get_sessions (const gchar *sessions_dirs);
+
+gboolean common_session_index_save_snapshot (const gchar *sessions_dirs, const gchar *path, GError **error);
+
+gboolean common_session_index_load_snapshot (const gchar *path);
+
+void common_session_index_set_changed_func (CommonSessionIndexChangedFunc func, gpointer user_data);
+
+void common_session_index_cleanup (void);
+
+G_END_DECLS
+
+#endif /* COMMON_SESSION_INDEX_H_ */
@@ -13,13 +13,16 @@
 
 #include <config.h>
 
-#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/utsname.h>
 #include <pwd.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 
 #include "dmrc.h"
+#include "metrics.h"
+#include "nss.h"
 #include "user-list.h"
 
 enum
@@ -53,6 +56,10 @@ enum
     USER_ADDED,
     USER_CHANGED,
     USER_REMOVED,
+    USERS_LOADED,
+    USERS_ADDED,
+    USERS_CHANGED,
+    USERS_REMOVED,
     LAST_LIST_SIGNAL
 };
 static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
@@ -60,11 +67,19 @@ static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
 enum
 {
     CHANGED,
-    GET_LOGGED_IN,
     LAST_USER_SIGNAL
 };
 static guint user_signals[LAST_USER_SIGNAL] = { 0 };
 
+typedef struct
+{
+    /* Names to match exactly */
+    GHashTable *names;
+
+    /* Glob patterns, e.g. "svc-*" */
+    GPtrArray *patterns;
+} NameFilter;
+
 typedef struct
 {
     /* Bus connection being communicated on */
@@ -81,30 +96,89 @@ typedef struct
     /* File monitor for password file */
     GFileMonitor *passwd_monitor;
 
+    /* Timeout to group bursts of password file changes into one reload */
+    guint passwd_reload_timeout;
+
+    /* Reload of the password database running in the NSS worker */
+    GCancellable *passwd_reload_cancellable;
+
+    /* State of the password file when it was last loaded */
+    gint64 passwd_mtime;
+    goffset passwd_size;
+    gchar *passwd_checksum;
+
+    /* Settings from the user configuration file */
+    gboolean have_user_config;
+    gint64 user_config_mtime;
+    gint minimum_uid;
+    NameFilter *hidden_users;
+    NameFilter *hidden_shells;
+    gboolean filter_accounts_service;
+
     /* TRUE if have scanned users */
     gboolean have_users;
 
-    /* List of users */
+    /* TRUE once all users have been loaded */
+    gboolean users_loaded;
+
+    /* Time the initial load started for metrics */
+    gint64 load_start_time;
+
+    /* Accounts service users still being loaded asynchronously, keyed by path */
+    GHashTable *loading_users;
+    gint n_loading_users;
+
+    /* List of users, sorted by display name */
     GList *users;
 
-    /* List of sessions */
-    GList *sessions;
+    /* Users indexed by name and by accounts service path */
+    GHashTable *users_by_name;
+    GHashTable *users_by_path;
+
+    /* Sessions keyed by path */
+    GHashTable *sessions;
+
+    /* Number of sessions each user has running, keyed by username */
+    GHashTable *session_counts;
+
+    /* Users found by common_user_list_lookup_user before the list is loaded, keyed by name */
+    GHashTable *lookup_cache;
+
+    /* Names and real names sorted for prefix searches, rebuilt after the list changes */
+    GPtrArray *search_index;
+
+    /* Users changed in this main loop iteration, all reported with pending_signal */
+    GPtrArray *pending_users;
+    GHashTable *pending_set;
+    guint pending_signal;
+    guint pending_idle;
 } CommonUserListPrivate;
 
 typedef struct
 {
-    /* TRUE if have loaded the DMRC file */
-    gboolean loaded_dmrc;
+    /* Case folded name or real name */
+    gchar *key;
+
+    CommonUser *user;
+} SearchEntry;
+
+typedef struct
+{
+    /* User found or NULL if there is no such user */
+    CommonUser *user;
+
+    /* Monotonic time this entry stops being used */
+    gint64 expiry_time;
+} LookupEntry;
 
+typedef struct
+{
     /* Bus we are listening for accounts service on */
     GDBusConnection *bus;
 
     /* Accounts service path */
     gchar *path;
 
-    /* Update signal from accounts service */
-    guint changed_signal;
-
     /* Username */
     gchar *name;
 
@@ -114,35 +188,69 @@ typedef struct
     /* Home directory of user */
     gchar *home_directory;
 
-    /* Shell for user */
-    gchar *shell;
+    /* Shell for user (interned) */
+    const gchar *shell;
 
     /* Image for user */
     gchar *image;
 
+    /* Modification time of the home directory when the image was found */
+    gint64 image_home_mtime;
+
     /* Background image for users */
     gchar *background;
 
-    /* TRUE if this user has messages available */
-    gboolean has_messages;
-
     /* UID of user */
     guint64 uid;
 
     /* GID of user */
     guint64 gid;
 
-    /* User chosen language */
-    gchar *language;
+    /* User chosen language (interned) */
+    const gchar *language;
 
-    /* User layout preferences */
-    gchar **layouts;
+    /* User layout preferences (array of interned strings) */
+    const gchar **layouts;
+
+    /* User default session (interned) */
+    const gchar *session;
+
+    /* Settings changed but not yet written */
+    gchar *pending_language;
+    gchar *pending_session;
+
+    /* Idle source to write the pending settings */
+    guint write_settings_source;
 
-    /* User default session */
-    gchar *session;
+    /* Writes are delayed while this is non-zero */
+    guint settings_hold_count;
+
+    /* TRUE if have loaded the DMRC file */
+    guint loaded_dmrc : 1;
+
+    /* TRUE if the DMRC file is being read in the background */
+    guint loading_dmrc : 1;
+
+    /* TRUE if listening for changes from the accounts service */
+    guint watching_changes : 1;
+
+    /* TRUE if the accounts service reported a change that hasn't been loaded yet */
+    guint stale : 1;
+
+    /* TRUE once the home directory has been checked for an image */
+    guint image_resolved : 1;
+
+    /* TRUE if the home directory may have changed since the image was found */
+    guint image_check : 1;
+
+    /* TRUE if this user has messages available */
+    guint has_messages : 1;
 
     /* TRUE if this user is locked */
-    gboolean is_locked;
+    guint is_locked : 1;
+
+    /* TRUE if this user was loaded from a snapshot and not yet confirmed */
+    guint from_snapshot : 1;
 } CommonUserPrivate;
 
 typedef struct
@@ -169,8 +277,41 @@ G_DEFINE_TYPE (CommonSession, common_session, G_TYPE_OBJECT)
 #define PASSWD_FILE      "/etc/passwd"
 #define USER_CONFIG_FILE "/etc/lightdm/users.conf"
 
+/* Time to wait for the accounts service to store a setting */
+#define ACCOUNTS_SET_TIMEOUT_MS 5000
+
+/* Time to wait for the password file to settle before reloading it */
+#define PASSWD_RELOAD_DELAY_MS 200
+
+/* Seconds to keep the result of a single user lookup */
+#define LOOKUP_CACHE_TTL 30
+
+/* Largest number of single user lookups to keep */
+#define LOOKUP_CACHE_MAX_ENTRIES 256
+
+/* Number of .dmrc files to read in parallel when prefetching */
+#define DMRC_PREFETCH_MAX_THREADS 4
+
+/* Time to wait for a .dmrc file before using the defaults */
+#define DMRC_PREFETCH_TIMEOUT_MS 2000
+
+/* Format of user list snapshots, bump the version when changing the type */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_USER_TYPE "(sssssssassttbb)"
+#define SNAPSHOT_TYPE "(ua" SNAPSHOT_USER_TYPE ")"
+#define SNAPSHOT_USER_FORMAT "(sssssss^assttbb)"
+
 static CommonUserList *singleton = NULL;
 
+/* Accounts service users listening for changes keyed by path, all served by one subscription */
+static GHashTable *watched_users = NULL;
+static GDBusConnection *watched_users_bus = NULL;
+static guint watched_users_changed_signal = 0;
+
+/* Users with changes to load and the idle that loads them */
+static GList *stale_users = NULL;
+static guint stale_users_idle = 0;
+
 /**
  * common_user_list_get_instance:
  *
@@ -197,14 +338,10 @@ get_user_by_name (CommonUserList *user_list, const gchar *username)
 {
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
-    for (GList *link = priv->users; link; link = link->next)
-    {
-        CommonUser *user = link->data;
-        if (g_strcmp0 (common_user_get_name (user), username) == 0)
-            return user;
-    }
+    if (!username)
+        return NULL;
 
-    return NULL;
+    return g_hash_table_lookup (priv->users_by_name, username);
 }
 
 static CommonUser *
@@ -212,14 +349,42 @@ get_user_by_path (CommonUserList *user_list, const gchar *path)
 {
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
-    for (GList *link = priv->users; link; link = link->next)
-    {
-        CommonUser *user = link->data;
-        if (g_strcmp0 (GET_USER_PRIVATE (user)->path, path) == 0)
-            return user;
-    }
+    if (!path)
+        return NULL;
 
-    return NULL;
+    return g_hash_table_lookup (priv->users_by_path, path);
+}
+
+static void
+index_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    CommonUserPrivate *user_priv = GET_USER_PRIVATE (user);
+
+    if (user_priv->name)
+        g_hash_table_insert (priv->users_by_name, g_strdup (user_priv->name), user);
+    if (user_priv->path)
+        g_hash_table_insert (priv->users_by_path, g_strdup (user_priv->path), user);
+}
+
+static gboolean
+value_is_user (gpointer key, gpointer value, gpointer user)
+{
+    return value == user;
+}
+
+static void
+unindex_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    CommonUserPrivate *user_priv = GET_USER_PRIVATE (user);
+
+    if (user_priv->name && g_hash_table_lookup (priv->users_by_name, user_priv->name) == user)
+        g_hash_table_remove (priv->users_by_name, user_priv->name);
+    else
+        g_hash_table_foreach_remove (priv->users_by_name, value_is_user, user);
+    if (user_priv->path)
+        g_hash_table_remove (priv->users_by_path, user_priv->path);
 }
 
 static gint
@@ -229,34 +394,114 @@ compare_user (gconstpointer a, gconstpointer b)
     return g_strcmp0 (common_user_get_display_name (user_a), common_user_get_display_name (user_b));
 }
 
+/* Shells, languages, sessions and layouts are shared by many users, so each value is only stored once */
+static const gchar *
+intern_string (const gchar *value)
+{
+    return value ? g_intern_string (value) : NULL;
+}
+
+static const gchar **
+intern_strv (const gchar * const *values)
+{
+    guint length = values ? g_strv_length ((gchar **) values) : 0;
+    const gchar **interned = g_new (const gchar *, length + 1);
+    for (guint i = 0; i < length; i++)
+        interned[i] = g_intern_string (values[i]);
+    interned[length] = NULL;
+    return interned;
+}
+
+static void
+set_layouts (CommonUserPrivate *priv, const gchar * const *layouts)
+{
+    g_free (priv->layouts);
+    priv->layouts = intern_strv (layouts);
+}
+
 static gboolean
-update_passwd_user (CommonUser *user, const gchar *real_name, const gchar *home_directory, const gchar *shell, const gchar *image)
+update_passwd_user (CommonUser *user, const gchar *real_name, const gchar *home_directory, const gchar *shell)
 {
     CommonUserPrivate *priv = GET_USER_PRIVATE (user);
 
     /* Skip if already set to this */
     if (g_strcmp0 (common_user_get_real_name (user), real_name) == 0 &&
         g_strcmp0 (common_user_get_home_directory (user), home_directory) == 0 &&
-        g_strcmp0 (common_user_get_shell (user), shell) == 0 &&
-        g_strcmp0 (common_user_get_image (user), image) == 0)
+        g_strcmp0 (common_user_get_shell (user), shell) == 0)
         return FALSE;
 
+    /* The image is looked for again in the new home directory when next needed */
+    if (g_strcmp0 (priv->home_directory, home_directory) != 0)
+    {
+        g_clear_pointer (&priv->image, g_free);
+        priv->image_resolved = FALSE;
+    }
+
     g_free (priv->real_name);
     priv->real_name = g_strdup (real_name);
     g_free (priv->home_directory);
     priv->home_directory = g_strdup (home_directory);
-    g_free (priv->shell);
-    priv->shell = g_strdup (shell);
-    g_free (priv->image);
-    priv->image = g_strdup (image);
+    priv->shell = intern_string (shell);
 
     return TRUE;
 }
 
+/* Report the users queued so far in one signal */
+static void
+flush_pending_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->pending_idle)
+        g_source_remove (priv->pending_idle);
+    priv->pending_idle = 0;
+
+    if (!priv->pending_users)
+        return;
+
+    g_autoptr(GPtrArray) users = g_steal_pointer (&priv->pending_users);
+    g_clear_pointer (&priv->pending_set, g_hash_table_unref);
+    g_signal_emit (user_list, list_signals[priv->pending_signal], 0, users);
+}
+
+static gboolean
+pending_users_cb (gpointer data)
+{
+    CommonUserList *user_list = data;
+    GET_LIST_PRIVATE (user_list)->pending_idle = 0;
+    flush_pending_users (user_list);
+    return G_SOURCE_REMOVE;
+}
+
+/* Report a change to one user now, and with the others like it once back in the main loop */
+static void
+emit_user_signal (CommonUserList *user_list, guint signal, guint batch_signal, CommonUser *user)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    /* Keep the batches in order, e.g. a user removed after being added */
+    if (priv->pending_users && priv->pending_signal != batch_signal)
+        flush_pending_users (user_list);
+
+    g_signal_emit (user_list, list_signals[signal], 0, user);
+
+    if (!priv->pending_users)
+    {
+        priv->pending_users = g_ptr_array_new_with_free_func (g_object_unref);
+        priv->pending_set = g_hash_table_new (g_direct_hash, g_direct_equal);
+        priv->pending_signal = batch_signal;
+    }
+    if (g_hash_table_add (priv->pending_set, user))
+        g_ptr_array_add (priv->pending_users, g_object_ref (user));
+
+    if (!priv->pending_idle)
+        priv->pending_idle = g_idle_add (pending_users_cb, user_list);
+}
+
 static void load_sessions (CommonUserList *user_list);
 
 static gboolean
-get_logged_in_cb (CommonUser *user, CommonUserList *user_list)
+get_logged_in (CommonUserList *user_list, CommonUser *user)
 {
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
@@ -264,21 +509,23 @@ get_logged_in_cb (CommonUser *user, CommonUserList *user_list)
     if (priv->session_added_signal == 0)
         load_sessions (user_list);
 
-    const gchar *username = GET_USER_PRIVATE (user)->name;
-    for (GList *link = priv->sessions; link; link = link->next)
-    {
-        CommonSession *session = link->data;
-        if (strcmp (session->username, username) == 0)
-            return TRUE;
-    }
-
-    return FALSE;
+    return g_hash_table_contains (priv->session_counts, GET_USER_PRIVATE (user)->name);
 }
 
 static void
 user_changed_cb (CommonUser *user, CommonUserList *user_list)
 {
-    g_signal_emit (user_list, list_signals[USER_CHANGED], 0, user);
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    /* Accounts service users can be renamed, keep the index pointing at them */
+    const gchar *name = GET_USER_PRIVATE (user)->name;
+    if (GET_USER_PRIVATE (user)->path && name && g_hash_table_lookup (priv->users_by_name, name) != user)
+    {
+        g_hash_table_foreach_remove (priv->users_by_name, value_is_user, user);
+        g_hash_table_insert (priv->users_by_name, g_strdup (name), user);
+    }
+
+    emit_user_signal (user_list, USER_CHANGED, USERS_CHANGED, user);
 }
 
 static CommonUser *
@@ -287,7 +534,6 @@ make_passwd_user (CommonUserList *user_list, struct passwd *entry)
     CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
     CommonUserPrivate *priv = GET_USER_PRIVATE (user);
 
-    g_signal_connect (user, "get-logged-in", G_CALLBACK (get_logged_in_cb), user_list);
 
     g_auto(GStrv) tokens = g_strsplit (entry->pw_gecos, ",", -1);
     gchar *real_name;
@@ -296,34 +542,118 @@ make_passwd_user (CommonUserList *user_list, struct passwd *entry)
     else
         real_name = g_strdup ("");
 
-    gchar *image = g_build_filename (entry->pw_dir, ".face", NULL);
-    if (!g_file_test (image, G_FILE_TEST_EXISTS))
-    {
-        g_free (image);
-        image = g_build_filename (entry->pw_dir, ".face.icon", NULL);
-        if (!g_file_test (image, G_FILE_TEST_EXISTS))
-        {
-            g_free (image);
-            image = NULL;
-        }
-    }
-
+    /* The image is found when first asked for, so loading doesn't touch every home directory */
     priv->name = g_strdup (entry->pw_name);
     priv->real_name = real_name;
     priv->home_directory = g_strdup (entry->pw_dir);
-    priv->shell = g_strdup (entry->pw_shell);
-    priv->image = image;
+    priv->shell = intern_string (entry->pw_shell);
     priv->uid = entry->pw_uid;
     priv->gid = entry->pw_gid;
 
     return user;
 }
 
+static NameFilter *
+name_filter_new (const gchar *list)
+{
+    NameFilter *filter = g_malloc0 (sizeof (NameFilter));
+    filter->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    filter->patterns = g_ptr_array_new_with_free_func ((GDestroyNotify) g_pattern_spec_free);
+
+    g_auto(GStrv) tokens = g_strsplit (list, " ", -1);
+    for (int i = 0; tokens[i]; i++)
+    {
+        if (tokens[i][0] == '\0')
+            continue;
+        if (strchr (tokens[i], '*') || strchr (tokens[i], '?'))
+            g_ptr_array_add (filter->patterns, g_pattern_spec_new (tokens[i]));
+        else
+            g_hash_table_add (filter->names, g_strdup (tokens[i]));
+    }
+
+    return filter;
+}
+
+static gboolean
+name_filter_matches (NameFilter *filter, const gchar *name)
+{
+    if (g_hash_table_contains (filter->names, name))
+        return TRUE;
+
+    for (guint i = 0; i < filter->patterns->len; i++)
+        if (g_pattern_match_string (g_ptr_array_index (filter->patterns, i), name))
+            return TRUE;
+
+    return FALSE;
+}
+
 static void
-load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
+name_filter_free (NameFilter *filter)
+{
+    g_hash_table_unref (filter->names);
+    g_ptr_array_unref (filter->patterns);
+    g_free (filter);
+}
+
+/* Check if a user should not be shown based on the user configuration */
+static gboolean
+user_is_hidden (CommonUserList *user_list, const gchar *name, const gchar *shell)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    /* Ignore users disabled by shell */
+    if (shell && name_filter_matches (priv->hidden_shells, shell))
+        return TRUE;
+
+    /* Ignore certain users */
+    return name && name_filter_matches (priv->hidden_users, name);
+}
+
+/* Check if a user still matches their password entry so no update is required */
+static gboolean
+passwd_entry_matches (CommonUser *user, struct passwd *entry)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    if (priv->uid != entry->pw_uid || priv->gid != entry->pw_gid ||
+        g_strcmp0 (priv->home_directory, entry->pw_dir) != 0 ||
+        g_strcmp0 (priv->shell, entry->pw_shell) != 0)
+        return FALSE;
+
+    const gchar *gecos = entry->pw_gecos ? entry->pw_gecos : "";
+    const gchar *end = strchr (gecos, ',');
+    gsize real_name_length = end ? (gsize) (end - gecos) : strlen (gecos);
+    return priv->real_name && strlen (priv->real_name) == real_name_length && strncmp (priv->real_name, gecos, real_name_length) == 0;
+}
+
+static gint64
+get_file_mtime (const gchar *path, goffset *size)
+{
+    GStatBuf stat_buf;
+    if (g_stat (path, &stat_buf) != 0)
+    {
+        if (size)
+            *size = -1;
+        return 0;
+    }
+
+    if (size)
+        *size = stat_buf.st_size;
+    return (gint64) stat_buf.st_mtim.tv_sec * G_USEC_PER_SEC + stat_buf.st_mtim.tv_nsec / 1000;
+}
+
+/* Loads the user configuration, returns TRUE if it has changed since last loaded */
+static gboolean
+load_user_config (CommonUserList *user_list)
 {
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
+    gint64 mtime = get_file_mtime (USER_CONFIG_FILE, NULL);
+    if (priv->have_user_config && mtime == priv->user_config_mtime)
+        return FALSE;
+    priv->have_user_config = TRUE;
+    priv->user_config_mtime = mtime;
+
     g_debug ("Loading user config from %s", USER_CONFIG_FILE);
 
     g_autoptr(GKeyFile) config = g_key_file_new ();
@@ -332,82 +662,134 @@ load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
     if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
         g_warning ("Failed to load configuration from %s: %s", USER_CONFIG_FILE, error->message);
 
-    gint minimum_uid = 500;
+    priv->minimum_uid = 500;
     if (g_key_file_has_key (config, "UserList", "minimum-uid", NULL))
-        minimum_uid = g_key_file_get_integer (config, "UserList", "minimum-uid", NULL);
+        priv->minimum_uid = g_key_file_get_integer (config, "UserList", "minimum-uid", NULL);
 
     g_autofree gchar *hidden_users_list = g_key_file_get_string (config, "UserList", "hidden-users", NULL);
     if (!hidden_users_list)
         hidden_users_list = g_strdup ("nobody nobody4 noaccess");
-    g_auto(GStrv) hidden_users = g_strsplit (hidden_users_list, " ", -1);
+    g_clear_pointer (&priv->hidden_users, name_filter_free);
+    priv->hidden_users = name_filter_new (hidden_users_list);
 
     g_autofree gchar *hidden_shells_list = g_key_file_get_string (config, "UserList", "hidden-shells", NULL);
     if (!hidden_shells_list)
         hidden_shells_list = g_strdup ("/bin/false /usr/sbin/nologin");
-    g_auto(GStrv) hidden_shells = g_strsplit (hidden_shells_list, " ", -1);
+    g_clear_pointer (&priv->hidden_shells, name_filter_free);
+    priv->hidden_shells = name_filter_new (hidden_shells_list);
+
+    priv->filter_accounts_service = g_key_file_get_boolean (config, "UserList", "filter-accounts-service", NULL);
+
+    return TRUE;
+}
+
+/* Records the state of the password file, returns TRUE if it has changed since last recorded */
+static gboolean
+update_passwd_state (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    goffset size;
+    gint64 mtime = get_file_mtime (PASSWD_FILE, &size);
+    if (priv->passwd_checksum && mtime == priv->passwd_mtime && size == priv->passwd_size)
+        return FALSE;
+    priv->passwd_mtime = mtime;
+    priv->passwd_size = size;
+
+    g_autofree gchar *data = NULL;
+    gsize data_length = 0;
+    g_file_get_contents (PASSWD_FILE, &data, &data_length, NULL);
+    g_autofree gchar *checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) (data ? data : ""), data_length);
+    if (g_strcmp0 (checksum, priv->passwd_checksum) == 0)
+        return FALSE;
+
+    g_free (priv->passwd_checksum);
+    priv->passwd_checksum = g_steal_pointer (&checksum);
+
+    return TRUE;
+}
+
+/* Have cached images checked again when next asked for, the home directory is
+ * only searched if it has been modified since the image was found */
+static void
+invalidate_images (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    for (GList *link = priv->users; link; link = link->next)
+        GET_USER_PRIVATE (link->data)->image_check = TRUE;
+}
 
-    setpwent ();
+static void
+apply_passwd_entries (CommonUserList *user_list, GPtrArray *entries, gboolean emit_add_signal)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    gint64 start_time = g_get_monotonic_time ();
 
     GList *users = NULL, *new_users = NULL, *changed_users = NULL;
-    while (TRUE)
+    g_autoptr(GHashTable) users_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (guint i = 0; i < entries->len; i++)
     {
-        errno = 0;
-        struct passwd *entry = getpwent ();
-        if (!entry)
-            break;
+        struct passwd *entry = g_ptr_array_index (entries, i);
 
         /* Ignore system users */
-        if (entry->pw_uid < minimum_uid)
+        if (entry->pw_uid < priv->minimum_uid)
             continue;
 
-        /* Ignore users disabled by shell */
-        if (entry->pw_shell)
-        {
-            int i;
-            for (i = 0; hidden_shells[i] && strcmp (entry->pw_shell, hidden_shells[i]) != 0; i++);
-            if (hidden_shells[i])
-                continue;
-        }
+        /* Ignore hidden users */
+        if (user_is_hidden (user_list, entry->pw_name, entry->pw_shell))
+            continue;
 
-        /* Ignore certain users */
-        int i;
-        for (i = 0; hidden_users[i] && strcmp (entry->pw_name, hidden_users[i]) != 0; i++);
-        if (hidden_users[i])
+        /* Ignore duplicate entries, the first one wins as with getpwnam */
+        if (g_hash_table_contains (users_by_name, entry->pw_name))
             continue;
 
+        /* Keep existing users that haven't changed */
+        CommonUser *info = get_user_by_name (user_list, entry->pw_name);
+        if (info && passwd_entry_matches (info, entry))
+        {
+            GET_USER_PRIVATE (info)->from_snapshot = FALSE;
+            g_hash_table_insert (users_by_name, g_strdup (entry->pw_name), info);
+            users = g_list_prepend (users, info);
+            continue;
+        }
+
         CommonUser *user = make_passwd_user (user_list, entry);
 
         /* Update existing users if have them */
-        GList *link;
-        for (link = priv->users; link; link = link->next)
+        if (info)
         {
-            CommonUser *info = link->data;
-            if (strcmp (common_user_get_name (info), common_user_get_name (user)) == 0)
-            {
-                if (update_passwd_user (info, common_user_get_real_name (user), common_user_get_home_directory (user), common_user_get_shell (user), common_user_get_image (user)))
-                    changed_users = g_list_insert_sorted (changed_users, info, compare_user);
-                g_object_unref (user);
-                user = info;
-                break;
-            }
+            GET_USER_PRIVATE (info)->from_snapshot = FALSE;
+            if (update_passwd_user (info, common_user_get_real_name (user), common_user_get_home_directory (user), common_user_get_shell (user)))
+                changed_users = g_list_prepend (changed_users, info);
+            g_object_unref (user);
+            user = info;
         }
-        if (!link)
+        else
         {
             /* Only notify once we have loaded the user list */
             if (priv->have_users)
-                new_users = g_list_insert_sorted (new_users, user, compare_user);
+                new_users = g_list_prepend (new_users, user);
         }
-        users = g_list_insert_sorted (users, user, compare_user);
+        g_hash_table_insert (users_by_name, g_strdup (common_user_get_name (user)), user);
+        users = g_list_prepend (users, user);
     }
 
-    if (errno != 0)
-        g_warning ("Failed to read password database: %s", strerror (errno));
-
-    endpwent ();
+    /* Sort once rather than on every insert */
+    users = g_list_sort (users, compare_user);
+    new_users = g_list_sort (new_users, compare_user);
+    changed_users = g_list_sort (changed_users, compare_user);
 
     /* Use new user list */
     GList *old_users = priv->users;
     priv->users = users;
+    g_hash_table_unref (priv->users_by_name);
+    priv->users_by_name = g_steal_pointer (&users_by_name);
+
+    /* Images are only looked for again when the user list has changed */
+    if (new_users || changed_users || g_list_length (old_users) != g_list_length (priv->users))
+        invalidate_images (user_list);
 
     /* Notify of changes */
     for (GList *link = new_users; link; link = link->next)
@@ -416,7 +798,7 @@ load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
         g_debug ("User %s added", common_user_get_name (info));
         g_signal_connect (info, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), user_list);
         if (emit_add_signal)
-            g_signal_emit (user_list, list_signals[USER_ADDED], 0, info);
+            emit_user_signal (user_list, USER_ADDED, USERS_ADDED, info);
     }
     g_list_free (new_users);
     for (GList *link = changed_users; link; link = link->next)
@@ -428,91 +810,207 @@ load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
     g_list_free (changed_users);
     for (GList *link = old_users; link; link = link->next)
     {
+        CommonUser *info = link->data;
+
         /* See if this user is in the current list */
-        GList *new_link;
-        for (new_link = priv->users; new_link; new_link = new_link->next)
-        {
-            if (new_link->data == link->data)
-                break;
-        }
+        if (get_user_by_name (user_list, common_user_get_name (info)) == info)
+            continue;
 
-        if (!new_link)
-        {
-            CommonUser *info = link->data;
-            g_debug ("User %s removed", common_user_get_name (info));
-            g_signal_emit (user_list, list_signals[USER_REMOVED], 0, info);
-            g_object_unref (info);
-        }
+        g_debug ("User %s removed", common_user_get_name (info));
+        emit_user_signal (user_list, USER_REMOVED, USERS_REMOVED, info);
+        g_object_unref (info);
     }
     g_list_free (old_users);
+
+    common_metrics_observe_since ("lightdm_user_list_load_duration_seconds", "phase=\"passwd-parse\"", start_time);
 }
 
 static void
-passwd_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, CommonUserList *user_list)
+load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
 {
-    if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
-    {
-        g_debug ("%s changed, reloading user list", g_file_get_path (file));
-        load_passwd_file (user_list, TRUE);
-    }
+    g_autoptr(GPtrArray) entries = common_nss_get_all_users ();
+    apply_passwd_entries (user_list, entries, emit_add_signal);
 }
 
-static gboolean load_accounts_user (CommonUser *user);
-
 static void
-accounts_user_changed_cb (GDBusConnection *connection,
-                          const gchar *sender_name,
-                          const gchar *object_path,
-                          const gchar *interface_name,
-                          const gchar *signal_name,
-                          GVariant *parameters,
-                          gpointer data)
+passwd_reloaded_cb (GObject *object, GAsyncResult *result, gpointer data)
 {
-    CommonUser *user = data;
-    /*CommonUserPrivate *priv = GET_USER_PRIVATE (user);*/
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) entries = common_nss_get_all_users_finish (result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
 
-    /* Log message disabled as AccountsService can have arbitrary plugins that
-     * might cause us to log when properties change we don't use. LP: #1376357
-     */
-    /*g_debug ("User %s changed", priv->path);*/
-    if (load_accounts_user (user))
-        g_signal_emit (user, user_signals[CHANGED], 0);
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    g_clear_object (&priv->passwd_reload_cancellable);
+    if (entries)
+        apply_passwd_entries (user_list, entries, TRUE);
 }
 
 static gboolean
-load_accounts_user (CommonUser *user)
+passwd_reload_cb (gpointer data)
 {
-    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
-    /* Get the properties for this user */
-    if (!priv->changed_signal)
-        priv->changed_signal = g_dbus_connection_signal_subscribe (priv->bus,
-                                                                   "org.freedesktop.Accounts",
-                                                                   "org.freedesktop.Accounts.User",
-                                                                   "Changed",
-                                                                   priv->path,
-                                                                   NULL,
-                                                                   G_DBUS_SIGNAL_FLAGS_NONE,
-                                                                   accounts_user_changed_cb,
-                                                                   user,
-                                                                   NULL);
+    priv->passwd_reload_timeout = 0;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
-                                                              "org.freedesktop.Accounts",
-                                                              priv->path,
-                                                              "org.freedesktop.DBus.Properties",
-                                                              "GetAll",
-                                                              g_variant_new ("(s)", "org.freedesktop.Accounts.User"),
-                                                              G_VARIANT_TYPE ("(a{sv})"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error updating user %s: %s", priv->path, error->message);
-    if (!result)
-        return FALSE;
+    gboolean config_changed = load_user_config (user_list);
+    if (!update_passwd_state (user_list) && !config_changed)
+    {
+        g_debug ("%s unchanged, not reloading user list", PASSWD_FILE);
+        return G_SOURCE_REMOVE;
+    }
+
+    /* Read the new entries without blocking the main loop on the name service */
+    g_debug ("%s changed, reloading user list", PASSWD_FILE);
+    common_nss_clear_cache ();
+    if (priv->passwd_reload_cancellable)
+        g_cancellable_cancel (priv->passwd_reload_cancellable);
+    g_clear_object (&priv->passwd_reload_cancellable);
+    priv->passwd_reload_cancellable = g_cancellable_new ();
+    common_nss_get_all_users_async (priv->passwd_reload_cancellable, passwd_reloaded_cb, user_list);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+passwd_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event_type != G_FILE_MONITOR_EVENT_CREATED)
+        return;
+
+    /* Wait for the file to stop changing before reloading */
+    if (priv->passwd_reload_timeout)
+        g_source_remove (priv->passwd_reload_timeout);
+    priv->passwd_reload_timeout = g_timeout_add (PASSWD_RELOAD_DELAY_MS, passwd_reload_cb, user_list);
+}
+
+static gboolean load_accounts_user (CommonUser *user);
+
+/* Load the properties of a user that has changed, returns TRUE if still a login user */
+static gboolean
+update_stale_user (CommonUser *user)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    if (!priv->stale)
+        return TRUE;
+    priv->stale = FALSE;
+
+    return load_accounts_user (user);
+}
+
+static gboolean
+stale_users_cb (gpointer data)
+{
+    stale_users_idle = 0;
+
+    GList *users = g_list_reverse (stale_users);
+    stale_users = NULL;
+    for (GList *link = users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        if (update_stale_user (user))
+            g_signal_emit (user, user_signals[CHANGED], 0);
+    }
+    g_list_free_full (users, g_object_unref);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+accounts_user_changed_cb (GDBusConnection *connection,
+                          const gchar *sender_name,
+                          const gchar *object_path,
+                          const gchar *interface_name,
+                          const gchar *signal_name,
+                          GVariant *parameters,
+                          gpointer data)
+{
+    /* Log message disabled as AccountsService can have arbitrary plugins that
+     * might cause us to log when properties change we don't use. LP: #1376357
+     */
+    /*g_debug ("User %s changed", object_path);*/
+
+    /* Load the changes from an idle so bursts of changes are loaded once.
+     * Users that are read before then are loaded straight away */
+    for (GList *link = g_hash_table_lookup (watched_users, object_path); link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+        if (priv->stale)
+            continue;
+        priv->stale = TRUE;
+        stale_users = g_list_prepend (stale_users, g_object_ref (user));
+    }
+
+    if (stale_users && !stale_users_idle)
+        stale_users_idle = g_idle_add (stale_users_cb, NULL);
+}
+
+static void
+subscribe_accounts_user (CommonUser *user)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    if (priv->watching_changes)
+        return;
+    priv->watching_changes = TRUE;
+
+    /* Use one match rule for all users rather than one per user */
+    if (!watched_users)
+    {
+        watched_users = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        watched_users_bus = g_object_ref (priv->bus);
+        watched_users_changed_signal = g_dbus_connection_signal_subscribe (watched_users_bus,
+                                                                           "org.freedesktop.Accounts",
+                                                                           "org.freedesktop.Accounts.User",
+                                                                           "Changed",
+                                                                           NULL,
+                                                                           NULL,
+                                                                           G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                           accounts_user_changed_cb,
+                                                                           NULL,
+                                                                           NULL);
+    }
+
+    GList *users = g_hash_table_lookup (watched_users, priv->path);
+    g_hash_table_insert (watched_users, g_strdup (priv->path), g_list_prepend (users, user));
+}
+
+static void
+unsubscribe_accounts_user (CommonUser *user)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    if (!priv->watching_changes)
+        return;
+    priv->watching_changes = FALSE;
+
+    GList *users = g_list_remove (g_hash_table_lookup (watched_users, priv->path), user);
+    if (users)
+        g_hash_table_insert (watched_users, g_strdup (priv->path), users);
+    else
+        g_hash_table_remove (watched_users, priv->path);
+
+    if (g_hash_table_size (watched_users) == 0)
+    {
+        g_dbus_connection_signal_unsubscribe (watched_users_bus, watched_users_changed_signal);
+        watched_users_changed_signal = 0;
+        g_clear_object (&watched_users_bus);
+        g_clear_pointer (&watched_users, g_hash_table_unref);
+    }
+}
+
+/* Stores the org.freedesktop.Accounts.User properties, returns FALSE if this is a system account */
+static gboolean
+update_accounts_user_properties (CommonUser *user, GVariant *result)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
 
     /* Store the properties we need */
     g_autoptr(GVariantIter) iter = NULL;
@@ -539,16 +1037,13 @@ load_accounts_user (CommonUser *user)
         }
         else if (strcmp (name, "Shell") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
-            g_free (priv->shell);
-            priv->shell = g_variant_dup_string (value, NULL);
+            priv->shell = intern_string (g_variant_get_string (value, NULL));
         }
         else if (strcmp (name, "SystemAccount") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
             system_account = g_variant_get_boolean (value);
         else if (strcmp (name, "Language") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
-            if (priv->language)
-                g_free (priv->language);
-            priv->language = g_variant_dup_string (value, NULL);
+            priv->language = intern_string (g_variant_get_string (value, NULL));
         }
         else if (strcmp (name, "IconFile") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
@@ -559,8 +1054,7 @@ load_accounts_user (CommonUser *user)
         }
         else if (strcmp (name, "XSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
-            g_free (priv->session);
-            priv->session = g_variant_dup_string (value, NULL);
+            priv->session = intern_string (g_variant_get_string (value, NULL));
         }
         else if (strcmp (name, "Uid") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
             priv->uid = g_variant_get_uint64 (value);
@@ -568,6 +1062,65 @@ load_accounts_user (CommonUser *user)
             priv->is_locked = g_variant_get_boolean (value);
     }
 
+    return !system_account;
+}
+
+/* Stores the org.freedesktop.DisplayManager.AccountsService properties */
+static void
+update_accounts_user_extra_properties (CommonUser *user, GVariant *result)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get (result, "(a{sv})", &iter);
+    const gchar *name;
+    GVariant *value;
+    while (g_variant_iter_loop (iter, "{&sv}", &name, &value))
+    {
+        if (strcmp (name, "BackgroundFile") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+        {
+            g_free (priv->background);
+            priv->background = g_variant_dup_string (value, NULL);
+            if (strcmp (priv->background, "") == 0)
+                g_clear_pointer (&priv->background, g_free);
+        }
+        else if (strcmp (name, "HasMessages") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            priv->has_messages = g_variant_get_boolean (value);
+        else if (strcmp (name, "KeyboardLayouts") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
+        {
+            g_autofree const gchar **layouts = g_variant_get_strv (value, NULL);
+            set_layouts (priv, layouts);
+        }
+    }
+}
+
+static gboolean
+load_accounts_user (CommonUser *user)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    subscribe_accounts_user (user);
+
+    /* Get the properties for this user */
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
+                                                              "org.freedesktop.Accounts",
+                                                              priv->path,
+                                                              "org.freedesktop.DBus.Properties",
+                                                              "GetAll",
+                                                              g_variant_new ("(s)", "org.freedesktop.Accounts.User"),
+                                                              G_VARIANT_TYPE ("(a{sv})"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (error)
+        g_warning ("Error updating user %s: %s", priv->path, error->message);
+    if (!result)
+        return FALSE;
+
+    gboolean is_login_user = update_accounts_user_properties (user, result);
+
     g_autoptr(GVariant) extra_result = g_dbus_connection_call_sync (priv->bus,
                                                                     "org.freedesktop.Accounts",
                                                                     priv->path,
@@ -581,37 +1134,26 @@ load_accounts_user (CommonUser *user)
                                                                     &error);
     if (error)
         g_warning ("Error updating user %s: %s", priv->path, error->message);
-    if (extra_result) {
-        g_autoptr(GVariantIter) extra_iter = NULL;
+    if (extra_result)
+        update_accounts_user_extra_properties (user, extra_result);
 
-        g_variant_get (extra_result, "(a{sv})", &extra_iter);
-        while (g_variant_iter_loop (extra_iter, "{&sv}", &name, &value))
-        {
-            if (strcmp (name, "BackgroundFile") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
-            {
-                g_free (priv->background);
-                priv->background = g_variant_dup_string (value, NULL);
-                if (strcmp (priv->background, "") == 0)
-                    g_clear_pointer (&priv->background, g_free);
-            }
-            else if (strcmp (name, "HasMessages") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-                priv->has_messages = g_variant_get_boolean (value);
-            else if (strcmp (name, "KeyboardLayouts") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
-            {
-                g_strfreev (priv->layouts);
-                priv->layouts = g_variant_dup_strv (value, NULL);
-                if (!priv->layouts)
-                {
-                    priv->layouts = g_malloc (sizeof (gchar *) * 1);
-                    priv->layouts[0] = NULL;
-                }
-            }
-        }
-    }
+    return is_login_user;
+}
 
-    return !system_account;
+/* Check if an accounts service user is hidden by the user configuration */
+static gboolean
+accounts_user_is_hidden (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    CommonUserPrivate *user_priv = GET_USER_PRIVATE (user);
+
+    if (!priv->filter_accounts_service)
+        return FALSE;
+
+    return user_is_hidden (user_list, user_priv->name, user_priv->shell);
 }
 
+/* If emit_signal is not set the user is prepended and the caller must sort the list */
 static void
 add_accounts_user (CommonUserList *user_list, const gchar *path, gboolean emit_signal)
 {
@@ -624,12 +1166,16 @@ add_accounts_user (CommonUserList *user_list, const gchar *path, gboolean emit_s
     priv->bus = g_object_ref (list_priv->bus);
     priv->path = g_strdup (path);
     g_signal_connect (user, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), user_list);
-    g_signal_connect (user, "get-logged-in", G_CALLBACK (get_logged_in_cb), user_list);
-    if (load_accounts_user (user))
+    if (load_accounts_user (user) && !accounts_user_is_hidden (user_list, user))
     {
-        list_priv->users = g_list_insert_sorted (list_priv->users, user, compare_user);
+        index_user (user_list, user);
         if (emit_signal)
-            g_signal_emit (user_list, list_signals[USER_ADDED], 0, user);
+        {
+            list_priv->users = g_list_insert_sorted (list_priv->users, user, compare_user);
+            emit_user_signal (user_list, USER_ADDED, USERS_ADDED, user);
+        }
+        else
+            list_priv->users = g_list_prepend (list_priv->users, user);
     }
     else
         g_object_unref (user);
@@ -682,19 +1228,43 @@ accounts_user_deleted_cb (GDBusConnection *connection,
     const gchar *path;
     g_variant_get (parameters, "(&o)", &path);
 
+    /* Stop any load in progress */
+    g_hash_table_remove (priv->loading_users, path);
+
     /* Delete user if we know of them */
     CommonUser *user = get_user_by_path (user_list, path);
     if (user)
     {
         g_debug ("User %s deleted", path);
         priv->users = g_list_remove (priv->users, user);
+        unindex_user (user_list, user);
 
-        g_signal_emit (user_list, list_signals[USER_REMOVED], 0, user);
+        emit_user_signal (user_list, USER_REMOVED, USERS_REMOVED, user);
 
         g_object_unref (user);
     }
 }
 
+static CommonSession *
+add_session (CommonUserList *user_list, const gchar *path, const gchar *username)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (g_hash_table_contains (priv->sessions, path))
+        return NULL;
+
+    g_debug ("Loaded session %s (%s)", path, username);
+    CommonSession *session = g_object_new (common_session_get_type (), NULL);
+    session->username = g_strdup (username);
+    session->path = g_strdup (path);
+    g_hash_table_insert (priv->sessions, session->path, session);
+
+    guint count = GPOINTER_TO_UINT (g_hash_table_lookup (priv->session_counts, username));
+    g_hash_table_insert (priv->session_counts, g_strdup (username), GUINT_TO_POINTER (count + 1));
+
+    return session;
+}
+
 static CommonSession *
 load_session (CommonUserList *user_list, const gchar *path)
 {
@@ -725,13 +1295,7 @@ load_session (CommonUserList *user_list, const gchar *path)
     const gchar *name;
     g_variant_get (username, "&s", &name);
 
-    g_debug ("Loaded session %s (%s)", path, name);
-    CommonSession *session = g_object_new (common_session_get_type (), NULL);
-    session->username = g_strdup (name);
-    session->path = g_strdup (path);
-    priv->sessions = g_list_append (priv->sessions, session);
-
-    return session;
+    return add_session (user_list, path, name);
 }
 
 static void
@@ -783,20 +1347,64 @@ session_removed_cb (GDBusConnection *connection,
     const gchar *path;
     g_variant_get (parameters, "(&o)", &path);
 
-    for (GList *link = priv->sessions; link; link = link->next)
+    CommonSession *session = g_hash_table_lookup (priv->sessions, path);
+    if (!session)
+        return;
+
+    g_debug ("Session %s removed", path);
+    g_hash_table_steal (priv->sessions, path);
+
+    guint count = GPOINTER_TO_UINT (g_hash_table_lookup (priv->session_counts, session->username));
+    if (count > 1)
+        g_hash_table_insert (priv->session_counts, g_strdup (session->username), GUINT_TO_POINTER (count - 1));
+    else
+        g_hash_table_remove (priv->session_counts, session->username);
+
+    CommonUser *user = get_user_by_name (user_list, session->username);
+    if (user)
+        g_signal_emit (user, user_signals[CHANGED], 0);
+    g_object_unref (session);
+}
+
+/* Get the users of all sessions in one call, returns FALSE if the daemon doesn't support this */
+static gboolean
+load_session_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
+                                                              "org.freedesktop.DisplayManager",
+                                                              "/org/freedesktop/DisplayManager",
+                                                              "org.freedesktop.DBus.Properties",
+                                                              "Get",
+                                                              g_variant_new ("(ss)", "org.freedesktop.DisplayManager", "SessionUsers"),
+                                                              G_VARIANT_TYPE ("(v)"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (error)
+        g_debug ("Unable to get session users from org.freedesktop.DisplayManager: %s", error->message);
+    if (!result)
+        return FALSE;
+
+    g_autoptr(GVariant) value = NULL;
+    g_variant_get (result, "(v)", &value);
+    if (!g_variant_is_of_type (value, G_VARIANT_TYPE ("a{os}")))
     {
-        CommonSession *session = link->data;
-        if (strcmp (session->path, path) == 0)
-        {
-            g_debug ("Session %s removed", path);
-            priv->sessions = g_list_delete_link (priv->sessions, link);
-            CommonUser *user = get_user_by_name (user_list, session->username);
-            if (user)
-                g_signal_emit (user, user_signals[CHANGED], 0);
-            g_object_unref (session);
-            break;
-        }
+        g_warning ("Unexpected type from org.freedesktop.DisplayManager.SessionUsers: %s", g_variant_get_type_string (value));
+        return FALSE;
     }
+
+    g_debug ("Loading sessions from org.freedesktop.DisplayManager");
+    GVariantIter iter;
+    g_variant_iter_init (&iter, value);
+    const gchar *path, *username;
+    while (g_variant_iter_loop (&iter, "{&o&s}", &path, &username))
+        add_session (user_list, path, username);
+
+    return TRUE;
 }
 
 static void
@@ -825,6 +1433,10 @@ load_sessions (CommonUserList *user_list)
                                                                        user_list,
                                                                        NULL);
 
+    if (load_session_users (user_list))
+        return;
+
+    /* Fall back to asking each session for its user */
     g_autoptr(GError) error = NULL;
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
                                                               "org.freedesktop.DisplayManager",
@@ -859,15 +1471,10 @@ load_sessions (CommonUserList *user_list)
 }
 
 static void
-load_users (CommonUserList *user_list)
+subscribe_accounts (CommonUserList *user_list)
 {
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
-    if (priv->have_users)
-        return;
-    priv->have_users = TRUE;
-
-    /* Get user list from accounts service and fall back to /etc/passwd if that fails */
     priv->user_added_signal = g_dbus_connection_signal_subscribe (priv->bus,
                                                                   "org.freedesktop.Accounts",
                                                                   "org.freedesktop.Accounts",
@@ -888,6 +1495,48 @@ load_users (CommonUserList *user_list)
                                                                     accounts_user_deleted_cb,
                                                                     user_list,
                                                                     NULL);
+}
+
+static void
+load_passwd_users (CommonUserList *user_list, gboolean emit_add_signal)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->user_added_signal)
+        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
+    priv->user_added_signal = 0;
+    if (priv->user_removed_signal)
+        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_removed_signal);
+    priv->user_removed_signal = 0;
+
+    load_user_config (user_list);
+    update_passwd_state (user_list);
+    load_passwd_file (user_list, emit_add_signal);
+
+    /* Watch for changes to user list */
+    g_autoptr(GFile) passwd_file = g_file_new_for_path (PASSWD_FILE);
+    g_autoptr(GError) e = NULL;
+    priv->passwd_monitor = g_file_monitor (passwd_file, G_FILE_MONITOR_NONE, NULL, &e);
+    if (e)
+        g_warning ("Error monitoring %s: %s", PASSWD_FILE, e->message);
+    else
+        g_signal_connect (priv->passwd_monitor, "changed", G_CALLBACK (passwd_changed_cb), user_list);
+}
+
+static void
+load_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->have_users)
+        return;
+    priv->have_users = TRUE;
+    priv->load_start_time = g_get_monotonic_time ();
+
+    load_user_config (user_list);
+
+    /* Get user list from accounts service and fall back to /etc/passwd if that fails */
+    subscribe_accounts (user_list);
 
     g_autoptr(GError) error = NULL;
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
@@ -911,32 +1560,478 @@ load_users (CommonUserList *user_list)
         const gchar *path;
         while (g_variant_iter_loop (iter, "&o", &path))
             add_accounts_user (user_list, path, FALSE);
+        priv->users = g_list_sort (priv->users, compare_user);
     }
     else
+        load_passwd_users (user_list, FALSE);
+
+    priv->users_loaded = TRUE;
+    common_metrics_observe_since ("lightdm_user_list_load_duration_seconds", "phase=\"initial-load\"", priv->load_start_time);
+}
+
+static void
+finish_loading_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    /* Remove snapshot users that no longer exist */
+    GList *link = priv->users;
+    while (link)
     {
-        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
-        priv->user_added_signal = 0;
-        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_removed_signal);
-        priv->user_removed_signal = 0;
+        GList *next = link->next;
+        CommonUser *user = link->data;
 
-        load_passwd_file (user_list, FALSE);
+        if (GET_USER_PRIVATE (user)->from_snapshot)
+        {
+            g_debug ("User %s removed", common_user_get_name (user));
+            priv->users = g_list_delete_link (priv->users, link);
+            unindex_user (user_list, user);
+            emit_user_signal (user_list, USER_REMOVED, USERS_REMOVED, user);
+            g_object_unref (user);
+        }
 
-        /* Watch for changes to user list */
-        g_autoptr(GFile) passwd_file = g_file_new_for_path (PASSWD_FILE);
-        g_autoptr(GError) e = NULL;
-        priv->passwd_monitor = g_file_monitor (passwd_file, G_FILE_MONITOR_NONE, NULL, &e);
-        if (e)
-            g_warning ("Error monitoring %s: %s", PASSWD_FILE, e->message);
-        else
-            g_signal_connect (priv->passwd_monitor, "changed", G_CALLBACK (passwd_changed_cb), user_list);
+        link = next;
     }
+
+    g_debug ("Loaded %u users", g_list_length (priv->users));
+    priv->users_loaded = TRUE;
+    common_metrics_observe_since ("lightdm_user_list_load_duration_seconds", "phase=\"initial-load\"", priv->load_start_time);
+
+    /* Everything loaded is reported before saying loading is done */
+    flush_pending_users (user_list);
+    g_signal_emit (user_list, list_signals[USERS_LOADED], 0);
 }
 
-/**
- * common_user_list_get_length:
- * @user_list: a #CommonUserList
- *
- * Return value: The number of users able to log in
+static void
+swap_pointers (gpointer *a, gpointer *b)
+{
+    gpointer t = *a;
+    *a = *b;
+    *b = t;
+}
+
+/* Moves the details of a loaded user into a user from a snapshot, so listeners
+ * see the existing user change rather than a new user */
+static void
+confirm_snapshot_user (CommonUserList *user_list, CommonUser *user, CommonUser *loaded)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+    CommonUserPrivate *loaded_priv = GET_USER_PRIVATE (loaded);
+
+    swap_pointers ((gpointer *) &priv->bus, (gpointer *) &loaded_priv->bus);
+    swap_pointers ((gpointer *) &priv->path, (gpointer *) &loaded_priv->path);
+    swap_pointers ((gpointer *) &priv->real_name, (gpointer *) &loaded_priv->real_name);
+    swap_pointers ((gpointer *) &priv->home_directory, (gpointer *) &loaded_priv->home_directory);
+    priv->shell = loaded_priv->shell;
+    swap_pointers ((gpointer *) &priv->image, (gpointer *) &loaded_priv->image);
+    priv->image_resolved = loaded_priv->image_resolved;
+    priv->image_check = loaded_priv->image_check;
+    priv->image_home_mtime = loaded_priv->image_home_mtime;
+    swap_pointers ((gpointer *) &priv->background, (gpointer *) &loaded_priv->background);
+    priv->language = loaded_priv->language;
+    swap_pointers ((gpointer *) &priv->layouts, (gpointer *) &loaded_priv->layouts);
+    priv->session = loaded_priv->session;
+    priv->has_messages = loaded_priv->has_messages;
+    priv->uid = loaded_priv->uid;
+    priv->gid = loaded_priv->gid;
+    priv->is_locked = loaded_priv->is_locked;
+    priv->from_snapshot = FALSE;
+
+    index_user (user_list, user);
+    subscribe_accounts_user (user);
+    g_signal_emit (user, user_signals[CHANGED], 0);
+}
+
+typedef struct
+{
+    CommonUserList *user_list;
+    CommonUser *user;
+
+    /* Number of property requests still outstanding */
+    gint n_pending;
+
+    /* TRUE if this user can log in */
+    gboolean is_login_user;
+} AccountsUserLoad;
+
+static void
+accounts_user_load_step (AccountsUserLoad *load)
+{
+    load->n_pending--;
+    if (load->n_pending > 0)
+        return;
+
+    CommonUserList *user_list = load->user_list;
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    CommonUser *user = load->user;
+    CommonUserPrivate *user_priv = GET_USER_PRIVATE (user);
+
+    /* Skip users that were deleted or have been added some other way while loading */
+    gboolean still_loading = g_hash_table_remove (priv->loading_users, user_priv->path);
+    CommonUser *existing = load->is_login_user ? get_user_by_name (user_list, user_priv->name) : NULL;
+    if (still_loading && existing && GET_USER_PRIVATE (existing)->from_snapshot)
+        confirm_snapshot_user (user_list, existing, user);
+    else if (load->is_login_user && still_loading && !get_user_by_path (user_list, user_priv->path))
+    {
+        g_debug ("User %s added", user_priv->path);
+        subscribe_accounts_user (user);
+        g_signal_connect (user, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), user_list);
+        index_user (user_list, user);
+        priv->users = g_list_insert_sorted (priv->users, g_object_ref (user), compare_user);
+        emit_user_signal (user_list, USER_ADDED, USERS_ADDED, user);
+    }
+
+    priv->n_loading_users--;
+    if (priv->n_loading_users == 0)
+        finish_loading_users (user_list);
+
+    g_object_unref (load->user);
+    g_object_unref (load->user_list);
+    g_free (load);
+}
+
+static void
+accounts_user_properties_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    AccountsUserLoad *load = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) properties = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (error)
+        g_warning ("Error updating user %s: %s", GET_USER_PRIVATE (load->user)->path, error->message);
+    if (properties)
+        load->is_login_user = update_accounts_user_properties (load->user, properties) && !accounts_user_is_hidden (load->user_list, load->user);
+
+    accounts_user_load_step (load);
+}
+
+static void
+accounts_user_extra_properties_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    AccountsUserLoad *load = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) properties = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (error)
+        g_warning ("Error updating user %s: %s", GET_USER_PRIVATE (load->user)->path, error->message);
+    if (properties)
+        update_accounts_user_extra_properties (load->user, properties);
+
+    accounts_user_load_step (load);
+}
+
+static void
+load_accounts_user_async (CommonUserList *user_list, const gchar *path)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
+    CommonUserPrivate *user_priv = GET_USER_PRIVATE (user);
+    user_priv->bus = g_object_ref (priv->bus);
+    user_priv->path = g_strdup (path);
+
+    AccountsUserLoad *load = g_malloc0 (sizeof (AccountsUserLoad));
+    load->user_list = g_object_ref (user_list);
+    load->user = user;
+    load->n_pending = 2;
+
+    g_hash_table_add (priv->loading_users, g_strdup (path));
+    priv->n_loading_users++;
+
+    /* Request both property sets at once, they can be answered in any order */
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.Accounts",
+                            path,
+                            "org.freedesktop.DBus.Properties",
+                            "GetAll",
+                            g_variant_new ("(s)", "org.freedesktop.Accounts.User"),
+                            G_VARIANT_TYPE ("(a{sv})"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            accounts_user_properties_cb,
+                            load);
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.Accounts",
+                            path,
+                            "org.freedesktop.DBus.Properties",
+                            "GetAll",
+                            g_variant_new ("(s)", "org.freedesktop.DisplayManager.AccountsService"),
+                            G_VARIANT_TYPE ("(a{sv})"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            accounts_user_extra_properties_cb,
+                            load);
+}
+
+static void
+list_cached_users_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) users = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (error)
+        g_warning ("Error getting user list from org.freedesktop.Accounts: %s", error->message);
+    if (users)
+    {
+        g_debug ("Loading users from org.freedesktop.Accounts");
+        g_autoptr(GVariantIter) iter = NULL;
+        g_variant_get (users, "(ao)", &iter);
+        const gchar *path;
+        while (g_variant_iter_loop (iter, "&o", &path))
+            load_accounts_user_async (user_list, path);
+        if (priv->n_loading_users == 0)
+            finish_loading_users (user_list);
+    }
+    else
+    {
+        load_passwd_users (user_list, TRUE);
+        finish_loading_users (user_list);
+    }
+
+    g_object_unref (user_list);
+}
+
+static gboolean
+load_passwd_users_cb (gpointer data)
+{
+    CommonUserList *user_list = data;
+
+    load_passwd_users (user_list, TRUE);
+    finish_loading_users (user_list);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * common_user_list_load_async:
+ * @user_list: A #CommonUserList
+ *
+ * Start loading the user list without blocking.  Users are added to the list
+ * (and the ::user-added signal emitted) as their details arrive, and the
+ * ::users-loaded signal is emitted once the list is complete.  Until then the
+ * other functions return the users loaded so far.
+ *
+ * This has no effect if the users have already been loaded.
+ **/
+void
+common_user_list_load_async (CommonUserList *user_list)
+{
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->have_users)
+        return;
+    priv->have_users = TRUE;
+    priv->load_start_time = g_get_monotonic_time ();
+
+    load_user_config (user_list);
+
+    /* Without a bus we can only use /etc/passwd, but still report from the main loop */
+    if (!priv->bus)
+    {
+        g_idle_add_full (G_PRIORITY_DEFAULT, load_passwd_users_cb, g_object_ref (user_list), g_object_unref);
+        return;
+    }
+
+    subscribe_accounts (user_list);
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.Accounts",
+                            "/org/freedesktop/Accounts",
+                            "org.freedesktop.Accounts",
+                            "ListCachedUsers",
+                            g_variant_new ("()"),
+                            G_VARIANT_TYPE ("(ao)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            list_cached_users_cb,
+                            g_object_ref (user_list));
+}
+
+/**
+ * common_user_list_get_is_loaded:
+ * @user_list: A #CommonUserList
+ *
+ * Check if all users have been loaded.
+ *
+ * Return value: #TRUE if the user list is complete.
+ **/
+gboolean
+common_user_list_get_is_loaded (CommonUserList *user_list)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), FALSE);
+    return GET_LIST_PRIVATE (user_list)->users_loaded;
+}
+
+static const gchar *
+null_to_empty (const gchar *value)
+{
+    return value ? value : "";
+}
+
+static gchar *
+empty_to_null (const gchar *value)
+{
+    return value[0] != '\0' ? g_strdup (value) : NULL;
+}
+
+/**
+ * common_user_list_save_snapshot:
+ * @user_list: A #CommonUserList
+ * @path: File to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write the users to a file that can be loaded with
+ * common_user_list_load_snapshot().  Settings that would need a user's home
+ * directory to be read are taken from the .dmrc cache instead.
+ *
+ * Only the users already loaded are written, the users are not looked up.
+ * Call this once common_user_list_get_is_loaded() returns %TRUE.
+ *
+ * Return value: %TRUE if the snapshot was written.
+ **/
+gboolean
+common_user_list_save_snapshot (CommonUserList *user_list, const gchar *path, GError **error)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" SNAPSHOT_USER_TYPE));
+    for (GList *link = GET_LIST_PRIVATE (user_list)->users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+        g_autofree gchar *dmrc_language = NULL;
+        g_autofree gchar *dmrc_session = NULL;
+        g_auto(GStrv) dmrc_layouts = NULL;
+        const gchar *language = priv->language, *session = priv->session;
+        const gchar * const *layouts = (const gchar * const *) priv->layouts;
+        if (!priv->path && !priv->loaded_dmrc)
+        {
+            g_autoptr(GKeyFile) dmrc = g_key_file_new ();
+            dmrc_load_from_cache (dmrc, priv->name);
+            language = dmrc_language = g_key_file_get_string (dmrc, "Desktop", "Language", NULL);
+            session = dmrc_session = g_key_file_get_string (dmrc, "Desktop", "Session", NULL);
+            dmrc_layouts = g_malloc0 (sizeof (gchar *) * 2);
+            dmrc_layouts[0] = g_key_file_get_string (dmrc, "Desktop", "Layout", NULL);
+            layouts = (const gchar * const *) dmrc_layouts;
+        }
+
+        g_variant_builder_add (&builder, SNAPSHOT_USER_FORMAT,
+                               null_to_empty (priv->name),
+                               null_to_empty (priv->real_name),
+                               null_to_empty (priv->home_directory),
+                               null_to_empty (priv->shell),
+                               null_to_empty (priv->image),
+                               null_to_empty (priv->background),
+                               null_to_empty (language),
+                               layouts,
+                               null_to_empty (session),
+                               priv->uid,
+                               (guint64) common_user_get_gid (user),
+                               priv->has_messages,
+                               priv->is_locked);
+    }
+
+    g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_new ("(u@a" SNAPSHOT_USER_TYPE ")", SNAPSHOT_VERSION, g_variant_builder_end (&builder)));
+    return g_file_set_contents (path, g_variant_get_data (snapshot), g_variant_get_size (snapshot), error);
+}
+
+/**
+ * common_user_list_load_snapshot:
+ * @user_list: A #CommonUserList
+ * @path: File written by common_user_list_save_snapshot()
+ *
+ * Populate the user list from a snapshot.  This must be called before the
+ * users are loaded; the snapshot users are then updated, or removed if they no
+ * longer exist, by the first load.
+ *
+ * Return value: %TRUE if the snapshot was loaded.
+ **/
+gboolean
+common_user_list_load_snapshot (CommonUserList *user_list, const gchar *path)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->have_users || priv->users)
+        return FALSE;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, &error);
+    if (!file)
+    {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Failed to load user list snapshot %s: %s", path, error->message);
+        return FALSE;
+    }
+
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) snapshot = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_TYPE), bytes, FALSE));
+    guint32 version;
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get (snapshot, "(ua" SNAPSHOT_USER_TYPE ")", &version, &iter);
+    if (version != SNAPSHOT_VERSION)
+    {
+        g_debug ("Ignoring user list snapshot %s with version %u", path, version);
+        return FALSE;
+    }
+
+    const gchar *name, *real_name, *home_directory, *shell, *image, *background, *language, *session;
+    gchar **layouts;
+    guint64 uid, gid;
+    gboolean has_messages, is_locked;
+    while (g_variant_iter_loop (iter, "(&s&s&s&s&s&s&s^as&sttbb)",
+                                &name, &real_name, &home_directory, &shell, &image, &background,
+                                &language, &layouts, &session, &uid, &gid, &has_messages, &is_locked))
+    {
+        if (name[0] == '\0' || get_user_by_name (user_list, name))
+            continue;
+
+        CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
+        CommonUserPrivate *user_priv = GET_USER_PRIVATE (user);
+        user_priv->name = g_strdup (name);
+        user_priv->real_name = g_strdup (real_name);
+        user_priv->home_directory = empty_to_null (home_directory);
+        user_priv->shell = shell[0] != '\0' ? g_intern_string (shell) : NULL;
+        user_priv->image = empty_to_null (image);
+        user_priv->image_resolved = TRUE;
+        user_priv->background = empty_to_null (background);
+        user_priv->language = g_intern_string (language);
+        set_layouts (user_priv, (const gchar * const *) layouts);
+        user_priv->session = g_intern_string (session);
+        user_priv->uid = uid;
+        user_priv->gid = gid;
+        user_priv->has_messages = has_messages;
+        user_priv->is_locked = is_locked;
+        user_priv->loaded_dmrc = TRUE;
+        user_priv->from_snapshot = TRUE;
+
+        g_signal_connect (user, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), user_list);
+            index_user (user_list, user);
+        priv->users = g_list_prepend (priv->users, user);
+    }
+    priv->users = g_list_sort (priv->users, compare_user);
+
+    g_debug ("Loaded %u users from snapshot %s", g_list_length (priv->users), path);
+
+    return TRUE;
+}
+
+/**
+ * common_user_list_get_length:
+ * @user_list: a #CommonUserList
+ *
+ * Return value: The number of users able to log in
  **/
 gint
 common_user_list_get_length (CommonUserList *user_list)
@@ -963,38 +2058,259 @@ common_user_list_get_users (CommonUserList *user_list)
     return GET_LIST_PRIVATE (user_list)->users;
 }
 
+static void
+search_entry_free (SearchEntry *entry)
+{
+    g_free (entry->key);
+    g_free (entry);
+}
+
+static gint
+compare_search_entries (gconstpointer a, gconstpointer b)
+{
+    const SearchEntry *entry_a = *((const SearchEntry **) a);
+    const SearchEntry *entry_b = *((const SearchEntry **) b);
+    return strcmp (entry_a->key, entry_b->key);
+}
+
+static void
+add_search_entry (GPtrArray *index, const gchar *text, CommonUser *user)
+{
+    if (!text || text[0] == '\0')
+        return;
+
+    SearchEntry *entry = g_malloc0 (sizeof (SearchEntry));
+    entry->key = g_utf8_casefold (text, -1);
+    entry->user = user;
+    g_ptr_array_add (index, entry);
+}
+
+static void
+invalidate_search_index (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    g_clear_pointer (&priv->search_index, g_ptr_array_unref);
+}
+
+static GPtrArray *
+get_search_index (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->search_index)
+        return priv->search_index;
+
+    /* Sorted by byte value so all keys with the same prefix are next to each other */
+    priv->search_index = g_ptr_array_new_with_free_func ((GDestroyNotify) search_entry_free);
+    for (GList *link = priv->users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        add_search_entry (priv->search_index, common_user_get_name (user), user);
+        if (g_strcmp0 (common_user_get_real_name (user), common_user_get_name (user)) != 0)
+            add_search_entry (priv->search_index, common_user_get_real_name (user), user);
+    }
+    g_ptr_array_sort (priv->search_index, compare_search_entries);
+
+    return priv->search_index;
+}
+
+/**
+ * common_user_list_search:
+ * @user_list: A #CommonUserList
+ * @prefix: Start of the user name or real name to match.
+ * @limit: Maximum number of users to return or 0 for no limit.
+ *
+ * Find the users from common_user_list_get_users() whose user name or
+ * real name starts with @prefix, ignoring case.  Users are returned in
+ * the order of the matching name.
+ *
+ * Return value: (element-type CommonUser) (transfer container): A list of matching #CommonUser.
+ **/
+GList *
+common_user_list_search (CommonUserList *user_list, const gchar *prefix, guint limit)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
+    g_return_val_if_fail (prefix != NULL, NULL);
+
+    load_users (user_list);
+    GPtrArray *index = get_search_index (user_list);
+
+    g_autofree gchar *key = g_utf8_casefold (prefix, -1);
+    size_t key_length = strlen (key);
+
+    /* Find the first entry not before the prefix */
+    guint start = 0, end = index->len;
+    while (start < end)
+    {
+        guint middle = start + (end - start) / 2;
+        SearchEntry *entry = g_ptr_array_index (index, middle);
+        if (strcmp (entry->key, key) < 0)
+            start = middle + 1;
+        else
+            end = middle;
+    }
+
+    /* Users can match on both their names but are only returned once */
+    g_autoptr(GHashTable) found = g_hash_table_new (g_direct_hash, g_direct_equal);
+    GList *users = NULL;
+    guint n_users = 0;
+    for (guint i = start; i < index->len && (limit == 0 || n_users < limit); i++)
+    {
+        SearchEntry *entry = g_ptr_array_index (index, i);
+        if (strncmp (entry->key, key, key_length) != 0)
+            break;
+        if (!g_hash_table_add (found, entry->user))
+            continue;
+        users = g_list_prepend (users, entry->user);
+        n_users++;
+    }
+
+    return g_list_reverse (users);
+}
+
+/**
+ * common_user_list_get_user_by_name:
+ * @user_list: A #CommonUserList
+ * @username: Name of user to get.
+ *
+ * Get infomation about a given user or #NULL if this user doesn't exist.
+ * Includes hidden and system users, unlike the list from
+ * common_user_list_get_users.
+ *
+ * Return value: (transfer full): A #CommonUser entry for the given user.
+ **/
+CommonUser *
+common_user_list_get_user_by_name (CommonUserList *user_list, const gchar *username)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
+    g_return_val_if_fail (username != NULL, NULL);
+
+    load_users (user_list);
+
+    CommonUser *user = get_user_by_name (user_list, username);
+    if (user)
+        return g_object_ref (user);
+
+    /* Sometimes we need to look up users that aren't in AccountsService.
+       Notably we need to look up the user that the greeter runs as, which
+       is usually 'lightdm'. For such cases, we manually create a one-off
+       CommonUser object and pre-seed with passwd info. */
+    g_autoptr(CommonPasswd) entry = common_nss_get_user_by_name (username);
+    if (entry != NULL)
+        return make_passwd_user (user_list, entry);
+
+    return NULL;
+}
+
+static void
+lookup_entry_free (LookupEntry *entry)
+{
+    g_clear_object (&entry->user);
+    g_free (entry);
+}
+
+static gboolean
+lookup_entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    LookupEntry *entry = value;
+    gint64 *now = user_data;
+    return *now >= entry->expiry_time;
+}
+
+/* Get a single user from the accounts service, returns NULL if not known or a system account */
+static CommonUser *
+find_accounts_user (CommonUserList *user_list, const gchar *username)
+{
+    CommonUserListPrivate *list_priv = GET_LIST_PRIVATE (user_list);
+
+    if (!list_priv->bus)
+        return NULL;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (list_priv->bus,
+                                                              "org.freedesktop.Accounts",
+                                                              "/org/freedesktop/Accounts",
+                                                              "org.freedesktop.Accounts",
+                                                              "FindUserByName",
+                                                              g_variant_new ("(s)", username),
+                                                              G_VARIANT_TYPE ("(o)"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (!result)
+    {
+        g_debug ("User %s not found in org.freedesktop.Accounts: %s", username, error->message);
+        return NULL;
+    }
+
+    const gchar *path;
+    g_variant_get (result, "(&o)", &path);
+
+    CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+    priv->bus = g_object_ref (list_priv->bus);
+    priv->path = g_strdup (path);
+    if (!load_accounts_user (user))
+    {
+        g_object_unref (user);
+        return NULL;
+    }
+
+    return user;
+}
+
 /**
- * common_user_list_get_user_by_name:
+ * common_user_list_lookup_user:
  * @user_list: A #CommonUserList
  * @username: Name of user to get.
  *
  * Get infomation about a given user or #NULL if this user doesn't exist.
- * Includes hidden and system users, unlike the list from
- * common_user_list_get_users.
+ * Unlike common_user_list_get_user_by_name this does not load the whole user
+ * list, only the requested user is looked up, and the result is kept for a
+ * short time.
  *
  * Return value: (transfer full): A #CommonUser entry for the given user.
  **/
 CommonUser *
-common_user_list_get_user_by_name (CommonUserList *user_list, const gchar *username)
+common_user_list_lookup_user (CommonUserList *user_list, const gchar *username)
 {
     g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
     g_return_val_if_fail (username != NULL, NULL);
 
-    load_users (user_list);
+    CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
-    CommonUser *user = get_user_by_name (user_list, username);
-    if (user)
-        return g_object_ref (user);
+    /* Use the full list if something else has loaded it */
+    if (priv->have_users)
+        return common_user_list_get_user_by_name (user_list, username);
 
-    /* Sometimes we need to look up users that aren't in AccountsService.
-       Notably we need to look up the user that the greeter runs as, which
-       is usually 'lightdm'. For such cases, we manually create a one-off
-       CommonUser object and pre-seed with passwd info. */
-    struct passwd *entry = getpwnam (username);
-    if (entry != NULL)
-        return make_passwd_user (user_list, entry);
+    gint64 now = g_get_monotonic_time ();
+    LookupEntry *entry = g_hash_table_lookup (priv->lookup_cache, username);
+    if (entry && now < entry->expiry_time)
+        return entry->user ? g_object_ref (entry->user) : NULL;
 
-    return NULL;
+    CommonUser *user = find_accounts_user (user_list, username);
+    if (!user)
+    {
+        g_autoptr(CommonPasswd) passwd_entry = common_nss_get_user_by_name (username);
+        if (passwd_entry)
+            user = make_passwd_user (user_list, passwd_entry);
+    }
+
+    /* Drop old results so looking up many names doesn't grow the cache forever */
+    if (g_hash_table_size (priv->lookup_cache) >= LOOKUP_CACHE_MAX_ENTRIES)
+    {
+        g_hash_table_foreach_remove (priv->lookup_cache, lookup_entry_expired, &now);
+        if (g_hash_table_size (priv->lookup_cache) >= LOOKUP_CACHE_MAX_ENTRIES)
+            g_hash_table_remove_all (priv->lookup_cache);
+    }
+
+    entry = g_new0 (LookupEntry, 1);
+    entry->user = user ? g_object_ref (user) : NULL;
+    entry->expiry_time = now + LOOKUP_CACHE_TTL * G_USEC_PER_SEC;
+    g_hash_table_insert (priv->lookup_cache, g_strdup (username), entry);
+
+    return user;
 }
 
 static void
@@ -1003,6 +2319,18 @@ common_user_list_init (CommonUserList *user_list)
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
     priv->bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+    priv->users_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->users_by_path = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->lookup_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) lookup_entry_free);
+    priv->loading_users = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->sessions = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_object_unref);
+    priv->session_counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    /* Any change to the users could change the search results */
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (invalidate_search_index), NULL);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (invalidate_search_index), NULL);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (invalidate_search_index), NULL);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USERS_LOADED, G_CALLBACK (invalidate_search_index), NULL);
 }
 
 static void
@@ -1040,8 +2368,18 @@ common_user_list_finalize (GObject *object)
     CommonUserListPrivate *priv = GET_LIST_PRIVATE (self);
 
     /* Remove children first, they might access us */
+    g_clear_pointer (&priv->users_by_name, g_hash_table_unref);
+    g_clear_pointer (&priv->users_by_path, g_hash_table_unref);
+    g_clear_pointer (&priv->search_index, g_ptr_array_unref);
+    g_clear_pointer (&priv->loading_users, g_hash_table_unref);
+    g_clear_pointer (&priv->lookup_cache, g_hash_table_unref);
     g_list_free_full (priv->users, g_object_unref);
-    g_list_free_full (priv->sessions, g_object_unref);
+    g_clear_pointer (&priv->sessions, g_hash_table_unref);
+    g_clear_pointer (&priv->session_counts, g_hash_table_unref);
+    if (priv->pending_idle)
+        g_source_remove (priv->pending_idle);
+    g_clear_pointer (&priv->pending_users, g_ptr_array_unref);
+    g_clear_pointer (&priv->pending_set, g_hash_table_unref);
 
     if (priv->user_added_signal)
         g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
@@ -1053,6 +2391,14 @@ common_user_list_finalize (GObject *object)
         g_dbus_connection_signal_unsubscribe (priv->bus, priv->session_removed_signal);
     g_object_unref (priv->bus);
     g_clear_object (&priv->passwd_monitor);
+    if (priv->passwd_reload_timeout)
+        g_source_remove (priv->passwd_reload_timeout);
+    if (priv->passwd_reload_cancellable)
+        g_cancellable_cancel (priv->passwd_reload_cancellable);
+    g_clear_object (&priv->passwd_reload_cancellable);
+    g_clear_pointer (&priv->passwd_checksum, g_free);
+    g_clear_pointer (&priv->hidden_users, name_filter_free);
+    g_clear_pointer (&priv->hidden_shells, name_filter_free);
 
     G_OBJECT_CLASS (common_user_list_parent_class)->finalize (object);
 }
@@ -1120,45 +2466,175 @@ common_user_list_class_init (CommonUserListClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 1, COMMON_TYPE_USER);
+
+    /**
+     * CommonUserList::users-loaded:
+     * @user_list: A #CommonUserList
+     *
+     * The ::users-loaded signal gets emitted when an asynchronous load started
+     * with common_user_list_load_async() has completed.
+     **/
+    list_signals[USERS_LOADED] =
+        g_signal_new (USER_LIST_SIGNAL_USERS_LOADED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (CommonUserListClass, users_loaded),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+
+    /**
+     * CommonUserList::users-added:
+     * @user_list: A #CommonUserList
+     * @users: (element-type CommonUser): The #CommonUser objects that have been added.
+     *
+     * The ::users-added signal gets emitted once the main loop is idle with
+     * the users reported by #CommonUserList::user-added since the last batch.
+     * Batches of different kinds are emitted in the order the changes happened.
+     **/
+    list_signals[USERS_ADDED] =
+        g_signal_new (USER_LIST_SIGNAL_USERS_ADDED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (CommonUserListClass, users_added),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
+
+    /**
+     * CommonUserList::users-changed:
+     * @user_list: A #CommonUserList
+     * @users: (element-type CommonUser): The #CommonUser objects that have been changed.
+     *
+     * The ::users-changed signal gets emitted once the main loop is idle with
+     * the users reported by #CommonUserList::user-changed since the last batch,
+     * each user appearing only once.
+     **/
+    list_signals[USERS_CHANGED] =
+        g_signal_new (USER_LIST_SIGNAL_USERS_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (CommonUserListClass, users_changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
+
+    /**
+     * CommonUserList::users-removed:
+     * @user_list: A #CommonUserList
+     * @users: (element-type CommonUser): The #CommonUser objects that have been removed.
+     *
+     * The ::users-removed signal gets emitted once the main loop is idle with
+     * the users reported by #CommonUserList::user-removed since the last batch.
+     **/
+    list_signals[USERS_REMOVED] =
+        g_signal_new (USER_LIST_SIGNAL_USERS_REMOVED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (CommonUserListClass, users_removed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
 }
 
-static gboolean
-call_method (CommonUser *user, const gchar *method, GVariant *args,
-             const gchar *expected, GVariant **result)
+static void
+set_method_cb (GObject *object, GAsyncResult *result, gpointer data)
 {
-    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+    g_autofree gchar *method = data;
 
     g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) answer = g_dbus_connection_call_sync (priv->bus,
-                                                              "org.freedesktop.Accounts",
-                                                              priv->path,
-                                                              "org.freedesktop.Accounts.User",
-                                                              method,
-                                                              args,
-                                                              G_VARIANT_TYPE (expected),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Could not call %s: %s", method, error->message);
-
+    g_autoptr(GVariant) answer = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
     if (!answer)
-        return FALSE;
+        g_warning ("Could not call %s: %s", method, error->message);
+}
 
-    if (result)
-        *result = g_steal_pointer (&answer);
+static void
+call_set_method (CommonUser *user, const gchar *method, const gchar *value)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
 
-    return TRUE;
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.Accounts",
+                            priv->path,
+                            "org.freedesktop.Accounts.User",
+                            method,
+                            g_variant_new ("(s)", value),
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            ACCOUNTS_SET_TIMEOUT_MS,
+                            NULL,
+                            set_method_cb,
+                            g_strdup (method));
 }
 
-static void
-save_string_to_dmrc (CommonUser *user, const gchar *group,
-                     const gchar *key, const gchar *value)
+static gboolean
+write_settings_cb (gpointer data)
 {
+    CommonUser *user = data;
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    priv->write_settings_source = 0;
+
+    g_autofree gchar *language = g_steal_pointer (&priv->pending_language);
+    g_autofree gchar *session = g_steal_pointer (&priv->pending_session);
+
+    if (priv->path)
+    {
+        if (language)
+            call_set_method (user, "SetLanguage", language);
+        if (session)
+            call_set_method (user, "SetXSession", session);
+    }
+
+    /* Read and write the .dmrc once for all the changes */
     g_autoptr(GKeyFile) dmrc = dmrc_load (user);
-    g_key_file_set_string (dmrc, group, key, value);
+    if (language)
+        g_key_file_set_string (dmrc, "Desktop", "Language", language);
+    if (session)
+        g_key_file_set_string (dmrc, "Desktop", "Session", session);
     dmrc_save (dmrc, user);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Changes made together are written together once the caller returns to the main loop */
+static void
+queue_settings_write (CommonUser *user)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    if (priv->write_settings_source == 0 && priv->settings_hold_count == 0)
+        priv->write_settings_source = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, write_settings_cb, g_object_ref (user), g_object_unref);
+}
+
+static void
+apply_dmrc (CommonUser *user, GKeyFile *dmrc)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    priv->loaded_dmrc = TRUE;
+    priv->loading_dmrc = FALSE;
+
+    /* The Language field contains the locale */
+    g_autofree gchar *language = g_key_file_get_string (dmrc, "Desktop", "Language", NULL);
+    priv->language = intern_string (language);
+
+    g_autofree gchar *layout = g_key_file_get_string (dmrc, "Desktop", "Layout", NULL);
+    const gchar *layouts[] = { layout, NULL };
+    set_layouts (priv, layouts);
+
+    g_autofree gchar *session = g_key_file_get_string (dmrc, "Desktop", "Session", NULL);
+    priv->session = intern_string (session);
+
+    /* Keep settings that haven't been written yet */
+    if (priv->pending_language)
+        priv->language = g_intern_string (priv->pending_language);
+    if (priv->pending_session)
+        priv->session = g_intern_string (priv->pending_session);
+
+    /* The file isn't watched for changes, a monitor on every user's home
+     * directory costs a watch each and polls on network filesystems.
+     * Settings changed through this library update the user directly */
 }
 
 /* Loads language/layout/session info for user */
@@ -1171,27 +2647,207 @@ load_dmrc (CommonUser *user)
     if (priv->path)
         return;
 
-    if (priv->loaded_dmrc)
+    /* Use the defaults until the background read completes */
+    if (priv->loaded_dmrc || priv->loading_dmrc)
         return;
-    priv->loaded_dmrc = TRUE;
+
     g_autoptr(GKeyFile) dmrc = dmrc_load (user);
+    apply_dmrc (user, dmrc);
+}
 
-    // FIXME: Watch for changes
+typedef struct _DmrcBatch DmrcBatch;
 
-    /* The Language field contains the locale */
-    g_free (priv->language);
-    priv->language = g_key_file_get_string (dmrc, "Desktop", "Language", NULL);
+typedef struct
+{
+    /* Batch this read is part of */
+    DmrcBatch *batch;
+
+    /* User being read and the locations to read from */
+    CommonUser *user;
+    gchar *home_directory;
+    uid_t uid;
+    gid_t gid;
+    gchar *name;
+
+    /* Result from worker thread */
+    GKeyFile *dmrc;
+
+    /* TRUE if root wasn't allowed to read the file, so it has to be read as the user on the main thread */
+    gboolean denied;
+
+    /* TRUE when the worker thread has completed */
+    gboolean done;
+} DmrcRead;
+
+struct _DmrcBatch
+{
+    GMainContext *context;
+
+    /* Reads in this batch */
+    GPtrArray *reads;
+
+    /* Number of reads still in a worker thread */
+    gint n_pending;
+
+    /* Timeout before giving up waiting for reads */
+    GSource *timeout;
+
+    /* TRUE once the batch has been reported */
+    gboolean complete;
+};
+
+static GThreadPool *dmrc_pool = NULL;
+
+static void
+dmrc_read_free (DmrcRead *read)
+{
+    g_object_unref (read->user);
+    g_free (read->home_directory);
+    g_free (read->name);
+    if (read->dmrc)
+        g_key_file_unref (read->dmrc);
+    g_free (read);
+}
+
+static void
+dmrc_batch_free (DmrcBatch *batch)
+{
+    if (batch->timeout)
+    {
+        g_source_destroy (batch->timeout);
+        g_source_unref (batch->timeout);
+    }
+    g_ptr_array_unref (batch->reads);
+    g_main_context_unref (batch->context);
+    g_free (batch);
+}
+
+static void
+complete_dmrc_batch (DmrcBatch *batch)
+{
+    batch->complete = TRUE;
+
+    /* Apply all the results together so each user only changes once */
+    for (guint i = 0; i < batch->reads->len; i++)
+    {
+        DmrcRead *read = g_ptr_array_index (batch->reads, i);
+        if (!read->done)
+        {
+            g_debug ("Timed out reading DMRC file for user %s, using defaults", common_user_get_name (read->user));
+            continue;
+        }
+        apply_dmrc (read->user, read->dmrc);
+        g_signal_emit (read->user, user_signals[CHANGED], 0);
+    }
+
+    if (batch->n_pending == 0)
+        dmrc_batch_free (batch);
+}
+
+static gboolean
+dmrc_batch_timeout_cb (gpointer data)
+{
+    DmrcBatch *batch = data;
+
+    g_clear_pointer (&batch->timeout, g_source_unref);
+    complete_dmrc_batch (batch);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+dmrc_read_done_cb (gpointer data)
+{
+    DmrcRead *read = data;
+    DmrcBatch *batch = read->batch;
+
+    if (read->denied && !dmrc_load_user_file_as_user (read->dmrc, read->home_directory, read->uid, read->gid))
+        dmrc_load_from_cache (read->dmrc, read->name);
+
+    read->done = TRUE;
+    batch->n_pending--;
+
+    if (batch->complete)
+    {
+        /* Arrived after the batch timed out */
+        apply_dmrc (read->user, read->dmrc);
+        g_signal_emit (read->user, user_signals[CHANGED], 0);
+        if (batch->n_pending == 0)
+            dmrc_batch_free (batch);
+    }
+    else if (batch->n_pending == 0)
+        complete_dmrc_batch (batch);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+dmrc_read_thread (gpointer data, gpointer user_data)
+{
+    DmrcRead *read = data;
+
+    /* Only the data captured in the read is used here, the user object belongs to the main thread */
+    read->dmrc = g_key_file_new ();
+    if (!dmrc_load_user_file (read->dmrc, read->home_directory, read->uid, &read->denied) && !read->denied)
+        dmrc_load_from_cache (read->dmrc, read->name);
+
+    g_main_context_invoke (read->batch->context, dmrc_read_done_cb, read);
+}
+
+/**
+ * common_user_list_prefetch_dmrc:
+ * @user_list: A #CommonUserList
+ * @users: (element-type CommonUser): Users to read settings for
+ *
+ * Read the language, layout and session settings for the given users in the
+ * background.  Until the settings are read the defaults are returned, and each
+ * user emits ::changed once when the whole batch has been read.  Files that take
+ * too long to read are reported separately when they arrive.
+ **/
+void
+common_user_list_prefetch_dmrc (CommonUserList *user_list, GList *users)
+{
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+
+    if (!dmrc_pool)
+        dmrc_pool = g_thread_pool_new (dmrc_read_thread, NULL, DMRC_PREFETCH_MAX_THREADS, FALSE, NULL);
+
+    DmrcBatch *batch = g_malloc0 (sizeof (DmrcBatch));
+    batch->context = g_main_context_ref_thread_default ();
+    batch->reads = g_ptr_array_new_with_free_func ((GDestroyNotify) dmrc_read_free);
+
+    for (GList *link = users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+        if (priv->path || priv->loaded_dmrc || priv->loading_dmrc || !priv->home_directory)
+            continue;
+        priv->loading_dmrc = TRUE;
+
+        DmrcRead *read = g_malloc0 (sizeof (DmrcRead));
+        read->batch = batch;
+        read->user = g_object_ref (user);
+        read->home_directory = g_strdup (priv->home_directory);
+        read->uid = priv->uid;
+        read->gid = priv->gid;
+        read->name = g_strdup (priv->name);
+        g_ptr_array_add (batch->reads, read);
+    }
 
-    if (g_key_file_has_key (dmrc, "Desktop", "Layout", NULL))
+    if (batch->reads->len == 0)
     {
-        g_strfreev (priv->layouts);
-        priv->layouts = g_malloc (sizeof (gchar *) * 2);
-        priv->layouts[0] = g_key_file_get_string (dmrc, "Desktop", "Layout", NULL);
-        priv->layouts[1] = NULL;
+        dmrc_batch_free (batch);
+        return;
     }
 
-    g_free (priv->session);
-    priv->session = g_key_file_get_string (dmrc, "Desktop", "Session", NULL);
+    batch->timeout = g_timeout_source_new (DMRC_PREFETCH_TIMEOUT_MS);
+    g_source_set_callback (batch->timeout, dmrc_batch_timeout_cb, batch, NULL);
+    g_source_attach (batch->timeout, batch->context);
+
+    batch->n_pending = batch->reads->len;
+    for (guint i = 0; i < batch->reads->len; i++)
+        g_thread_pool_push (dmrc_pool, g_ptr_array_index (batch->reads, i), NULL);
 }
 
 /**
@@ -1206,6 +2862,7 @@ const gchar *
 common_user_get_name (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->name;
 }
 
@@ -1221,6 +2878,7 @@ const gchar *
 common_user_get_real_name (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->real_name;
 }
 
@@ -1236,6 +2894,7 @@ const gchar *
 common_user_get_display_name (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
 
     CommonUserPrivate *priv = GET_USER_PRIVATE (user);
     if (!priv->real_name || strcmp (priv->real_name, "") == 0)
@@ -1256,6 +2915,7 @@ const gchar *
 common_user_get_home_directory (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->home_directory;
 }
 
@@ -1271,14 +2931,49 @@ const gchar *
 common_user_get_shell (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->shell;
 }
 
+/* Find the image in the home directory of a passwd user.  The result is kept
+ * until the user list changes, then the home directory is looked in again only
+ * if it has been modified since */
+static void
+resolve_home_image (CommonUser *user)
+{
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+
+    if (priv->path || !priv->home_directory)
+        return;
+    if (priv->image_resolved && !priv->image_check)
+        return;
+    priv->image_check = FALSE;
+
+    /* Adding or removing an image changes the home directory */
+    gint64 mtime = get_file_mtime (priv->home_directory, NULL);
+    if (priv->image_resolved && mtime == priv->image_home_mtime)
+        return;
+    priv->image_resolved = TRUE;
+    priv->image_home_mtime = mtime;
+
+    g_clear_pointer (&priv->image, g_free);
+    const gchar *names[] = { ".face", ".face.icon", NULL };
+    for (int i = 0; names[i] && !priv->image; i++)
+    {
+        g_autofree gchar *path = g_build_filename (priv->home_directory, names[i], NULL);
+        if (g_file_test (path, G_FILE_TEST_EXISTS))
+            priv->image = g_steal_pointer (&path);
+    }
+}
+
 /**
  * common_user_get_image:
  * @user: A #CommonUser
  *
- * Get the image URI for a user.
+ * Get the image URI for a user.  For users from the password database the
+ * first call, and the first after the user list changes, checks the home
+ * directory and so may block on the filesystem; the result is cached on the
+ * user otherwise.
  *
  * Return value: The image URI for the given user or #NULL if no URI
  **/
@@ -1286,6 +2981,27 @@ const gchar *
 common_user_get_image (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
+    resolve_home_image (user);
+    return GET_USER_PRIVATE (user)->image;
+}
+
+/**
+ * common_user_get_cached_image:
+ * @user: A #CommonUser
+ *
+ * Get the image URI for a user without looking in their home directory, so
+ * this never blocks on the filesystem.  Users from the password database only
+ * have an image once it has been found by common_user_get_image() or loaded
+ * from a snapshot.
+ *
+ * Return value: The image URI for the given user or #NULL if no URI is known
+ **/
+const gchar *
+common_user_get_cached_image (CommonUser *user)
+{
+    g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->image;
 }
 
@@ -1301,6 +3017,7 @@ const gchar *
 common_user_get_background (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->background;
 }
 
@@ -1316,6 +3033,7 @@ const gchar *
 common_user_get_language (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     load_dmrc (user);
     const gchar *language = GET_USER_PRIVATE (user)->language;
     return (language && language[0] == 0) ? NULL : language; /* Treat "" as NULL */
@@ -1334,8 +3052,11 @@ common_user_set_language (CommonUser *user, const gchar *language)
     g_return_if_fail (COMMON_IS_USER (user));
     if (g_strcmp0 (common_user_get_language (user), language) != 0)
     {
-        call_method (user, "SetLanguage", g_variant_new ("(s)", language), "()", NULL);
-        save_string_to_dmrc (user, "Desktop", "Language", language);
+        CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+        priv->language = g_intern_string (language ? language : "");
+        g_free (priv->pending_language);
+        priv->pending_language = g_strdup (priv->language);
+        queue_settings_write (user);
     }
 }
 
@@ -1351,6 +3072,7 @@ const gchar *
 common_user_get_layout (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     load_dmrc (user);
     return GET_USER_PRIVATE (user)->layouts[0];
 }
@@ -1367,6 +3089,7 @@ const gchar * const *
 common_user_get_layouts (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     load_dmrc (user);
     return (const gchar * const *) GET_USER_PRIVATE (user)->layouts;
 }
@@ -1383,6 +3106,7 @@ const gchar *
 common_user_get_session (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+    update_stale_user (user);
     load_dmrc (user);
     const gchar *session = GET_USER_PRIVATE (user)->session;
     return (session && session[0] == 0) ? NULL : session; /* Treat "" as NULL */
@@ -1401,11 +3125,55 @@ common_user_set_session (CommonUser *user, const gchar *session)
     g_return_if_fail (COMMON_IS_USER (user));
     if (g_strcmp0 (common_user_get_session (user), session) != 0)
     {
-        call_method (user, "SetXSession", g_variant_new ("(s)", session), "()", NULL);
-        save_string_to_dmrc (user, "Desktop", "Session", session);
+        CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+        priv->session = g_intern_string (session ? session : "");
+        g_free (priv->pending_session);
+        priv->pending_session = g_strdup (priv->session);
+        queue_settings_write (user);
     }
 }
 
+/**
+ * common_user_hold_settings:
+ * @user: A #CommonUser
+ *
+ * Delay writing settings changed with common_user_set_language() and
+ * common_user_set_session() until common_user_release_settings() is called.
+ * The new values are returned by the getters straight away.
+ **/
+void
+common_user_hold_settings (CommonUser *user)
+{
+    g_return_if_fail (COMMON_IS_USER (user));
+
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+    priv->settings_hold_count++;
+    if (priv->write_settings_source != 0)
+    {
+        g_source_remove (priv->write_settings_source);
+        priv->write_settings_source = 0;
+    }
+}
+
+/**
+ * common_user_release_settings:
+ * @user: A #CommonUser
+ *
+ * Release a hold from common_user_hold_settings(), writing any changed
+ * settings once the last hold is released.
+ **/
+void
+common_user_release_settings (CommonUser *user)
+{
+    g_return_if_fail (COMMON_IS_USER (user));
+
+    CommonUserPrivate *priv = GET_USER_PRIVATE (user);
+    g_return_if_fail (priv->settings_hold_count > 0);
+    priv->settings_hold_count--;
+    if (priv->pending_language || priv->pending_session)
+        queue_settings_write (user);
+}
+
 /**
  * common_user_get_logged_in:
  * @user: A #CommonUser
@@ -1419,10 +3187,11 @@ common_user_get_logged_in (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), FALSE);
 
-    gboolean result;
-    g_signal_emit (user, user_signals[GET_LOGGED_IN], 0, &result);
+    /* Users only come from the list, it knows which have sessions */
+    if (!singleton)
+        return FALSE;
 
-    return result;
+    return get_logged_in (singleton, user);
 }
 
 /**
@@ -1437,6 +3206,7 @@ gboolean
 common_user_get_has_messages (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), FALSE);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->has_messages;
 }
 
@@ -1452,6 +3222,7 @@ uid_t
 common_user_get_uid (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), 0);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->uid;
 }
 
@@ -1473,7 +3244,7 @@ common_user_get_gid (CommonUser *user)
     CommonUserPrivate *priv = GET_USER_PRIVATE (user);
     if (priv->uid != 0 && priv->gid == 0)
     {
-        struct passwd *entry = getpwuid (priv->uid);
+        g_autoptr(CommonPasswd) entry = common_nss_get_user_by_uid (priv->uid);
         if (entry != NULL)
             priv->gid = entry->pw_gid;
     }
@@ -1492,6 +3263,7 @@ gboolean
 common_user_get_is_locked (CommonUser *user)
 {
     g_return_val_if_fail (COMMON_IS_USER (user), FALSE);
+    update_stale_user (user);
     return GET_USER_PRIVATE (user)->is_locked;
 }
 
@@ -1499,8 +3271,7 @@ static void
 common_user_init (CommonUser *user)
 {
     CommonUserPrivate *priv = GET_USER_PRIVATE (user);
-    priv->layouts = g_malloc (sizeof (gchar *) * 1);
-    priv->layouts[0] = NULL;
+    priv->layouts = intern_strv (NULL);
 }
 
 static void
@@ -1582,19 +3353,18 @@ common_user_finalize (GObject *object)
     CommonUser *self = COMMON_USER (object);
     CommonUserPrivate *priv = GET_USER_PRIVATE (self);
 
+    unsubscribe_accounts_user (self);
     g_clear_pointer (&priv->path, g_free);
-    if (priv->changed_signal)
-        g_dbus_connection_signal_unsubscribe (priv->bus, priv->changed_signal);
     g_clear_object (&priv->bus);
     g_clear_pointer (&priv->name, g_free);
     g_clear_pointer (&priv->real_name, g_free);
     g_clear_pointer (&priv->home_directory, g_free);
-    g_clear_pointer (&priv->shell, g_free);
+
     g_clear_pointer (&priv->image, g_free);
     g_clear_pointer (&priv->background, g_free);
-    g_clear_pointer (&priv->language, g_free);
-    g_clear_pointer (&priv->layouts, g_strfreev);
-    g_clear_pointer (&priv->session, g_free);
+    g_clear_pointer (&priv->layouts, g_free);
+    g_clear_pointer (&priv->pending_language, g_free);
+    g_clear_pointer (&priv->pending_session, g_free);
 }
 
 static void
@@ -1736,16 +3506,6 @@ common_user_class_init (CommonUserClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 0);
-
-    user_signals[GET_LOGGED_IN] =
-        g_signal_new ("get-logged-in",
-                      G_TYPE_FROM_CLASS (klass),
-                      G_SIGNAL_RUN_LAST,
-                      0,
-                      g_signal_accumulator_first_wins,
-                      NULL,
-                      NULL,
-                      G_TYPE_BOOLEAN, 0);
 }
 
 static void
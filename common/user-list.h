@@ -35,6 +35,10 @@ G_BEGIN_DECLS
 #define USER_LIST_SIGNAL_USER_ADDED   "user-added"
 #define USER_LIST_SIGNAL_USER_CHANGED "user-changed"
 #define USER_LIST_SIGNAL_USER_REMOVED "user-removed"
+#define USER_LIST_SIGNAL_USERS_LOADED "users-loaded"
+#define USER_LIST_SIGNAL_USERS_ADDED   "users-added"
+#define USER_LIST_SIGNAL_USERS_CHANGED "users-changed"
+#define USER_LIST_SIGNAL_USERS_REMOVED "users-removed"
 
 #define USER_SIGNAL_CHANGED "changed"
 
@@ -62,6 +66,10 @@ typedef struct
     void (*user_added)(CommonUserList *user_list, CommonUser *user);
     void (*user_changed)(CommonUserList *user_list, CommonUser *user);
     void (*user_removed)(CommonUserList *user_list, CommonUser *user);
+    void (*users_loaded)(CommonUserList *user_list);
+    void (*users_added)(CommonUserList *user_list, GPtrArray *users);
+    void (*users_changed)(CommonUserList *user_list, GPtrArray *users);
+    void (*users_removed)(CommonUserList *user_list, GPtrArray *users);
 } CommonUserListClass;
 
 GType common_user_list_get_type (void);
@@ -72,12 +80,26 @@ CommonUserList *common_user_list_get_instance (void);
 
 void common_user_list_cleanup (void);
 
+void common_user_list_load_async (CommonUserList *user_list);
+
+gboolean common_user_list_get_is_loaded (CommonUserList *user_list);
+
+gboolean common_user_list_save_snapshot (CommonUserList *user_list, const gchar *path, GError **error);
+
+gboolean common_user_list_load_snapshot (CommonUserList *user_list, const gchar *path);
+
 gint common_user_list_get_length (CommonUserList *user_list);
 
 CommonUser *common_user_list_get_user_by_name (CommonUserList *user_list, const gchar *username);
 
+CommonUser *common_user_list_lookup_user (CommonUserList *user_list, const gchar *username);
+
 GList *common_user_list_get_users (CommonUserList *user_list);
 
+GList *common_user_list_search (CommonUserList *user_list, const gchar *prefix, guint limit);
+
+void common_user_list_prefetch_dmrc (CommonUserList *user_list, GList *users);
+
 const gchar *common_user_get_name (CommonUser *user);
 
 const gchar *common_user_get_real_name (CommonUser *user);
@@ -90,6 +112,8 @@ const gchar *common_user_get_shell (CommonUser *user);
 
 const gchar *common_user_get_image (CommonUser *user);
 
+const gchar *common_user_get_cached_image (CommonUser *user);
+
 const gchar *common_user_get_background (CommonUser *user);
 
 const gchar *common_user_get_language (CommonUser *user);
@@ -104,6 +128,10 @@ const gchar *common_user_get_session (CommonUser *user);
 
 void common_user_set_session (CommonUser *user, const gchar *session);
 
+void common_user_hold_settings (CommonUser *user);
+
+void common_user_release_settings (CommonUser *user);
+
 gboolean common_user_get_logged_in (CommonUser *user);
 
 gboolean common_user_get_has_messages (CommonUser *user);
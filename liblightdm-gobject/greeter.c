@@ -8,15 +8,24 @@
  * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <poll.h>
 #include <gio/gio.h>
 #include <gio/gunixsocketaddress.h>
 #include <security/pam_appl.h>
 
 #include "lightdm/greeter.h"
+#include "system-private.h"
 
 /**
  * SECTION:greeter
@@ -105,6 +114,23 @@ enum {
     PROP_AUTOLOGIN_SESSION_HINT,
 };
 
+/* Values of the hints that have properties */
+typedef struct
+{
+    gchar *default_session;
+    gboolean hide_users;
+    gboolean show_manual_login;
+    gboolean show_remote_login;
+    gboolean lock;
+    gboolean has_guest_account;
+    gchar *select_user;
+    gboolean select_guest;
+    gchar *autologin_user;
+    gchar *autologin_session;
+    gboolean autologin_guest;
+    gint autologin_timeout;
+} HintValues;
+
 enum {
     SHOW_PROMPT,
     SHOW_MESSAGE,
@@ -112,6 +138,7 @@ enum {
     AUTOLOGIN_TIMER_EXPIRED,
     IDLE,
     RESET,
+    HINT_CHANGED,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -132,12 +159,18 @@ typedef struct
 
     /* Channel to read from daemon */
     GIOChannel *from_server_channel;
-    guint from_server_watch;
+    GSource *from_server_source;
+
+    /* Context the greeter was created in, its sources are attached here */
+    GMainContext *context;
 
-    /* Data read from the daemon */
-    guint8 *read_buffer;
+    /* Data read from the daemon, reused between messages */
+    GByteArray *read_buffer;
     gsize n_read;
 
+    /* File descriptors received from the daemon for shared memory messages */
+    GQueue *received_fds;
+
     gsize n_responses_waiting;
     GList *responses_received;
 
@@ -156,14 +189,23 @@ typedef struct
     /* Hints provided by the daemon */
     GHashTable *hints;
 
+    /* Hint names indexed as sent by the daemon */
+    GPtrArray *hint_keys;
+
+    /* Hints with properties, parsed when the hints change */
+    HintValues hint_values;
+
     /* Timeout source to notify greeter to autologin */
-    guint autologin_timeout;
+    GSource *autologin_source;
 
     gchar *authentication_user;
     gboolean in_authentication;
     gboolean is_authenticated;
     guint32 authenticate_sequence_number;
     gboolean cancelling_authentication;
+
+    /* Milliseconds synchronous calls wait for the daemon to reply (0 to wait forever) */
+    guint sync_timeout;
 } LightDMGreeterPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (LightDMGreeter, lightdm_greeter, G_TYPE_OBJECT)
@@ -172,7 +214,10 @@ G_DEFINE_TYPE_WITH_PRIVATE (LightDMGreeter, lightdm_greeter, G_TYPE_OBJECT)
 
 #define HEADER_SIZE 8
 #define MAX_MESSAGE_LENGTH 1024
-#define API_VERSION 1
+#define API_VERSION 5
+
+/* Features sent with the API version when connecting */
+#define GREETER_FEATURE_SHARED_MEMORY (1 << 0)
 
 /* Messages from the greeter to the server */
 typedef enum
@@ -186,6 +231,7 @@ typedef enum
     GREETER_MESSAGE_SET_LANGUAGE,
     GREETER_MESSAGE_AUTHENTICATE_REMOTE,
     GREETER_MESSAGE_ENSURE_SHARED_DIR,
+    GREETER_MESSAGE_PONG,
 } GreeterMessage;
 
 /* Messages from the server to the greeter */
@@ -199,6 +245,10 @@ typedef enum
     SERVER_MESSAGE_IDLE,
     SERVER_MESSAGE_RESET,
     SERVER_MESSAGE_CONNECTED_V2,
+    SERVER_MESSAGE_CONNECTED_V3,
+    SERVER_MESSAGE_HINTS_CHANGED,
+    SERVER_MESSAGE_SHARED_MEMORY,
+    SERVER_MESSAGE_PING,
 } ServerMessage;
 
 /* Request sent to server */
@@ -237,6 +287,7 @@ lightdm_greeter_error_get_type (void)
             { LIGHTDM_GREETER_ERROR_SESSION_FAILED, "LIGHTDM_GREETER_ERROR_SESSION_FAILED", "session-failed" },
             { LIGHTDM_GREETER_ERROR_NO_AUTOLOGIN, "LIGHTDM_GREETER_ERROR_NO_AUTOLOGIN", "no-autologin" },
             { LIGHTDM_GREETER_ERROR_INVALID_USER, "LIGHTDM_GREETER_ERROR_INVALID_USER", "invalid-user" },
+            { LIGHTDM_GREETER_ERROR_TIMED_OUT, "LIGHTDM_GREETER_ERROR_TIMED_OUT", "timed-out" },
             { 0, NULL, NULL }
         };
         enum_type = g_enum_register_static (g_intern_static_string ("LightDMGreeterError"), values);
@@ -283,7 +334,11 @@ lightdm_message_type_get_type (void)
 /**
  * lightdm_greeter_new:
  *
- * Create a new greeter.
+ * Create a new greeter. Messages from the daemon are handled, and signals
+ * and asynchronous callbacks are called, in the thread-default main context
+ * when the greeter is created. To keep the daemon connection responsive while
+ * the main thread is busy drawing, create the greeter in another thread after
+ * calling g_main_context_push_thread_default() and run that context there.
  *
  * Return value: the new #LightDMGreeter
  **/
@@ -312,6 +367,36 @@ lightdm_greeter_set_resettable (LightDMGreeter *greeter, gboolean resettable)
     priv->resettable = resettable;
 }
 
+/**
+ * lightdm_greeter_set_sync_timeout:
+ * @greeter: A #LightDMGreeter
+ * @timeout: Milliseconds to wait for a reply or 0 to wait forever
+ *
+ * Set how long the synchronous functions, e.g. lightdm_greeter_connect_to_daemon_sync(),
+ * wait for the daemon to reply before failing with %LIGHTDM_GREETER_ERROR_TIMED_OUT.
+ **/
+void
+lightdm_greeter_set_sync_timeout (LightDMGreeter *greeter, guint timeout)
+{
+    g_return_if_fail (LIGHTDM_IS_GREETER (greeter));
+    GET_PRIVATE (greeter)->sync_timeout = timeout;
+}
+
+/**
+ * lightdm_greeter_get_sync_timeout:
+ * @greeter: A #LightDMGreeter
+ *
+ * Get how long the synchronous functions wait for the daemon to reply.
+ *
+ * Return value: The timeout in milliseconds or 0 if they wait forever.
+ **/
+guint
+lightdm_greeter_get_sync_timeout (LightDMGreeter *greeter)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), 0);
+    return GET_PRIVATE (greeter)->sync_timeout;
+}
+
 static Request *
 request_new (LightDMGreeter *greeter, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
 {
@@ -325,6 +410,24 @@ request_new (LightDMGreeter *greeter, GCancellable *cancellable, GAsyncReadyCall
     return request;
 }
 
+/* Attach a source to the context the greeter was created in */
+static GSource *
+attach_source (LightDMGreeter *greeter, GSource *source, GSourceFunc func, gpointer data, GDestroyNotify notify)
+{
+    g_source_set_callback (source, func, data, notify);
+    g_source_attach (source, GET_PRIVATE (greeter)->context);
+    return source;
+}
+
+static void
+clear_source (GSource **source)
+{
+    if (!*source)
+        return;
+    g_source_destroy (*source);
+    g_clear_pointer (source, g_source_unref);
+}
+
 static gboolean
 request_callback_cb (gpointer data)
 {
@@ -346,7 +449,7 @@ request_complete (Request *request)
     if (request->cancellable && g_cancellable_is_cancelled (request->cancellable))
         return;
 
-    g_idle_add (request_callback_cb, g_object_ref (request));
+    g_source_unref (attach_source (request->greeter, g_idle_source_new (), request_callback_cb, g_object_ref (request), NULL));
 }
 
 static gboolean
@@ -355,7 +458,7 @@ timed_login_cb (gpointer data)
     LightDMGreeter *greeter = data;
     LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
 
-    priv->autologin_timeout = 0;
+    g_clear_pointer (&priv->autologin_source, g_source_unref);
     g_signal_emit (G_OBJECT (greeter), signals[AUTOLOGIN_TIMER_EXPIRED], 0);
 
     return FALSE;
@@ -463,6 +566,24 @@ get_message_length (guint8 *message, gsize message_length)
     return read_int (message, message_length, &offset);
 }
 
+static gboolean
+watch_server_channels (LightDMGreeter *greeter, GError **error)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    priv->from_server_source = attach_source (greeter, g_io_create_watch (priv->from_server_channel, G_IO_IN), (GSourceFunc) from_server_cb, greeter, NULL);
+
+    if (!g_io_channel_set_encoding (priv->to_server_channel, NULL, error) ||
+        !g_io_channel_set_encoding (priv->from_server_channel, NULL, error))
+        return FALSE;
+
+    /* Socket reads are done with recvmsg() so file descriptors can be received, the channel must not read ahead */
+    if (priv->socket)
+        g_io_channel_set_buffered (priv->from_server_channel, FALSE);
+
+    return TRUE;
+}
+
 static gboolean
 connect_to_daemon (LightDMGreeter *greeter, GError **error)
 {
@@ -500,13 +621,7 @@ connect_to_daemon (LightDMGreeter *greeter, GError **error)
         return FALSE;
     }
 
-    priv->from_server_watch = g_io_add_watch (priv->from_server_channel, G_IO_IN, from_server_cb, greeter);
-
-    if (!g_io_channel_set_encoding (priv->to_server_channel, NULL, error) ||
-        !g_io_channel_set_encoding (priv->from_server_channel, NULL, error))
-        return FALSE;
-
-    return TRUE;
+    return watch_server_channels (greeter, error);
 }
 
 static gboolean
@@ -563,15 +678,162 @@ send_message (LightDMGreeter *greeter, guint8 *message, gsize message_length, GE
     return TRUE;
 }
 
+/* Read the number of entries in an array, each of which is at least min_entry_length octets long */
+static guint32
+read_array_length (guint8 *message, gsize message_length, gsize *offset, gsize min_entry_length)
+{
+    guint32 length = read_int (message, message_length, offset);
+    if (length > (message_length - *offset) / min_entry_length)
+    {
+        g_warning ("Array length of %u elements too long", length);
+        return 0;
+    }
+    return length;
+}
+
+/* Update hints from a table sent by the daemon, returns the names of the hints that have changed */
+static GPtrArray *
+read_hint_table (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset, GString *debug_string)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    guint32 n_keys = read_array_length (message, message_length, offset, int_length ());
+    for (guint32 i = 0; i < n_keys; i++)
+        g_ptr_array_add (priv->hint_keys, read_string (message, message_length, offset));
+
+    GPtrArray *changed = g_ptr_array_new ();
+    guint32 n_values = read_array_length (message, message_length, offset, int_length () * 2);
+    for (guint32 i = 0; i < n_values; i++)
+    {
+        guint32 index = read_int (message, message_length, offset);
+        gchar *value = read_string (message, message_length, offset);
+        if (index >= priv->hint_keys->len)
+        {
+            g_warning ("Unknown hint index %u", index);
+            g_free (value);
+            continue;
+        }
+        const gchar *name = g_ptr_array_index (priv->hint_keys, index);
+        g_hash_table_insert (priv->hints, g_strdup (name), value);
+        g_ptr_array_add (changed, (gpointer) name);
+        g_string_append_printf (debug_string, " %s=%s", name, value);
+    }
+
+    guint32 n_removed = read_array_length (message, message_length, offset, int_length ());
+    for (guint32 i = 0; i < n_removed; i++)
+    {
+        guint32 index = read_int (message, message_length, offset);
+        if (index >= priv->hint_keys->len)
+        {
+            g_warning ("Unknown hint index %u", index);
+            continue;
+        }
+        const gchar *name = g_ptr_array_index (priv->hint_keys, index);
+        g_hash_table_remove (priv->hints, name);
+        g_ptr_array_add (changed, (gpointer) name);
+        g_string_append_printf (debug_string, " -%s", name);
+    }
+
+    return changed;
+}
+
+static gboolean
+parse_boolean_hint (GHashTable *hints, const gchar *name)
+{
+    return g_strcmp0 (g_hash_table_lookup (hints, name), "true") == 0;
+}
+
+static void
+hint_values_clear (HintValues *values)
+{
+    g_clear_pointer (&values->default_session, g_free);
+    g_clear_pointer (&values->select_user, g_free);
+    g_clear_pointer (&values->autologin_user, g_free);
+    g_clear_pointer (&values->autologin_session, g_free);
+}
+
+/* Parse the hints once, rather than each time a property is read, and notify the ones that changed */
+static void
+update_hint_values (LightDMGreeter *greeter)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    HintValues old = priv->hint_values;
+    HintValues *new = &priv->hint_values;
+    new->default_session = g_strdup (g_hash_table_lookup (priv->hints, "default-session"));
+    new->hide_users = parse_boolean_hint (priv->hints, "hide-users");
+    new->show_manual_login = parse_boolean_hint (priv->hints, "show-manual-login");
+    new->show_remote_login = parse_boolean_hint (priv->hints, "show-remote-login");
+    new->lock = parse_boolean_hint (priv->hints, "lock-screen");
+    new->has_guest_account = parse_boolean_hint (priv->hints, "has-guest-account");
+    new->select_user = g_strdup (g_hash_table_lookup (priv->hints, "select-user"));
+    new->select_guest = parse_boolean_hint (priv->hints, "select-guest");
+    new->autologin_user = g_strdup (g_hash_table_lookup (priv->hints, "autologin-user"));
+    new->autologin_session = g_strdup (g_hash_table_lookup (priv->hints, "autologin-session"));
+    new->autologin_guest = parse_boolean_hint (priv->hints, "autologin-guest");
+    const gchar *timeout = g_hash_table_lookup (priv->hints, "autologin-timeout");
+    new->autologin_timeout = timeout ? MAX (atoi (timeout), 0) : 0;
+
+    g_object_freeze_notify (G_OBJECT (greeter));
+    if (g_strcmp0 (old.default_session, new->default_session) != 0)
+        g_object_notify (G_OBJECT (greeter), "default-session-hint");
+    if (old.hide_users != new->hide_users)
+        g_object_notify (G_OBJECT (greeter), "hide-users-hint");
+    if (old.show_manual_login != new->show_manual_login)
+        g_object_notify (G_OBJECT (greeter), "show-manual-login-hint");
+    if (old.show_remote_login != new->show_remote_login)
+        g_object_notify (G_OBJECT (greeter), "show-remote-login-hint");
+    if (old.lock != new->lock)
+        g_object_notify (G_OBJECT (greeter), "lock-hint");
+    if (old.has_guest_account != new->has_guest_account)
+        g_object_notify (G_OBJECT (greeter), "has-guest-account-hint");
+    if (g_strcmp0 (old.select_user, new->select_user) != 0)
+        g_object_notify (G_OBJECT (greeter), "select-user-hint");
+    if (old.select_guest != new->select_guest)
+        g_object_notify (G_OBJECT (greeter), "select-guest-hint");
+    if (g_strcmp0 (old.autologin_user, new->autologin_user) != 0)
+        g_object_notify (G_OBJECT (greeter), "autologin-user-hint");
+    if (g_strcmp0 (old.autologin_session, new->autologin_session) != 0)
+        g_object_notify (G_OBJECT (greeter), "autologin-session-hint");
+    if (old.autologin_guest != new->autologin_guest)
+        g_object_notify (G_OBJECT (greeter), "autologin-guest-hint");
+    if (old.autologin_timeout != new->autologin_timeout)
+        g_object_notify (G_OBJECT (greeter), "autologin-timeout-hint");
+    hint_values_clear (&old);
+    g_object_thaw_notify (G_OBJECT (greeter));
+}
+
+/* Pass on the system information the daemon sends, so it doesn't need to be read from the filesystem */
+static void
+update_system_info (LightDMGreeter *greeter)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    const gchar *hostname = g_hash_table_lookup (priv->hints, "hostname");
+    if (!hostname)
+        return;
+
+    const gchar *motd = g_hash_table_lookup (priv->hints, "motd");
+    system_set_daemon_info (hostname, g_hash_table_lookup (priv->hints, "os-release"), motd && motd[0] != '\0' ? motd : NULL);
+}
+
 static void
-handle_connected (LightDMGreeter *greeter, gboolean v2, guint8 *message, gsize message_length, gsize *offset)
+handle_connected (LightDMGreeter *greeter, ServerMessage id, guint8 *message, gsize message_length, gsize *offset)
 {
     LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
     int timeout;
     Request *request;
 
     g_autoptr(GString) debug_string = g_string_new ("Connected");
-    if (v2)
+    if (id == SERVER_MESSAGE_CONNECTED_V3)
+    {
+        priv->api_version = read_int (message, message_length, offset);
+        g_string_append_printf (debug_string, " api=%u", priv->api_version);
+        g_autofree gchar *version = read_string (message, message_length, offset);
+        g_string_append_printf (debug_string, " version=%s", version);
+        g_ptr_array_unref (read_hint_table (greeter, message, message_length, offset, debug_string));
+    }
+    else if (id == SERVER_MESSAGE_CONNECTED_V2)
     {
         priv->api_version = read_int (message, message_length, offset);
         g_string_append_printf (debug_string, " api=%u", priv->api_version);
@@ -603,12 +865,16 @@ handle_connected (LightDMGreeter *greeter, gboolean v2, guint8 *message, gsize m
     priv->connected = TRUE;
     g_debug ("%s", debug_string->str);
 
+    update_hint_values (greeter);
+    update_system_info (greeter);
+
     /* Set timeout for default login */
     timeout = lightdm_greeter_get_autologin_timeout_hint (greeter);
     if (timeout)
     {
         g_debug ("Setting autologin timer for %d seconds", timeout);
-        priv->autologin_timeout = g_timeout_add (timeout * 1000, timed_login_cb, greeter);
+        clear_source (&priv->autologin_source);
+        priv->autologin_source = attach_source (greeter, g_timeout_source_new (timeout * 1000), timed_login_cb, greeter, NULL);
     }
 
     /* Notify asynchronous caller */
@@ -740,9 +1006,30 @@ handle_reset (LightDMGreeter *greeter, guint8 *message, gsize message_length, gs
 
     g_debug ("Reset%s", hint_string->str);
 
+    update_hint_values (greeter);
+    update_system_info (greeter);
+
     g_signal_emit (G_OBJECT (greeter), signals[RESET], 0);
 }
 
+static void
+handle_hints_changed (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
+{
+    g_autoptr(GString) hint_string = g_string_new ("");
+    g_autoptr(GPtrArray) changed = read_hint_table (greeter, message, message_length, offset, hint_string);
+
+    g_debug ("Hints changed%s", hint_string->str);
+
+    update_hint_values (greeter);
+    update_system_info (greeter);
+
+    for (guint i = 0; i < changed->len; i++)
+    {
+        const gchar *name = g_ptr_array_index (changed, i);
+        g_signal_emit (G_OBJECT (greeter), signals[HINT_CHANGED], g_quark_from_string (name), name);
+    }
+}
+
 static void
 handle_session_result (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
 {
@@ -788,6 +1075,23 @@ handle_shared_dir_result (LightDMGreeter *greeter, guint8 *message, gsize messag
     }
 }
 
+/* Answer from the main loop so the daemon can tell if the greeter has stopped responding */
+static void
+handle_ping (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
+{
+    guint32 sequence_number = read_int (message, message_length, offset);
+
+    guint8 reply[MAX_MESSAGE_LENGTH];
+    gsize reply_offset = 0;
+    g_autoptr(GError) error = NULL;
+    if (!write_header (reply, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_PONG, int_length (), &reply_offset, &error) ||
+        !write_int (reply, MAX_MESSAGE_LENGTH, sequence_number, &reply_offset, &error) ||
+        !send_message (greeter, reply, reply_offset, &error))
+        g_warning ("Failed to answer ping: %s", error->message);
+}
+
+static void handle_shared_memory (LightDMGreeter *greeter);
+
 static void
 handle_message (LightDMGreeter *greeter, guint8 *message, gsize message_length)
 {
@@ -797,7 +1101,7 @@ handle_message (LightDMGreeter *greeter, guint8 *message, gsize message_length)
     switch (id)
     {
     case SERVER_MESSAGE_CONNECTED:
-        handle_connected (greeter, FALSE, message, message_length, &offset);
+        handle_connected (greeter, id, message, message_length, &offset);
         break;
     case SERVER_MESSAGE_PROMPT_AUTHENTICATION:
         handle_prompt_authentication (greeter, message, message_length, &offset);
@@ -818,7 +1122,17 @@ handle_message (LightDMGreeter *greeter, guint8 *message, gsize message_length)
         handle_reset (greeter, message, message_length, &offset);
         break;
     case SERVER_MESSAGE_CONNECTED_V2:
-        handle_connected (greeter, TRUE, message, message_length, &offset);
+    case SERVER_MESSAGE_CONNECTED_V3:
+        handle_connected (greeter, id, message, message_length, &offset);
+        break;
+    case SERVER_MESSAGE_HINTS_CHANGED:
+        handle_hints_changed (greeter, message, message_length, &offset);
+        break;
+    case SERVER_MESSAGE_SHARED_MEMORY:
+        handle_shared_memory (greeter);
+        break;
+    case SERVER_MESSAGE_PING:
+        handle_ping (greeter, message, message_length, &offset);
         break;
     default:
         g_warning ("Unknown message from server: %d", id);
@@ -826,112 +1140,292 @@ handle_message (LightDMGreeter *greeter, guint8 *message, gsize message_length)
     }
 }
 
+/* Handle a message the daemon has put in shared memory, the data is used where it is mapped */
+static void
+handle_shared_memory (LightDMGreeter *greeter)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    if (g_queue_is_empty (priv->received_fds))
+    {
+        g_warning ("Shared memory message from daemon without a file descriptor");
+        return;
+    }
+    int fd = GPOINTER_TO_INT (g_queue_pop_head (priv->received_fds));
+
+    /* The daemon can't change the data while we are reading it */
+    int seals = fcntl (fd, F_GET_SEALS);
+    struct stat info;
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+        fstat (fd, &info) != 0 || info.st_size < HEADER_SIZE)
+    {
+        g_warning ("Ignoring invalid shared memory message from daemon");
+        close (fd);
+        return;
+    }
+
+    gsize length = info.st_size;
+    guint8 *data = mmap (NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED)
+    {
+        g_warning ("Failed to map shared memory message from daemon: %s", strerror (errno));
+        return;
+    }
+
+    gsize offset = 0;
+    guint32 id = read_int (data, length, &offset);
+    if (id == SERVER_MESSAGE_SHARED_MEMORY || HEADER_SIZE + get_message_length (data, length) != length)
+        g_warning ("Ignoring invalid shared memory message from daemon");
+    else
+        handle_message (greeter, data, length);
+
+    munmap (data, length);
+}
+
+/* Read from the daemon, keeping any file descriptors sent with the data */
+static GIOStatus
+read_from_server (LightDMGreeter *greeter, guint8 *buffer, gsize count, gsize *n_read, GError **error)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    if (!priv->socket)
+        return g_io_channel_read_chars (priv->from_server_channel, (gchar *) buffer, count, n_read, error);
+
+    struct iovec vector = { buffer, count };
+    union
+    {
+        struct cmsghdr header;
+        guint8 buffer[CMSG_SPACE (sizeof (int) * 4)];
+    } control;
+    struct msghdr header = { 0 };
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof (control.buffer);
+
+    *n_read = 0;
+    ssize_t n = recvmsg (g_socket_get_fd (priv->socket), &header, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (n < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return G_IO_STATUS_AGAIN;
+        g_set_error_literal (error, G_IO_CHANNEL_ERROR, g_io_channel_error_from_errno (errno), strerror (errno));
+        return G_IO_STATUS_ERROR;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&header); cmsg; cmsg = CMSG_NXTHDR (&header, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        gsize n_fds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+        for (gsize i = 0; i < n_fds; i++)
+        {
+            int fd;
+            memcpy (&fd, CMSG_DATA (cmsg) + i * sizeof (int), sizeof (int));
+            g_queue_push_tail (priv->received_fds, GINT_TO_POINTER (fd));
+        }
+    }
+
+    if (n == 0)
+    {
+        g_set_error_literal (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_FAILED, "Connection closed");
+        return G_IO_STATUS_EOF;
+    }
+
+    *n_read = n;
+    return G_IO_STATUS_NORMAL;
+}
+
+/* TRUE if more data from the daemon can be read without blocking */
 static gboolean
-recv_message (LightDMGreeter *greeter, gboolean block, guint8 **message, gsize *length, GError **error)
+have_server_data (LightDMGreeter *greeter, GIOChannel *source)
 {
     LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
 
-    if (!connect_to_daemon (greeter, error))
-        return FALSE;
+    if (priv->socket)
+        return (g_socket_condition_check (priv->socket, G_IO_IN) & G_IO_IN) != 0;
+    return (g_io_channel_get_buffer_condition (source) & G_IO_IN) != 0;
+}
 
-    /* Read the header, or the whole message if we already have that */
-    gsize n_to_read = HEADER_SIZE;
-    if (priv->n_read >= HEADER_SIZE)
-        n_to_read += get_message_length (priv->read_buffer, priv->n_read);
+/* Wait until the daemon has sent more data, or the deadline (-1 for none) passes */
+static gboolean
+wait_for_server (LightDMGreeter *greeter, gint64 deadline, GError **error)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
 
-    do
+    struct pollfd fd = { 0 };
+    fd.fd = priv->socket ? g_socket_get_fd (priv->socket) : g_io_channel_unix_get_fd (priv->from_server_channel);
+    fd.events = POLLIN;
+
+    while (TRUE)
     {
-        gsize n_read;
-        g_autoptr(GError) read_error = NULL;
-        GIOStatus status = g_io_channel_read_chars (priv->from_server_channel,
-                                          (gchar *) priv->read_buffer + priv->n_read,
-                                          n_to_read - priv->n_read,
-                                          &n_read,
-                                          &read_error);
-        if (status == G_IO_STATUS_AGAIN)
+        int timeout = -1;
+        if (deadline >= 0)
         {
-            if (block)
-                continue;
+            gint64 remaining = deadline - g_get_monotonic_time ();
+            if (remaining <= 0)
+                break;
+            timeout = (int) MIN ((remaining + 999) / 1000, G_MAXINT);
         }
-        else if (status != G_IO_STATUS_NORMAL)
+
+        int n = poll (&fd, 1, timeout);
+        if (n > 0)
+            return TRUE;
+        if (n < 0 && errno != EINTR)
         {
             g_set_error (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_COMMUNICATION_ERROR,
-                         "Failed to read from daemon: %s",
-                         read_error->message);
+                         "Failed to wait for daemon: %s", strerror (errno));
             return FALSE;
         }
+    }
 
-        g_debug ("Read %zi bytes from daemon", n_read);
+    g_set_error (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_TIMED_OUT,
+                 "Daemon did not reply within %ums", priv->sync_timeout);
+    return FALSE;
+}
 
-        priv->n_read += n_read;
-    } while (priv->n_read < n_to_read && block);
+static gboolean
+recv_message (LightDMGreeter *greeter, gboolean block, guint8 **message, gsize *length, GError **error)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
 
-    /* Stop if haven't got all the data we want */
-    if (priv->n_read != n_to_read)
-    {
-        if (message)
-            *message = NULL;
-        if (length)
-            *length = 0;
-        return TRUE;
-    }
+    if (!connect_to_daemon (greeter, error))
+        return FALSE;
+
+    if (!priv->read_buffer)
+        priv->read_buffer = g_byte_array_sized_new (HEADER_SIZE);
+
+    gint64 deadline = block && priv->sync_timeout > 0 ? g_get_monotonic_time () + (gint64) priv->sync_timeout * 1000 : -1;
 
-    /* If have header, rerun for content */
-    if (priv->n_read == HEADER_SIZE)
+    while (TRUE)
     {
-        n_to_read = get_message_length (priv->read_buffer, priv->n_read);
-        if (n_to_read > 0)
+        /* Read the header, or the whole message if we already have that */
+        gsize n_to_read = HEADER_SIZE;
+        if (priv->n_read >= HEADER_SIZE)
+            n_to_read += get_message_length (priv->read_buffer->data, priv->n_read);
+        if (priv->read_buffer->len < n_to_read)
+            g_byte_array_set_size (priv->read_buffer, n_to_read);
+
+        do
         {
-            priv->read_buffer = g_realloc (priv->read_buffer, HEADER_SIZE + n_to_read);
-            return recv_message (greeter, block, message, length, error);
+            /* Sleep until there is something to read, rather than in the read, so the timeout applies */
+            if (block && !have_server_data (greeter, priv->from_server_channel) && !wait_for_server (greeter, deadline, error))
+                return FALSE;
+
+            gsize n_read;
+            g_autoptr(GError) read_error = NULL;
+            GIOStatus status = read_from_server (greeter,
+                                                 priv->read_buffer->data + priv->n_read,
+                                                 n_to_read - priv->n_read,
+                                                 &n_read,
+                                                 &read_error);
+            if (status == G_IO_STATUS_AGAIN)
+                continue;
+            else if (status != G_IO_STATUS_NORMAL)
+            {
+                g_set_error (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_COMMUNICATION_ERROR,
+                             "Failed to read from daemon: %s",
+                             read_error->message);
+                return FALSE;
+            }
+
+            priv->n_read += n_read;
+        } while (priv->n_read < n_to_read && block);
+
+        /* Stop if haven't got all the data we want */
+        if (priv->n_read != n_to_read)
+        {
+            if (message)
+                *message = NULL;
+            if (length)
+                *length = 0;
+            return TRUE;
         }
+
+        /* If have header, rerun for content */
+        if (priv->n_read == HEADER_SIZE && get_message_length (priv->read_buffer->data, priv->n_read) > 0)
+            continue;
+
+        break;
     }
 
+    /* The message stays in our buffer, it is only valid until the next read */
     if (message)
-        *message = priv->read_buffer;
-    else
-        g_free (priv->read_buffer);
+        *message = priv->read_buffer->data;
     if (length)
         *length = priv->n_read;
-
-    priv->read_buffer = g_malloc (priv->n_read);
     priv->n_read = 0;
 
     return TRUE;
 }
 
+static void
+dispatch_message (LightDMGreeter *greeter, guint8 *message, gsize message_length)
+{
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
+    /* Signal handlers may make synchronous calls that read more messages, so
+     * they get a new buffer while this message is being handled */
+    GByteArray *buffer = g_steal_pointer (&priv->read_buffer);
+    handle_message (greeter, message, message_length);
+    if (priv->read_buffer)
+        g_byte_array_unref (buffer);
+    else
+        priv->read_buffer = buffer;
+}
+
 static gboolean
 from_server_cb (GIOChannel *source, GIOCondition condition, gpointer data)
 {
     LightDMGreeter *greeter = data;
+    gboolean result = G_SOURCE_CONTINUE;
 
-    /* Read one message and process it */
-    g_autofree guint8 *message = NULL;
-    gsize message_length;
-    g_autoptr(GError) error = NULL;
-    if (!recv_message (greeter, FALSE, &message, &message_length, &error))
+    /* Process all the messages that have been received, keeping the greeter
+     * alive in case a handler drops the last reference */
+    g_object_ref (greeter);
+    do
     {
-        // FIXME: Should push this up to the client somehow
-        g_warning ("Failed to read from daemon: %s\n", error->message);
-        return G_SOURCE_REMOVE;
-    }
+        guint8 *message = NULL;
+        gsize message_length;
+        g_autoptr(GError) error = NULL;
+        if (!recv_message (greeter, FALSE, &message, &message_length, &error))
+        {
+            // FIXME: Should push this up to the client somehow
+            g_warning ("Failed to read from daemon: %s\n", error->message);
+            result = G_SOURCE_REMOVE;
+            break;
+        }
 
-    if (message)
-        handle_message (greeter, message, message_length);
+        if (!message)
+            break;
+        dispatch_message (greeter, message, message_length);
+    } while (G_OBJECT (greeter)->ref_count > 1 && have_server_data (greeter, source));
+    g_object_unref (greeter);
 
-    return G_SOURCE_CONTINUE;
+    return result;
 }
 
 static gboolean
 send_connect (LightDMGreeter *greeter, gboolean resettable, GError **error)
 {
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+
     g_debug ("Connecting to display manager...");
+    if (!connect_to_daemon (greeter, error))
+        return FALSE;
+
+    /* API version 3 adds shared memory messages, API version 4 adds pings and API version 5 says
+     * which features are supported. Shared memory needs a socket to pass the file descriptors */
+    guint32 features = priv->socket ? GREETER_FEATURE_SHARED_MEMORY : 0;
+
     guint8 message[MAX_MESSAGE_LENGTH];
     gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_CONNECT, string_length (VERSION) + int_length () * 2, &offset, error) &&
+    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_CONNECT, string_length (VERSION) + int_length () * 3, &offset, error) &&
            write_string (message, MAX_MESSAGE_LENGTH, VERSION, &offset, error) &&
            write_int (message, MAX_MESSAGE_LENGTH, resettable ? 1 : 0, &offset, error) &&
            write_int (message, MAX_MESSAGE_LENGTH, API_VERSION, &offset, error) &&
+           write_int (message, MAX_MESSAGE_LENGTH, features, &offset, error) &&
            send_message (greeter, message, offset, error);
 }
 
@@ -1038,11 +1532,11 @@ lightdm_greeter_connect_to_daemon_sync (LightDMGreeter *greeter, GError **error)
     priv->connect_requests = g_list_append (priv->connect_requests, g_object_ref (request));
     do
     {
-        g_autofree guint8 *message = NULL;
+        guint8 *message = NULL;
         gsize message_length;
         if (!recv_message (greeter, TRUE, &message, &message_length, error))
             return FALSE;
-        handle_message (greeter, message, message_length);
+        dispatch_message (greeter, message, message_length);
     } while (!request->complete);
 
     return lightdm_greeter_connect_to_daemon_finish (greeter, G_ASYNC_RESULT (request), error);
@@ -1065,6 +1559,386 @@ lightdm_greeter_connect_sync (LightDMGreeter *greeter, GError **error)
     return lightdm_greeter_connect_to_daemon_sync (greeter, error);
 }
 
+/**
+ * lightdm_greeter_get_fd:
+ * @greeter: A #LightDMGreeter
+ *
+ * Get the file descriptor messages from the daemon are read from, for greeters
+ * that drive the greeter with lightdm_greeter_process_events() instead of a
+ * GLib main loop.
+ *
+ * Return value: a file descriptor to watch for input, or -1 if not connected
+ * or the connection to the daemon has failed.
+ **/
+gint
+lightdm_greeter_get_fd (LightDMGreeter *greeter)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), -1);
+
+    LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
+    if (!priv->from_server_source || g_source_is_destroyed (priv->from_server_source))
+        return -1;
+    return g_io_channel_unix_get_fd (priv->from_server_channel);
+}
+
+/**
+ * lightdm_greeter_process_events:
+ * @greeter: A #LightDMGreeter
+ *
+ * Handle any messages from the daemon and expired timers without blocking.
+ * This lets toolkits that don't run a GLib main loop drive the greeter from
+ * their own event loop: create the greeter with a new #GMainContext pushed as
+ * the thread-default context (see lightdm_greeter_new()), then call this
+ * function when the file descriptor from lightdm_greeter_get_fd() is readable,
+ * when the returned timeout expires and after calling other greeter functions.
+ *
+ * Return value: the number of milliseconds until this should be called again
+ * even if there is no input, or -1 if only input needs to be waited for.
+ **/
+gint
+lightdm_greeter_process_events (LightDMGreeter *greeter)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), -1);
+
+    /* Handlers may drop the last reference to the greeter */
+    g_autoptr(GMainContext) context = g_main_context_ref (GET_PRIVATE (greeter)->context);
+
+    while (g_main_context_iteration (context, FALSE));
+
+    /* Find how long until the next timer expires without waiting for it */
+    gint timeout = -1;
+    if (g_main_context_acquire (context))
+    {
+        gint priority;
+        if (g_main_context_prepare (context, &priority))
+            timeout = 0;
+        else
+            g_main_context_query (context, priority, &timeout, NULL, 0);
+        g_main_context_release (context);
+    }
+
+    return timeout;
+}
+
+/* A daemon serving several displays frames messages as [display id][length][data],
+ * display id 0 carries control messages and the other ids the greeter protocol */
+#define DISPLAY_HOST_HEADER_SIZE 8
+#define DISPLAY_HOST_CONTROL_ID 0
+
+typedef enum
+{
+    DISPLAY_HOST_MESSAGE_ADD_DISPLAY = 0,
+    DISPLAY_HOST_MESSAGE_REMOVE_DISPLAY
+} DisplayHostMessage;
+
+/* A display served over the shared connection */
+typedef struct
+{
+    guint32 id;
+    LightDMGreeter *greeter;
+    gchar *seat_name;
+    gchar *display;
+    gchar *x_authority;
+
+    /* Our end of the socket pair to the greeter */
+    int fd;
+    GIOChannel *channel;
+    GSource *source;
+} SharedDisplay;
+
+typedef struct
+{
+    GSocket *socket;
+    GSource *source;
+
+    /* Context the displays are served in */
+    GMainContext *context;
+
+    /* Data read from the daemon that is not yet a full message */
+    GByteArray *read_buffer;
+
+    /* Displays being served keyed by id */
+    GHashTable *displays;
+
+    LightDMGreeterDisplayFunc added_callback;
+    LightDMGreeterDisplayFunc removed_callback;
+    gpointer user_data;
+} DisplayHost;
+
+static DisplayHost *display_host = NULL;
+
+static void
+shared_display_free (SharedDisplay *display)
+{
+    clear_source (&display->source);
+    g_clear_pointer (&display->channel, g_io_channel_unref);
+    if (display->fd >= 0)
+        close (display->fd);
+    g_clear_object (&display->greeter);
+    g_free (display->seat_name);
+    g_free (display->display);
+    g_free (display->x_authority);
+    g_free (display);
+}
+
+static void
+remove_shared_display (SharedDisplay *display)
+{
+    if (display_host->removed_callback)
+        display_host->removed_callback (display->greeter, display->seat_name, display->display, display->x_authority, display_host->user_data);
+    shared_display_free (display);
+}
+
+static void
+display_host_free (void)
+{
+    g_autoptr(GList) displays = g_hash_table_get_values (display_host->displays);
+    g_hash_table_steal_all (display_host->displays);
+    for (GList *link = displays; link; link = link->next)
+        remove_shared_display (link->data);
+
+    if (display_host->source)
+        g_source_destroy (display_host->source);
+    g_clear_pointer (&display_host->source, g_source_unref);
+    g_clear_object (&display_host->socket);
+    g_byte_array_unref (display_host->read_buffer);
+    g_hash_table_unref (display_host->displays);
+    g_main_context_unref (display_host->context);
+    g_clear_pointer (&display_host, g_free);
+}
+
+static gboolean
+write_all (int fd, const guint8 *data, gsize length)
+{
+    while (length > 0)
+    {
+        ssize_t n_written = write (fd, data, length);
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        data += n_written;
+        length -= n_written;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+shared_display_read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    SharedDisplay *display = data;
+
+    guint8 buffer[4096];
+    ssize_t n_read = read (display->fd, buffer + DISPLAY_HOST_HEADER_SIZE, sizeof (buffer) - DISPLAY_HOST_HEADER_SIZE);
+    if (n_read <= 0)
+    {
+        g_clear_pointer (&display->source, g_source_unref);
+        return G_SOURCE_REMOVE;
+    }
+
+    gsize offset = 0;
+    write_header (buffer, sizeof (buffer), display->id, n_read, &offset, NULL);
+    if (!write_all (g_socket_get_fd (display_host->socket), buffer, DISPLAY_HOST_HEADER_SIZE + n_read))
+        g_warning ("Failed to write to daemon: %s", strerror (errno));
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+add_shared_display (guint32 id, gchar *seat_name, gchar *display_name, gchar *x_authority)
+{
+    int fds[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        g_warning ("Failed to create socket pair for display %s: %s", display_name, strerror (errno));
+        g_free (seat_name);
+        g_free (display_name);
+        g_free (x_authority);
+        return;
+    }
+
+    SharedDisplay *display = g_malloc0 (sizeof (SharedDisplay));
+    display->id = id;
+    display->seat_name = seat_name;
+    display->display = display_name;
+    display->x_authority = x_authority;
+    display->fd = fds[1];
+    display->channel = g_io_channel_unix_new (display->fd);
+    display->source = g_io_create_watch (display->channel, G_IO_IN | G_IO_HUP);
+    g_source_set_callback (display->source, (GSourceFunc) shared_display_read_cb, display, NULL);
+    g_source_attach (display->source, display_host->context);
+
+    /* The greeter talks to its end of the pair as if it was the daemon */
+    g_main_context_push_thread_default (display_host->context);
+    display->greeter = lightdm_greeter_new ();
+    g_main_context_pop_thread_default (display_host->context);
+    LightDMGreeterPrivate *priv = GET_PRIVATE (display->greeter);
+    priv->from_server_channel = g_io_channel_unix_new (fds[0]);
+    g_io_channel_set_close_on_unref (priv->from_server_channel, TRUE);
+    priv->to_server_channel = g_io_channel_ref (priv->from_server_channel);
+    g_autoptr(GError) error = NULL;
+    if (!watch_server_channels (display->greeter, &error))
+        g_warning ("Failed to set up channel for display %s: %s", display->display, error->message);
+
+    g_hash_table_insert (display_host->displays, GUINT_TO_POINTER (id), display);
+    if (display_host->added_callback)
+        display_host->added_callback (display->greeter, display->seat_name, display->display, display->x_authority, display_host->user_data);
+}
+
+static void
+handle_display_host_control (guint8 *message, gsize message_length)
+{
+    gsize offset = 0;
+    guint32 type = read_int (message, message_length, &offset);
+    guint32 id = read_int (message, message_length, &offset);
+
+    switch (type)
+    {
+    case DISPLAY_HOST_MESSAGE_ADD_DISPLAY:
+    {
+        gchar *seat_name = read_string (message, message_length, &offset);
+        gchar *display_name = read_string (message, message_length, &offset);
+        gchar *x_authority = read_string (message, message_length, &offset);
+        g_debug ("Adding display %s for seat %s", display_name, seat_name);
+        add_shared_display (id, seat_name, display_name, x_authority);
+        break;
+    }
+    case DISPLAY_HOST_MESSAGE_REMOVE_DISPLAY:
+    {
+        SharedDisplay *display = g_hash_table_lookup (display_host->displays, GUINT_TO_POINTER (id));
+        if (!display)
+            break;
+        g_debug ("Removing display %s for seat %s", display->display, display->seat_name);
+        g_hash_table_steal (display_host->displays, GUINT_TO_POINTER (id));
+        remove_shared_display (display);
+        break;
+    }
+    default:
+        g_warning ("Unknown control message from daemon: %u", type);
+        break;
+    }
+}
+
+static void
+handle_display_host_message (guint32 id, guint8 *message, gsize message_length)
+{
+    if (id == DISPLAY_HOST_CONTROL_ID)
+    {
+        handle_display_host_control (message, message_length);
+        return;
+    }
+
+    SharedDisplay *display = g_hash_table_lookup (display_host->displays, GUINT_TO_POINTER (id));
+    if (!display)
+        return;
+
+    if (!write_all (display->fd, message, message_length))
+        g_warning ("Failed to pass message to display %s: %s", display->display, strerror (errno));
+}
+
+static gboolean
+display_host_read_cb (GSocket *socket, GIOCondition condition, gpointer data)
+{
+    guint8 buffer[4096];
+    g_autoptr(GError) error = NULL;
+    gssize n_read = g_socket_receive (socket, (gchar *) buffer, sizeof (buffer), NULL, &error);
+    if (n_read <= 0)
+    {
+        if (error)
+            g_warning ("Failed to read from daemon: %s", error->message);
+        g_debug ("Daemon closed shared greeter connection");
+        g_clear_pointer (&display_host->source, g_source_unref);
+        display_host_free ();
+        return G_SOURCE_REMOVE;
+    }
+    g_byte_array_append (display_host->read_buffer, buffer, n_read);
+
+    /* Handle all the complete messages */
+    gsize offset = 0;
+    while (display_host->read_buffer->len - offset >= DISPLAY_HOST_HEADER_SIZE)
+    {
+        guint8 *header = display_host->read_buffer->data + offset;
+        gsize header_offset = 0;
+        guint32 id = read_int (header, DISPLAY_HOST_HEADER_SIZE, &header_offset);
+        guint32 length = read_int (header, DISPLAY_HOST_HEADER_SIZE, &header_offset);
+        if (display_host->read_buffer->len - offset - DISPLAY_HOST_HEADER_SIZE < length)
+            break;
+        handle_display_host_message (id, header + DISPLAY_HOST_HEADER_SIZE, length);
+        offset += DISPLAY_HOST_HEADER_SIZE + length;
+    }
+    g_byte_array_remove_range (display_host->read_buffer, 0, offset);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * LightDMGreeterDisplayFunc:
+ * @greeter: The #LightDMGreeter for this display
+ * @seat_name: The name of the seat the display is on
+ * @display: The X display to show the greeter on (empty if not an X display)
+ * @x_authority: The X authority file for the display (empty if not an X display)
+ * @user_data: The user data passed to lightdm_greeter_serve_displays()
+ *
+ * Called when a display is added or removed from a greeter serving several displays.
+ */
+
+/**
+ * lightdm_greeter_serve_displays:
+ * @path: (allow-none): The socket to connect to or #NULL to use the LIGHTDM_GREETER_HOST_SOCKET environment variable
+ * @added_callback: (scope forever): A function to call when a display needs a greeter
+ * @removed_callback: (scope forever) (allow-none): A function to call when a display no longer needs a greeter
+ * @user_data: (closure): Data to pass to the callbacks
+ * @error: return location for a #GError, or %NULL
+ *
+ * Connect to the daemon as a greeter serving several displays at once. Each
+ * time the daemon wants a greeter on a display @added_callback is called with a
+ * new #LightDMGreeter for it, which is used the same way as a greeter
+ * connecting with lightdm_greeter_connect_to_daemon(). The greeter is unreferenced
+ * after @removed_callback is called.
+ *
+ * Return value: #TRUE if successfully connected
+ **/
+gboolean
+lightdm_greeter_serve_displays (const gchar *path, LightDMGreeterDisplayFunc added_callback, LightDMGreeterDisplayFunc removed_callback, gpointer user_data, GError **error)
+{
+    g_return_val_if_fail (added_callback != NULL, FALSE);
+    g_return_val_if_fail (display_host == NULL, FALSE);
+
+    if (!path)
+        path = g_getenv ("LIGHTDM_GREETER_HOST_SOCKET");
+    if (!path)
+    {
+        g_set_error_literal (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_CONNECTION_FAILED,
+                             "Unable to determine socket to daemon");
+        return FALSE;
+    }
+
+    g_autoptr(GSocket) socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, error);
+    if (!socket)
+        return FALSE;
+
+    g_autoptr(GSocketAddress) address = g_unix_socket_address_new (path);
+    if (!g_socket_connect (socket, address, NULL, error))
+        return FALSE;
+
+    display_host = g_malloc0 (sizeof (DisplayHost));
+    display_host->socket = g_steal_pointer (&socket);
+    display_host->read_buffer = g_byte_array_new ();
+    display_host->displays = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) shared_display_free);
+    display_host->added_callback = added_callback;
+    display_host->removed_callback = removed_callback;
+    display_host->user_data = user_data;
+    display_host->context = g_main_context_ref_thread_default ();
+    display_host->source = g_socket_create_source (display_host->socket, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback (display_host->source, (GSourceFunc) display_host_read_cb, NULL, NULL);
+    g_source_attach (display_host->source, display_host->context);
+
+    return TRUE;
+}
+
 /**
  * lightdm_greeter_get_hint:
  * @greeter: A #LightDMGreeter
@@ -1093,14 +1967,7 @@ const gchar *
 lightdm_greeter_get_default_session_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "default-session");
-}
-
-static gboolean
-get_boolean_hint (LightDMGreeter *greeter, const gchar *name)
-{
-    const gchar *value = lightdm_greeter_get_hint (greeter, name);
-    return g_strcmp0 (value, "true") == 0;
+    return GET_PRIVATE (greeter)->hint_values.default_session;
 }
 
 /**
@@ -1121,7 +1988,7 @@ gboolean
 lightdm_greeter_get_hide_users_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "hide-users");
+    return GET_PRIVATE (greeter)->hint_values.hide_users;
 }
 
 /**
@@ -1139,7 +2006,7 @@ gboolean
 lightdm_greeter_get_show_manual_login_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "show-manual-login");
+    return GET_PRIVATE (greeter)->hint_values.show_manual_login;
 }
 
 /**
@@ -1155,7 +2022,7 @@ gboolean
 lightdm_greeter_get_show_remote_login_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "show-remote-login");
+    return GET_PRIVATE (greeter)->hint_values.show_remote_login;
 }
 
 /**
@@ -1170,7 +2037,7 @@ gboolean
 lightdm_greeter_get_lock_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "lock-screen");
+    return GET_PRIVATE (greeter)->hint_values.lock;
 }
 
 /**
@@ -1184,12 +2051,8 @@ lightdm_greeter_get_lock_hint (LightDMGreeter *greeter)
 gboolean
 lightdm_greeter_get_has_guest_account_hint (LightDMGreeter *greeter)
 {
-    const gchar *value;
-
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    value = lightdm_greeter_get_hint (greeter, "has-guest-account");
-
-    return g_strcmp0 (value, "true") == 0;
+    return GET_PRIVATE (greeter)->hint_values.has_guest_account;
 }
 
 /**
@@ -1204,7 +2067,7 @@ const gchar *
 lightdm_greeter_get_select_user_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "select-user");
+    return GET_PRIVATE (greeter)->hint_values.select_user;
 }
 
 /**
@@ -1219,7 +2082,7 @@ gboolean
 lightdm_greeter_get_select_guest_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "select-guest");
+    return GET_PRIVATE (greeter)->hint_values.select_guest;
 }
 
 /**
@@ -1234,7 +2097,7 @@ const gchar *
 lightdm_greeter_get_autologin_user_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "autologin-user");
+    return GET_PRIVATE (greeter)->hint_values.autologin_user;
 }
 
 /**
@@ -1249,7 +2112,7 @@ const gchar *
 lightdm_greeter_get_autologin_session_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "autologin-session");
+    return GET_PRIVATE (greeter)->hint_values.autologin_session;
 }
 
 /**
@@ -1264,7 +2127,7 @@ gboolean
 lightdm_greeter_get_autologin_guest_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "autologin-guest");
+    return GET_PRIVATE (greeter)->hint_values.autologin_guest;
 }
 
 /**
@@ -1279,15 +2142,7 @@ gint
 lightdm_greeter_get_autologin_timeout_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-
-    const gchar *value = lightdm_greeter_get_hint (greeter, "autologin-timeout");
-    gint timeout = 0;
-    if (value)
-        timeout = atoi (value);
-    if (timeout < 0)
-        timeout = 0;
-
-    return timeout;
+    return GET_PRIVATE (greeter)->hint_values.autologin_timeout;
 }
 
 /**
@@ -1303,9 +2158,7 @@ lightdm_greeter_cancel_autologin (LightDMGreeter *greeter)
 
     LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
 
-    if (priv->autologin_timeout)
-       g_source_remove (priv->autologin_timeout);
-    priv->autologin_timeout = 0;
+    clear_source (&priv->autologin_source);
 }
 
 /**
@@ -1672,11 +2525,11 @@ lightdm_greeter_start_session_sync (LightDMGreeter *greeter, const gchar *sessio
     priv->start_session_requests = g_list_append (priv->start_session_requests, g_object_ref (request));
     do
     {
-        g_autofree guint8 *message = NULL;
+        guint8 *message = NULL;
         gsize message_length;
         if (!recv_message (greeter, TRUE, &message, &message_length, error))
             return FALSE;
-        handle_message (greeter, message, message_length);
+        dispatch_message (greeter, message, message_length);
     } while (!request->complete);
 
     return lightdm_greeter_start_session_finish (greeter, G_ASYNC_RESULT (request), error);
@@ -1774,11 +2627,11 @@ lightdm_greeter_ensure_shared_data_dir_sync (LightDMGreeter *greeter, const gcha
     priv->ensure_shared_data_dir_requests = g_list_append (priv->ensure_shared_data_dir_requests, g_object_ref (request));
     do
     {
-        g_autofree guint8 *message = NULL;
+        guint8 *message = NULL;
         gsize message_length;
         if (!recv_message (greeter, TRUE, &message, &message_length, error))
             return FALSE;
-        handle_message (greeter, message, message_length);
+        dispatch_message (greeter, message, message_length);
     } while (!request->complete);
 
     return lightdm_greeter_ensure_shared_data_dir_finish (greeter, G_ASYNC_RESULT (request), error);
@@ -1789,8 +2642,11 @@ lightdm_greeter_init (LightDMGreeter *greeter)
 {
     LightDMGreeterPrivate *priv = GET_PRIVATE (greeter);
 
-    priv->read_buffer = g_malloc (HEADER_SIZE);
+    priv->context = g_main_context_ref_thread_default ();
+    priv->read_buffer = g_byte_array_sized_new (HEADER_SIZE);
+    priv->received_fds = g_queue_new ();
     priv->hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->hint_keys = g_ptr_array_new_with_free_func (g_free);
 }
 
 static void
@@ -1873,10 +2729,13 @@ lightdm_greeter_finalize (GObject *object)
         g_io_channel_unref (priv->to_server_channel);
     if (priv->from_server_channel)
         g_io_channel_unref (priv->from_server_channel);
-    if (priv->from_server_watch)
-        g_source_remove (priv->from_server_watch);
-    priv->from_server_watch = 0;
-    g_clear_pointer (&priv->read_buffer, g_free);
+    clear_source (&priv->from_server_source);
+    clear_source (&priv->autologin_source);
+    g_clear_pointer (&priv->context, g_main_context_unref);
+    g_clear_pointer (&priv->read_buffer, g_byte_array_unref);
+    while (!g_queue_is_empty (priv->received_fds))
+        close (GPOINTER_TO_INT (g_queue_pop_head (priv->received_fds)));
+    g_queue_free (priv->received_fds);
     g_list_free_full (priv->responses_received, g_free);
     priv->responses_received = NULL;
     g_list_free_full (priv->connect_requests, g_object_unref);
@@ -1888,6 +2747,8 @@ lightdm_greeter_finalize (GObject *object)
     g_clear_pointer (&priv->authentication_user, g_free);
     g_hash_table_unref (priv->hints);
     priv->hints = NULL;
+    hint_values_clear (&priv->hint_values);
+    g_clear_pointer (&priv->hint_keys, g_ptr_array_unref);
 
     G_OBJECT_CLASS (lightdm_greeter_parent_class)->finalize (object);
 }
@@ -2131,6 +2992,27 @@ lightdm_greeter_class_init (LightDMGreeterClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 0);
+
+    /**
+     * LightDMGreeter::hint-changed:
+     * @greeter: A #LightDMGreeter
+     * @name: The name of the hint that has changed
+     *
+     * The ::hint-changed signal gets emitted when the daemon changes a hint
+     * after the greeter has connected. The signal is detailed with the hint
+     * name, e.g. "hint-changed::select-user".
+     *
+     * Use lightdm_greeter_get_hint() to get the new value, which is #NULL if
+     * the hint has been removed.
+     **/
+    signals[HINT_CHANGED] =
+        g_signal_new (LIGHTDM_GREETER_SIGNAL_HINT_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                      G_STRUCT_OFFSET (LightDMGreeterClass, hint_changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_STRING);
 }
 
 static void
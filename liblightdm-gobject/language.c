@@ -9,12 +9,11 @@
  */
 
 #include <string.h>
-#include <locale.h>
-#include <langinfo.h>
 #include <stdio.h>
 #include <glib/gi18n.h>
 
 #include "lightdm/language.h"
+#include "locale-names.h"
 
 /**
  * SECTION:language
@@ -54,44 +53,41 @@ G_DEFINE_TYPE_WITH_PRIVATE (LightDMLanguage, lightdm_language, G_TYPE_OBJECT)
 
 #define GET_PRIVATE(obj) G_TYPE_INSTANCE_GET_PRIVATE ((obj), LIGHTDM_TYPE_LANGUAGE, LightDMLanguagePrivate)
 
+/* Languages may be loaded from a thread by lightdm_prefetch_async() */
+static GMutex languages_lock;
 static gboolean have_languages = FALSE;
 static GList *languages = NULL;
 
 static void
 update_languages (void)
 {
+    g_mutex_lock (&languages_lock);
     if (have_languages)
+    {
+        g_mutex_unlock (&languages_lock);
         return;
+    }
 
-    const gchar *command = "locale -a";
-    g_autofree gchar *stdout_text = NULL;
-    g_autofree gchar *stderr_text = NULL;
-    gint exit_status;
-    g_autoptr(GError) error = NULL;
-    gboolean result = g_spawn_command_line_sync (command, &stdout_text, &stderr_text, &exit_status, &error);
-    if (error)
-        g_warning ("Failed to run '%s': %s", command, error->message);
-    else if (exit_status != 0)
-        g_warning ("Failed to get languages, '%s' returned %d", command, exit_status);
-    else if (result)
+    /* Use the names the daemon has already translated if possible */
+    const gchar *cache_path = g_getenv ("LIGHTDM_LOCALE_NAMES");
+    if (cache_path)
+        common_locale_names_load_cache (cache_path);
+
+    GPtrArray *codes = common_locale_names_get_codes ();
+    for (guint i = 0; i < codes->len; i++)
     {
-        g_auto(GStrv) tokens = g_strsplit_set (stdout_text, "\n\r", -1);
-        for (int i = 0; tokens[i]; i++)
-        {
-            const gchar *code = g_strchug (tokens[i]);
-            if (code[0] == '\0')
-                continue;
+        const gchar *code = g_ptr_array_index (codes, i);
 
-            /* Ignore the non-interesting languages */
-            if (strcmp (command, "locale -a") == 0 && !g_strrstr (code, ".utf8"))
-                continue;
+        /* Ignore the non-interesting languages */
+        if (!g_strrstr (code, ".utf8"))
+            continue;
 
-            LightDMLanguage *language = g_object_new (LIGHTDM_TYPE_LANGUAGE, "code", code, NULL);
-            languages = g_list_append (languages, language);
-        }
+        LightDMLanguage *language = g_object_new (LIGHTDM_TYPE_LANGUAGE, "code", code, NULL);
+        languages = g_list_append (languages, language);
     }
 
     have_languages = TRUE;
+    g_mutex_unlock (&languages_lock);
 }
 
 static gboolean
@@ -100,46 +96,6 @@ is_utf8 (const gchar *code)
     return g_strrstr (code, ".utf8") || g_strrstr (code, ".UTF-8");
 }
 
-/* Get a valid locale name that can be passed to setlocale(), so we always can use nl_langinfo() to get language and country names. */
-static gchar *
-get_locale_name (const gchar *code)
-{
-    if (is_utf8 (code))
-        return g_strdup (code);
-
-    g_autofree gchar *language = NULL;
-    const char *at = strchr (code, '@');
-    if (at)
-        language = g_strndup (code, at - code);
-    else
-        language = g_strdup (code);
-
-    static gchar **avail_locales;
-    if (!avail_locales)
-    {
-        g_autofree gchar *locales = NULL;
-        g_autoptr(GError) error = NULL;
-        if (g_spawn_command_line_sync ("locale -a", &locales, NULL, NULL, &error))
-            avail_locales = g_strsplit (g_strchomp (locales), "\n", -1);
-        else
-            g_warning ("Failed to run 'locale -a': %s", error->message);
-    }
-
-    if (!avail_locales)
-        return NULL;
-
-    for (gint i = 0; avail_locales[i]; i++)
-    {
-        const gchar *loc = avail_locales[i];
-        if (!g_strrstr (loc, ".utf8"))
-            continue;
-        if (g_str_has_prefix (loc, language))
-            return g_strdup (loc);
-    }
-
-    return NULL;
-}
-
 /**
  * lightdm_get_language:
  *
@@ -210,19 +166,8 @@ lightdm_language_get_name (LightDMLanguage *language)
 
     if (!priv->name)
     {
-        g_autofree gchar *locale = get_locale_name (priv->code);
-        if (locale)
-        {
-            const gchar *current = setlocale (LC_ALL, NULL);
-            setlocale (LC_IDENTIFICATION, locale);
-            setlocale (LC_MESSAGES, "");
-
-            const gchar *language_en = nl_langinfo (_NL_IDENTIFICATION_LANGUAGE);
-            if (language_en && strlen (language_en) > 0)
-                priv->name = g_strdup (dgettext ("iso_639_3", language_en));
-
-            setlocale (LC_ALL, current);
-        }
+        update_languages ();
+        common_locale_names_lookup (priv->code, &priv->name, NULL);
         if (!priv->name)
         {
             g_auto(GStrv) tokens = g_strsplit_set (priv->code, "_.@", 2);
@@ -250,19 +195,8 @@ lightdm_language_get_territory (LightDMLanguage *language)
 
     if (!priv->territory && strchr (priv->code, '_'))
     {
-        g_autofree gchar *locale = get_locale_name (priv->code);
-        if (locale)
-        {
-            gchar *current = setlocale (LC_ALL, NULL);
-            setlocale (LC_IDENTIFICATION, locale);
-            setlocale (LC_MESSAGES, "");
-
-            gchar *country_en = nl_langinfo (_NL_IDENTIFICATION_TERRITORY);
-            if (country_en && strlen (country_en) > 0 && g_strcmp0 (country_en, "ISO") != 0)
-                priv->territory = g_strdup (dgettext ("iso_3166", country_en));
-
-            setlocale (LC_ALL, current);
-        }
+        update_languages ();
+        common_locale_names_lookup (priv->code, NULL, &priv->territory);
         if (!priv->territory)
         {
             g_auto(GStrv) tokens = g_strsplit_set (priv->code, "_.@", 3);
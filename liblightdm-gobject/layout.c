@@ -9,6 +9,10 @@
  * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
  */
 
+#include <string.h>
+#include <locale.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <libxklavier/xklavier.h>
 
 #include "lightdm/layout.h"
@@ -51,6 +55,15 @@ G_DEFINE_TYPE_WITH_PRIVATE (LightDMLayout, lightdm_layout, G_TYPE_OBJECT)
 
 #define GET_PRIVATE(obj) G_TYPE_INSTANCE_GET_PRIVATE ((obj), LIGHTDM_TYPE_LAYOUT, LightDMLayoutPrivate)
 
+/* Format of the layout cache, bump the version when changing the type */
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(usta(sss))"
+
+/* Location of the XKB rules files the layouts are read from */
+#define XKB_RULES_DIR "/usr/share/X11/xkb/rules"
+
+/* Layouts may be loaded from a thread by lightdm_prefetch_async() */
+static GRecMutex layouts_lock;
 static gboolean have_layouts = FALSE;
 static Display *display = NULL;
 static XklEngine *xkl_engine = NULL;
@@ -58,6 +71,18 @@ static XklConfigRec *xkl_config = NULL;
 static GList *layouts = NULL;
 static LightDMLayout *default_layout = NULL;
 
+/* Name and descriptions of every layout and variant */
+static GMappedFile *catalog_file = NULL;
+static GVariant *catalog = NULL;
+
+/* Layouts that have been created from the catalog */
+static GHashTable *layout_objects = NULL;
+
+/* Layouts in the X server keymap, one per XKB group, most recently used first.
+ * Switching to one of these only needs the group changing, not a new keymap */
+#define MAX_GROUPS 4
+static gchar *groups[MAX_GROUPS] = { NULL };
+
 static gchar *
 make_layout_string (const gchar *layout, const gchar *variant)
 {
@@ -87,14 +112,20 @@ parse_layout_string (const gchar *name, gchar **layout, gchar **variant)
     }
 }
 
+typedef struct
+{
+    GVariantBuilder *builder;
+    const gchar *layout;
+} CatalogData;
+
 static void
 variant_cb (XklConfigRegistry *config,
            const XklConfigItem *item,
            gpointer data)
 {
-    g_autofree gchar *full_name = make_layout_string (data, item->name);
-    LightDMLayout *layout = g_object_new (LIGHTDM_TYPE_LAYOUT, "name", full_name, "short-description", item->short_description, "description", item->description, NULL);
-    layouts = g_list_append (layouts, layout);
+    CatalogData *catalog_data = data;
+    g_autofree gchar *full_name = make_layout_string (catalog_data->layout, item->name);
+    g_variant_builder_add (catalog_data->builder, "(sss)", full_name, item->short_description, item->description);
 }
 
 static void
@@ -102,49 +133,263 @@ layout_cb (XklConfigRegistry *config,
            const XklConfigItem *item,
            gpointer data)
 {
-    LightDMLayout *layout = g_object_new (LIGHTDM_TYPE_LAYOUT, "name", item->name, "short-description", item->short_description, "description", item->description, NULL);
-    layouts = g_list_append (layouts, layout);
+    GVariantBuilder *builder = data;
+    g_variant_builder_add (builder, "(sss)", item->name, item->short_description, item->description);
 
-    xkl_config_registry_foreach_layout_variant (config, item->name, variant_cb, (gpointer) item->name);
+    CatalogData catalog_data = { builder, item->name };
+    xkl_config_registry_foreach_layout_variant (config, item->name, variant_cb, &catalog_data);
 }
 
-/**
- * lightdm_get_layouts:
- *
- * Get a list of keyboard layouts to present to the user.
- *
- * Return value: (element-type LightDMLayout) (transfer none): A list of #LightDMLayout that should be presented to the user.
- **/
-GList *
-lightdm_get_layouts (void)
+static gchar *
+get_cache_path (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), "lightdm", "layouts.cache", NULL);
+}
+
+/* Identifies the installed rules, so the cache is refreshed when they change */
+static guint64
+get_rules_stamp (void)
+{
+    guint64 stamp = 0;
+
+    g_autoptr(GDir) dir = g_dir_open (XKB_RULES_DIR, 0, NULL);
+    if (!dir)
+        return stamp;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        if (!g_str_has_suffix (name, ".xml"))
+            continue;
+
+        g_autofree gchar *path = g_build_filename (XKB_RULES_DIR, name, NULL);
+        GStatBuf info;
+        if (g_stat (path, &info) == 0)
+            stamp = MAX (stamp, (guint64) info.st_mtime);
+    }
+
+    return stamp;
+}
+
+static const gchar *
+get_messages_locale (void)
+{
+    const gchar *locale = setlocale (LC_MESSAGES, NULL);
+    return locale ? locale : "";
+}
+
+static gboolean
+load_catalog_cache (const gchar *path, guint64 stamp)
+{
+    g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, NULL);
+    if (!file)
+        return FALSE;
+
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+    guint32 version;
+    const gchar *messages_locale;
+    guint64 cache_stamp;
+    g_autoptr(GVariant) entries = NULL;
+    g_variant_get (cache, "(u&st@a(sss))", &version, &messages_locale, &cache_stamp, &entries);
+    if (version != CACHE_VERSION || cache_stamp != stamp || g_strcmp0 (messages_locale, get_messages_locale ()) != 0)
+    {
+        g_debug ("Ignoring out of date layout cache %s", path);
+        return FALSE;
+    }
+
+    catalog_file = g_steal_pointer (&file);
+    catalog = g_steal_pointer (&entries);
+
+    return TRUE;
+}
+
+static void
+save_catalog_cache (const gchar *path, guint64 stamp)
+{
+    g_autofree gchar *dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (dir, 0700);
+
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new ("(ust@a(sss))", CACHE_VERSION, get_messages_locale (), stamp, catalog));
+    g_autoptr(GError) error = NULL;
+    if (!g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), &error))
+        g_debug ("Failed to write layout cache %s: %s", path, error->message);
+}
+
+/* Get the names of all the layouts, from the cache if the rules have not changed */
+static gboolean
+load_catalog_locked (void)
 {
-    if (have_layouts)
-        return layouts;
+    if (catalog)
+        return TRUE;
 
     display = XOpenDisplay (NULL);
     if (display == NULL)
-        return NULL;
+        return FALSE;
 
     xkl_engine = xkl_engine_get_instance (display);
     xkl_config = xkl_config_rec_new ();
     if (!xkl_config_rec_get_from_server (xkl_config, xkl_engine))
         g_warning ("Failed to get Xkl configuration from server");
+    for (guint i = 0; i < MAX_GROUPS && xkl_config->layouts && xkl_config->layouts[i]; i++)
+        groups[i] = make_layout_string (xkl_config->layouts[i], xkl_config->variants ? xkl_config->variants[i] : NULL);
+
+    g_autofree gchar *cache_path = get_cache_path ();
+    guint64 stamp = get_rules_stamp ();
+    if (load_catalog_cache (cache_path, stamp))
+        return TRUE;
 
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sss)"));
     XklConfigRegistry *registry = xkl_config_registry_get_instance (xkl_engine);
     xkl_config_registry_load (registry, FALSE);
-    xkl_config_registry_foreach_layout (registry, layout_cb, NULL);
+    xkl_config_registry_foreach_layout (registry, layout_cb, &builder);
     g_object_unref (registry);
+    catalog = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+    save_catalog_cache (cache_path, stamp);
+
+    return TRUE;
+}
+
+static gboolean
+load_catalog (void)
+{
+    g_rec_mutex_lock (&layouts_lock);
+    gboolean result = load_catalog_locked ();
+    g_rec_mutex_unlock (&layouts_lock);
+    return result;
+}
+
+/* Get the object for a catalog entry, creating it the first time it is used */
+static LightDMLayout *
+get_layout (const gchar *name, const gchar *short_description, const gchar *description)
+{
+    g_rec_mutex_lock (&layouts_lock);
+
+    if (!layout_objects)
+        layout_objects = g_hash_table_new (g_str_hash, g_str_equal);
+
+    LightDMLayout *layout = g_hash_table_lookup (layout_objects, name);
+    if (!layout)
+    {
+        layout = g_object_new (LIGHTDM_TYPE_LAYOUT, "name", name, "short-description", short_description, "description", description, NULL);
+        g_hash_table_insert (layout_objects, (gpointer) lightdm_layout_get_name (layout), layout);
+    }
+
+    g_rec_mutex_unlock (&layouts_lock);
 
-    have_layouts = TRUE;
+    return layout;
+}
+
+static LightDMLayout *
+find_layout (const gchar *name)
+{
+    if (!load_catalog () || !name)
+        return NULL;
+
+    GVariantIter iter;
+    const gchar *layout_name, *short_description, *description;
+    g_variant_iter_init (&iter, catalog);
+    while (g_variant_iter_next (&iter, "(&s&s&s)", &layout_name, &short_description, &description))
+    {
+        if (strcmp (layout_name, name) == 0)
+            return get_layout (layout_name, short_description, description);
+    }
+
+    return NULL;
+}
+
+/**
+ * lightdm_get_layouts:
+ *
+ * Get a list of keyboard layouts to present to the user.
+ *
+ * Return value: (element-type LightDMLayout) (transfer none): A list of #LightDMLayout that should be presented to the user.
+ **/
+GList *
+lightdm_get_layouts (void)
+{
+    g_rec_mutex_lock (&layouts_lock);
+
+    if (!have_layouts && load_catalog ())
+    {
+        GVariantIter iter;
+        const gchar *name, *short_description, *description;
+        g_variant_iter_init (&iter, catalog);
+        while (g_variant_iter_next (&iter, "(&s&s&s)", &name, &short_description, &description))
+            layouts = g_list_prepend (layouts, get_layout (name, short_description, description));
+        layouts = g_list_reverse (layouts);
+
+        have_layouts = TRUE;
+    }
+
+    g_rec_mutex_unlock (&layouts_lock);
 
     return layouts;
 }
 
+/* Switch to a layout already in the keymap, returns FALSE if it needs to be added */
+static gboolean
+lock_group (const gchar *name)
+{
+    g_rec_mutex_lock (&layouts_lock);
+    gint group = -1;
+    for (gint i = 0; i < MAX_GROUPS && groups[i] && group < 0; i++)
+        if (g_strcmp0 (groups[i], name) == 0)
+            group = i;
+    if (group >= 0)
+    {
+        g_debug ("Switching to keyboard group %d", group);
+        xkl_engine_lock_group (xkl_engine, group);
+    }
+    g_rec_mutex_unlock (&layouts_lock);
+
+    return group >= 0;
+}
+
+/* Get the groups for a new keymap, with this layout first and the others that were most recently used */
+static GStrv
+get_new_groups (const gchar *name)
+{
+    GStrv new_groups = g_new0 (gchar *, MAX_GROUPS + 1);
+    guint n_groups = 0;
+
+    new_groups[n_groups++] = g_strdup (name);
+    g_rec_mutex_lock (&layouts_lock);
+    for (guint i = 0; i < MAX_GROUPS && groups[i] && n_groups < MAX_GROUPS; i++)
+        if (g_strcmp0 (groups[i], name) != 0)
+            new_groups[n_groups++] = g_strdup (groups[i]);
+    g_rec_mutex_unlock (&layouts_lock);
+
+    return new_groups;
+}
+
+/* Record the groups in a keymap that has just been activated, with the first group selected */
+static void
+set_groups (GStrv new_groups)
+{
+    g_rec_mutex_lock (&layouts_lock);
+    for (guint i = 0; i < MAX_GROUPS; i++)
+    {
+        g_free (groups[i]);
+        groups[i] = g_strdup (new_groups[i]);
+        if (!new_groups[i])
+            break;
+    }
+    xkl_engine_lock_group (xkl_engine, 0);
+    g_rec_mutex_unlock (&layouts_lock);
+}
+
 /**
  * lightdm_set_layout:
  * @layout: The layout to use
  *
  * Set the layout for this session.
+ *
+ * Recently used layouts are kept in the keymap, so switching back to them is
+ * instant. Use lightdm_set_layout_async() to avoid blocking when a new keymap
+ * has to be compiled.
  **/
 void
 lightdm_set_layout (LightDMLayout *dmlayout)
@@ -153,23 +398,136 @@ lightdm_set_layout (LightDMLayout *dmlayout)
 
     g_debug ("Setting keyboard layout to '%s'", lightdm_layout_get_name (dmlayout));
 
-    g_autofree gchar *layout = NULL;
-    g_autofree gchar *variant = NULL;
-    parse_layout_string (lightdm_layout_get_name (dmlayout), &layout, &variant);
+    if (!load_catalog () || lock_group (lightdm_layout_get_name (dmlayout)))
+        return;
+
+    g_auto(GStrv) new_groups = get_new_groups (lightdm_layout_get_name (dmlayout));
+    guint n_groups = g_strv_length (new_groups);
 
     XklConfigRec *config = xkl_config_rec_new ();
-    config->layouts = g_malloc (sizeof (gchar *) * 2);
-    config->variants = g_malloc (sizeof (gchar *) * 2);
+    config->layouts = g_new0 (gchar *, n_groups + 1);
+    config->variants = g_new0 (gchar *, n_groups + 1);
     config->model = g_strdup (xkl_config->model);
-    config->layouts[0] = g_steal_pointer (&layout);
-    config->layouts[1] = NULL;
-    config->variants[0] = g_steal_pointer (&variant);
-    config->variants[1] = NULL;
-    if (!xkl_config_rec_activate (config, xkl_engine))
+    for (guint i = 0; i < n_groups; i++)
+    {
+        g_autofree gchar *variant = NULL;
+        parse_layout_string (new_groups[i], &config->layouts[i], &variant);
+        config->variants[i] = variant ? g_steal_pointer (&variant) : g_strdup ("");
+    }
+    if (xkl_config_rec_activate (config, xkl_engine))
+        set_groups (new_groups);
+    else
         g_warning ("Failed to activate XKL config");
     g_object_unref (config);
 }
 
+static void
+setxkbmap_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GTask) task = data;
+
+    g_autoptr(GError) error = NULL;
+    if (!g_subprocess_wait_check_finish (G_SUBPROCESS (object), result, &error))
+    {
+        g_task_return_error (task, g_steal_pointer (&error));
+        return;
+    }
+
+    set_groups (g_task_get_task_data (task));
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * lightdm_set_layout_async:
+ * @layout: The layout to use
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when the layout has been set or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Set the layout for this session without blocking. Recently used layouts are
+ * switched to immediately; other layouts are compiled into a new keymap by
+ * setxkbmap in the background.
+ *
+ * When the layout has been set, @callback will be called. You can then call
+ * lightdm_set_layout_finish() to get the result of the operation.
+ **/
+void
+lightdm_set_layout_async (LightDMLayout *layout, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail (layout != NULL);
+
+    g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+
+    g_debug ("Setting keyboard layout to '%s'", lightdm_layout_get_name (layout));
+
+    if (!load_catalog ())
+    {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to connect to X server");
+        return;
+    }
+    if (lock_group (lightdm_layout_get_name (layout)))
+    {
+        g_task_return_boolean (task, TRUE);
+        return;
+    }
+
+    GStrv new_groups = get_new_groups (lightdm_layout_get_name (layout));
+    g_task_set_task_data (task, new_groups, (GDestroyNotify) g_strfreev);
+
+    g_autoptr(GString) layouts = g_string_new ("");
+    g_autoptr(GString) variants = g_string_new ("");
+    for (guint i = 0; new_groups[i]; i++)
+    {
+        g_autofree gchar *l = NULL;
+        g_autofree gchar *v = NULL;
+        parse_layout_string (new_groups[i], &l, &v);
+        if (i > 0)
+        {
+            g_string_append_c (layouts, ',');
+            g_string_append_c (variants, ',');
+        }
+        g_string_append (layouts, l);
+        if (v)
+            g_string_append (variants, v);
+    }
+
+    const gchar *argv[] = { "setxkbmap", "-layout", layouts->str, "-variant", variants->str, NULL, NULL, NULL };
+    if (xkl_config->model && xkl_config->model[0] != '\0')
+    {
+        argv[5] = "-model";
+        argv[6] = xkl_config->model;
+    }
+
+    /* Fall back to compiling the keymap here if setxkbmap isn't available */
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSubprocess) subprocess = g_subprocess_newv (argv, G_SUBPROCESS_FLAGS_NONE, &error);
+    if (!subprocess)
+    {
+        g_debug ("Failed to run setxkbmap: %s", error->message);
+        lightdm_set_layout (layout);
+        g_task_return_boolean (task, TRUE);
+        return;
+    }
+
+    g_subprocess_wait_check_async (subprocess, cancellable, setxkbmap_cb, g_steal_pointer (&task));
+}
+
+/**
+ * lightdm_set_layout_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_set_layout_async().
+ *
+ * Return value: #TRUE if the layout was set.
+ **/
+gboolean
+lightdm_set_layout_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /**
  * lightdm_get_layout:
  *
@@ -180,22 +538,14 @@ lightdm_set_layout (LightDMLayout *dmlayout)
 LightDMLayout *
 lightdm_get_layout (void)
 {
-    lightdm_get_layouts ();
+    if (!load_catalog ())
+        return NULL;
 
-    if (layouts && xkl_config && !default_layout)
+    if (xkl_config && !default_layout)
     {
         g_autofree gchar *full_name = make_layout_string (xkl_config->layouts ? xkl_config->layouts[0] : NULL,
                                                           xkl_config->variants ? xkl_config->variants[0] : NULL);
-
-        for (GList *item = layouts; item; item = item->next)
-        {
-            LightDMLayout *iter_layout = (LightDMLayout *) item->data;
-            if (g_strcmp0 (lightdm_layout_get_name (iter_layout), full_name) == 0)
-            {
-                default_layout = iter_layout;
-                break;
-            }
-        }
+        default_layout = find_layout (full_name);
     }
 
     return default_layout;
@@ -15,6 +15,7 @@
 #include "lightdm/language.h"
 #include "lightdm/layout.h"
 #include "lightdm/power.h"
+#include "lightdm/prefetch.h"
 #include "lightdm/session.h"
 #include "lightdm/system.h"
 #include "lightdm/user.h"
@@ -34,6 +34,7 @@ typedef struct _LightDMGreeterClass     LightDMGreeterClass;
 #define LIGHTDM_GREETER_SIGNAL_AUTOLOGIN_TIMER_EXPIRED "autologin-timer-expired"
 #define LIGHTDM_GREETER_SIGNAL_IDLE                    "idle"
 #define LIGHTDM_GREETER_SIGNAL_RESET                   "reset"
+#define LIGHTDM_GREETER_SIGNAL_HINT_CHANGED            "hint-changed"
 
 /**
  * LightDMPromptType:
@@ -79,9 +80,9 @@ struct _LightDMGreeterClass
     void (*autologin_timer_expired)(LightDMGreeter *greeter);
     void (*idle)(LightDMGreeter *greeter);
     void (*reset)(LightDMGreeter *greeter);
+    void (*hint_changed)(LightDMGreeter *greeter, const gchar *name);
 
     /* Reserved */
-    void (*reserved1) (void);
     void (*reserved2) (void);
     void (*reserved3) (void);
     void (*reserved4) (void);
@@ -102,6 +103,7 @@ static inline void glib_autoptr_cleanup_LightDMGreeter (LightDMGreeter **_ptr)
  * @LIGHTDM_GREETER_ERROR_SESSION_FAILED: requested session failed to start.
  * @LIGHTDM_GREETER_ERROR_NO_AUTOLOGIN: autologin not configured.
  * @LIGHTDM_GREETER_ERROR_INVALID_USER: autologin not configured.
+ * @LIGHTDM_GREETER_ERROR_TIMED_OUT: the daemon did not reply within the sync timeout.
  *
  * Error codes returned by greeter operations.
  */
@@ -111,7 +113,8 @@ typedef enum
     LIGHTDM_GREETER_ERROR_CONNECTION_FAILED,
     LIGHTDM_GREETER_ERROR_SESSION_FAILED,
     LIGHTDM_GREETER_ERROR_NO_AUTOLOGIN,
-    LIGHTDM_GREETER_ERROR_INVALID_USER
+    LIGHTDM_GREETER_ERROR_INVALID_USER,
+    LIGHTDM_GREETER_ERROR_TIMED_OUT
 } LightDMGreeterError;
 
 GQuark lightdm_greeter_error_quark (void);
@@ -124,12 +127,24 @@ LightDMGreeter *lightdm_greeter_new (void);
 
 void lightdm_greeter_set_resettable (LightDMGreeter *greeter, gboolean resettable);
 
+void lightdm_greeter_set_sync_timeout (LightDMGreeter *greeter, guint timeout);
+
+guint lightdm_greeter_get_sync_timeout (LightDMGreeter *greeter);
+
 void lightdm_greeter_connect_to_daemon (LightDMGreeter *greeter, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
 
 gboolean lightdm_greeter_connect_to_daemon_finish (LightDMGreeter *greeter, GAsyncResult *result, GError **error);
 
 gboolean lightdm_greeter_connect_to_daemon_sync (LightDMGreeter *greeter, GError **error);
 
+gint lightdm_greeter_get_fd (LightDMGreeter *greeter);
+
+gint lightdm_greeter_process_events (LightDMGreeter *greeter);
+
+typedef void (*LightDMGreeterDisplayFunc) (LightDMGreeter *greeter, const gchar *seat_name, const gchar *display, const gchar *x_authority, gpointer user_data);
+
+gboolean lightdm_greeter_serve_displays (const gchar *path, LightDMGreeterDisplayFunc added_callback, LightDMGreeterDisplayFunc removed_callback, gpointer user_data, GError **error);
+
 const gchar *lightdm_greeter_get_hint (LightDMGreeter *greeter, const gchar *name);
 
 const gchar *lightdm_greeter_get_default_session_hint (LightDMGreeter *greeter);
@@ -11,7 +11,7 @@
 #ifndef LIGHTDM_LAYOUT_H_
 #define LIGHTDM_LAYOUT_H_
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -58,6 +58,10 @@ GList *lightdm_get_layouts (void);
 
 void lightdm_set_layout (LightDMLayout *layout);
 
+void lightdm_set_layout_async (LightDMLayout *layout, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_set_layout_finish (GAsyncResult *result, GError **error);
+
 LightDMLayout *lightdm_get_layout (void);
 
 const gchar *lightdm_layout_get_name (LightDMLayout *layout);
@@ -11,22 +11,89 @@
 #ifndef LIGHTDM_POWER_H_
 #define LIGHTDM_POWER_H_
 
+#include <gio/gio.h>
+
 G_BEGIN_DECLS
 
+#define LIGHTDM_TYPE_POWER_CAPABILITIES            (lightdm_power_capabilities_get_type())
+#define LIGHTDM_POWER_CAPABILITIES(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), LIGHTDM_TYPE_POWER_CAPABILITIES, LightDMPowerCapabilities))
+#define LIGHTDM_POWER_CAPABILITIES_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), LIGHTDM_TYPE_POWER_CAPABILITIES, LightDMPowerCapabilitiesClass))
+#define LIGHTDM_IS_POWER_CAPABILITIES(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), LIGHTDM_TYPE_POWER_CAPABILITIES))
+#define LIGHTDM_IS_POWER_CAPABILITIES_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), LIGHTDM_TYPE_POWER_CAPABILITIES))
+#define LIGHTDM_POWER_CAPABILITIES_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), LIGHTDM_TYPE_POWER_CAPABILITIES, LightDMPowerCapabilitiesClass))
+
+#define LIGHTDM_POWER_CAPABILITIES_SIGNAL_CHANGED "changed"
+
+typedef struct _LightDMPowerCapabilities      LightDMPowerCapabilities;
+typedef struct _LightDMPowerCapabilitiesClass LightDMPowerCapabilitiesClass;
+
+struct _LightDMPowerCapabilities
+{
+    GObject parent_instance;
+};
+
+struct _LightDMPowerCapabilitiesClass
+{
+    /*< private >*/
+    GObjectClass parent_class;
+
+    void (*changed)(LightDMPowerCapabilities *power_capabilities);
+
+    /* Reserved */
+    void (*reserved1) (void);
+    void (*reserved2) (void);
+    void (*reserved3) (void);
+    void (*reserved4) (void);
+    void (*reserved5) (void);
+    void (*reserved6) (void);
+};
+
+GType lightdm_power_capabilities_get_type (void);
+
+LightDMPowerCapabilities *lightdm_power_capabilities_get_instance (void);
+
+void lightdm_get_power_capabilities_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+LightDMPowerCapabilities *lightdm_get_power_capabilities_finish (GAsyncResult *result, GError **error);
+
+gboolean lightdm_power_capabilities_get_can_suspend (LightDMPowerCapabilities *power_capabilities);
+
+gboolean lightdm_power_capabilities_get_can_hibernate (LightDMPowerCapabilities *power_capabilities);
+
+gboolean lightdm_power_capabilities_get_can_restart (LightDMPowerCapabilities *power_capabilities);
+
+gboolean lightdm_power_capabilities_get_can_shutdown (LightDMPowerCapabilities *power_capabilities);
+
 gboolean lightdm_get_can_suspend (void);
 
+void lightdm_get_can_suspend_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_suspend_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_suspend (GError **error);
 
 gboolean lightdm_get_can_hibernate (void);
 
+void lightdm_get_can_hibernate_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_hibernate_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_hibernate (GError **error);
 
 gboolean lightdm_get_can_restart (void);
 
+void lightdm_get_can_restart_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_restart_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_restart (GError **error);
 
 gboolean lightdm_get_can_shutdown (void);
 
+void lightdm_get_can_shutdown_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_shutdown_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_shutdown (GError **error);
 
 G_END_DECLS
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef LIGHTDM_PREFETCH_H_
+#define LIGHTDM_PREFETCH_H_
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * LightDMPrefetchFlags:
+ * @LIGHTDM_PREFETCH_USERS: The user list, see lightdm_user_list_get_instance().
+ * @LIGHTDM_PREFETCH_SESSIONS: The sessions, see lightdm_get_sessions().
+ * @LIGHTDM_PREFETCH_LANGUAGES: The languages, see lightdm_get_languages().
+ * @LIGHTDM_PREFETCH_LAYOUTS: The keyboard layouts, see lightdm_get_layouts().
+ * @LIGHTDM_PREFETCH_POWER: The power capabilities, see lightdm_power_capabilities_get_instance().
+ * @LIGHTDM_PREFETCH_ALL: Everything above.
+ *
+ * Information a greeter can load in advance with lightdm_prefetch_async().
+ */
+typedef enum
+{
+    LIGHTDM_PREFETCH_USERS     = 1 << 0,
+    LIGHTDM_PREFETCH_SESSIONS  = 1 << 1,
+    LIGHTDM_PREFETCH_LANGUAGES = 1 << 2,
+    LIGHTDM_PREFETCH_LAYOUTS   = 1 << 3,
+    LIGHTDM_PREFETCH_POWER     = 1 << 4,
+    LIGHTDM_PREFETCH_ALL       = 0x1F
+} LightDMPrefetchFlags;
+
+GType lightdm_prefetch_flags_get_type (void);
+
+/**
+ * LightDMPrefetchFunc:
+ * @item: The information that is now loaded.
+ * @user_data: Data passed to lightdm_prefetch_async().
+ *
+ * Called once for each piece of information when it has been loaded.
+ */
+typedef void (*LightDMPrefetchFunc) (LightDMPrefetchFlags item, gpointer user_data);
+
+void lightdm_prefetch_async (LightDMPrefetchFlags items,
+                             LightDMPrefetchFunc item_func, gpointer item_data, GDestroyNotify item_destroy,
+                             GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+LightDMPrefetchFlags lightdm_prefetch_finish (GAsyncResult *result, GError **error);
+
+G_END_DECLS
+
+#endif /* LIGHTDM_PREFETCH_H_ */
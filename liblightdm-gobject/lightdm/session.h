@@ -25,6 +25,19 @@ G_BEGIN_DECLS
 typedef struct _LightDMSession          LightDMSession;
 typedef struct _LightDMSessionClass     LightDMSessionClass;
 
+#define LIGHTDM_TYPE_SESSION_LIST            (lightdm_session_list_get_type())
+#define LIGHTDM_SESSION_LIST(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), LIGHTDM_TYPE_SESSION_LIST, LightDMSessionList))
+#define LIGHTDM_SESSION_LIST_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), LIGHTDM_TYPE_SESSION_LIST, LightDMSessionListClass))
+#define LIGHTDM_IS_SESSION_LIST(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), LIGHTDM_TYPE_SESSION_LIST))
+#define LIGHTDM_IS_SESSION_LIST_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), LIGHTDM_TYPE_SESSION_LIST))
+#define LIGHTDM_SESSION_LIST_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), LIGHTDM_TYPE_SESSION_LIST, LightDMSessionListClass))
+
+typedef struct _LightDMSessionList      LightDMSessionList;
+typedef struct _LightDMSessionListClass LightDMSessionListClass;
+
+#define LIGHTDM_SESSION_LIST_SIGNAL_SESSION_ADDED   "session-added"
+#define LIGHTDM_SESSION_LIST_SIGNAL_SESSION_REMOVED "session-removed"
+
 struct _LightDMSession
 {
     GObject parent_instance;
@@ -44,6 +57,26 @@ struct _LightDMSessionClass
     void (*reserved6) (void);
 };
 
+struct _LightDMSessionList
+{
+    GObject parent_instance;
+};
+
+struct _LightDMSessionListClass
+{
+    /*< private >*/
+    GObjectClass parent_class;
+
+    void (*session_added)(LightDMSessionList *session_list, LightDMSession *session);
+    void (*session_removed)(LightDMSessionList *session_list, LightDMSession *session);
+
+    /* Reserved */
+    void (*reserved1) (void);
+    void (*reserved2) (void);
+    void (*reserved3) (void);
+    void (*reserved4) (void);
+};
+
 #ifdef GLIB_VERSION_2_44
 typedef LightDMSession *LightDMSession_autoptr;
 static inline void glib_autoptr_cleanup_LightDMSession (LightDMSession **_ptr)
@@ -58,6 +91,10 @@ GList *lightdm_get_sessions (void);
 
 GList *lightdm_get_remote_sessions (void);
 
+GType lightdm_session_list_get_type (void);
+
+LightDMSessionList *lightdm_session_list_get_instance (void);
+
 const gchar *lightdm_session_get_key (LightDMSession *session);
 
 const gchar *lightdm_session_get_session_type (LightDMSession *session);
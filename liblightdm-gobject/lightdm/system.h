@@ -29,6 +29,16 @@ const gchar *lightdm_get_os_version_id (void);
 
 gchar *lightdm_get_motd (void);
 
+/**
+ * LightDMSystemChangedFunc:
+ * @user_data: Data passed to lightdm_set_system_changed_func().
+ *
+ * Called when the system information may have changed.
+ */
+typedef void (*LightDMSystemChangedFunc) (gpointer user_data);
+
+void lightdm_set_system_changed_func (LightDMSystemChangedFunc func, gpointer user_data, GDestroyNotify destroy);
+
 G_END_DECLS
 
 #endif /* LIGHTDM_HOSTNAME_H_ */
@@ -38,6 +38,10 @@ typedef struct _LightDMUserClass     LightDMUserClass;
 #define LIGHTDM_USER_LIST_SIGNAL_USER_ADDED   "user-added"
 #define LIGHTDM_USER_LIST_SIGNAL_USER_CHANGED "user-changed"
 #define LIGHTDM_USER_LIST_SIGNAL_USER_REMOVED "user-removed"
+#define LIGHTDM_USER_LIST_SIGNAL_USERS_LOADED "users-loaded"
+#define LIGHTDM_USER_LIST_SIGNAL_USERS_ADDED   "users-added"
+#define LIGHTDM_USER_LIST_SIGNAL_USERS_CHANGED "users-changed"
+#define LIGHTDM_USER_LIST_SIGNAL_USERS_REMOVED "users-removed"
 
 #define LIGHTDM_SIGNAL_USER_CHANGED "changed"
 
@@ -75,12 +79,12 @@ struct _LightDMUserListClass
     void (*user_added)(LightDMUserList *user_list, LightDMUser *user);
     void (*user_changed)(LightDMUserList *user_list, LightDMUser *user);
     void (*user_removed)(LightDMUserList *user_list, LightDMUser *user);
+    void (*users_loaded)(LightDMUserList *user_list);
+    void (*users_added)(LightDMUserList *user_list, GPtrArray *users);
+    void (*users_changed)(LightDMUserList *user_list, GPtrArray *users);
+    void (*users_removed)(LightDMUserList *user_list, GPtrArray *users);
 
     /* Reserved */
-    void (*reserved1) (void);
-    void (*reserved2) (void);
-    void (*reserved3) (void);
-    void (*reserved4) (void);
     void (*reserved5) (void);
     void (*reserved6) (void);
 };
@@ -98,6 +102,41 @@ static inline void glib_autoptr_cleanup_LightDMUserList (LightDMUserList **_ptr)
 }
 #endif
 
+/**
+ * LightDMUserInfo:
+ * @name: The user name
+ * @real_name: The real name of the user
+ * @display_name: The name to show for the user
+ * @home_directory: The home directory of the user
+ * @image: (nullable): The image for the user
+ * @background: (nullable): The background for the user
+ * @uid: The user ID
+ *
+ * An entry in the read-only user table, see lightdm_user_list_get_user_table().
+ */
+typedef struct
+{
+    const gchar *name;
+    const gchar *real_name;
+    const gchar *display_name;
+    const gchar *home_directory;
+    const gchar *image;
+    const gchar *background;
+    uid_t uid;
+} LightDMUserInfo;
+
+/**
+ * LightDMUserListIter:
+ *
+ * An iterator over the user table, see lightdm_user_list_iter_init().
+ */
+typedef struct
+{
+    /*< private >*/
+    GArray *table;
+    guint index;
+} LightDMUserListIter;
+
 GType lightdm_user_list_get_type (void);
 
 GType lightdm_user_get_type (void);
@@ -110,6 +149,20 @@ LightDMUser *lightdm_user_list_get_user_by_name (LightDMUserList *user_list, con
 
 GList *lightdm_user_list_get_users (LightDMUserList *user_list);
 
+GList *lightdm_user_list_search (LightDMUserList *user_list, const gchar *prefix, guint limit);
+
+void lightdm_user_list_load_async (LightDMUserList *user_list);
+
+gboolean lightdm_user_list_get_is_loaded (LightDMUserList *user_list);
+
+void lightdm_user_list_prefetch_settings (LightDMUserList *user_list);
+
+const LightDMUserInfo *lightdm_user_list_get_user_table (LightDMUserList *user_list, guint *n_users);
+
+void lightdm_user_list_iter_init (LightDMUserListIter *iter, LightDMUserList *user_list);
+
+gboolean lightdm_user_list_iter_next (LightDMUserListIter *iter, const LightDMUserInfo **info);
+
 const gchar *lightdm_user_get_name (LightDMUser *user);
 
 const gchar *lightdm_user_get_real_name (LightDMUser *user);
@@ -122,6 +175,10 @@ const gchar *lightdm_user_get_image (LightDMUser *user);
 
 const gchar *lightdm_user_get_background (LightDMUser *user);
 
+const gchar *lightdm_user_get_cached_image (LightDMUser *user);
+
+const gchar *lightdm_user_get_cached_background (LightDMUser *user);
+
 const gchar *lightdm_user_get_language (LightDMUser *user);
 
 const gchar *lightdm_user_get_layout (LightDMUser *user);
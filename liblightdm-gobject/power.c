@@ -106,45 +106,362 @@ ck_call_function (const gchar *function, GVariant *parameters, GError **error)
                                    error);
 }
 
+typedef enum
+{
+    CAPABILITY_SUSPEND,
+    CAPABILITY_HIBERNATE,
+    CAPABILITY_RESTART,
+    CAPABILITY_SHUTDOWN,
+    N_CAPABILITIES
+} Capability;
+
+/* Services to ask, in order of preference */
+typedef enum
+{
+    BACKEND_LOGIN1,
+    BACKEND_CONSOLE_KIT,
+    BACKEND_UPOWER,
+    N_BACKENDS
+} Backend;
+
+static const struct
+{
+    const gchar *name;
+    const gchar *path;
+    const gchar *interface;
+} backends[N_BACKENDS] =
+{
+    { "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager" },
+    { "org.freedesktop.ConsoleKit", "/org/freedesktop/ConsoleKit/Manager", "org.freedesktop.ConsoleKit.Manager" },
+    { "org.freedesktop.UPower", "/org/freedesktop/UPower", "org.freedesktop.UPower" }
+};
+
+static const struct
+{
+    const gchar *property;
+    const gchar *methods[N_BACKENDS];
+} capabilities[N_CAPABILITIES] =
+{
+    { "can-suspend", { "CanSuspend", "CanSuspend", "SuspendAllowed" } },
+    { "can-hibernate", { "CanHibernate", "CanHibernate", "HibernateAllowed" } },
+    { "can-restart", { "CanReboot", "CanRestart", NULL } },
+    { "can-shutdown", { "CanPowerOff", "CanStop", NULL } }
+};
+
+/* Capabilities last reported, valid until the services signal a change */
+static gboolean capability_known[N_CAPABILITIES] = { FALSE };
+static gboolean capability_value[N_CAPABILITIES] = { FALSE };
+static GDBusConnection *watch_connection = NULL;
+
+enum {
+    PROP_CAN_SUSPEND = 1,
+    PROP_CAN_HIBERNATE,
+    PROP_CAN_RESTART,
+    PROP_CAN_SHUTDOWN
+};
+
+enum {
+    CHANGED,
+    LAST_SIGNAL
+};
+static guint capabilities_signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (LightDMPowerCapabilities, lightdm_power_capabilities, G_TYPE_OBJECT)
+
+static LightDMPowerCapabilities *capabilities_singleton = NULL;
+
+static void refresh_capabilities (LightDMPowerCapabilities *power_capabilities, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+static gboolean
+parse_capability_result (GVariant *result)
+{
+    if (g_variant_is_of_type (result, G_VARIANT_TYPE ("(s)")))
+    {
+        const gchar *value;
+        g_variant_get (result, "(&s)", &value);
+        return g_strcmp0 (value, "yes") == 0;
+    }
+    else if (g_variant_is_of_type (result, G_VARIANT_TYPE ("(b)")))
+    {
+        gboolean value;
+        g_variant_get (result, "(b)", &value);
+        return value;
+    }
+
+    return FALSE;
+}
+
+static void
+services_changed_cb (GDBusConnection *connection,
+                     const gchar *sender_name,
+                     const gchar *object_path,
+                     const gchar *interface_name,
+                     const gchar *signal_name,
+                     GVariant *parameters,
+                     gpointer user_data)
+{
+    /* Any change might affect what is allowed, so ask again */
+    gboolean was_known = FALSE;
+    for (int i = 0; i < N_CAPABILITIES; i++)
+    {
+        was_known |= capability_known[i];
+        capability_known[i] = FALSE;
+    }
+
+    if (was_known && capabilities_singleton)
+        refresh_capabilities (capabilities_singleton, NULL, NULL, NULL);
+}
+
+/* Watch for changes to the services so the cached capabilities can be trusted */
+static gboolean
+watch_services (GDBusConnection *connection)
+{
+    if (watch_connection)
+        return TRUE;
+    if (!connection)
+        return FALSE;
+
+    watch_connection = g_object_ref (connection);
+    for (int i = 0; i < N_BACKENDS; i++)
+    {
+        g_dbus_connection_signal_subscribe (watch_connection,
+                                            backends[i].name,
+                                            "org.freedesktop.DBus.Properties",
+                                            "PropertiesChanged",
+                                            backends[i].path,
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            services_changed_cb,
+                                            NULL,
+                                            NULL);
+        g_dbus_connection_signal_subscribe (watch_connection,
+                                            "org.freedesktop.DBus",
+                                            "org.freedesktop.DBus",
+                                            "NameOwnerChanged",
+                                            "/org/freedesktop/DBus",
+                                            backends[i].name,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            services_changed_cb,
+                                            NULL,
+                                            NULL);
+    }
+
+    return TRUE;
+}
+
+static void
+set_capability (GDBusConnection *connection, Capability capability, gboolean value)
+{
+    if (!watch_services (connection))
+        return;
+
+    gboolean changed = capability_value[capability] != value;
+    capability_known[capability] = TRUE;
+    capability_value[capability] = value;
+
+    if (changed && capabilities_singleton)
+        g_object_notify (G_OBJECT (capabilities_singleton), capabilities[capability].property);
+}
+
+static GVariant *
+call_backend_sync (Backend backend, const gchar *method)
+{
+    switch (backend)
+    {
+    case BACKEND_LOGIN1:
+        return login1_call_function (method, NULL, NULL);
+    case BACKEND_CONSOLE_KIT:
+        return ck_call_function (method, NULL, NULL);
+    case BACKEND_UPOWER:
+        return upower_call_function (method, NULL);
+    default:
+        return NULL;
+    }
+}
+
+static gboolean
+get_capability_sync (Capability capability)
+{
+    if (capability_known[capability])
+        return capability_value[capability];
+
+    gboolean value = FALSE;
+    for (Backend backend = 0; backend < N_BACKENDS && capabilities[capability].methods[backend]; backend++)
+    {
+        g_autoptr(GVariant) r = call_backend_sync (backend, capabilities[capability].methods[backend]);
+        if (r)
+        {
+            value = parse_capability_result (r);
+            break;
+        }
+    }
+
+    g_autoptr(GDBusConnection) connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+    set_capability (connection, capability, value);
+
+    return value;
+}
+
+typedef struct
+{
+    Capability capability;
+    Backend backend;
+    GDBusConnection *connection;
+} CapabilityQuery;
+
+static void
+capability_query_free (CapabilityQuery *query)
+{
+    g_clear_object (&query->connection);
+    g_free (query);
+}
+
+static void query_next_backend (GTask *task);
+
+static void
+query_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    GTask *task = data;
+    CapabilityQuery *query = g_task_get_task_data (task);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) r = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (r)
+    {
+        gboolean value = parse_capability_result (r);
+        set_capability (query->connection, query->capability, value);
+        g_task_return_boolean (task, value);
+        g_object_unref (task);
+        return;
+    }
+
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        g_task_return_error (task, g_steal_pointer (&error));
+        g_object_unref (task);
+        return;
+    }
+
+    g_debug ("Can't check %s using %s: %s", capabilities[query->capability].methods[query->backend], backends[query->backend].name, error->message);
+    query->backend++;
+    query_next_backend (task);
+}
+
+static void
+query_next_backend (GTask *task)
+{
+    CapabilityQuery *query = g_task_get_task_data (task);
+
+    if (query->backend >= N_BACKENDS || !capabilities[query->capability].methods[query->backend])
+    {
+        set_capability (query->connection, query->capability, FALSE);
+        g_task_return_boolean (task, FALSE);
+        g_object_unref (task);
+        return;
+    }
+
+    g_dbus_connection_call (query->connection,
+                            backends[query->backend].name,
+                            backends[query->backend].path,
+                            backends[query->backend].interface,
+                            capabilities[query->capability].methods[query->backend],
+                            NULL,
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            g_task_get_cancellable (task),
+                            query_cb,
+                            task);
+}
+
+static void
+query_bus_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    GTask *task = data;
+    CapabilityQuery *query = g_task_get_task_data (task);
+
+    GError *error = NULL;
+    query->connection = g_bus_get_finish (result, &error);
+    if (!query->connection)
+    {
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    query_next_backend (task);
+}
+
+static void
+query_capability (Capability capability, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+
+    if (capability_known[capability])
+    {
+        g_task_return_boolean (task, capability_value[capability]);
+        g_object_unref (task);
+        return;
+    }
+
+    CapabilityQuery *query = g_new0 (CapabilityQuery, 1);
+    query->capability = capability;
+    query->backend = BACKEND_LOGIN1;
+    g_task_set_task_data (task, query, (GDestroyNotify) capability_query_free);
+
+    g_bus_get (G_BUS_TYPE_SYSTEM, cancellable, query_bus_cb, task);
+}
+
+static gboolean
+query_capability_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 /**
  * lightdm_get_can_suspend:
  *
  * Checks if authorized to do a system suspend.
+ * The result is cached until the power services report a change.
  *
  * Return value: #TRUE if can suspend the system
  **/
 gboolean
 lightdm_get_can_suspend (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanSuspend", NULL, NULL);
-    gboolean can_suspend = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_suspend = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        const gchar *result;
-        r = ck_call_function ("CanSuspend", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_suspend = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        r = upower_call_function ("SuspendAllowed", NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_suspend);
-    }
+    return get_capability_sync (CAPABILITY_SUSPEND);
+}
 
-    return can_suspend;
+/**
+ * lightdm_get_can_suspend_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when the check is complete or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to do a system suspend.
+ * When the check is complete, @callback will be called.
+ * You can then call lightdm_get_can_suspend_finish() to get the result of the operation.
+ **/
+void
+lightdm_get_can_suspend_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    query_capability (CAPABILITY_SUSPEND, cancellable, callback, user_data);
+}
+
+/**
+ * lightdm_get_can_suspend_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_get_can_suspend_async().
+ *
+ * Return value: #TRUE if can suspend the system
+ **/
+gboolean
+lightdm_get_can_suspend_finish (GAsyncResult *result, GError **error)
+{
+    return query_capability_finish (result, error);
 }
 
 /**
@@ -180,41 +497,45 @@ lightdm_suspend (GError **error)
  * lightdm_get_can_hibernate:
  *
  * Checks if is authorized to do a system hibernate.
+ * The result is cached until the power services report a change.
  *
  * Return value: #TRUE if can hibernate the system
  **/
 gboolean
 lightdm_get_can_hibernate (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanHibernate", NULL, NULL);
-    gboolean can_hibernate = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_hibernate = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        const gchar *result;
-        r = ck_call_function ("CanHibernate", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_hibernate = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        r = upower_call_function ("HibernateAllowed", NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_hibernate);
-    }
+    return get_capability_sync (CAPABILITY_HIBERNATE);
+}
 
-    return can_hibernate;
+/**
+ * lightdm_get_can_hibernate_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when the check is complete or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to do a system hibernate.
+ * When the check is complete, @callback will be called.
+ * You can then call lightdm_get_can_hibernate_finish() to get the result of the operation.
+ **/
+void
+lightdm_get_can_hibernate_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    query_capability (CAPABILITY_HIBERNATE, cancellable, callback, user_data);
+}
+
+/**
+ * lightdm_get_can_hibernate_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_get_can_hibernate_async().
+ *
+ * Return value: #TRUE if can hibernate the system
+ **/
+gboolean
+lightdm_get_can_hibernate_finish (GAsyncResult *result, GError **error)
+{
+    return query_capability_finish (result, error);
 }
 
 /**
@@ -250,31 +571,45 @@ lightdm_hibernate (GError **error)
  * lightdm_get_can_restart:
  *
  * Checks if is authorized to do a system restart.
+ * The result is cached until the power services report a change.
  *
  * Return value: #TRUE if can restart the system
  **/
 gboolean
 lightdm_get_can_restart (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanReboot", NULL, NULL);
-    gboolean can_restart = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_restart = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    else
-    {
-        r = ck_call_function ("CanRestart", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_restart);
-    }
+    return get_capability_sync (CAPABILITY_RESTART);
+}
+
+/**
+ * lightdm_get_can_restart_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when the check is complete or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to do a system restart.
+ * When the check is complete, @callback will be called.
+ * You can then call lightdm_get_can_restart_finish() to get the result of the operation.
+ **/
+void
+lightdm_get_can_restart_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    query_capability (CAPABILITY_RESTART, cancellable, callback, user_data);
+}
 
-    return can_restart;
+/**
+ * lightdm_get_can_restart_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_get_can_restart_async().
+ *
+ * Return value: #TRUE if can restart the system
+ **/
+gboolean
+lightdm_get_can_restart_finish (GAsyncResult *result, GError **error)
+{
+    return query_capability_finish (result, error);
 }
 
 /**
@@ -301,31 +636,45 @@ lightdm_restart (GError **error)
  * lightdm_get_can_shutdown:
  *
  * Checks if is authorized to do a system shutdown.
+ * The result is cached until the power services report a change.
  *
  * Return value: #TRUE if can shutdown the system
  **/
 gboolean
 lightdm_get_can_shutdown (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanPowerOff", NULL, NULL);
-    gboolean can_shutdown = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_shutdown = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    else
-    {
-        r = ck_call_function ("CanStop", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_shutdown);
-    }
+    return get_capability_sync (CAPABILITY_SHUTDOWN);
+}
 
-    return can_shutdown;
+/**
+ * lightdm_get_can_shutdown_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when the check is complete or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to do a system shutdown.
+ * When the check is complete, @callback will be called.
+ * You can then call lightdm_get_can_shutdown_finish() to get the result of the operation.
+ **/
+void
+lightdm_get_can_shutdown_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    query_capability (CAPABILITY_SHUTDOWN, cancellable, callback, user_data);
+}
+
+/**
+ * lightdm_get_can_shutdown_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_get_can_shutdown_async().
+ *
+ * Return value: #TRUE if can shutdown the system
+ **/
+gboolean
+lightdm_get_can_shutdown_finish (GAsyncResult *result, GError **error)
+{
+    return query_capability_finish (result, error);
 }
 
 /**
@@ -347,3 +696,258 @@ lightdm_shutdown (GError **error)
     g_autoptr(GVariant) ck_result = ck_call_function ("Stop", NULL, error);
     return ck_result != NULL;
 }
+
+typedef struct
+{
+    guint n_remaining;
+    GError *error;
+} RefreshData;
+
+static void
+refresh_data_free (RefreshData *data)
+{
+    g_clear_error (&data->error);
+    g_free (data);
+}
+
+static void
+refresh_capability_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    RefreshData *data = g_task_get_task_data (task);
+
+    GError *error = NULL;
+    query_capability_finish (result, &error);
+    if (error && !data->error)
+        data->error = error;
+    else
+        g_clear_error (&error);
+
+    data->n_remaining--;
+    if (data->n_remaining == 0)
+    {
+        LightDMPowerCapabilities *power_capabilities = g_task_get_source_object (task);
+        g_signal_emit (power_capabilities, capabilities_signals[CHANGED], 0);
+
+        if (data->error)
+            g_task_return_error (task, g_steal_pointer (&data->error));
+        else
+            g_task_return_boolean (task, TRUE);
+    }
+    g_object_unref (task);
+}
+
+/* Check all the capabilities in parallel */
+static void
+refresh_capabilities (LightDMPowerCapabilities *power_capabilities, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    GTask *task = g_task_new (power_capabilities, cancellable, callback, user_data);
+    RefreshData *data = g_new0 (RefreshData, 1);
+    data->n_remaining = N_CAPABILITIES;
+    g_task_set_task_data (task, data, (GDestroyNotify) refresh_data_free);
+
+    for (Capability capability = 0; capability < N_CAPABILITIES; capability++)
+        query_capability (capability, cancellable, refresh_capability_cb, g_object_ref (task));
+    g_object_unref (task);
+}
+
+/**
+ * lightdm_power_capabilities_get_instance:
+ *
+ * Get the power capabilities of the system. These are checked in the
+ * background when first requested and checked again when the power services
+ * report a change.
+ *
+ * Return value: (transfer none): the #LightDMPowerCapabilities
+ **/
+LightDMPowerCapabilities *
+lightdm_power_capabilities_get_instance (void)
+{
+    if (!capabilities_singleton)
+    {
+        capabilities_singleton = g_object_new (LIGHTDM_TYPE_POWER_CAPABILITIES, NULL);
+        refresh_capabilities (capabilities_singleton, NULL, NULL, NULL);
+    }
+    return capabilities_singleton;
+}
+
+/**
+ * lightdm_get_power_capabilities_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when the capabilities are known or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks all the power capabilities at once.
+ * When the checks are complete, @callback will be called.
+ * You can then call lightdm_get_power_capabilities_finish() to get the result of the operation.
+ **/
+void
+lightdm_get_power_capabilities_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    LightDMPowerCapabilities *power_capabilities = capabilities_singleton;
+    if (!power_capabilities)
+        capabilities_singleton = power_capabilities = g_object_new (LIGHTDM_TYPE_POWER_CAPABILITIES, NULL);
+    refresh_capabilities (power_capabilities, cancellable, callback, user_data);
+}
+
+/**
+ * lightdm_get_power_capabilities_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_get_power_capabilities_async().
+ *
+ * Return value: (transfer none): the #LightDMPowerCapabilities or %NULL on error.
+ **/
+LightDMPowerCapabilities *
+lightdm_get_power_capabilities_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, capabilities_singleton), NULL);
+
+    if (!g_task_propagate_boolean (G_TASK (result), error))
+        return NULL;
+    return capabilities_singleton;
+}
+
+/**
+ * lightdm_power_capabilities_get_can_suspend:
+ * @power_capabilities: A #LightDMPowerCapabilities
+ *
+ * Checks if authorized to do a system suspend.
+ *
+ * Return value: #TRUE if can suspend the system
+ **/
+gboolean
+lightdm_power_capabilities_get_can_suspend (LightDMPowerCapabilities *power_capabilities)
+{
+    g_return_val_if_fail (LIGHTDM_IS_POWER_CAPABILITIES (power_capabilities), FALSE);
+    return get_capability_sync (CAPABILITY_SUSPEND);
+}
+
+/**
+ * lightdm_power_capabilities_get_can_hibernate:
+ * @power_capabilities: A #LightDMPowerCapabilities
+ *
+ * Checks if is authorized to do a system hibernate.
+ *
+ * Return value: #TRUE if can hibernate the system
+ **/
+gboolean
+lightdm_power_capabilities_get_can_hibernate (LightDMPowerCapabilities *power_capabilities)
+{
+    g_return_val_if_fail (LIGHTDM_IS_POWER_CAPABILITIES (power_capabilities), FALSE);
+    return get_capability_sync (CAPABILITY_HIBERNATE);
+}
+
+/**
+ * lightdm_power_capabilities_get_can_restart:
+ * @power_capabilities: A #LightDMPowerCapabilities
+ *
+ * Checks if is authorized to do a system restart.
+ *
+ * Return value: #TRUE if can restart the system
+ **/
+gboolean
+lightdm_power_capabilities_get_can_restart (LightDMPowerCapabilities *power_capabilities)
+{
+    g_return_val_if_fail (LIGHTDM_IS_POWER_CAPABILITIES (power_capabilities), FALSE);
+    return get_capability_sync (CAPABILITY_RESTART);
+}
+
+/**
+ * lightdm_power_capabilities_get_can_shutdown:
+ * @power_capabilities: A #LightDMPowerCapabilities
+ *
+ * Checks if is authorized to do a system shutdown.
+ *
+ * Return value: #TRUE if can shutdown the system
+ **/
+gboolean
+lightdm_power_capabilities_get_can_shutdown (LightDMPowerCapabilities *power_capabilities)
+{
+    g_return_val_if_fail (LIGHTDM_IS_POWER_CAPABILITIES (power_capabilities), FALSE);
+    return get_capability_sync (CAPABILITY_SHUTDOWN);
+}
+
+static void
+lightdm_power_capabilities_init (LightDMPowerCapabilities *power_capabilities)
+{
+}
+
+static void
+lightdm_power_capabilities_get_property (GObject    *object,
+                                         guint       prop_id,
+                                         GValue     *value,
+                                         GParamSpec *pspec)
+{
+    switch (prop_id)
+    {
+    case PROP_CAN_SUSPEND:
+        g_value_set_boolean (value, capability_value[CAPABILITY_SUSPEND]);
+        break;
+    case PROP_CAN_HIBERNATE:
+        g_value_set_boolean (value, capability_value[CAPABILITY_HIBERNATE]);
+        break;
+    case PROP_CAN_RESTART:
+        g_value_set_boolean (value, capability_value[CAPABILITY_RESTART]);
+        break;
+    case PROP_CAN_SHUTDOWN:
+        g_value_set_boolean (value, capability_value[CAPABILITY_SHUTDOWN]);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+lightdm_power_capabilities_class_init (LightDMPowerCapabilitiesClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->get_property = lightdm_power_capabilities_get_property;
+
+    g_object_class_install_property (object_class,
+                                     PROP_CAN_SUSPEND,
+                                     g_param_spec_boolean ("can-suspend",
+                                                           "can-suspend",
+                                                           "TRUE if authorized to do a system suspend",
+                                                           FALSE,
+                                                           G_PARAM_READABLE));
+    g_object_class_install_property (object_class,
+                                     PROP_CAN_HIBERNATE,
+                                     g_param_spec_boolean ("can-hibernate",
+                                                           "can-hibernate",
+                                                           "TRUE if authorized to do a system hibernate",
+                                                           FALSE,
+                                                           G_PARAM_READABLE));
+    g_object_class_install_property (object_class,
+                                     PROP_CAN_RESTART,
+                                     g_param_spec_boolean ("can-restart",
+                                                           "can-restart",
+                                                           "TRUE if authorized to do a system restart",
+                                                           FALSE,
+                                                           G_PARAM_READABLE));
+    g_object_class_install_property (object_class,
+                                     PROP_CAN_SHUTDOWN,
+                                     g_param_spec_boolean ("can-shutdown",
+                                                           "can-shutdown",
+                                                           "TRUE if authorized to do a system shutdown",
+                                                           FALSE,
+                                                           G_PARAM_READABLE));
+
+    /**
+     * LightDMPowerCapabilities::changed:
+     * @power_capabilities: A #LightDMPowerCapabilities
+     *
+     * The ::changed signal gets emitted when the capabilities have been checked.
+     **/
+    capabilities_signals[CHANGED] =
+        g_signal_new (LIGHTDM_POWER_CAPABILITIES_SIGNAL_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMPowerCapabilitiesClass, changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+}
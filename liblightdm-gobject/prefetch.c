@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <config.h>
+
+#include "user-list.h"
+#include "lightdm/prefetch.h"
+#include "lightdm/language.h"
+#include "lightdm/layout.h"
+#include "lightdm/power.h"
+#include "lightdm/session.h"
+#include "lightdm/user.h"
+
+/**
+ * SECTION:prefetch
+ * @title: Prefetching
+ * @short_description: Load greeter information in parallel
+ * @include: lightdm.h
+ *
+ * Helper functions to load the users, sessions, languages, keyboard layouts
+ * and power capabilities at the same time when a greeter starts, rather than
+ * one after the other the first time each is used.
+ */
+
+typedef struct
+{
+    /* Items still loading and items that have been loaded */
+    LightDMPrefetchFlags remaining;
+    LightDMPrefetchFlags loaded;
+
+    LightDMPrefetchFunc item_func;
+    gpointer item_data;
+    GDestroyNotify item_destroy;
+
+    gulong users_loaded_handler;
+} PrefetchData;
+
+GType
+lightdm_prefetch_flags_get_type (void)
+{
+    static GType flags_type = 0;
+
+    if (G_UNLIKELY(flags_type == 0)) {
+        static const GFlagsValue values[] = {
+            { LIGHTDM_PREFETCH_USERS, "LIGHTDM_PREFETCH_USERS", "users" },
+            { LIGHTDM_PREFETCH_SESSIONS, "LIGHTDM_PREFETCH_SESSIONS", "sessions" },
+            { LIGHTDM_PREFETCH_LANGUAGES, "LIGHTDM_PREFETCH_LANGUAGES", "languages" },
+            { LIGHTDM_PREFETCH_LAYOUTS, "LIGHTDM_PREFETCH_LAYOUTS", "layouts" },
+            { LIGHTDM_PREFETCH_POWER, "LIGHTDM_PREFETCH_POWER", "power" },
+            { 0, NULL, NULL }
+        };
+        flags_type = g_flags_register_static (g_intern_static_string ("LightDMPrefetchFlags"), values);
+    }
+
+    return flags_type;
+}
+
+static void
+prefetch_data_free (PrefetchData *data)
+{
+    if (data->users_loaded_handler)
+        g_signal_handler_disconnect (lightdm_user_list_get_instance (), data->users_loaded_handler);
+    if (data->item_destroy)
+        data->item_destroy (data->item_data);
+    g_free (data);
+}
+
+static void
+item_ready (GTask *task, LightDMPrefetchFlags item)
+{
+    PrefetchData *data = g_task_get_task_data (task);
+
+    data->remaining &= ~item;
+    data->loaded |= item;
+
+    if (data->item_func && !g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+        data->item_func (item, data->item_data);
+
+    if (data->remaining == 0 && !g_task_return_error_if_cancelled (task))
+        g_task_return_int (task, data->loaded);
+}
+
+static void
+load_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    switch (GPOINTER_TO_UINT (task_data))
+    {
+    case LIGHTDM_PREFETCH_SESSIONS:
+        lightdm_get_sessions ();
+        break;
+    case LIGHTDM_PREFETCH_LANGUAGES:
+        lightdm_get_languages ();
+        break;
+    case LIGHTDM_PREFETCH_LAYOUTS:
+        lightdm_get_layouts ();
+        break;
+    default:
+        break;
+    }
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+load_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+    item_ready (task, GPOINTER_TO_UINT (g_task_get_task_data (G_TASK (result))));
+    g_object_unref (task);
+}
+
+/* Load information that is only read from files in a thread of its own */
+static void
+load_in_thread (GTask *task, LightDMPrefetchFlags item)
+{
+    g_autoptr(GTask) load_task = g_task_new (NULL, NULL, load_cb, g_object_ref (task));
+    g_task_set_task_data (load_task, GUINT_TO_POINTER (item), NULL);
+    g_task_run_in_thread (load_task, load_thread);
+}
+
+static void
+users_loaded_cb (LightDMUserList *user_list, GTask *task)
+{
+    PrefetchData *data = g_task_get_task_data (task);
+
+    g_signal_handler_disconnect (user_list, data->users_loaded_handler);
+    data->users_loaded_handler = 0;
+
+    item_ready (task, LIGHTDM_PREFETCH_USERS);
+    g_object_unref (task);
+}
+
+static gboolean
+users_already_loaded_cb (gpointer user_data)
+{
+    GTask *task = user_data;
+    item_ready (task, LIGHTDM_PREFETCH_USERS);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+power_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    GTask *task = user_data;
+
+    g_autoptr(GError) error = NULL;
+    if (!lightdm_get_power_capabilities_finish (result, &error))
+        g_debug ("Failed to check power capabilities: %s", error->message);
+
+    item_ready (task, LIGHTDM_PREFETCH_POWER);
+    g_object_unref (task);
+}
+
+/**
+ * lightdm_prefetch_async:
+ * @items: The #LightDMPrefetchFlags to load.
+ * @item_func: (allow-none) (scope notified) (closure item_data) (destroy item_destroy): A #LightDMPrefetchFunc to call as each item is loaded or %NULL.
+ * @item_data: (allow-none): data to pass to @item_func or %NULL.
+ * @item_destroy: (allow-none): A #GDestroyNotify to free @item_data or %NULL.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when everything has been loaded or %NULL.
+ * @user_data: (allow-none): data to pass to the @callback or %NULL.
+ *
+ * Starts loading the requested information at the same time. Sessions,
+ * languages and keyboard layouts are read in threads, users and power
+ * capabilities are loaded asynchronously. @item_func is called in the main
+ * thread as each one becomes available, after which the normal functions to
+ * get them return without blocking.
+ *
+ * When everything is loaded, @callback will be called. You can then call
+ * lightdm_prefetch_finish() to get the result of the operation.
+ **/
+void
+lightdm_prefetch_async (LightDMPrefetchFlags items,
+                        LightDMPrefetchFunc item_func, gpointer item_data, GDestroyNotify item_destroy,
+                        GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+    PrefetchData *data = g_new0 (PrefetchData, 1);
+    data->remaining = items & LIGHTDM_PREFETCH_ALL;
+    data->item_func = item_func;
+    data->item_data = item_data;
+    data->item_destroy = item_destroy;
+    g_task_set_task_data (task, data, (GDestroyNotify) prefetch_data_free);
+
+    if (data->remaining == 0)
+    {
+        g_task_return_int (task, 0);
+        return;
+    }
+
+    if (items & LIGHTDM_PREFETCH_USERS)
+    {
+        LightDMUserList *user_list = lightdm_user_list_get_instance ();
+        lightdm_user_list_load_async (user_list);
+        if (common_user_list_get_is_loaded (common_user_list_get_instance ()))
+            g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, users_already_loaded_cb, g_object_ref (task), g_object_unref);
+        else
+            data->users_loaded_handler = g_signal_connect_data (user_list, LIGHTDM_USER_LIST_SIGNAL_USERS_LOADED, G_CALLBACK (users_loaded_cb), g_object_ref (task), NULL, 0);
+    }
+    if (items & LIGHTDM_PREFETCH_SESSIONS)
+        load_in_thread (task, LIGHTDM_PREFETCH_SESSIONS);
+    if (items & LIGHTDM_PREFETCH_LANGUAGES)
+        load_in_thread (task, LIGHTDM_PREFETCH_LANGUAGES);
+    if (items & LIGHTDM_PREFETCH_LAYOUTS)
+        load_in_thread (task, LIGHTDM_PREFETCH_LAYOUTS);
+    if (items & LIGHTDM_PREFETCH_POWER)
+        lightdm_get_power_capabilities_async (cancellable, power_cb, g_object_ref (task));
+}
+
+/**
+ * lightdm_prefetch_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an operation started with lightdm_prefetch_async().
+ *
+ * Return value: The #LightDMPrefetchFlags that were loaded, or 0 on error.
+ **/
+LightDMPrefetchFlags
+lightdm_prefetch_finish (GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), 0);
+
+    gssize loaded = g_task_propagate_int (G_TASK (result), error);
+    return loaded < 0 ? 0 : loaded;
+}
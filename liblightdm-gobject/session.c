@@ -12,6 +12,7 @@
 #include <gio/gdesktopappinfo.h>
 
 #include "configuration.h"
+#include "session-index.h"
 #include "lightdm/session.h"
 
 /**
@@ -35,6 +36,19 @@
  * Class structure for #LightDMSession.
  */
 
+/**
+ * LightDMSessionList:
+ *
+ * #LightDMSessionList is an opaque data structure and can only be accessed
+ * using the provided functions.
+ */
+
+/**
+ * LightDMSessionListClass:
+ *
+ * Class structure for #LightDMSessionList.
+ */
+
 enum {
     PROP_KEY = 1,
     PROP_NAME,
@@ -49,13 +63,27 @@ typedef struct
     gchar *comment;
 } LightDMSessionPrivate;
 
+enum {
+    SESSION_ADDED,
+    SESSION_REMOVED,
+    LAST_LIST_SIGNAL
+};
+static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
+
 G_DEFINE_TYPE_WITH_PRIVATE (LightDMSession, lightdm_session, G_TYPE_OBJECT)
+G_DEFINE_TYPE (LightDMSessionList, lightdm_session_list, G_TYPE_OBJECT)
 
 #define GET_PRIVATE(obj) G_TYPE_INSTANCE_GET_PRIVATE ((obj), LIGHTDM_TYPE_SESSION, LightDMSessionPrivate)
 
+/* Sessions may be loaded from a thread by lightdm_prefetch_async() */
+static GMutex sessions_lock;
 static gboolean have_sessions = FALSE;
+static gchar *local_sessions_dir = NULL;
+static gchar *remote_sessions_dir = NULL;
 static GList *local_sessions = NULL;
 static GList *remote_sessions = NULL;
+static LightDMSessionList *list_singleton = NULL;
+static guint reload_idle = 0;
 
 static gint
 compare_session (gconstpointer a, gconstpointer b)
@@ -66,8 +94,10 @@ compare_session (gconstpointer a, gconstpointer b)
 }
 
 static LightDMSession *
-load_session (GKeyFile *key_file, const gchar *key, const gchar *default_type)
+load_session (CommonSessionFile *session_file)
 {
+    GKeyFile *key_file = session_file->key_file;
+
     if (g_key_file_get_boolean (key_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NO_DISPLAY, NULL) ||
         g_key_file_get_boolean (key_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_HIDDEN, NULL))
         return NULL;
@@ -92,18 +122,14 @@ load_session (GKeyFile *key_file, const gchar *key, const gchar *default_type)
             return NULL;
     }
 
-    g_autofree gchar *type = g_key_file_get_string (key_file, G_KEY_FILE_DESKTOP_GROUP, "X-LightDM-Session-Type", NULL);
-    if (!type)
-        type = strdup (default_type);
-
     LightDMSession *session = g_object_new (LIGHTDM_TYPE_SESSION, NULL);
     LightDMSessionPrivate *priv = GET_PRIVATE (session);
 
     g_free (priv->key);
-    priv->key = g_strdup (key);
+    priv->key = g_strdup (session_file->key);
 
     g_free (priv->type);
-    priv->type = g_steal_pointer (&type);
+    priv->type = g_strdup (session_file->session_type);
 
     g_free (priv->name);
     priv->name = g_steal_pointer (&name);
@@ -117,77 +143,115 @@ load_session (GKeyFile *key_file, const gchar *key, const gchar *default_type)
 }
 
 static GList *
-load_sessions_dir (GList *sessions, const gchar *sessions_dir, const gchar *default_type)
+load_sessions (const gchar *sessions_dir)
 {
-    g_autoptr(GError) error = NULL;
-    GDir *directory = g_dir_open (sessions_dir, 0, &error);
-    if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-        g_warning ("Failed to open sessions directory: %s", error->message);
-    if (!directory)
-        return sessions;
-
-    while (TRUE)
+    g_autoptr(GList) session_files = common_session_index_get_sessions (sessions_dir);
+    GList *sessions = NULL;
+    for (GList *link = session_files; link; link = link->next)
     {
-        const gchar *filename = g_dir_read_name (directory);
-        if (filename == NULL)
-            break;
-
-        if (!g_str_has_suffix (filename, ".desktop"))
-            continue;
+        CommonSessionFile *session_file = link->data;
 
-        g_autofree gchar *path = g_build_filename (sessions_dir, filename, NULL);
-
-        g_autoptr(GKeyFile) key_file = g_key_file_new ();
-        g_autoptr(GError) e = NULL;
-        gboolean result = g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &e);
-        if (e)
-            g_warning ("Failed to load session file %s: %s:", path, e->message);
-
-        if (result)
+        LightDMSession *session = load_session (session_file);
+        if (session)
         {
-            g_autofree gchar *key = g_strndup (filename, strlen (filename) - strlen (".desktop"));
-            LightDMSession *session = load_session (key_file, key, default_type);
-            if (session)
-            {
-                g_debug ("Loaded session %s (%s, %s)", path, GET_PRIVATE (session)->name, GET_PRIVATE (session)->comment);
-                sessions = g_list_insert_sorted (sessions, session, compare_session);
-            }
-            else
-                g_debug ("Ignoring session %s", path);
+            g_debug ("Loaded session %s (%s, %s)", session_file->path, GET_PRIVATE (session)->name, GET_PRIVATE (session)->comment);
+            sessions = g_list_insert_sorted (sessions, session, compare_session);
         }
+        else
+            g_debug ("Ignoring session %s", session_file->path);
     }
 
-    g_dir_close (directory);
-
     return sessions;
 }
 
+static gboolean
+session_equal (LightDMSession *a, LightDMSession *b)
+{
+    LightDMSessionPrivate *priv_a = GET_PRIVATE (a);
+    LightDMSessionPrivate *priv_b = GET_PRIVATE (b);
+    return strcmp (priv_a->key, priv_b->key) == 0 &&
+           g_strcmp0 (priv_a->type, priv_b->type) == 0 &&
+           strcmp (priv_a->name, priv_b->name) == 0 &&
+           strcmp (priv_a->comment, priv_b->comment) == 0;
+}
+
 static GList *
-load_sessions (const gchar *sessions_dir)
+find_session (GList *sessions, LightDMSession *session)
 {
-    g_auto(GStrv) dirs = g_strsplit (sessions_dir, ":", -1);
-    GList *sessions = NULL;
-    for (int i = 0; dirs[i]; i++)
+    for (GList *link = sessions; link; link = link->next)
+        if (session_equal (link->data, session))
+            return link;
+    return NULL;
+}
+
+/* Bring the list up to date, keeping the objects for sessions that haven't changed */
+static void
+merge_sessions (GList **sessions, GList *new_sessions)
+{
+    GList *next_link;
+    for (GList *link = *sessions; link; link = next_link)
     {
-        const gchar *default_type = "x";
+        LightDMSession *session = link->data;
+        next_link = link->next;
 
-        if (dirs[i] != NULL && g_str_has_suffix (dirs[i], "/wayland-sessions") == TRUE)
-            default_type = "wayland";
+        if (find_session (new_sessions, session))
+            continue;
 
-        sessions = load_sessions_dir (sessions, dirs[i], default_type);
+        *sessions = g_list_delete_link (*sessions, link);
+        if (list_singleton)
+            g_signal_emit (list_singleton, list_signals[SESSION_REMOVED], 0, session);
+        g_object_unref (session);
     }
 
-    return sessions;
+    for (GList *link = new_sessions; link; link = link->next)
+    {
+        LightDMSession *session = link->data;
+
+        if (find_session (*sessions, session))
+        {
+            g_object_unref (session);
+            continue;
+        }
+
+        *sessions = g_list_insert_sorted (*sessions, session, compare_session);
+        if (list_singleton)
+            g_signal_emit (list_singleton, list_signals[SESSION_ADDED], 0, session);
+    }
+    g_list_free (new_sessions);
+}
+
+static gboolean
+reload_sessions_cb (gpointer data)
+{
+    reload_idle = 0;
+
+    g_debug ("Session directories changed, reloading sessions");
+    merge_sessions (&local_sessions, load_sessions (local_sessions_dir));
+    merge_sessions (&remote_sessions, load_sessions (remote_sessions_dir));
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+session_index_changed_cb (gpointer data)
+{
+    /* Coalesce the events for several files into a single reload */
+    if (!reload_idle)
+        reload_idle = g_idle_add (reload_sessions_cb, NULL);
 }
 
 static void
 update_sessions (void)
 {
+    g_mutex_lock (&sessions_lock);
     if (have_sessions)
+    {
+        g_mutex_unlock (&sessions_lock);
         return;
+    }
 
-    g_autofree gchar *sessions_dir = g_strdup (SESSIONS_DIR);
-    g_autofree gchar *remote_sessions_dir = g_strdup (REMOTE_SESSIONS_DIR);
+    local_sessions_dir = g_strdup (SESSIONS_DIR);
+    remote_sessions_dir = g_strdup (REMOTE_SESSIONS_DIR);
 
     /* Use session directory from configuration */
     config_load_from_standard_locations (config_get_instance (), NULL, NULL);
@@ -195,8 +259,8 @@ update_sessions (void)
     gchar *value = config_get_string (config_get_instance (), "LightDM", "sessions-directory");
     if (value)
     {
-        g_free (sessions_dir);
-        sessions_dir = value;
+        g_free (local_sessions_dir);
+        local_sessions_dir = value;
     }
 
     value = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
@@ -206,10 +270,19 @@ update_sessions (void)
         remote_sessions_dir = value;
     }
 
-    local_sessions = load_sessions (sessions_dir);
+    /* Start from the session files the daemon has already read, if they are still current */
+    const gchar *snapshot_path = g_getenv ("LIGHTDM_SESSIONS_SNAPSHOT");
+    if (snapshot_path)
+        common_session_index_load_snapshot (snapshot_path);
+
+    local_sessions = load_sessions (local_sessions_dir);
     remote_sessions = load_sessions (remote_sessions_dir);
 
+    /* Keep the lists current as sessions are installed and removed */
+    common_session_index_set_changed_func (session_index_changed_cb, NULL);
+
     have_sessions = TRUE;
+    g_mutex_unlock (&sessions_lock);
 }
 
 /**
@@ -240,6 +313,27 @@ lightdm_get_remote_sessions (void)
     return remote_sessions;
 }
 
+/**
+ * lightdm_session_list_get_instance:
+ *
+ * Get the list of sessions. This object emits signals when sessions are
+ * installed or removed, the sessions themselves are returned by
+ * lightdm_get_sessions() and lightdm_get_remote_sessions(), which are
+ * updated before the signals are emitted.
+ *
+ * Return value: (transfer none): the #LightDMSessionList
+ **/
+LightDMSessionList *
+lightdm_session_list_get_instance (void)
+{
+    if (!list_singleton)
+    {
+        list_singleton = g_object_new (LIGHTDM_TYPE_SESSION_LIST, NULL);
+        update_sessions ();
+    }
+    return list_singleton;
+}
+
 /**
  * lightdm_session_get_key:
  * @session: A #LightDMSession
@@ -381,3 +475,45 @@ lightdm_session_class_init (LightDMSessionClass *klass)
                                                           NULL,
                                                           G_PARAM_READABLE));
 }
+
+static void
+lightdm_session_list_init (LightDMSessionList *session_list)
+{
+}
+
+static void
+lightdm_session_list_class_init (LightDMSessionListClass *klass)
+{
+    /**
+     * LightDMSessionList::session-added:
+     * @session_list: A #LightDMSessionList
+     * @session: The #LightDMSession that has been added.
+     *
+     * The ::session-added signal gets emitted when a session is installed.
+     **/
+    list_signals[SESSION_ADDED] =
+        g_signal_new (LIGHTDM_SESSION_LIST_SIGNAL_SESSION_ADDED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMSessionListClass, session_added),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, LIGHTDM_TYPE_SESSION);
+
+    /**
+     * LightDMSessionList::session-removed:
+     * @session_list: A #LightDMSessionList
+     * @session: The #LightDMSession that has been removed.
+     *
+     * The ::session-removed signal gets emitted when a session is removed or
+     * changed, a changed session is added again afterwards.
+     **/
+    list_signals[SESSION_REMOVED] =
+        g_signal_new (LIGHTDM_SESSION_LIST_SIGNAL_SESSION_REMOVED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMSessionListClass, session_removed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, LIGHTDM_TYPE_SESSION);
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef SYSTEM_PRIVATE_H_
+#define SYSTEM_PRIVATE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void system_set_daemon_info (const gchar *hostname, const gchar *os_release, const gchar *motd);
+
+G_END_DECLS
+
+#endif /* SYSTEM_PRIVATE_H_ */
@@ -8,9 +8,13 @@
  * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
  */
 
+#include <limits.h>
 #include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
 
 #include "lightdm/system.h"
+#include "system-private.h"
 
 /**
  * SECTION:system
@@ -19,8 +23,95 @@
  * @include: lightdm.h
  *
  * Helper functions to get system information.
+ *
+ * The information is read once and kept until the files it comes from
+ * change. When the daemon provides it the filesystem is not read at all.
  */
 
+/* Cached values, old values are kept until replaced so returned strings stay valid */
+static gboolean hostname_loaded = FALSE;
+static gchar *hostname = NULL;
+static gboolean os_release_loaded = FALSE;
+static gchar *os_id = NULL;
+static gchar *os_name = NULL;
+static gchar *os_version = NULL;
+static gchar *os_version_id = NULL;
+static gchar *os_pretty_name = NULL;
+static gboolean motd_loaded = FALSE;
+static gchar *motd = NULL;
+
+/* TRUE if the daemon has provided the information */
+static gboolean have_daemon_info = FALSE;
+
+/* Monitors on the files the information is read from */
+static GFileMonitor *hostname_monitor = NULL;
+static GFileMonitor *os_release_monitor = NULL;
+static GFileMonitor *motd_monitor = NULL;
+
+static LightDMSystemChangedFunc changed_func = NULL;
+static gpointer changed_data = NULL;
+static GDestroyNotify changed_destroy = NULL;
+
+static void
+notify_changed (void)
+{
+    if (changed_func)
+        changed_func (changed_data);
+}
+
+static void
+file_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer data)
+{
+    if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+        event_type != G_FILE_MONITOR_EVENT_CREATED &&
+        event_type != G_FILE_MONITOR_EVENT_DELETED)
+        return;
+
+    gboolean *loaded = data;
+    *loaded = FALSE;
+    notify_changed ();
+}
+
+static void
+watch_file (const gchar *path, GFileMonitor **monitor, gboolean *loaded)
+{
+    if (*monitor)
+        return;
+
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    *monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+    if (*monitor)
+        g_signal_connect (*monitor, "changed", G_CALLBACK (file_changed_cb), loaded);
+}
+
+static void
+set_value (gchar **value, const gchar *new_value)
+{
+    g_free (*value);
+    *value = g_strdup (new_value);
+}
+
+static void
+load_hostname (void)
+{
+    if (hostname_loaded)
+        return;
+
+    watch_file ("/etc/hostname", &hostname_monitor, &hostname_loaded);
+
+    /* Not g_get_host_name(), which never notices the name changing */
+    gchar name[HOST_NAME_MAX + 1];
+    if (gethostname (name, sizeof (name)) == 0)
+    {
+        name[HOST_NAME_MAX] = '\0';
+        set_value (&hostname, name);
+    }
+    else
+        set_value (&hostname, g_get_host_name ());
+
+    hostname_loaded = TRUE;
+}
+
 /**
  * lightdm_get_hostname:
  *
@@ -29,39 +120,35 @@
 const gchar *
 lightdm_get_hostname (void)
 {
-    return g_get_host_name ();
+    load_hostname ();
+    return hostname;
 }
 
-static gboolean os_release_loaded = FALSE;
-static gchar *os_id = NULL;
-static gchar *os_name = NULL;
-static gchar *os_version = NULL;
-static gchar *os_version_id = NULL;
-static gchar *os_pretty_name = NULL;
-
 static void
 use_os_value (const gchar *name, const gchar *value)
 {
     if (strcmp (name, "ID") == 0)
-        os_id = g_strdup (value);
+        set_value (&os_id, value);
     if (strcmp (name, "NAME") == 0)
-        os_name = g_strdup (value);
+        set_value (&os_name, value);
     if (strcmp (name, "VERSION") == 0)
-        os_version = g_strdup (value);
+        set_value (&os_version, value);
     if (strcmp (name, "VERSION_ID") == 0)
-        os_version_id = g_strdup (value);
+        set_value (&os_version_id, value);
     if (strcmp (name, "PRETTY_NAME") == 0)
-        os_pretty_name = g_strdup (value);
+        set_value (&os_pretty_name, value);
 }
 
 static void
-load_os_release (void)
+parse_os_release (const gchar *data)
 {
-    if (os_release_loaded)
-        return;
+    g_clear_pointer (&os_id, g_free);
+    g_clear_pointer (&os_name, g_free);
+    g_clear_pointer (&os_version, g_free);
+    g_clear_pointer (&os_version_id, g_free);
+    g_clear_pointer (&os_pretty_name, g_free);
 
-    g_autofree gchar *data = NULL;
-    if (!g_file_get_contents ("/etc/os-release", &data, NULL, NULL))
+    if (!data)
         return;
 
     g_auto(GStrv) lines = g_strsplit (data, "\n", -1);
@@ -81,6 +168,19 @@ load_os_release (void)
             }
         }
     }
+}
+
+static void
+load_os_release (void)
+{
+    if (os_release_loaded)
+        return;
+
+    watch_file ("/etc/os-release", &os_release_monitor, &os_release_loaded);
+
+    g_autofree gchar *data = NULL;
+    g_file_get_contents ("/etc/os-release", &data, NULL, NULL);
+    parse_os_release (data);
 
     os_release_loaded = TRUE;
 }
@@ -171,7 +271,63 @@ lightdm_get_os_version_id (void)
 gchar *
 lightdm_get_motd (void)
 {
-    gchar *data = NULL;
-    g_file_get_contents ("/etc/motd", &data, NULL, NULL);
-    return data;
+    if (!motd_loaded)
+    {
+        watch_file ("/etc/motd", &motd_monitor, &motd_loaded);
+        g_clear_pointer (&motd, g_free);
+        g_file_get_contents ("/etc/motd", &motd, NULL, NULL);
+        motd_loaded = TRUE;
+    }
+
+    return g_strdup (motd);
+}
+
+/**
+ * lightdm_set_system_changed_func:
+ * @func: (allow-none) (scope notified) (closure user_data) (destroy destroy): A #LightDMSystemChangedFunc to call when the system information changes or %NULL.
+ * @user_data: (allow-none): data to pass to @func or %NULL.
+ * @destroy: (allow-none): A #GDestroyNotify to free @user_data or %NULL.
+ *
+ * Set a function to call when the hostname, OS information or message of
+ * the day may have changed. Strings returned before the change remain
+ * valid until the new values are requested.
+ **/
+void
+lightdm_set_system_changed_func (LightDMSystemChangedFunc func, gpointer user_data, GDestroyNotify destroy)
+{
+    if (changed_destroy)
+        changed_destroy (changed_data);
+    changed_func = func;
+    changed_data = user_data;
+    changed_destroy = destroy;
+}
+
+/* Use the information the daemon sent instead of reading it from the filesystem */
+void
+system_set_daemon_info (const gchar *new_hostname, const gchar *os_release, const gchar *new_motd)
+{
+    gboolean changed = have_daemon_info &&
+                       (g_strcmp0 (hostname, new_hostname) != 0 || g_strcmp0 (motd, new_motd) != 0);
+
+    /* The daemon sends the information again when it changes */
+    have_daemon_info = TRUE;
+    g_clear_object (&hostname_monitor);
+    g_clear_object (&os_release_monitor);
+    g_clear_object (&motd_monitor);
+
+    if (new_hostname)
+        set_value (&hostname, new_hostname);
+    hostname_loaded = new_hostname != NULL;
+
+    g_autofree gchar *old_pretty_name = g_strdup (os_pretty_name);
+    parse_os_release (os_release);
+    os_release_loaded = TRUE;
+    if (g_strcmp0 (old_pretty_name, os_pretty_name) != 0)
+        changed = TRUE;
+
+    set_value (&motd, new_motd);
+    motd_loaded = TRUE;
+
+    if (changed)
+        notify_changed ();
 }
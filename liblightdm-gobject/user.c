@@ -74,6 +74,8 @@ enum
     USER_PROP_HOME_DIRECTORY,
     USER_PROP_IMAGE,
     USER_PROP_BACKGROUND,
+    USER_PROP_CACHED_IMAGE,
+    USER_PROP_CACHED_BACKGROUND,
     USER_PROP_LANGUAGE,
     USER_PROP_LAYOUT,
     USER_PROP_LAYOUTS,
@@ -89,6 +91,10 @@ enum
     USER_ADDED,
     USER_CHANGED,
     USER_REMOVED,
+    USERS_LOADED,
+    USERS_ADDED,
+    USERS_CHANGED,
+    USERS_REMOVED,
     LAST_LIST_SIGNAL
 };
 static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
@@ -104,13 +110,29 @@ typedef struct
 {
     gboolean initialized;
 
-    /* Wrapper list, kept locally to preserve transfer-none promises */
+    /* Wrapper list, kept locally to preserve transfer-none promises.
+     * Only made when wrappers are asked for */
+    gboolean wrapped;
     GList *lightdm_list;
+
+    /* Wrappers made so far, keyed by common user. This has all the users in
+     * the list once wrapped, or just those from searches and signals before then */
+    GHashTable *wrappers;
+
+    /* Wrappers of removed users, kept until they are reported together */
+    GPtrArray *removed_wrappers;
+
+    /* Read-only table of the users, rebuilt after the list changes */
+    GArray *user_table;
 } LightDMUserListPrivate;
 
 typedef struct
 {
     CommonUser *common_user;
+
+    /* Paths of the copies of the image and background kept by the daemon */
+    gchar *cached_image;
+    gchar *cached_background;
 } LightDMUserPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (LightDMUserList, lightdm_user_list, G_TYPE_OBJECT)
@@ -143,29 +165,86 @@ user_changed_cb (CommonUser *common_user, LightDMUser *lightdm_user)
 }
 
 static LightDMUser *
-wrap_common_user (CommonUser *user)
+get_wrapper (LightDMUserList *user_list, CommonUser *user)
 {
-    LightDMUser *lightdm_user = g_object_new (LIGHTDM_TYPE_USER, "common-user", user, NULL);
+    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    LightDMUser *lightdm_user = g_hash_table_lookup (priv->wrappers, user);
+    if (lightdm_user)
+        return lightdm_user;
+
+    lightdm_user = g_object_new (LIGHTDM_TYPE_USER, "common-user", user, NULL);
     g_signal_connect (user, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), lightdm_user);
+    g_hash_table_insert (priv->wrappers, user, lightdm_user);
+
     return lightdm_user;
 }
 
+static void
+wrapper_free (LightDMUser *lightdm_user)
+{
+    g_signal_handlers_disconnect_by_data (GET_USER_PRIVATE (lightdm_user)->common_user, lightdm_user);
+    g_object_unref (lightdm_user);
+}
+
+static void
+ensure_wrapped (LightDMUserList *user_list)
+{
+    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    if (priv->wrapped)
+        return;
+
+    GList *common_users = common_user_list_get_users (common_user_list_get_instance ());
+    for (GList *link = common_users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        priv->lightdm_list = g_list_prepend (priv->lightdm_list, g_object_ref (get_wrapper (user_list, user)));
+    }
+    priv->lightdm_list = g_list_reverse (priv->lightdm_list);
+
+    priv->wrapped = TRUE;
+}
+
+/* Make wrappers to report a change, unless they don't exist and nobody is listening */
+static gboolean
+need_wrappers (LightDMUserList *user_list, guint signal_id)
+{
+    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    g_clear_pointer (&priv->user_table, g_array_unref);
+
+    if (!priv->wrapped && !g_signal_has_handler_pending (user_list, signal_id, 0, TRUE))
+        return FALSE;
+
+    return TRUE;
+}
+
 static void
 user_list_added_cb (CommonUserList *common_list, CommonUser *common_user, LightDMUserList *user_list)
 {
     LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
-    GList *common_users = common_user_list_get_users (common_list);
-    LightDMUser *lightdm_user = wrap_common_user (common_user);
-    priv->lightdm_list = g_list_insert (priv->lightdm_list, lightdm_user, g_list_index (common_users, common_user));
+
+    if (!need_wrappers (user_list, list_signals[USER_ADDED]))
+        return;
+
+    /* Only the new user needs a wrapper, the full list is made if it is asked for */
+    LightDMUser *lightdm_user = get_wrapper (user_list, common_user);
+    if (priv->wrapped)
+    {
+        GList *common_users = common_user_list_get_users (common_list);
+        priv->lightdm_list = g_list_insert (priv->lightdm_list, g_object_ref (lightdm_user), g_list_index (common_users, common_user));
+    }
     g_signal_emit (user_list, list_signals[USER_ADDED], 0, lightdm_user);
 }
 
 static void
 user_list_changed_cb (CommonUserList *common_list, CommonUser *common_user, LightDMUserList *user_list)
 {
-    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
-    GList *common_users = common_user_list_get_users (common_list);
-    LightDMUser *lightdm_user = g_list_nth_data (priv->lightdm_list, g_list_index (common_users, common_user));
+    if (!need_wrappers (user_list, list_signals[USER_CHANGED]))
+        return;
+
+    LightDMUser *lightdm_user = get_wrapper (user_list, common_user);
     g_signal_emit (user_list, list_signals[USER_CHANGED], 0, lightdm_user);
 }
 
@@ -174,18 +253,77 @@ user_list_removed_cb (CommonUserList *common_list, CommonUser *common_user, Ligh
 {
     LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
 
-    for (GList *link = priv->lightdm_list; link; link = link->next)
+    /* Without a wrapper nobody can have been told about this user */
+    g_clear_pointer (&priv->user_table, g_array_unref);
+    LightDMUser *lightdm_user = g_hash_table_lookup (priv->wrappers, common_user);
+    if (!lightdm_user)
+        return;
+
+    GList *link = g_list_find (priv->lightdm_list, lightdm_user);
+    if (link)
     {
-        LightDMUser *lightdm_user = link->data;
-        LightDMUserPrivate *user_priv = GET_USER_PRIVATE (lightdm_user);
-        if (user_priv->common_user == common_user)
-        {
-            priv->lightdm_list = g_list_delete_link (priv->lightdm_list, link);
-            g_signal_emit (user_list, list_signals[USER_REMOVED], 0, lightdm_user);
-            g_object_unref (lightdm_user);
-            break;
-        }
+        priv->lightdm_list = g_list_delete_link (priv->lightdm_list, link);
+        g_object_unref (lightdm_user);
     }
+    g_signal_emit (user_list, list_signals[USER_REMOVED], 0, lightdm_user);
+    g_hash_table_steal (priv->wrappers, common_user);
+    g_ptr_array_add (priv->removed_wrappers, lightdm_user);
+}
+
+static GPtrArray *
+get_wrappers (LightDMUserList *user_list, GPtrArray *common_users)
+{
+    GPtrArray *users = g_ptr_array_new_full (common_users->len, g_object_unref);
+    for (guint i = 0; i < common_users->len; i++)
+        g_ptr_array_add (users, g_object_ref (get_wrapper (user_list, g_ptr_array_index (common_users, i))));
+    return users;
+}
+
+static void
+user_list_users_added_cb (CommonUserList *common_list, GPtrArray *common_users, LightDMUserList *user_list)
+{
+    if (!need_wrappers (user_list, list_signals[USERS_ADDED]))
+        return;
+
+    g_autoptr(GPtrArray) users = get_wrappers (user_list, common_users);
+    g_signal_emit (user_list, list_signals[USERS_ADDED], 0, users);
+}
+
+static void
+user_list_users_changed_cb (CommonUserList *common_list, GPtrArray *common_users, LightDMUserList *user_list)
+{
+    if (!need_wrappers (user_list, list_signals[USERS_CHANGED]))
+        return;
+
+    g_autoptr(GPtrArray) users = get_wrappers (user_list, common_users);
+    g_signal_emit (user_list, list_signals[USERS_CHANGED], 0, users);
+}
+
+static void
+user_list_users_removed_cb (CommonUserList *common_list, GPtrArray *common_users, LightDMUserList *user_list)
+{
+    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    /* The wrappers were set aside as each user was removed */
+    g_autoptr(GPtrArray) users = g_steal_pointer (&priv->removed_wrappers);
+    priv->removed_wrappers = g_ptr_array_new_with_free_func ((GDestroyNotify) wrapper_free);
+    if (users->len > 0)
+        g_signal_emit (user_list, list_signals[USERS_REMOVED], 0, users);
+}
+
+static void
+user_list_loaded_cb (CommonUserList *common_list, LightDMUserList *user_list)
+{
+    g_signal_emit (user_list, list_signals[USERS_LOADED], 0);
+}
+
+/* Show the users the daemon last saw straight away and update them in the background */
+static void
+load_snapshot (void)
+{
+    const gchar *snapshot_path = g_getenv ("LIGHTDM_USER_LIST_SNAPSHOT");
+    if (snapshot_path && common_user_list_load_snapshot (common_user_list_get_instance (), snapshot_path))
+        common_user_list_load_async (common_user_list_get_instance ());
 }
 
 static void
@@ -196,23 +334,73 @@ initialize_user_list_if_needed (LightDMUserList *user_list)
     if (priv->initialized)
         return;
 
-    GList *common_users = common_user_list_get_users (common_user_list_get_instance ());
-    for (GList *link = common_users; link; link = link->next)
-    {
-        CommonUser *user = link->data;
-        LightDMUser *lightdm_user = wrap_common_user (user);
-        priv->lightdm_list = g_list_prepend (priv->lightdm_list, lightdm_user);
-    }
-    priv->lightdm_list = g_list_reverse (priv->lightdm_list);
+    load_snapshot ();
 
     CommonUserList *common_list = common_user_list_get_instance ();
     g_signal_connect (common_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (user_list_added_cb), user_list);
     g_signal_connect (common_list, USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (user_list_changed_cb), user_list);
     g_signal_connect (common_list, USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (user_list_removed_cb), user_list);
+    g_signal_connect (common_list, USER_LIST_SIGNAL_USERS_LOADED, G_CALLBACK (user_list_loaded_cb), user_list);
+    g_signal_connect (common_list, USER_LIST_SIGNAL_USERS_ADDED, G_CALLBACK (user_list_users_added_cb), user_list);
+    g_signal_connect (common_list, USER_LIST_SIGNAL_USERS_CHANGED, G_CALLBACK (user_list_users_changed_cb), user_list);
+    g_signal_connect (common_list, USER_LIST_SIGNAL_USERS_REMOVED, G_CALLBACK (user_list_users_removed_cb), user_list);
 
     priv->initialized = TRUE;
 }
 
+/**
+ * lightdm_user_list_load_async:
+ * @user_list: A #LightDMUserList
+ *
+ * Start loading the users without blocking.  Users are reported with the
+ * #LightDMUserList::user-added signal as they are loaded and the
+ * #LightDMUserList::users-loaded signal is emitted once the list is complete.
+ * Until then lightdm_user_list_get_users() returns the users loaded so far.
+ *
+ * Call this before any other user list functions; once the list has been
+ * loaded this has no effect.
+ **/
+void
+lightdm_user_list_load_async (LightDMUserList *user_list)
+{
+    g_return_if_fail (LIGHTDM_IS_USER_LIST (user_list));
+    load_snapshot ();
+    common_user_list_load_async (common_user_list_get_instance ());
+    initialize_user_list_if_needed (user_list);
+}
+
+/**
+ * lightdm_user_list_prefetch_settings:
+ * @user_list: A #LightDMUserList
+ *
+ * Start reading the language, layout and session settings of all users in the
+ * background so they can be shown without blocking on slow home directories.
+ * Until a user's settings have been read the system defaults are returned and
+ * the #LightDMUser::changed signal is emitted once they are available.
+ **/
+void
+lightdm_user_list_prefetch_settings (LightDMUserList *user_list)
+{
+    g_return_if_fail (LIGHTDM_IS_USER_LIST (user_list));
+    CommonUserList *common_list = common_user_list_get_instance ();
+    common_user_list_prefetch_dmrc (common_list, common_user_list_get_users (common_list));
+}
+
+/**
+ * lightdm_user_list_get_is_loaded:
+ * @user_list: A #LightDMUserList
+ *
+ * Check if all users have been loaded.
+ *
+ * Return value: #TRUE if the user list is complete.
+ **/
+gboolean
+lightdm_user_list_get_is_loaded (LightDMUserList *user_list)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), FALSE);
+    return common_user_list_get_is_loaded (common_user_list_get_instance ());
+}
+
 /**
  * lightdm_user_list_get_length:
  * @user_list: a #LightDMUserList
@@ -224,7 +412,7 @@ lightdm_user_list_get_length (LightDMUserList *user_list)
 {
     g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), 0);
     initialize_user_list_if_needed (user_list);
-    return g_list_length (GET_LIST_PRIVATE (user_list)->lightdm_list);
+    return common_user_list_get_length (common_user_list_get_instance ());
 }
 
 /**
@@ -241,6 +429,7 @@ lightdm_user_list_get_users (LightDMUserList *user_list)
 {
     g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
     initialize_user_list_if_needed (user_list);
+    ensure_wrapped (user_list);
     return GET_LIST_PRIVATE (user_list)->lightdm_list;
 }
 
@@ -260,6 +449,7 @@ lightdm_user_list_get_user_by_name (LightDMUserList *user_list, const gchar *use
     g_return_val_if_fail (username != NULL, NULL);
 
     initialize_user_list_if_needed (user_list);
+    ensure_wrapped (user_list);
 
     for (GList *link = GET_LIST_PRIVATE (user_list)->lightdm_list; link; link = link->next)
     {
@@ -271,9 +461,139 @@ lightdm_user_list_get_user_by_name (LightDMUserList *user_list, const gchar *use
     return NULL;
 }
 
+/**
+ * lightdm_user_list_search:
+ * @user_list: A #LightDMUserList
+ * @prefix: Start of the user name or real name to match.
+ * @limit: Maximum number of users to return or 0 for no limit.
+ *
+ * Find the users whose user name or real name starts with @prefix, ignoring
+ * case.  Only the matching users get a #LightDMUser, so greeters for large
+ * user directories can show the results of what has been typed without
+ * making an entry for every user as lightdm_user_list_get_users() does.
+ *
+ * Return value: (element-type LightDMUser) (transfer container): A list of matching #LightDMUser, free with g_list_free().
+ **/
+GList *
+lightdm_user_list_search (LightDMUserList *user_list, const gchar *prefix, guint limit)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
+    g_return_val_if_fail (prefix != NULL, NULL);
+
+    initialize_user_list_if_needed (user_list);
+
+    g_autoptr(GList) common_users = common_user_list_search (common_user_list_get_instance (), prefix, limit);
+    GList *users = NULL;
+    for (GList *link = common_users; link; link = link->next)
+        users = g_list_prepend (users, get_wrapper (user_list, link->data));
+
+    return g_list_reverse (users);
+}
+
+static GArray *
+get_user_table (LightDMUserList *user_list)
+{
+    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+
+    initialize_user_list_if_needed (user_list);
+
+    if (priv->user_table)
+        return priv->user_table;
+
+    /* The entries point at the strings of the common users, nothing is copied */
+    CommonUserList *common_list = common_user_list_get_instance ();
+    priv->user_table = g_array_sized_new (FALSE, TRUE, sizeof (LightDMUserInfo), common_user_list_get_length (common_list));
+    for (GList *link = common_user_list_get_users (common_list); link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        LightDMUserInfo info;
+        info.name = common_user_get_name (user);
+        info.real_name = common_user_get_real_name (user);
+        info.display_name = common_user_get_display_name (user);
+        info.home_directory = common_user_get_home_directory (user);
+        info.image = common_user_get_image (user);
+        info.background = common_user_get_background (user);
+        info.uid = common_user_get_uid (user);
+        g_array_append_val (priv->user_table, info);
+    }
+
+    return priv->user_table;
+}
+
+/**
+ * lightdm_user_list_get_user_table:
+ * @user_list: A #LightDMUserList
+ * @n_users: (out): Location to write the number of users
+ *
+ * Get a read-only table of the users to present to the user.  Unlike
+ * lightdm_user_list_get_users() this does not make a #LightDMUser for each
+ * user, which saves memory and time with large user directories.
+ *
+ * The table is only valid until the user list changes, so it should not be
+ * kept after returning to the main loop.
+ *
+ * Return value: (array length=n_users) (transfer none): The users.
+ **/
+const LightDMUserInfo *
+lightdm_user_list_get_user_table (LightDMUserList *user_list, guint *n_users)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
+    g_return_val_if_fail (n_users != NULL, NULL);
+
+    GArray *table = get_user_table (user_list);
+    *n_users = table->len;
+    return (const LightDMUserInfo *) table->data;
+}
+
+/**
+ * lightdm_user_list_iter_init:
+ * @iter: (out caller-allocates): A #LightDMUserListIter
+ * @user_list: A #LightDMUserList
+ *
+ * Start iterating over the user table, see lightdm_user_list_get_user_table().
+ **/
+void
+lightdm_user_list_iter_init (LightDMUserListIter *iter, LightDMUserList *user_list)
+{
+    g_return_if_fail (iter != NULL);
+    g_return_if_fail (LIGHTDM_IS_USER_LIST (user_list));
+
+    iter->table = get_user_table (user_list);
+    iter->index = 0;
+}
+
+/**
+ * lightdm_user_list_iter_next:
+ * @iter: A #LightDMUserListIter
+ * @info: (out) (transfer none): Location to write the next user
+ *
+ * Get the next user from the user table.  As with the table, the iterator
+ * is only valid until the user list changes.
+ *
+ * Return value: %FALSE if there are no more users.
+ **/
+gboolean
+lightdm_user_list_iter_next (LightDMUserListIter *iter, const LightDMUserInfo **info)
+{
+    g_return_val_if_fail (iter != NULL, FALSE);
+
+    GArray *table = iter->table;
+    if (!table || iter->index >= table->len)
+        return FALSE;
+
+    if (info)
+        *info = &g_array_index (table, LightDMUserInfo, iter->index);
+    iter->index++;
+
+    return TRUE;
+}
+
 static void
 lightdm_user_list_init (LightDMUserList *user_list)
 {
+    LightDMUserListPrivate *priv = GET_LIST_PRIVATE (user_list);
+    priv->wrappers = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) wrapper_free);
+    priv->removed_wrappers = g_ptr_array_new_with_free_func ((GDestroyNotify) wrapper_free);
 }
 
 static void
@@ -312,6 +632,9 @@ lightdm_user_list_finalize (GObject *object)
     LightDMUserListPrivate *priv = GET_LIST_PRIVATE (self);
 
     g_list_free_full (priv->lightdm_list, g_object_unref);
+    g_clear_pointer (&priv->wrappers, g_hash_table_unref);
+    g_clear_pointer (&priv->removed_wrappers, g_ptr_array_unref);
+    g_clear_pointer (&priv->user_table, g_array_unref);
 
     G_OBJECT_CLASS (lightdm_user_list_parent_class)->finalize (object);
 }
@@ -395,6 +718,77 @@ lightdm_user_list_class_init (LightDMUserListClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 1, LIGHTDM_TYPE_USER);
+
+    /**
+     * LightDMUserList::users-loaded:
+     * @user_list: A #LightDMUserList
+     *
+     * The ::users-loaded signal gets emitted when loading started with
+     * lightdm_user_list_load_async() has completed.
+     **/
+    list_signals[USERS_LOADED] =
+        g_signal_new (LIGHTDM_USER_LIST_SIGNAL_USERS_LOADED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMUserListClass, users_loaded),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+
+    /**
+     * LightDMUserList::users-added:
+     * @user_list: A #LightDMUserList
+     * @users: (element-type LightDMUser): The #LightDMUser objects that have been added.
+     *
+     * The ::users-added signal gets emitted once the main loop is idle with all
+     * the users reported by #LightDMUserList::user-added since the last batch.
+     * Listening to these instead of the signals for each user allows a large
+     * change such as a directory sync to be handled at once. Batches of
+     * different kinds are emitted in the order the changes happened.
+     **/
+    list_signals[USERS_ADDED] =
+        g_signal_new (LIGHTDM_USER_LIST_SIGNAL_USERS_ADDED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMUserListClass, users_added),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
+
+    /**
+     * LightDMUserList::users-changed:
+     * @user_list: A #LightDMUserList
+     * @users: (element-type LightDMUser): The #LightDMUser objects that have been changed.
+     *
+     * The ::users-changed signal gets emitted once the main loop is idle with
+     * the users reported by #LightDMUserList::user-changed since the last
+     * batch, each user appearing only once.
+     **/
+    list_signals[USERS_CHANGED] =
+        g_signal_new (LIGHTDM_USER_LIST_SIGNAL_USERS_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMUserListClass, users_changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
+
+    /**
+     * LightDMUserList::users-removed:
+     * @user_list: A #LightDMUserList
+     * @users: (element-type LightDMUser): The #LightDMUser objects that have been removed.
+     *
+     * The ::users-removed signal gets emitted once the main loop is idle with
+     * the users reported by #LightDMUserList::user-removed since the last batch.
+     **/
+    list_signals[USERS_REMOVED] =
+        g_signal_new (LIGHTDM_USER_LIST_SIGNAL_USERS_REMOVED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMUserListClass, users_removed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, G_TYPE_PTR_ARRAY);
 }
 
 /**
@@ -487,6 +881,60 @@ lightdm_user_get_background (LightDMUser *user)
     return common_user_get_background (GET_USER_PRIVATE (user)->common_user);
 }
 
+/* Find the daemon's copy of an image, which greeters can read even if the user's home directory is private */
+static const gchar *
+get_cached_image (LightDMUser *user, const gchar *source, const gchar *kind, gchar **path)
+{
+    g_clear_pointer (path, g_free);
+
+    const gchar *cache_dir = g_getenv ("LIGHTDM_IMAGE_CACHE");
+    if (!source || !cache_dir)
+        return NULL;
+
+    g_autofree gchar *name = g_strdup_printf ("%s-%s", lightdm_user_get_name (user), kind);
+    g_autofree gchar *cached_path = g_build_filename (cache_dir, name, NULL);
+    if (g_file_test (cached_path, G_FILE_TEST_IS_REGULAR))
+        *path = g_steal_pointer (&cached_path);
+
+    return *path;
+}
+
+/**
+ * lightdm_user_get_cached_image:
+ * @user: A #LightDMUser
+ *
+ * Get the path of a copy of the user's image kept by the daemon. Unlike the
+ * path from lightdm_user_get_image() this can be read by the greeter even when
+ * the user's home directory is not accessible.
+ *
+ * Return value: (nullable): The cached image path for the given user or #NULL if no image is cached
+ **/
+const gchar *
+lightdm_user_get_cached_image (LightDMUser *user)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER (user), NULL);
+    LightDMUserPrivate *priv = GET_USER_PRIVATE (user);
+    return get_cached_image (user, common_user_get_image (priv->common_user), "image", &priv->cached_image);
+}
+
+/**
+ * lightdm_user_get_cached_background:
+ * @user: A #LightDMUser
+ *
+ * Get the path of a copy of the user's background kept by the daemon. Unlike
+ * the path from lightdm_user_get_background() this can be read by the greeter
+ * even when the user's home directory is not accessible.
+ *
+ * Return value: (nullable): The cached background path for the given user or #NULL if no background is cached
+ **/
+const gchar *
+lightdm_user_get_cached_background (LightDMUser *user)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER (user), NULL);
+    LightDMUserPrivate *priv = GET_USER_PRIVATE (user);
+    return get_cached_image (user, common_user_get_background (priv->common_user), "background", &priv->cached_background);
+}
+
 /**
  * lightdm_user_get_language:
  * @user: A #LightDMUser
@@ -660,6 +1108,12 @@ lightdm_user_get_property (GObject    *object,
     case USER_PROP_BACKGROUND:
         g_value_set_string (value, lightdm_user_get_background (self));
         break;
+    case USER_PROP_CACHED_IMAGE:
+        g_value_set_string (value, lightdm_user_get_cached_image (self));
+        break;
+    case USER_PROP_CACHED_BACKGROUND:
+        g_value_set_string (value, lightdm_user_get_cached_background (self));
+        break;
     case USER_PROP_LANGUAGE:
         g_value_set_string (value, lightdm_user_get_language (self));
         break;
@@ -696,6 +1150,8 @@ lightdm_user_finalize (GObject *object)
     LightDMUserPrivate *priv = GET_USER_PRIVATE (self);
 
     g_object_unref (priv->common_user);
+    g_free (priv->cached_image);
+    g_free (priv->cached_background);
 
     G_OBJECT_CLASS (lightdm_user_parent_class)->finalize (object);
 }
@@ -758,6 +1214,20 @@ lightdm_user_class_init (LightDMUserClass *klass)
                                                           "User background",
                                                           NULL,
                                                           G_PARAM_READABLE));
+    g_object_class_install_property (object_class,
+                                     USER_PROP_CACHED_IMAGE,
+                                     g_param_spec_string ("cached-image",
+                                                          "cached-image",
+                                                          "Copy of the avatar image readable by greeters",
+                                                          NULL,
+                                                          G_PARAM_READABLE));
+    g_object_class_install_property (object_class,
+                                     USER_PROP_CACHED_BACKGROUND,
+                                     g_param_spec_string ("cached-background",
+                                                          "cached-background",
+                                                          "Copy of the user background readable by greeters",
+                                                          NULL,
+                                                          G_PARAM_READABLE));
     g_object_class_install_property (object_class,
                                      USER_PROP_LANGUAGE,
                                      g_param_spec_string ("language",
@@ -26,9 +26,16 @@ class Q_DECL_EXPORT Greeter : public QObject
 
     Q_PROPERTY(bool authenticated READ isAuthenticated ) //NOTFIY authenticationComplete
     Q_PROPERTY(QString authenticationUser READ authenticationUser )
-    Q_PROPERTY(QString defaultSession READ defaultSessionHint CONSTANT)
-    Q_PROPERTY(QString selectUser READ selectUserHint CONSTANT)
-    Q_PROPERTY(bool selectGuest READ selectGuestHint CONSTANT)
+    Q_PROPERTY(QString defaultSession READ defaultSessionHint NOTIFY hintsChanged)
+    Q_PROPERTY(QString selectUser READ selectUserHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool selectGuest READ selectGuestHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool hideUsers READ hideUsersHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool showManualLogin READ showManualLoginHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool showRemoteLogin READ showRemoteLoginHint NOTIFY hintsChanged)
+    Q_PROPERTY(QString autologinUser READ autologinUserHint NOTIFY hintsChanged)
+    Q_PROPERTY(QString autologinSession READ autologinSessionHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool autologinGuest READ autologinGuestHint NOTIFY hintsChanged)
+    Q_PROPERTY(int autologinTimeout READ autologinTimeoutHint NOTIFY hintsChanged)
 
     Q_PROPERTY(QString hostname READ hostname CONSTANT)
     Q_PROPERTY(QString osId READ osId CONSTANT)
@@ -37,8 +44,10 @@ class Q_DECL_EXPORT Greeter : public QObject
     Q_PROPERTY(QString osVersion READ osVersion CONSTANT)
     Q_PROPERTY(QString osVersionId READ osVersionId CONSTANT)
     Q_PROPERTY(QString motd READ motd CONSTANT)
-    Q_PROPERTY(bool hasGuestAccount READ hasGuestAccountHint CONSTANT)
-    Q_PROPERTY(bool locked READ lockHint CONSTANT)
+    Q_PROPERTY(bool hasGuestAccount READ hasGuestAccountHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool locked READ lockHint NOTIFY hintsChanged)
+    Q_PROPERTY(bool coalesceMessages READ coalesceMessages WRITE setCoalesceMessages)
+    Q_PROPERTY(QVariantList conversation READ conversation NOTIFY conversationChanged)
 
     Q_ENUMS(PromptType MessageType)
 
@@ -81,6 +90,13 @@ public:
     QString osVersionId() const;
     QString motd() const;
 
+    // When coalescing, prompts and messages are not emitted individually but
+    // collected once per main loop iteration into conversation(), a list of
+    // maps with "prompt" (bool), "text" and "type" entries.
+    bool coalesceMessages() const;
+    void setCoalesceMessages(bool coalesce);
+    QVariantList conversation() const;
+
 public Q_SLOTS:
     bool connectToDaemonSync();
     bool connectSync();
@@ -103,10 +119,13 @@ Q_SIGNALS:
     void autologinTimerExpired();
     void idle();
     void reset();
+    void conversationChanged();
+    void hintsChanged();
 
 private:
     GreeterPrivate *d_ptr;
     Q_DECLARE_PRIVATE(Greeter)
+    Q_PRIVATE_SLOT(d_func(), void _q_processEvents())
 
 };
 }
@@ -45,12 +45,29 @@ public:
     int rowCount(const QModelIndex &parent) const;
     QVariant data(const QModelIndex &index, int role) const;
 
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
+    void setSearchPrefix(const QString &prefix);
+    QString searchPrefix() const;
+
+    void setPageSize(int size);
+    int pageSize() const;
+
+    void setAvatarSize(int size);
+    int avatarSize() const;
+
+    void setImageCacheLimit(int kilobytes);
+    int imageCacheLimit() const;
+
 protected:
 
 private:
     UsersModelPrivate * const d_ptr;
 
     Q_DECLARE_PRIVATE(UsersModel)
+    Q_PRIVATE_SLOT(d_func(), void _q_flushChanges())
+    Q_PRIVATE_SLOT(d_func(), void _q_imageLoaded(const QString &, const QImage &))
 
 };
 
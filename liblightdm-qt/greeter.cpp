@@ -16,6 +16,9 @@
 #include <QtCore/QDir>
 #include <QtCore/QVariant>
 #include <QtCore/QSettings>
+#include <QtCore/QList>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QTimer>
 
 #include <lightdm.h>
 
@@ -25,7 +28,32 @@ class QLightDM::GreeterPrivate
 {
 public:
     GreeterPrivate(Greeter *parent);
+    ~GreeterPrivate();
     LightDMGreeter *ldmGreeter;
+
+    // The greeter runs in its own context, driven from the Qt event loop so
+    // the GLib event dispatcher isn't needed
+    GMainContext *context;
+    QSocketNotifier *notifier;
+    QTimer *eventTimer;
+
+    // Prompts and messages received since the last flush, converted when flushed
+    struct PendingItem {
+        bool isPrompt;
+        int type;
+        QByteArray text;
+    };
+    bool coalesce;
+    GSource *flushSource;
+    QList<PendingItem> pending;
+    QVariantList conversation;
+
+    void queue(bool isPrompt, int type, const gchar *text);
+    void flush();
+    void clearConversation();
+    void watchDaemon();
+    void scheduleEvents();
+    void _q_processEvents();
 protected:
     Greeter* q_ptr;
 
@@ -35,18 +63,30 @@ protected:
     static void cb_autoLoginExpired(LightDMGreeter *greeter, gpointer data);
     static void cb_idle(LightDMGreeter *greeter, gpointer data);
     static void cb_reset(LightDMGreeter *greeter, gpointer data);
+    static void cb_notify(GObject *object, GParamSpec *pspec, gpointer data);
+    static gboolean cb_flush(gpointer data);
 
 private:
     Q_DECLARE_PUBLIC(Greeter)
 };
 
 GreeterPrivate::GreeterPrivate(Greeter *parent) :
+    notifier(0),
+    coalesce(false),
+    flushSource(0),
     q_ptr(parent)
 {
 #if !defined(GLIB_VERSION_2_36)
     g_type_init();
 #endif
+    context = g_main_context_new();
+    g_main_context_push_thread_default(context);
     ldmGreeter = lightdm_greeter_new();
+    g_main_context_pop_thread_default(context);
+
+    eventTimer = new QTimer(parent);
+    eventTimer->setSingleShot(true);
+    QObject::connect(eventTimer, SIGNAL(timeout()), parent, SLOT(_q_processEvents()));
 
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_SHOW_PROMPT, G_CALLBACK (cb_showPrompt), this);
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_SHOW_MESSAGE, G_CALLBACK (cb_showMessage), this);
@@ -54,6 +94,119 @@ GreeterPrivate::GreeterPrivate(Greeter *parent) :
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_AUTOLOGIN_TIMER_EXPIRED, G_CALLBACK (cb_autoLoginExpired), this);
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_IDLE, G_CALLBACK (cb_idle), this);
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_RESET, G_CALLBACK (cb_reset), this);
+    g_signal_connect (ldmGreeter, "notify", G_CALLBACK (cb_notify), this);
+}
+
+GreeterPrivate::~GreeterPrivate()
+{
+    if (flushSource)
+    {
+        g_source_destroy(flushSource);
+        g_source_unref(flushSource);
+    }
+    g_main_context_unref(context);
+}
+
+void GreeterPrivate::watchDaemon()
+{
+    Q_Q(Greeter);
+
+    int fd = lightdm_greeter_get_fd(ldmGreeter);
+    if (notifier || fd < 0)
+        return;
+
+    notifier = new QSocketNotifier(fd, QSocketNotifier::Read, q);
+    QObject::connect(notifier, SIGNAL(activated(int)), q, SLOT(_q_processEvents()));
+}
+
+// Library calls can queue work without the daemon sending anything
+void GreeterPrivate::scheduleEvents()
+{
+    eventTimer->start(0);
+}
+
+void GreeterPrivate::_q_processEvents()
+{
+    int timeout = lightdm_greeter_process_events(ldmGreeter);
+    if (timeout < 0)
+        eventTimer->stop();
+    else
+        eventTimer->start(timeout);
+
+    // Stop watching once the connection has failed, the socket stays readable
+    if (notifier && lightdm_greeter_get_fd(ldmGreeter) < 0)
+        notifier->setEnabled(false);
+}
+
+void GreeterPrivate::queue(bool isPrompt, int type, const gchar *text)
+{
+    PendingItem item;
+    item.isPrompt = isPrompt;
+    item.type = type;
+    item.text = QByteArray(text);
+    pending.append(item);
+
+    // Everything that arrives before the main loop runs again goes in one update
+    if (!flushSource)
+    {
+        flushSource = g_idle_source_new();
+        g_source_set_callback(flushSource, cb_flush, this, NULL);
+        g_source_attach(flushSource, context);
+        scheduleEvents();
+    }
+}
+
+void GreeterPrivate::flush()
+{
+    Q_Q(Greeter);
+
+    if (flushSource)
+    {
+        g_source_destroy(flushSource);
+        g_source_unref(flushSource);
+        flushSource = 0;
+    }
+    if (pending.isEmpty())
+        return;
+
+    Q_FOREACH (const PendingItem &item, pending)
+    {
+        QVariantMap entry;
+        entry[QStringLiteral("prompt")] = item.isPrompt;
+        entry[QStringLiteral("text")] = QString::fromUtf8(item.text);
+        entry[QStringLiteral("type")] = item.type;
+        conversation.append(entry);
+    }
+    pending.clear();
+
+    Q_EMIT q->conversationChanged();
+}
+
+void GreeterPrivate::clearConversation()
+{
+    Q_Q(Greeter);
+
+    if (flushSource)
+    {
+        g_source_destroy(flushSource);
+        g_source_unref(flushSource);
+        flushSource = 0;
+    }
+    pending.clear();
+    if (conversation.isEmpty())
+        return;
+
+    conversation.clear();
+    Q_EMIT q->conversationChanged();
+}
+
+gboolean GreeterPrivate::cb_flush(gpointer data)
+{
+    GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    g_source_unref(that->flushSource);
+    that->flushSource = 0;
+    that->flush();
+    return G_SOURCE_REMOVE;
 }
 
 void GreeterPrivate::cb_showPrompt(LightDMGreeter *greeter, const gchar *text, LightDMPromptType type, gpointer data)
@@ -61,6 +214,12 @@ void GreeterPrivate::cb_showPrompt(LightDMGreeter *greeter, const gchar *text, L
     Q_UNUSED(greeter);
 
     GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    if (that->coalesce)
+    {
+        that->queue(true, type == LIGHTDM_PROMPT_TYPE_QUESTION ? Greeter::PromptTypeQuestion : Greeter::PromptTypeSecret, text);
+        return;
+    }
+
     QString message = QString::fromUtf8(text);
 
     Q_EMIT that->q_func()->showPrompt(message, type == LIGHTDM_PROMPT_TYPE_QUESTION ?
@@ -72,6 +231,12 @@ void GreeterPrivate::cb_showMessage(LightDMGreeter *greeter, const gchar *text,
     Q_UNUSED(greeter);
 
     GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    if (that->coalesce)
+    {
+        that->queue(false, type == LIGHTDM_MESSAGE_TYPE_INFO ? Greeter::MessageTypeInfo : Greeter::MessageTypeError, text);
+        return;
+    }
+
     QString message = QString::fromUtf8(text);
 
     Q_EMIT that->q_func()->showMessage(message, type == LIGHTDM_MESSAGE_TYPE_INFO ?
@@ -82,9 +247,20 @@ void GreeterPrivate::cb_authenticationComplete(LightDMGreeter *greeter, gpointer
 {
     Q_UNUSED(greeter);
     GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    // Deliver any messages from the PAM conversation before the result
+    that->flush();
     Q_EMIT that->q_func()->authenticationComplete();
 }
 
+void GreeterPrivate::cb_notify(GObject *object, GParamSpec *pspec, gpointer data)
+{
+    Q_UNUSED(object);
+    GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    // The hint properties are only notified when the daemon changes their values
+    if (g_str_has_suffix(pspec->name, "-hint"))
+        Q_EMIT that->q_func()->hintsChanged();
+}
+
 void GreeterPrivate::cb_autoLoginExpired(LightDMGreeter *greeter, gpointer data)
 {
     Q_UNUSED(greeter);
@@ -103,6 +279,7 @@ void GreeterPrivate::cb_reset(LightDMGreeter *greeter, gpointer data)
 {
     Q_UNUSED(greeter);
     GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    that->clearConversation();
     Q_EMIT that->q_func()->reset();
 }
 
@@ -121,55 +298,90 @@ Greeter::~Greeter()
 bool Greeter::connectToDaemonSync()
 {
     Q_D(Greeter);
-    return lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    bool result = lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    d->watchDaemon();
+    d->scheduleEvents();
+    return result;
 }
 
 bool Greeter::connectSync()
 {
-    Q_D(Greeter);
-    return lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    return connectToDaemonSync();
 }
 
 void Greeter::authenticate(const QString &username)
 {
     Q_D(Greeter);
+    d->clearConversation();
     lightdm_greeter_authenticate(d->ldmGreeter, username.toLocal8Bit().data(), NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::authenticateAsGuest()
 {
     Q_D(Greeter);
+    d->clearConversation();
     lightdm_greeter_authenticate_as_guest(d->ldmGreeter, NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::authenticateAutologin()
 {
     Q_D(Greeter);
+    d->clearConversation();
     lightdm_greeter_authenticate_autologin(d->ldmGreeter, NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::authenticateRemote(const QString &session, const QString &username)
 {
     Q_D(Greeter);
+    d->clearConversation();
     lightdm_greeter_authenticate_remote(d->ldmGreeter, session.toLocal8Bit().data(), username.toLocal8Bit().data(), NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::respond(const QString &response)
 {
     Q_D(Greeter);
     lightdm_greeter_respond(d->ldmGreeter, response.toLocal8Bit().data(), NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::cancelAuthentication()
 {
     Q_D(Greeter);
     lightdm_greeter_cancel_authentication(d->ldmGreeter, NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::cancelAutologin()
 {
     Q_D(Greeter);
     lightdm_greeter_cancel_autologin(d->ldmGreeter);
+    d->scheduleEvents();
+}
+
+void Greeter::setCoalesceMessages(bool coalesce)
+{
+    Q_D(Greeter);
+    if (d->coalesce == coalesce)
+        return;
+
+    d->flush();
+    d->coalesce = coalesce;
+}
+
+bool Greeter::coalesceMessages() const
+{
+    Q_D(const Greeter);
+    return d->coalesce;
+}
+
+QVariantList Greeter::conversation() const
+{
+    Q_D(const Greeter);
+    return d->conversation;
 }
 
 bool Greeter::inAuthentication() const
@@ -194,6 +406,7 @@ void Greeter::setLanguage (const QString &language)
 {
     Q_D(Greeter);
     lightdm_greeter_set_language(d->ldmGreeter, language.toLocal8Bit().constData(), NULL);
+    d->scheduleEvents();
 }
 
 void Greeter::setResettable (bool resettable)
@@ -205,13 +418,17 @@ void Greeter::setResettable (bool resettable)
 bool Greeter::startSessionSync(const QString &session)
 {
     Q_D(Greeter);
-    return lightdm_greeter_start_session_sync(d->ldmGreeter, session.toLocal8Bit().constData(), NULL);
+    bool result = lightdm_greeter_start_session_sync(d->ldmGreeter, session.toLocal8Bit().constData(), NULL);
+    d->scheduleEvents();
+    return result;
 }
 
 QString Greeter::ensureSharedDataDirSync(const QString &username)
 {
     Q_D(Greeter);
-    return QString::fromUtf8(lightdm_greeter_ensure_shared_data_dir_sync(d->ldmGreeter, username.toLocal8Bit().constData(), NULL));
+    QString dir = QString::fromUtf8(lightdm_greeter_ensure_shared_data_dir_sync(d->ldmGreeter, username.toLocal8Bit().constData(), NULL));
+    d->scheduleEvents();
+    return dir;
 }
 
 
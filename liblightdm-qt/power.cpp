@@ -19,17 +19,40 @@ using namespace QLightDM;
 class PowerInterface::PowerInterfacePrivate
 {
 public:
-    PowerInterfacePrivate();
+    PowerInterfacePrivate(PowerInterface *parent);
+    ~PowerInterfacePrivate();
+
+    PowerInterface * const q;
+
+    static void cb_changed(LightDMPowerCapabilities *power_capabilities, gpointer data);
 };
 
-PowerInterface::PowerInterfacePrivate::PowerInterfacePrivate()
+PowerInterface::PowerInterfacePrivate::PowerInterfacePrivate(PowerInterface *parent) :
+    q(parent)
+{
+#if !defined(GLIB_VERSION_2_36)
+    g_type_init();
+#endif
+    /* Start checking the capabilities in the background */
+    g_signal_connect(lightdm_power_capabilities_get_instance(), LIGHTDM_POWER_CAPABILITIES_SIGNAL_CHANGED, G_CALLBACK (cb_changed), this);
+}
+
+PowerInterface::PowerInterfacePrivate::~PowerInterfacePrivate()
+{
+    g_signal_handlers_disconnect_by_data(lightdm_power_capabilities_get_instance(), this);
+}
+
+void PowerInterface::PowerInterfacePrivate::cb_changed(LightDMPowerCapabilities *power_capabilities, gpointer data)
 {
+    Q_UNUSED(power_capabilities)
+    PowerInterfacePrivate *that = static_cast<PowerInterfacePrivate*>(data);
+    Q_EMIT that->q->capabilitiesChanged();
 }
 
 
 PowerInterface::PowerInterface(QObject *parent)
     : QObject(parent),
-      d(new PowerInterfacePrivate)
+      d(new PowerInterfacePrivate(this))
 {
 }
 
@@ -40,7 +63,7 @@ PowerInterface::~PowerInterface()
 
 bool PowerInterface::canSuspend()
 {
-    return lightdm_get_can_suspend ();
+    return lightdm_power_capabilities_get_can_suspend (lightdm_power_capabilities_get_instance ());
 }
 
 bool PowerInterface::suspend()
@@ -50,7 +73,7 @@ bool PowerInterface::suspend()
 
 bool PowerInterface::canHibernate()
 {
-    return lightdm_get_can_hibernate ();
+    return lightdm_power_capabilities_get_can_hibernate (lightdm_power_capabilities_get_instance ());
 }
 
 bool PowerInterface::hibernate()
@@ -60,7 +83,7 @@ bool PowerInterface::hibernate()
 
 bool PowerInterface::canShutdown()
 {
-    return lightdm_get_can_shutdown ();
+    return lightdm_power_capabilities_get_can_shutdown (lightdm_power_capabilities_get_instance ());
 }
 
 bool PowerInterface::shutdown()
@@ -70,7 +93,7 @@ bool PowerInterface::shutdown()
 
 bool PowerInterface::canRestart()
 {
-    return lightdm_get_can_restart ();
+    return lightdm_power_capabilities_get_can_restart (lightdm_power_capabilities_get_instance ());
 }
 
 bool PowerInterface::restart()
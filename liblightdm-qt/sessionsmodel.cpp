@@ -20,6 +20,7 @@ using namespace QLightDM;
 class SessionItem
 {
 public:
+    LightDMSession *ldmSession;
     QString key;
     QString type;
     QString name;
@@ -31,19 +32,31 @@ class SessionsModelPrivate
 {
 public:
     SessionsModelPrivate(SessionsModel *parent);
+    ~SessionsModelPrivate();
     QList<SessionItem> items;
+    SessionsModel::SessionType sessionType;
+    LightDMSessionList *ldmSessionList;
 
     void loadSessions(SessionsModel::SessionType sessionType);
 
+    static void cb_sessionAdded(LightDMSessionList *sessionList, LightDMSession *ldmSession, gpointer data);
+    static void cb_sessionRemoved(LightDMSessionList *sessionList, LightDMSession *ldmSession, gpointer data);
+
 protected:
     SessionsModel* q_ptr;
 
+private:
+    GList *ldmSessions() const;
+    static SessionItem makeItem(LightDMSession *ldmSession);
+
 private:
     Q_DECLARE_PUBLIC(SessionsModel)
 
 };
 
 SessionsModelPrivate::SessionsModelPrivate(SessionsModel *parent) :
+    sessionType(SessionsModel::LocalSessions),
+    ldmSessionList(0),
     q_ptr(parent)
 {
 #if !defined(GLIB_VERSION_2_36)
@@ -51,35 +64,85 @@ SessionsModelPrivate::SessionsModelPrivate(SessionsModel *parent) :
 #endif
 }
 
-void SessionsModelPrivate::loadSessions(SessionsModel::SessionType sessionType)
+SessionsModelPrivate::~SessionsModelPrivate()
 {
-    GList *ldmSessions;
+    if (ldmSessionList)
+        g_signal_handlers_disconnect_by_data(ldmSessionList, this);
+}
 
+GList *SessionsModelPrivate::ldmSessions() const
+{
     switch (sessionType) {
     case SessionsModel::RemoteSessions:
-        ldmSessions = lightdm_get_remote_sessions();
-        break;
+        return lightdm_get_remote_sessions();
     case SessionsModel::LocalSessions:
         /* Fall through*/
     default:
-        ldmSessions = lightdm_get_sessions();
-        break;
+        return lightdm_get_sessions();
     }
+}
 
-    for (GList* item = ldmSessions; item; item = item->next) {
+SessionItem SessionsModelPrivate::makeItem(LightDMSession *ldmSession)
+{
+    SessionItem session;
+    session.ldmSession = ldmSession;
+    session.key = QString::fromUtf8(lightdm_session_get_key(ldmSession));
+    session.type = QString::fromUtf8(lightdm_session_get_session_type(ldmSession));
+    session.name = QString::fromUtf8(lightdm_session_get_name(ldmSession));
+    session.comment = QString::fromUtf8(lightdm_session_get_comment(ldmSession));
+    return session;
+}
+
+void SessionsModelPrivate::loadSessions(SessionsModel::SessionType sessionType)
+{
+    this->sessionType = sessionType;
+
+    for (GList* item = ldmSessions(); item; item = item->next) {
        LightDMSession *ldmSession = static_cast<LightDMSession*>(item->data);
        Q_ASSERT(ldmSession);
 
-       SessionItem session;
-       session.key = QString::fromUtf8(lightdm_session_get_key(ldmSession));
-       session.type = QString::fromUtf8(lightdm_session_get_session_type(ldmSession));
-       session.name = QString::fromUtf8(lightdm_session_get_name(ldmSession));
-       session.comment = QString::fromUtf8(lightdm_session_get_comment(ldmSession));
-
-       items.append(session);
+       items.append(makeItem(ldmSession));
    }
 
    //this happens in the constructor so we don't need beginInsertRows() etc.
+
+   // Follow sessions being installed and removed
+   ldmSessionList = lightdm_session_list_get_instance();
+   g_signal_connect(ldmSessionList, LIGHTDM_SESSION_LIST_SIGNAL_SESSION_ADDED, G_CALLBACK (cb_sessionAdded), this);
+   g_signal_connect(ldmSessionList, LIGHTDM_SESSION_LIST_SIGNAL_SESSION_REMOVED, G_CALLBACK (cb_sessionRemoved), this);
+}
+
+void SessionsModelPrivate::cb_sessionAdded(LightDMSessionList *sessionList, LightDMSession *ldmSession, gpointer data)
+{
+    Q_UNUSED(sessionList);
+
+    SessionsModelPrivate *that = static_cast<SessionsModelPrivate*>(data);
+
+    // The lists are already updated, so the position in them is the row
+    int row = g_list_index(that->ldmSessions(), ldmSession);
+    if (row < 0)
+        return;
+
+    that->q_func()->beginInsertRows(QModelIndex(), row, row);
+    that->items.insert(row, makeItem(ldmSession));
+    that->q_func()->endInsertRows();
+}
+
+void SessionsModelPrivate::cb_sessionRemoved(LightDMSessionList *sessionList, LightDMSession *ldmSession, gpointer data)
+{
+    Q_UNUSED(sessionList);
+
+    SessionsModelPrivate *that = static_cast<SessionsModelPrivate*>(data);
+
+    for (int row = 0; row < that->items.size(); row++) {
+        if (that->items[row].ldmSession != ldmSession)
+            continue;
+
+        that->q_func()->beginRemoveRows(QModelIndex(), row, row);
+        that->items.removeAt(row);
+        that->q_func()->endRemoveRows();
+        return;
+    }
 }
 
 
@@ -12,7 +12,16 @@
 
 #include <QtCore/QString>
 #include <QtCore/QDebug>
+#include <QtCore/QHash>
+#include <QtCore/QCache>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
 #include <QtGui/QIcon>
+#include <QtGui/QImage>
+#include <QtGui/QImageReader>
+#include <QtGui/QPixmap>
+
+#include <algorithm>
 
 #include <lightdm.h>
 
@@ -21,28 +30,104 @@ using namespace QLightDM;
 class UserItem
 {
 public:
-    QString name;
-    QString realName;
-    QString homeDirectory;
-    QString image;
-    QString background;
-    QString session;
-    bool isLoggedIn;
-    bool hasMessages;
-    quint64 uid;
+    UserItem(LightDMUser *user);
+
+    /* Owned by the LightDMUserList, which tells us before dropping it */
+    LightDMUser *ldmUser;
+
+    /* Text fields are converted when first used and again after a change */
+    const QString &name() const;
+    const QString &realName() const;
+    const QString &homeDirectory() const;
+    const QString &image() const;
+    const QString &background() const;
+    const QString &session() const;
     QString displayName() const;
-    bool isLocked;
+    void invalidate();
+
+private:
+    void load() const;
+    mutable bool loaded;
+    mutable QString m_name;
+    mutable QString m_realName;
+    mutable QString m_homeDirectory;
+    mutable QString m_image;
+    mutable QString m_background;
+    mutable QString m_session;
 };
 
+UserItem::UserItem(LightDMUser *user) :
+    ldmUser(user),
+    loaded(false)
+{
+}
+
+void UserItem::load() const
+{
+    if (loaded) {
+        return;
+    }
+
+    m_name = QString::fromUtf8(lightdm_user_get_name(ldmUser));
+    m_homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
+    m_realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
+    m_image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
+    m_background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
+    m_session = QString::fromUtf8(lightdm_user_get_session(ldmUser));
+    loaded = true;
+}
+
+void UserItem::invalidate()
+{
+    loaded = false;
+}
+
+const QString &UserItem::name() const { load(); return m_name; }
+const QString &UserItem::realName() const { load(); return m_realName; }
+const QString &UserItem::homeDirectory() const { load(); return m_homeDirectory; }
+const QString &UserItem::image() const { load(); return m_image; }
+const QString &UserItem::background() const { load(); return m_background; }
+const QString &UserItem::session() const { load(); return m_session; }
+
 QString UserItem::displayName() const {
-    if (realName.isEmpty()){
-        return name;
+    if (realName().isEmpty()){
+        return name();
     }
     else {
-        return realName;
+        return realName();
     }
 }
 
+/* Decodes an image file off the GUI thread and hands it back to the model */
+class ImageLoadJob : public QRunnable
+{
+public:
+    ImageLoadJob(UsersModel *model, const QString &key, const QString &path, int size) :
+        model(model), key(key), path(path), size(size) {}
+
+    void run();
+
+private:
+    UsersModel *model;
+    QString key;
+    QString path;
+    int size;
+};
+
+void ImageLoadJob::run()
+{
+    QImageReader reader(path);
+    if (size > 0) {
+        QSize imageSize = reader.size();
+        if (imageSize.isValid() && (imageSize.width() > size || imageSize.height() > size)) {
+            reader.setScaledSize(imageSize.scaled(size, size, Qt::KeepAspectRatio));
+        }
+    }
+    QImage image = reader.read();
+
+    QMetaObject::invokeMethod(model, "_q_imageLoaded", Qt::QueuedConnection, Q_ARG(QString, key), Q_ARG(QImage, image));
+}
+
 namespace QLightDM {
 class UsersModelPrivate {
 public:
@@ -50,22 +135,67 @@ public:
     virtual ~UsersModelPrivate();
     QList<UserItem> users;
 
+    /* Row of each user, so change signals don't need to search the list */
+    QHash<LightDMUser*, int> rows;
+
+    /* Users are only read when the model is first used, so a search can be
+     * set up before the full list is ever loaded */
+    bool loaded;
+
+    /* Only users matching the prefix are shown, pageSize at a time */
+    QString searchPrefix;
+    int pageSize;
+    bool moreAvailable;
+
+    bool paged() const { return pageSize > 0 || !searchPrefix.isEmpty(); }
+    bool matches(LightDMUser *ldmUser) const;
+    void ensureLoaded();
+    void fetchUsers(int limit, bool notify);
+    void reload(int limit);
+
+    /* Range of rows changed since the last dataChanged */
+    int firstChangedRow;
+    int lastChangedRow;
+    bool flushQueued;
+
+    void _q_flushChanges();
+
+    /* Decoded avatars and backgrounds, with the cost in kilobytes */
+    mutable QCache<QString, QPixmap> images;
+    mutable QHash<QString, QList<LightDMUser*> > pendingImages;
+    mutable QThreadPool imageLoaders;
+    int avatarSize;
+
+    const QPixmap *lookupImage(const UserItem &user, const QString &path, int size) const;
+    void dropImages(const UserItem &user);
+    void _q_imageLoaded(const QString &key, const QImage &image);
+
     protected:
         UsersModel * const q_ptr;
 
         void loadUsers();
+        void queueChange(int row);
 
-        static void cb_userAdded(LightDMUserList *user_list, LightDMUser *user, gpointer data);
-        static void cb_userChanged(LightDMUserList *user_list, LightDMUser *user, gpointer data);
-        static void cb_userRemoved(LightDMUserList *user_list, LightDMUser *user, gpointer data);
+        static void cb_usersAdded(LightDMUserList *user_list, GPtrArray *users, gpointer data);
+        static void cb_usersChanged(LightDMUserList *user_list, GPtrArray *users, gpointer data);
+        static void cb_usersRemoved(LightDMUserList *user_list, GPtrArray *users, gpointer data);
     private:
         Q_DECLARE_PUBLIC(UsersModel)
 };
 }
 
 UsersModelPrivate::UsersModelPrivate(UsersModel* parent) :
+    loaded(false),
+    pageSize(0),
+    moreAvailable(false),
+    firstChangedRow(-1),
+    lastChangedRow(-1),
+    flushQueued(false),
+    images(16 * 1024),
+    avatarSize(0),
     q_ptr(parent)
 {
+    imageLoaders.setMaxThreadCount(2);
 #if !defined(GLIB_VERSION_2_36)
     g_type_init();
 #endif
@@ -76,108 +206,302 @@ UsersModelPrivate::~UsersModelPrivate()
     g_signal_handlers_disconnect_by_data(lightdm_user_list_get_instance(), this);
 }
 
+/* Round up to a power of two so similar sizes share a cache entry */
+static int sizeBucket(int size)
+{
+    if (size <= 0) {
+        return 0;
+    }
+    int bucket = 16;
+    while (bucket < size) {
+        bucket *= 2;
+    }
+    return bucket;
+}
+
+static QString imageKey(const QString &path, int size)
+{
+    return QString::number(size) + QLatin1Char(':') + path;
+}
+
+/* Returns the decoded image, or NULL and starts decoding it in the background */
+const QPixmap *UsersModelPrivate::lookupImage(const UserItem &user, const QString &path, int size) const
+{
+    if (path.isEmpty()) {
+        return 0;
+    }
+
+    QString key = imageKey(path, size);
+    const QPixmap *pixmap = images.object(key);
+    if (pixmap) {
+        return pixmap;
+    }
+
+    QHash<QString, QList<LightDMUser*> >::iterator pending = pendingImages.find(key);
+    if (pending != pendingImages.end()) {
+        if (!pending.value().contains(user.ldmUser)) {
+            pending.value().append(user.ldmUser);
+        }
+        return 0;
+    }
+
+    pendingImages[key].append(user.ldmUser);
+    imageLoaders.start(new ImageLoadJob(q_ptr, key, path, size));
+    return 0;
+}
+
+/* The files may have been replaced, so decode them again next time */
+void UsersModelPrivate::dropImages(const UserItem &user)
+{
+    images.remove(imageKey(user.image(), sizeBucket(avatarSize)));
+    images.remove(imageKey(user.background(), 0));
+}
+
+void UsersModelPrivate::_q_imageLoaded(const QString &key, const QImage &image)
+{
+    QList<LightDMUser*> waiting = pendingImages.take(key);
+
+    /* Failures are cached as an empty image so they aren't retried on every repaint */
+    QPixmap *pixmap = new QPixmap(QPixmap::fromImage(image));
+    int cost = qMax(1, int(qint64(image.bytesPerLine()) * image.height() / 1024));
+    images.insert(key, pixmap, qMin(cost, images.maxCost()));
+
+    Q_FOREACH(LightDMUser *ldmUser, waiting) {
+        QHash<LightDMUser*, int>::const_iterator i = rows.constFind(ldmUser);
+        if (i != rows.constEnd()) {
+            queueChange(i.value());
+        }
+    }
+}
+
 void UsersModelPrivate::loadUsers()
 {
-    Q_Q(UsersModel);
+    g_signal_connect(lightdm_user_list_get_instance(), LIGHTDM_USER_LIST_SIGNAL_USERS_ADDED, G_CALLBACK (cb_usersAdded), this);
+    g_signal_connect(lightdm_user_list_get_instance(), LIGHTDM_USER_LIST_SIGNAL_USERS_CHANGED, G_CALLBACK (cb_usersChanged), this);
+    g_signal_connect(lightdm_user_list_get_instance(), LIGHTDM_USER_LIST_SIGNAL_USERS_REMOVED, G_CALLBACK (cb_usersRemoved), this);
+}
 
-    int rowCount = lightdm_user_list_get_length(lightdm_user_list_get_instance());
+bool UsersModelPrivate::matches(LightDMUser *ldmUser) const
+{
+    return QString::fromUtf8(lightdm_user_get_name(ldmUser)).startsWith(searchPrefix, Qt::CaseInsensitive) ||
+           QString::fromUtf8(lightdm_user_get_real_name(ldmUser)).startsWith(searchPrefix, Qt::CaseInsensitive);
+}
 
-    if (rowCount == 0) {
+/* Read the users the first time they are needed, nobody has seen any rows yet */
+void UsersModelPrivate::ensureLoaded()
+{
+    if (loaded) {
         return;
-    } else {
-        q->beginInsertRows(QModelIndex(), 0, rowCount-1);
+    }
+    loaded = true;
 
+    if (!paged()) {
         const GList *items, *item;
         items = lightdm_user_list_get_users(lightdm_user_list_get_instance());
         for (item = items; item; item = item->next) {
             LightDMUser *ldmUser = static_cast<LightDMUser*>(item->data);
+            rows.insert(ldmUser, users.size());
+            users.append(UserItem(ldmUser));
+        }
+    } else {
+        fetchUsers(pageSize, false);
+    }
+}
 
-            UserItem user;
-            user.name = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-            user.homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
-            user.realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
-            user.image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
-            user.background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
-            user.session = QString::fromUtf8(lightdm_user_get_session(ldmUser));
-            user.isLoggedIn = lightdm_user_get_logged_in(ldmUser);
-            user.hasMessages = lightdm_user_get_has_messages(ldmUser);
-            user.uid = (quint64)lightdm_user_get_uid(ldmUser);
-            user.isLocked = lightdm_user_get_is_locked(ldmUser);
-            users.append(user);
+/* Add the matching users not already shown, up to limit users in total */
+void UsersModelPrivate::fetchUsers(int limit, bool notify)
+{
+    Q_Q(UsersModel);
+
+    /* Ask for one more than needed to know if there is another page */
+    GList *items = lightdm_user_list_search(lightdm_user_list_get_instance(), searchPrefix.toUtf8().constData(), limit > 0 ? limit + 1 : 0);
+
+    QList<LightDMUser*> added;
+    int count = 0;
+    for (GList *item = items; item && (limit <= 0 || count < limit); item = item->next, count++) {
+        LightDMUser *ldmUser = static_cast<LightDMUser*>(item->data);
+        if (!rows.contains(ldmUser)) {
+            added.append(ldmUser);
         }
+    }
+    moreAvailable = limit > 0 && int(g_list_length(items)) > limit;
+    g_list_free(items);
+
+    if (added.isEmpty()) {
+        return;
+    }
 
+    if (notify) {
+        q->beginInsertRows(QModelIndex(), users.size(), users.size() + added.size() - 1);
+    }
+    Q_FOREACH(LightDMUser *ldmUser, added) {
+        rows.insert(ldmUser, users.size());
+        users.append(UserItem(ldmUser));
+    }
+    if (notify) {
         q->endInsertRows();
     }
-    g_signal_connect(lightdm_user_list_get_instance(), LIGHTDM_USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (cb_userAdded), this);
-    g_signal_connect(lightdm_user_list_get_instance(), LIGHTDM_USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (cb_userChanged), this);
-    g_signal_connect(lightdm_user_list_get_instance(), LIGHTDM_USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (cb_userRemoved), this);
 }
 
-void UsersModelPrivate::cb_userAdded(LightDMUserList *user_list, LightDMUser *ldmUser, gpointer data)
+/* Show the matching users again, up to limit rows or one page if 0 */
+void UsersModelPrivate::reload(int limit)
 {
-    Q_UNUSED(user_list)
-    UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
+    Q_Q(UsersModel);
 
-    that->q_func()->beginInsertRows(QModelIndex(), that->users.size(), that->users.size());
+    if (!loaded) {
+        return;
+    }
 
-    UserItem user;
-    user.name = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-    user.homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
-    user.realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
-    user.image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
-    user.background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
-    user.isLoggedIn = lightdm_user_get_logged_in(ldmUser);
-    user.hasMessages = lightdm_user_get_has_messages(ldmUser);
-    user.uid = (quint64)lightdm_user_get_uid(ldmUser);
-    user.isLocked = lightdm_user_get_is_locked(ldmUser);
-    that->users.append(user);
+    /* Report pending changes while the row numbers are still valid */
+    _q_flushChanges();
 
-    that->q_func()->endInsertRows();
+    q->beginResetModel();
+    users.clear();
+    rows.clear();
+    loaded = false;
+    ensureLoaded();
+    if (paged() && pageSize > 0 && limit > pageSize) {
+        fetchUsers(limit, false);
+    }
+    q->endResetModel();
+}
+
+/* Coalesce bursts of changes into a single dataChanged once we are back in the event loop */
+void UsersModelPrivate::queueChange(int row)
+{
+    Q_Q(UsersModel);
+
+    if (firstChangedRow < 0 || row < firstChangedRow) {
+        firstChangedRow = row;
+    }
+    if (row > lastChangedRow) {
+        lastChangedRow = row;
+    }
 
+    if (!flushQueued) {
+        flushQueued = true;
+        QMetaObject::invokeMethod(q, "_q_flushChanges", Qt::QueuedConnection);
+    }
 }
 
-void UsersModelPrivate::cb_userChanged(LightDMUserList *user_list, LightDMUser *ldmUser, gpointer data)
+void UsersModelPrivate::_q_flushChanges()
+{
+    Q_Q(UsersModel);
+
+    flushQueued = false;
+    if (firstChangedRow < 0) {
+        return;
+    }
+
+    int first = firstChangedRow;
+    int last = qMin(lastChangedRow, users.size() - 1);
+    firstChangedRow = lastChangedRow = -1;
+    if (first <= last) {
+        q->dataChanged(q->createIndex(first, 0), q->createIndex(last, 0));
+    }
+}
+
+void UsersModelPrivate::cb_usersAdded(LightDMUserList *user_list, GPtrArray *ldmUsers, gpointer data)
 {
     Q_UNUSED(user_list)
     UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
 
-    QString userToChange = QString::fromUtf8(lightdm_user_get_name(ldmUser));
+    if (!that->loaded) {
+        return;
+    }
 
-    for (int i=0;i<that->users.size();i++) {
-        if (that->users[i].name == userToChange) {
+    /* Search again so the new users are shown in order if they match */
+    if (that->paged()) {
+        int matching = 0;
+        for (guint i = 0; i < ldmUsers->len; i++) {
+            if (that->matches(static_cast<LightDMUser*>(g_ptr_array_index(ldmUsers, i)))) {
+                matching++;
+            }
+        }
+        if (matching > 0) {
+            that->reload(that->users.size() + matching);
+        }
+        return;
+    }
+
+    QList<LightDMUser*> added;
+    for (guint i = 0; i < ldmUsers->len; i++) {
+        LightDMUser *ldmUser = static_cast<LightDMUser*>(g_ptr_array_index(ldmUsers, i));
+        if (!that->rows.contains(ldmUser)) {
+            added.append(ldmUser);
+        }
+    }
+    if (added.isEmpty()) {
+        return;
+    }
 
-            that->users[i].homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
-            that->users[i].realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
-            that->users[i].image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
-            that->users[i].background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
-            that->users[i].isLoggedIn = lightdm_user_get_logged_in(ldmUser);
-            that->users[i].hasMessages = lightdm_user_get_has_messages(ldmUser);
-            that->users[i].uid = (quint64)lightdm_user_get_uid(ldmUser);
-            that->users[i].isLocked = lightdm_user_get_is_locked(ldmUser);
+    that->q_func()->beginInsertRows(QModelIndex(), that->users.size(), that->users.size() + added.size() - 1);
+    Q_FOREACH(LightDMUser *ldmUser, added) {
+        that->rows.insert(ldmUser, that->users.size());
+        that->users.append(UserItem(ldmUser));
+    }
+    that->q_func()->endInsertRows();
+}
 
-            QModelIndex index = that->q_ptr->createIndex(i, 0);
-            that->q_ptr->dataChanged(index, index);
-            break;
+void UsersModelPrivate::cb_usersChanged(LightDMUserList *user_list, GPtrArray *ldmUsers, gpointer data)
+{
+    Q_UNUSED(user_list)
+    UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
+
+    for (guint i = 0; i < ldmUsers->len; i++) {
+        QHash<LightDMUser*, int>::const_iterator row = that->rows.constFind(static_cast<LightDMUser*>(g_ptr_array_index(ldmUsers, i)));
+        if (row == that->rows.constEnd()) {
+            continue;
         }
+
+        that->dropImages(that->users[row.value()]);
+        that->users[row.value()].invalidate();
+        that->queueChange(row.value());
     }
 }
 
 
-void UsersModelPrivate::cb_userRemoved(LightDMUserList *user_list, LightDMUser *ldmUser, gpointer data)
+void UsersModelPrivate::cb_usersRemoved(LightDMUserList *user_list, GPtrArray *ldmUsers, gpointer data)
 {
     Q_UNUSED(user_list)
 
     UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
-    QString userToRemove = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-
-    for (int i=0;i<that->users.size();i++) {
-        if (that->users[i].name == userToRemove) {
-            that->q_ptr->beginRemoveRows(QModelIndex(), i, i);
-            that->users.removeAt(i);
-            that->q_ptr->endRemoveRows();
-            break;
+
+    QList<int> removed;
+    for (guint i = 0; i < ldmUsers->len; i++) {
+        QHash<LightDMUser*, int>::const_iterator row = that->rows.constFind(static_cast<LightDMUser*>(g_ptr_array_index(ldmUsers, i)));
+        if (row != that->rows.constEnd()) {
+            removed.append(row.value());
         }
     }
+    if (removed.isEmpty()) {
+        return;
+    }
+
+    /* Report pending changes while the row numbers are still valid */
+    that->_q_flushChanges();
+
+    /* Rows removed from all over the list are shown again at once rather than moving the rest for each one */
+    if (removed.size() == 1) {
+        that->q_ptr->beginRemoveRows(QModelIndex(), removed.first(), removed.first());
+    } else {
+        that->q_ptr->beginResetModel();
+    }
+
+    std::sort(removed.begin(), removed.end());
+    for (int i = removed.size() - 1; i >= 0; i--) {
+        that->rows.remove(that->users[removed[i]].ldmUser);
+        that->users.removeAt(removed[i]);
+    }
+    for (int j = removed.first(); j < that->users.size(); j++) {
+        that->rows[that->users[j].ldmUser] = j;
+    }
+
+    if (removed.size() == 1) {
+        that->q_ptr->endRemoveRows();
+    } else {
+        that->q_ptr->endResetModel();
+    }
 }
 
 UsersModel::UsersModel(QObject *parent) :
@@ -204,14 +528,113 @@ UsersModel::UsersModel(QObject *parent) :
 
 UsersModel::~UsersModel()
 {
+    /* Loaders refer back to the model */
+    d_ptr->imageLoaders.clear();
+    d_ptr->imageLoaders.waitForDone();
     delete d_ptr;
 }
 
+/**
+ * Set the size in pixels avatars are shown at. Larger avatars are scaled
+ * down when loaded to save memory, 0 keeps them at their original size.
+ */
+void UsersModel::setAvatarSize(int size)
+{
+    Q_D(UsersModel);
+    d->avatarSize = size;
+}
+
+int UsersModel::avatarSize() const
+{
+    Q_D(const UsersModel);
+    return d->avatarSize;
+}
+
+/**
+ * Set the memory in kilobytes to use for decoded avatars and backgrounds.
+ * The least recently used images are dropped when this is exceeded.
+ */
+void UsersModel::setImageCacheLimit(int kilobytes)
+{
+    Q_D(UsersModel);
+    d->images.setMaxCost(qMax(kilobytes, 1));
+}
+
+int UsersModel::imageCacheLimit() const
+{
+    Q_D(const UsersModel);
+    return d->images.maxCost();
+}
+
+
+/**
+ * Only show users whose user name or real name starts with prefix, ignoring
+ * case. An empty prefix shows all users.
+ */
+void UsersModel::setSearchPrefix(const QString &prefix)
+{
+    Q_D(UsersModel);
+    if (prefix == d->searchPrefix) {
+        return;
+    }
+    d->searchPrefix = prefix;
+    d->reload(0);
+}
+
+QString UsersModel::searchPrefix() const
+{
+    Q_D(const UsersModel);
+    return d->searchPrefix;
+}
+
+/**
+ * Set the number of users to load at a time, with more loaded by fetchMore().
+ * This is best set before the model is used so the full user list is never
+ * loaded. 0 loads all the matching users at once.
+ */
+void UsersModel::setPageSize(int size)
+{
+    Q_D(UsersModel);
+    size = qMax(size, 0);
+    if (size == d->pageSize) {
+        return;
+    }
+    d->pageSize = size;
+    d->reload(0);
+}
+
+int UsersModel::pageSize() const
+{
+    Q_D(const UsersModel);
+    return d->pageSize;
+}
+
+bool UsersModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_D(const UsersModel);
+    if (parent != QModelIndex()) {
+        return false;
+    }
+
+    const_cast<UsersModelPrivate*>(d)->ensureLoaded();
+    return d->moreAvailable;
+}
+
+void UsersModel::fetchMore(const QModelIndex &parent)
+{
+    Q_D(UsersModel);
+    if (parent != QModelIndex() || !canFetchMore(parent)) {
+        return;
+    }
+
+    d->fetchUsers(d->users.size() + d->pageSize, true);
+}
 
 int UsersModel::rowCount(const QModelIndex &parent) const
 {
     Q_D(const UsersModel);
     if (parent == QModelIndex()) {
+        const_cast<UsersModelPrivate*>(d)->ensureLoaded();
         return d->users.size();
     }
 
@@ -222,36 +645,41 @@ QVariant UsersModel::data(const QModelIndex &index, int role) const
 {
     Q_D(const UsersModel);
 
-    if (!index.isValid()) {
+    if (!index.isValid() || index.row() >= d->users.size()) {
         return QVariant();
     }
 
-    int row = index.row();
+    const UserItem &user = d->users[index.row()];
     switch (role) {
     case Qt::DisplayRole:
-        return d->users[row].displayName();
-    case Qt::DecorationRole:
-        return QIcon(d->users[row].image);
+        return user.displayName();
+    case Qt::DecorationRole: {
+        /* Images are decoded in the background, dataChanged is emitted when ready */
+        const QPixmap *image = d->lookupImage(user, user.image(), sizeBucket(d->avatarSize));
+        return image ? QIcon(*image) : QIcon();
+    }
     case UsersModel::NameRole:
-        return d->users[row].name;
+        return user.name();
     case UsersModel::RealNameRole:
-        return d->users[row].realName;
+        return user.realName();
     case UsersModel::SessionRole:
-        return d->users[row].session;
+        return user.session();
     case UsersModel::LoggedInRole:
-        return d->users[row].isLoggedIn;
-    case UsersModel::BackgroundRole:
-        return QPixmap(d->users[row].background);
+        return bool(lightdm_user_get_logged_in(user.ldmUser));
+    case UsersModel::BackgroundRole: {
+        const QPixmap *background = d->lookupImage(user, user.background(), 0);
+        return background ? *background : QPixmap();
+    }
     case UsersModel::BackgroundPathRole:
-        return d->users[row].background;
+        return user.background();
     case UsersModel::HasMessagesRole:
-        return d->users[row].hasMessages;
+        return bool(lightdm_user_get_has_messages(user.ldmUser));
     case UsersModel::ImagePathRole:
-        return d->users[row].image;
+        return user.image();
     case UsersModel::UidRole:
-        return d->users[row].uid;
+        return (quint64)lightdm_user_get_uid(user.ldmUser);
     case UsersModel::IsLockedRole:
-        return d->users[row].isLocked;
+        return bool(lightdm_user_get_is_locked(user.ldmUser));
     }
 
     return QVariant();
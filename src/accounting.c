@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <utmp.h>
+#if HAVE_LIBAUDIT
+#include <libaudit.h>
+#endif
+
+#include "accounting.h"
+
+typedef struct
+{
+    gchar *wtmp_file;
+    struct utmp ut;
+    AccountingEvent event;
+    gchar *username;
+    uid_t uid;
+    gchar *remote_host_name;
+    gchar *tty;
+    gboolean success;
+} AccountingRecord;
+
+/* Milliseconds to collect records for before writing them, 0 if the session children write their own */
+static guint batch_interval = 0;
+
+/* TRUE to sync the files after each batch is written */
+static gboolean sync_writes = FALSE;
+
+/* Records waiting to be written, in the order they were made */
+static GQueue records = G_QUEUE_INIT;
+static guint flush_timeout = 0;
+
+#if HAVE_LIBAUDIT
+static int audit_fd = -1;
+#endif
+
+void
+accounting_set_batch_interval (guint interval)
+{
+    batch_interval = interval;
+}
+
+gboolean
+accounting_get_enabled (void)
+{
+    return batch_interval > 0;
+}
+
+void
+accounting_set_sync (gboolean sync)
+{
+    sync_writes = sync;
+}
+
+static void
+accounting_record_free (AccountingRecord *record)
+{
+    g_free (record->wtmp_file);
+    g_free (record->username);
+    g_free (record->remote_host_name);
+    g_free (record->tty);
+    g_free (record);
+}
+
+static gboolean
+flush_cb (gpointer data)
+{
+    flush_timeout = 0;
+    accounting_flush ();
+    return G_SOURCE_REMOVE;
+}
+
+void
+accounting_add (const gchar *wtmp_file, const struct utmpx *ut, AccountingEvent event, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success)
+{
+    AccountingRecord *record = g_malloc0 (sizeof (AccountingRecord));
+    record->wtmp_file = g_strdup (wtmp_file);
+
+    /* Same conversion as updwtmpx (), which isn't available everywhere */
+    record->ut.ut_type = ut->ut_type;
+    record->ut.ut_pid = ut->ut_pid;
+    strncpy (record->ut.ut_line, ut->ut_line, sizeof (record->ut.ut_line));
+    strncpy (record->ut.ut_id, ut->ut_id, sizeof (record->ut.ut_id));
+    strncpy (record->ut.ut_user, ut->ut_user, sizeof (record->ut.ut_user));
+    strncpy (record->ut.ut_host, ut->ut_host, sizeof (record->ut.ut_host));
+    record->ut.ut_tv.tv_sec = ut->ut_tv.tv_sec;
+    record->ut.ut_tv.tv_usec = ut->ut_tv.tv_usec;
+
+    record->event = event;
+    record->username = g_strdup (username);
+    record->uid = uid;
+    record->remote_host_name = g_strdup (remote_host_name);
+    record->tty = g_strdup (tty);
+    record->success = success;
+    g_queue_push_tail (&records, record);
+
+    if (!flush_timeout)
+        flush_timeout = g_timeout_add (batch_interval, flush_cb, NULL);
+}
+
+/* Append records to a file, locked the same way as updwtmp () so other writers don't interleave */
+static void
+write_records (const gchar *wtmp_file, GByteArray *data)
+{
+    int fd = open (wtmp_file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+    {
+        g_debug ("Failed to open %s: %s", wtmp_file, strerror (errno));
+        return;
+    }
+
+    struct flock lock;
+    memset (&lock, 0, sizeof (lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl (fd, F_SETLKW, &lock) < 0)
+        g_debug ("Failed to lock %s: %s", wtmp_file, strerror (errno));
+
+    gsize offset = 0;
+    while (offset < data->len)
+    {
+        ssize_t n_written = write (fd, data->data + offset, data->len - offset);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+        {
+            g_warning ("Failed to write to %s: %s", wtmp_file, strerror (errno));
+            break;
+        }
+        offset += n_written;
+    }
+    if (sync_writes && fdatasync (fd) < 0)
+        g_warning ("Failed to sync %s: %s", wtmp_file, strerror (errno));
+
+    lock.l_type = F_UNLCK;
+    fcntl (fd, F_SETLK, &lock);
+    close (fd);
+}
+
+#if HAVE_LIBAUDIT
+static void
+write_audit_event (AccountingRecord *record)
+{
+    if (audit_fd < 0)
+        audit_fd = audit_open ();
+    if (audit_fd < 0)
+    {
+        g_warning ("Error opening audit socket: %s", strerror (errno));
+        return;
+    }
+
+    int type = record->event == ACCOUNTING_EVENT_LOGIN ? AUDIT_USER_LOGIN : AUDIT_USER_LOGOUT;
+    const char *op = record->event == ACCOUNTING_EVENT_LOGIN ? "login" : "logout";
+    if (audit_log_acct_message (audit_fd, type, NULL, op, record->username, record->uid, record->remote_host_name, NULL, record->tty, record->success ? 1 : 0) <= 0)
+    {
+        g_warning ("Error writing audit message: %s", strerror (errno));
+        audit_close (audit_fd);
+        audit_fd = -1;
+    }
+}
+#endif
+
+void
+accounting_flush (void)
+{
+    if (flush_timeout)
+        g_source_remove (flush_timeout);
+    flush_timeout = 0;
+
+    if (g_queue_is_empty (&records))
+        return;
+
+    /* Collect the records for each file so each is opened and written once */
+    g_autoptr(GHashTable) files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_byte_array_unref);
+    g_autoptr(GPtrArray) file_order = g_ptr_array_new ();
+    guint n_records = 0;
+    AccountingRecord *record;
+    while ((record = g_queue_pop_head (&records)))
+    {
+        GByteArray *data = g_hash_table_lookup (files, record->wtmp_file);
+        if (!data)
+        {
+            data = g_byte_array_new ();
+            g_ptr_array_add (file_order, record->wtmp_file);
+            g_hash_table_insert (files, g_steal_pointer (&record->wtmp_file), data);
+        }
+        g_byte_array_append (data, (const guint8 *) &record->ut, sizeof (record->ut));
+
+#if HAVE_LIBAUDIT
+        if (record->event != ACCOUNTING_EVENT_NONE)
+            write_audit_event (record);
+#endif
+
+        accounting_record_free (record);
+        n_records++;
+    }
+
+    for (guint i = 0; i < file_order->len; i++)
+        write_records (file_order->pdata[i], g_hash_table_lookup (files, file_order->pdata[i]));
+    g_debug ("Wrote %u login record(s) to %u file(s)", n_records, file_order->len);
+}
+
+void
+accounting_cleanup (void)
+{
+    accounting_flush ();
+#if HAVE_LIBAUDIT
+    if (audit_fd >= 0)
+        audit_close (audit_fd);
+    audit_fd = -1;
+#endif
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef ACCOUNTING_H_
+#define ACCOUNTING_H_
+
+#include <glib.h>
+#include <sys/types.h>
+#include <utmpx.h>
+
+G_BEGIN_DECLS
+
+/* Audit event to log along with a login record */
+typedef enum
+{
+    ACCOUNTING_EVENT_NONE,
+    ACCOUNTING_EVENT_LOGIN,
+    ACCOUNTING_EVENT_LOGOUT
+} AccountingEvent;
+
+void accounting_set_batch_interval (guint interval);
+
+gboolean accounting_get_enabled (void);
+
+void accounting_set_sync (gboolean sync);
+
+void accounting_add (const gchar *wtmp_file, const struct utmpx *ut, AccountingEvent event, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success);
+
+void accounting_flush (void);
+
+void accounting_cleanup (void);
+
+G_END_DECLS
+
+#endif /* ACCOUNTING_H_ */
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 
 #include "accounts.h"
+#include "nss.h"
 #include "user-list.h"
 
 typedef struct
@@ -29,7 +30,8 @@ accounts_get_user_by_name (const gchar *username)
 {
     g_return_val_if_fail (username != NULL, NULL);
 
-    CommonUser *common_user = common_user_list_get_user_by_name (common_user_list_get_instance (), username);
+    /* Only look up this user, the whole list may be slow to load on directory-backed systems */
+    CommonUser *common_user = common_user_list_lookup_user (common_user_list_get_instance (), username);
     if (common_user == NULL)
         return NULL;
 
@@ -42,7 +44,7 @@ accounts_get_user_by_name (const gchar *username)
 User *
 accounts_get_current_user ()
 {
-    struct passwd *entry = getpwuid (getuid ());
+    g_autoptr(CommonPasswd) entry = common_nss_get_user_by_uid (getuid ());
     if (entry != NULL)
         return accounts_get_user_by_name (entry->pw_name);
     else
@@ -121,6 +123,22 @@ user_get_xsession (User *user)
     return common_user_get_session (priv->common_user);
 }
 
+void
+user_hold_settings (User *user)
+{
+    UserPrivate *priv = user_get_instance_private (user);
+    g_return_if_fail (user != NULL);
+    common_user_hold_settings (priv->common_user);
+}
+
+void
+user_release_settings (User *user)
+{
+    UserPrivate *priv = user_get_instance_private (user);
+    g_return_if_fail (user != NULL);
+    common_user_release_settings (priv->common_user);
+}
+
 static void
 user_init (User *user)
 {
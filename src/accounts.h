@@ -57,6 +57,10 @@ const gchar *user_get_language (User *user);
 
 void user_set_language (User *user, const gchar *language);
 
+void user_hold_settings (User *user);
+
+void user_release_settings (User *user);
+
 G_END_DECLS
 
 #endif /* USER_H_ */
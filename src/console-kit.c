@@ -14,6 +14,31 @@
 
 #include "console-kit.h"
 
+/* Time in milliseconds to wait for ConsoleKit to reply to a method call */
+#define CK_CALL_TIMEOUT 5000
+
+/* System bus, kept once found */
+static GDBusConnection *ck_bus = NULL;
+
+/* Session object paths, keyed by cookie */
+static GHashTable *session_paths = NULL;
+
+typedef struct
+{
+    gchar *cookie;
+    const gchar *method;
+    const gchar *error_message;
+} SessionCall;
+
+static void
+session_call_free (SessionCall *call)
+{
+    g_free (call->cookie);
+    g_free (call);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SessionCall, session_call_free)
+
 gchar *
 ck_open_session (GVariantBuilder *parameters)
 {
@@ -33,7 +58,7 @@ ck_open_session (GVariantBuilder *parameters)
                                                               g_variant_new ("(a(sv))", parameters),
                                                               G_VARIANT_TYPE ("(s)"),
                                                               G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
+                                                              CK_CALL_TIMEOUT,
                                                               NULL,
                                                               &error);
 
@@ -61,7 +86,7 @@ get_ck_session (GDBusConnection *bus, const gchar *cookie)
                                                               g_variant_new ("(s)", cookie),
                                                               G_VARIANT_TYPE ("(o)"),
                                                               G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
+                                                              CK_CALL_TIMEOUT,
                                                               NULL,
                                                               &error);
     if (error)
@@ -75,103 +100,146 @@ get_ck_session (GDBusConnection *bus, const gchar *cookie)
     return g_steal_pointer (&session_path);
 }
 
-void
-ck_lock_session (const gchar *cookie)
+static void
+session_method_cb (GObject *object, GAsyncResult *res, gpointer data)
 {
-    g_return_if_fail (cookie != NULL);
+    g_autoptr(SessionCall) call = data;
 
-    g_debug ("Locking ConsoleKit session %s", cookie);
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error)
+    {
+        g_warning ("%s: %s", call->error_message, error->message);
+
+        /* Look the session up again next time in case it has gone */
+        if (session_paths)
+            g_hash_table_remove (session_paths, call->cookie);
+    }
+}
+
+static void
+call_method_on_path (GDBusConnection *bus, const gchar *session_path, SessionCall *call)
+{
+    g_dbus_connection_call (bus,
+                            "org.freedesktop.ConsoleKit",
+                            session_path,
+                            "org.freedesktop.ConsoleKit.Session",
+                            call->method,
+                            g_variant_new ("()"),
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            CK_CALL_TIMEOUT,
+                            NULL,
+                            session_method_cb,
+                            call);
+}
+
+static void
+get_session_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    GDBusConnection *bus = G_DBUS_CONNECTION (object);
+    g_autoptr(SessionCall) call = data;
 
     g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (bus, res, &error);
     if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
-    if (!bus)
+        g_warning ("Error getting ConsoleKit session: %s", error->message);
+    if (!result)
         return;
 
-    g_autofree gchar *session_path = get_ck_session (bus, cookie);
-    if (!session_path)
-        return;
+    const gchar *session_path;
+    g_variant_get (result, "(&o)", &session_path);
 
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              session_path,
-                                                              "org.freedesktop.ConsoleKit.Session",
-                                                              "Lock",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error locking ConsoleKit session: %s", error->message);
+    /* The path doesn't change for the life of the session */
+    if (!session_paths)
+        session_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_insert (session_paths, g_strdup (call->cookie), g_strdup (session_path));
+
+    call_method_on_path (bus, session_path, g_steal_pointer (&call));
 }
 
-void
-ck_unlock_session (const gchar *cookie)
+static void
+get_bus_cb (GObject *object, GAsyncResult *res, gpointer data)
 {
-    g_return_if_fail (cookie != NULL);
-
-    g_debug ("Unlocking ConsoleKit session %s", cookie);
+    g_autoptr(SessionCall) call = data;
 
     g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    g_autoptr(GDBusConnection) bus = g_bus_get_finish (res, &error);
     if (error)
         g_warning ("Failed to get system bus: %s", error->message);
     if (!bus)
         return;
+    if (!ck_bus)
+        ck_bus = g_object_ref (bus);
+
+    g_dbus_connection_call (bus,
+                            "org.freedesktop.ConsoleKit",
+                            "/org/freedesktop/ConsoleKit/Manager",
+                            "org.freedesktop.ConsoleKit.Manager",
+                            "GetSessionForCookie",
+                            g_variant_new ("(s)", call->cookie),
+                            G_VARIANT_TYPE ("(o)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            CK_CALL_TIMEOUT,
+                            NULL,
+                            get_session_cb,
+                            g_steal_pointer (&call));
+}
 
-    g_autofree gchar *session_path = get_ck_session (bus, cookie);
-    if (!session_path)
-        return;
+/* Calls a method on the session without waiting for ConsoleKit to respond */
+static void
+call_session_method (const gchar *cookie, const gchar *method, const gchar *error_message)
+{
+    SessionCall *call = g_malloc0 (sizeof (SessionCall));
+    call->cookie = g_strdup (cookie);
+    call->method = method;
+    call->error_message = error_message;
+
+    /* Skip straight to the method call for sessions already looked up */
+    const gchar *session_path = session_paths ? g_hash_table_lookup (session_paths, cookie) : NULL;
+    if (ck_bus && session_path)
+        call_method_on_path (ck_bus, session_path, call);
+    else
+        g_bus_get (G_BUS_TYPE_SYSTEM, NULL, get_bus_cb, call);
+}
 
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              session_path,
-                                                              "org.freedesktop.ConsoleKit.Session",
-                                                              "Unlock",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error unlocking ConsoleKit session: %s", error->message);
+void
+ck_forget_session (const gchar *cookie)
+{
+    g_return_if_fail (cookie != NULL);
+
+    if (session_paths)
+        g_hash_table_remove (session_paths, cookie);
 }
 
 void
-ck_activate_session (const gchar *cookie)
+ck_lock_session (const gchar *cookie)
 {
     g_return_if_fail (cookie != NULL);
 
-    g_debug ("Activating ConsoleKit session %s", cookie);
+    g_debug ("Locking ConsoleKit session %s", cookie);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-    if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
-    if (!bus)
-        return;
+    call_session_method (cookie, "Lock", "Error locking ConsoleKit session");
+}
 
-    g_autofree gchar *session_path = get_ck_session (bus, cookie);
-    if (!session_path)
-        return;
+void
+ck_unlock_session (const gchar *cookie)
+{
+    g_return_if_fail (cookie != NULL);
 
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              session_path,
-                                                              "org.freedesktop.ConsoleKit.Session",
-                                                              "Activate",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error activating ConsoleKit session: %s", error->message);
+    g_debug ("Unlocking ConsoleKit session %s", cookie);
+
+    call_session_method (cookie, "Unlock", "Error unlocking ConsoleKit session");
+}
+
+void
+ck_activate_session (const gchar *cookie)
+{
+    g_return_if_fail (cookie != NULL);
+
+    g_debug ("Activating ConsoleKit session %s", cookie);
+
+    call_session_method (cookie, "Activate", "Error activating ConsoleKit session");
 }
 
 void
@@ -195,7 +263,7 @@ ck_close_session (const gchar *cookie)
                                                               g_variant_new ("(s)", cookie),
                                                               G_VARIANT_TYPE ("(b)"),
                                                               G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
+                                                              CK_CALL_TIMEOUT,
                                                               NULL,
                                                               &error);
 
@@ -236,7 +304,7 @@ ck_get_xdg_runtime_dir (const gchar *cookie)
                                                               g_variant_new ("()"),
                                                               G_VARIANT_TYPE ("(s)"),
                                                               G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
+                                                              CK_CALL_TIMEOUT,
                                                               NULL,
                                                               &error);
     if (error)
@@ -22,6 +22,8 @@ void ck_lock_session (const gchar *cookie);
 
 void ck_unlock_session (const gchar *cookie);
 
+void ck_forget_session (const gchar *cookie);
+
 void ck_activate_session (const gchar *cookie);
 
 void ck_close_session (const gchar *cookie);
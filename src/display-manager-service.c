@@ -10,12 +10,19 @@
 
 #include <config.h>
 
+#include <stdio.h>
+
 #include "display-manager-service.h"
+#include "login-trace.h"
+#include "metrics.h"
+#include "process.h"
 
 enum {
     READY,
     ADD_XLOCAL_SEAT,
     NAME_LOST,
+    RELOAD,
+    RESTART,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -25,6 +32,9 @@ typedef struct
     /* Display manager being exposed on D-Bus */
     DisplayManager *manager;
 
+    /* VNC server to report statistics for */
+    VNCServer *vnc_server;
+
     /* Bus connected to */
     GDBusConnection *bus;
 
@@ -34,6 +44,9 @@ typedef struct
     /* Handle for display manager D-Bus object */
     guint reg_id;
 
+    /* Handle for object manager on the display manager D-Bus object */
+    guint object_manager_reg_id;
+
     /* D-Bus interface information */
     GDBusNodeInfo *seat_info;
     GDBusNodeInfo *session_info;
@@ -45,6 +58,22 @@ typedef struct
     /* Bus entries for seats / session */
     GHashTable *seat_bus_entries;
     GHashTable *session_bus_entries;
+
+    /* Property values built from the bus entries, cleared when the entries change */
+    GVariant *seat_list;
+    GVariant *session_list;
+    GVariant *session_users;
+
+    /* Objects added and removed since signals were last emitted */
+    GQueue *pending_changes;
+
+    /* Properties to signal as changed */
+    gboolean seats_changed;
+    gboolean sessions_changed;
+    GHashTable *changed_seat_sessions;
+
+    /* Idle to emit signals for all the changes in this main loop iteration */
+    guint flush_idle;
 } DisplayManagerServicePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (DisplayManagerService, display_manager_service, G_TYPE_OBJECT)
@@ -55,6 +84,9 @@ typedef struct
     Seat *seat;
     gchar *path;
     guint bus_id;
+
+    /* Value of the Sessions property, NULL when it needs rebuilding */
+    GVariant *sessions;
 } SeatBusEntry;
 typedef struct
 {
@@ -65,6 +97,17 @@ typedef struct
     guint bus_id;
 } SessionBusEntry;
 
+/* A seat or session added or removed, waiting to be signalled */
+typedef struct
+{
+    gchar *path;
+    gchar *seat_path;
+    gboolean is_session;
+
+    /* Entry for added objects (which exists until signalled), NULL if removed */
+    gpointer entry;
+} PendingChange;
+
 #define LIGHTDM_BUS_NAME "org.freedesktop.DisplayManager"
 
 DisplayManagerService *
@@ -78,6 +121,18 @@ display_manager_service_new (DisplayManager *manager)
     return service;
 }
 
+void
+display_manager_service_set_vnc_server (DisplayManagerService *service, VNCServer *server)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    g_return_if_fail (service != NULL);
+
+    g_clear_object (&priv->vnc_server);
+    if (server)
+        priv->vnc_server = g_object_ref (server);
+}
+
 static SeatBusEntry *
 seat_bus_entry_new (DisplayManagerService *service, Seat *seat, const gchar *path)
 {
@@ -101,12 +156,15 @@ session_bus_entry_new (DisplayManagerService *service, Session *session, const g
     return entry;
 }
 
+/* Takes the reference to property_value */
 static void
 emit_object_value_changed (GDBusConnection *bus, const gchar *path, const gchar *interface_name, const gchar *property_name, GVariant *property_value)
 {
+    g_autoptr(GVariant) value = g_variant_take_ref (property_value);
+
     GVariantBuilder builder;
     g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
-    g_variant_builder_add (&builder, "{sv}", property_name, property_value);
+    g_variant_builder_add (&builder, "{sv}", property_name, value);
 
     g_autoptr(GError) error = NULL;
     if (!g_dbus_connection_emit_signal (bus,
@@ -139,6 +197,7 @@ seat_bus_entry_free (gpointer data)
     SeatBusEntry *entry = data;
 
     g_free (entry->path);
+    g_clear_pointer (&entry->sessions, g_variant_unref);
     g_free (entry);
 }
 
@@ -153,7 +212,7 @@ session_bus_entry_free (gpointer data)
 }
 
 static GVariant *
-get_seat_list (DisplayManagerService *service)
+build_seat_list (DisplayManagerService *service)
 {
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
@@ -173,7 +232,7 @@ get_seat_list (DisplayManagerService *service)
 }
 
 static GVariant *
-get_session_list (DisplayManagerService *service, const gchar *seat_path)
+build_session_list (DisplayManagerService *service, const gchar *seat_path)
 {
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
@@ -193,6 +252,89 @@ get_session_list (DisplayManagerService *service, const gchar *seat_path)
     return g_variant_builder_end (&builder);
 }
 
+/* Map of session paths to the user running them so clients don't have to query each session */
+static GVariant *
+build_session_users (DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{os}"));
+
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, priv->session_bus_entries);
+    gpointer value;
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        SessionBusEntry *entry = value;
+        g_variant_builder_add (&builder, "{os}", entry->path, session_get_username (entry->session));
+    }
+
+    return g_variant_builder_end (&builder);
+}
+
+/* Returns a new reference to the cached value, building it if the entries changed since */
+static GVariant *
+get_cached (GVariant **cache, GVariant *(*build) (DisplayManagerService *service), DisplayManagerService *service)
+{
+    if (!*cache)
+        *cache = g_variant_ref_sink (build (service));
+    return g_variant_ref (*cache);
+}
+
+static GVariant *
+get_seat_list (DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+    return get_cached (&priv->seat_list, build_seat_list, service);
+}
+
+static GVariant *
+build_all_sessions (DisplayManagerService *service)
+{
+    return build_session_list (service, NULL);
+}
+
+static GVariant *
+get_session_list (DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+    return get_cached (&priv->session_list, build_all_sessions, service);
+}
+
+static GVariant *
+get_session_users (DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+    return get_cached (&priv->session_users, build_session_users, service);
+}
+
+static GVariant *
+get_seat_sessions (SeatBusEntry *entry)
+{
+    if (!entry->sessions)
+        entry->sessions = g_variant_ref_sink (build_session_list (entry->service, entry->path));
+    return g_variant_ref (entry->sessions);
+}
+
+static SeatBusEntry *
+find_seat_entry (DisplayManagerService *service, const gchar *path)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, priv->seat_bus_entries);
+    gpointer value;
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        SeatBusEntry *entry = value;
+        if (g_strcmp0 (entry->path, path) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
 static GVariant *
 handle_display_manager_get_property (GDBusConnection       *connection,
                                      const gchar           *sender,
@@ -203,15 +345,28 @@ handle_display_manager_get_property (GDBusConnection       *connection,
                                      gpointer               user_data)
 {
     DisplayManagerService *service = user_data;
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
     if (g_strcmp0 (property_name, "Seats") == 0)
         return get_seat_list (service);
     else if (g_strcmp0 (property_name, "Sessions") == 0)
-        return get_session_list (service, NULL);
+        return get_session_list (service);
+    else if (g_strcmp0 (property_name, "SessionUsers") == 0)
+        return get_session_users (service);
+    else if (g_strcmp0 (property_name, "VNCQueueLength") == 0)
+        return g_variant_new_uint32 (priv->vnc_server ? vnc_server_get_queue_length (priv->vnc_server) : 0);
+    else if (g_strcmp0 (property_name, "VNCActiveLaunches") == 0)
+        return g_variant_new_uint32 (priv->vnc_server ? vnc_server_get_active_launches (priv->vnc_server) : 0);
+    else if (g_strcmp0 (property_name, "VNCRejectedConnections") == 0)
+        return g_variant_new_uint32 (priv->vnc_server ? vnc_server_get_rejected_connections (priv->vnc_server) : 0);
+    else if (g_strcmp0 (property_name, "VNCAverageLaunchTime") == 0)
+        return g_variant_new_uint32 (priv->vnc_server ? vnc_server_get_average_launch_time (priv->vnc_server) : 0);
 
     return NULL;
 }
 
+static GVariant *get_managed_objects (DisplayManagerService *service);
+
 static void
 handle_display_manager_call (GDBusConnection       *connection,
                              const gchar           *sender,
@@ -249,6 +404,101 @@ handle_display_manager_call (GDBusConnection       *connection,
         SeatBusEntry *entry = g_hash_table_lookup (priv->seat_bus_entries, seat);
         g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", entry->path));
     }
+    else if (g_strcmp0 (method_name, "Reload") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        g_signal_emit (service, signals[RELOAD], 0);
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("()"));
+    }
+    else if (g_strcmp0 (method_name, "Restart") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        /* Reply first, the connection goes away when the daemon re-executes */
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("()"));
+        g_dbus_connection_flush_sync (g_dbus_method_invocation_get_connection (invocation), NULL, NULL);
+        g_signal_emit (service, signals[RESTART], 0);
+    }
+    else if (g_strcmp0 (method_name, "GetLoginTrace") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a(xsssu))", login_trace_get_events ()));
+    }
+    else if (g_strcmp0 (method_name, "GetMetrics") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        g_autofree gchar *text = common_metrics_to_text ();
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", text));
+    }
+    else if (g_strcmp0 (method_name, "FlushLogs") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        process_flush_logs ();
+        for (GList *seat_link = display_manager_get_seats (priv->manager); seat_link; seat_link = seat_link->next)
+            for (GList *session_link = seat_get_sessions (SEAT (seat_link->data)); session_link; session_link = session_link->next)
+                session_flush_log (SESSION (session_link->data));
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("()"));
+    }
+    else if (g_strcmp0 (method_name, "GetManagedObjects") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a{oa{sa{sv}}})", get_managed_objects (service)));
+    }
+    else
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
+}
+
+static void
+handle_object_manager_call (GDBusConnection       *connection,
+                            const gchar           *sender,
+                            const gchar           *object_path,
+                            const gchar           *interface_name,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               user_data)
+{
+    DisplayManagerService *service = user_data;
+
+    if (g_strcmp0 (method_name, "GetManagedObjects") == 0)
+    {
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
+        {
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+            return;
+        }
+
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a{oa{sa{sv}}})", get_managed_objects (service)));
+    }
     else
         g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
 }
@@ -268,8 +518,18 @@ handle_seat_get_property (GDBusConnection       *connection,
         return g_variant_new_boolean (seat_get_can_switch (entry->seat));
     if (g_strcmp0 (property_name, "HasGuestAccount") == 0)
         return g_variant_new_boolean (seat_get_allow_guest (entry->seat));
+    else if (g_strcmp0 (property_name, "GreeterFailures") == 0)
+        return g_variant_new_uint32 (seat_get_greeter_failures (entry->seat));
+    else if (g_strcmp0 (property_name, "GreeterRestartDelay") == 0)
+        return g_variant_new_uint32 (seat_get_greeter_restart_delay (entry->seat));
     else if (g_strcmp0 (property_name, "Sessions") == 0)
-        return get_session_list (entry->service, entry->path);
+        return get_seat_sessions (entry);
+    else if (g_strcmp0 (property_name, "ResourceUsage") == 0)
+    {
+        ProcessUsage usage;
+        seat_get_usage (entry->seat, &usage);
+        return process_usage_to_variant (&usage);
+    }
 
     return NULL;
 }
@@ -341,27 +601,6 @@ handle_seat_call (GDBusConnection       *connection,
         g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
 }
 
-static Seat *
-get_seat_for_session (DisplayManagerService *service, Session *session)
-{
-    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
-
-    for (GList *seat_link = display_manager_get_seats (priv->manager); seat_link; seat_link = seat_link->next)
-    {
-        Seat *seat = seat_link->data;
-
-        for (GList *session_link = seat_get_sessions (seat); session_link; session_link = session_link->next)
-        {
-            Session *s = session_link->data;
-
-            if (s == session)
-                return seat;
-        }
-    }
-
-    return NULL;
-}
-
 static GVariant *
 handle_session_get_property (GDBusConnection       *connection,
                              const gchar           *sender,
@@ -377,6 +616,8 @@ handle_session_get_property (GDBusConnection       *connection,
         return g_variant_new_object_path (entry->seat_path);
     else if (g_strcmp0 (property_name, "UserName") == 0)
         return g_variant_new_string (session_get_username (entry->session));
+    else if (g_strcmp0 (property_name, "ResourceUsage") == 0)
+        return process_usage_to_variant (session_get_usage (entry->session));
 
     return NULL;
 }
@@ -398,7 +639,8 @@ handle_session_call (GDBusConnection       *connection,
         if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("()")))
             g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
 
-        Seat *seat = get_seat_for_session (entry->service, entry->session);
+        DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (entry->service);
+        Seat *seat = display_manager_get_seat_for_session (priv->manager, entry->session);
         /* FIXME: Should only allow locks if have a session on this seat */
         seat_lock (seat, session_get_username (entry->session));
         g_dbus_method_invocation_return_value (invocation, NULL);
@@ -407,6 +649,224 @@ handle_session_call (GDBusConnection       *connection,
         g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
 }
 
+/* Get all the properties of an object the same way as they would be read individually */
+static GVariant *
+get_object_interfaces (const gchar *path, GDBusInterfaceInfo *info, GDBusInterfaceGetPropertyFunc get_property, gpointer entry)
+{
+    GVariantBuilder properties;
+    g_variant_builder_init (&properties, G_VARIANT_TYPE ("a{sv}"));
+    for (int i = 0; info->properties[i]; i++)
+    {
+        g_autoptr(GVariant) value = get_property (NULL, NULL, path, info->name, info->properties[i]->name, NULL, entry);
+        if (value)
+            g_variant_take_ref (value);
+        if (value)
+            g_variant_builder_add (&properties, "{sv}", info->properties[i]->name, value);
+    }
+
+    GVariantBuilder interfaces;
+    g_variant_builder_init (&interfaces, G_VARIANT_TYPE ("a{sa{sv}}"));
+    g_variant_builder_add (&interfaces, "{sa{sv}}", info->name, &properties);
+
+    return g_variant_builder_end (&interfaces);
+}
+
+static void
+add_object_properties (GVariantBuilder *builder, const gchar *path, GDBusInterfaceInfo *info, GDBusInterfaceGetPropertyFunc get_property, gpointer entry)
+{
+    g_variant_builder_add (builder, "{o@a{sa{sv}}}", path, get_object_interfaces (path, info, get_property, entry));
+}
+
+/* Get every seat and session with their properties in the same format as org.freedesktop.DBus.ObjectManager.GetManagedObjects */
+static GVariant *
+get_managed_objects (DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{oa{sa{sv}}}"));
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init (&iter, priv->seat_bus_entries);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        SeatBusEntry *entry = value;
+        add_object_properties (&builder, entry->path, priv->seat_info->interfaces[0], handle_seat_get_property, entry);
+    }
+    g_hash_table_iter_init (&iter, priv->session_bus_entries);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        SessionBusEntry *entry = value;
+        add_object_properties (&builder, entry->path, priv->session_info->interfaces[0], handle_session_get_property, entry);
+    }
+
+    return g_variant_builder_end (&builder);
+}
+
+static void
+pending_change_free (PendingChange *change)
+{
+    g_free (change->path);
+    g_free (change->seat_path);
+    g_free (change);
+}
+
+static void
+emit_interfaces_added (DisplayManagerService *service, PendingChange *change)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    GVariant *interfaces;
+    if (change->is_session)
+        interfaces = get_object_interfaces (change->path, priv->session_info->interfaces[0], handle_session_get_property, change->entry);
+    else
+        interfaces = get_object_interfaces (change->path, priv->seat_info->interfaces[0], handle_seat_get_property, change->entry);
+
+    g_autoptr(GError) error = NULL;
+    if (!g_dbus_connection_emit_signal (priv->bus,
+                                        NULL,
+                                        "/org/freedesktop/DisplayManager",
+                                        "org.freedesktop.DBus.ObjectManager",
+                                        "InterfacesAdded",
+                                        g_variant_new ("(o@a{sa{sv}})", change->path, interfaces),
+                                        &error))
+        g_warning ("Failed to emit InterfacesAdded signal: %s", error->message);
+}
+
+static void
+emit_interfaces_removed (DisplayManagerService *service, PendingChange *change)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    const gchar *interface_name = change->is_session ? "org.freedesktop.DisplayManager.Session" : "org.freedesktop.DisplayManager.Seat";
+    const gchar *interface_names[] = { interface_name, NULL };
+
+    g_autoptr(GError) error = NULL;
+    if (!g_dbus_connection_emit_signal (priv->bus,
+                                        NULL,
+                                        "/org/freedesktop/DisplayManager",
+                                        "org.freedesktop.DBus.ObjectManager",
+                                        "InterfacesRemoved",
+                                        g_variant_new ("(o^as)", change->path, interface_names),
+                                        &error))
+        g_warning ("Failed to emit InterfacesRemoved signal: %s", error->message);
+}
+
+static gboolean
+flush_changes_cb (gpointer data)
+{
+    DisplayManagerService *service = data;
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    priv->flush_idle = 0;
+
+    PendingChange *change;
+    while ((change = g_queue_pop_head (priv->pending_changes)))
+    {
+        if (change->is_session && change->entry)
+        {
+            emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SessionAdded", change->path);
+            if (change->seat_path)
+                emit_object_signal (priv->bus, change->seat_path, "SessionAdded", change->path);
+            emit_interfaces_added (service, change);
+        }
+        else if (change->is_session)
+        {
+            emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SessionRemoved", change->path);
+            if (change->seat_path)
+                emit_object_signal (priv->bus, change->seat_path, "SessionRemoved", change->path);
+            emit_interfaces_removed (service, change);
+        }
+        else if (change->entry)
+        {
+            emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SeatAdded", change->path);
+            emit_interfaces_added (service, change);
+        }
+        else
+        {
+            emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SeatRemoved", change->path);
+            emit_interfaces_removed (service, change);
+        }
+        pending_change_free (change);
+    }
+
+    /* Each list is only signalled once however many objects changed */
+    if (priv->seats_changed)
+        emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
+    if (priv->sessions_changed)
+    {
+        emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service));
+        emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "SessionUsers", get_session_users (service));
+    }
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, priv->changed_seat_sessions);
+    gpointer key;
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        SeatBusEntry *entry = find_seat_entry (service, key);
+        emit_object_value_changed (priv->bus, key, "org.freedesktop.DisplayManager.Seat", "Sessions", entry ? get_seat_sessions (entry) : build_session_list (service, key));
+    }
+    priv->seats_changed = FALSE;
+    priv->sessions_changed = FALSE;
+    g_hash_table_remove_all (priv->changed_seat_sessions);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Queue a seat or session being added or removed, signals for all changes are sent together */
+static void
+queue_change (DisplayManagerService *service, const gchar *path, const gchar *seat_path, gboolean is_session, gpointer entry)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    /* The lists are built again the next time they are asked for */
+    if (is_session)
+    {
+        g_clear_pointer (&priv->session_list, g_variant_unref);
+        g_clear_pointer (&priv->session_users, g_variant_unref);
+        SeatBusEntry *seat_entry = seat_path ? find_seat_entry (service, seat_path) : NULL;
+        if (seat_entry)
+            g_clear_pointer (&seat_entry->sessions, g_variant_unref);
+    }
+    else
+        g_clear_pointer (&priv->seat_list, g_variant_unref);
+
+    /* An object removed before it was signalled was never seen, so don't report either change */
+    if (!entry)
+    {
+        for (GList *link = priv->pending_changes->head; link; link = link->next)
+        {
+            PendingChange *change = link->data;
+            if (change->entry && g_strcmp0 (change->path, path) == 0)
+            {
+                g_queue_delete_link (priv->pending_changes, link);
+                pending_change_free (change);
+                return;
+            }
+        }
+    }
+
+    PendingChange *change = g_malloc0 (sizeof (PendingChange));
+    change->path = g_strdup (path);
+    change->seat_path = g_strdup (seat_path);
+    change->is_session = is_session;
+    change->entry = entry;
+    g_queue_push_tail (priv->pending_changes, change);
+
+    if (is_session)
+    {
+        priv->sessions_changed = TRUE;
+        if (seat_path)
+            g_hash_table_add (priv->changed_seat_sessions, g_strdup (seat_path));
+    }
+    else
+        priv->seats_changed = TRUE;
+
+    if (!priv->flush_idle)
+        priv->flush_idle = g_idle_add (flush_changes_cb, service);
+}
+
 static void
 running_user_session_cb (Seat *seat, Session *session, DisplayManagerService *service)
 {
@@ -415,8 +875,21 @@ running_user_session_cb (Seat *seat, Session *session, DisplayManagerService *se
     /* Set environment variables when session runs */
     SeatBusEntry *seat_entry = g_hash_table_lookup (priv->seat_bus_entries, seat);
     session_set_env (session, "XDG_SEAT_PATH", seat_entry->path);
-    g_autofree gchar *path = g_strdup_printf ("/org/freedesktop/DisplayManager/Session%d", priv->session_index);
-    priv->session_index++;
+
+    /* A session kept over a restart keeps the path it was given */
+    g_autofree gchar *path = NULL;
+    const gchar *kept_path = session_get_env (session, "XDG_SESSION_PATH");
+    guint kept_index;
+    if (kept_path && sscanf (kept_path, "/org/freedesktop/DisplayManager/Session%u", &kept_index) == 1)
+    {
+        path = g_strdup (kept_path);
+        priv->session_index = MAX (priv->session_index, kept_index + 1);
+    }
+    else
+    {
+        path = g_strdup_printf ("/org/freedesktop/DisplayManager/Session%d", priv->session_index);
+        priv->session_index++;
+    }
     session_set_env (session, "XDG_SESSION_PATH", path);
     g_object_set_data_full (G_OBJECT (session), "XDG_SESSION_PATH", g_steal_pointer (&path), g_free);
 
@@ -440,11 +913,7 @@ running_user_session_cb (Seat *seat, Session *session, DisplayManagerService *se
     if (session_entry->bus_id == 0)
         g_warning ("Failed to register user session: %s", error->message);
 
-    emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service, NULL));
-    emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SessionAdded", session_entry->path);
-
-    emit_object_value_changed (priv->bus, seat_entry->path, "org.freedesktop.DisplayManager.Seat", "Sessions", get_session_list (service, session_entry->seat_path));
-    emit_object_signal (priv->bus, seat_entry->path, "SessionAdded", session_entry->path);
+    queue_change (service, session_entry->path, session_entry->seat_path, TRUE, session_entry);
 }
 
 static void
@@ -455,22 +924,13 @@ session_removed_cb (Seat *seat, Session *session, DisplayManagerService *service
     g_signal_handlers_disconnect_matched (session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
 
     SessionBusEntry *entry = g_hash_table_lookup (priv->session_bus_entries, session);
-    g_autofree gchar *seat_path = NULL;
     if (entry)
     {
         g_dbus_connection_unregister_object (priv->bus, entry->bus_id);
-        emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SessionRemoved", entry->path);
-        emit_object_signal (priv->bus, entry->seat_path, "SessionRemoved", entry->path);
-        seat_path = g_strdup (entry->seat_path);
+        queue_change (service, entry->path, entry->seat_path, TRUE, NULL);
     }
 
     g_hash_table_remove (priv->session_bus_entries, session);
-
-    if (seat_path)
-    {
-        emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service, NULL));
-        emit_object_value_changed (priv->bus, seat_path, "org.freedesktop.DisplayManager.Seat", "Sessions", get_session_list (service, seat_path));
-    }
 }
 
 static void
@@ -501,11 +961,18 @@ seat_added_cb (DisplayManager *display_manager, Seat *seat, DisplayManagerServic
     if (entry->bus_id == 0)
         g_warning ("Failed to register seat: %s", error->message);
 
-    emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
-    emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SeatAdded", entry->path);
+    queue_change (service, entry->path, NULL, FALSE, entry);
 
     g_signal_connect (seat, SEAT_SIGNAL_RUNNING_USER_SESSION, G_CALLBACK (running_user_session_cb), service);
     g_signal_connect (seat, SEAT_SIGNAL_SESSION_REMOVED, G_CALLBACK (session_removed_cb), service);
+
+    /* Sessions taken over after a restart are already running when the seat is added */
+    for (GList *link = seat_get_sessions (seat); link; link = link->next)
+    {
+        Session *session = link->data;
+        if (!IS_GREETER_SESSION (session) && session_get_is_run (session) && !g_hash_table_contains (priv->session_bus_entries, session))
+            running_user_session_cb (seat, session, service);
+    }
 }
 
 static void
@@ -517,12 +984,10 @@ seat_removed_cb (DisplayManager *display_manager, Seat *seat, DisplayManagerServ
     if (entry)
     {
         g_dbus_connection_unregister_object (priv->bus, entry->bus_id);
-        emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SeatRemoved", entry->path);
+        queue_change (service, entry->path, NULL, FALSE, NULL);
     }
 
     g_hash_table_remove (priv->seat_bus_entries, seat);
-
-    emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
 }
 
 static void
@@ -542,6 +1007,19 @@ bus_acquired_cb (GDBusConnection *connection,
         "  <interface name='org.freedesktop.DisplayManager'>"
         "    <property name='Seats' type='ao' access='read'/>"
         "    <property name='Sessions' type='ao' access='read'/>"
+        "    <property name='SessionUsers' type='a{os}' access='read'/>"
+        "    <property name='VNCQueueLength' type='u' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
+        "    <property name='VNCActiveLaunches' type='u' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
+        "    <property name='VNCRejectedConnections' type='u' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
+        "    <property name='VNCAverageLaunchTime' type='u' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
         "    <method name='AddSeat'>"
         "      <arg name='type' direction='in' type='s'/>"
         "      <arg name='properties' direction='in' type='a(ss)'/>"
@@ -551,6 +1029,18 @@ bus_acquired_cb (GDBusConnection *connection,
         "      <arg name='display-number' direction='in' type='i'/>"
         "      <arg name='seat' direction='out' type='o'/>"
         "    </method>"
+        "    <method name='Reload'/>"
+        "    <method name='Restart'/>"
+        "    <method name='GetLoginTrace'>"
+        "      <arg name='events' direction='out' type='a(xsssu)'/>"
+        "    </method>"
+        "    <method name='GetMetrics'>"
+        "      <arg name='metrics' direction='out' type='s'/>"
+        "    </method>"
+        "    <method name='FlushLogs'/>"
+        "    <method name='GetManagedObjects'>"
+        "      <arg name='objects' direction='out' type='a{oa{sa{sv}}}'/>"
+        "    </method>"
         "    <signal name='SeatAdded'>"
         "      <arg name='seat' type='o'/>"
         "    </signal>"
@@ -574,6 +1064,15 @@ bus_acquired_cb (GDBusConnection *connection,
         "    <property name='CanSwitch' type='b' access='read'/>"
         "    <property name='HasGuestAccount' type='b' access='read'/>"
         "    <property name='Sessions' type='ao' access='read'/>"
+        "    <property name='GreeterFailures' type='u' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
+        "    <property name='GreeterRestartDelay' type='u' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
+        "    <property name='ResourceUsage' type='a{st}' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
         "    <method name='SwitchToGreeter'/>"
         "    <method name='SwitchToUser'>"
         "      <arg name='username' direction='in' type='s'/>"
@@ -599,6 +1098,9 @@ bus_acquired_cb (GDBusConnection *connection,
         "  <interface name='org.freedesktop.DisplayManager.Session'>"
         "    <property name='Seat' type='o' access='read'/>"
         "    <property name='UserName' type='s' access='read'/>"
+        "    <property name='ResourceUsage' type='a{st}' access='read'>"
+        "      <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
+        "    </property>"
         "    <method name='Lock'/>"
         "  </interface>"
         "</node>";
@@ -621,6 +1123,40 @@ bus_acquired_cb (GDBusConnection *connection,
         g_warning ("Failed to register display manager: %s", error->message);
     g_dbus_node_info_unref (display_manager_info);
 
+    /* Allow clients to follow all seats and sessions with a single match rule */
+    const gchar *object_manager_interface =
+        "<node>"
+        "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+        "    <method name='GetManagedObjects'>"
+        "      <arg name='objects' direction='out' type='a{oa{sa{sv}}}'/>"
+        "    </method>"
+        "    <signal name='InterfacesAdded'>"
+        "      <arg name='object' type='o'/>"
+        "      <arg name='interfaces' type='a{sa{sv}}'/>"
+        "    </signal>"
+        "    <signal name='InterfacesRemoved'>"
+        "      <arg name='object' type='o'/>"
+        "      <arg name='interfaces' type='as'/>"
+        "    </signal>"
+        "  </interface>"
+        "</node>";
+    GDBusNodeInfo *object_manager_info = g_dbus_node_info_new_for_xml (object_manager_interface, NULL);
+    g_assert (object_manager_info != NULL);
+
+    static const GDBusInterfaceVTable object_manager_vtable =
+    {
+        handle_object_manager_call
+    };
+    priv->object_manager_reg_id = g_dbus_connection_register_object (connection,
+                                                                     "/org/freedesktop/DisplayManager",
+                                                                     object_manager_info->interfaces[0],
+                                                                     &object_manager_vtable,
+                                                                     service, NULL,
+                                                                     &error);
+    if (priv->object_manager_reg_id == 0)
+        g_warning ("Failed to register object manager: %s", error->message);
+    g_dbus_node_info_unref (object_manager_info);
+
     /* Add objects for existing seats and listen to new ones */
     g_signal_connect (priv->manager, DISPLAY_MANAGER_SIGNAL_SEAT_ADDED, G_CALLBACK (seat_added_cb), service);
     g_signal_connect (priv->manager, DISPLAY_MANAGER_SIGNAL_SEAT_REMOVED, G_CALLBACK (seat_removed_cb), service);
@@ -663,12 +1199,27 @@ display_manager_service_start (DisplayManagerService *service)
                                    NULL);
 }
 
+void
+display_manager_service_get_n_bus_entries (DisplayManagerService *service, guint *n_seats, guint *n_sessions)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    g_return_if_fail (service != NULL);
+
+    if (n_seats)
+        *n_seats = g_hash_table_size (priv->seat_bus_entries);
+    if (n_sessions)
+        *n_sessions = g_hash_table_size (priv->session_bus_entries);
+}
+
 static void
 display_manager_service_init (DisplayManagerService *service)
 {
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
     priv->seat_bus_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, seat_bus_entry_free);
     priv->session_bus_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, session_bus_entry_free);
+    priv->pending_changes = g_queue_new ();
+    priv->changed_seat_sessions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -677,7 +1228,12 @@ display_manager_service_finalize (GObject *object)
     DisplayManagerService *self = DISPLAY_MANAGER_SERVICE (object);
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (self);
 
+    if (priv->flush_idle)
+        g_source_remove (priv->flush_idle);
+    g_queue_free_full (priv->pending_changes, (GDestroyNotify) pending_change_free);
+    g_hash_table_unref (priv->changed_seat_sessions);
     g_dbus_connection_unregister_object (priv->bus, priv->reg_id);
+    g_dbus_connection_unregister_object (priv->bus, priv->object_manager_reg_id);
     g_bus_unown_name (priv->bus_id);
     if (priv->seat_info)
         g_dbus_node_info_unref (priv->seat_info);
@@ -685,8 +1241,12 @@ display_manager_service_finalize (GObject *object)
         g_dbus_node_info_unref (priv->session_info);
     g_hash_table_unref (priv->seat_bus_entries);
     g_hash_table_unref (priv->session_bus_entries);
+    g_clear_pointer (&priv->seat_list, g_variant_unref);
+    g_clear_pointer (&priv->session_list, g_variant_unref);
+    g_clear_pointer (&priv->session_users, g_variant_unref);
     g_object_unref (priv->bus);
     g_clear_object (&priv->manager);
+    g_clear_object (&priv->vnc_server);
 
     G_OBJECT_CLASS (display_manager_service_parent_class)->finalize (object);
 }
@@ -725,4 +1285,22 @@ display_manager_service_class_init (DisplayManagerServiceClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 0);
+
+    signals[RELOAD] =
+        g_signal_new (DISPLAY_MANAGER_SERVICE_SIGNAL_RELOAD,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (DisplayManagerServiceClass, reload),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+
+    signals[RESTART] =
+        g_signal_new (DISPLAY_MANAGER_SERVICE_SIGNAL_RESTART,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (DisplayManagerServiceClass, restart),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
 }
@@ -14,6 +14,7 @@
 #include <glib-object.h>
 
 #include "display-manager.h"
+#include "vnc-server.h"
 
 G_BEGIN_DECLS
 
@@ -23,6 +24,8 @@ G_BEGIN_DECLS
 #define DISPLAY_MANAGER_SERVICE_SIGNAL_READY           "ready"
 #define DISPLAY_MANAGER_SERVICE_SIGNAL_ADD_XLOCAL_SEAT "add-xlocal-seat"
 #define DISPLAY_MANAGER_SERVICE_SIGNAL_NAME_LOST       "name-lost"
+#define DISPLAY_MANAGER_SERVICE_SIGNAL_RELOAD          "reload"
+#define DISPLAY_MANAGER_SERVICE_SIGNAL_RESTART         "restart"
 
 typedef struct
 {
@@ -36,14 +39,20 @@ typedef struct
     void  (*ready)(DisplayManagerService *service);
     Seat *(*add_xlocal_seat)(DisplayManagerService *service, gint display_number);
     void  (*name_lost)(DisplayManagerService *service);
+    void  (*reload)(DisplayManagerService *service);
+    void  (*restart)(DisplayManagerService *service);
 } DisplayManagerServiceClass;
 
 GType display_manager_service_get_type (void);
 
 DisplayManagerService *display_manager_service_new (DisplayManager *manager);
 
+void display_manager_service_set_vnc_server (DisplayManagerService *service, VNCServer *server);
+
 void display_manager_service_start (DisplayManagerService *service);
 
+void display_manager_service_get_n_bus_entries (DisplayManagerService *service, guint *n_seats, guint *n_sessions);
+
 G_END_DECLS
 
 #endif /* DISPLAY_MANAGER_SERVICE_H_ */
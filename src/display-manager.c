@@ -20,6 +20,7 @@
 #include "seat-local.h"
 #include "seat-xremote.h"
 #include "plymouth.h"
+#include "process.h"
 
 enum {
     SEAT_ADDED,
@@ -29,14 +30,45 @@ enum {
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Progress of a seat through startup */
+typedef struct
+{
+    DisplayManager *manager;
+    Seat *seat;
+
+    /* Time the seat was added */
+    gint64 added_time;
+
+    /* Time seat_start() returned */
+    gint64 started_time;
+
+    /* Handler waiting for the first session */
+    gulong session_added_handler;
+} SeatStartup;
+
 typedef struct
 {
     /* The seats available */
     GList *seats;
 
+    /* The seats by name */
+    GHashTable *seats_by_name;
+
+    /* Seats that have not started their first session yet */
+    GList *starting_seats;
+
+    /* Time the first of the starting seats was added */
+    gint64 startup_time;
+
     /* TRUE if stopping the display manager (waiting for seats to stop) */
     gboolean stopping;
 
+    /* Time display_manager_stop() was called */
+    gint64 stop_time;
+
+    /* Timeout to kill whatever is still running when stopping */
+    guint stop_timeout;
+
     /* TRUE if stopped */
     gboolean stopped;
 } DisplayManagerPrivate;
@@ -60,16 +92,56 @@ Seat *
 display_manager_get_seat (DisplayManager *manager, const gchar *name)
 {
     DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+    return g_hash_table_lookup (priv->seats_by_name, name);
+}
 
-    for (GList *link = priv->seats; link; link = link->next)
-    {
-        Seat *seat = link->data;
+Seat *
+display_manager_get_seat_for_session (DisplayManager *manager, Session *session)
+{
+    const gchar *seat_name = session_get_seat_name (session);
+    if (!seat_name)
+        return NULL;
 
-        if (strcmp (seat_get_name (seat), name) == 0)
-            return seat;
-    }
+    Seat *seat = display_manager_get_seat (manager, seat_name);
+    if (!seat || !g_list_find (seat_get_sessions (seat), session))
+        return NULL;
 
-    return NULL;
+    return seat;
+}
+
+/* If more than one seat has a name the first added is found, as when the list was searched */
+static void
+index_seat (DisplayManager *manager, Seat *seat)
+{
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+
+    const gchar *name = seat_get_name (seat);
+    if (name && !g_hash_table_contains (priv->seats_by_name, name))
+        g_hash_table_insert (priv->seats_by_name, g_strdup (name), seat);
+}
+
+static void
+unindex_seat (DisplayManager *manager, Seat *seat)
+{
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+
+    const gchar *name = seat_get_name (seat);
+    if (!name || g_hash_table_lookup (priv->seats_by_name, name) != seat)
+        return;
+
+    g_hash_table_remove (priv->seats_by_name, name);
+    for (GList *link = priv->seats; link; link = link->next)
+        if (g_strcmp0 (seat_get_name (link->data), name) == 0)
+        {
+            g_hash_table_insert (priv->seats_by_name, g_strdup (name), link->data);
+            break;
+        }
+}
+
+static gdouble
+elapsed_seconds (gint64 start, gint64 end)
+{
+    return (end - start) / (gdouble) G_USEC_PER_SEC;
 }
 
 static void
@@ -82,17 +154,77 @@ check_stopped (DisplayManager *manager)
         g_list_length (priv->seats) == 0)
     {
         priv->stopped = TRUE;
-        g_debug ("Display manager stopped");
+        if (priv->stop_timeout)
+            g_source_remove (priv->stop_timeout);
+        priv->stop_timeout = 0;
+        g_debug ("Display manager stopped in %.3fs", elapsed_seconds (priv->stop_time, g_get_monotonic_time ()));
         g_signal_emit (manager, signals[STOPPED], 0);
     }
 }
 
+static void
+seat_startup_free (SeatStartup *startup)
+{
+    if (startup->session_added_handler)
+        g_signal_handler_disconnect (startup->seat, startup->session_added_handler);
+    g_free (startup);
+}
+
+static void
+finish_seat_startup (SeatStartup *startup)
+{
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (startup->manager);
+
+    priv->starting_seats = g_list_remove (priv->starting_seats, startup);
+    if (!priv->starting_seats)
+    {
+        g_debug ("All seats started in %.3fs", elapsed_seconds (priv->startup_time, g_get_monotonic_time ()));
+        priv->startup_time = 0;
+    }
+
+    seat_startup_free (startup);
+}
+
+static void
+seat_session_added_cb (Seat *seat, Session *session, SeatStartup *startup)
+{
+    gint64 now = g_get_monotonic_time ();
+    l_debug (seat, "Started first session in %.3fs (setup %.3fs, display server %.3fs)",
+             elapsed_seconds (startup->added_time, now),
+             elapsed_seconds (startup->added_time, startup->started_time),
+             elapsed_seconds (startup->started_time, now));
+    finish_seat_startup (startup);
+}
+
+static SeatStartup *
+find_seat_startup (DisplayManager *manager, Seat *seat)
+{
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+
+    for (GList *link = priv->starting_seats; link; link = link->next)
+    {
+        SeatStartup *startup = link->data;
+        if (startup->seat == seat)
+            return startup;
+    }
+
+    return NULL;
+}
+
 static void
 seat_stopped_cb (Seat *seat, DisplayManager *manager)
 {
     DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
 
+    SeatStartup *startup = find_seat_startup (manager, seat);
+    if (startup)
+        finish_seat_startup (startup);
+
+    if (priv->stopping)
+        l_debug (seat, "Stopped in %.3fs", elapsed_seconds (priv->stop_time, g_get_monotonic_time ()));
+
     priv->seats = g_list_remove (priv->seats, seat);
+    unindex_seat (manager, seat);
     g_signal_handlers_disconnect_matched (seat, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, manager);
 
     if (!priv->stopping)
@@ -110,11 +242,36 @@ display_manager_add_seat (DisplayManager *manager, Seat *seat)
 
     g_return_val_if_fail (!priv->stopping, FALSE);
 
+    /* Track how long each phase of starting takes; seats added together are
+     * started one after another but their display servers start concurrently */
+    SeatStartup *startup = g_malloc0 (sizeof (SeatStartup));
+    startup->manager = manager;
+    startup->seat = seat;
+    startup->added_time = g_get_monotonic_time ();
+    if (!priv->starting_seats)
+        priv->startup_time = startup->added_time;
+
     gboolean result = seat_start (SEAT (seat));
+    startup->started_time = g_get_monotonic_time ();
     if (!result)
+    {
+        seat_startup_free (startup);
+        if (!priv->starting_seats)
+            priv->startup_time = 0;
         return FALSE;
+    }
+
+    l_debug (seat, "Setup took %.3fs", elapsed_seconds (startup->added_time, startup->started_time));
+    if (seat_get_sessions (seat))
+        seat_startup_free (startup);
+    else
+    {
+        startup->session_added_handler = g_signal_connect (seat, SEAT_SIGNAL_SESSION_ADDED, G_CALLBACK (seat_session_added_cb), startup);
+        priv->starting_seats = g_list_append (priv->starting_seats, startup);
+    }
 
     priv->seats = g_list_append (priv->seats, g_object_ref (seat));
+    index_seat (manager, seat);
     g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (seat_stopped_cb), manager);
     g_signal_emit (manager, signals[SEAT_ADDED], 0, seat);
 
@@ -134,6 +291,27 @@ display_manager_start (DisplayManager *manager)
     }
 }
 
+static gboolean
+stop_timeout_cb (gpointer data)
+{
+    DisplayManager *manager = data;
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+
+    priv->stop_timeout = 0;
+
+    g_warning ("%u seats still running after %ds, killing remaining processes",
+               g_list_length (priv->seats), config_get_integer (config_get_instance (), "LightDM", "shutdown-timeout"));
+    for (GList *link = priv->seats; link; link = link->next)
+    {
+        Seat *seat = link->data;
+        l_debug (seat, "Killing; still stopping after %.3fs", elapsed_seconds (priv->stop_time, g_get_monotonic_time ()));
+        seat_kill (seat);
+    }
+    process_kill_all ();
+
+    return G_SOURCE_REMOVE;
+}
+
 void
 display_manager_stop (DisplayManager *manager)
 {
@@ -147,6 +325,12 @@ display_manager_stop (DisplayManager *manager)
     g_debug ("Stopping display manager");
 
     priv->stopping = TRUE;
+    priv->stop_time = g_get_monotonic_time ();
+
+    /* Every seat is signalled at once, anything still running when the deadline passes is killed */
+    gint timeout = config_get_integer (config_get_instance (), "LightDM", "shutdown-timeout");
+    if (timeout > 0)
+        priv->stop_timeout = g_timeout_add_seconds (timeout, stop_timeout_cb, manager);
 
     /* Stop all the seats. Copy the list as it might be modified if a seat stops during this loop */
     GList *seats = g_list_copy (priv->seats);
@@ -163,6 +347,10 @@ display_manager_stop (DisplayManager *manager)
 static void
 display_manager_init (DisplayManager *manager)
 {
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+
+    priv->seats_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
     /* Load the seat modules */
     seat_register_module ("local", SEAT_LOCAL_TYPE);
     seat_register_module ("xremote", SEAT_XREMOTE_TYPE);
@@ -174,12 +362,16 @@ display_manager_finalize (GObject *object)
     DisplayManager *self = DISPLAY_MANAGER (object);
     DisplayManagerPrivate *priv = display_manager_get_instance_private (self);
 
+    if (priv->stop_timeout)
+        g_source_remove (priv->stop_timeout);
+    g_list_free_full (priv->starting_seats, (GDestroyNotify) seat_startup_free);
     for (GList *link = priv->seats; link; link = link->next)
     {
         Seat *seat = link->data;
         g_signal_handlers_disconnect_matched (seat, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     }
     g_list_free_full (priv->seats, g_object_unref);
+    g_hash_table_unref (priv->seats_by_name);
 
     G_OBJECT_CLASS (display_manager_parent_class)->finalize (object);
 }
@@ -49,6 +49,8 @@ GList *display_manager_get_seats (DisplayManager *manager);
 
 Seat *display_manager_get_seat (DisplayManager *manager, const gchar *name);
 
+Seat *display_manager_get_seat_for_session (DisplayManager *manager, Session *session);
+
 void display_manager_start (DisplayManager *manager);
 
 void display_manager_stop (DisplayManager *manager);
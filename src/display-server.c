@@ -12,6 +12,7 @@
 #include <config.h>
 
 #include "display-server.h"
+#include "metrics.h"
 
 enum {
     READY,
@@ -25,11 +26,17 @@ typedef struct
     /* TRUE when started */
     gboolean is_ready;
 
+    /* Time started for metrics */
+    gint64 start_time;
+
     /* TRUE when being stopped */
     gboolean stopping;
 
     /* TRUE when the display server has stopped */
     gboolean stopped;
+
+    /* Limits to apply to the display server process */
+    ResourceControl *resource_control;
 } DisplayServerPrivate;
 
 static void display_server_logger_iface_init (LoggerInterface *iface);
@@ -83,10 +90,26 @@ display_server_real_get_vt (DisplayServer *server)
     return -1;
 }
 
+/* TRUE if sessions can be connected to this display server before it is ready */
+gboolean
+display_server_get_has_address (DisplayServer *server)
+{
+    g_return_val_if_fail (server != NULL, FALSE);
+    return DISPLAY_SERVER_GET_CLASS (server)->get_has_address (server);
+}
+
+static gboolean
+display_server_real_get_has_address (DisplayServer *server)
+{
+    return TRUE;
+}
+
 gboolean
 display_server_start (DisplayServer *server)
 {
+    DisplayServerPrivate *priv = display_server_get_instance_private (server);
     g_return_val_if_fail (server != NULL, FALSE);
+    priv->start_time = g_get_monotonic_time ();
     return DISPLAY_SERVER_GET_CLASS (server)->start (server);
 }
 
@@ -103,10 +126,50 @@ display_server_real_start (DisplayServer *server)
 {
     DisplayServerPrivate *priv = display_server_get_instance_private (server);
     priv->is_ready = TRUE;
+    g_autofree gchar *labels = g_strdup_printf ("type=\"%s\"", display_server_get_session_type (server));
+    common_metrics_observe_since ("lightdm_display_server_start_duration_seconds", labels, priv->start_time);
     g_signal_emit (server, signals[READY], 0);
     return TRUE;
 }
 
+/* Mark a display server that was already running before the daemon restarted as ready,
+ * there is nothing waiting on it so ready is not emitted */
+void
+display_server_adopt (DisplayServer *server)
+{
+    DisplayServerPrivate *priv = display_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->is_ready = TRUE;
+}
+
+/* Return a running display server to its initial state, it emits ready again once done */
+gboolean
+display_server_reset (DisplayServer *server)
+{
+    DisplayServerPrivate *priv = display_server_get_instance_private (server);
+
+    g_return_val_if_fail (server != NULL, FALSE);
+
+    if (priv->stopping || !priv->is_ready)
+        return FALSE;
+
+    priv->is_ready = FALSE;
+    priv->start_time = g_get_monotonic_time ();
+    if (!DISPLAY_SERVER_GET_CLASS (server)->reset (server))
+    {
+        priv->is_ready = TRUE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+display_server_real_reset (DisplayServer *server)
+{
+    return FALSE;
+}
+
 void
 display_server_connect_session (DisplayServer *server, Session *session)
 {
@@ -157,21 +220,71 @@ display_server_real_stop (DisplayServer *server)
     g_signal_emit (server, signals[STOPPED], 0);
 }
 
+static const ProcessUsage *
+display_server_real_get_usage (DisplayServer *server)
+{
+    return NULL;
+}
+
+/* Resources used by the process running this display server or NULL if it doesn't have one */
+const ProcessUsage *
+display_server_get_usage (DisplayServer *server)
+{
+    g_return_val_if_fail (server != NULL, NULL);
+    return DISPLAY_SERVER_GET_CLASS (server)->get_usage (server);
+}
+
+void
+display_server_set_resource_control (DisplayServer *server, ResourceControl *control)
+{
+    DisplayServerPrivate *priv = display_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_clear_object (&priv->resource_control);
+    if (control)
+        priv->resource_control = g_object_ref (control);
+}
+
+ResourceControl *
+display_server_get_resource_control (DisplayServer *server)
+{
+    DisplayServerPrivate *priv = display_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, NULL);
+    return priv->resource_control;
+}
+
 static void
 display_server_init (DisplayServer *server)
 {
 }
 
+static void
+display_server_finalize (GObject *object)
+{
+    DisplayServer *self = DISPLAY_SERVER (object);
+    DisplayServerPrivate *priv = display_server_get_instance_private (self);
+
+    g_clear_object (&priv->resource_control);
+
+    G_OBJECT_CLASS (display_server_parent_class)->finalize (object);
+}
+
 static void
 display_server_class_init (DisplayServerClass *klass)
 {
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = display_server_finalize;
+
     klass->get_parent = display_server_real_get_parent;  
     klass->get_can_share = display_server_real_get_can_share;
     klass->get_vt = display_server_real_get_vt;
+    klass->get_has_address = display_server_real_get_has_address;
     klass->start = display_server_real_start;
+    klass->reset = display_server_real_reset;
     klass->connect_session = display_server_real_connect_session;
     klass->disconnect_session = display_server_real_disconnect_session;
     klass->stop = display_server_real_stop;
+    klass->get_usage = display_server_real_get_usage;
 
     signals[READY] =
         g_signal_new (DISPLAY_SERVER_SIGNAL_READY,
@@ -201,4 +314,5 @@ static void
 display_server_logger_iface_init (LoggerInterface *iface)
 {
     iface->logprefix = &display_server_real_logprefix;
+    iface->subsystem = LOG_SUBSYSTEM_DISPLAY_SERVER;
 }
@@ -18,6 +18,8 @@ typedef struct DisplayServer DisplayServer;
 
 #include "logger.h"
 #include "session.h"
+#include "resource-control.h"
+#include "process-usage.h"
 
 G_BEGIN_DECLS
 
@@ -45,10 +47,13 @@ typedef struct
     const gchar *(*get_session_type)(DisplayServer *server);
     gboolean (*get_can_share)(DisplayServer *server);
     gint (*get_vt)(DisplayServer *server);
+    gboolean (*get_has_address)(DisplayServer *server);
     gboolean (*start)(DisplayServer *server);
+    gboolean (*reset)(DisplayServer *server);
     void (*connect_session)(DisplayServer *server, Session *session);
     void (*disconnect_session)(DisplayServer *server, Session *session);
     void (*stop)(DisplayServer *server);
+    const ProcessUsage *(*get_usage)(DisplayServer *server);
 } DisplayServerClass;
 
 GType display_server_get_type (void);
@@ -61,18 +66,30 @@ gboolean display_server_get_can_share (DisplayServer *server);
 
 gint display_server_get_vt (DisplayServer *server);
 
+gboolean display_server_get_has_address (DisplayServer *server);
+
 gboolean display_server_start (DisplayServer *server);
 
 gboolean display_server_get_is_ready (DisplayServer *server);
 
+void display_server_adopt (DisplayServer *server);
+
+gboolean display_server_reset (DisplayServer *server);
+
 void display_server_connect_session (DisplayServer *server, Session *session);
 
 void display_server_disconnect_session (DisplayServer *server, Session *session);
 
 void display_server_stop (DisplayServer *server);
 
+const ProcessUsage *display_server_get_usage (DisplayServer *server);
+
 gboolean display_server_get_is_stopping (DisplayServer *server);
 
+void display_server_set_resource_control (DisplayServer *server, ResourceControl *control);
+
+ResourceControl *display_server_get_resource_control (DisplayServer *server);
+
 G_END_DECLS
 
 #endif /* DISPLAY_SERVER_H_ */
@@ -11,6 +11,7 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <glib.h>
 #include <glib/gi18n.h>
@@ -97,6 +98,57 @@ get_seat_proxy (void)
     return seat_proxy;
 }
 
+static const gchar *
+get_object_name (const gchar *path)
+{
+    if (g_str_has_prefix (path, "/org/freedesktop/DisplayManager/"))
+        return path + strlen ("/org/freedesktop/DisplayManager/");
+    else
+        return path;
+}
+
+/* Find the properties for an object in the result of GetManagedObjects */
+static GVariant *
+get_object_properties (GVariant *objects, const gchar *path, const gchar *interface_name)
+{
+    g_autoptr(GVariant) interfaces = g_variant_lookup_value (objects, path, G_VARIANT_TYPE ("a{sa{sv}}"));
+    if (!interfaces)
+        return NULL;
+
+    return g_variant_lookup_value (interfaces, interface_name, G_VARIANT_TYPE ("a{sv}"));
+}
+
+static void
+print_properties (GVariant *properties, const gchar *skip_name, const gchar *indent)
+{
+    GVariantIter iter;
+    g_variant_iter_init (&iter, properties);
+    const gchar *name;
+    GVariant *value;
+    while (g_variant_iter_loop (&iter, "{&sv}", &name, &value))
+    {
+        if (strcmp (name, skip_name) == 0)
+            continue;
+
+        g_autofree gchar *value_string = g_variant_print (value, FALSE);
+        g_print ("%s%s=%s\n", indent, name, value_string);
+    }
+}
+
+static void
+monitor_signal_cb (GDBusProxy *proxy, const gchar *sender_name, const gchar *signal_name, GVariant *parameters, gpointer user_data)
+{
+    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
+        return;
+
+    const gchar *path;
+    g_variant_get (parameters, "(&o)", &path);
+    g_print ("%s %s\n", signal_name, get_object_name (path));
+
+    /* Make each event visible straight away when output is piped */
+    fflush (stdout);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -128,6 +180,7 @@ main (int argc, char **argv)
                         "  switch-to-guest [SESSION]                            Switch to a guest session\n"
                         "  lock                                                 Lock the current seat\n"
                         "  list-seats                                           List the active seats\n"
+                        "  monitor                                              Show seats and sessions as they are added and removed\n"
                         "  add-nested-seat [--fullscreen|--screen DIMENSIONS]   Start a nested display\n"
                         "  add-local-x-seat DISPLAY_NUMBER                      Add a local X seat\n"
                         "  add-seat TYPE [NAME=VALUE...]                        Add a dynamic seat\n");
@@ -279,44 +332,41 @@ main (int argc, char **argv)
             g_printerr ("Unable to contact display manager\n");
             return EXIT_FAILURE;
         }
-        g_autoptr(GVariant) seats = g_dbus_proxy_get_cached_property (dm_proxy, "Seats");
 
+        /* Get all seats and sessions in one call rather than querying each one */
+        g_autoptr(GVariant) result = g_dbus_proxy_call_sync (dm_proxy,
+                                                             "GetManagedObjects",
+                                                             g_variant_new ("()"),
+                                                             G_DBUS_CALL_FLAGS_NONE,
+                                                             -1,
+                                                             NULL,
+                                                             &error);
+        if (!result)
+        {
+            g_printerr ("Unable to list seats: %s\n", error->message);
+            return EXIT_FAILURE;
+        }
+        if (!g_variant_is_of_type (result, G_VARIANT_TYPE ("(a{oa{sa{sv}}})")))
+        {
+            g_printerr ("Unexpected response to GetManagedObjects: %s\n", g_variant_get_type_string (result));
+            return EXIT_FAILURE;
+        }
+        g_autoptr(GVariant) objects = g_variant_get_child_value (result, 0);
+
+        g_autoptr(GVariant) seats = g_dbus_proxy_get_cached_property (dm_proxy, "Seats");
         g_autoptr(GVariantIter) seat_iter = NULL;
         g_variant_get (seats, "ao", &seat_iter);
-        gchar *seat_path;
+        const gchar *seat_path;
         while (g_variant_iter_loop (seat_iter, "&o", &seat_path))
         {
-            gchar *seat_name;
-            g_autoptr(GDBusProxy) proxy = NULL;
-
-            if (g_str_has_prefix (seat_path, "/org/freedesktop/DisplayManager/"))
-                seat_name = seat_path + strlen ("/org/freedesktop/DisplayManager/");
-            else
-                seat_name = seat_path;
-
-            proxy = g_dbus_proxy_new_sync (g_dbus_proxy_get_connection (dm_proxy),
-                                           G_DBUS_PROXY_FLAGS_NONE,
-                                           NULL,
-                                           "org.freedesktop.DisplayManager",
-                                           seat_path,
-                                           "org.freedesktop.DisplayManager.Seat",
-                                           NULL,
-                                           NULL);
-            if (!proxy || !g_dbus_proxy_get_name_owner (proxy))
+            g_autoptr(GVariant) seat_properties = get_object_properties (objects, seat_path, "org.freedesktop.DisplayManager.Seat");
+            if (!seat_properties)
                 continue;
 
-            g_print ("%s\n", seat_name);
-            g_auto(GStrv) property_names = g_dbus_proxy_get_cached_property_names (proxy);
-            for (int i = 0; property_names[i]; i++)
-            {
-                if (strcmp (property_names[i], "Sessions") == 0)
-                    continue;
-
-                g_autoptr(GVariant) value = g_dbus_proxy_get_cached_property (proxy, property_names[i]);
-                g_print ("  %s=%s\n", property_names[i], g_variant_print (value, FALSE));
-            }
+            g_print ("%s\n", get_object_name (seat_path));
+            print_properties (seat_properties, "Sessions", "  ");
 
-            g_autoptr(GVariant) sessions = g_dbus_proxy_get_cached_property (proxy, "Sessions");
+            g_autoptr(GVariant) sessions = g_variant_lookup_value (seat_properties, "Sessions", G_VARIANT_TYPE ("ao"));
             if (!sessions)
                 continue;
 
@@ -325,38 +375,32 @@ main (int argc, char **argv)
             const gchar *session_path;
             while (g_variant_iter_loop (session_iter, "&o", &session_path))
             {
-                const gchar *session_name;
-                if (g_str_has_prefix (session_path, "/org/freedesktop/DisplayManager/"))
-                    session_name = session_path + strlen ("/org/freedesktop/DisplayManager/");
-                else
-                    session_name = session_path;
-
-                g_autoptr(GDBusProxy) session_proxy = g_dbus_proxy_new_sync (g_dbus_proxy_get_connection (dm_proxy),
-                                                                             G_DBUS_PROXY_FLAGS_NONE,
-                                                                             NULL,
-                                                                             "org.freedesktop.DisplayManager",
-                                                                             session_path,
-                                                                             "org.freedesktop.DisplayManager.Session",
-                                                                             NULL,
-                                                                             NULL);
-                if (!session_proxy || !g_dbus_proxy_get_name_owner (session_proxy))
+                g_autoptr(GVariant) session_properties = get_object_properties (objects, session_path, "org.freedesktop.DisplayManager.Session");
+                if (!session_properties)
                     continue;
 
-                g_print ("  %s\n", session_name);
-                g_auto(GStrv) property_names = g_dbus_proxy_get_cached_property_names (session_proxy);
-                for (int i = 0; property_names[i]; i++)
-                {
-                    if (strcmp (property_names[i], "Seat") == 0)
-                        continue;
-
-                    g_autoptr(GVariant) value = g_dbus_proxy_get_cached_property (session_proxy, property_names[i]);
-                    g_print ("    %s=%s\n", property_names[i], g_variant_print (value, FALSE));
-                }
+                g_print ("  %s\n", get_object_name (session_path));
+                print_properties (session_properties, "Seat", "    ");
             }
         }
 
         return EXIT_SUCCESS;
     }
+    else if (strcmp (command, "monitor") == 0)
+    {
+        if (n_options != 0)
+        {
+            g_printerr ("Usage monitor\n");
+            usage ();
+            return EXIT_FAILURE;
+        }
+
+        g_signal_connect (dm_proxy, "g-signal", G_CALLBACK (monitor_signal_cb), NULL);
+        g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+        g_main_loop_run (loop);
+
+        return EXIT_SUCCESS;
+    }
     else if (strcmp (command, "add-nested-seat") == 0)
     {
         const gchar *path = g_find_program_in_path ("Xephyr");
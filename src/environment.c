@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+
+#include "environment.h"
+
+struct Environment
+{
+    /* Name to "NAME=VALUE" entry */
+    GHashTable *entries;
+
+    /* NULL terminated array of entries, built when first needed after a change */
+    GPtrArray *envp;
+};
+
+Environment *
+environment_new (void)
+{
+    Environment *env = g_malloc0 (sizeof (Environment));
+    env->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    return env;
+}
+
+void
+environment_set (Environment *env, const gchar *name, const gchar *value)
+{
+    g_return_if_fail (env != NULL);
+    g_return_if_fail (name != NULL);
+
+    if (!value)
+    {
+        environment_unset (env, name);
+        return;
+    }
+
+    g_hash_table_insert (env->entries, g_strdup (name), g_strdup_printf ("%s=%s", name, value));
+    g_clear_pointer (&env->envp, g_ptr_array_unref);
+}
+
+const gchar *
+environment_get (Environment *env, const gchar *name)
+{
+    g_return_val_if_fail (env != NULL, NULL);
+    g_return_val_if_fail (name != NULL, NULL);
+
+    const gchar *entry = g_hash_table_lookup (env->entries, name);
+    if (!entry)
+        return NULL;
+
+    return entry + strlen (name) + 1;
+}
+
+void
+environment_unset (Environment *env, const gchar *name)
+{
+    g_return_if_fail (env != NULL);
+    g_return_if_fail (name != NULL);
+
+    if (g_hash_table_remove (env->entries, name))
+        g_clear_pointer (&env->envp, g_ptr_array_unref);
+}
+
+gboolean
+environment_contains (Environment *env, const gchar *name)
+{
+    g_return_val_if_fail (env != NULL, FALSE);
+    return g_hash_table_contains (env->entries, name);
+}
+
+guint
+environment_get_length (Environment *env)
+{
+    g_return_val_if_fail (env != NULL, 0);
+    return g_hash_table_size (env->entries);
+}
+
+/* The entries are owned by the environment and valid until it is next changed */
+const gchar * const *
+environment_get_envp (Environment *env)
+{
+    g_return_val_if_fail (env != NULL, NULL);
+
+    if (!env->envp)
+    {
+        env->envp = g_ptr_array_sized_new (g_hash_table_size (env->entries) + 1);
+        GHashTableIter iter;
+        gpointer entry;
+        g_hash_table_iter_init (&iter, env->entries);
+        while (g_hash_table_iter_next (&iter, NULL, &entry))
+            g_ptr_array_add (env->envp, entry);
+        g_ptr_array_add (env->envp, NULL);
+    }
+
+    return (const gchar * const *) env->envp->pdata;
+}
+
+void
+environment_free (Environment *env)
+{
+    if (!env)
+        return;
+
+    g_clear_pointer (&env->envp, g_ptr_array_unref);
+    g_hash_table_unref (env->entries);
+    g_free (env);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef ENVIRONMENT_H_
+#define ENVIRONMENT_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Environment variables to pass to a child, looked up by name */
+typedef struct Environment Environment;
+
+Environment *environment_new (void);
+
+void environment_set (Environment *env, const gchar *name, const gchar *value);
+
+const gchar *environment_get (Environment *env, const gchar *name);
+
+void environment_unset (Environment *env, const gchar *name);
+
+gboolean environment_contains (Environment *env, const gchar *name);
+
+guint environment_get_length (Environment *env);
+
+const gchar * const *environment_get_envp (Environment *env);
+
+void environment_free (Environment *env);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Environment, environment_free)
+
+G_END_DECLS
+
+#endif /* ENVIRONMENT_H_ */
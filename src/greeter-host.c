@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "greeter-host.h"
+#include "accounts.h"
+#include "configuration.h"
+
+/* Messages on the shared connection are framed as [display id][length][data].
+ * Display id 0 is used for control messages, the data for the other ids is the
+ * normal greeter protocol for that display */
+#define HOST_HEADER_SIZE 8
+#define HOST_CONTROL_ID 0
+
+/* Most data to hold for a reader that isn't keeping up before giving up on it */
+#define MAX_WRITE_BUFFER_SIZE (16 * 1024 * 1024)
+
+/* Control messages sent to the shared greeter */
+typedef enum
+{
+    HOST_MESSAGE_ADD_DISPLAY = 0,
+    HOST_MESSAGE_REMOVE_DISPLAY
+} HostMessage;
+
+typedef struct
+{
+    /* Path of socket to use */
+    gchar *path;
+
+    /* Listening UNIX socket */
+    GSocket *socket;
+
+    /* Source for listening for connections */
+    GSource *source;
+
+    /* Connection from the shared greeter */
+    GSocket *connection;
+    GSource *connection_source;
+
+    /* Data waiting until the shared greeter can accept it */
+    GByteArray *write_buffer;
+    GSource *write_source;
+
+    /* Data read from the shared greeter that is not yet a full message */
+    GByteArray *read_buffer;
+
+    /* Displays being relayed keyed by id */
+    GHashTable *displays;
+
+    /* Id to use for the next display */
+    guint next_id;
+} GreeterHostPrivate;
+
+/* A greeter being relayed over the shared connection */
+typedef struct
+{
+    GreeterHost *host;
+    guint id;
+
+    /* Our end of the socket pair to the daemon side */
+    int fd;
+    GIOChannel *channel;
+    guint watch;
+
+    /* Data waiting until the daemon side can accept it */
+    GByteArray *write_buffer;
+    guint write_watch;
+
+    /* TRUE if the shared greeter has been told about this display */
+    gboolean announced;
+} HostDisplay;
+
+G_DEFINE_TYPE_WITH_PRIVATE (GreeterHost, greeter_host, G_TYPE_OBJECT)
+
+static GreeterHost *singleton = NULL;
+
+GreeterHost *
+greeter_host_get_instance (void)
+{
+    if (!singleton)
+        singleton = g_object_new (GREETER_HOST_TYPE, NULL);
+    return singleton;
+}
+
+void
+greeter_host_cleanup (void)
+{
+    g_clear_object (&singleton);
+}
+
+static void
+host_display_free (HostDisplay *display)
+{
+    if (display->watch)
+        g_source_remove (display->watch);
+    if (display->write_watch)
+        g_source_remove (display->write_watch);
+    g_byte_array_unref (display->write_buffer);
+    g_clear_pointer (&display->channel, g_io_channel_unref);
+    if (display->fd >= 0)
+        close (display->fd);
+    g_free (display);
+}
+
+static void
+append_int (GByteArray *buffer, guint32 value)
+{
+    guint8 data[4] = { value >> 24, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF };
+    g_byte_array_append (buffer, data, 4);
+}
+
+static void
+append_string (GByteArray *buffer, const gchar *value)
+{
+    gsize length = value ? strlen (value) : 0;
+    append_int (buffer, length);
+    g_byte_array_append (buffer, (const guint8 *) value, length);
+}
+
+static guint32
+get_int (const guint8 *data)
+{
+    return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+/* Write as much of @buffer to a non-blocking descriptor as it will take, returns FALSE on error */
+static gboolean
+write_buffered (int fd, GByteArray *buffer)
+{
+    gsize offset = 0;
+    while (offset < buffer->len)
+    {
+        ssize_t n_written = send (fd, buffer->data + offset, buffer->len - offset, MSG_NOSIGNAL);
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return FALSE;
+        }
+        offset += n_written;
+    }
+    g_byte_array_remove_range (buffer, 0, offset);
+
+    return TRUE;
+}
+
+static void disconnect_greeter (GreeterHost *host);
+
+static gboolean
+connection_write_cb (GSocket *socket, GIOCondition condition, GreeterHost *host)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    if (!write_buffered (g_socket_get_fd (socket), priv->write_buffer))
+    {
+        g_warning ("Failed to write to shared greeter: %s", strerror (errno));
+        disconnect_greeter (host);
+        return G_SOURCE_REMOVE;
+    }
+    if (priv->write_buffer->len > 0)
+        return G_SOURCE_CONTINUE;
+
+    g_clear_pointer (&priv->write_source, g_source_unref);
+    return G_SOURCE_REMOVE;
+}
+
+/* Queue a frame for the shared greeter, the main loop never waits for it to read */
+static void
+send_frame (GreeterHost *host, guint id, const guint8 *data, gsize length)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    if (!priv->connection)
+        return;
+
+    if (priv->write_buffer->len + HOST_HEADER_SIZE + length > MAX_WRITE_BUFFER_SIZE)
+    {
+        g_warning ("Shared greeter is not reading messages, disconnecting it");
+        disconnect_greeter (host);
+        return;
+    }
+
+    append_int (priv->write_buffer, id);
+    append_int (priv->write_buffer, length);
+    g_byte_array_append (priv->write_buffer, data, length);
+
+    /* Already waiting for the socket to have room */
+    if (priv->write_source)
+        return;
+
+    if (!write_buffered (g_socket_get_fd (priv->connection), priv->write_buffer))
+    {
+        g_warning ("Failed to write to shared greeter: %s", strerror (errno));
+        disconnect_greeter (host);
+        return;
+    }
+    if (priv->write_buffer->len > 0)
+    {
+        priv->write_source = g_socket_create_source (priv->connection, G_IO_OUT, NULL);
+        g_source_set_callback (priv->write_source, (GSourceFunc) connection_write_cb, host, NULL);
+        g_source_attach (priv->write_source, NULL);
+    }
+}
+
+static gboolean
+display_write_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    HostDisplay *display = data;
+
+    if (!write_buffered (display->fd, display->write_buffer))
+    {
+        g_debug ("Failed to relay shared greeter message to display %u: %s", display->id, strerror (errno));
+        display->write_watch = 0;
+        greeter_host_detach (display->host, display->id);
+        return G_SOURCE_REMOVE;
+    }
+    if (display->write_buffer->len > 0)
+        return G_SOURCE_CONTINUE;
+
+    display->write_watch = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+display_read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    HostDisplay *display = data;
+
+    guint8 buffer[4096];
+    ssize_t n_read = read (display->fd, buffer, sizeof (buffer));
+    if (n_read < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return G_SOURCE_CONTINUE;
+
+    /* The daemon side has gone, so the shared greeter has to stop using this display */
+    if (n_read <= 0)
+    {
+        display->watch = 0;
+        greeter_host_detach (display->host, display->id);
+        return G_SOURCE_REMOVE;
+    }
+
+    send_frame (display->host, display->id, buffer, n_read);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+disconnect_greeter (GreeterHost *host)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    if (!priv->connection)
+        return;
+
+    g_debug ("Shared greeter disconnected");
+
+    if (priv->connection_source)
+        g_source_destroy (priv->connection_source);
+    g_clear_pointer (&priv->connection_source, g_source_unref);
+    if (priv->write_source)
+        g_source_destroy (priv->write_source);
+    g_clear_pointer (&priv->write_source, g_source_unref);
+    g_socket_close (priv->connection, NULL);
+    g_clear_object (&priv->connection);
+    g_byte_array_set_size (priv->read_buffer, 0);
+    g_byte_array_set_size (priv->write_buffer, 0);
+
+    /* Closing our ends of the relays makes the greeters see the shared greeter go */
+    g_hash_table_remove_all (priv->displays);
+}
+
+static void
+handle_frame (GreeterHost *host, guint id, const guint8 *data, gsize length)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    /* There are no control messages from the shared greeter yet */
+    if (id == HOST_CONTROL_ID)
+        return;
+
+    HostDisplay *display = g_hash_table_lookup (priv->displays, GUINT_TO_POINTER (id));
+    if (!display)
+    {
+        g_debug ("Ignoring shared greeter message for unknown display %u", id);
+        return;
+    }
+
+    if (display->write_buffer->len + length > MAX_WRITE_BUFFER_SIZE)
+    {
+        g_debug ("Display %u is not reading shared greeter messages, removing it", id);
+        greeter_host_detach (host, id);
+        return;
+    }
+    g_byte_array_append (display->write_buffer, data, length);
+
+    if (display->write_watch)
+        return;
+
+    if (!write_buffered (display->fd, display->write_buffer))
+    {
+        g_debug ("Failed to relay shared greeter message to display %u: %s", id, strerror (errno));
+        greeter_host_detach (host, id);
+        return;
+    }
+    if (display->write_buffer->len > 0)
+        display->write_watch = g_io_add_watch (display->channel, G_IO_OUT, display_write_cb, display);
+}
+
+static gboolean
+connection_read_cb (GSocket *socket, GIOCondition condition, GreeterHost *host)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    guint8 buffer[4096];
+    g_autoptr(GError) error = NULL;
+    gssize n_read = g_socket_receive (socket, (gchar *) buffer, sizeof (buffer), NULL, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        return G_SOURCE_CONTINUE;
+    if (n_read <= 0)
+    {
+        if (error)
+            g_warning ("Failed to read from shared greeter: %s", error->message);
+        g_clear_pointer (&priv->connection_source, g_source_unref);
+        disconnect_greeter (host);
+        return G_SOURCE_REMOVE;
+    }
+    g_byte_array_append (priv->read_buffer, buffer, n_read);
+
+    /* Relay all the complete frames */
+    gsize offset = 0;
+    while (priv->connection && priv->read_buffer->len - offset >= HOST_HEADER_SIZE)
+    {
+        guint32 length = get_int (priv->read_buffer->data + offset + 4);
+        if (priv->read_buffer->len - offset - HOST_HEADER_SIZE < length)
+            break;
+        handle_frame (host, get_int (priv->read_buffer->data + offset), priv->read_buffer->data + offset + HOST_HEADER_SIZE, length);
+        offset += HOST_HEADER_SIZE + length;
+    }
+    if (priv->connection)
+        g_byte_array_remove_range (priv->read_buffer, 0, offset);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+is_allowed_user (uid_t uid)
+{
+    /* The daemon's own user, which is only not root when running unprivileged in test mode */
+    if (uid == 0 || uid == geteuid ())
+        return TRUE;
+
+    g_autofree gchar *greeter_user = config_get_string (config_get_instance (), "LightDM", "greeter-user");
+    g_autoptr(User) user = greeter_user ? accounts_get_user_by_name (greeter_user) : NULL;
+    return user && user_get_uid (user) == uid;
+}
+
+static gboolean
+greeter_connect_cb (GSocket *s, GIOCondition condition, GreeterHost *host)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSocket) new_socket = g_socket_accept (priv->socket, NULL, &error);
+    if (error)
+        g_warning ("Failed to accept shared greeter connection: %s", error->message);
+    if (!new_socket)
+        return G_SOURCE_CONTINUE;
+
+    if (priv->connection)
+    {
+        g_debug ("Refusing shared greeter connection, one is already connected");
+        g_socket_close (new_socket, NULL);
+        return G_SOURCE_CONTINUE;
+    }
+
+    /* Only the greeter user can see the greeter protocol for other seats */
+    g_autoptr(GCredentials) credentials = g_socket_get_credentials (new_socket, &error);
+    if (!credentials || !is_allowed_user (g_credentials_get_unix_user (credentials, NULL)))
+    {
+        g_warning ("Refusing shared greeter connection from unknown user");
+        g_socket_close (new_socket, NULL);
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_debug ("Shared greeter connected");
+    g_socket_set_blocking (new_socket, FALSE);
+    priv->connection = g_steal_pointer (&new_socket);
+    priv->connection_source = g_socket_create_source (priv->connection, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback (priv->connection_source, (GSourceFunc) connection_read_cb, host, NULL);
+    g_source_attach (priv->connection_source, NULL);
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean
+greeter_host_start (GreeterHost *host, const gchar *path, GError **error)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    g_return_val_if_fail (host != NULL, FALSE);
+    g_return_val_if_fail (priv->socket == NULL, FALSE);
+
+    priv->path = g_strdup (path);
+    priv->socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, error);
+    if (!priv->socket)
+        return FALSE;
+
+    unlink (priv->path);
+    g_autoptr(GSocketAddress) address = g_unix_socket_address_new (priv->path);
+    if (!g_socket_bind (priv->socket, address, FALSE, error))
+        return FALSE;
+    if (!g_socket_listen (priv->socket, error))
+        return FALSE;
+
+    priv->source = g_socket_create_source (priv->socket, G_IO_IN, NULL);
+    g_source_set_callback (priv->source, (GSourceFunc) greeter_connect_cb, host, NULL);
+    g_source_attach (priv->source, NULL);
+
+    /* Allow to be connected to, connections are checked by user */
+    if (chmod (priv->path, S_IRWXU | S_IRWXG | S_IRWXO) < 0)
+    {
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (errno),
+                     "Failed to set permissions on shared greeter socket %s: %s",
+                     priv->path,
+                     g_strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+greeter_host_get_is_connected (GreeterHost *host)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+    g_return_val_if_fail (host != NULL, FALSE);
+    return priv->connection != NULL;
+}
+
+guint
+greeter_host_attach (GreeterHost *host, Greeter *greeter)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    g_return_val_if_fail (host != NULL, 0);
+
+    if (!priv->connection)
+        return 0;
+
+    int fds[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        g_warning ("Failed to create shared greeter socket pair: %s", strerror (errno));
+        return 0;
+    }
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+    /* The greeter closes both descriptors it is given */
+    greeter_set_file_descriptors (greeter, fds[0], fcntl (fds[0], F_DUPFD_CLOEXEC, 0));
+
+    HostDisplay *display = g_malloc0 (sizeof (HostDisplay));
+    display->host = host;
+    display->id = priv->next_id++;
+    if (priv->next_id == HOST_CONTROL_ID)
+        priv->next_id++;
+    display->fd = fds[1];
+    fcntl (display->fd, F_SETFL, fcntl (display->fd, F_GETFL) | O_NONBLOCK);
+    display->write_buffer = g_byte_array_new ();
+    display->channel = g_io_channel_unix_new (display->fd);
+    display->watch = g_io_add_watch (display->channel, G_IO_IN | G_IO_HUP, display_read_cb, display);
+    g_hash_table_insert (priv->displays, GUINT_TO_POINTER (display->id), display);
+
+    return display->id;
+}
+
+void
+greeter_host_add_display (GreeterHost *host, guint id, const gchar *seat_name, const gchar *display, const gchar *x_authority)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    g_return_if_fail (host != NULL);
+
+    HostDisplay *d = g_hash_table_lookup (priv->displays, GUINT_TO_POINTER (id));
+    if (!d || d->announced)
+        return;
+
+    g_debug ("Adding display %s for seat %s to shared greeter", display, seat_name);
+
+    g_autoptr(GByteArray) message = g_byte_array_new ();
+    append_int (message, HOST_MESSAGE_ADD_DISPLAY);
+    append_int (message, id);
+    append_string (message, seat_name);
+    append_string (message, display);
+    append_string (message, x_authority);
+    d->announced = TRUE;
+    send_frame (host, HOST_CONTROL_ID, message->data, message->len);
+}
+
+void
+greeter_host_detach (GreeterHost *host, guint id)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+
+    g_return_if_fail (host != NULL);
+
+    HostDisplay *d = g_hash_table_lookup (priv->displays, GUINT_TO_POINTER (id));
+    if (!d)
+        return;
+
+    if (d->announced)
+    {
+        g_autoptr(GByteArray) message = g_byte_array_new ();
+        append_int (message, HOST_MESSAGE_REMOVE_DISPLAY);
+        append_int (message, id);
+        send_frame (host, HOST_CONTROL_ID, message->data, message->len);
+    }
+
+    g_hash_table_remove (priv->displays, GUINT_TO_POINTER (id));
+}
+
+static void
+greeter_host_init (GreeterHost *host)
+{
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (host);
+    priv->read_buffer = g_byte_array_new ();
+    priv->write_buffer = g_byte_array_new ();
+    priv->displays = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) host_display_free);
+    priv->next_id = HOST_CONTROL_ID + 1;
+}
+
+static void
+greeter_host_finalize (GObject *object)
+{
+    GreeterHost *self = GREETER_HOST (object);
+    GreeterHostPrivate *priv = greeter_host_get_instance_private (self);
+
+    disconnect_greeter (self);
+    if (priv->path)
+        unlink (priv->path);
+    g_clear_pointer (&priv->path, g_free);
+    if (priv->source)
+        g_source_destroy (priv->source);
+    g_clear_pointer (&priv->source, g_source_unref);
+    g_clear_object (&priv->socket);
+    g_clear_pointer (&priv->read_buffer, g_byte_array_unref);
+    g_clear_pointer (&priv->write_buffer, g_byte_array_unref);
+    g_clear_pointer (&priv->displays, g_hash_table_unref);
+
+    G_OBJECT_CLASS (greeter_host_parent_class)->finalize (object);
+}
+
+static void
+greeter_host_class_init (GreeterHostClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = greeter_host_finalize;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef GREETER_HOST_H_
+#define GREETER_HOST_H_
+
+#include <glib-object.h>
+
+#include "greeter.h"
+
+G_BEGIN_DECLS
+
+#define GREETER_HOST_TYPE           (greeter_host_get_type())
+#define GREETER_HOST(obj)           (G_TYPE_CHECK_INSTANCE_CAST ((obj), GREETER_HOST_TYPE, GreeterHost))
+#define GREETER_HOST_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST ((klass), GREETER_HOST_TYPE, GreeterHostClass))
+#define GREETER_HOST_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GREETER_HOST_TYPE, GreeterHostClass))
+#define IS_GREETER_HOST(obj)        (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GREETER_HOST_TYPE))
+
+typedef struct
+{
+    GObject parent_instance;
+} GreeterHost;
+
+typedef struct
+{
+    GObjectClass parent_class;
+} GreeterHostClass;
+
+GType greeter_host_get_type (void);
+
+GreeterHost *greeter_host_get_instance (void);
+
+void greeter_host_cleanup (void);
+
+gboolean greeter_host_start (GreeterHost *host, const gchar *path, GError **error);
+
+gboolean greeter_host_get_is_connected (GreeterHost *host);
+
+guint greeter_host_attach (GreeterHost *host, Greeter *greeter);
+
+void greeter_host_add_display (GreeterHost *host, guint id, const gchar *seat_name, const gchar *display, const gchar *x_authority);
+
+void greeter_host_detach (GreeterHost *host, guint id);
+
+G_END_DECLS
+
+#endif /* GREETER_HOST_H_ */
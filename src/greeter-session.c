@@ -16,11 +16,18 @@
 #include <fcntl.h>
 
 #include "greeter-session.h"
+#include "greeter-host.h"
 
 typedef struct
 {
     /* Greeter running inside this session */
     Greeter *greeter;
+
+    /* TRUE if this session can use a shared greeter process */
+    gboolean shared;
+
+    /* Id of this greeter on the shared greeter connection or 0 if running its own greeter */
+    guint host_id;
 } GreeterSessionPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GreeterSession, greeter_session, SESSION_TYPE)
@@ -39,11 +46,37 @@ greeter_session_get_greeter (GreeterSession *session)
     return priv->greeter;
 }
 
+void
+greeter_session_set_shared (GreeterSession *session, gboolean shared)
+{
+    GreeterSessionPrivate *priv = greeter_session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    priv->shared = shared;
+}
+
+static void
+shared_greeter_disconnected_cb (Greeter *greeter, Session *session)
+{
+    /* Without the shared greeter nothing needs the session kept open */
+    session_stop (session);
+}
+
 static gboolean
 greeter_session_start (Session *session)
 {
     GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
 
+    /* Use the shared greeter if it is connected, otherwise run one for this seat */
+    if (priv->shared && greeter_host_get_is_connected (greeter_host_get_instance ()))
+        priv->host_id = greeter_host_attach (greeter_host_get_instance (), priv->greeter);
+    if (priv->host_id != 0)
+    {
+        g_debug ("Using shared greeter for seat %s", session_get_seat_name (session));
+        g_signal_connect (priv->greeter, GREETER_SIGNAL_DISCONNECTED, G_CALLBACK (shared_greeter_disconnected_cb), session);
+        session_set_hold (session, TRUE);
+        return SESSION_CLASS (greeter_session_parent_class)->start (session);
+    }
+
     /* Create a pipe to talk with the greeter */
     int to_greeter_pipe[2], from_greeter_pipe[2];
     if (pipe (to_greeter_pipe) != 0 || pipe (from_greeter_pipe) != 0)
@@ -77,12 +110,33 @@ greeter_session_start (Session *session)
     return result;
 }
 
+static void
+greeter_session_run (Session *session)
+{
+    GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
+
+    SESSION_CLASS (greeter_session_parent_class)->run (session);
+
+    /* The session is open, so the shared greeter can now use the display */
+    if (priv->host_id != 0)
+        greeter_host_add_display (greeter_host_get_instance (),
+                                  priv->host_id,
+                                  session_get_seat_name (session),
+                                  session_get_env (session, "DISPLAY"),
+                                  session_get_x_authority_filename (session));
+}
+
 static void
 greeter_session_stop (Session *session)
 {
     GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
 
     greeter_stop (priv->greeter);
+    if (priv->host_id != 0)
+    {
+        greeter_host_detach (greeter_host_get_instance (), priv->host_id);
+        priv->host_id = 0;
+    }
 
     SESSION_CLASS (greeter_session_parent_class)->stop (session);
 }
@@ -100,6 +154,9 @@ greeter_session_finalize (GObject *object)
     GreeterSession *self = GREETER_SESSION (object);
     GreeterSessionPrivate *priv = greeter_session_get_instance_private (self);
 
+    if (priv->host_id != 0)
+        greeter_host_detach (greeter_host_get_instance (), priv->host_id);
+    g_signal_handlers_disconnect_matched (priv->greeter, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     g_clear_object (&priv->greeter);
 
     G_OBJECT_CLASS (greeter_session_parent_class)->finalize (object);
@@ -112,6 +169,7 @@ greeter_session_class_init (GreeterSessionClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
     session_class->start = greeter_session_start;
+    session_class->run = greeter_session_run;
     session_class->stop = greeter_session_stop;
     object_class->finalize = greeter_session_finalize;
 }
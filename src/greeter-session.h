@@ -39,6 +39,8 @@ GreeterSession *greeter_session_new (void);
 
 Greeter *greeter_session_get_greeter (GreeterSession *session);
 
+void greeter_session_set_shared (GreeterSession *session, gboolean shared);
+
 G_END_DECLS
 
 #endif /* GREETER_SESSION_H_ */
@@ -34,13 +34,20 @@ typedef struct
     /* Source for listening for connections */
     GSource *source;
 
-    /* Socket to greeter */
-    GSocket *greeter_socket;
+    /* Maximum number of greeters that can be connected at once */
+    guint max_greeters;
 
-    /* Greeter connected on this socket */
-    Greeter *greeter;
+    /* Greeters connected on this socket */
+    GList *connections;
 } GreeterSocketPrivate;
 
+/* A greeter connected on this socket */
+typedef struct
+{
+    GSocket *socket;
+    Greeter *greeter;
+} GreeterConnection;
+
 G_DEFINE_TYPE_WITH_PRIVATE (GreeterSocket, greeter_socket, G_TYPE_OBJECT)
 
 GreeterSocket *
@@ -54,15 +61,39 @@ greeter_socket_new (const gchar *path)
     return socket;
 }
 
+void
+greeter_socket_set_max_greeters (GreeterSocket *socket, guint max_greeters)
+{
+    GreeterSocketPrivate *priv = greeter_socket_get_instance_private (socket);
+    g_return_if_fail (socket != NULL);
+    priv->max_greeters = max_greeters;
+}
+
+static void greeter_disconnected_cb (Greeter *greeter, GreeterSocket *socket);
+
+static void
+greeter_connection_free (GreeterConnection *connection, GreeterSocket *socket)
+{
+    g_signal_handlers_disconnect_by_func (connection->greeter, greeter_disconnected_cb, socket);
+    g_object_unref (connection->greeter);
+    g_object_unref (connection->socket);
+    g_free (connection);
+}
+
 static void
 greeter_disconnected_cb (Greeter *greeter, GreeterSocket *socket)
 {
     GreeterSocketPrivate *priv = greeter_socket_get_instance_private (socket);
 
-    if (greeter == priv->greeter)
+    for (GList *link = priv->connections; link; link = link->next)
     {
-        g_clear_object (&priv->greeter);
-        g_clear_object (&priv->greeter_socket);
+        GreeterConnection *connection = link->data;
+        if (connection->greeter == greeter)
+        {
+            priv->connections = g_list_delete_link (priv->connections, link);
+            greeter_connection_free (connection, socket);
+            return;
+        }
     }
 }
 
@@ -78,17 +109,28 @@ greeter_connect_cb (GSocket *s, GIOCondition condition, GreeterSocket *socket)
     if (!new_socket)
         return G_SOURCE_CONTINUE;
 
-    /* Greeter already connected */
-    if (priv->greeter)
+    /* Already have as many greeters as allowed */
+    if (g_list_length (priv->connections) >= priv->max_greeters)
+    {
+        g_debug ("Refusing greeter connection, %u greeters already connected", priv->max_greeters);
+        g_socket_close (new_socket, NULL);
+        return G_SOURCE_CONTINUE;
+    }
+
+    Greeter *greeter = NULL;
+    g_signal_emit (socket, signals[CREATE_GREETER], 0, &greeter);
+    if (!greeter)
     {
         g_socket_close (new_socket, NULL);
         return G_SOURCE_CONTINUE;
     }
 
-    priv->greeter_socket = g_steal_pointer (&new_socket);
-    g_signal_emit (socket, signals[CREATE_GREETER], 0, &priv->greeter);
-    g_signal_connect (priv->greeter, GREETER_SIGNAL_DISCONNECTED, G_CALLBACK (greeter_disconnected_cb), socket);
-    greeter_set_file_descriptors (priv->greeter, g_socket_get_fd (priv->greeter_socket), g_socket_get_fd (priv->greeter_socket));
+    GreeterConnection *connection = g_malloc0 (sizeof (GreeterConnection));
+    connection->socket = g_steal_pointer (&new_socket);
+    connection->greeter = greeter;
+    priv->connections = g_list_append (priv->connections, connection);
+    g_signal_connect (greeter, GREETER_SIGNAL_DISCONNECTED, G_CALLBACK (greeter_disconnected_cb), socket);
+    greeter_set_file_descriptors (greeter, g_socket_get_fd (connection->socket), g_socket_get_fd (connection->socket));
 
     return G_SOURCE_CONTINUE;
 }
@@ -135,6 +177,8 @@ greeter_socket_start (GreeterSocket *socket, GError **error)
 static void
 greeter_socket_init (GreeterSocket *socket)
 {
+    GreeterSocketPrivate *priv = greeter_socket_get_instance_private (socket);
+    priv->max_greeters = 1;
 }
 
 static void
@@ -148,8 +192,9 @@ greeter_socket_finalize (GObject *object)
     g_clear_pointer (&priv->path, g_free);
     g_clear_object (&priv->socket);
     g_clear_object (&priv->source);
-    g_clear_object (&priv->greeter_socket);
-    g_clear_object (&priv->greeter);
+    for (GList *link = priv->connections; link; link = link->next)
+        greeter_connection_free (link->data, self);
+    g_clear_pointer (&priv->connections, g_list_free);
 
     G_OBJECT_CLASS (greeter_socket_parent_class)->finalize (object);
 }
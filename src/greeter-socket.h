@@ -40,6 +40,8 @@ GType greeter_socket_get_type (void);
 
 GreeterSocket *greeter_socket_new (const gchar *path);
 
+void greeter_socket_set_max_greeters (GreeterSocket *socket, guint max_greeters);
+
 gboolean greeter_socket_start (GreeterSocket *socket, GError **error);
 
 G_END_DECLS
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "greeter-trace.h"
+
+/* A trace is the magic, the wall clock time it started (microseconds since
+ * the epoch), then for each message its direction, the microseconds since
+ * the start, its length and the message. Numbers are big endian like the
+ * greeter protocol. */
+#define TRACE_MAGIC "LDMGTRC1"
+#define MAGIC_LENGTH 8
+#define RECORD_HEADER_LENGTH 13
+
+/* Larger than any real message, anything bigger means the file is corrupt */
+#define MAX_RECORD_LENGTH (16 * 1024 * 1024)
+
+struct GreeterTrace
+{
+    gchar *path;
+    int fd;
+    gint64 start_time;
+};
+
+static void
+write_uint (guint8 *buffer, guint64 value, gsize length)
+{
+    for (gsize i = 0; i < length; i++)
+        buffer[i] = (value >> ((length - i - 1) * 8)) & 0xFF;
+}
+
+static guint64
+read_uint (const guint8 *buffer, gsize length)
+{
+    guint64 value = 0;
+    for (gsize i = 0; i < length; i++)
+        value = value << 8 | buffer[i];
+    return value;
+}
+
+static gboolean
+write_all (int fd, struct iovec *iov, int n_iov)
+{
+    while (n_iov > 0)
+    {
+        ssize_t n_written = writev (fd, iov, n_iov);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written < 0)
+            return FALSE;
+
+        while (n_iov > 0 && (gsize) n_written >= iov->iov_len)
+        {
+            n_written -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if (n_iov > 0)
+        {
+            iov->iov_base = (guint8 *) iov->iov_base + n_written;
+            iov->iov_len -= n_written;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Start a new trace, the file is only readable by the owner as it shows who logged in */
+GreeterTrace *
+greeter_trace_new (const gchar *path, GError **error)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to open greeter trace %s: %s", path, g_strerror (errno));
+        return NULL;
+    }
+
+    GreeterTrace *trace = g_new0 (GreeterTrace, 1);
+    trace->path = g_strdup (path);
+    trace->fd = fd;
+    trace->start_time = g_get_monotonic_time ();
+
+    guint8 header[MAGIC_LENGTH + 8];
+    memcpy (header, TRACE_MAGIC, MAGIC_LENGTH);
+    write_uint (header + MAGIC_LENGTH, g_get_real_time (), 8);
+    struct iovec iov = { header, sizeof (header) };
+    if (!write_all (fd, &iov, 1))
+    {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to write greeter trace %s: %s", path, g_strerror (errno));
+        greeter_trace_free (trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+/* Record a message, @data is the whole message including its header */
+void
+greeter_trace_write (GreeterTrace *trace, GreeterTraceDirection direction, const guint8 *data, gsize length)
+{
+    g_return_if_fail (trace != NULL);
+
+    if (trace->fd < 0)
+        return;
+
+    guint8 header[RECORD_HEADER_LENGTH];
+    header[0] = direction;
+    write_uint (header + 1, g_get_monotonic_time () - trace->start_time, 8);
+    write_uint (header + 9, length, 4);
+
+    /* Written straight away so the trace is there if the daemon gets stuck */
+    struct iovec iov[2] = { { header, sizeof (header) }, { (guint8 *) data, length } };
+    if (!write_all (trace->fd, iov, 2))
+    {
+        g_warning ("Failed to write greeter trace %s, no longer tracing: %s", trace->path, g_strerror (errno));
+        close (trace->fd);
+        trace->fd = -1;
+    }
+}
+
+void
+greeter_trace_free (GreeterTrace *trace)
+{
+    if (!trace)
+        return;
+
+    if (trace->fd >= 0)
+        close (trace->fd);
+    g_free (trace->path);
+    g_free (trace);
+}
+
+void
+greeter_trace_record_free (GreeterTraceRecord *record)
+{
+    g_bytes_unref (record->data);
+    g_free (record);
+}
+
+/* Read all the messages in a trace, returns an array of GreeterTraceRecord */
+GPtrArray *
+greeter_trace_load (const gchar *path, GError **error)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    g_autofree gchar *contents = NULL;
+    gsize length;
+    if (!g_file_get_contents (path, &contents, &length, error))
+        return NULL;
+
+    if (length < MAGIC_LENGTH + 8 || memcmp (contents, TRACE_MAGIC, MAGIC_LENGTH) != 0)
+    {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                     "%s is not a greeter trace", path);
+        return NULL;
+    }
+
+    g_autoptr(GPtrArray) records = g_ptr_array_new_with_free_func ((GDestroyNotify) greeter_trace_record_free);
+    const guint8 *data = (const guint8 *) contents;
+    gsize offset = MAGIC_LENGTH + 8;
+    while (offset < length)
+    {
+        if (length - offset < RECORD_HEADER_LENGTH)
+        {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                         "Greeter trace %s ends in the middle of a record", path);
+            return NULL;
+        }
+
+        GreeterTraceDirection direction = data[offset];
+        gint64 time = read_uint (data + offset + 1, 8);
+        gsize record_length = read_uint (data + offset + 9, 4);
+        offset += RECORD_HEADER_LENGTH;
+        if ((direction != GREETER_TRACE_FROM_GREETER && direction != GREETER_TRACE_TO_GREETER) ||
+            record_length > MAX_RECORD_LENGTH || record_length > length - offset)
+        {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                         "Invalid record in greeter trace %s", path);
+            return NULL;
+        }
+
+        GreeterTraceRecord *record = g_new0 (GreeterTraceRecord, 1);
+        record->direction = direction;
+        record->time = time;
+        record->data = g_bytes_new (data + offset, record_length);
+        g_ptr_array_add (records, record);
+        offset += record_length;
+    }
+
+    return g_steal_pointer (&records);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef GREETER_TRACE_H_
+#define GREETER_TRACE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Which way a message went */
+typedef enum
+{
+    GREETER_TRACE_FROM_GREETER = 'G',
+    GREETER_TRACE_TO_GREETER = 'D',
+} GreeterTraceDirection;
+
+typedef struct
+{
+    GreeterTraceDirection direction;
+
+    /* Microseconds since the trace started */
+    gint64 time;
+
+    /* The whole message including its header */
+    GBytes *data;
+} GreeterTraceRecord;
+
+typedef struct GreeterTrace GreeterTrace;
+
+GreeterTrace *greeter_trace_new (const gchar *path, GError **error);
+
+void greeter_trace_write (GreeterTrace *trace, GreeterTraceDirection direction, const guint8 *data, gsize length);
+
+void greeter_trace_free (GreeterTrace *trace);
+
+GPtrArray *greeter_trace_load (const gchar *path, GError **error);
+
+void greeter_trace_record_free (GreeterTraceRecord *record);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GreeterTrace, greeter_trace_free)
+
+G_END_DECLS
+
+#endif /* GREETER_TRACE_H_ */
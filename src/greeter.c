@@ -8,15 +8,30 @@
  * license.
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 
 #include <stdlib.h>
 #include <string.h>
-#include <gcrypt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 #include "greeter.h"
 #include "configuration.h"
+#include "session-index.h"
 #include "shared-data-manager.h"
+#include "login-trace.h"
+#include "metrics.h"
+#include "secure-memory.h"
+#include "logger.h"
+#include "greeter-trace.h"
 
 enum {
     PROP_ACTIVE_USERNAME = 1,
@@ -27,6 +42,7 @@ enum {
     DISCONNECTED,
     CREATE_SESSION,
     START_SESSION,
+    UNRESPONSIVE,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -39,12 +55,25 @@ typedef struct
 
     /* Buffer for data read from greeter */
     guint8 *read_buffer;
+    gsize read_buffer_size;
     gsize n_read;
     gboolean use_secure_memory;
 
     /* Hints for the greeter */
     GHashTable *hints;
 
+    /* Index of each hint name the greeter has been sent (API version 2 onwards) */
+    GHashTable *hint_keys;
+
+    /* Names of hints changed since they were last sent to the greeter */
+    GHashTable *changed_hints;
+
+    /* TRUE if hint changes are sent to the greeter as they occur */
+    gboolean incremental_hints;
+
+    /* TRUE if large messages are passed to the greeter in shared memory (API version 3 onwards) */
+    gboolean use_shared_memory;
+
     /* Default session to use */
     gchar *default_session;
 
@@ -60,6 +89,9 @@ typedef struct
     /* PAM session being constructed by the greeter */
     Session *authentication_session;
 
+    /* TRUE if a failed authentication session is kept to try the same user again */
+    gboolean reuse_authentication_session;
+
     /* API version the client can speak */
     guint32 api_version;
 
@@ -78,14 +110,47 @@ typedef struct
     /* Communication channels to communicate with */
     int to_greeter_input;
     int from_greeter_output;
-    GIOChannel *to_greeter_channel;
     GIOChannel *from_greeter_channel;
     guint from_greeter_watch;
+
+    /* Messages waiting to be written to the greeter (QueuedMessage) */
+    GPtrArray *write_queue;
+    gsize write_offset;
+    guint write_idle;
+
+    /* Users the greeter requested shared directories for, the first is being handled */
+    GQueue *shared_dir_requests;
+
+    /* Statistics on data written to the greeter */
+    gsize n_messages_written;
+    gsize n_bytes_written;
+    gsize n_write_calls;
+
+    /* Monotonic time the last message was received from the greeter */
+    gint64 last_activity;
+
+    /* Pings checking the greeter is still responding (API version 4 onwards) */
+    guint ping_interval;
+    guint ping_limit;
+    gchar *ping_labels;
+    guint ping_timeout;
+    guint32 ping_sequence;
+    gint64 ping_time;
+    guint missed_pings;
+
+    /* Record of the messages exchanged with the greeter (greeter-trace-directory) */
+    GreeterTrace *trace;
 } GreeterPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (Greeter, greeter, G_TYPE_OBJECT)
 
-#define API_VERSION 1
+/* Number used to make trace file names */
+static guint trace_count = 0;
+
+#define API_VERSION 5
+
+/* Features a greeter says it supports when connecting, from API version 5 */
+#define GREETER_FEATURE_SHARED_MEMORY (1 << 0)
 
 /* Messages from the greeter to the server */
 typedef enum
@@ -99,6 +164,7 @@ typedef enum
     GREETER_MESSAGE_SET_LANGUAGE,
     GREETER_MESSAGE_AUTHENTICATE_REMOTE,
     GREETER_MESSAGE_ENSURE_SHARED_DIR,
+    GREETER_MESSAGE_PONG,
 } GreeterMessage;
 
 /* Messages from the server to the greeter */
@@ -112,9 +178,24 @@ typedef enum
     SERVER_MESSAGE_IDLE,
     SERVER_MESSAGE_RESET,
     SERVER_MESSAGE_CONNECTED_V2,
+    SERVER_MESSAGE_CONNECTED_V3,
+    SERVER_MESSAGE_HINTS_CHANGED,
+    SERVER_MESSAGE_SHARED_MEMORY,
+    SERVER_MESSAGE_PING,
 } ServerMessage;
 
+/* Message waiting to be written, with a file descriptor to pass along with it */
+typedef struct
+{
+    GByteArray *data;
+    int fd;
+} QueuedMessage;
+
 static gboolean read_cb (GIOChannel *source, GIOCondition condition, gpointer data);
+static void flush_messages (Greeter *greeter);
+static void schedule_flush (Greeter *greeter);
+static void stop_pings (Greeter *greeter);
+static void queue_hint_changes (Greeter *greeter);
 
 Greeter *
 greeter_new (void)
@@ -122,6 +203,31 @@ greeter_new (void)
     return g_object_new (GREETER_TYPE, NULL);
 }
 
+static void
+start_trace (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_autofree gchar *trace_dir = config_get_string (config_get_instance (), "LightDM", "greeter-trace-directory");
+    if (!trace_dir)
+        return;
+
+    if (g_mkdir_with_parents (trace_dir, S_IRWXU) < 0)
+    {
+        g_warning ("Failed to make greeter trace directory %s: %s", trace_dir, strerror (errno));
+        return;
+    }
+
+    g_autofree gchar *filename = g_strdup_printf ("greeter-%d-%u.trace", getpid (), trace_count++);
+    g_autofree gchar *path = g_build_filename (trace_dir, filename, NULL);
+    g_autoptr(GError) error = NULL;
+    priv->trace = greeter_trace_new (path, &error);
+    if (priv->trace)
+        log_debug (LOG_SUBSYSTEM_GREETER, "Recording greeter messages to %s", path);
+    else
+        g_warning ("%s", error->message);
+}
+
 void
 greeter_set_file_descriptors (Greeter *greeter, int to_greeter_fd, int from_greeter_fd)
 {
@@ -132,11 +238,6 @@ greeter_set_file_descriptors (Greeter *greeter, int to_greeter_fd, int from_gree
     g_return_if_fail (priv->from_greeter_output < 0);
 
     priv->to_greeter_input = to_greeter_fd;
-    priv->to_greeter_channel = g_io_channel_unix_new (priv->to_greeter_input);
-    g_autoptr(GError) to_error = NULL;
-    g_io_channel_set_encoding (priv->to_greeter_channel, NULL, &to_error);
-    if (to_error)
-        g_warning ("Failed to set encoding on to greeter channel to binary: %s\n", to_error->message);
 
     priv->from_greeter_output = from_greeter_fd;
     priv->from_greeter_channel = g_io_channel_unix_new (priv->from_greeter_output);
@@ -147,6 +248,8 @@ greeter_set_file_descriptors (Greeter *greeter, int to_greeter_fd, int from_gree
     g_io_channel_set_buffered (priv->from_greeter_channel, FALSE);
 
     priv->from_greeter_watch = g_io_add_watch (priv->from_greeter_channel, G_IO_IN | G_IO_HUP, read_cb, greeter);
+
+    start_trace (greeter);
 }
 
 void
@@ -157,6 +260,10 @@ greeter_stop (Greeter *greeter)
     /* Stop any events occurring after we've stopped */
     if (priv->authentication_session)
         g_signal_handlers_disconnect_matched (priv->authentication_session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, greeter);
+    stop_pings (greeter);
+
+    /* Deliver anything the greeter has been sent */
+    flush_messages (greeter);
 }
 
 void
@@ -170,6 +277,17 @@ greeter_set_pam_services (Greeter *greeter, const gchar *pam_service, const gcha
     priv->autologin_pam_service = g_strdup (autologin_pam_service);
 }
 
+void
+greeter_set_ping (Greeter *greeter, guint interval, guint limit, const gchar *seat_name)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    g_return_if_fail (greeter != NULL);
+    priv->ping_interval = interval;
+    priv->ping_limit = MAX (limit, 1);
+    g_free (priv->ping_labels);
+    priv->ping_labels = g_strdup_printf ("seat=\"%s\"", seat_name ? seat_name : "");
+}
+
 void
 greeter_set_allow_guest (Greeter *greeter, gboolean allow_guest)
 {
@@ -183,6 +301,17 @@ greeter_clear_hints (Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
     g_return_if_fail (greeter != NULL);
+
+    if (priv->incremental_hints && g_hash_table_size (priv->hints) > 0)
+    {
+        GHashTableIter iter;
+        g_hash_table_iter_init (&iter, priv->hints);
+        gpointer key;
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+            g_hash_table_add (priv->changed_hints, g_strdup (key));
+        schedule_flush (greeter);
+    }
+
     g_hash_table_remove_all (priv->hints);
 }
 
@@ -191,6 +320,13 @@ greeter_set_hint (Greeter *greeter, const gchar *name, const gchar *value)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
     g_return_if_fail (greeter != NULL);
+
+    if (priv->incremental_hints && g_strcmp0 (g_hash_table_lookup (priv->hints, name), value) != 0)
+    {
+        g_hash_table_add (priv->changed_hints, g_strdup (name));
+        schedule_flush (greeter);
+    }
+
     g_hash_table_insert (priv->hints, g_strdup (name), g_strdup (value));
 }
 
@@ -198,20 +334,27 @@ static void *
 secure_malloc (Greeter *greeter, size_t n)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return gcry_malloc_secure (n);
-    else
+    if (!priv->use_secure_memory)
         return g_malloc (n);
+
+    /* Abort like g_malloc () rather than continue without the memory */
+    void *ptr = secure_memory_alloc (n);
+    if (!ptr)
+        g_error ("Failed to allocate %zu octets of secure memory", n);
+    return ptr;
 }
 
 static void *
 secure_realloc (Greeter *greeter, void *ptr, size_t n)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return gcry_realloc (ptr, n);
-    else
+    if (!priv->use_secure_memory)
         return g_realloc (ptr, n);
+
+    void *new_ptr = secure_memory_realloc (ptr, n);
+    if (!new_ptr)
+        g_error ("Failed to allocate %zu octets of secure memory", n);
+    return new_ptr;
 }
 
 static void
@@ -219,17 +362,9 @@ secure_free (Greeter *greeter, void *ptr)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
     if (priv->use_secure_memory)
-        return gcry_free (ptr);
+        secure_memory_free (ptr);
     else
-        return g_free (ptr);
-}
-
-static void
-secure_freev (Greeter *greeter, gchar **v)
-{
-    for (int i = 0; v[i]; i++)
-        secure_free (greeter, v[i]);
-    g_free (v);
+        g_free (ptr);
 }
 
 static guint32
@@ -239,130 +374,480 @@ int_length (void)
 }
 
 #define HEADER_SIZE (sizeof (guint32) * 2)
-#define MAX_MESSAGE_LENGTH 1024
+
+/* Initial size of the read buffer, grown as required by larger messages */
+#define READ_BUFFER_SIZE 512
+
+/* Maximum number of queued messages to pass to a single writev() */
+#define MAX_WRITE_VECTORS 64
+
+/* Messages at least this long are passed in shared memory when the greeter supports it */
+#define SHARED_MEMORY_THRESHOLD 16384
 
 static void
-write_message (Greeter *greeter, guint8 *message, gsize message_length)
+queued_message_free (QueuedMessage *message)
+{
+    g_byte_array_unref (message->data);
+    if (message->fd >= 0)
+        close (message->fd);
+    g_free (message);
+}
+
+static void
+clear_write_queue (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (priv->write_queue->len > 0)
+        g_ptr_array_remove_range (priv->write_queue, 0, priv->write_queue->len);
+    priv->write_offset = 0;
+}
+
+/* Write all the queued messages to the greeter */
+static void
+flush_messages (Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    gchar *data = (gchar *) message;
-    gsize data_length = message_length;
-    while (data_length > 0)
+    if (priv->write_idle)
+    {
+        g_source_remove (priv->write_idle);
+        priv->write_idle = 0;
+    }
+
+    queue_hint_changes (greeter);
+
+    if (priv->to_greeter_input < 0)
+    {
+        clear_write_queue (greeter);
+        return;
+    }
+
+    while (priv->write_queue->len > 0)
     {
-        GIOStatus status;
-        gsize n_written;
-
-        g_autoptr(GError) error = NULL;
-        status = g_io_channel_write_chars (priv->to_greeter_channel, data, data_length, &n_written, &error);
-        if (error)
-            g_warning ("Error writing to greeter: %s", error->message);
-        if (status != G_IO_STATUS_NORMAL)
+        /* A file descriptor is sent with the first byte of its message, so each write carries at most one */
+        struct iovec vectors[MAX_WRITE_VECTORS];
+        guint n_vectors = 0;
+        while (n_vectors < MIN (priv->write_queue->len, MAX_WRITE_VECTORS))
+        {
+            QueuedMessage *message = g_ptr_array_index (priv->write_queue, n_vectors);
+            if (n_vectors > 0 && message->fd >= 0)
+                break;
+            gsize offset = n_vectors == 0 ? priv->write_offset : 0;
+            vectors[n_vectors].iov_base = message->data->data + offset;
+            vectors[n_vectors].iov_len = message->data->len - offset;
+            n_vectors++;
+        }
+
+        QueuedMessage *first = g_ptr_array_index (priv->write_queue, 0);
+        ssize_t n_written;
+        if (first->fd >= 0)
+        {
+            union
+            {
+                struct cmsghdr header;
+                guint8 buffer[CMSG_SPACE (sizeof (int))];
+            } control;
+            memset (&control, 0, sizeof (control));
+            struct msghdr header = { 0 };
+            header.msg_iov = vectors;
+            header.msg_iovlen = n_vectors;
+            header.msg_control = control.buffer;
+            header.msg_controllen = sizeof (control.buffer);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR (&header);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+            memcpy (CMSG_DATA (cmsg), &first->fd, sizeof (int));
+            n_written = sendmsg (priv->to_greeter_input, &header, MSG_NOSIGNAL);
+
+            /* The greeter has its own copy once any of the message is sent */
+            if (n_written > 0)
+            {
+                close (first->fd);
+                first->fd = -1;
+            }
+        }
+        else
+            n_written = writev (priv->to_greeter_input, vectors, n_vectors);
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            g_warning ("Error writing to greeter: %s", g_strerror (errno));
+            clear_write_queue (greeter);
             return;
-        data_length -= n_written;
-        data += n_written;
+        }
+        priv->n_write_calls++;
+        priv->n_bytes_written += n_written;
+        common_metrics_add ("lightdm_greeter_bytes_total", "direction=\"sent\"", n_written);
+
+        /* Drop the messages that have been completely written */
+        guint n_complete = 0;
+        gsize n_remaining = n_written;
+        while (n_complete < n_vectors && n_remaining >= vectors[n_complete].iov_len)
+        {
+            n_remaining -= vectors[n_complete].iov_len;
+            n_complete++;
+        }
+        if (n_complete > 0)
+        {
+            g_ptr_array_remove_range (priv->write_queue, 0, n_complete);
+            priv->write_offset = 0;
+        }
+        priv->write_offset += n_remaining;
     }
+}
 
-    g_autoptr(GError) error = NULL;
-    g_io_channel_flush (priv->to_greeter_channel, &error);
-    if (error)
-        g_warning ("Failed to flush data to greeter: %s", error->message);
+static gboolean
+flush_messages_cb (gpointer data)
+{
+    Greeter *greeter = data;
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    priv->write_idle = 0;
+    flush_messages (greeter);
+
+    return G_SOURCE_REMOVE;
 }
 
 static void
-write_int (guint8 *buffer, gint buffer_length, guint32 value, gsize *offset)
+write_int (GByteArray *message, guint32 value)
 {
-    if (*offset + 4 >= buffer_length)
-        return;
-    buffer[*offset] = value >> 24;
-    buffer[*offset+1] = (value >> 16) & 0xFF;
-    buffer[*offset+2] = (value >> 8) & 0xFF;
-    buffer[*offset+3] = value & 0xFF;
-    *offset += 4;
+    guint8 buffer[4];
+    buffer[0] = value >> 24;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = value & 0xFF;
+    g_byte_array_append (message, buffer, 4);
 }
 
 static void
-write_string (guint8 *buffer, gint buffer_length, const gchar *value, gsize *offset)
+write_string (GByteArray *message, const gchar *value)
 {
-    gint length;
-    if (value)
-        length = strlen (value);
-    else
-        length = 0;
-    write_int (buffer, buffer_length, length, offset);
-    if (*offset + length >= buffer_length)
-        return;
+    gsize length = value ? strlen (value) : 0;
+    write_int (message, length);
     if (length > 0)
+        g_byte_array_append (message, (const guint8 *) value, length);
+}
+
+#ifdef HAVE_MEMFD_CREATE
+/* Copy a message into a sealed memory file the greeter can map */
+static int
+create_shared_memory (GByteArray *message)
+{
+    int fd = memfd_create ("lightdm-greeter-message", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
     {
-        memcpy (buffer + *offset, value, length);
-        *offset += length;
+        g_warning ("Failed to create shared memory for greeter message: %s", g_strerror (errno));
+        return -1;
     }
+
+    gsize n_written = 0;
+    while (n_written < message->len)
+    {
+        ssize_t n = write (fd, message->data + n_written, message->len - n_written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            g_warning ("Failed to write shared memory for greeter message: %s", g_strerror (errno));
+            close (fd);
+            return -1;
+        }
+        n_written += n;
+    }
+
+    if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    {
+        g_warning ("Failed to seal shared memory for greeter message: %s", g_strerror (errno));
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+#endif
+
+static GByteArray *
+start_message (ServerMessage id)
+{
+    GByteArray *message = g_byte_array_new ();
+    write_int (message, id);
+    write_int (message, 0); /* Length, set when queued */
+    return message;
 }
 
 static void
-write_header (guint8 *buffer, gint buffer_length, guint32 id, guint32 length, gsize *offset)
+schedule_flush (Greeter *greeter)
 {
-    write_int (buffer, buffer_length, id, offset);
-    write_int (buffer, buffer_length, length, offset);
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (!priv->write_idle)
+        priv->write_idle = g_idle_add_full (G_PRIORITY_HIGH, flush_messages_cb, greeter, NULL);
 }
 
-static guint32
-string_length (const gchar *value)
+static void
+set_message_length (GByteArray *message)
 {
-    if (value == NULL)
-        return int_length ();
-    else
-        return int_length () + strlen (value);
+    guint32 length = message->len - HEADER_SIZE;
+    message->data[4] = length >> 24;
+    message->data[5] = (length >> 16) & 0xFF;
+    message->data[6] = (length >> 8) & 0xFF;
+    message->data[7] = length & 0xFF;
 }
 
 static void
-handle_connect (Greeter *greeter, const gchar *version, gboolean resettable, guint32 api_version)
+append_message (Greeter *greeter, GByteArray *message)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    g_debug ("Greeter connected version=%s api=%u resettable=%s", version, api_version, resettable ? "true" : "false");
+    set_message_length (message);
 
-    priv->api_version = api_version;
-    priv->resettable = resettable;
+    /* Traced before being moved to shared memory so the trace has the whole message */
+    if (priv->trace)
+        greeter_trace_write (priv->trace, GREETER_TRACE_TO_GREETER, message->data, message->len);
+
+    QueuedMessage *queued = g_malloc0 (sizeof (QueuedMessage));
+    queued->data = message;
+    queued->fd = -1;
+
+#ifdef HAVE_MEMFD_CREATE
+    /* Send large messages as a file the greeter maps, not through the socket */
+    if (priv->use_shared_memory && message->len >= SHARED_MEMORY_THRESHOLD)
+    {
+        queued->fd = create_shared_memory (message);
+        if (queued->fd >= 0)
+        {
+            g_byte_array_unref (queued->data);
+            queued->data = start_message (SERVER_MESSAGE_SHARED_MEMORY);
+            set_message_length (queued->data);
+        }
+    }
+#endif
+
+    g_ptr_array_add (priv->write_queue, queued);
+    priv->n_messages_written++;
+    common_metrics_add ("lightdm_greeter_messages_total", "direction=\"sent\"", 1);
+    schedule_flush (greeter);
+}
+
+/* Write a table of hints for the given names, sending any names the greeter doesn't already know.
+ * Names that are no longer set are sent as removed. */
+static void
+write_hint_table (Greeter *greeter, GByteArray *message, GPtrArray *names)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    guint32 n_new_keys = 0, n_values = 0;
+    for (guint i = 0; i < names->len; i++)
+    {
+        const gchar *name = g_ptr_array_index (names, i);
+        if (!g_hash_table_contains (priv->hint_keys, name))
+            n_new_keys++;
+        if (g_hash_table_contains (priv->hints, name))
+            n_values++;
+    }
+
+    write_int (message, n_new_keys);
+    for (guint i = 0; i < names->len; i++)
+    {
+        const gchar *name = g_ptr_array_index (names, i);
+        if (g_hash_table_contains (priv->hint_keys, name))
+            continue;
+        g_hash_table_insert (priv->hint_keys, g_strdup (name), GUINT_TO_POINTER (g_hash_table_size (priv->hint_keys)));
+        write_string (message, name);
+    }
+
+    write_int (message, n_values);
+    for (guint i = 0; i < names->len; i++)
+    {
+        const gchar *name = g_ptr_array_index (names, i);
+        const gchar *value = g_hash_table_lookup (priv->hints, name);
+        if (value == NULL)
+            continue;
+        write_int (message, GPOINTER_TO_UINT (g_hash_table_lookup (priv->hint_keys, name)));
+        write_string (message, value);
+    }
+
+    write_int (message, names->len - n_values);
+    for (guint i = 0; i < names->len; i++)
+    {
+        const gchar *name = g_ptr_array_index (names, i);
+        if (g_hash_table_contains (priv->hints, name))
+            continue;
+        write_int (message, GPOINTER_TO_UINT (g_hash_table_lookup (priv->hint_keys, name)));
+    }
+}
+
+static GPtrArray *
+get_hash_table_keys (GHashTable *table)
+{
+    GPtrArray *keys = g_ptr_array_sized_new (g_hash_table_size (table));
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, table);
+    gpointer key;
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_ptr_array_add (keys, key);
+    return keys;
+}
+
+/* Send any hints that have changed since the greeter was last sent them */
+static void
+queue_hint_changes (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (g_hash_table_size (priv->changed_hints) == 0)
+        return;
+
+    g_autoptr(GPtrArray) names = get_hash_table_keys (priv->changed_hints);
+    GByteArray *message = start_message (SERVER_MESSAGE_HINTS_CHANGED);
+    write_hint_table (greeter, message, names);
+    g_hash_table_remove_all (priv->changed_hints);
+    append_message (greeter, message);
+}
+
+/* Queue a message to be sent to the greeter; messages queued in the same main loop iteration are written together */
+static void
+queue_message (Greeter *greeter, GByteArray *message)
+{
+    queue_hint_changes (greeter);
+    append_message (greeter, message);
+}
+
+static void
+write_hints (Greeter *greeter, GByteArray *message)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    guint32 env_length = 0;
     GHashTableIter iter;
     g_hash_table_iter_init (&iter, priv->hints);
     gpointer key, value;
     while (g_hash_table_iter_next (&iter, &key, &value))
-        env_length += string_length (key) + string_length (value);
+    {
+        write_string (message, key);
+        write_string (message, value);
+    }
+}
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    if (api_version == 0)
+static void
+stop_pings (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    if (priv->ping_timeout)
+        g_source_remove (priv->ping_timeout);
+    priv->ping_timeout = 0;
+    priv->ping_time = 0;
+}
+
+static gboolean
+ping_cb (gpointer data)
+{
+    Greeter *greeter = data;
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    /* The last ping wasn't answered in time */
+    if (priv->ping_time != 0)
     {
-        write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_CONNECTED, string_length (VERSION) + env_length, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, VERSION, &offset);
-        g_hash_table_iter_init (&iter, priv->hints);
-        while (g_hash_table_iter_next (&iter, &key, &value))
+        priv->missed_pings++;
+        common_metrics_add ("lightdm_greeter_missed_pings_total", priv->ping_labels, 1);
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter missed ping %u (%u of %u)", priv->ping_sequence, priv->missed_pings, priv->ping_limit);
+        if (priv->missed_pings >= priv->ping_limit)
         {
-            write_string (message, MAX_MESSAGE_LENGTH, key, &offset);
-            write_string (message, MAX_MESSAGE_LENGTH, value, &offset);
+            priv->ping_timeout = 0;
+            priv->ping_time = 0;
+            g_signal_emit (greeter, signals[UNRESPONSIVE], 0);
+            return G_SOURCE_REMOVE;
         }
     }
+
+    priv->ping_sequence++;
+    priv->ping_time = g_get_monotonic_time ();
+    GByteArray *message = start_message (SERVER_MESSAGE_PING);
+    write_int (message, priv->ping_sequence);
+    queue_message (greeter, message);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+handle_pong (Greeter *greeter, guint32 sequence_number)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    /* Late answers were already counted as missed */
+    if (priv->ping_time == 0 || sequence_number != priv->ping_sequence)
+        return;
+
+    common_metrics_observe_since ("lightdm_greeter_ping_seconds", priv->ping_labels, priv->ping_time);
+    priv->ping_time = 0;
+    priv->missed_pings = 0;
+}
+
+static void
+handle_connect (Greeter *greeter, const gchar *version, gboolean resettable, guint32 api_version, guint32 features)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    log_debug (LOG_SUBSYSTEM_GREETER, "Greeter connected version=%s api=%u features=%u resettable=%s", version, api_version, features, resettable ? "true" : "false");
+
+    priv->api_version = api_version;
+    priv->resettable = resettable;
+
+#ifdef HAVE_MEMFD_CREATE
+    /* File descriptors can only be passed over a socket. Greeters using API version 3 and 4
+     * only asked for shared memory on a socket, later ones say if they can receive it */
+    gboolean can_receive_fds = api_version >= 5 ? (features & GREETER_FEATURE_SHARED_MEMORY) != 0 : api_version >= 3;
+    struct stat info;
+    priv->use_shared_memory = can_receive_fds &&
+                              fstat (priv->to_greeter_input, &info) == 0 && S_ISSOCK (info.st_mode);
+#endif
+
+    GByteArray *message;
+    if (api_version == 0)
+    {
+        message = start_message (SERVER_MESSAGE_CONNECTED);
+        write_string (message, VERSION);
+        write_hints (greeter, message);
+    }
+    else if (api_version == 1)
+    {
+        message = start_message (SERVER_MESSAGE_CONNECTED_V2);
+        write_int (message, api_version);
+        write_string (message, VERSION);
+        write_int (message, g_hash_table_size (priv->hints));
+        write_hints (greeter, message);
+    }
     else
     {
-        write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_CONNECTED_V2, string_length (VERSION) + int_length () * 2 + env_length, &offset);
-        write_int (message, MAX_MESSAGE_LENGTH, api_version <= API_VERSION ? api_version : API_VERSION, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, VERSION, &offset);
-        write_int (message, MAX_MESSAGE_LENGTH, g_hash_table_size (priv->hints), &offset);
-        g_hash_table_iter_init (&iter, priv->hints);
-        while (g_hash_table_iter_next (&iter, &key, &value))
-        {
-            write_string (message, MAX_MESSAGE_LENGTH, key, &offset);
-            write_string (message, MAX_MESSAGE_LENGTH, value, &offset);
-        }
+        message = start_message (SERVER_MESSAGE_CONNECTED_V3);
+        write_int (message, api_version <= API_VERSION ? api_version : API_VERSION);
+        write_string (message, VERSION);
+        g_autoptr(GPtrArray) names = get_hash_table_keys (priv->hints);
+        write_hint_table (greeter, message, names);
+
+        /* From now on only send the hints that change */
+        priv->incremental_hints = TRUE;
+        g_hash_table_remove_all (priv->changed_hints);
     }
-    write_message (greeter, message, offset);
+    queue_message (greeter, message);
+
+    stop_pings (greeter);
+    priv->missed_pings = 0;
+    if (api_version >= 4 && priv->ping_interval > 0)
+        priv->ping_timeout = g_timeout_add_seconds (priv->ping_interval, ping_cb, greeter);
 
     g_signal_emit (greeter, signals[CONNECTED], 0);
 }
 
+static void
+trace_authentication (Greeter *greeter, LoginTracePoint point, const gchar *phase)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    login_trace (point, phase, session_get_seat_name (priv->authentication_session), session_get_id (priv->authentication_session));
+}
+
 static void
 pam_messages_cb (Session *session, Greeter *greeter)
 {
@@ -372,27 +857,25 @@ pam_messages_cb (Session *session, Greeter *greeter)
     int messages_length = session_get_messages_length (session);
 
     /* Respond to d-bus query with messages */
-    g_debug ("Prompt greeter with %d message(s)", messages_length);
-    guint32 size = int_length () + string_length (session_get_username (session)) + int_length ();
-    for (int i = 0; i < messages_length; i++)
-        size += int_length () + string_length (messages[i].msg);
-
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_PROMPT_AUTHENTICATION, size, &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, priv->authentication_sequence_number, &offset);
-    write_string (message, MAX_MESSAGE_LENGTH, session_get_username (session), &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, messages_length, &offset);
+    log_debug (LOG_SUBSYSTEM_GREETER, "Prompt greeter with %d message(s)", messages_length);
+    GByteArray *message = start_message (SERVER_MESSAGE_PROMPT_AUTHENTICATION);
+    write_int (message, priv->authentication_sequence_number);
+    write_string (message, session_get_username (session));
+    write_int (message, messages_length);
     int n_prompts = 0;
     for (int i = 0; i < messages_length; i++)
     {
-        write_int (message, MAX_MESSAGE_LENGTH, messages[i].msg_style, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, messages[i].msg, &offset);
+        write_int (message, messages[i].msg_style);
+        write_string (message, messages[i].msg);
 
         if (messages[i].msg_style == PAM_PROMPT_ECHO_OFF || messages[i].msg_style == PAM_PROMPT_ECHO_ON)
             n_prompts++;
     }
-    write_message (greeter, message, offset);
+    queue_message (greeter, message);
+
+    /* Time waiting for the user separately from PAM */
+    if (n_prompts > 0)
+        trace_authentication (greeter, LOGIN_TRACE_BEGIN, "greeter-prompt");
 
     /* Continue immediately if nothing to respond with */
     // FIXME: Should probably give the greeter a chance to ack the message
@@ -408,22 +891,17 @@ pam_messages_cb (Session *session, Greeter *greeter)
 static void
 send_end_authentication (Greeter *greeter, guint32 sequence_number, const gchar *username, int result)
 {
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_END_AUTHENTICATION, int_length () + string_length (username) + int_length (), &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, sequence_number, &offset);
-    write_string (message, MAX_MESSAGE_LENGTH, username, &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, result, &offset);
-    write_message (greeter, message, offset);
+    GByteArray *message = start_message (SERVER_MESSAGE_END_AUTHENTICATION);
+    write_int (message, sequence_number);
+    write_string (message, username);
+    write_int (message, result);
+    queue_message (greeter, message);
 }
 
 void
 greeter_idle (Greeter *greeter)
 {
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_IDLE, 0, &offset);
-    write_message (greeter, message, offset);
+    queue_message (greeter, start_message (SERVER_MESSAGE_IDLE));
 }
 
 void
@@ -433,23 +911,12 @@ greeter_reset (Greeter *greeter)
 
     g_return_if_fail (greeter != NULL);
 
-    GHashTableIter iter;
-    g_hash_table_iter_init (&iter, priv->hints);
-    gpointer key, value;
-    guint32 length = 0;
-    while (g_hash_table_iter_next (&iter, &key, &value))
-        length += string_length (key) + string_length (value);
+    /* All the hints are sent with the reset */
+    g_hash_table_remove_all (priv->changed_hints);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_RESET, length, &offset);
-    g_hash_table_iter_init (&iter, priv->hints);
-    while (g_hash_table_iter_next (&iter, &key, &value))
-    {
-        write_string (message, MAX_MESSAGE_LENGTH, key, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, value, &offset);
-    }
-    write_message (greeter, message, offset);
+    GByteArray *message = start_message (SERVER_MESSAGE_RESET);
+    write_hints (greeter, message);
+    queue_message (greeter, message);
 }
 
 static void
@@ -457,16 +924,18 @@ authentication_complete_cb (Session *session, Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    g_debug ("Authenticate result for user %s: %s", session_get_username (session), session_get_authentication_result_string (session));
+    log_debug (LOG_SUBSYSTEM_GREETER, "Authenticate result for user %s: %s", session_get_username (session), session_get_authentication_result_string (session));
+
+    trace_authentication (greeter, LOGIN_TRACE_END, "greeter-authentication");
 
     int result = session_get_authentication_result (session);
     if (session_get_is_authenticated (session))
     {
         if (session_get_user (session))
-            g_debug ("User %s authorized", session_get_username (session));
+            log_debug (LOG_SUBSYSTEM_GREETER, "User %s authorized", session_get_username (session));
         else
         {
-            g_debug ("User %s authorized, but no account of that name exists", session_get_username (session));
+            log_debug (LOG_SUBSYSTEM_GREETER, "User %s authorized, but no account of that name exists", session_get_username (session));
             result = PAM_USER_UNKNOWN;
         }
     }
@@ -491,6 +960,26 @@ reset_session (Greeter *greeter)
     priv->guest_account_authenticated = FALSE;
 }
 
+/* Try again in the existing session if it failed to authenticate the same user */
+static gboolean
+retry_authentication (Greeter *greeter, guint32 sequence_number, const gchar *username)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (!priv->authentication_session || priv->remote_session || priv->guest_account_authenticated || username == NULL)
+        return FALSE;
+    if (g_strcmp0 (session_get_username (priv->authentication_session), username) != 0)
+        return FALSE;
+    if (!session_retry_authentication (priv->authentication_session))
+        return FALSE;
+
+    log_debug (LOG_SUBSYSTEM_GREETER, "Reusing authentication session for %s", username);
+    priv->authentication_sequence_number = sequence_number;
+    trace_authentication (greeter, LOGIN_TRACE_BEGIN, "greeter-authentication");
+
+    return TRUE;
+}
+
 static void
 handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *username)
 {
@@ -498,11 +987,14 @@ handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *use
 
     if (username[0] == '\0')
     {
-        g_debug ("Greeter start authentication");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter start authentication");
         username = NULL;
     }
     else
-        g_debug ("Greeter start authentication for %s", username);
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter start authentication for %s", username);
+
+    if (retry_authentication (greeter, sequence_number, username))
+        return;
 
     reset_session (greeter);
 
@@ -521,6 +1013,7 @@ handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *use
 
     g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
     g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
+    trace_authentication (greeter, LOGIN_TRACE_BEGIN, "greeter-authentication");
 
     /* Use non-interactive service for autologin user */
     const gchar *autologin_username = g_hash_table_lookup (priv->hints, "autologin-user");
@@ -542,6 +1035,7 @@ handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *use
     session_set_username (priv->authentication_session, username);
     session_set_do_authenticate (priv->authentication_session, TRUE);
     session_set_is_interactive (priv->authentication_session, is_interactive);
+    session_set_allow_retry (priv->authentication_session, priv->reuse_authentication_session && is_interactive);
     session_start (priv->authentication_session);
 }
 
@@ -550,13 +1044,13 @@ handle_authenticate_as_guest (Greeter *greeter, guint32 sequence_number)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    g_debug ("Greeter start authentication for guest account");
+    log_debug (LOG_SUBSYSTEM_GREETER, "Greeter start authentication for guest account");
 
     reset_session (greeter);
 
     if (!priv->allow_guest)
     {
-        g_debug ("Guest account is disabled");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Guest account is disabled");
         send_end_authentication (greeter, sequence_number, "", PAM_USER_UNKNOWN);
         return;
     }
@@ -575,19 +1069,16 @@ get_remote_session_service (const gchar *session_name)
             return NULL;
     }
 
-    /* Load the session file */
-    g_autoptr(GKeyFile) session_desktop_file = g_key_file_new ();
-    g_autofree gchar *filename = g_strdup_printf ("%s.desktop", session_name);
+    /* Use the session index, which keeps the files parsed until they change */
     g_autofree gchar *remote_sessions_dir = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
-    g_autofree gchar *path = g_build_filename (remote_sessions_dir, filename, NULL);
-    g_autoptr(GError) error = NULL;
-    gboolean result = g_key_file_load_from_file (session_desktop_file, path, G_KEY_FILE_NONE, &error);
-    if (error)
-        g_debug ("Failed to load session file %s: %s", path, error->message);
-    if (!result)
+    CommonSessionFile *session_file = common_session_index_lookup (remote_sessions_dir, session_name);
+    if (!session_file)
+    {
+        log_debug (LOG_SUBSYSTEM_GREETER, "Failed to find remote session %s", session_name);
         return NULL;
+    }
 
-    return g_key_file_get_string (session_desktop_file, G_KEY_FILE_DESKTOP_GROUP, "X-LightDM-PAM-Service", NULL);
+    return g_key_file_get_string (session_file->key_file, G_KEY_FILE_DESKTOP_GROUP, "X-LightDM-PAM-Service", NULL);
 }
 
 static void
@@ -597,11 +1088,11 @@ handle_authenticate_remote (Greeter *greeter, const gchar *session_name, const g
 
     if (username[0] == '\0')
     {
-        g_debug ("Greeter start authentication for remote session %s", session_name);
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter start authentication for remote session %s", session_name);
         username = NULL;
     }
     else
-        g_debug ("Greeter start authentication for remote session %s as user %s", session_name, username);
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter start authentication for remote session %s as user %s", session_name, username);
 
     reset_session (greeter);
 
@@ -619,6 +1110,7 @@ handle_authenticate_remote (Greeter *greeter, const gchar *session_name, const g
     {
         g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
         g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
+        trace_authentication (greeter, LOGIN_TRACE_BEGIN, "greeter-authentication");
 
         /* Run the session process */
         session_set_pam_service (priv->authentication_session, service);
@@ -662,7 +1154,8 @@ handle_continue_authentication (Greeter *greeter, gchar **secrets)
         return;
     }
 
-    g_debug ("Continue authentication");
+    log_debug (LOG_SUBSYSTEM_GREETER, "Continue authentication");
+    trace_authentication (greeter, LOGIN_TRACE_END, "greeter-prompt");
 
     /* Build response */
     struct pam_response *response = calloc (messages_length, sizeof (struct pam_response));
@@ -694,7 +1187,7 @@ handle_cancel_authentication (Greeter *greeter)
     if (priv->authentication_session == NULL)
         return;
 
-    g_debug ("Cancel authentication");
+    log_debug (LOG_SUBSYSTEM_GREETER, "Cancel authentication");
     reset_session (greeter);
 }
 
@@ -718,23 +1211,21 @@ handle_start_session (Greeter *greeter, const gchar *session)
     if (priv->guest_account_authenticated || session_get_is_authenticated (priv->authentication_session))
     {
         if (session)
-            g_debug ("Greeter requests session %s", session);
+            log_debug (LOG_SUBSYSTEM_GREETER, "Greeter requests session %s", session);
         else
-            g_debug ("Greeter requests default session");
+            log_debug (LOG_SUBSYSTEM_GREETER, "Greeter requests default session");
         priv->start_session = TRUE;
         g_signal_emit (greeter, signals[START_SESSION], 0, session_type, session, &result);
     }
     else
     {
-        g_debug ("Ignoring start session request, user is not authorized");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Ignoring start session request, user is not authorized");
         result = FALSE;
     }
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_SESSION_RESULT, int_length (), &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, result ? 0 : 1, &offset);
-    write_message (greeter, message, offset);
+    GByteArray *message = start_message (SERVER_MESSAGE_SESSION_RESULT);
+    write_int (message, result ? 0 : 1);
+    queue_message (greeter, message);
 }
 
 static void
@@ -744,104 +1235,340 @@ handle_set_language (Greeter *greeter, const gchar *language)
 
     if (!priv->guest_account_authenticated && !session_get_is_authenticated (priv->authentication_session))
     {
-        g_debug ("Ignoring set language request, user is not authorized");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Ignoring set language request, user is not authorized");
         return;
     }
 
     // FIXME: Could use this
     if (priv->guest_account_authenticated)
     {
-        g_debug ("Ignoring set language request for guest user");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Ignoring set language request for guest user");
         return;
     }
 
-    g_debug ("Greeter sets language %s", language);
+    log_debug (LOG_SUBSYSTEM_GREETER, "Greeter sets language %s", language);
     User *user = session_get_user (priv->authentication_session);
     user_set_language (user, language);
 }
 
+static void start_ensure_shared_dir (Greeter *greeter);
+
 static void
-handle_ensure_shared_dir (Greeter *greeter, const gchar *username)
+ensure_shared_dir_cb (GObject *object, GAsyncResult *result, gpointer data)
 {
-    g_debug ("Greeter requests data directory for user %s", username);
+    g_autoptr(Greeter) greeter = data;
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    g_autofree gchar *dir = shared_data_manager_ensure_user_dir (shared_data_manager_get_instance (), username);
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *dir = shared_data_manager_ensure_user_dir_finish (SHARED_DATA_MANAGER (object), result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        log_debug (LOG_SUBSYSTEM_GREETER, "Not providing data directory: %s", error->message);
+    else if (error)
+        g_warning ("Failed to ensure data directory: %s", error->message);
+
+    /* Replies are matched to requests in order */
+    GByteArray *message = start_message (SERVER_MESSAGE_SHARED_DIR_RESULT);
+    write_string (message, dir);
+    queue_message (greeter, message);
+
+    g_free (g_queue_pop_head (priv->shared_dir_requests));
+    start_ensure_shared_dir (greeter);
+}
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_SHARED_DIR_RESULT, string_length (dir), &offset);
-    write_string (message, MAX_MESSAGE_LENGTH, dir, &offset);
-    write_message (greeter, message, offset);
+static void
+start_ensure_shared_dir (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    const gchar *username = g_queue_peek_head (priv->shared_dir_requests);
+    if (!username)
+        return;
+
+    shared_data_manager_ensure_user_dir_async (shared_data_manager_get_instance (), username, ensure_shared_dir_cb, g_object_ref (greeter));
 }
 
-static guint32
-read_int (Greeter *greeter, gsize *offset)
+static void
+handle_ensure_shared_dir (Greeter *greeter, const gchar *username)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    if (priv->n_read - *offset < sizeof (guint32))
+    log_debug (LOG_SUBSYSTEM_GREETER, "Greeter requests data directory for user %s", username);
+
+    /* The directory is set up off the main thread, one request at a time */
+    g_queue_push_tail (priv->shared_dir_requests, g_strdup (username));
+    if (g_queue_get_length (priv->shared_dir_requests) == 1)
+        start_ensure_shared_dir (greeter);
+}
+
+/* View onto a single complete message in the read buffer */
+typedef struct
+{
+    guint8 *data;
+    gsize length;
+    gsize offset;
+} MessageReader;
+
+static guint32
+read_int (MessageReader *reader)
+{
+    if (reader->length - reader->offset < sizeof (guint32))
     {
-        g_warning ("Not enough space for int, need %zu, got %zu", sizeof (guint32), priv->n_read - *offset);
+        g_warning ("Not enough space for int, need %zu, got %zu", sizeof (guint32), reader->length - reader->offset);
         return 0;
     }
-    guint8 *buffer = priv->read_buffer + *offset;
+    guint8 *buffer = reader->data + reader->offset;
     guint32 value = buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
-    *offset += int_length ();
+    reader->offset += int_length ();
     return value;
 }
 
-static int
-get_message_length (Greeter *greeter)
+/* Strings are returned as slices of the read buffer, which are only valid until the message is consumed.
+ * To nul-terminate them without copying, the string is moved back one byte over its (already read) length. */
+static const gchar *
+read_string (MessageReader *reader)
 {
-    gsize offset;
-    int payload_length;
+    gsize start = reader->offset;
+    guint32 length = read_int (reader);
+    if (reader->offset == start)
+        return "";
+    if (reader->length - reader->offset < length)
+    {
+        g_warning ("Not enough space for string, need %u, got %zu", length, reader->length - reader->offset);
+        return "";
+    }
+
+    gchar *value = (gchar *) reader->data + reader->offset - 1;
+    memmove (value, value + 1, length);
+    value[length] = '\0';
+    reader->offset += length;
+
+    return value;
+}
+
+static gboolean
+has_more (MessageReader *reader)
+{
+    return reader->offset < reader->length;
+}
+
+static gboolean
+read_connect (Greeter *greeter, MessageReader *reader)
+{
+    const gchar *version = read_string (reader);
+    gboolean resettable = FALSE;
+    if (has_more (reader))
+        resettable = read_int (reader) != 0;
+    guint32 api_version = 0;
+    if (has_more (reader))
+        api_version = read_int (reader);
+    guint32 features = 0;
+    if (has_more (reader))
+        features = read_int (reader);
+    handle_connect (greeter, version, resettable, api_version, features);
+    return TRUE;
+}
 
-    offset = int_length ();
-    payload_length = read_int (greeter, &offset);
+static gboolean
+read_authenticate (Greeter *greeter, MessageReader *reader)
+{
+    guint32 sequence_number = read_int (reader);
+    const gchar *username = read_string (reader);
+    handle_authenticate (greeter, sequence_number, username);
+    return TRUE;
+}
 
-    if (HEADER_SIZE + payload_length < HEADER_SIZE)
+static gboolean
+read_authenticate_as_guest (Greeter *greeter, MessageReader *reader)
+{
+    guint32 sequence_number = read_int (reader);
+    handle_authenticate_as_guest (greeter, sequence_number);
+    return TRUE;
+}
+
+static gboolean
+read_authenticate_remote (Greeter *greeter, MessageReader *reader)
+{
+    guint32 sequence_number = read_int (reader);
+    const gchar *session_name = read_string (reader);
+    const gchar *username = read_string (reader);
+    handle_authenticate_remote (greeter, session_name, username, sequence_number);
+    return TRUE;
+}
+
+static gboolean
+read_continue_authentication (Greeter *greeter, MessageReader *reader)
+{
+    guint32 n_secrets = read_int (reader);
+    /* Every secret needs at least its length in the message */
+    if (n_secrets > (reader->length - reader->offset) / int_length ())
     {
-        g_warning ("Payload length of %u octets too long", payload_length);
-        return HEADER_SIZE;
+        g_warning ("Array length of %u elements too long", n_secrets);
+        return FALSE;
     }
+    g_autofree const gchar **secrets = g_new (const gchar *, n_secrets + 1);
+    guint32 i;
+    for (i = 0; i < n_secrets; i++)
+        secrets[i] = read_string (reader);
+    secrets[i] = NULL;
+    handle_continue_authentication (greeter, (gchar **) secrets);
+
+    /* Don't leave secrets lying around in the buffer */
+    memset (reader->data, 0, reader->length);
 
-    return HEADER_SIZE + payload_length;
+    return TRUE;
 }
 
-static gchar *
-read_string_full (Greeter *greeter, gsize *offset, void* (*alloc_fn)(size_t n))
+static gboolean
+read_cancel_authentication (Greeter *greeter, MessageReader *reader)
 {
-    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    handle_cancel_authentication (greeter);
+    return TRUE;
+}
+
+static gboolean
+read_start_session (Greeter *greeter, MessageReader *reader)
+{
+    const gchar *session_name = read_string (reader);
+    handle_start_session (greeter, session_name);
+    return TRUE;
+}
+
+static gboolean
+read_set_language (Greeter *greeter, MessageReader *reader)
+{
+    const gchar *language = read_string (reader);
+    handle_set_language (greeter, language);
+    return TRUE;
+}
 
-    guint32 length = read_int (greeter, offset);
-    if (priv->n_read - *offset < length)
+static gboolean
+read_ensure_shared_dir (Greeter *greeter, MessageReader *reader)
+{
+    const gchar *username = read_string (reader);
+    handle_ensure_shared_dir (greeter, username);
+    return TRUE;
+}
+
+static gboolean
+read_pong (Greeter *greeter, MessageReader *reader)
+{
+    guint32 sequence_number = read_int (reader);
+    handle_pong (greeter, sequence_number);
+    return TRUE;
+}
+
+/* Handlers for each message, return FALSE if the message was malformed and the greeter should be dropped */
+typedef gboolean (*MessageHandler) (Greeter *greeter, MessageReader *reader);
+static const MessageHandler message_handlers[] =
+{
+    [GREETER_MESSAGE_CONNECT] = read_connect,
+    [GREETER_MESSAGE_AUTHENTICATE] = read_authenticate,
+    [GREETER_MESSAGE_AUTHENTICATE_AS_GUEST] = read_authenticate_as_guest,
+    [GREETER_MESSAGE_CONTINUE_AUTHENTICATION] = read_continue_authentication,
+    [GREETER_MESSAGE_START_SESSION] = read_start_session,
+    [GREETER_MESSAGE_CANCEL_AUTHENTICATION] = read_cancel_authentication,
+    [GREETER_MESSAGE_SET_LANGUAGE] = read_set_language,
+    [GREETER_MESSAGE_AUTHENTICATE_REMOTE] = read_authenticate_remote,
+    [GREETER_MESSAGE_ENSURE_SHARED_DIR] = read_ensure_shared_dir,
+    [GREETER_MESSAGE_PONG] = read_pong,
+};
+
+static gboolean
+dispatch_message (Greeter *greeter, guint32 id, guint8 *data, gsize length)
+{
+    if (id >= G_N_ELEMENTS (message_handlers) || message_handlers[id] == NULL)
     {
-        g_warning ("Not enough space for string, need %u, got %zu", length, priv->n_read - *offset);
-        return g_strdup ("");
+        g_warning ("Unknown message from greeter: %u", id);
+        return TRUE;
     }
 
-    gchar *value = (*alloc_fn) (sizeof (gchar) * (length + 1));
-    memcpy (value, priv->read_buffer + *offset, length);
-    value[length] = '\0';
-    *offset += length;
+    MessageReader reader = { data, length, 0 };
+    return message_handlers[id] (greeter, &reader);
+}
 
-    return value;
+static guint32
+peek_int (const guint8 *buffer)
+{
+    return buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
 }
 
-static gchar *
-read_string (Greeter *greeter, gsize *offset)
+/* Record a message from the greeter, responses to authentication prompts are left empty */
+static void
+trace_received (Greeter *greeter, guint32 id, const guint8 *message, gsize length)
 {
-    return read_string_full (greeter, offset, g_malloc);
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (id != GREETER_MESSAGE_CONTINUE_AUTHENTICATION)
+    {
+        greeter_trace_write (priv->trace, GREETER_TRACE_FROM_GREETER, message, length);
+        return;
+    }
+
+    guint32 n_secrets = 0;
+    if (length >= HEADER_SIZE + int_length ())
+        n_secrets = MIN (peek_int (message + HEADER_SIZE), (length - HEADER_SIZE - int_length ()) / int_length ());
+    g_autoptr(GByteArray) redacted = g_byte_array_new ();
+    write_int (redacted, id);
+    write_int (redacted, 0);
+    write_int (redacted, n_secrets);
+    for (guint32 i = 0; i < n_secrets; i++)
+        write_string (redacted, NULL);
+    set_message_length (redacted);
+    greeter_trace_write (priv->trace, GREETER_TRACE_FROM_GREETER, redacted->data, redacted->len);
 }
 
-static gchar *
-read_secret (Greeter *greeter, gsize *offset)
+/* Process all the complete messages in the read buffer, return FALSE if the greeter should be dropped */
+static gboolean
+process_messages (Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return read_string_full (greeter, offset, gcry_malloc_secure);
-    else
-        return read_string_full (greeter, offset, g_malloc);
+
+    gsize offset = 0;
+    gboolean result = TRUE;
+    while (result && priv->n_read - offset >= HEADER_SIZE)
+    {
+        guint8 *header = priv->read_buffer + offset;
+        guint32 id = peek_int (header);
+        guint32 payload_length = peek_int (header + int_length ());
+        if (payload_length > G_MAXSIZE - HEADER_SIZE)
+        {
+            g_warning ("Payload length of %u octets too long", payload_length);
+            return FALSE;
+        }
+
+        gsize message_length = HEADER_SIZE + payload_length;
+        if (priv->n_read - offset < message_length)
+        {
+            /* Make room for the rest of this message */
+            if (message_length > priv->read_buffer_size)
+            {
+                memmove (priv->read_buffer, header, priv->n_read - offset);
+                priv->n_read -= offset;
+                offset = 0;
+                priv->read_buffer = secure_realloc (greeter, priv->read_buffer, message_length);
+                priv->read_buffer_size = message_length;
+            }
+            break;
+        }
+
+        common_metrics_add ("lightdm_greeter_messages_total", "direction=\"received\"", 1);
+        /* Answering pings doesn't mean anyone is using the greeter */
+        if (id != GREETER_MESSAGE_PONG)
+            priv->last_activity = g_get_monotonic_time ();
+        if (priv->trace)
+            trace_received (greeter, id, header, message_length);
+        result = dispatch_message (greeter, id, header + HEADER_SIZE, payload_length);
+        offset += message_length;
+    }
+
+    /* Keep any partial message for the next read */
+    if (offset > 0)
+    {
+        memmove (priv->read_buffer, priv->read_buffer + offset, priv->n_read - offset);
+        priv->n_read -= offset;
+    }
+
+    return result;
 }
 
 static gboolean
@@ -852,36 +1579,34 @@ read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
 
     if (condition == G_IO_HUP)
     {
-        g_debug ("Greeter closed communication channel");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter closed communication channel");
         priv->from_greeter_watch = 0;
+        stop_pings (greeter);
         g_signal_emit (greeter, signals[DISCONNECTED], 0);
         return FALSE;
     }
 
-    gsize n_to_read = HEADER_SIZE;
-    if (priv->n_read >= HEADER_SIZE)
+    /* Read as much as is available, the header tells us if more space is required */
+    if (priv->n_read == priv->read_buffer_size)
     {
-        n_to_read = get_message_length (greeter);
-        if (n_to_read <= HEADER_SIZE)
-        {
-            priv->from_greeter_watch = 0;
-            return FALSE;
-        }
+        priv->read_buffer_size *= 2;
+        priv->read_buffer = secure_realloc (greeter, priv->read_buffer, priv->read_buffer_size);
     }
 
     gsize n_read;
     g_autoptr(GError) error = NULL;
     GIOStatus status = g_io_channel_read_chars (priv->from_greeter_channel,
                                                 (gchar *) priv->read_buffer + priv->n_read,
-                                                n_to_read - priv->n_read,
+                                                priv->read_buffer_size - priv->n_read,
                                                 &n_read,
                                                 &error);
     if (error)
         g_warning ("Error reading from greeter: %s", error->message);
     if (status == G_IO_STATUS_EOF)
     {
-        g_debug ("Greeter closed communication channel");
+        log_debug (LOG_SUBSYSTEM_GREETER, "Greeter closed communication channel");
         priv->from_greeter_watch = 0;
+        stop_pings (greeter);
         g_signal_emit (greeter, signals[DISCONNECTED], 0);
         return FALSE;
     }
@@ -889,106 +1614,16 @@ read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
         return TRUE;
 
     priv->n_read += n_read;
-    if (priv->n_read != n_to_read)
-        return TRUE;
-
-    /* If have header, rerun for content */
-    if (priv->n_read == HEADER_SIZE)
-    {
-        n_to_read = get_message_length (greeter);
-        if (n_to_read > HEADER_SIZE)
-        {
-            priv->read_buffer = secure_realloc (greeter, priv->read_buffer, n_to_read);
-            read_cb (source, condition, greeter);
-            return TRUE;
-        }
-    }
+    common_metrics_add ("lightdm_greeter_bytes_total", "direction=\"received\"", n_read);
 
-    gsize offset = 0;
-    int id = read_int (greeter, &offset);
-    int length = HEADER_SIZE + read_int (greeter, &offset);
-    switch (id)
+    /* Handlers may cause the greeter to be dropped */
+    g_autoptr(Greeter) self = g_object_ref (greeter);
+    if (!process_messages (greeter))
     {
-    case GREETER_MESSAGE_CONNECT:
-        {
-            g_autofree gchar *version = read_string (greeter, &offset);
-            gboolean resettable = FALSE;
-            if (offset < length)
-                resettable = read_int (greeter, &offset) != 0;
-            guint32 api_version = 0;
-            if (offset < length)
-                api_version = read_int (greeter, &offset);
-            handle_connect (greeter, version, resettable, api_version);
-        }
-        break;
-    case GREETER_MESSAGE_AUTHENTICATE:
-        {
-            guint32 sequence_number = read_int (greeter, &offset);
-            g_autofree gchar *username = read_string (greeter, &offset);
-            handle_authenticate (greeter, sequence_number, username);
-        }
-        break;
-    case GREETER_MESSAGE_AUTHENTICATE_AS_GUEST:
-        {
-            guint32 sequence_number = read_int (greeter, &offset);
-            handle_authenticate_as_guest (greeter, sequence_number);
-        }
-        break;
-    case GREETER_MESSAGE_AUTHENTICATE_REMOTE:
-        {
-            guint32 sequence_number = read_int (greeter, &offset);
-            g_autofree gchar *session_name = read_string (greeter, &offset);
-            g_autofree gchar *username = read_string (greeter, &offset);
-            handle_authenticate_remote (greeter, session_name, username, sequence_number);
-        }
-        break;
-    case GREETER_MESSAGE_CONTINUE_AUTHENTICATION:
-        {
-            guint32 n_secrets = read_int (greeter, &offset);
-            guint32 max_secrets = (G_MAXUINT32 - 1) / sizeof (gchar *);
-            if (n_secrets > max_secrets)
-            {
-                g_warning ("Array length of %u elements too long", n_secrets);
-                priv->from_greeter_watch = 0;
-                return FALSE;
-            }
-            gchar **secrets = g_malloc (sizeof (gchar *) * (n_secrets + 1));
-            guint32 i;
-            for (i = 0; i < n_secrets; i++)
-                secrets[i] = read_secret (greeter, &offset);
-            secrets[i] = NULL;
-            handle_continue_authentication (greeter, secrets);
-            secure_freev (greeter, secrets);
-        }
-        break;
-    case GREETER_MESSAGE_CANCEL_AUTHENTICATION:
-        handle_cancel_authentication (greeter);
-        break;
-    case GREETER_MESSAGE_START_SESSION:
-        {
-            g_autofree gchar *session_name = read_string (greeter, &offset);
-            handle_start_session (greeter, session_name);
-        }
-        break;
-    case GREETER_MESSAGE_SET_LANGUAGE:
-        {
-            g_autofree gchar *language = read_string (greeter, &offset);
-            handle_set_language (greeter, language);
-        }
-        break;
-    case GREETER_MESSAGE_ENSURE_SHARED_DIR:
-        {
-            g_autofree gchar *username = read_string (greeter, &offset);
-            handle_ensure_shared_dir (greeter, username);
-        }
-        break;
-    default:
-        g_warning ("Unknown message from greeter: %d", id);
-        break;
+        priv->from_greeter_watch = 0;
+        return FALSE;
     }
 
-    priv->n_read = 0;
-
     return TRUE;
 }
 
@@ -1023,6 +1658,22 @@ greeter_get_resettable (Greeter *greeter)
     return priv->resettable;
 }
 
+gint64
+greeter_get_last_activity (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    g_return_val_if_fail (greeter != NULL, 0);
+    return priv->last_activity;
+}
+
+gboolean
+greeter_get_accepts_hint_changes (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    g_return_val_if_fail (greeter != NULL, FALSE);
+    return priv->incremental_hints;
+}
+
 gboolean
 greeter_get_start_session (Greeter *greeter)
 {
@@ -1056,10 +1707,17 @@ greeter_init (Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    priv->read_buffer = secure_malloc (greeter, HEADER_SIZE);
-    priv->hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
     priv->use_secure_memory = config_get_boolean (config_get_instance (), "LightDM", "lock-memory");
+    priv->reuse_authentication_session = config_get_boolean (config_get_instance (), "LightDM", "reuse-authentication-session");
+    priv->read_buffer_size = READ_BUFFER_SIZE;
+    priv->read_buffer = secure_malloc (greeter, priv->read_buffer_size);
+    priv->hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->hint_keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->changed_hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->write_queue = g_ptr_array_new_with_free_func ((GDestroyNotify) queued_message_free);
+    priv->shared_dir_requests = g_queue_new ();
     priv->to_greeter_input = -1;
+    priv->last_activity = g_get_monotonic_time ();
     priv->from_greeter_output = -1;
 }
 
@@ -1073,6 +1731,8 @@ greeter_finalize (GObject *object)
     g_clear_pointer (&priv->autologin_pam_service, g_free);
     secure_free (self, priv->read_buffer);
     g_hash_table_unref (priv->hints);
+    g_hash_table_unref (priv->hint_keys);
+    g_hash_table_unref (priv->changed_hints);
     g_clear_pointer (&priv->remote_session, g_free);
     g_clear_pointer (&priv->active_username, g_free);
     if (priv->authentication_session)
@@ -1080,14 +1740,21 @@ greeter_finalize (GObject *object)
         g_signal_handlers_disconnect_matched (priv->authentication_session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
         g_object_unref (priv->authentication_session);
     }
+    flush_messages (self);
+    if (priv->n_messages_written > 0)
+        log_debug (LOG_SUBSYSTEM_GREETER, "Sent %zu messages (%zu bytes) to greeter in %zu writes", priv->n_messages_written, priv->n_bytes_written, priv->n_write_calls);
+    g_ptr_array_unref (priv->write_queue);
+    g_queue_free_full (priv->shared_dir_requests, g_free);
     close (priv->to_greeter_input);
     close (priv->from_greeter_output);
-    if (priv->to_greeter_channel)
-        g_io_channel_unref (priv->to_greeter_channel);
     if (priv->from_greeter_channel)
         g_io_channel_unref (priv->from_greeter_channel);
     if (priv->from_greeter_watch)
         g_source_remove (priv->from_greeter_watch);
+    if (priv->ping_timeout)
+        g_source_remove (priv->ping_timeout);
+    g_clear_pointer (&priv->ping_labels, g_free);
+    g_clear_pointer (&priv->trace, greeter_trace_free);
 
     G_OBJECT_CLASS (greeter_parent_class)->finalize (object);
 }
@@ -1168,6 +1835,15 @@ greeter_class_init (GreeterClass *klass)
                       NULL,
                       G_TYPE_BOOLEAN, 2, G_TYPE_INT, G_TYPE_STRING);
 
+    signals[UNRESPONSIVE] =
+        g_signal_new (GREETER_SIGNAL_UNRESPONSIVE,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (GreeterClass, unresponsive),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+
     g_object_class_install_property (object_class,
                                      PROP_ACTIVE_USERNAME,
                                      g_param_spec_string (GREETER_PROPERTY_ACTIVE_USERNAME,
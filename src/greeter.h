@@ -27,6 +27,7 @@ G_BEGIN_DECLS
 #define GREETER_SIGNAL_DISCONNECTED   "disconnected"
 #define GREETER_SIGNAL_CREATE_SESSION "create-session"
 #define GREETER_SIGNAL_START_SESSION  "start-session"
+#define GREETER_SIGNAL_UNRESPONSIVE   "unresponsive"
 
 #define GREETER_PROPERTY_ACTIVE_USERNAME "active-username"
 
@@ -44,6 +45,7 @@ typedef struct
     void (*disconnected)(Greeter *greeter);  
     Session *(*create_session)(Greeter *greeter);
     gboolean (*start_session)(Greeter *greeter, SessionType type, const gchar *session);
+    void (*unresponsive)(Greeter *greeter);
 } GreeterClass;
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (Greeter, g_object_unref)
@@ -58,6 +60,8 @@ void greeter_stop (Greeter *greeter);
 
 void greeter_set_pam_services (Greeter *greeter, const gchar *pam_service, const gchar *autologin_pam_service);
 
+void greeter_set_ping (Greeter *greeter, guint interval, guint limit, const gchar *seat_name);
+
 void greeter_set_allow_guest (Greeter *greeter, gboolean allow_guest);
 
 void greeter_clear_hints (Greeter *greeter);
@@ -76,6 +80,10 @@ gboolean greeter_get_start_session (Greeter *greeter);
 
 gboolean greeter_get_resettable (Greeter *greeter);
 
+gint64 greeter_get_last_activity (Greeter *greeter);
+
+gboolean greeter_get_accepts_hint_changes (Greeter *greeter);
+
 const gchar *greeter_get_active_username (Greeter *greeter);
 
 G_END_DECLS
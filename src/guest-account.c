@@ -11,6 +11,7 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <gio/gio.h>
 
 #include "guest-account.h"
 #include "configuration.h"
@@ -38,74 +39,213 @@ guest_account_is_installed (void)
     return get_setup_script () != NULL;
 }
 
-static gboolean
-run_script (const gchar *script, gchar **stdout_text, gint *exit_status, GError **error)
-{
-    gint argc;
-    g_auto(GStrv) argv = NULL;
-    if (!g_shell_parse_argv (script, &argc, &argv, error))
-        return FALSE;
+/* Accounts that have been set up in advance */
+static GQueue pool = G_QUEUE_INIT;
+static gboolean filling_pool = FALSE;
 
-    gboolean result = g_spawn_sync (NULL, argv, NULL,
-                                    G_SPAWN_SEARCH_PATH,
-                                    NULL, NULL,
-                                    stdout_text, NULL, exit_status, error);
-
-    return result;
+static guint
+get_pool_size (void)
+{
+    return MAX (config_get_integer (config_get_instance (), "LightDM", "guest-account-pool-size"), 0);
 }
 
-gchar *
-guest_account_setup (void)
+static GSubprocess *
+run_script (const gchar *command, GSubprocessFlags flags, GError **error)
 {
-    g_autofree gchar *command = g_strdup_printf ("%s add", get_setup_script ());
-    g_debug ("Opening guest account with command '%s'", command);
-    g_autofree gchar *stdout_text = NULL;
-    gint exit_status;
-    g_autoptr(GError) error = NULL;
-    gboolean result = run_script (command, &stdout_text, &exit_status, &error);
-    if (error)
-        g_warning ("Error running guest account setup script '%s': %s", get_setup_script (), error->message);
-    if (!result)
+    gint argc;
+    g_auto(GStrv) argv = NULL;
+    if (!g_shell_parse_argv (command, &argc, &argv, error))
         return NULL;
 
-    if (exit_status != 0)
-    {
-        g_debug ("Guest account setup script returns %d: %s", exit_status, stdout_text);
-        return NULL;
-    }
+    return g_subprocess_newv ((const gchar * const *) argv, flags, error);
+}
 
+static gchar *
+get_username (const gchar *stdout_text, GError **error)
+{
     /* Use the last line and trim whitespace */
-    g_auto(GStrv) lines = g_strsplit (g_strstrip (stdout_text), "\n", -1);
+    g_autofree gchar *text = g_strdup (stdout_text ? stdout_text : "");
+    g_auto(GStrv) lines = g_strsplit (g_strstrip (text), "\n", -1);
     g_autofree gchar *username = NULL;
-    if (lines)
+    if (lines && lines[0])
         username = g_strdup (g_strstrip (lines[g_strv_length (lines) - 1]));
     else
         username = g_strdup ("");
 
     if (strcmp (username, "") == 0)
     {
-        g_debug ("Guest account setup script didn't return a username");
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Guest account setup script didn't return a username");
         return NULL;
     }
 
+    return g_steal_pointer (&username);
+}
+
+static void
+setup_script_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    GSubprocess *subprocess = G_SUBPROCESS (object);
+    g_autoptr(GTask) task = data;
+
+    g_autofree gchar *stdout_text = NULL;
+    GError *error = NULL;
+    if (!g_subprocess_communicate_utf8_finish (subprocess, result, &stdout_text, NULL, &error))
+    {
+        g_task_return_error (task, error);
+        return;
+    }
+
+    if (!g_subprocess_get_if_exited (subprocess))
+    {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Guest account setup script terminated");
+        return;
+    }
+    if (g_subprocess_get_exit_status (subprocess) != 0)
+    {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                 "Guest account setup script returns %d: %s", g_subprocess_get_exit_status (subprocess), stdout_text);
+        return;
+    }
+
+    gchar *username = get_username (stdout_text, &error);
+    if (!username)
+    {
+        g_task_return_error (task, error);
+        return;
+    }
+
     g_debug ("Guest account %s setup", username);
+    g_task_return_pointer (task, username, g_free);
+}
 
-    return g_steal_pointer (&username);
+static void
+run_setup_script (GTask *task)
+{
+    g_autofree gchar *command = g_strdup_printf ("%s add", get_setup_script ());
+    g_debug ("Opening guest account with command '%s'", command);
+    GError *error = NULL;
+    g_autoptr(GSubprocess) subprocess = run_script (command, G_SUBPROCESS_FLAGS_STDOUT_PIPE, &error);
+    if (!subprocess)
+    {
+        g_warning ("Error running guest account setup script '%s': %s", get_setup_script (), error->message);
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    g_subprocess_communicate_utf8_async (subprocess, NULL, NULL, setup_script_cb, task);
+}
+
+static void fill_pool (void);
+
+static void
+pool_setup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    filling_pool = FALSE;
+
+    g_autoptr(GError) error = NULL;
+    gchar *username = g_task_propagate_pointer (G_TASK (result), &error);
+    if (!username)
+    {
+        /* Don't retry, it will most likely fail again */
+        g_warning ("Failed to set up guest account for pool: %s", error->message);
+        return;
+    }
+    g_queue_push_tail (&pool, username);
+
+    fill_pool ();
+}
+
+/* Set up accounts one at a time until the pool is full */
+static void
+fill_pool (void)
+{
+    if (filling_pool || !guest_account_is_installed () || g_queue_get_length (&pool) >= get_pool_size ())
+        return;
+
+    filling_pool = TRUE;
+    run_setup_script (g_task_new (NULL, NULL, pool_setup_cb, NULL));
 }
 
 void
-guest_account_cleanup (const gchar *username)
+guest_account_prepare (void)
+{
+    fill_pool ();
+}
+
+void
+guest_account_setup_async (GAsyncReadyCallback callback, gpointer user_data)
+{
+    GTask *task = g_task_new (NULL, NULL, callback, user_data);
+
+    gchar *username = g_queue_pop_head (&pool);
+    if (username)
+    {
+        g_debug ("Using guest account %s from pool", username);
+        g_task_return_pointer (task, username, g_free);
+        g_object_unref (task);
+    }
+    else
+        run_setup_script (task);
+
+    /* Replace the used account in the background */
+    fill_pool ();
+}
+
+gchar *
+guest_account_setup_finish (GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+cleanup_script_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    GSubprocess *subprocess = G_SUBPROCESS (object);
+    g_autofree gchar *username = data;
+
+    g_autoptr(GError) error = NULL;
+    if (!g_subprocess_wait_finish (subprocess, result, &error))
+        g_warning ("Error running guest account cleanup script '%s': %s", get_setup_script (), error->message);
+    else if (!g_subprocess_get_if_exited (subprocess))
+        g_debug ("Guest account cleanup script terminated");
+    else if (g_subprocess_get_exit_status (subprocess) != 0)
+        g_debug ("Guest account cleanup script returns %d", g_subprocess_get_exit_status (subprocess));
+    else
+        g_debug ("Guest account %s closed", username);
+}
+
+static GSubprocess *
+run_cleanup_script (const gchar *username)
 {
     g_autofree gchar *command = g_strdup_printf ("%s remove %s", get_setup_script (), username);
     g_debug ("Closing guest account %s with command '%s'", username, command);
 
-    gint exit_status;
     g_autoptr(GError) error = NULL;
-    gboolean result = run_script (command, NULL, &exit_status, &error);
-
-    if (error)
+    GSubprocess *subprocess = run_script (command, G_SUBPROCESS_FLAGS_NONE, &error);
+    if (!subprocess)
         g_warning ("Error running guest account cleanup script '%s': %s", get_setup_script (), error->message);
 
-    if (result && exit_status != 0)
-        g_debug ("Guest account cleanup script returns %d", exit_status);
+    return subprocess;
+}
+
+void
+guest_account_cleanup (const gchar *username)
+{
+    g_autoptr(GSubprocess) subprocess = run_cleanup_script (username);
+    if (subprocess)
+        g_subprocess_wait_async (subprocess, NULL, cleanup_script_cb, g_strdup (username));
+}
+
+void
+guest_account_cleanup_pool (void)
+{
+    gchar *username;
+    while ((username = g_queue_pop_head (&pool)) != NULL)
+    {
+        g_autoptr(GSubprocess) subprocess = run_cleanup_script (username);
+        if (subprocess)
+            g_subprocess_wait (subprocess, NULL, NULL);
+        g_free (username);
+    }
 }
@@ -12,16 +12,22 @@
 #ifndef GUEST_ACCOUNT_H_
 #define GUEST_ACCOUNT_H_
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
 gboolean guest_account_is_installed (void);
 
-gchar *guest_account_setup (void);
+void guest_account_prepare (void);
+
+void guest_account_setup_async (GAsyncReadyCallback callback, gpointer user_data);
+
+gchar *guest_account_setup_finish (GAsyncResult *result, GError **error);
 
 void guest_account_cleanup (const gchar *username);
 
+void guest_account_cleanup_pool (void);
+
 G_END_DECLS
 
 #endif /* GUEST_ACCOUNT_H_ */
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gio/gio.h>
+
+#include "handoff.h"
+
+/* The daemon re-executes itself with the state in a memfd. The sessions keep
+ * running as they are still children of the same process, and each seat
+ * takes over its sessions when it starts again */
+
+/* Bump the version when changing the type */
+#define HANDOFF_VERSION 2
+#define HANDOFF_SESSION_TYPE "(sssiiisssbiussayi)"
+#define HANDOFF_TYPE "(uaia" HANDOFF_SESSION_TYPE ")"
+
+/* Sessions from before the restart that no seat has taken yet */
+static GList *kept_sessions = NULL;
+
+/* The pipes belong to whoever made the session, they are not closed here */
+void
+handoff_session_free (HandoffSession *session)
+{
+    if (!session)
+        return;
+
+    g_free (session->seat_name);
+    g_free (session->username);
+    g_free (session->session_type);
+    g_free (session->login1_session_id);
+    g_free (session->console_kit_cookie);
+    g_free (session->bus_path);
+    g_free (session->x_authority_file);
+    g_free (session->x_authority_name);
+    g_clear_pointer (&session->x_authority_data, g_bytes_unref);
+    g_free (session);
+}
+
+static void
+reap_cb (GPid pid, gint status, gpointer data)
+{
+    /* Only waited on so it doesn't stay a zombie */
+}
+
+/* Stop a session that can't be taken over, as is done for the daemon's own sessions */
+void
+handoff_session_abandon (HandoffSession *session)
+{
+    g_debug ("Stopping session for %s on seat %s from before restart", session->username, session->seat_name);
+
+    kill (session->session_pid, SIGTERM);
+    g_child_watch_add (session->session_pid, reap_cb, NULL);
+    if (session->x_server_pid != 0)
+    {
+        kill (session->x_server_pid, SIGTERM);
+        g_child_watch_add (session->x_server_pid, reap_cb, NULL);
+    }
+    close (session->to_child_input);
+    close (session->from_child_output);
+    handoff_session_free (session);
+}
+
+/* Write @sessions into a file that is passed on to the new daemon, the
+ * session pipes are kept open across the exec.  @stopping_pids are other
+ * children that have been told to stop, for the new daemon to reap */
+int
+handoff_save (GList *sessions, GArray *stopping_pids, GError **error)
+{
+    GVariantBuilder pids_builder;
+    g_variant_builder_init (&pids_builder, G_VARIANT_TYPE ("ai"));
+    for (guint i = 0; i < stopping_pids->len; i++)
+        g_variant_builder_add (&pids_builder, "i", g_array_index (stopping_pids, GPid, i));
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" HANDOFF_SESSION_TYPE));
+    for (GList *link = sessions; link; link = link->next)
+    {
+        HandoffSession *session = link->data;
+        gsize data_length = 0;
+        gconstpointer data = session->x_authority_data ? g_bytes_get_data (session->x_authority_data, &data_length) : NULL;
+        g_variant_builder_add (&builder, "(sssiiisssbiuss@ayi)",
+                               session->seat_name,
+                               session->username ? session->username : "",
+                               session->session_type,
+                               session->session_pid,
+                               session->to_child_input,
+                               session->from_child_output,
+                               session->login1_session_id ? session->login1_session_id : "",
+                               session->console_kit_cookie ? session->console_kit_cookie : "",
+                               session->bus_path ? session->bus_path : "",
+                               session->is_active,
+                               session->x_server_pid,
+                               session->display_number,
+                               session->x_authority_file ? session->x_authority_file : "",
+                               session->x_authority_name ? session->x_authority_name : "",
+                               g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data, data_length, 1),
+                               session->vt);
+    }
+    g_autoptr(GVariant) state = g_variant_ref_sink (g_variant_new ("(u@ai@a" HANDOFF_SESSION_TYPE ")", HANDOFF_VERSION, g_variant_builder_end (&pids_builder), g_variant_builder_end (&builder)));
+
+    int fd = memfd_create ("lightdm-handoff", 0);
+    if (fd < 0)
+    {
+        int e = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not create handoff file: %s", strerror (e));
+        return -1;
+    }
+
+    const gchar *data = g_variant_get_data (state);
+    gsize length = g_variant_get_size (state), offset = 0;
+    while (offset < length)
+    {
+        ssize_t n_written = write (fd, data + offset, length - offset);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+        {
+            int e = errno;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not write handoff file: %s", strerror (e));
+            close (fd);
+            return -1;
+        }
+        offset += n_written;
+    }
+    lseek (fd, 0, SEEK_SET);
+
+    for (GList *link = sessions; link; link = link->next)
+    {
+        HandoffSession *session = link->data;
+        fcntl (session->to_child_input, F_SETFD, 0);
+        fcntl (session->from_child_output, F_SETFD, 0);
+    }
+
+    return fd;
+}
+
+static gchar *
+dup_non_empty (const gchar *value)
+{
+    return value[0] != '\0' ? g_strdup (value) : NULL;
+}
+
+/* Read the sessions passed on by the daemon before it restarted, they are
+ * taken over with handoff_take_sessions () as their seats start */
+gboolean
+handoff_load (int fd, GError **error)
+{
+    g_autoptr(GByteArray) data = g_byte_array_new ();
+    guint8 buffer[4096];
+    while (TRUE)
+    {
+        ssize_t n_read = read (fd, buffer, sizeof (buffer));
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read < 0)
+        {
+            int e = errno;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not read handoff file: %s", strerror (e));
+            close (fd);
+            return FALSE;
+        }
+        if (n_read == 0)
+            break;
+        g_byte_array_append (data, buffer, n_read);
+    }
+    close (fd);
+
+    g_autoptr(GBytes) bytes = g_byte_array_free_to_bytes (g_steal_pointer (&data));
+    g_autoptr(GVariant) state = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (HANDOFF_TYPE), bytes, FALSE));
+
+    guint32 version;
+    g_autoptr(GVariantIter) pids_iter = NULL;
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get (state, "(uaia" HANDOFF_SESSION_TYPE ")", &version, &pids_iter, &iter);
+    if (version != HANDOFF_VERSION)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unsupported handoff version %u", version);
+        return FALSE;
+    }
+
+    gint32 pid;
+    while (g_variant_iter_next (pids_iter, "i", &pid))
+        g_child_watch_add (pid, reap_cb, NULL);
+
+    const gchar *seat_name, *username, *session_type, *login1_session_id, *console_kit_cookie, *bus_path, *x_authority_file, *x_authority_name;
+    gint32 session_pid, to_child_input, from_child_output, x_server_pid, vt;
+    gboolean is_active;
+    guint32 display_number;
+    GVariant *x_authority_data;
+    while (g_variant_iter_next (iter, "(&s&s&siii&s&s&sbiu&s&s@ayi)", &seat_name, &username, &session_type,
+                                &session_pid, &to_child_input, &from_child_output,
+                                &login1_session_id, &console_kit_cookie, &bus_path, &is_active,
+                                &x_server_pid, &display_number, &x_authority_file, &x_authority_name, &x_authority_data, &vt))
+    {
+        HandoffSession *session = g_malloc0 (sizeof (HandoffSession));
+        session->seat_name = g_strdup (seat_name);
+        session->username = g_strdup (username);
+        session->session_type = g_strdup (session_type);
+        session->session_pid = session_pid;
+        session->to_child_input = to_child_input;
+        session->from_child_output = from_child_output;
+        session->login1_session_id = dup_non_empty (login1_session_id);
+        session->console_kit_cookie = dup_non_empty (console_kit_cookie);
+        session->bus_path = dup_non_empty (bus_path);
+        session->is_active = is_active;
+        session->x_server_pid = x_server_pid;
+        session->display_number = display_number;
+        session->x_authority_file = dup_non_empty (x_authority_file);
+        session->x_authority_name = dup_non_empty (x_authority_name);
+        if (g_variant_get_size (x_authority_data) > 0)
+            session->x_authority_data = g_variant_get_data_as_bytes (x_authority_data);
+        g_variant_unref (x_authority_data);
+        session->vt = vt;
+
+        /* Don't pass the pipes on to anything the daemon runs */
+        fcntl (to_child_input, F_SETFD, FD_CLOEXEC);
+        fcntl (from_child_output, F_SETFD, FD_CLOEXEC);
+
+        g_debug ("Keeping session for %s on seat %s from before restart (session child %d, X server %d on display :%u, VT %d)",
+                 username, seat_name, session_pid, x_server_pid, display_number, vt);
+        kept_sessions = g_list_append (kept_sessions, session);
+    }
+
+    return TRUE;
+}
+
+/* Get the sessions from before the restart to run on @seat_name, the caller
+ * takes over the sessions and their pipes */
+GList *
+handoff_take_sessions (const gchar *seat_name)
+{
+    GList *sessions = NULL;
+    for (GList *link = kept_sessions; link; )
+    {
+        GList *next = link->next;
+        HandoffSession *session = link->data;
+        if (g_strcmp0 (session->seat_name, seat_name) == 0)
+        {
+            kept_sessions = g_list_delete_link (kept_sessions, link);
+            sessions = g_list_append (sessions, session);
+        }
+        link = next;
+    }
+
+    return sessions;
+}
+
+/* Stop the sessions that no seat took over */
+void
+handoff_cleanup (void)
+{
+    g_list_free_full (kept_sessions, (GDestroyNotify) handoff_session_abandon);
+    kept_sessions = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A user session kept running while the daemon restarts */
+typedef struct
+{
+    gchar *seat_name;
+    gchar *username;
+
+    /* "x" or "wayland" */
+    gchar *session_type;
+
+    /* Session child and the pipes the daemon talks to it on */
+    GPid session_pid;
+    int to_child_input;
+    int from_child_output;
+
+    /* Registrations of the session, NULL if not registered */
+    gchar *login1_session_id;
+    gchar *console_kit_cookie;
+
+    /* D-Bus path the session was exported on */
+    gchar *bus_path;
+
+    /* TRUE if this was the active session on the seat */
+    gboolean is_active;
+
+    /* X server the session is using, 0 if none */
+    GPid x_server_pid;
+    guint display_number;
+    gchar *x_authority_file;
+    gchar *x_authority_name;
+    GBytes *x_authority_data;
+
+    gint vt;
+} HandoffSession;
+
+void handoff_session_free (HandoffSession *session);
+
+void handoff_session_abandon (HandoffSession *session);
+
+int handoff_save (GList *sessions, GArray *stopping_pids, GError **error);
+
+gboolean handoff_load (int fd, GError **error);
+
+GList *handoff_take_sessions (const gchar *seat_name);
+
+void handoff_cleanup (void);
+
+G_END_DECLS
+
+#endif /* HANDOFF_H_ */
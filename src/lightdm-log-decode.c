@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "log-binary.h"
+
+/* Prints a log written with log-format=binary as text */
+int
+main (int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        g_printerr ("Usage: %s LOG-FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) file = g_mapped_file_new (argv[1], FALSE, &error);
+    if (!file)
+    {
+        g_printerr ("Failed to open %s: %s\n", argv[1], error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (!log_binary_decode ((const guint8 *) g_mapped_file_get_contents (file), g_mapped_file_get_length (file), stdout, &error))
+    {
+        g_printerr ("Failed to decode %s: %s\n", argv[1], error->message);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
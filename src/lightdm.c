@@ -13,6 +13,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <glib.h>
 #include <glib/gi18n.h>
@@ -26,17 +27,39 @@
 #include "display-manager-service.h"
 #include "xdmcp-server.h"
 #include "vnc-server.h"
+#include "vnc-pool.h"
 #include "seat-xdmcp-session.h"
 #include "seat-xvnc.h"
 #include "x-server.h"
+#include "x-server-local.h"
+#include "wayland-session.h"
+#include "seat-local.h"
+#include "greeter-session.h"
+#include "handoff.h"
 #include "process.h"
 #include "session-child.h"
+#include "guest-account.h"
 #include "shared-data-manager.h"
+#include "greeter-host.h"
 #include "user-list.h"
+#include "session-index.h"
+#include "locale-names.h"
+#include "dmrc.h"
+#include "nss.h"
 #include "login1.h"
+#include "accounting.h"
 #include "log-file.h"
+#include "log-binary.h"
+#include "login-trace.h"
+#include "startup-profile.h"
+#include "metrics.h"
+#include "socket-activation.h"
+#include "service-notify.h"
+#include "greeter.h"
+#include "x-authority.h"
 
 static gchar *config_path = NULL;
+static gchar **daemon_argv = NULL;
 static GMainLoop *loop = NULL;
 static GTimer *log_timer;
 static int log_fd = -1;
@@ -48,54 +71,242 @@ static XDMCPServer *xdmcp_server = NULL;
 static guint xdmcp_client_count = 0;
 static VNCServer *vnc_server = NULL;
 static guint vnc_client_count = 0;
+static VNCPool *vnc_pool = NULL;
+static guint vnc_pool_count = 0;
 static gint exit_code = EXIT_SUCCESS;
 
+/* Steps that both need to be done before the service manager is told the daemon has started */
+static gboolean display_manager_started = FALSE;
+static gboolean seats_created = FALSE;
+
 static gboolean update_login1_seat (Login1Seat *login1_seat);
 
+/* Timeouts waiting for logind seats to stop changing */
+static GHashTable *login1_settle_timeouts = NULL;
+static void reload_config (void);
+static void set_config_defaults (Configuration *config);
+
+/* Log messages are queued and written by a background thread so slow log
+ * storage doesn't stall the main loop */
+#define LOG_FLUSH_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+#define LOG_BATCH_SIZE 4096
+#define LOG_BUFFER_LIMIT (1024 * 1024)
+
+static GMutex log_lock;
+static GCond log_cond;
+static GString *log_buffer = NULL;
+static GMutex log_write_lock;
+static GString *log_write_buffer = NULL;
+static GThread *log_thread = NULL;
+static gboolean log_thread_quit = FALSE;
+static pid_t log_pid = 0;
+
+/* TRUE if writing records for lightdm-log-decode rather than text */
+static gboolean log_binary = FALSE;
+
 static void
-log_cb (const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer data)
+log_write (const gchar *text, gsize length)
+{
+    /* Log everything to a file */
+    if (log_fd >= 0)
+    {
+        gsize offset = 0;
+        while (offset < length)
+        {
+            ssize_t n_written = write (log_fd, text + offset, length - offset);
+            if (n_written < 0 && errno == EINTR)
+                continue;
+            if (n_written <= 0)
+                break;
+            offset += n_written;
+        }
+    }
+
+    /* Log to stderr if requested, binary logs do this as messages arrive */
+    if (debug && !log_binary)
+        g_printerr ("%.*s", (int) length, text);
+}
+
+/* Write out everything queued so far, in order */
+static void
+log_flush (void)
 {
+    g_mutex_lock (&log_write_lock);
+
+    g_mutex_lock (&log_lock);
+    GString *pending = log_buffer;
+    log_buffer = log_write_buffer;
+    log_write_buffer = pending;
+    g_mutex_unlock (&log_lock);
+
+    if (log_write_buffer->len > 0)
+        log_write (log_write_buffer->str, log_write_buffer->len);
+    g_string_truncate (log_write_buffer, 0);
+
+    g_mutex_unlock (&log_write_lock);
+}
+
+/* Queue data appended by @append_func for the writer thread */
+static void
+log_queue (GLogLevelFlags log_level, void (*append_func) (GString *buffer, gpointer data), gpointer data)
+{
+    g_mutex_lock (&log_lock);
+    gsize old_length = log_buffer->len;
+    append_func (log_buffer, data);
+    gboolean flush_now = (log_level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL)) != 0 || log_buffer->len >= LOG_BUFFER_LIMIT;
+    if (old_length == 0 || log_buffer->len >= LOG_BATCH_SIZE)
+        g_cond_signal (&log_cond);
+    g_mutex_unlock (&log_lock);
+
+    /* Make sure serious errors are written before we possibly abort, and
+     * don't let the queue grow without limit if the writer falls behind */
+    if (flush_now)
+        log_flush ();
+}
+
+static gpointer
+log_thread_cb (gpointer data)
+{
+    g_mutex_lock (&log_lock);
+    while (TRUE)
+    {
+        while (!log_thread_quit && log_buffer->len == 0)
+            g_cond_wait (&log_cond, &log_lock);
+        if (log_thread_quit)
+            break;
+
+        /* Give other messages a chance to arrive so they can be written together */
+        gint64 end_time = g_get_monotonic_time () + LOG_FLUSH_INTERVAL;
+        while (!log_thread_quit && log_buffer->len < LOG_BATCH_SIZE)
+            if (!g_cond_wait_until (&log_cond, &log_lock, end_time))
+                break;
+
+        g_mutex_unlock (&log_lock);
+        log_flush ();
+        g_mutex_lock (&log_lock);
+    }
+    g_mutex_unlock (&log_lock);
+
+    return NULL;
+}
+
+typedef struct
+{
+    GLogLevelFlags log_level;
     const gchar *prefix;
-    switch (log_level & G_LOG_LEVEL_MASK)
+    const gchar *format;
+    va_list *ap;
+    const gchar *message;
+} LogEntry;
+
+static void
+append_text (GString *buffer, gpointer data)
+{
+    LogEntry *entry = data;
+    gint64 time = g_timer_elapsed (log_timer, NULL) * G_USEC_PER_SEC;
+    if (log_binary)
+        log_binary_write_text (buffer, time, entry->log_level, entry->message);
+    else
+        g_string_append_printf (buffer, "[%+.2fs] %s %s\n", time / (gdouble) G_USEC_PER_SEC, log_level_get_prefix (entry->log_level), entry->message);
+}
+
+static void
+append_message (GString *buffer, gpointer data)
+{
+    LogEntry *entry = data;
+    log_binary_write_message (buffer, g_timer_elapsed (log_timer, NULL) * G_USEC_PER_SEC, entry->log_level, entry->prefix, entry->format, *entry->ap);
+}
+
+/* Store subsystem messages without formatting them */
+static void
+log_unformatted_cb (GLogLevelFlags log_level, const gchar *prefix, const gchar *format, va_list ap)
+{
+    /* Forked children write whole messages straight to the file */
+    if (!log_thread || getpid () != log_pid || debug)
     {
-    case G_LOG_LEVEL_ERROR:
-        prefix = "ERROR:";
-        break;
-    case G_LOG_LEVEL_CRITICAL:
-        prefix = "CRITICAL:";
-        break;
-    case G_LOG_LEVEL_WARNING:
-        prefix = "WARNING:";
-        break;
-    case G_LOG_LEVEL_MESSAGE:
-        prefix = "MESSAGE:";
-        break;
-    case G_LOG_LEVEL_INFO:
-        prefix = "INFO:";
-        break;
-    case G_LOG_LEVEL_DEBUG:
-        prefix = "DEBUG:";
-        break;
-    default:
-        prefix = "LOG:";
-        break;
+        g_autofree gchar *message = g_strdup_vprintf (format, ap);
+        if (prefix)
+            g_log (LOGGER_LOG_DOMAIN, log_level, "%s%s", prefix, message);
+        else
+            g_log (LOGGER_LOG_DOMAIN, log_level, "%s", message);
+        return;
     }
 
-    g_autofree gchar *text = g_strdup_printf ("[%+.2fs] %s %s\n", g_timer_elapsed (log_timer, NULL), prefix, message);
+    va_list ap_copy;
+    va_copy (ap_copy, ap);
+    LogEntry entry = { log_level, prefix, format, &ap_copy, NULL };
+    log_queue (log_level, append_message, &entry);
+    va_end (ap_copy);
+}
 
-    /* Log everything to a file */
-    if (log_fd >= 0)
+static void
+log_cb (const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer data)
+{
+    /* Messages from subsystems have been checked before they were formatted */
+    gboolean checked = g_strcmp0 (log_domain, LOGGER_LOG_DOMAIN) == 0;
+    if (!checked && !logger_level_enabled (LOG_SUBSYSTEM_GENERAL, log_level & G_LOG_LEVEL_MASK))
+        return;
+
+    LogEntry entry = { log_level, NULL, NULL, NULL, message };
+
+    /* Forked children don't have the writer thread and may have inherited the lock held */
+    if (!log_thread || getpid () != log_pid)
     {
-        ssize_t n_written = write (log_fd, text, strlen (text));
-        if (n_written < 0)
-            ; /* Check result so compiler doesn't warn about it */
+        g_autoptr(GString) text = g_string_new (NULL);
+        append_text (text, &entry);
+        log_write (text->str, text->len);
     }
+    else
+        log_queue (log_level, append_text, &entry);
+
+    /* Binary logs can't be echoed as they are written */
+    if (debug && log_binary)
+        g_printerr ("[%+.2fs] %s %s\n", g_timer_elapsed (log_timer, NULL), log_level_get_prefix (log_level), message);
 
-    /* Log to stderr if requested */
+    if (!debug)
+        g_log_default_handler (checked ? NULL : log_domain, log_level, message, data);
+}
+
+static void
+set_log_levels (void)
+{
+    /* Running with --debug shows everything */
     if (debug)
-        g_printerr ("%s", text);
-    else
-        g_log_default_handler (log_domain, log_level, message, data);
+    {
+        logger_set_all_levels (G_LOG_LEVEL_MASK);
+        return;
+    }
+
+    g_autofree gchar *level = config_get_string (config_get_instance (), "LightDM", "log-level");
+    if (!logger_set_level (NULL, level))
+    {
+        g_warning ("Invalid log-level %s", level);
+        logger_set_all_levels (G_LOG_LEVEL_MASK);
+    }
+
+    g_auto(GStrv) overrides = config_get_string_list (config_get_instance (), "LightDM", "log-subsystem-levels");
+    for (gint i = 0; overrides && overrides[i]; i++)
+    {
+        g_auto(GStrv) tokens = g_strsplit (overrides[i], "=", 2);
+        if (g_strv_length (tokens) != 2 || !logger_set_level (g_strstrip (tokens[0]), g_strstrip (tokens[1])))
+            g_warning ("Invalid log-subsystem-levels entry %s", overrides[i]);
+    }
+}
+
+static void
+log_shutdown (void)
+{
+    if (!log_thread || getpid () != log_pid)
+        return;
+
+    g_mutex_lock (&log_lock);
+    log_thread_quit = TRUE;
+    g_cond_signal (&log_cond);
+    g_mutex_unlock (&log_lock);
+    g_thread_join (log_thread);
+
+    log_flush ();
+    log_thread = NULL;
 }
 
 static void
@@ -105,19 +316,52 @@ log_init (void)
 
     /* Log to a file */
     g_autofree gchar *log_dir = config_get_string (config_get_instance (), "LightDM", "log-directory");
-    g_autofree gchar *path = g_build_filename (log_dir, "lightdm.log", NULL);
+    g_autofree gchar *log_format = config_get_string (config_get_instance (), "LightDM", "log-format");
+    log_binary = g_strcmp0 (log_format, "binary") == 0;
+    if (!log_binary && g_strcmp0 (log_format, "text") != 0)
+        g_warning ("Invalid log-format %s, using text", log_format);
+    g_autofree gchar *path = g_build_filename (log_dir, log_binary ? "lightdm.log.bin" : "lightdm.log", NULL);
+
+    log_file_set_max_size ((goffset) config_get_integer (config_get_instance (), "LightDM", "log-max-size") * 1024);
+    log_file_set_compress (config_get_boolean (config_get_instance (), "LightDM", "compress-old-logs"));
 
     gboolean backup_logs = config_get_boolean (config_get_instance (), "LightDM", "backup-logs");
     log_fd = log_file_open (path, backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND);
     fcntl (log_fd, F_SETFD, FD_CLOEXEC);
+
+    log_buffer = g_string_sized_new (LOG_BATCH_SIZE);
+    log_write_buffer = g_string_sized_new (LOG_BATCH_SIZE);
+    if (log_binary)
+        log_binary_write_header (log_buffer);
+    log_pid = getpid ();
+    log_thread = g_thread_new ("log-writer", log_thread_cb, NULL);
+    if (log_binary)
+        logger_set_unformatted_func (log_unformatted_cb);
+    atexit (log_shutdown);
     g_log_set_default_handler (log_cb, NULL);
 
     g_debug ("Logging to %s", path);
 }
 
+/* Config sections that apply to each seat name, as matching the globs doesn't change */
+static GHashTable *seat_config_sections = NULL;
+
+static void
+free_config_sections (gpointer sections)
+{
+    g_list_free_full (sections, g_free);
+}
+
 static GList*
 get_config_sections (const gchar *seat_name)
 {
+    if (!seat_config_sections)
+        seat_config_sections = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_config_sections);
+
+    GList *cached_sections = g_hash_table_lookup (seat_config_sections, seat_name ? seat_name : "");
+    if (cached_sections)
+        return g_list_copy_deep (cached_sections, (GCopyFunc) g_strdup, NULL);
+
     /* Load seat defaults first */
     GList *config_sections = g_list_append (NULL, g_strdup ("Seat:*"));
 
@@ -132,13 +376,17 @@ get_config_sections (const gchar *seat_name)
         }
     }
 
+    g_hash_table_insert (seat_config_sections, g_strdup (seat_name ? seat_name : ""), g_list_copy_deep (config_sections, (GCopyFunc) g_strdup, NULL));
+
     return config_sections;
 }
 
 static void
-set_seat_properties (Seat *seat, const gchar *seat_name)
+set_seat_properties_from_sections (Seat *seat, const gchar *seat_name, GList *sections)
 {
-    GList *sections = get_config_sections (seat_name);
+    /* Remember which sections apply so the properties can be updated on reload */
+    g_object_set_data_full (G_OBJECT (seat), "lightdm-config-name", g_strdup (seat_name ? seat_name : ""), g_free);
+
     for (GList *link = sections; link; link = link->next)
     {
         const gchar *section = link->data;
@@ -153,9 +401,70 @@ set_seat_properties (Seat *seat, const gchar *seat_name)
             seat_set_property (seat, keys[i], value);
         }
     }
+}
+
+static void
+set_seat_properties (Seat *seat, const gchar *seat_name)
+{
+    GList *sections = get_config_sections (seat_name);
+    set_seat_properties_from_sections (seat, seat_name, sections);
     g_list_free_full (sections, g_free);
 }
 
+static guint
+get_n_open_fds (void)
+{
+    g_autoptr(GDir) dir = g_dir_open ("/proc/self/fd", 0, NULL);
+    if (!dir)
+        return 0;
+
+    guint n_fds = 0;
+    while (g_dir_read_name (dir))
+        n_fds++;
+
+    /* Don't count the descriptor used to read the directory */
+    return n_fds > 0 ? n_fds - 1 : 0;
+}
+
+/* Log the number of live objects and the size of long-lived tables so growth
+ * over a long uptime can be tracked down. GObject only counts instances when
+ * the daemon is run with GOBJECT_DEBUG=instance-count */
+static void
+log_daemon_stats (void)
+{
+    static const struct
+    {
+        const gchar *name;
+        GType (*get_type) (void);
+    } types[] =
+    {
+        { "Seat", seat_get_type },
+        { "Session", session_get_type },
+        { "Greeter", greeter_get_type },
+        { "Process", process_get_type },
+        { "XAuthority", x_authority_get_type },
+        { "CommonUser", common_user_get_type },
+        { "XDMCPSession", xdmcp_session_get_type },
+    };
+
+    g_debug ("Daemon statistics:");
+    for (gsize i = 0; i < G_N_ELEMENTS (types); i++)
+        g_debug ("  %s instances: %d", types[i].name, g_type_get_instance_count (types[i].get_type ()));
+
+    g_debug ("  Child processes: %u", process_get_count ());
+    if (xdmcp_server)
+        g_debug ("  XDMCP sessions: %u", xdmcp_server_get_n_sessions (xdmcp_server));
+    if (display_manager_service)
+    {
+        guint n_seats, n_sessions;
+        display_manager_service_get_n_bus_entries (display_manager_service, &n_seats, &n_sessions);
+        g_debug ("  D-Bus seat objects: %u", n_seats);
+        g_debug ("  D-Bus session objects: %u", n_sessions);
+    }
+    g_debug ("  Seats: %u", g_list_length (display_manager_get_seats (display_manager)));
+    g_debug ("  Open file descriptors: %u", get_n_open_fds ());
+}
+
 static void
 signal_cb (Process *process, int signum)
 {
@@ -167,9 +476,14 @@ signal_cb (Process *process, int signum)
         display_manager_stop (display_manager);
         // FIXME: Stop XDMCP server
         break;
+    case SIGHUP:
+        g_debug ("Caught %s signal, reloading configuration", g_strsignal (signum));
+        reload_config ();
+        break;
     case SIGUSR1:
+        break;
     case SIGUSR2:
-    case SIGHUP:
+        log_daemon_stats ();
         break;
     }
 }
@@ -262,6 +576,47 @@ display_manager_seat_removed_cb (DisplayManager *display_manager, Seat *seat)
     }
 }
 
+static void
+set_xdmcp_load_options (void)
+{
+    xdmcp_server_set_report_load (xdmcp_server, config_get_boolean (config_get_instance (), "XDMCPServer", "report-load"));
+    xdmcp_server_set_max_sessions (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "max-sessions"), 0));
+    g_autofree gchar *busy_load = config_get_string (config_get_instance (), "XDMCPServer", "busy-load");
+    xdmcp_server_set_busy_load (xdmcp_server,
+                                busy_load ? g_ascii_strtod (busy_load, NULL) : 0,
+                                MAX (config_get_integer (config_get_instance (), "XDMCPServer", "busy-delay"), 0));
+}
+
+static void
+xdmcp_seat_launched_cb (Seat *seat, XDMCPSession *session)
+{
+    xdmcp_server_launch_complete (xdmcp_server, session);
+}
+
+static void
+xdmcp_seat_running_user_session_cb (Seat *seat, Session *user_session, XDMCPSession *session)
+{
+    xdmcp_server_launch_complete (xdmcp_server, session);
+}
+
+static void
+xdmcp_seat_stopped_cb (Seat *seat, XDMCPSession *session)
+{
+    xdmcp_server_launch_complete (xdmcp_server, session);
+    xdmcp_server_session_ended (xdmcp_server, session);
+}
+
+/* Remote seats are stopped if their greeter goes unused for the configured time */
+static void
+set_greeter_idle_timeout (Seat *seat, const gchar *section)
+{
+    if (!config_has_key (config_get_instance (), section, "greeter-idle-timeout"))
+        return;
+
+    g_autofree gchar *value = g_strdup_printf ("%d", config_get_integer (config_get_instance (), section, "greeter-idle-timeout"));
+    seat_set_property (seat, "greeter-idle-timeout", value);
+}
+
 static gboolean
 xdmcp_session_cb (XDMCPServer *server, XDMCPSession *session)
 {
@@ -270,28 +625,103 @@ xdmcp_session_cb (XDMCPServer *server, XDMCPSession *session)
     g_autofree gchar *name = g_strdup_printf ("xdmcp%d", xdmcp_client_count);
     xdmcp_client_count++;
 
+    /* Free up the launch slot once the greeter or an automatic login is running, or the seat failed */
+    g_signal_connect (seat, SEAT_SIGNAL_GREETER_CONNECTED, G_CALLBACK (xdmcp_seat_launched_cb), session);
+    g_signal_connect (seat, SEAT_SIGNAL_RUNNING_USER_SESSION, G_CALLBACK (xdmcp_seat_running_user_session_cb), session);
+    g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (xdmcp_seat_stopped_cb), session);
+
     seat_set_name (SEAT (seat), name);
     set_seat_properties (SEAT (seat), NULL);
+    set_greeter_idle_timeout (SEAT (seat), "XDMCPServer");
     return display_manager_add_seat (display_manager, SEAT (seat));
 }
 
+static void
+vnc_seat_launched_cb (Seat *seat, GSocket *connection)
+{
+    vnc_server_launch_complete (vnc_server, connection);
+}
+
 static void
 vnc_connection_cb (VNCServer *server, GSocket *connection)
 {
+    /* Use an X server that is already running if there is one */
+    if (vnc_pool_take (vnc_pool, connection))
+    {
+        vnc_server_launch_complete (server, connection);
+        return;
+    }
+
     g_autoptr(SeatXVNC) seat = seat_xvnc_new (connection);
 
     g_autofree gchar *name = g_strdup_printf ("vnc%d", vnc_client_count);
     vnc_client_count++;
 
+    /* Free up the launch slot once the X server is running or has failed */
+    g_signal_connect (seat, SEAT_XVNC_SIGNAL_READY, G_CALLBACK (vnc_seat_launched_cb), connection);
+    g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (vnc_seat_launched_cb), connection);
+
     seat_set_name (SEAT (seat), name);
     set_seat_properties (SEAT (seat), NULL);
-    display_manager_add_seat (display_manager, SEAT (seat));
+    set_greeter_idle_timeout (SEAT (seat), "VNCServer");
+    if (!display_manager_add_seat (display_manager, SEAT (seat)))
+        vnc_server_launch_complete (server, connection);
+}
+
+static SeatXVNC *
+vnc_pool_create_seat_cb (VNCPool *pool, GSocket *connection)
+{
+    g_autoptr(SeatXVNC) seat = seat_xvnc_new (connection);
+
+    g_autofree gchar *name = g_strdup_printf ("vnc-pool%d", vnc_pool_count);
+    vnc_pool_count++;
+
+    seat_set_name (SEAT (seat), name);
+    set_seat_properties (SEAT (seat), NULL);
+    if (!display_manager_add_seat (display_manager, SEAT (seat)))
+        return NULL;
+
+    return g_steal_pointer (&seat);
+}
+
+static gchar *
+load_xdmcp_key (const gchar *key_name)
+{
+    if (!key_name)
+        return NULL;
+
+    g_autofree gchar *path = g_build_filename (config_get_directory (config_get_instance ()), "keys.conf", NULL);
+
+    g_autoptr(GKeyFile) keys = g_key_file_new ();
+    g_autoptr(GError) error = NULL;
+    gboolean result = g_key_file_load_from_file (keys, path, G_KEY_FILE_NONE, &error);
+    if (error)
+        g_warning ("Unable to load keys from %s: %s", path, error->message);
+
+    if (!result)
+        return NULL;
+
+    if (!g_key_file_has_key (keys, "keyring", key_name, NULL))
+    {
+        g_warning ("Key %s not defined", key_name);
+        return NULL;
+    }
+
+    return g_key_file_get_string (keys, "keyring", key_name, NULL);
+}
+
+static void
+notify_if_started (void)
+{
+    if (display_manager_started && seats_created)
+        service_notify_milestone (SERVICE_NOTIFY_STARTED);
 }
 
 static void
 start_display_manager (void)
 {
     display_manager_start (display_manager);
+    startup_profile_mark ("display-manager-started");
 
     /* Start the XDMCP server */
     if (config_get_boolean (config_get_instance (), "XDMCPServer", "enabled"))
@@ -308,28 +738,15 @@ start_display_manager (void)
         xdmcp_server_set_listen_address (xdmcp_server, listen_address);
         g_autofree gchar *hostname = config_get_string (config_get_instance (), "XDMCPServer", "hostname");
         xdmcp_server_set_hostname (xdmcp_server, hostname);
+        xdmcp_server_set_max_launches (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "max-launches"), 0));
+        g_auto(GStrv) priority_classes = config_get_string_list (config_get_instance (), "XDMCPServer", "priority-display-classes");
+        xdmcp_server_set_priority_classes (xdmcp_server, priority_classes);
+        xdmcp_server_set_worker_threads (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "worker-threads"), 0));
+        set_xdmcp_load_options ();
         g_signal_connect (xdmcp_server, XDMCP_SERVER_SIGNAL_NEW_SESSION, G_CALLBACK (xdmcp_session_cb), NULL);
 
         g_autofree gchar *key_name = config_get_string (config_get_instance (), "XDMCPServer", "key");
-        g_autofree gchar *key = NULL;
-        if (key_name)
-        {
-            g_autofree gchar *path = g_build_filename (config_get_directory (config_get_instance ()), "keys.conf", NULL);
-
-            g_autoptr(GKeyFile) keys = g_key_file_new ();
-            g_autoptr(GError) error = NULL;
-            gboolean result = g_key_file_load_from_file (keys, path, G_KEY_FILE_NONE, &error);
-            if (error)
-                g_warning ("Unable to load keys from %s: %s", path, error->message);
-
-            if (result)
-            {
-                if (g_key_file_has_key (keys, "keyring", key_name, NULL))
-                    key = g_key_file_get_string (keys, "keyring", key_name, NULL);
-                else
-                    g_warning ("Key %s not defined", key_name);
-            }
-        }
+        g_autofree gchar *key = load_xdmcp_key (key_name);
         if (key)
             xdmcp_server_set_key (xdmcp_server, key);
 
@@ -361,18 +778,350 @@ start_display_manager (void)
             }
             g_autofree gchar *listen_address = config_get_string (config_get_instance (), "VNCServer", "listen-address");
             vnc_server_set_listen_address (vnc_server, listen_address);
+            vnc_server_set_max_launches (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "max-launches"), 0));
+            vnc_server_set_rate_limit (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "rate-limit"), 0));
+            vnc_server_set_admission_timeout (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "admission-timeout"), 0));
+            if (display_manager_service)
+                display_manager_service_set_vnc_server (display_manager_service, vnc_server);
             g_signal_connect (vnc_server, VNC_SERVER_SIGNAL_NEW_CONNECTION, G_CALLBACK (vnc_connection_cb), NULL);
 
+            vnc_pool = vnc_pool_new ();
+            vnc_pool_set_size (vnc_pool, MAX (config_get_integer (config_get_instance (), "VNCServer", "pool-size"), 0));
+            g_signal_connect (vnc_pool, VNC_POOL_SIGNAL_CREATE_SEAT, G_CALLBACK (vnc_pool_create_seat_cb), NULL);
+            vnc_pool_start (vnc_pool);
+
             g_debug ("Starting VNC server on TCP/IP port %d", vnc_server_get_port (vnc_server));
             vnc_server_start (vnc_server);
         }
         else
             g_warning ("Can't start VNC server, Xvnc is not in the path");
     }
+
+    /* Don't hold on to sockets passed for servers that aren't enabled */
+    socket_activation_cleanup ();
+
+    display_manager_started = TRUE;
+    notify_if_started ();
+}
+static void
+warn_restart_needed (const gchar *section, const gchar *key)
+{
+    g_warning ("Configuration change to [%s] %s will only take effect after a restart", section, key);
+}
+
+static void
+reload_seat_section (const gchar *section, gchar **keys)
+{
+    const gchar *seat_name_glob = section + strlen ("Seat:");
+
+    for (GList *link = display_manager_get_seats (display_manager); link; link = link->next)
+    {
+        Seat *seat = link->data;
+        const gchar *seat_name = g_object_get_data (G_OBJECT (seat), "lightdm-config-name");
+
+        if (!seat_name || !g_pattern_match_simple (seat_name_glob, seat_name))
+            continue;
+
+        /* Recalculate the value from all the sections, the change may be overridden
+         * by a more specific section or uncover a less specific one */
+        GList *sections = get_config_sections (seat_name);
+        for (gchar **key = keys; *key; key++)
+        {
+            g_autofree gchar *value = NULL;
+            for (GList *section_link = sections; section_link; section_link = section_link->next)
+            {
+                if (config_has_key (config_get_instance (), section_link->data, *key))
+                {
+                    g_free (value);
+                    value = config_get_string (config_get_instance (), section_link->data, *key);
+                }
+            }
+
+            l_debug (seat, "Updating property %s from [%s]", *key, section);
+            seat_set_property (seat, *key, value);
+        }
+        g_list_free_full (sections, g_free);
+    }
+}
+
+static void
+reload_xdmcp_section (gchar **keys)
+{
+    for (gchar **key = keys; *key; key++)
+    {
+        if (!xdmcp_server)
+            warn_restart_needed ("XDMCPServer", *key);
+        else if (strcmp (*key, "hostname") == 0)
+        {
+            g_autofree gchar *hostname = config_get_string (config_get_instance (), "XDMCPServer", "hostname");
+            xdmcp_server_set_hostname (xdmcp_server, hostname);
+        }
+        else if (strcmp (*key, "key") == 0)
+        {
+            g_autofree gchar *key_name = config_get_string (config_get_instance (), "XDMCPServer", "key");
+            g_autofree gchar *key_value = load_xdmcp_key (key_name);
+            xdmcp_server_set_key (xdmcp_server, key_value);
+        }
+        else if (strcmp (*key, "max-launches") == 0)
+            xdmcp_server_set_max_launches (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "max-launches"), 0));
+        else if (strcmp (*key, "priority-display-classes") == 0)
+        {
+            g_auto(GStrv) priority_classes = config_get_string_list (config_get_instance (), "XDMCPServer", "priority-display-classes");
+            xdmcp_server_set_priority_classes (xdmcp_server, priority_classes);
+        }
+        else if (strcmp (*key, "report-load") == 0 || strcmp (*key, "max-sessions") == 0 ||
+                 strcmp (*key, "busy-load") == 0 || strcmp (*key, "busy-delay") == 0)
+            set_xdmcp_load_options ();
+        else
+            warn_restart_needed ("XDMCPServer", *key);
+    }
+}
+
+static void
+reload_vnc_section (gchar **keys)
+{
+    for (gchar **key = keys; *key; key++)
+    {
+        if (!vnc_server)
+            warn_restart_needed ("VNCServer", *key);
+        else if (strcmp (*key, "max-launches") == 0)
+            vnc_server_set_max_launches (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "max-launches"), 0));
+        else if (strcmp (*key, "rate-limit") == 0)
+            vnc_server_set_rate_limit (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "rate-limit"), 0));
+        else if (strcmp (*key, "admission-timeout") == 0)
+            vnc_server_set_admission_timeout (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "admission-timeout"), 0));
+        else if (strcmp (*key, "pool-size") == 0)
+        {
+            vnc_pool_set_size (vnc_pool, MAX (config_get_integer (config_get_instance (), "VNCServer", "pool-size"), 0));
+            vnc_pool_start (vnc_pool);
+        }
+        else
+            warn_restart_needed ("VNCServer", *key);
+    }
+}
+
+/* Session children load the final configuration from a snapshot rather than parsing it again */
+static void
+update_session_config_snapshot (void)
+{
+    g_autofree gchar *run_dir = config_get_string (config_get_instance (), "LightDM", "run-directory");
+    g_autofree gchar *path = g_build_filename (run_dir, "config.snapshot", NULL);
+    g_autoptr(GError) error = NULL;
+    if (config_save_snapshot (config_get_instance (), path, NULL, &error))
+        session_child_set_config_snapshot (path);
+    else
+    {
+        g_warning ("Failed to write configuration snapshot: %s", error->message);
+        session_child_set_config_snapshot (NULL);
+    }
+}
+
+static void
+reload_config (void)
+{
+    g_autoptr(Configuration) new_config = config_new ();
+    GList *messages = NULL;
+    if (!config_load_from_standard_locations (new_config, config_path, &messages))
+    {
+        g_warning ("Failed to reload configuration, keeping existing configuration");
+        g_list_free_full (messages, g_free);
+        return;
+    }
+    for (GList *link = messages; link; link = link->next)
+        g_debug ("%s", (gchar *) link->data);
+    g_list_free_full (messages, g_free);
+
+    /* The directories were resolved at startup and can't be moved while running */
+    set_config_defaults (new_config);
+    const gchar *directory_keys[] = { "log-directory", "run-directory", "cache-directory", NULL };
+    for (const gchar **key = directory_keys; *key; key++)
+    {
+        g_autofree gchar *value = config_get_string (config_get_instance (), "LightDM", *key);
+        config_set_string (new_config, "LightDM", *key, value);
+    }
+
+    g_auto(GStrv) groups = config_get_changed_groups (config_get_instance (), new_config);
+    g_autoptr(GHashTable) changed_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_strfreev);
+    for (gchar **group = groups; *group; group++)
+        g_hash_table_insert (changed_keys, *group, config_get_changed_keys (config_get_instance (), new_config, *group));
+
+    config_copy (config_get_instance (), new_config);
+    update_session_config_snapshot ();
+    set_log_levels ();
+    if (seat_config_sections)
+        g_hash_table_remove_all (seat_config_sections);
+
+    if (!groups[0])
+    {
+        g_debug ("Configuration reloaded, no changes");
+        return;
+    }
+
+    for (gchar **group = groups; *group; group++)
+    {
+        gchar **keys = g_hash_table_lookup (changed_keys, *group);
+
+        g_debug ("Configuration section [%s] changed", *group);
+        if (g_str_has_prefix (*group, "Seat:"))
+            reload_seat_section (*group, keys);
+        else if (strcmp (*group, "XDMCPServer") == 0)
+            reload_xdmcp_section (keys);
+        else if (strcmp (*group, "VNCServer") == 0)
+            reload_vnc_section (keys);
+        else
+        {
+            for (gchar **key = keys; *key; key++)
+                warn_restart_needed (*group, *key);
+        }
+    }
+}
+
+static void
+service_reload_cb (DisplayManagerService *service)
+{
+    g_debug ("Reload requested over D-Bus");
+    reload_config ();
+}
+
+/* User sessions on local seats keep running, everything else is stopped */
+static HandoffSession *
+make_handoff_session (Seat *seat, Session *session)
+{
+    if (!IS_SEAT_LOCAL (seat) || IS_GREETER_SESSION (session) ||
+        !session_get_is_run (session) || session_get_is_stopping (session) || session_get_pid (session) <= 0)
+        return NULL;
+
+    DisplayServer *display_server = session_get_display_server (session);
+    if (!display_server || (!IS_X_SERVER_LOCAL (display_server) && !IS_WAYLAND_SESSION (display_server)))
+        return NULL;
+
+    HandoffSession *handoff_session = g_malloc0 (sizeof (HandoffSession));
+    handoff_session->seat_name = g_strdup (seat_get_name (seat));
+    handoff_session->username = g_strdup (session_get_username (session));
+    handoff_session->session_type = g_strdup (display_server_get_session_type (display_server));
+    handoff_session->session_pid = session_get_pid (session);
+    session_get_child_fds (session, &handoff_session->to_child_input, &handoff_session->from_child_output);
+    handoff_session->login1_session_id = g_strdup (session_get_login1_session_id (session));
+    handoff_session->console_kit_cookie = g_strdup (session_get_console_kit_cookie (session));
+    handoff_session->bus_path = g_strdup (session_get_env (session, "XDG_SESSION_PATH"));
+    handoff_session->is_active = seat_get_active_session (seat) == session;
+    handoff_session->vt = display_server_get_vt (display_server);
+    if (IS_X_SERVER_LOCAL (display_server))
+    {
+        handoff_session->x_server_pid = x_server_local_get_pid (X_SERVER_LOCAL (display_server));
+        handoff_session->display_number = x_server_get_display_number (X_SERVER (display_server));
+        handoff_session->x_authority_file = g_strdup (x_server_local_get_authority_file_path (X_SERVER_LOCAL (display_server)));
+        XAuthority *authority = x_server_get_authority (X_SERVER (display_server));
+        if (authority)
+        {
+            handoff_session->x_authority_name = g_strdup (x_authority_get_authorization_name (authority));
+            handoff_session->x_authority_data = g_bytes_new (x_authority_get_authorization_data (authority),
+                                                             x_authority_get_authorization_data_length (authority));
+        }
+    }
+
+    return handoff_session;
+}
+
+/* Re-execute the daemon, e.g. after an upgrade, without ending running user sessions */
+static void
+restart_daemon (void)
+{
+    g_autofree gchar *path = g_find_program_in_path (daemon_argv[0]);
+    if (!path)
+    {
+        g_warning ("Not restarting, unable to find %s", daemon_argv[0]);
+        return;
+    }
+
+    GList *sessions = NULL;
+    g_autoptr(GHashTable) kept_pids = g_hash_table_new (g_direct_hash, g_direct_equal);
+    for (GList *seat_link = display_manager_get_seats (display_manager); seat_link; seat_link = seat_link->next)
+    {
+        Seat *seat = seat_link->data;
+        for (GList *link = seat_get_sessions (seat); link; link = link->next)
+        {
+            HandoffSession *session = make_handoff_session (seat, link->data);
+            if (!session)
+                continue;
+            sessions = g_list_append (sessions, session);
+            g_hash_table_add (kept_pids, GINT_TO_POINTER (session->session_pid));
+            if (session->x_server_pid != 0)
+                g_hash_table_add (kept_pids, GINT_TO_POINTER (session->x_server_pid));
+        }
+    }
+
+    /* Greeters, sessions that can't be kept and their display servers are stopped,
+     * the new daemon reaps them */
+    g_autoptr(GArray) stopping_pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+    for (GList *seat_link = display_manager_get_seats (display_manager); seat_link; seat_link = seat_link->next)
+    {
+        for (GList *link = seat_get_sessions (seat_link->data); link; link = link->next)
+        {
+            GPid pid = session_get_pid (link->data);
+            if (pid > 0 && !g_hash_table_contains (kept_pids, GINT_TO_POINTER (pid)))
+                g_array_append_val (stopping_pids, pid);
+        }
+    }
+    GList *processes = process_get_all ();
+    for (GList *link = processes; link; link = link->next)
+    {
+        GPid pid = process_get_pid (link->data);
+        if (pid > 0 && !g_hash_table_contains (kept_pids, GINT_TO_POINTER (pid)))
+            g_array_append_val (stopping_pids, pid);
+    }
+    g_list_free (processes);
+
+    g_autoptr(GError) error = NULL;
+    int fd = handoff_save (sessions, stopping_pids, &error);
+    guint n_sessions = g_list_length (sessions);
+    g_list_free_full (sessions, (GDestroyNotify) handoff_session_free);
+    if (fd < 0)
+    {
+        g_warning ("Not restarting: %s", error->message);
+        return;
+    }
+
+    for (guint i = 0; i < stopping_pids->len; i++)
+        kill (g_array_index (stopping_pids, GPid, i), SIGTERM);
+
+    g_autoptr(GPtrArray) argv = g_ptr_array_new_with_free_func (g_free);
+    for (int i = 0; daemon_argv[i]; i++)
+    {
+        if (!g_str_has_prefix (daemon_argv[i], "--handoff-fd="))
+            g_ptr_array_add (argv, g_strdup (daemon_argv[i]));
+    }
+    g_ptr_array_add (argv, g_strdup_printf ("--handoff-fd=%d", fd));
+    g_ptr_array_add (argv, NULL);
+
+    g_debug ("Restarting daemon, keeping %u sessions", n_sessions);
+
+    /* Anything not written now would be lost */
+    accounting_cleanup ();
+    login_trace_cleanup ();
+    login1_service_flush (login1_service_get_instance ());
+    service_notify_restart ();
+    log_shutdown ();
+
+    execv (path, (gchar **) argv->pdata);
+
+    /* The sessions have already been handed over, so there is no going back */
+    g_printerr ("Failed to restart %s: %s\n", path, strerror (errno));
+    _exit (EXIT_FAILURE);
 }
+
+static void
+service_restart_cb (DisplayManagerService *service)
+{
+    g_debug ("Restart requested over D-Bus");
+    restart_daemon ();
+}
+
 static void
 service_ready_cb (DisplayManagerService *service)
 {
+    startup_profile_mark ("dbus-name-acquired");
+    service_notify_milestone (SERVICE_NOTIFY_DBUS_READY);
     start_display_manager ();
 }
 
@@ -398,16 +1147,17 @@ add_login1_seat (Login1Seat *login1_seat)
         if (types)
             break;
     }
-    g_list_free_full (config_sections, g_free);
 
     g_autoptr(Seat) seat = NULL;
     for (gchar **type = types; !seat && type && *type; type++)
         seat = create_seat (*type, seat_name);
 
     if (seat)
-    {
-        set_seat_properties (seat, seat_name);
+        set_seat_properties_from_sections (seat, seat_name, config_sections);
+    g_list_free_full (config_sections, g_free);
 
+    if (seat)
+    {
         if (!login1_seat_get_can_multi_session (login1_seat))
         {
             g_debug ("Seat %s has property CanMultiSession=no", seat_name);
@@ -470,11 +1220,58 @@ update_login1_seat (Login1Seat *login1_seat)
     }
 }
 
+static gboolean
+login1_seat_settled_cb (gpointer data)
+{
+    Login1Seat *login1_seat = g_object_ref (data);
+
+    g_hash_table_remove (login1_settle_timeouts, login1_seat);
+    g_debug ("Seat %s has settled", login1_seat_get_id (login1_seat));
+    update_login1_seat (login1_seat);
+    g_object_unref (login1_seat);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Update the seat once it has stopped changing, so devices coming and going don't restart it each time */
+static void
+settle_login1_seat (Login1Seat *login1_seat)
+{
+    gint settle_time = config_get_integer (config_get_instance (), "LightDM", "logind-settle-time");
+    if (settle_time <= 0)
+    {
+        update_login1_seat (login1_seat);
+        return;
+    }
+
+    if (!login1_settle_timeouts)
+        login1_settle_timeouts = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, NULL);
+    guint timeout = GPOINTER_TO_UINT (g_hash_table_lookup (login1_settle_timeouts, login1_seat));
+    if (timeout)
+        g_source_remove (timeout);
+    timeout = g_timeout_add (settle_time, login1_seat_settled_cb, login1_seat);
+    g_hash_table_insert (login1_settle_timeouts, g_object_ref (login1_seat), GUINT_TO_POINTER (timeout));
+}
+
+static void
+cancel_login1_seat_settle (Login1Seat *login1_seat)
+{
+    if (!login1_settle_timeouts)
+        return;
+
+    guint timeout = GPOINTER_TO_UINT (g_hash_table_lookup (login1_settle_timeouts, login1_seat));
+    if (timeout)
+    {
+        g_source_remove (timeout);
+        g_hash_table_remove (login1_settle_timeouts, login1_seat);
+    }
+}
+
 static void
 login1_can_graphical_changed_cb (Login1Seat *login1_seat)
 {
     g_debug ("Seat %s changes graphical state to %s", login1_seat_get_id (login1_seat), login1_seat_get_can_graphical (login1_seat) ? "true" : "false");
-    update_login1_seat (login1_seat);
+    settle_login1_seat (login1_seat);
 }
 
 static void
@@ -505,13 +1302,19 @@ login1_active_session_changed_cb (Login1Seat *login1_seat, const gchar *login1_s
     }
 }
 
-static gboolean
-login1_add_seat (Login1Seat *login1_seat)
+static void
+login1_connect_seat (Login1Seat *login1_seat)
 {
     if (config_get_boolean (config_get_instance (), "LightDM", "logind-check-graphical"))
         g_signal_connect (login1_seat, "can-graphical-changed", G_CALLBACK (login1_can_graphical_changed_cb), NULL);
 
     g_signal_connect (login1_seat, LOGIN1_SIGNAL_ACTIVE_SESION_CHANGED, G_CALLBACK (login1_active_session_changed_cb), NULL);
+}
+
+static gboolean
+login1_add_seat (Login1Seat *login1_seat)
+{
+    login1_connect_seat (login1_seat);
 
     return update_login1_seat (login1_seat);
 }
@@ -524,7 +1327,9 @@ login1_service_seat_added_cb (Login1Service *service, Login1Seat *login1_seat)
     else
         g_debug ("Seat %s added from logind without graphical output", login1_seat_get_id (login1_seat));
 
-    login1_add_seat (login1_seat);
+    /* Hotplugged seats are only started once they are stable */
+    login1_connect_seat (login1_seat);
+    settle_login1_seat (login1_seat);
 }
 
 static void
@@ -533,16 +1338,140 @@ login1_service_seat_removed_cb (Login1Service *service, Login1Seat *login1_seat)
     g_debug ("Seat %s removed from logind", login1_seat_get_id (login1_seat));
     g_signal_handlers_disconnect_matched (login1_seat, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, login1_can_graphical_changed_cb, NULL);
     g_signal_handlers_disconnect_matched (login1_seat, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, login1_active_session_changed_cb, NULL);
+    cancel_login1_seat_settle (login1_seat);
     remove_login1_seat (login1_seat);
 }
 
+static void
+set_config_defaults (Configuration *config)
+{
+    if (!config_has_key (config, "LightDM", "start-default-seat"))
+        config_set_boolean (config, "LightDM", "start-default-seat", TRUE);
+    if (!config_has_key (config, "LightDM", "minimum-vt"))
+        config_set_integer (config, "LightDM", "minimum-vt", 7);
+    if (!config_has_key (config, "LightDM", "guest-account-script"))
+        config_set_string (config, "LightDM", "guest-account-script", "guest-account");
+    if (!config_has_key (config, "LightDM", "greeter-user"))
+        config_set_string (config, "LightDM", "greeter-user", GREETER_USER);
+    if (!config_has_key (config, "LightDM", "greeter-readahead"))
+        config_set_boolean (config, "LightDM", "greeter-readahead", TRUE);
+    if (!config_has_key (config, "LightDM", "lock-memory"))
+        config_set_boolean (config, "LightDM", "lock-memory", TRUE);
+    if (!config_has_key (config, "LightDM", "reuse-authentication-session"))
+        config_set_boolean (config, "LightDM", "reuse-authentication-session", FALSE);
+    if (!config_has_key (config, "LightDM", "backup-logs"))
+        config_set_boolean (config, "LightDM", "backup-logs", TRUE);
+    if (!config_has_key (config, "LightDM", "log-level"))
+        config_set_string (config, "LightDM", "log-level", "debug");
+    if (!config_has_key (config, "LightDM", "log-format"))
+        config_set_string (config, "LightDM", "log-format", "text");
+    if (!config_has_key (config, "LightDM", "log-max-size"))
+        config_set_integer (config, "LightDM", "log-max-size", 0);
+    if (!config_has_key (config, "LightDM", "compress-old-logs"))
+        config_set_boolean (config, "LightDM", "compress-old-logs", FALSE);
+    if (!config_has_key (config, "LightDM", "log-capture-size"))
+        config_set_integer (config, "LightDM", "log-capture-size", 0);
+    if (!config_has_key (config, "LightDM", "log-capture-rate"))
+        config_set_integer (config, "LightDM", "log-capture-rate", 64);
+    if (!config_has_key (config, "LightDM", "accounting-batch-interval"))
+        config_set_integer (config, "LightDM", "accounting-batch-interval", 0);
+    if (!config_has_key (config, "LightDM", "accounting-sync"))
+        config_set_boolean (config, "LightDM", "accounting-sync", FALSE);
+    if (!config_has_key (config, "LightDM", "logind-settle-time"))
+        config_set_integer (config, "LightDM", "logind-settle-time", 0);
+    if (!config_has_key (config, "LightDM", "dbus-service"))
+        config_set_boolean (config, "LightDM", "dbus-service", TRUE);
+    if (!config_has_key (config, "LightDM", "max-session-greeters"))
+        config_set_integer (config, "LightDM", "max-session-greeters", 4);
+    if (!config_has_key (config, "LightDM", "shutdown-timeout"))
+        config_set_integer (config, "LightDM", "shutdown-timeout", 10);
+    if (!config_has_key (config, "LightDM", "max-process-launches"))
+        config_set_integer (config, "LightDM", "max-process-launches", 0);
+    if (!config_has_key (config, "LightDM", "notify-ready"))
+        config_set_string (config, "LightDM", "notify-ready", "started");
+    if (!config_has_key (config, "LightDM", "stall-report-timeout"))
+        config_set_integer (config, "LightDM", "stall-report-timeout", 0);
+    if (!config_has_key (config, "XDMCPServer", "busy-delay"))
+        config_set_integer (config, "XDMCPServer", "busy-delay", 500);
+    if (!config_has_key (config, "VNCServer", "admission-timeout"))
+        config_set_integer (config, "VNCServer", "admission-timeout", 150);
+    if (!config_has_key (config, "XDMCPServer", "liveness-timeout"))
+        config_set_integer (config, "XDMCPServer", "liveness-timeout", 30);
+    if (!config_has_key (config, "Seat:*", "type"))
+        config_set_string (config, "Seat:*", "type", "local");
+    if (!config_has_key (config, "Seat:*", "pam-service"))
+        config_set_string (config, "Seat:*", "pam-service", "lightdm");
+    if (!config_has_key (config, "Seat:*", "pam-autologin-service"))
+        config_set_string (config, "Seat:*", "pam-autologin-service", "lightdm-autologin");
+    if (!config_has_key (config, "Seat:*", "pam-greeter-service"))
+        config_set_string (config, "Seat:*", "pam-greeter-service", "lightdm-greeter");
+    if (!config_has_key (config, "Seat:*", "xserver-command"))
+        config_set_string (config, "Seat:*", "xserver-command", "X");
+    if (!config_has_key (config, "Seat:*", "xmir-command"))
+        config_set_string (config, "Seat:*", "xmir-command", "Xmir");
+    if (!config_has_key (config, "Seat:*", "xserver-share"))
+        config_set_boolean (config, "Seat:*", "xserver-share", TRUE);
+    if (!config_has_key (config, "Seat:*", "xserver-display-fd"))
+        config_set_boolean (config, "Seat:*", "xserver-display-fd", FALSE);
+    if (!config_has_key (config, "Seat:*", "xserver-recycle"))
+        config_set_boolean (config, "Seat:*", "xserver-recycle", FALSE);
+    if (!config_has_key (config, "Seat:*", "xserver-connect-timeout"))
+        config_set_integer (config, "Seat:*", "xserver-connect-timeout", 30);
+    if (!config_has_key (config, "Seat:*", "early-authentication"))
+        config_set_boolean (config, "Seat:*", "early-authentication", TRUE);
+    if (!config_has_key (config, "Seat:*", "start-session"))
+        config_set_boolean (config, "Seat:*", "start-session", TRUE);
+    if (!config_has_key (config, "Seat:*", "allow-user-switching"))
+        config_set_boolean (config, "Seat:*", "allow-user-switching", TRUE);
+    if (!config_has_key (config, "Seat:*", "allow-guest"))
+        config_set_boolean (config, "Seat:*", "allow-guest", TRUE);
+    if (!config_has_key (config, "Seat:*", "greeter-allow-guest"))
+        config_set_boolean (config, "Seat:*", "greeter-allow-guest", TRUE);
+    if (!config_has_key (config, "Seat:*", "greeter-show-remote-login"))
+        config_set_boolean (config, "Seat:*", "greeter-show-remote-login", TRUE);
+    if (!config_has_key (config, "Seat:*", "greeter-session"))
+        config_set_string (config, "Seat:*", "greeter-session", DEFAULT_GREETER_SESSION);
+    if (!config_has_key (config, "Seat:*", "greeter-restart-limit"))
+        config_set_integer (config, "Seat:*", "greeter-restart-limit", 5);
+    if (!config_has_key (config, "Seat:*", "greeter-ping-interval"))
+        config_set_integer (config, "Seat:*", "greeter-ping-interval", 0);
+    if (!config_has_key (config, "Seat:*", "greeter-ping-limit"))
+        config_set_integer (config, "Seat:*", "greeter-ping-limit", 3);
+    if (!config_has_key (config, "Seat:*", "resource-sample-interval"))
+        config_set_integer (config, "Seat:*", "resource-sample-interval", 60);
+    if (!config_has_key (config, "Seat:*", "greeter-shared"))
+        config_set_boolean (config, "Seat:*", "greeter-shared", FALSE);
+    if (!config_has_key (config, "Seat:*", "user-session"))
+        config_set_string (config, "Seat:*", "user-session", DEFAULT_USER_SESSION);
+    if (!config_has_key (config, "Seat:*", "session-wrapper"))
+        config_set_string (config, "Seat:*", "session-wrapper", "lightdm-session");
+    if (!config_has_key (config, "LightDM", "sessions-directory"))
+        config_set_string (config, "LightDM", "sessions-directory", SESSIONS_DIR);
+    if (!config_has_key (config, "LightDM", "remote-sessions-directory"))
+        config_set_string (config, "LightDM", "remote-sessions-directory", REMOTE_SESSIONS_DIR);
+    if (!config_has_key (config, "LightDM", "greeters-directory"))
+    {
+        g_autoptr(GPtrArray) dirs = g_ptr_array_new_with_free_func (g_free);
+        const gchar * const *data_dirs = g_get_system_data_dirs ();
+        for (int i = 0; data_dirs[i]; i++)
+            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "lightdm/greeters", NULL));
+        for (int i = 0; data_dirs[i]; i++)
+            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "xgreeters", NULL));
+        g_ptr_array_add (dirs, NULL);
+        g_autofree gchar *value = g_strjoinv (":", (gchar **) dirs->pdata);
+        config_set_string (config, "LightDM", "greeters-directory", value);
+    }
+    if (!config_has_key (config, "XDMCPServer", "hostname"))
+        config_set_string (config, "XDMCPServer", "hostname", g_get_host_name ());
+}
+
 int
 main (int argc, char **argv)
 {
     /* Disable the SIGPIPE handler - this is a stupid Unix hangover behaviour.
      * We will handle pipes / sockets being closed instead of having the whole daemon be killed...
      * http://stackoverflow.com/questions/8369506/why-does-sigpipe-exist
-     * Similar case for SIGHUP.
+     * Similar case for SIGHUP until the process module takes it over to reload the configuration.
      */
     struct sigaction action;
     action.sa_handler = SIG_IGN;
@@ -555,6 +1484,11 @@ main (int argc, char **argv)
     if (argc >= 2 && strcmp (argv[1], "--session-child") == 0)
         return session_child_run (argc, argv);
 
+    /* Kept to re-execute the daemon the same way */
+    daemon_argv = g_strdupv (argv);
+
+    gint64 start_time = g_get_monotonic_time ();
+
 #if !defined(GLIB_VERSION_2_36)
     g_type_init ();
 #endif
@@ -571,7 +1505,8 @@ main (int argc, char **argv)
     gchar *log_dir = NULL;
     gchar *run_dir = NULL;
     gchar *cache_dir = NULL;
-    gboolean show_config = FALSE, show_version = FALSE;
+    gboolean show_config = FALSE, show_version = FALSE, profile_startup = FALSE;
+    gint handoff_fd = -1;
     GOptionEntry options[] =
     {
         { "config", 'c', 0, G_OPTION_ARG_STRING, &config_path,
@@ -595,12 +1530,18 @@ main (int argc, char **argv)
         { "cache-dir", 0, 0, G_OPTION_ARG_STRING, &cache_dir,
           /* Help string for command line --cache-dir flag */
           N_("Directory to cache information"), "DIRECTORY" },
+        { "profile-startup", 0, 0, G_OPTION_ARG_NONE, &profile_startup,
+          /* Help string for command line --profile-startup flag */
+          N_("Write a profile of startup to the log directory"), NULL },
         { "show-config", 0, 0, G_OPTION_ARG_NONE, &show_config,
           /* Help string for command line --show-config flag */
           N_("Show combined configuration"), NULL },
         { "version", 'v', 0, G_OPTION_ARG_NONE, &show_version,
           /* Help string for command line --version flag */
           N_("Show release version"), NULL },
+        { "handoff-fd", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &handoff_fd,
+          /* Passed to itself when the daemon restarts */
+          NULL, NULL },
         { NULL }
     };
     g_option_context_add_main_entries (option_context, options, GETTEXT_PACKAGE);
@@ -713,6 +1654,9 @@ main (int argc, char **argv)
         g_setenv ("PATH", new_path, TRUE);
     }
 
+    if (profile_startup)
+        startup_profile_start (start_time);
+
     /* Write PID file */
     FILE *pid_file = fopen (pid_path, "w");
     if (pid_file)
@@ -738,80 +1682,33 @@ main (int argc, char **argv)
         default_cache_dir = g_strdup (CACHE_DIR);
     }
 
-    /* Load config file(s) */
-    if (!config_load_from_standard_locations (config_get_instance (), config_path, &messages))
-        exit (EXIT_FAILURE);
-    g_free (config_path);
+    /* Load config file(s), using the snapshot from the last start if none have changed */
+    g_autofree gchar *config_cache_path = g_build_filename (cache_dir ? cache_dir : default_cache_dir, "config.cache", NULL);
+    if (config_load_snapshot (config_get_instance (), config_cache_path, config_path, TRUE, &messages, NULL))
+        messages = g_list_append (messages, g_strdup_printf ("Loaded configuration snapshot %s", config_cache_path));
+    else
+    {
+        if (!config_load_from_standard_locations (config_get_instance (), config_path, &messages))
+            exit (EXIT_FAILURE);
+
+        /* Snapshot before the defaults are added, so it matches the files */
+        g_autofree gchar *config_cache_dir = g_path_get_dirname (config_cache_path);
+        g_mkdir_with_parents (config_cache_dir, S_IRWXU | S_IXGRP | S_IXOTH);
+        g_autoptr(GError) snapshot_error = NULL;
+        if (!config_save_snapshot (config_get_instance (), config_cache_path, config_path, &snapshot_error))
+            messages = g_list_append (messages, g_strdup_printf ("Failed to write configuration snapshot: %s", snapshot_error->message));
+    }
+
+    startup_profile_mark ("config-loaded");
 
     /* Set default values */
-    if (!config_has_key (config_get_instance (), "LightDM", "start-default-seat"))
-        config_set_boolean (config_get_instance (), "LightDM", "start-default-seat", TRUE);
-    if (!config_has_key (config_get_instance (), "LightDM", "minimum-vt"))
-        config_set_integer (config_get_instance (), "LightDM", "minimum-vt", 7);
-    if (!config_has_key (config_get_instance (), "LightDM", "guest-account-script"))
-        config_set_string (config_get_instance (), "LightDM", "guest-account-script", "guest-account");
-    if (!config_has_key (config_get_instance (), "LightDM", "greeter-user"))
-        config_set_string (config_get_instance (), "LightDM", "greeter-user", GREETER_USER);
-    if (!config_has_key (config_get_instance (), "LightDM", "lock-memory"))
-        config_set_boolean (config_get_instance (), "LightDM", "lock-memory", TRUE);
-    if (!config_has_key (config_get_instance (), "LightDM", "backup-logs"))
-        config_set_boolean (config_get_instance (), "LightDM", "backup-logs", TRUE);
-    if (!config_has_key (config_get_instance (), "LightDM", "dbus-service"))
-        config_set_boolean (config_get_instance (), "LightDM", "dbus-service", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "type"))
-        config_set_string (config_get_instance (), "Seat:*", "type", "local");
-    if (!config_has_key (config_get_instance (), "Seat:*", "pam-service"))
-        config_set_string (config_get_instance (), "Seat:*", "pam-service", "lightdm");
-    if (!config_has_key (config_get_instance (), "Seat:*", "pam-autologin-service"))
-        config_set_string (config_get_instance (), "Seat:*", "pam-autologin-service", "lightdm-autologin");
-    if (!config_has_key (config_get_instance (), "Seat:*", "pam-greeter-service"))
-        config_set_string (config_get_instance (), "Seat:*", "pam-greeter-service", "lightdm-greeter");
-    if (!config_has_key (config_get_instance (), "Seat:*", "xserver-command"))
-        config_set_string (config_get_instance (), "Seat:*", "xserver-command", "X");
-    if (!config_has_key (config_get_instance (), "Seat:*", "xmir-command"))
-        config_set_string (config_get_instance (), "Seat:*", "xmir-command", "Xmir");
-    if (!config_has_key (config_get_instance (), "Seat:*", "xserver-share"))
-        config_set_boolean (config_get_instance (), "Seat:*", "xserver-share", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "start-session"))
-        config_set_boolean (config_get_instance (), "Seat:*", "start-session", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "allow-user-switching"))
-        config_set_boolean (config_get_instance (), "Seat:*", "allow-user-switching", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "allow-guest"))
-        config_set_boolean (config_get_instance (), "Seat:*", "allow-guest", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "greeter-allow-guest"))
-        config_set_boolean (config_get_instance (), "Seat:*", "greeter-allow-guest", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "greeter-show-remote-login"))
-        config_set_boolean (config_get_instance (), "Seat:*", "greeter-show-remote-login", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "greeter-session"))
-        config_set_string (config_get_instance (), "Seat:*", "greeter-session", DEFAULT_GREETER_SESSION);
-    if (!config_has_key (config_get_instance (), "Seat:*", "user-session"))
-        config_set_string (config_get_instance (), "Seat:*", "user-session", DEFAULT_USER_SESSION);
-    if (!config_has_key (config_get_instance (), "Seat:*", "session-wrapper"))
-        config_set_string (config_get_instance (), "Seat:*", "session-wrapper", "lightdm-session");
+    set_config_defaults (config_get_instance ());
     if (!config_has_key (config_get_instance (), "LightDM", "log-directory"))
         config_set_string (config_get_instance (), "LightDM", "log-directory", default_log_dir);
     if (!config_has_key (config_get_instance (), "LightDM", "run-directory"))
         config_set_string (config_get_instance (), "LightDM", "run-directory", default_run_dir);
     if (!config_has_key (config_get_instance (), "LightDM", "cache-directory"))
         config_set_string (config_get_instance (), "LightDM", "cache-directory", default_cache_dir);
-    if (!config_has_key (config_get_instance (), "LightDM", "sessions-directory"))
-        config_set_string (config_get_instance (), "LightDM", "sessions-directory", SESSIONS_DIR);
-    if (!config_has_key (config_get_instance (), "LightDM", "remote-sessions-directory"))
-        config_set_string (config_get_instance (), "LightDM", "remote-sessions-directory", REMOTE_SESSIONS_DIR);
-    if (!config_has_key (config_get_instance (), "LightDM", "greeters-directory"))
-    {
-        g_autoptr(GPtrArray) dirs = g_ptr_array_new_with_free_func (g_free);
-        const gchar * const *data_dirs = g_get_system_data_dirs ();
-        for (int i = 0; data_dirs[i]; i++)
-            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "lightdm/greeters", NULL));
-        for (int i = 0; data_dirs[i]; i++)
-            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "xgreeters", NULL));
-        g_ptr_array_add (dirs, NULL);
-        g_autofree gchar *value = g_strjoinv (":", (gchar **) dirs->pdata);
-        config_set_string (config_get_instance (), "LightDM", "greeters-directory", value);
-    }
-    if (!config_has_key (config_get_instance (), "XDMCPServer", "hostname"))
-        config_set_string (config_get_instance (), "XDMCPServer", "hostname", g_get_host_name ());
 
     /* Override defaults */
     if (log_dir)
@@ -835,8 +1732,29 @@ main (int argc, char **argv)
     if (g_mkdir_with_parents (cache_dir_path, S_IRWXU | S_IXGRP | S_IXOTH) < 0)
         g_warning ("Failed to make cache directory %s: %s", cache_dir_path, strerror (errno));
 
+    update_session_config_snapshot ();
+    startup_profile_mark ("directories-created");
+
+    set_log_levels ();
     log_init ();
 
+    g_autofree gchar *startup_profile_path = g_build_filename (log_dir_path, "startup-profile.json", NULL);
+    startup_profile_set_file (startup_profile_path);
+
+    accounting_set_batch_interval (MAX (config_get_integer (config_get_instance (), "LightDM", "accounting-batch-interval"), 0));
+    accounting_set_sync (config_get_boolean (config_get_instance (), "LightDM", "accounting-sync"));
+    process_set_max_launches (MAX (config_get_integer (config_get_instance (), "LightDM", "max-process-launches"), 0));
+
+    g_autofree gchar *login_trace_file = config_get_string (config_get_instance (), "LightDM", "login-trace-file");
+    if (login_trace_file)
+        login_trace_set_file (login_trace_file);
+
+    g_autofree gchar *notify_ready = config_get_string (config_get_instance (), "LightDM", "notify-ready");
+    ServiceNotifyMilestone ready_milestone = SERVICE_NOTIFY_STARTED;
+    if (!service_notify_parse_milestone (notify_ready, &ready_milestone))
+        g_warning ("Unknown notify-ready value %s, notifying once started", notify_ready);
+    service_notify_start (ready_milestone, MAX (config_get_integer (config_get_instance (), "LightDM", "stall-report-timeout"), 0));
+
     /* Show queued messages once logging is complete */
     for (GList *link = messages; link; link = link->next)
         g_debug ("%s", (gchar *)link->data);
@@ -847,6 +1765,14 @@ main (int argc, char **argv)
     if (getenv ("DISPLAY"))
         g_debug ("Using Xephyr for X servers");
 
+    /* Keep supervising the sessions passed on by the daemon before it restarted */
+    if (handoff_fd >= 0)
+    {
+        g_autoptr(GError) handoff_error = NULL;
+        if (!handoff_load (handoff_fd, &handoff_error))
+            g_warning ("Failed to take over sessions from before restart: %s", handoff_error->message);
+    }
+
     display_manager = display_manager_new ();
     g_signal_connect (display_manager, DISPLAY_MANAGER_SIGNAL_STOPPED, G_CALLBACK (display_manager_stopped_cb), NULL);
     g_signal_connect (display_manager, DISPLAY_MANAGER_SIGNAL_SEAT_REMOVED, G_CALLBACK (display_manager_seat_removed_cb), NULL);
@@ -857,6 +1783,8 @@ main (int argc, char **argv)
         g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_ADD_XLOCAL_SEAT, G_CALLBACK (service_add_xlocal_seat_cb), NULL);
         g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_READY, G_CALLBACK (service_ready_cb), NULL);
         g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_NAME_LOST, G_CALLBACK (service_name_lost_cb), NULL);
+        g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_RELOAD, G_CALLBACK (service_reload_cb), NULL);
+        g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_RESTART, G_CALLBACK (service_restart_cb), NULL);
         display_manager_service_start (display_manager_service);
     }
     else
@@ -864,11 +1792,21 @@ main (int argc, char **argv)
 
     shared_data_manager_start (shared_data_manager_get_instance ());
 
+    /* Listen for a greeter that serves several seats */
+    g_autofree gchar *greeter_host_socket = config_get_string (config_get_instance (), "LightDM", "greeter-host-socket");
+    if (greeter_host_socket && greeter_host_socket[0] != '\0')
+    {
+        g_autoptr(GError) error = NULL;
+        if (!greeter_host_start (greeter_host_get_instance (), greeter_host_socket, &error))
+            g_warning ("Failed to start shared greeter socket: %s", error->message);
+    }
+
     /* Connect to logind */
     if (login1_service_connect (login1_service_get_instance ()))
     {
         /* Load dynamic seats from logind */
         g_debug ("Monitoring logind for seats");
+        startup_profile_mark ("logind-connected");
 
         if (config_get_boolean (config_get_instance (), "LightDM", "start-default-seat"))
         {
@@ -912,14 +1850,60 @@ main (int argc, char **argv)
         }
     }
 
+    startup_profile_mark ("seats-created");
+    seats_created = TRUE;
+    notify_if_started ();
+
     g_main_loop_run (loop);
 
+    /* Tell the service manager we're stopping and stop watching the main loop */
+    service_notify_cleanup ();
+
     /* Clean up shared data manager */
     shared_data_manager_cleanup ();
 
+    /* Clean up shared greeter socket */
+    greeter_host_cleanup ();
+
+    /* Stop sessions still running from before a restart */
+    handoff_cleanup ();
+
     /* Clean up user list */
     common_user_list_cleanup ();
 
+    /* Clean up session index */
+    common_session_index_cleanup ();
+
+    /* Clean up locale names */
+    common_locale_names_cleanup ();
+
+    /* Clean up DMRC cache */
+    dmrc_cleanup ();
+
+    /* Stop the NSS worker */
+    common_nss_cleanup ();
+
+    /* Write any login records still waiting */
+    accounting_cleanup ();
+
+    /* Close login trace */
+    login_trace_cleanup ();
+
+    /* Write the startup profile if no greeter connected */
+    startup_profile_cleanup ();
+
+    /* Clean up metrics */
+    common_metrics_cleanup ();
+
+    g_clear_pointer (&seat_config_sections, g_hash_table_unref);
+    g_clear_pointer (&config_path, g_free);
+
+    /* Remove unused guest accounts */
+    guest_account_cleanup_pool ();
+
+    /* Make sure outstanding logind requests are sent */
+    login1_service_flush (login1_service_get_instance ());
+
     /* Remove D-Bus interface */
     g_clear_object (&display_manager_service);
 
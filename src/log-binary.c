@@ -0,0 +1,626 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "log-binary.h"
+
+/* Size of the length and type at the start of each record */
+#define RECORD_HEADER_SIZE (sizeof (guint32) + 1)
+
+typedef enum
+{
+    LENGTH_DEFAULT,
+    LENGTH_LONG,
+    LENGTH_LONG_LONG,
+    LENGTH_SIZE,
+    LENGTH_PTRDIFF,
+    LENGTH_LONG_DOUBLE
+} LengthModifier;
+
+/* A printf conversion, e.g. "%-5ld" */
+typedef struct
+{
+    const gchar *flags;
+    gsize flags_length;
+    const gchar *width;
+    gsize width_length;
+    gboolean width_from_argument;
+    const gchar *precision;
+    gsize precision_length;
+    gboolean has_precision;
+    gboolean precision_from_argument;
+    LengthModifier length;
+    gchar conversion;
+} Conversion;
+
+/* Argument types as stored in a message record */
+#define ARG_INT     'i'
+#define ARG_UINT    'u'
+#define ARG_DOUBLE  'd'
+#define ARG_STRING  's'
+#define ARG_POINTER 'p'
+
+/* Format IDs assigned so far, callers serialize writes */
+static GHashTable *format_ids = NULL;
+
+const gchar *
+log_level_get_prefix (GLogLevelFlags log_level)
+{
+    switch (log_level & G_LOG_LEVEL_MASK)
+    {
+    case G_LOG_LEVEL_ERROR:
+        return "ERROR:";
+    case G_LOG_LEVEL_CRITICAL:
+        return "CRITICAL:";
+    case G_LOG_LEVEL_WARNING:
+        return "WARNING:";
+    case G_LOG_LEVEL_MESSAGE:
+        return "MESSAGE:";
+    case G_LOG_LEVEL_INFO:
+        return "INFO:";
+    case G_LOG_LEVEL_DEBUG:
+        return "DEBUG:";
+    default:
+        return "LOG:";
+    }
+}
+
+/* Find the next conversion in @format, returning the text after it or NULL if
+ * there are no more. Text before the conversion is returned in @literal_length */
+static const gchar *
+next_conversion (const gchar *format, gsize *literal_length, Conversion *c)
+{
+    const gchar *start = strchr (format, '%');
+    if (!start)
+    {
+        *literal_length = strlen (format);
+        return NULL;
+    }
+    *literal_length = start - format;
+
+    memset (c, 0, sizeof (Conversion));
+    const gchar *p = start + 1;
+
+    c->flags = p;
+    while (*p && strchr ("-+ #0'", *p))
+        p++;
+    c->flags_length = p - c->flags;
+
+    c->width = p;
+    if (*p == '*')
+    {
+        c->width_from_argument = TRUE;
+        p++;
+    }
+    else
+        while (g_ascii_isdigit (*p))
+            p++;
+    c->width_length = p - c->width;
+
+    if (*p == '.')
+    {
+        c->has_precision = TRUE;
+        p++;
+        c->precision = p;
+        if (*p == '*')
+        {
+            c->precision_from_argument = TRUE;
+            p++;
+        }
+        else
+            while (g_ascii_isdigit (*p))
+                p++;
+        c->precision_length = p - c->precision;
+    }
+
+    if (p[0] == 'h')
+        p += p[1] == 'h' ? 2 : 1;
+    else if (p[0] == 'l' && p[1] == 'l')
+    {
+        c->length = LENGTH_LONG_LONG;
+        p += 2;
+    }
+    else if (p[0] == 'l')
+    {
+        c->length = LENGTH_LONG;
+        p++;
+    }
+    else if (p[0] == 'q' || p[0] == 'j')
+    {
+        c->length = LENGTH_LONG_LONG;
+        p++;
+    }
+    else if (p[0] == 'z')
+    {
+        c->length = LENGTH_SIZE;
+        p++;
+    }
+    else if (p[0] == 't')
+    {
+        c->length = LENGTH_PTRDIFF;
+        p++;
+    }
+    else if (p[0] == 'L')
+    {
+        c->length = LENGTH_LONG_DOUBLE;
+        p++;
+    }
+
+    c->conversion = *p;
+    if (*p)
+        p++;
+
+    return p;
+}
+
+static void
+append_int64 (GString *buffer, gchar type, guint64 value)
+{
+    g_string_append_c (buffer, type);
+    g_string_append_len (buffer, (const gchar *) &value, sizeof (value));
+}
+
+static void
+append_string (GString *buffer, const gchar *value, gsize max_length)
+{
+    guint32 length = value ? strnlen (value, max_length) : G_MAXUINT32;
+    g_string_append_len (buffer, (const gchar *) &length, sizeof (length));
+    if (value)
+        g_string_append_len (buffer, value, length);
+}
+
+static gsize
+begin_record (GString *buffer, LogBinaryRecordType type)
+{
+    gsize offset = buffer->len;
+    guint32 length = 0;
+    g_string_append_len (buffer, (const gchar *) &length, sizeof (length));
+    g_string_append_c (buffer, type);
+    return offset;
+}
+
+static void
+end_record (GString *buffer, gsize offset)
+{
+    guint32 length = buffer->len - offset;
+    memcpy (buffer->str + offset, &length, sizeof (length));
+}
+
+/* Append the arguments used by @format, FALSE if it has a conversion that
+ * can't be stored */
+static gboolean
+append_arguments (GString *buffer, const gchar *format, va_list ap)
+{
+    const gchar *f = format;
+    while (f)
+    {
+        gsize literal_length;
+        Conversion c;
+        f = next_conversion (f, &literal_length, &c);
+        if (!f)
+            break;
+
+        if (c.width_from_argument)
+            append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, int));
+        if (c.precision_from_argument)
+            append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, int));
+
+        switch (c.conversion)
+        {
+        case '%':
+            break;
+        case 'd':
+        case 'i':
+            switch (c.length)
+            {
+            case LENGTH_LONG:
+                append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, long));
+                break;
+            case LENGTH_LONG_LONG:
+                append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, long long));
+                break;
+            case LENGTH_SIZE:
+                append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, ssize_t));
+                break;
+            case LENGTH_PTRDIFF:
+                append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, ptrdiff_t));
+                break;
+            default:
+                append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, int));
+                break;
+            }
+            break;
+        case 'c':
+            append_int64 (buffer, ARG_INT, (gint64) va_arg (ap, int));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (c.length)
+            {
+            case LENGTH_LONG:
+                append_int64 (buffer, ARG_UINT, (guint64) va_arg (ap, unsigned long));
+                break;
+            case LENGTH_LONG_LONG:
+                append_int64 (buffer, ARG_UINT, (guint64) va_arg (ap, unsigned long long));
+                break;
+            case LENGTH_SIZE:
+                append_int64 (buffer, ARG_UINT, (guint64) va_arg (ap, size_t));
+                break;
+            case LENGTH_PTRDIFF:
+                append_int64 (buffer, ARG_UINT, (guint64) va_arg (ap, ptrdiff_t));
+                break;
+            default:
+                append_int64 (buffer, ARG_UINT, (guint64) va_arg (ap, unsigned int));
+                break;
+            }
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            gdouble value = c.length == LENGTH_LONG_DOUBLE ? (gdouble) va_arg (ap, long double) : va_arg (ap, double);
+            g_string_append_c (buffer, ARG_DOUBLE);
+            g_string_append_len (buffer, (const gchar *) &value, sizeof (value));
+            break;
+        }
+        case 's':
+        {
+            /* Only what a precision would print is kept */
+            gsize max_length = G_MAXUINT32 - 1;
+            if (c.has_precision && !c.precision_from_argument)
+                max_length = strtoul (c.precision, NULL, 10);
+            g_string_append_c (buffer, ARG_STRING);
+            append_string (buffer, va_arg (ap, const gchar *), max_length);
+            break;
+        }
+        case 'p':
+            append_int64 (buffer, ARG_POINTER, (guint64) (guintptr) va_arg (ap, gpointer));
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void
+log_binary_write_header (GString *buffer)
+{
+    g_string_append_len (buffer, LOG_BINARY_MAGIC, strlen (LOG_BINARY_MAGIC));
+
+    /* Formats have to be written again after each header */
+    if (format_ids)
+        g_hash_table_remove_all (format_ids);
+}
+
+static guint32
+get_format_id (GString *buffer, const gchar *format)
+{
+    if (!format_ids)
+        format_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    gpointer value;
+    if (g_hash_table_lookup_extended (format_ids, format, NULL, &value))
+        return GPOINTER_TO_UINT (value);
+
+    guint32 id = g_hash_table_size (format_ids);
+    g_hash_table_insert (format_ids, g_strdup (format), GUINT_TO_POINTER (id));
+
+    gsize offset = begin_record (buffer, LOG_BINARY_RECORD_FORMAT);
+    g_string_append_len (buffer, (const gchar *) &id, sizeof (id));
+    g_string_append (buffer, format);
+    end_record (buffer, offset);
+
+    return id;
+}
+
+/* Store a message without formatting it, falling back to text for formats
+ * that can't be stored */
+void
+log_binary_write_message (GString *buffer, gint64 time, GLogLevelFlags log_level, const gchar *prefix, const gchar *format, va_list ap)
+{
+    va_list ap_copy;
+    va_copy (ap_copy, ap);
+
+    guint32 format_id = get_format_id (buffer, format);
+    gsize offset = begin_record (buffer, LOG_BINARY_RECORD_MESSAGE);
+    guint32 level = log_level & G_LOG_LEVEL_MASK;
+    g_string_append_len (buffer, (const gchar *) &time, sizeof (time));
+    g_string_append_len (buffer, (const gchar *) &level, sizeof (level));
+    g_string_append_len (buffer, (const gchar *) &format_id, sizeof (format_id));
+    guint16 prefix_length = prefix ? MIN (strlen (prefix), G_MAXUINT16) : 0;
+    g_string_append_len (buffer, (const gchar *) &prefix_length, sizeof (prefix_length));
+    if (prefix)
+        g_string_append_len (buffer, prefix, prefix_length);
+    if (append_arguments (buffer, format, ap))
+        end_record (buffer, offset);
+    else
+    {
+        g_string_truncate (buffer, offset);
+        g_autofree gchar *message = g_strdup_vprintf (format, ap_copy);
+        g_autofree gchar *text = g_strconcat (prefix ? prefix : "", message, NULL);
+        log_binary_write_text (buffer, time, log_level, text);
+    }
+
+    va_end (ap_copy);
+}
+
+void
+log_binary_write_text (GString *buffer, gint64 time, GLogLevelFlags log_level, const gchar *text)
+{
+    gsize offset = begin_record (buffer, LOG_BINARY_RECORD_TEXT);
+    guint32 level = log_level & G_LOG_LEVEL_MASK;
+    g_string_append_len (buffer, (const gchar *) &time, sizeof (time));
+    g_string_append_len (buffer, (const gchar *) &level, sizeof (level));
+    g_string_append (buffer, text);
+    end_record (buffer, offset);
+}
+
+typedef struct
+{
+    const guint8 *data;
+    gsize length;
+    gsize offset;
+} Reader;
+
+static gboolean
+read_bytes (Reader *reader, gpointer value, gsize length)
+{
+    if (reader->length - reader->offset < length)
+        return FALSE;
+    memcpy (value, reader->data + reader->offset, length);
+    reader->offset += length;
+    return TRUE;
+}
+
+static gboolean
+read_argument (Reader *reader, gchar expected_type, guint64 *value, const gchar **string, gsize *string_length)
+{
+    gchar type;
+    if (!read_bytes (reader, &type, 1) || type != expected_type)
+        return FALSE;
+
+    if (type != ARG_STRING)
+        return read_bytes (reader, value, sizeof (guint64));
+
+    guint32 length;
+    if (!read_bytes (reader, &length, sizeof (length)))
+        return FALSE;
+    if (length == G_MAXUINT32)
+    {
+        *string = NULL;
+        *string_length = 0;
+        return TRUE;
+    }
+    if (reader->length - reader->offset < length)
+        return FALSE;
+    *string = (const gchar *) reader->data + reader->offset;
+    *string_length = length;
+    reader->offset += length;
+    return TRUE;
+}
+
+/* Format the arguments in @reader the way printf() would have */
+static gboolean
+format_message (GString *text, const gchar *format, Reader *reader)
+{
+    const gchar *f = format;
+    while (f)
+    {
+        gsize literal_length;
+        Conversion c;
+        const gchar *next = next_conversion (f, &literal_length, &c);
+        g_string_append_len (text, f, literal_length);
+        f = next;
+        if (!f)
+            break;
+
+        GString *spec = g_string_new ("%");
+        g_string_append_len (spec, c.flags, c.flags_length);
+        guint64 value;
+        if (c.width_from_argument)
+        {
+            if (!read_argument (reader, ARG_INT, &value, NULL, NULL))
+            {
+                g_string_free (spec, TRUE);
+                return FALSE;
+            }
+            g_string_append_printf (spec, "%d", (gint) (gint64) value);
+        }
+        else
+            g_string_append_len (spec, c.width, c.width_length);
+        if (c.has_precision)
+        {
+            g_string_append_c (spec, '.');
+            if (c.precision_from_argument)
+            {
+                if (!read_argument (reader, ARG_INT, &value, NULL, NULL))
+                {
+                    g_string_free (spec, TRUE);
+                    return FALSE;
+                }
+                g_string_append_printf (spec, "%d", (gint) (gint64) value);
+            }
+            else
+                g_string_append_len (spec, c.precision, c.precision_length);
+        }
+
+        gboolean result = TRUE;
+        const gchar *string;
+        gsize string_length;
+        switch (c.conversion)
+        {
+        case '%':
+            g_string_append_c (text, '%');
+            break;
+        case 'd':
+        case 'i':
+            g_string_append (spec, G_GINT64_MODIFIER);
+            g_string_append_c (spec, c.conversion);
+            result = read_argument (reader, ARG_INT, &value, NULL, NULL);
+            if (result)
+                g_string_append_printf (text, spec->str, (gint64) value);
+            break;
+        case 'c':
+            g_string_append_c (spec, 'c');
+            result = read_argument (reader, ARG_INT, &value, NULL, NULL);
+            if (result)
+                g_string_append_printf (text, spec->str, (gint) value);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            g_string_append (spec, G_GINT64_MODIFIER);
+            g_string_append_c (spec, c.conversion);
+            result = read_argument (reader, ARG_UINT, &value, NULL, NULL);
+            if (result)
+                g_string_append_printf (text, spec->str, value);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            g_string_append_c (spec, c.conversion);
+            result = read_argument (reader, ARG_DOUBLE, &value, NULL, NULL);
+            gdouble d;
+            memcpy (&d, &value, sizeof (d));
+            if (result)
+                g_string_append_printf (text, spec->str, d);
+            break;
+        }
+        case 's':
+        {
+            result = read_argument (reader, ARG_STRING, &value, &string, &string_length);
+            if (result)
+            {
+                /* Strings aren't nul terminated in the log */
+                g_autofree gchar *s = string ? g_strndup (string, string_length) : NULL;
+                g_string_append_c (spec, 's');
+                g_string_append_printf (text, spec->str, s ? s : "(null)");
+            }
+            break;
+        }
+        case 'p':
+            g_string_append_c (spec, 'p');
+            result = read_argument (reader, ARG_POINTER, &value, NULL, NULL);
+            if (result)
+                g_string_append_printf (text, spec->str, (gpointer) (guintptr) value);
+            break;
+        default:
+            result = FALSE;
+            break;
+        }
+        g_string_free (spec, TRUE);
+        if (!result)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+write_line (FILE *output, gint64 time, guint32 level, const gchar *text, gsize text_length)
+{
+    fprintf (output, "[%+.2fs] %s %.*s\n", time / (gdouble) G_USEC_PER_SEC, log_level_get_prefix (level), (int) text_length, text);
+}
+
+/* Write the messages in a binary log out as they would have been in a text log */
+gboolean
+log_binary_decode (const guint8 *data, gsize length, FILE *output, GError **error)
+{
+    gsize magic_length = strlen (LOG_BINARY_MAGIC);
+    g_autoptr(GPtrArray) formats = g_ptr_array_new_with_free_func (g_free);
+
+    gsize offset = 0;
+    while (offset < length)
+    {
+        if (length - offset >= magic_length && memcmp (data + offset, LOG_BINARY_MAGIC, magic_length) == 0)
+        {
+            g_ptr_array_set_size (formats, 0);
+            offset += magic_length;
+            continue;
+        }
+
+        guint32 record_length;
+        if (length - offset < RECORD_HEADER_SIZE)
+        {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Truncated record at offset %zu", offset);
+            return FALSE;
+        }
+        memcpy (&record_length, data + offset, sizeof (record_length));
+        if (record_length < RECORD_HEADER_SIZE || record_length > length - offset)
+        {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Invalid record length %u at offset %zu", record_length, offset);
+            return FALSE;
+        }
+
+        Reader reader = { data + offset, record_length, RECORD_HEADER_SIZE };
+        gchar type = data[offset + sizeof (guint32)];
+        gint64 time;
+        guint32 level, format_id;
+        guint16 prefix_length;
+        switch (type)
+        {
+        case LOG_BINARY_RECORD_FORMAT:
+            if (!read_bytes (&reader, &format_id, sizeof (format_id)) || format_id != formats->len)
+                break;
+            g_ptr_array_add (formats, g_strndup ((const gchar *) reader.data + reader.offset, reader.length - reader.offset));
+            break;
+        case LOG_BINARY_RECORD_MESSAGE:
+        {
+            if (!read_bytes (&reader, &time, sizeof (time)) ||
+                !read_bytes (&reader, &level, sizeof (level)) ||
+                !read_bytes (&reader, &format_id, sizeof (format_id)) ||
+                !read_bytes (&reader, &prefix_length, sizeof (prefix_length)) ||
+                reader.length - reader.offset < prefix_length)
+                break;
+            const gchar *prefix = (const gchar *) reader.data + reader.offset;
+            reader.offset += prefix_length;
+
+            g_autoptr(GString) text = g_string_new_len (prefix, prefix_length);
+            if (format_id < formats->len && format_message (text, g_ptr_array_index (formats, format_id), &reader))
+                write_line (output, time, level, text->str, text->len);
+            else
+                write_line (output, time, level, "(undecodable message)", strlen ("(undecodable message)"));
+            break;
+        }
+        case LOG_BINARY_RECORD_TEXT:
+            if (!read_bytes (&reader, &time, sizeof (time)) ||
+                !read_bytes (&reader, &level, sizeof (level)))
+                break;
+            write_line (output, time, level, (const gchar *) reader.data + reader.offset, reader.length - reader.offset);
+            break;
+        default:
+            break;
+        }
+
+        offset += record_length;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef LOG_BINARY_H_
+#define LOG_BINARY_H_
+
+#include <glib.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+G_BEGIN_DECLS
+
+/* Written at the start of each run, format IDs are only valid until the next one */
+#define LOG_BINARY_MAGIC "LDMBLOG1"
+
+typedef enum
+{
+    /* Format string for later messages: guint32 id, then the string */
+    LOG_BINARY_RECORD_FORMAT = 'F',
+
+    /* Unformatted message: gint64 time, guint32 level, guint32 format id,
+     * guint16 prefix length, prefix, then the arguments */
+    LOG_BINARY_RECORD_MESSAGE = 'M',
+
+    /* Already formatted message: gint64 time, guint32 level, then the text */
+    LOG_BINARY_RECORD_TEXT = 'T'
+} LogBinaryRecordType;
+
+const gchar *log_level_get_prefix (GLogLevelFlags log_level);
+
+void log_binary_write_header (GString *buffer);
+
+void log_binary_write_message (GString *buffer, gint64 time, GLogLevelFlags log_level, const gchar *prefix, const gchar *format, va_list ap) __attribute__ ((format (printf, 5, 0)));
+
+void log_binary_write_text (GString *buffer, gint64 time, GLogLevelFlags log_level, const gchar *text);
+
+gboolean log_binary_decode (const guint8 *data, gsize length, FILE *output, GError **error);
+
+G_END_DECLS
+
+#endif /* LOG_BINARY_H_ */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log-capture.h"
+
+struct LogCapture
+{
+    /* Ring of captured output */
+    guint8 *data;
+    gsize size;
+    gsize start;
+    gsize length;
+
+    /* Bytes per second let through, with a burst of up to one second's worth */
+    gsize rate;
+    gdouble tokens;
+    gint64 last_refill;
+
+    /* Bytes lost since the last flush */
+    guint64 n_dropped;
+    guint64 n_overwritten;
+};
+
+LogCapture *
+log_capture_new (gsize size, gsize rate)
+{
+    g_return_val_if_fail (size > 0, NULL);
+
+    LogCapture *capture = g_malloc0 (sizeof (LogCapture));
+    capture->data = g_malloc (size);
+    capture->size = size;
+    capture->rate = rate;
+    capture->tokens = rate;
+    capture->last_refill = g_get_monotonic_time ();
+    return capture;
+}
+
+/* Read what is available from fd into the ring, returns 0 on end of file */
+gssize
+log_capture_read (LogCapture *capture, int fd)
+{
+    g_return_val_if_fail (capture != NULL, -1);
+
+    guint8 buffer[4096];
+    gssize n_read = read (fd, buffer, sizeof (buffer));
+    if (n_read > 0)
+        log_capture_add (capture, buffer, n_read);
+    return n_read;
+}
+
+void
+log_capture_add (LogCapture *capture, const guint8 *data, gsize length)
+{
+    g_return_if_fail (capture != NULL);
+
+    /* Drop whatever is over the rate limit */
+    if (capture->rate > 0)
+    {
+        gint64 now = g_get_monotonic_time ();
+        capture->tokens = MIN (capture->rate, capture->tokens + (now - capture->last_refill) * capture->rate / (gdouble) G_USEC_PER_SEC);
+        capture->last_refill = now;
+
+        gsize allowed = MIN (length, (gsize) capture->tokens);
+        capture->tokens -= allowed;
+        capture->n_dropped += length - allowed;
+        length = allowed;
+    }
+
+    /* Only the end of a write bigger than the ring can be kept */
+    if (length > capture->size)
+    {
+        capture->n_overwritten += length - capture->size;
+        data += length - capture->size;
+        length = capture->size;
+    }
+
+    /* Overwrite the oldest data */
+    if (capture->length + length > capture->size)
+    {
+        gsize n_lost = capture->length + length - capture->size;
+        capture->n_overwritten += n_lost;
+        capture->start = (capture->start + n_lost) % capture->size;
+        capture->length -= n_lost;
+    }
+
+    gsize end = (capture->start + capture->length) % capture->size;
+    gsize n_first = MIN (length, capture->size - end);
+    memcpy (capture->data + end, data, n_first);
+    memcpy (capture->data, data + n_first, length - n_first);
+    capture->length += length;
+}
+
+static gboolean
+write_all (int fd, const guint8 *data, gsize length)
+{
+    while (length > 0)
+    {
+        gssize n_written = write (fd, data, length);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return FALSE;
+        data += n_written;
+        length -= n_written;
+    }
+
+    return TRUE;
+}
+
+/* Write the captured output to fd and empty the ring */
+gboolean
+log_capture_flush (LogCapture *capture, int fd)
+{
+    g_return_val_if_fail (capture != NULL, FALSE);
+
+    gboolean result = TRUE;
+    if (capture->n_dropped > 0 || capture->n_overwritten > 0)
+    {
+        g_autofree gchar *note = g_strdup_printf ("[%" G_GUINT64_FORMAT " bytes dropped over rate limit, %" G_GUINT64_FORMAT " bytes overwritten]\n",
+                                                  capture->n_dropped, capture->n_overwritten);
+        result = write_all (fd, (const guint8 *) note, strlen (note));
+    }
+
+    gsize n_first = MIN (capture->length, capture->size - capture->start);
+    if (result)
+        result = write_all (fd, capture->data + capture->start, n_first) &&
+                 write_all (fd, capture->data, capture->length - n_first);
+
+    capture->start = 0;
+    capture->length = 0;
+    capture->n_dropped = 0;
+    capture->n_overwritten = 0;
+
+    return result;
+}
+
+void
+log_capture_free (LogCapture *capture)
+{
+    if (!capture)
+        return;
+    g_free (capture->data);
+    g_free (capture);
+}
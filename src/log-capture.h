@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef LOG_CAPTURE_H_
+#define LOG_CAPTURE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Rate limited in-memory copy of the most recent output of a process */
+typedef struct LogCapture LogCapture;
+
+LogCapture *log_capture_new (gsize size, gsize rate);
+
+gssize log_capture_read (LogCapture *capture, int fd);
+
+void log_capture_add (LogCapture *capture, const guint8 *data, gsize length);
+
+gboolean log_capture_flush (LogCapture *capture, int fd);
+
+void log_capture_free (LogCapture *capture);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LogCapture, log_capture_free)
+
+G_END_DECLS
+
+#endif /* LOG_CAPTURE_H_ */
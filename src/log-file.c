@@ -12,9 +12,111 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
 
 #include "log-file.h"
 
+/* Size at which appended logs are rotated, 0 for no limit */
+static goffset max_size = 0;
+
+/* TRUE to gzip rotated logs */
+static gboolean compress_old = FALSE;
+
+/* Compresses rotated logs one at a time so starting a process never waits for it */
+static GThreadPool *compress_pool = NULL;
+
+/* Counter to make unique names for logs waiting to be compressed */
+static guint rotate_count = 0;
+
+typedef struct
+{
+    gchar *log_filename;
+    gchar *rotated_filename;
+} CompressJob;
+
+void
+log_file_set_max_size (goffset size)
+{
+    max_size = size;
+}
+
+void
+log_file_set_compress (gboolean compress)
+{
+    compress_old = compress;
+}
+
+static gboolean
+compress_file (const gchar *source_filename, const gchar *destination_filename, GError **error)
+{
+    g_autoptr(GFile) source = g_file_new_for_path (source_filename);
+    g_autoptr(GFileInputStream) input = g_file_read (source, NULL, error);
+    if (!input)
+        return FALSE;
+
+    g_autoptr(GFile) destination = g_file_new_for_path (destination_filename);
+    g_autoptr(GFileOutputStream) output = g_file_replace (destination, NULL, FALSE, G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
+    if (!output)
+        return FALSE;
+
+    g_autoptr(GZlibCompressor) compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    g_autoptr(GOutputStream) stream = g_converter_output_stream_new (G_OUTPUT_STREAM (output), G_CONVERTER (compressor));
+    if (g_output_stream_splice (stream, G_INPUT_STREAM (input), G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, NULL, error) < 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+static void
+compress_cb (gpointer data, gpointer user_data)
+{
+    CompressJob *job = data;
+
+    g_autofree gchar *compressed_filename = g_strdup_printf ("%s.old.gz", job->log_filename);
+    g_autofree gchar *old_filename = g_strdup_printf ("%s.old", job->log_filename);
+    g_autoptr(GError) error = NULL;
+    if (compress_file (job->rotated_filename, compressed_filename, &error))
+    {
+        unlink (job->rotated_filename);
+        unlink (old_filename);
+    }
+    else
+    {
+        g_warning ("Failed to compress log file %s: %s", job->rotated_filename, error->message);
+        rename (job->rotated_filename, old_filename);
+    }
+
+    g_free (job->log_filename);
+    g_free (job->rotated_filename);
+    g_free (job);
+}
+
+/* Move an old log out of the way, leaving any compression to the worker thread */
+static void
+rotate (const gchar *log_filename)
+{
+    if (!compress_old)
+    {
+        g_autofree gchar *old_filename = g_strdup_printf ("%s.old", log_filename);
+        rename (log_filename, old_filename);
+        return;
+    }
+
+    g_autofree gchar *rotated_filename = g_strdup_printf ("%s.old.%u.tmp", log_filename, rotate_count++);
+    if (rename (log_filename, rotated_filename) < 0)
+        return;
+
+    if (!compress_pool)
+        compress_pool = g_thread_pool_new (compress_cb, NULL, 1, FALSE, NULL);
+
+    CompressJob *job = g_malloc0 (sizeof (CompressJob));
+    job->log_filename = g_strdup (log_filename);
+    job->rotated_filename = g_steal_pointer (&rotated_filename);
+    g_thread_pool_push (compress_pool, job, NULL);
+}
+
 int
 log_file_open (const gchar *log_filename, LogMode log_mode)
 {
@@ -22,16 +124,20 @@ log_file_open (const gchar *log_filename, LogMode log_mode)
     if (log_mode == LOG_MODE_BACKUP_AND_TRUNCATE)
     {
         /* Move old file out of the way */
-        g_autofree gchar *old_filename = NULL;
-
-        old_filename = g_strdup_printf ("%s.old", log_filename);
-        rename (log_filename, old_filename);
+        rotate (log_filename);
 
         open_flags |= O_TRUNC;
     }
     else if (log_mode == LOG_MODE_APPEND)
     {
-        /* Keep appending to it */
+        /* Keep appending to it, unless it has got too big */
+        struct stat info;
+        if (max_size > 0 && stat (log_filename, &info) == 0 && info.st_size >= max_size)
+        {
+            g_debug ("Rotating log file %s, size %" G_GOFFSET_FORMAT " exceeds %" G_GOFFSET_FORMAT " bytes", log_filename, (goffset) info.st_size, max_size);
+            rotate (log_filename);
+        }
+
         open_flags |= O_APPEND;
     }
     else
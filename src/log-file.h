@@ -21,6 +21,10 @@ typedef enum
     LOG_MODE_APPEND
 } LogMode;
 
+void log_file_set_max_size (goffset size);
+
+void log_file_set_compress (gboolean compress);
+
 int log_file_open (const gchar *log_filename, LogMode log_mode);
 
 #endif /* LOG_FILE_H_ */
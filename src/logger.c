@@ -1,7 +1,23 @@
+#include <string.h>
+
 #include "logger.h"
 
 G_DEFINE_INTERFACE (Logger, logger, G_TYPE_INVALID)
 
+/* Everything is logged until configured otherwise */
+GLogLevelFlags logger_enabled_levels[LOG_SUBSYSTEM_LAST] =
+{
+    G_LOG_LEVEL_MASK, G_LOG_LEVEL_MASK, G_LOG_LEVEL_MASK, G_LOG_LEVEL_MASK,
+    G_LOG_LEVEL_MASK, G_LOG_LEVEL_MASK, G_LOG_LEVEL_MASK
+};
+
+static const gchar *subsystem_names[LOG_SUBSYSTEM_LAST] =
+{
+    "general", "seat", "session", "display-server", "greeter", "xdmcp", "vnc"
+};
+
+static LoggerUnformattedFunc unformatted_func = NULL;
+
 static void
 logger_logv_default (Logger *self, GLogLevelFlags log_level, const gchar *format, va_list ap) __attribute__ ((format (printf, 3, 0)));
 
@@ -9,6 +25,73 @@ static void
 logger_default_init (LoggerInterface *iface)
 {
     iface->logv = &logger_logv_default;
+    iface->subsystem = LOG_SUBSYSTEM_GENERAL;
+}
+
+static GLogLevelFlags
+parse_level (const gchar *level)
+{
+    /* Errors, criticals and warnings are always logged */
+    GLogLevelFlags levels = G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING;
+    if (strcmp (level, "warning") == 0)
+        return levels;
+    levels |= G_LOG_LEVEL_MESSAGE;
+    if (strcmp (level, "message") == 0)
+        return levels;
+    levels |= G_LOG_LEVEL_INFO;
+    if (strcmp (level, "info") == 0)
+        return levels;
+    levels |= G_LOG_LEVEL_DEBUG;
+    if (strcmp (level, "debug") == 0)
+        return levels;
+    return 0;
+}
+
+/* Set the lowest level logged for @subsystem, or every subsystem if %NULL */
+gboolean
+logger_set_level (const gchar *subsystem, const gchar *level)
+{
+    GLogLevelFlags levels = parse_level (level);
+    if (levels == 0)
+        return FALSE;
+
+    for (gint i = 0; i < LOG_SUBSYSTEM_LAST; i++)
+    {
+        if (subsystem == NULL || strcmp (subsystem_names[i], subsystem) == 0)
+        {
+            logger_enabled_levels[i] = levels;
+            if (subsystem)
+                return TRUE;
+        }
+    }
+
+    return subsystem == NULL;
+}
+
+void
+logger_set_all_levels (GLogLevelFlags levels)
+{
+    for (gint i = 0; i < LOG_SUBSYSTEM_LAST; i++)
+        logger_enabled_levels[i] = levels;
+}
+
+void
+logger_set_unformatted_func (LoggerUnformattedFunc func)
+{
+    unformatted_func = func;
+}
+
+/* Log a message that has passed its subsystem's level check */
+void
+logger_log_message (GLogLevelFlags log_level, const gchar *format, ...)
+{
+    va_list ap;
+    va_start (ap, format);
+    if (unformatted_func)
+        unformatted_func (log_level, NULL, format, ap);
+    else
+        g_logv (LOGGER_LOG_DOMAIN, log_level, format, ap);
+    va_end (ap);
 }
 
 gint
@@ -28,45 +111,49 @@ logger_logv (Logger *self, GLogLevelFlags log_level, const gchar *format, va_lis
 void
 logger_logv_default (Logger *self, GLogLevelFlags log_level, const gchar *format, va_list ap)
 {
-    /* figure out how long the prefix is */
-    gint tmp = logger_logprefix (self, NULL, 0);
-    if (tmp < 0)
+    if (!logger_get_enabled (self, log_level))
+        return;
+
+    /* Prefixes are short, so only size one separately in the rare case it doesn't fit */
+    gchar pfx_buf[128];
+    g_autofree gchar *pfx_alloc = NULL;
+    gchar *pfx = pfx_buf;
+    gint length = logger_logprefix (self, pfx_buf, sizeof (pfx_buf));
+    if (length < 0)
     {
         g_error ("failed to get log prefix");
         return;
     }
+    if ((gsize) length >= sizeof (pfx_buf))
+    {
+        pfx = pfx_alloc = g_malloc (length + 1);
+        logger_logprefix (self, pfx, length + 1);
+    }
 
-    /* print the prefix to a variable length array (to avoid malloc) */
-    gchar pfx[tmp + 1];
-    tmp = logger_logprefix (self, pfx, sizeof(pfx));
-    if (tmp < 0)
+    if (unformatted_func)
     {
-        g_error ("failed to get log prefix");
+        unformatted_func (log_level, pfx, format, ap);
         return;
     }
 
-    /* figure out how long the formatted message is */
+    /* Likewise format into a stack buffer and only allocate for long messages */
+    gchar msg_buf[512];
+    g_autofree gchar *msg_alloc = NULL;
+    gchar *msg = msg_buf;
     va_list ap_copy;
     va_copy (ap_copy, ap);
-    tmp = g_vsnprintf (NULL, 0, format, ap_copy);
+    length = g_vsnprintf (msg_buf, sizeof (msg_buf), format, ap_copy);
     va_end (ap_copy);
-    if (tmp < 0)
-    {
-        g_error ("failed to format log message");
-        return;
-    }
-
-    /* print the message to a variable length array (to avoid malloc) */
-    gchar msg[tmp+1];
-    tmp = g_vsnprintf (msg, sizeof(msg), format, ap);
-    if (tmp < 0)
+    if (length < 0)
     {
         g_error ("failed to format log message");
         return;
     }
+    if ((gsize) length >= sizeof (msg_buf))
+        msg = msg_alloc = g_strdup_vprintf (format, ap);
 
     /* log the message with the prefix */
-    g_log (G_LOG_DOMAIN, log_level, "%s%s", pfx, msg);
+    g_log (LOGGER_LOG_DOMAIN, log_level, "%s%s", pfx, msg);
 }
 
 void
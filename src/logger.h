@@ -18,15 +18,54 @@ G_BEGIN_DECLS
 
 typedef struct Logger Logger;
 
+/* Parts of the daemon that can be given their own log level */
+typedef enum
+{
+    LOG_SUBSYSTEM_GENERAL,
+    LOG_SUBSYSTEM_SEAT,
+    LOG_SUBSYSTEM_SESSION,
+    LOG_SUBSYSTEM_DISPLAY_SERVER,
+    LOG_SUBSYSTEM_GREETER,
+    LOG_SUBSYSTEM_XDMCP,
+    LOG_SUBSYSTEM_VNC,
+    LOG_SUBSYSTEM_LAST
+} LogSubsystem;
+
 typedef struct {
     GTypeInterface parent;
 
     gint (*logprefix) (Logger *self, gchar *buf, gulong buflen);
     void (*logv) (Logger *self, GLogLevelFlags log_level, const gchar *format, va_list ap);
+
+    /* Subsystem whose log level applies to this logger */
+    LogSubsystem subsystem;
 } LoggerInterface;
 
+/* Domain of messages that have already been checked against their subsystem's level */
+#define LOGGER_LOG_DOMAIN "lightdm"
+
+/* Levels enabled for each subsystem, checked before any message is formatted */
+extern GLogLevelFlags logger_enabled_levels[LOG_SUBSYSTEM_LAST];
+
 GType logger_get_type (void);
 
+/* Called instead of formatting messages when they are being logged unformatted */
+typedef void (*LoggerUnformattedFunc) (GLogLevelFlags log_level, const gchar *prefix, const gchar *format, va_list ap);
+
+gboolean logger_set_level (const gchar *subsystem, const gchar *level);
+
+void logger_set_unformatted_func (LoggerUnformattedFunc func);
+
+void logger_log_message (GLogLevelFlags log_level, const gchar *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+void logger_set_all_levels (GLogLevelFlags levels);
+
+#define logger_level_enabled(subsystem, log_level) \
+    ((logger_enabled_levels[subsystem] & (log_level)) != 0)
+
+#define logger_get_enabled(self, log_level) \
+    logger_level_enabled (LOGGER_GET_INTERFACE (self)->subsystem, log_level)
+
 /*!
  * \brief instruct \c self to generate a log message prefix
  *
@@ -51,10 +90,20 @@ void logger_log (Logger *self, GLogLevelFlags log_level, const gchar *format, ..
 
 /* convenience wrappers around logger_log() */
 #define l_debug(self, ...) \
-    logger_log (LOGGER (self), G_LOG_LEVEL_DEBUG, __VA_ARGS__)
+    G_STMT_START { \
+        if (logger_get_enabled (self, G_LOG_LEVEL_DEBUG)) \
+            logger_log (LOGGER (self), G_LOG_LEVEL_DEBUG, __VA_ARGS__); \
+    } G_STMT_END
 #define l_warning(self, ...) \
     logger_log (LOGGER (self), G_LOG_LEVEL_WARNING, __VA_ARGS__)
 
+/* For code that logs with g_debug () directly */
+#define log_debug(subsystem, ...) \
+    G_STMT_START { \
+        if (logger_level_enabled (subsystem, G_LOG_LEVEL_DEBUG)) \
+            logger_log_message (G_LOG_LEVEL_DEBUG, __VA_ARGS__); \
+    } G_STMT_END
+
 G_END_DECLS
 
 #endif /* !LOGGER_H_ */
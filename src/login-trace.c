@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "login-trace.h"
+
+/* Number of events kept for the D-Bus interface */
+#define MAX_EVENTS 1024
+
+typedef struct
+{
+    gint64 timestamp;
+    LoginTracePoint point;
+    const gchar *phase;
+    gchar *seat_name;
+    guint session_id;
+} LoginTraceEvent;
+
+static GQueue events = G_QUEUE_INIT;
+
+/* File to write trace events to */
+static FILE *trace_file = NULL;
+
+static const gchar *
+point_to_string (LoginTracePoint point)
+{
+    switch (point)
+    {
+    case LOGIN_TRACE_BEGIN:
+        return "begin";
+    case LOGIN_TRACE_END:
+        return "end";
+    case LOGIN_TRACE_INSTANT:
+    default:
+        return "instant";
+    }
+}
+
+static void
+free_event (LoginTraceEvent *event)
+{
+    g_free (event->seat_name);
+    g_free (event);
+}
+
+void
+login_trace_set_file (const gchar *filename)
+{
+    if (trace_file)
+        fclose (trace_file);
+    trace_file = NULL;
+
+    if (!filename)
+        return;
+
+    trace_file = fopen (filename, "w");
+    if (!trace_file)
+    {
+        g_warning ("Failed to open login trace file %s: %s", filename, strerror (errno));
+        return;
+    }
+
+    /* Trace Event Format, the closing bracket is optional so the file is valid at any time */
+    fputs ("[\n", trace_file);
+    fflush (trace_file);
+}
+
+static void
+write_event (LoginTraceEvent *event)
+{
+    /* Async events so phases of different seats and sessions can overlap */
+    const gchar *type;
+    switch (event->point)
+    {
+    case LOGIN_TRACE_BEGIN:
+        type = "b";
+        break;
+    case LOGIN_TRACE_END:
+        type = "e";
+        break;
+    case LOGIN_TRACE_INSTANT:
+    default:
+        type = "n";
+        break;
+    }
+
+    fprintf (trace_file,
+             "{\"name\": \"%s\", \"cat\": \"login\", \"ph\": \"%s\", \"ts\": %" G_GINT64_FORMAT ", \"pid\": %d, \"tid\": 0, \"id\": \"%s/%u\", \"args\": {\"seat\": \"%s\", \"session\": %u}},\n",
+             event->phase, type, event->timestamp, getpid (),
+             event->seat_name ? event->seat_name : "", event->session_id,
+             event->seat_name ? event->seat_name : "", event->session_id);
+    fflush (trace_file);
+}
+
+/* Phase names must be static strings */
+void
+login_trace (LoginTracePoint point, const gchar *phase, const gchar *seat_name, guint session_id)
+{
+    LoginTraceEvent *event = g_malloc0 (sizeof (LoginTraceEvent));
+    event->timestamp = g_get_monotonic_time ();
+    event->point = point;
+    event->phase = phase;
+    event->seat_name = g_strdup (seat_name);
+    event->session_id = session_id;
+
+    if (trace_file)
+        write_event (event);
+
+    g_queue_push_tail (&events, event);
+    while (g_queue_get_length (&events) > MAX_EVENTS)
+        free_event (g_queue_pop_head (&events));
+}
+
+GVariant *
+login_trace_get_events (void)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xsssu)"));
+    for (GList *link = events.head; link; link = link->next)
+    {
+        LoginTraceEvent *event = link->data;
+        g_variant_builder_add (&builder, "(xsssu)",
+                               event->timestamp,
+                               point_to_string (event->point),
+                               event->phase,
+                               event->seat_name ? event->seat_name : "",
+                               event->session_id);
+    }
+
+    return g_variant_builder_end (&builder);
+}
+
+void
+login_trace_cleanup (void)
+{
+    login_trace_set_file (NULL);
+    while (!g_queue_is_empty (&events))
+        free_event (g_queue_pop_head (&events));
+}
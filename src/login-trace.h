@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef LOGIN_TRACE_H_
+#define LOGIN_TRACE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Points in a login phase, phases are matched by name, seat and session */
+typedef enum
+{
+    LOGIN_TRACE_BEGIN,
+    LOGIN_TRACE_END,
+    LOGIN_TRACE_INSTANT
+} LoginTracePoint;
+
+void login_trace_set_file (const gchar *filename);
+
+void login_trace (LoginTracePoint point, const gchar *phase, const gchar *seat_name, guint session_id);
+
+GVariant *login_trace_get_events (void);
+
+void login_trace_cleanup (void);
+
+G_END_DECLS
+
+#endif /* LOGIN_TRACE_H_ */
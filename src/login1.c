@@ -14,11 +14,15 @@
 #include <gio/gio.h>
 
 #include "login1.h"
+#include "service-notify.h"
 
 #define LOGIN1_SERVICE_NAME "org.freedesktop.login1"
 #define LOGIN1_OBJECT_NAME "/org/freedesktop/login1"
 #define LOGIN1_MANAGER_INTERFACE_NAME "org.freedesktop.login1.Manager"
 
+/* Time in milliseconds to wait for logind to reply to a method call */
+#define LOGIN1_CALL_TIMEOUT 5000
+
 enum {
     SEAT_ADDED,
     SEAT_REMOVED,
@@ -37,6 +41,9 @@ typedef struct
     /* Seats the service is reporting */
     GList *seats;
 
+    /* Seats that have been announced but whose properties are still being read */
+    GList *pending_seats;
+
     /* Handle to signal subscription */
     guint signal_id;
 } Login1ServicePrivate;
@@ -94,6 +101,8 @@ update_property (Login1Seat *seat, const gchar *name, GVariant *value)
         priv->can_graphical = g_variant_get_boolean (value);
         g_signal_emit (seat, seat_signals[CAN_GRAPHICAL_CHANGED], 0);
     }
+    else if (strcmp (name, "CanMultiSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+        priv->can_multi_session = g_variant_get_boolean (value);
     else if (strcmp (name, "ActiveSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE ("(so)")))
     {
         const gchar *login1_session_id;
@@ -102,6 +111,33 @@ update_property (Login1Seat *seat, const gchar *name, GVariant *value)
     }
 }
 
+typedef struct
+{
+    Login1Seat *seat;
+    gchar *name;
+} PropertyRequest;
+
+static void
+get_property_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    PropertyRequest *request = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error)
+        g_warning ("Error updating seat property %s: %s", request->name, error->message);
+    if (result)
+    {
+        g_autoptr(GVariant) v = NULL;
+        g_variant_get (result, "(v)", &v);
+        update_property (request->seat, request->name, v);
+    }
+
+    g_object_unref (request->seat);
+    g_free (request->name);
+    g_free (request);
+}
+
 static void
 seat_properties_changed_cb (GDBusConnection *connection,
                             const gchar *sender_name,
@@ -125,31 +161,45 @@ seat_properties_changed_cb (GDBusConnection *connection,
 
     while (g_variant_iter_loop (invalidated_properties, "&s", &name))
     {
-        g_autoptr(GError) error = NULL;
-        g_autoptr(GVariant) result = g_dbus_connection_call_sync (connection,
-                                                                  LOGIN1_SERVICE_NAME,
-                                                                  priv->path,
-                                                                  "org.freedesktop.DBus.Properties",
-                                                                  "Get",
-                                                                  g_variant_new ("(ss)", "org.freedesktop.login1.Seat", name),
-                                                                  G_VARIANT_TYPE ("(v)"),
-                                                                  G_DBUS_CALL_FLAGS_NONE,
-                                                                  -1,
-                                                                  NULL,
-                                                                  &error);
-        if (error)
-            g_warning ("Error updating seat property %s: %s", name, error->message);
-        if (result)
-        {
-            g_autoptr(GVariant) v = NULL;
-            g_variant_get (result, "(v)", &v);
-            update_property (seat, name, v);
-        }
+        PropertyRequest *request = g_malloc0 (sizeof (PropertyRequest));
+        request->seat = g_object_ref (seat);
+        request->name = g_strdup (name);
+        g_dbus_connection_call (connection,
+                                LOGIN1_SERVICE_NAME,
+                                priv->path,
+                                "org.freedesktop.DBus.Properties",
+                                "Get",
+                                g_variant_new ("(ss)", "org.freedesktop.login1.Seat", name),
+                                G_VARIANT_TYPE ("(v)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                LOGIN1_CALL_TIMEOUT,
+                                NULL,
+                                get_property_cb,
+                                request);
+    }
+}
+
+static void
+set_seat_properties (Login1Seat *seat, GVariant *result)
+{
+    Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
+
+    g_autoptr(GVariantIter) properties = NULL;
+    g_variant_get (result, "(a{sv})", &properties);
+
+    const gchar *name;
+    GVariant *value;
+    while (g_variant_iter_loop (properties, "{&sv}", &name, &value))
+    {
+        if (strcmp (name, "CanGraphical") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            priv->can_graphical = g_variant_get_boolean (value);
+        else if (strcmp (name, "CanMultiSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            priv->can_multi_session = g_variant_get_boolean (value);
     }
 }
 
 static Login1Seat *
-add_seat (Login1Service *service, const gchar *id, const gchar *path)
+new_seat (Login1Service *service, const gchar *id, const gchar *path)
 {
     Login1ServicePrivate *priv = login1_service_get_instance_private (service);
 
@@ -171,8 +221,20 @@ add_seat (Login1Service *service, const gchar *id, const gchar *path)
                                                             g_object_ref (seat),
                                                             g_object_unref);
 
+    return seat;
+}
+
+static Login1Seat *
+add_seat (Login1Service *service, const gchar *id, const gchar *path)
+{
+    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
+
+    Login1Seat *seat = new_seat (service, id, path);
+    Login1SeatPrivate *s_priv = login1_seat_get_instance_private (seat);
+
     /* Get properties for this seat */
     g_autoptr(GError) error = NULL;
+    service_notify_blocking_begin ("logind seat GetAll");
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (s_priv->connection,
                                                               LOGIN1_SERVICE_NAME,
                                                               path,
@@ -181,32 +243,61 @@ add_seat (Login1Service *service, const gchar *id, const gchar *path)
                                                               g_variant_new ("(s)", "org.freedesktop.login1.Seat"),
                                                               G_VARIANT_TYPE ("(a{sv})"),
                                                               G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
+                                                              LOGIN1_CALL_TIMEOUT,
                                                               NULL,
                                                               &error);
+    service_notify_blocking_end ();
     if (error)
         g_warning ("Failed to get seat properties: %s", error->message);
     if (result)
-    {
-        g_autoptr(GVariantIter) properties = NULL;
-        g_variant_get (result, "(a{sv})", &properties);
-
-        const gchar *name;
-        GVariant *value;
-        while (g_variant_iter_loop (properties, "{&sv}", &name, &value))
-        {
-            if (strcmp (name, "CanGraphical") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-                s_priv->can_graphical = g_variant_get_boolean (value);
-            else if (strcmp (name, "CanMultiSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-                s_priv->can_multi_session = g_variant_get_boolean (value);
-        }
-    }
+        set_seat_properties (seat, result);
 
     priv->seats = g_list_append (priv->seats, seat);
 
     return seat;
 }
 
+static void
+get_seat_properties_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    g_autoptr(Login1Seat) seat = data;
+    Login1Service *service = login1_service_get_instance ();
+    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error)
+        g_warning ("Failed to get seat properties: %s", error->message);
+
+    /* Seat was removed while we were waiting */
+    GList *link = g_list_find (priv->pending_seats, seat);
+    if (!link)
+        return;
+    priv->pending_seats = g_list_delete_link (priv->pending_seats, link);
+
+    if (result)
+        set_seat_properties (seat, result);
+
+    /* Reference from the pending list moves to the seat list */
+    priv->seats = g_list_append (priv->seats, seat);
+    g_signal_emit (service, service_signals[SEAT_ADDED], 0, seat);
+}
+
+static Login1Seat *
+find_seat (GList *seats, const gchar *id)
+{
+    for (GList *link = seats; link; link = link->next)
+    {
+        Login1Seat *seat = link->data;
+        Login1SeatPrivate *s_priv = login1_seat_get_instance_private (seat);
+
+        if (strcmp (s_priv->id, id) == 0)
+            return seat;
+    }
+
+    return NULL;
+}
+
 static void
 signal_cb (GDBusConnection *connection,
            const gchar *sender_name,
@@ -224,18 +315,38 @@ signal_cb (GDBusConnection *connection,
         const gchar *id, *path;
         g_variant_get (parameters, "(&s&o)", &id, &path);
 
-        Login1Seat *seat = login1_service_get_seat (service, id);
-        if (!seat)
-        {
-            seat = add_seat (service, id, path);
-            g_signal_emit (service, service_signals[SEAT_ADDED], 0, seat);
-        }
+        if (login1_service_get_seat (service, id) || find_seat (priv->pending_seats, id))
+            return;
+
+        /* Only report the seat once we know what it can do */
+        Login1Seat *seat = new_seat (service, id, path);
+        priv->pending_seats = g_list_append (priv->pending_seats, g_object_ref (seat));
+        g_dbus_connection_call (connection,
+                                LOGIN1_SERVICE_NAME,
+                                path,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)", "org.freedesktop.login1.Seat"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                LOGIN1_CALL_TIMEOUT,
+                                NULL,
+                                get_seat_properties_cb,
+                                seat);
     }
     else if (strcmp (signal_name, "SeatRemoved") == 0)
     {
         const gchar *id, *path;
         g_variant_get (parameters, "(&s&o)", &id, &path);
 
+        Login1Seat *pending_seat = find_seat (priv->pending_seats, id);
+        if (pending_seat)
+        {
+            priv->pending_seats = g_list_remove (priv->pending_seats, pending_seat);
+            g_object_unref (pending_seat);
+            return;
+        }
+
         g_autoptr(Login1Seat) seat = login1_service_get_seat (service, id);
         if (seat)
         {
@@ -273,6 +384,7 @@ login1_service_connect (Login1Service *service)
                                                           g_object_ref (service),
                                                           g_object_unref);
 
+    service_notify_blocking_begin ("logind ListSeats");
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
                                                               LOGIN1_SERVICE_NAME,
                                                               LOGIN1_OBJECT_NAME,
@@ -281,9 +393,10 @@ login1_service_connect (Login1Service *service)
                                                               g_variant_new ("()"),
                                                               G_VARIANT_TYPE ("(a(so))"),
                                                               G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
+                                                              LOGIN1_CALL_TIMEOUT,
                                                               NULL,
                                                               &error);
+    service_notify_blocking_end ();
     if (error)
         g_warning ("Failed to get list of logind seats: %s", error->message);
     if (!result)
@@ -301,6 +414,17 @@ login1_service_connect (Login1Service *service)
     return TRUE;
 }
 
+void
+login1_service_flush (Login1Service *service)
+{
+    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
+
+    g_return_if_fail (service != NULL);
+
+    if (priv->connection)
+        g_dbus_connection_flush_sync (priv->connection, NULL, NULL);
+}
+
 gboolean
 login1_service_get_is_connected (Login1Service *service)
 {
@@ -324,23 +448,42 @@ login1_service_get_seat (Login1Service *service, const gchar *id)
 
     g_return_val_if_fail (service != NULL, NULL);
 
-    for (GList *link = priv->seats; link; link = link->next)
-    {
-        Login1Seat *seat = link->data;
-        Login1SeatPrivate *s_priv = login1_seat_get_instance_private (seat);
+    return find_seat (priv->seats, id);
+}
 
-        if (strcmp (s_priv->id, id) == 0)
-            return seat;
-    }
+static void
+session_call_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    const gchar *message = data;
 
-    return NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error)
+        g_warning ("%s: %s", message, error->message);
 }
 
-void
-login1_service_lock_session (Login1Service *service, const gchar *session_id)
+static void
+call_session_method (Login1Service *service, const gchar *method, const gchar *session_id, const gchar *error_message)
 {
     Login1ServicePrivate *priv = login1_service_get_instance_private (service);
 
+    g_dbus_connection_call (priv->connection,
+                            LOGIN1_SERVICE_NAME,
+                            LOGIN1_OBJECT_NAME,
+                            LOGIN1_MANAGER_INTERFACE_NAME,
+                            method,
+                            g_variant_new ("(s)", session_id),
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            LOGIN1_CALL_TIMEOUT,
+                            NULL,
+                            session_call_cb,
+                            (gpointer) error_message);
+}
+
+void
+login1_service_lock_session (Login1Service *service, const gchar *session_id)
+{
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -349,27 +492,12 @@ login1_service_lock_session (Login1Service *service, const gchar *session_id)
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "LockSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error locking login1 session: %s", error->message);
+    call_session_method (service, "LockSession", session_id, "Error locking login1 session");
 }
 
 void
 login1_service_unlock_session (Login1Service *service, const gchar *session_id)
 {
-    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
-
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -378,27 +506,12 @@ login1_service_unlock_session (Login1Service *service, const gchar *session_id)
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "UnlockSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error unlocking login1 session: %s", error->message);
+    call_session_method (service, "UnlockSession", session_id, "Error unlocking login1 session");
 }
 
 void
 login1_service_activate_session (Login1Service *service, const gchar *session_id)
 {
-    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
-
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -407,27 +520,12 @@ login1_service_activate_session (Login1Service *service, const gchar *session_id
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "ActivateSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error activating login1 session: %s", error->message);
+    call_session_method (service, "ActivateSession", session_id, "Error activating login1 session");
 }
 
 void
 login1_service_terminate_session (Login1Service *service, const gchar *session_id)
 {
-    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
-
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -436,20 +534,7 @@ login1_service_terminate_session (Login1Service *service, const gchar *session_i
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "TerminateSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error terminating login1 session: %s", error->message);
+    call_session_method (service, "TerminateSession", session_id, "Error terminating login1 session");
 }
 
 static void
@@ -464,6 +549,7 @@ login1_service_finalize (GObject *object)
     Login1ServicePrivate *priv = login1_service_get_instance_private (self);
 
     g_list_free_full (priv->seats, g_object_unref);
+    g_list_free_full (priv->pending_seats, g_object_unref);
     g_dbus_connection_signal_unsubscribe (priv->connection, priv->signal_id);
     g_clear_object (&priv->connection);
 
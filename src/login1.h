@@ -60,6 +60,8 @@ Login1Service *login1_service_get_instance (void);
 
 gboolean login1_service_connect (Login1Service *service);
 
+void login1_service_flush (Login1Service *service);
+
 gboolean login1_service_get_is_connected (Login1Service *service);
 
 GList *login1_service_get_seats (Login1Service *service);
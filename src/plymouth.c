@@ -9,10 +9,28 @@
  * license.
  */
 
-#include <stdlib.h>
-#include <sys/wait.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
 
 #include "plymouth.h"
+#include "startup-profile.h"
+#include "service-notify.h"
+
+/* Abstract socket plymouthd listens on for requests */
+#define PLYMOUTH_SOCKET_PATH "/org/freedesktop/plymouthd"
+
+/* Request types from the Plymouth boot protocol */
+#define PLYMOUTH_REQUEST_PING "P"
+#define PLYMOUTH_REQUEST_HAS_ACTIVE_VT "V"
+#define PLYMOUTH_REQUEST_DEACTIVATE "D"
+#define PLYMOUTH_REQUEST_QUIT "Q"
+
+/* Response meaning the request succeeded */
+#define PLYMOUTH_RESPONSE_ACK 0x06
+
+/* Seconds to wait for plymouthd to answer a request we need the result of */
+#define PLYMOUTH_REPLY_TIMEOUT 5
 
 static gboolean have_pinged = FALSE;
 static gboolean have_checked_active_vt = FALSE;
@@ -21,26 +39,112 @@ static gboolean is_running = FALSE;
 static gboolean is_active = FALSE;
 static gboolean has_active_vt = FALSE;
 
+static GSocket *
+plymouth_connect (void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSocket) socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, &error);
+    if (!socket)
+    {
+        g_warning ("Failed to create Plymouth socket: %s", error->message);
+        return NULL;
+    }
+
+    g_autoptr(GSocketAddress) address = g_unix_socket_address_new_with_type (PLYMOUTH_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    if (!g_socket_connect (socket, address, NULL, &error))
+    {
+        g_debug ("Could not connect to Plymouth: %s", error->message);
+        return NULL;
+    }
+
+    return g_steal_pointer (&socket);
+}
+
+/* Send a request, an argument is sent as a length-prefixed string */
+static GSocket *
+plymouth_send_request (const gchar *command, const gchar *argument)
+{
+    g_autoptr(GSocket) socket = plymouth_connect ();
+    if (!socket)
+        return NULL;
+
+    guint8 request[256 + 4];
+    gsize length = 0;
+    request[length++] = command[0];
+    if (argument)
+    {
+        gsize argument_length = strlen (argument) + 1;
+        g_return_val_if_fail (argument_length <= 255, NULL);
+        request[length++] = '\002';
+        request[length++] = argument_length;
+        memcpy (request + length, argument, argument_length);
+        length += argument_length;
+    }
+    else
+        request[length++] = '\0';
+
+    g_autoptr(GError) error = NULL;
+    gssize n_written = g_socket_send (socket, (const gchar *) request, length, NULL, &error);
+    if (n_written < 0)
+    {
+        g_warning ("Failed to send Plymouth request: %s", error->message);
+        return NULL;
+    }
+
+    return g_steal_pointer (&socket);
+}
+
+/* Wait for the response to a request, returns TRUE if it was acknowledged */
 static gboolean
-plymouth_run_command (const gchar *command, gint *exit_status)
+plymouth_read_response (GSocket *socket)
 {
-    g_autofree gchar *command_line = g_strdup_printf ("plymouth %s", command);
+    guint8 response;
     g_autoptr(GError) error = NULL;
-    gboolean result = g_spawn_command_line_sync (command_line, NULL, NULL, exit_status, &error);
+    gssize n_read = g_socket_receive (socket, (gchar *) &response, 1, NULL, &error);
+    if (n_read < 0)
+        g_warning ("Failed to read Plymouth response: %s", error->message);
 
-    if (error)
-        g_debug ("Could not run %s: %s", command_line, error->message);
+    return n_read == 1 && response == PLYMOUTH_RESPONSE_ACK;
+}
+
+static gboolean
+plymouth_request_sync (const gchar *command, const gchar *argument)
+{
+    g_autoptr(GSocket) socket = plymouth_send_request (command, argument);
+    if (!socket)
+        return FALSE;
 
+    g_socket_set_timeout (socket, PLYMOUTH_REPLY_TIMEOUT);
+    service_notify_blocking_begin ("plymouth request");
+    gboolean result = plymouth_read_response (socket);
+    service_notify_blocking_end ();
     return result;
 }
 
 static gboolean
-plymouth_command_returns_true (gchar *command)
+response_cb (GSocket *socket, GIOCondition condition, gpointer data)
 {
-    gint exit_status;
-    if (!plymouth_run_command (command, &exit_status))
-        return FALSE;
-    return WIFEXITED (exit_status) && WEXITSTATUS (exit_status) == 0;
+    const gchar *description = data;
+
+    gboolean result = plymouth_read_response (socket);
+    g_debug ("Plymouth %s request %s", description, result ? "completed" : "failed");
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Send a request without waiting for the response */
+static void
+plymouth_request_async (const gchar *command, const gchar *argument, const gchar *description)
+{
+    g_autoptr(GSocket) socket = plymouth_send_request (command, argument);
+    if (!socket)
+        return;
+
+    /* The source keeps the socket open until plymouthd answers or hangs up */
+    g_socket_set_blocking (socket, FALSE);
+    g_autoptr(GSource) source = g_socket_create_source (socket, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback (source, (GSourceFunc) response_cb, (gpointer) description, NULL);
+    g_source_attach (source, NULL);
 }
 
 gboolean
@@ -49,7 +153,7 @@ plymouth_get_is_running (void)
     if (!have_pinged)
     {
         have_pinged = TRUE;
-        is_running = plymouth_command_returns_true ("--ping");
+        is_running = plymouth_request_sync (PLYMOUTH_REQUEST_PING, NULL);
         is_active = is_running;
     }
 
@@ -68,7 +172,7 @@ plymouth_has_active_vt (void)
     if (!have_checked_active_vt)
     {
         have_checked_active_vt = TRUE;
-        has_active_vt = plymouth_command_returns_true ("--has-active-vt");
+        has_active_vt = plymouth_request_sync (PLYMOUTH_REQUEST_HAS_ACTIVE_VT, NULL);
     }
 
     return has_active_vt;
@@ -79,7 +183,9 @@ plymouth_deactivate (void)
 {
     g_debug ("Deactivating Plymouth");
     is_active = FALSE;
-    plymouth_run_command ("deactivate", NULL);
+
+    /* Wait for Plymouth to release the display before a display server takes it over */
+    plymouth_request_sync (PLYMOUTH_REQUEST_DEACTIVATE, NULL);
 }
 
 void
@@ -92,8 +198,6 @@ plymouth_quit (gboolean retain_splash)
 
     have_pinged = TRUE;
     is_running = FALSE;
-    if (retain_splash)
-        plymouth_run_command ("quit --retain-splash", NULL);
-    else
-        plymouth_run_command ("quit", NULL);
+    startup_profile_mark ("plymouth-quit");
+    plymouth_request_async (PLYMOUTH_REQUEST_QUIT, retain_splash ? "\001" : "", "quit");
 }
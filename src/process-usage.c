@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "process-usage.h"
+
+static gchar *
+read_proc_file (GPid pid, const gchar *name)
+{
+    g_autofree gchar *path = g_strdup_printf ("/proc/%d/%s", pid, name);
+    gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return NULL;
+    return contents;
+}
+
+/* Find "name: value" in a /proc file */
+static gboolean
+get_field (const gchar *contents, const gchar *name, guint64 *value)
+{
+    gsize name_length = strlen (name);
+    for (const gchar *line = contents; line; line = strchr (line, '\n'))
+    {
+        if (line[0] == '\n')
+            line++;
+        if (strncmp (line, name, name_length) == 0 && line[name_length] == ':')
+        {
+            *value = g_ascii_strtoull (line + name_length + 1, NULL, 10);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean
+read_process (GPid pid, ProcessUsage *usage, guint depth)
+{
+    g_autofree gchar *stat = read_proc_file (pid, "stat");
+    if (!stat)
+        return FALSE;
+
+    /* Fields follow the command name, which can contain spaces and brackets */
+    const gchar *c = strrchr (stat, ')');
+    if (!c || c[1] == '\0')
+        return FALSE;
+    g_auto(GStrv) fields = g_strsplit (c + 2, " ", 16);
+    if (g_strv_length (fields) < 15)
+        return FALSE;
+
+    /* utime, stime, cutime and cstime are fields 14-17 of the whole line */
+    static long ticks_per_second = 0;
+    if (ticks_per_second == 0)
+        ticks_per_second = sysconf (_SC_CLK_TCK);
+    guint64 utime = g_ascii_strtoull (fields[11], NULL, 10) + g_ascii_strtoull (fields[13], NULL, 10);
+    guint64 stime = g_ascii_strtoull (fields[12], NULL, 10) + g_ascii_strtoull (fields[14], NULL, 10);
+    usage->user_time += utime * G_USEC_PER_SEC / ticks_per_second;
+    usage->system_time += stime * G_USEC_PER_SEC / ticks_per_second;
+
+    g_autofree gchar *status = read_proc_file (pid, "status");
+    guint64 hwm;
+    if (status && get_field (status, "VmHWM", &hwm))
+        usage->max_rss = MAX (usage->max_rss, hwm * 1024);
+
+    /* Only readable by the owner of the process and root */
+    g_autofree gchar *io = read_proc_file (pid, "io");
+    guint64 value;
+    if (io && get_field (io, "read_bytes", &value))
+        usage->read_bytes += value;
+    if (io && get_field (io, "write_bytes", &value))
+        usage->write_bytes += value;
+
+    /* Children that have not been waited for yet are not in the totals above */
+    if (depth >= 32)
+        return TRUE;
+    g_autofree gchar *children_name = g_strdup_printf ("task/%d/children", pid);
+    g_autofree gchar *children = read_proc_file (pid, children_name);
+    g_auto(GStrv) child_pids = children ? g_strsplit (g_strstrip (children), " ", -1) : NULL;
+    for (gint i = 0; child_pids && child_pids[i]; i++)
+    {
+        GPid child_pid = atoi (child_pids[i]);
+        if (child_pid > 0)
+            read_process (child_pid, usage, depth + 1);
+    }
+
+    return TRUE;
+}
+
+/* Sample the resources used so far by a running (or exited but not yet
+ * reaped) process and its descendants. Values only ever increase so children
+ * exiting between samples can't make them go backwards */
+gboolean
+process_usage_read (GPid pid, ProcessUsage *usage)
+{
+    ProcessUsage sample = { 0 };
+    if (!read_process (pid, &sample, 0))
+        return FALSE;
+
+    usage->user_time = MAX (usage->user_time, sample.user_time);
+    usage->system_time = MAX (usage->system_time, sample.system_time);
+    usage->max_rss = MAX (usage->max_rss, sample.max_rss);
+    usage->read_bytes = MAX (usage->read_bytes, sample.read_bytes);
+    usage->write_bytes = MAX (usage->write_bytes, sample.write_bytes);
+
+    return TRUE;
+}
+
+/* Update with the final figures from wait4() */
+void
+process_usage_set_rusage (ProcessUsage *usage, const struct rusage *rusage)
+{
+    usage->user_time = MAX (usage->user_time, (guint64) rusage->ru_utime.tv_sec * G_USEC_PER_SEC + rusage->ru_utime.tv_usec);
+    usage->system_time = MAX (usage->system_time, (guint64) rusage->ru_stime.tv_sec * G_USEC_PER_SEC + rusage->ru_stime.tv_usec);
+    usage->max_rss = MAX (usage->max_rss, (guint64) rusage->ru_maxrss * 1024);
+
+    /* Block counts are in 512 byte units and miss cached I/O, so only use
+     * them if /proc couldn't be read */
+    if (usage->read_bytes == 0)
+        usage->read_bytes = (guint64) rusage->ru_inblock * 512;
+    if (usage->write_bytes == 0)
+        usage->write_bytes = (guint64) rusage->ru_oublock * 512;
+}
+
+void
+process_usage_add (ProcessUsage *total, const ProcessUsage *usage)
+{
+    total->user_time += usage->user_time;
+    total->system_time += usage->system_time;
+    total->max_rss = MAX (total->max_rss, usage->max_rss);
+    total->read_bytes += usage->read_bytes;
+    total->write_bytes += usage->write_bytes;
+}
+
+GVariant *
+process_usage_to_variant (const ProcessUsage *usage)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+    g_variant_builder_add (&builder, "{st}", "UserTime", usage->user_time);
+    g_variant_builder_add (&builder, "{st}", "SystemTime", usage->system_time);
+    g_variant_builder_add (&builder, "{st}", "MaxRSS", usage->max_rss);
+    g_variant_builder_add (&builder, "{st}", "ReadBytes", usage->read_bytes);
+    g_variant_builder_add (&builder, "{st}", "WriteBytes", usage->write_bytes);
+    return g_variant_builder_end (&builder);
+}
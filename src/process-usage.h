@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef PROCESS_USAGE_H_
+#define PROCESS_USAGE_H_
+
+#include <glib.h>
+#include <sys/resource.h>
+
+G_BEGIN_DECLS
+
+/* Resources used by a process and the children it has waited for */
+typedef struct
+{
+    /* CPU time in microseconds */
+    guint64 user_time;
+    guint64 system_time;
+
+    /* Peak resident set size in bytes */
+    guint64 max_rss;
+
+    /* Bytes read from and written to storage */
+    guint64 read_bytes;
+    guint64 write_bytes;
+} ProcessUsage;
+
+gboolean process_usage_read (GPid pid, ProcessUsage *usage);
+
+void process_usage_set_rusage (ProcessUsage *usage, const struct rusage *rusage);
+
+void process_usage_add (ProcessUsage *total, const ProcessUsage *usage);
+
+GVariant *process_usage_to_variant (const ProcessUsage *usage);
+
+G_END_DECLS
+
+#endif /* PROCESS_USAGE_H_ */
@@ -9,6 +9,7 @@
  * license.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -18,8 +19,21 @@
 #include <signal.h>
 #include <grp.h>
 #include <config.h>
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__linux__) && defined(SYS_pidfd_open)
+#define USE_PIDFD_REAPER
+#endif
 
+#include "environment.h"
+#include "log-capture.h"
 #include "log-file.h"
+#include "metrics.h"
 #include "process.h"
 
 enum {
@@ -41,6 +55,16 @@ typedef struct
     gboolean log_stdout;
     LogMode log_mode;
 
+    /* Output held in memory and only written to the log file when flushed */
+    gsize capture_size;
+    gsize capture_rate;
+    LogCapture *capture;
+    GIOChannel *capture_channel;
+    guint capture_watch;
+
+    /* TRUE once the capture has been written out since the process started */
+    gboolean capture_flushed;
+
     /* Command to run */
     gchar *command;
 
@@ -48,7 +72,7 @@ typedef struct
     gboolean clear_environment;
 
     /* Environment variables to set */
-    GHashTable *env;
+    Environment *env;
 
     /* Process ID */
     GPid pid;
@@ -56,6 +80,9 @@ typedef struct
     /* Exit status of process */
     int exit_status;
 
+    /* Resources used by the process, final once it has exited */
+    ProcessUsage usage;
+
     /* TRUE if stopping this process (waiting for child process to stop) */
     gboolean stopping;
 
@@ -64,6 +91,15 @@ typedef struct
 
     /* Watch on process */
     guint watch;
+
+    /* File descriptor referring to the process when reaped by the shared reaper */
+    int pidfd;
+
+    /* Time process_stop() was called */
+    gint64 stop_time;
+
+    /* TRUE if had to kill the process to stop it */
+    gboolean killed;
 } ProcessPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (Process, process, G_TYPE_OBJECT)
@@ -73,10 +109,20 @@ static GHashTable *processes = NULL;
 static pid_t signal_pid;
 static int signal_pipe[2];
 
-#ifndef HAVE_CLEARENV
-extern char **environ;
+/* A signal sent to the daemon, written in one go so it can't be interleaved */
+typedef struct
+{
+    int signo;
+    pid_t pid;
+} SignalEvent;
+
+#ifdef USE_PIDFD_REAPER
+/* All the watched processes are in one epoll set, so one wakeup reaps every process that has exited */
+static int reaper_fd = -1;
 #endif
 
+extern char **environ;
+
 Process *
 process_get_current (void)
 {
@@ -115,6 +161,100 @@ process_set_log_file (Process *process, const gchar *path, gboolean log_stdout,
     priv->log_mode = log_mode;
 }
 
+void
+process_set_log_capture (Process *process, gsize size, gsize rate)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+
+    g_return_if_fail (process != NULL);
+
+    priv->capture_size = size;
+    priv->capture_rate = rate;
+}
+
+static void
+flush_capture (ProcessPrivate *priv)
+{
+    if (!priv->capture || !priv->log_file)
+        return;
+
+    int log_fd = log_file_open (priv->log_file, priv->capture_flushed ? LOG_MODE_APPEND : priv->log_mode);
+    if (log_fd < 0)
+        return;
+    if (!log_capture_flush (priv->capture, log_fd))
+        g_warning ("Failed to write captured output to %s: %s", priv->log_file, strerror (errno));
+    close (log_fd);
+    priv->capture_flushed = TRUE;
+}
+
+static void
+stop_capture (ProcessPrivate *priv)
+{
+    if (priv->capture_watch)
+        g_source_remove (priv->capture_watch);
+    priv->capture_watch = 0;
+    g_clear_pointer (&priv->capture_channel, g_io_channel_unref);
+}
+
+static gboolean
+capture_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    ProcessPrivate *priv = data;
+
+    gssize n_read = log_capture_read (priv->capture, g_io_channel_unix_get_fd (source));
+    if (n_read > 0 || (n_read < 0 && errno == EAGAIN))
+        return G_SOURCE_CONTINUE;
+
+    /* Everything that could write to the pipe has closed it */
+    priv->capture_watch = 0;
+    g_clear_pointer (&priv->capture_channel, g_io_channel_unref);
+    return G_SOURCE_REMOVE;
+}
+
+/* Returns the end of a pipe to give to the process in place of the log file */
+static int
+start_capture (ProcessPrivate *priv)
+{
+    stop_capture (priv);
+    g_clear_pointer (&priv->capture, log_capture_free);
+    priv->capture_flushed = FALSE;
+
+    int fds[2];
+    if (pipe2 (fds, O_CLOEXEC) < 0)
+    {
+        g_warning ("Failed to make pipe to capture output: %s", strerror (errno));
+        return log_file_open (priv->log_file, priv->log_mode);
+    }
+    fcntl (fds[0], F_SETFL, O_NONBLOCK);
+
+    priv->capture = log_capture_new (priv->capture_size, priv->capture_rate);
+    priv->capture_channel = g_io_channel_unix_new (fds[0]);
+    g_io_channel_set_close_on_unref (priv->capture_channel, TRUE);
+    priv->capture_watch = g_io_add_watch (priv->capture_channel, G_IO_IN | G_IO_HUP | G_IO_ERR, capture_cb, priv);
+
+    return fds[1];
+}
+
+void
+process_flush_logs (void)
+{
+    if (!processes)
+        return;
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init (&iter, processes);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        ProcessPrivate *priv = process_get_instance_private (PROCESS (value));
+
+        /* Write out anything still in the pipe first */
+        if (priv->capture_channel)
+            while (log_capture_read (priv->capture, g_io_channel_unix_get_fd (priv->capture_channel)) > 0);
+        flush_capture (priv);
+    }
+}
+
 void
 process_set_clear_environment (Process *process, gboolean clear_environment)
 {
@@ -137,7 +277,7 @@ process_set_env (Process *process, const gchar *name, const gchar *value)
     ProcessPrivate *priv = process_get_instance_private (process);
     g_return_if_fail (process != NULL);
     g_return_if_fail (name != NULL);
-    g_hash_table_insert (priv->env, g_strdup (name), g_strdup (value));
+    environment_set (priv->env, name, value);
 }
 
 const gchar *
@@ -146,7 +286,7 @@ process_get_env (Process *process, const gchar *name)
     ProcessPrivate *priv = process_get_instance_private (process);
     g_return_val_if_fail (process != NULL, NULL);
     g_return_val_if_fail (name != NULL, NULL);
-    return g_hash_table_lookup (priv->env, name);
+    return environment_get (priv->env, name);
 }
 
 void
@@ -180,6 +320,14 @@ process_watch_cb (GPid pid, gint status, gpointer data)
     else if (WIFSIGNALED (status))
         g_debug ("Process %d terminated with signal %d", pid, WTERMSIG (status));
 
+    /* Keep whatever the process wrote before it stopped */
+    if (priv->capture_channel)
+        while (log_capture_read (priv->capture, g_io_channel_unix_get_fd (priv->capture_channel)) > 0);
+    flush_capture (priv);
+
+    if (priv->stop_time)
+        common_metrics_observe_since ("lightdm_process_stop_duration_seconds", priv->killed ? "forced=\"true\"" : "forced=\"false\"", priv->stop_time);
+
     if (priv->quit_timeout)
         g_source_remove (priv->quit_timeout);
     priv->quit_timeout = 0;
@@ -189,6 +337,214 @@ process_watch_cb (GPid pid, gint status, gpointer data)
     g_signal_emit (process, signals[STOPPED], 0);
 }
 
+#ifdef USE_PIDFD_REAPER
+static void
+stop_pidfd_watch (ProcessPrivate *priv)
+{
+    if (priv->pidfd < 0)
+        return;
+
+    /* Closing also removes it from the epoll set */
+    close (priv->pidfd);
+    priv->pidfd = -1;
+}
+
+static gboolean
+reaper_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    struct epoll_event events[64];
+    int n_events;
+    do
+    {
+        n_events = epoll_wait (reaper_fd, events, G_N_ELEMENTS (events), 0);
+        if (n_events < 0 && errno == EINTR)
+            continue;
+        if (n_events < 0)
+        {
+            g_warning ("Error waiting for processes: %s", strerror (errno));
+            return G_SOURCE_CONTINUE;
+        }
+
+        for (int i = 0; i < n_events; i++)
+        {
+            pid_t pid = events[i].data.u64;
+            Process *process = g_hash_table_lookup (processes, GINT_TO_POINTER (pid));
+            if (!process)
+                continue;
+            ProcessPrivate *priv = process_get_instance_private (process);
+
+            /* Take the last reading while the exited process can still be inspected */
+            process_usage_read (pid, &priv->usage);
+
+            int status = 0;
+            struct rusage rusage;
+            pid_t result = wait4 (pid, &status, WNOHANG, &rusage);
+            if (result == 0)
+                continue;
+            if (result < 0)
+                g_warning ("Error reaping process %d: %s", pid, strerror (errno));
+            else
+                process_usage_set_rusage (&priv->usage, &rusage);
+
+            stop_pidfd_watch (priv);
+            process_watch_cb (pid, status, process);
+        }
+    } while (n_events == G_N_ELEMENTS (events));
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+start_pidfd_watch (Process *process)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+
+    if (reaper_fd < 0)
+    {
+        reaper_fd = epoll_create1 (EPOLL_CLOEXEC);
+        if (reaper_fd < 0)
+            return FALSE;
+        g_io_add_watch (g_io_channel_unix_new (reaper_fd), G_IO_IN, reaper_cb, NULL);
+    }
+
+    /* Falls back to a child watch on kernels without pidfd support */
+    int fd = syscall (SYS_pidfd_open, priv->pid, 0);
+    if (fd < 0)
+        return FALSE;
+
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN;
+    event.data.u64 = priv->pid;
+    if (epoll_ctl (reaper_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        close (fd);
+        return FALSE;
+    }
+    priv->pidfd = fd;
+
+    return TRUE;
+}
+#endif
+
+static gboolean
+watch_process (Process *process, gboolean block)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+
+    if (block)
+    {
+        int exit_status;
+        struct rusage rusage;
+        if (wait4 (priv->pid, &exit_status, 0, &rusage) > 0)
+            process_usage_set_rusage (&priv->usage, &rusage);
+        process_watch_cb (priv->pid, exit_status, process);
+    }
+    else
+    {
+        g_hash_table_insert (processes, GINT_TO_POINTER (priv->pid), g_object_ref (process));
+#ifdef USE_PIDFD_REAPER
+        if (start_pidfd_watch (process))
+            return TRUE;
+#endif
+        priv->watch = g_child_watch_add (priv->pid, process_watch_cb, process);
+    }
+
+    return TRUE;
+}
+
+#ifdef HAVE_POSIX_SPAWN
+/* Build the complete environment for the child up front */
+static gchar **
+build_envp (ProcessPrivate *priv)
+{
+    GPtrArray *envp = g_ptr_array_new ();
+
+    if (!priv->clear_environment)
+    {
+        for (gchar **e = environ; e && *e; e++)
+        {
+            const gchar *divider = strchr (*e, '=');
+            g_autofree gchar *key = divider ? g_strndup (*e, divider - *e) : g_strdup (*e);
+            if (!environment_contains (priv->env, key))
+                g_ptr_array_add (envp, g_strdup (*e));
+        }
+    }
+
+    for (const gchar * const *e = environment_get_envp (priv->env); *e; e++)
+        g_ptr_array_add (envp, g_strdup (*e));
+    g_ptr_array_add (envp, NULL);
+
+    return (gchar **) g_ptr_array_free (envp, FALSE);
+}
+
+/* Find a program the way execvp() would in the child's environment */
+static gchar *
+find_program (ProcessPrivate *priv, const gchar *name)
+{
+    if (strchr (name, '/'))
+        return g_strdup (name);
+
+    const gchar *path = environment_get (priv->env, "PATH");
+    if (!path && !priv->clear_environment)
+        path = g_getenv ("PATH");
+    if (!path)
+        path = "/bin:/usr/bin";
+
+    g_auto(GStrv) dirs = g_strsplit (path, ":", -1);
+    for (int i = 0; dirs[i]; i++)
+    {
+        g_autofree gchar *filename = g_build_filename (dirs[i][0] != '\0' ? dirs[i] : ".", name, NULL);
+        if (access (filename, X_OK) == 0)
+            return g_steal_pointer (&filename);
+    }
+
+    return NULL;
+}
+
+/* Launch without forking the daemon, possible when there is no custom setup to run in the child */
+static pid_t
+spawn_process (ProcessPrivate *priv, gchar **argv, int log_fd)
+{
+    g_autofree gchar *filename = find_program (priv, argv[0]);
+    if (!filename)
+        return -1;
+
+    g_auto(GStrv) envp = build_envp (priv);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init (&actions);
+    if (log_fd >= 0)
+    {
+        if (priv->log_stdout)
+            posix_spawn_file_actions_adddup2 (&actions, log_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2 (&actions, log_fd, STDERR_FILENO);
+        posix_spawn_file_actions_addclose (&actions, log_fd);
+    }
+
+    /* Reset SIGPIPE handler so the child has default behaviour (we disabled it at LightDM start) */
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init (&attributes);
+    sigset_t signals;
+    sigemptyset (&signals);
+    sigaddset (&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault (&attributes, &signals);
+    posix_spawnattr_setflags (&attributes, POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int result = posix_spawn (&pid, filename, &actions, &attributes, argv, envp);
+    posix_spawn_file_actions_destroy (&actions);
+    posix_spawnattr_destroy (&attributes);
+
+    if (result != 0)
+    {
+        g_debug ("Failed to spawn %s, falling back to fork: %s", filename, strerror (result));
+        return -1;
+    }
+
+    return pid;
+}
+#endif
+
 gboolean
 process_start (Process *process, gboolean block)
 {
@@ -198,6 +554,8 @@ process_start (Process *process, gboolean block)
     g_return_val_if_fail (priv->command != NULL, FALSE);
     g_return_val_if_fail (priv->pid == 0, FALSE);
 
+    memset (&priv->usage, 0, sizeof (priv->usage));
+
     gint argc;
     g_auto(GStrv) argv = NULL;
     g_autoptr(GError) error = NULL;
@@ -208,23 +566,29 @@ process_start (Process *process, gboolean block)
     }
 
     int log_fd = -1;
-    if (priv->log_file)
+    if (priv->log_file && priv->capture_size > 0)
+        log_fd = start_capture (priv);
+    else if (priv->log_file)
         log_fd = log_file_open (priv->log_file, priv->log_mode);
 
-    /* Work out variables to set */
-    guint env_length = g_hash_table_size (priv->env);
-    g_autofree gchar **env_keys = g_malloc (sizeof (gchar *) * env_length);
-    g_autofree gchar **env_values = g_malloc (sizeof (gchar *) * env_length);
-    GList *keys = g_hash_table_get_keys (priv->env);
-    guint i = 0;
-    for (GList *link = keys; i < env_length; i++, link = link->next)
+    pid_t pid = -1;
+#ifdef HAVE_POSIX_SPAWN
+    if (!priv->run_func)
+        pid = spawn_process (priv, argv, log_fd);
+    if (pid > 0)
     {
-        env_keys[i] = link->data;
-        env_values[i] = g_hash_table_lookup (priv->env, env_keys[i]);
+        close (log_fd);
+        g_debug ("Launching process %d: %s", pid, priv->command);
+        common_metrics_add ("lightdm_process_spawns_total", "method=\"posix_spawn\"", 1);
+        priv->pid = pid;
+        return watch_process (process, block);
     }
-    g_list_free (keys);
+#endif
 
-    pid_t pid = fork ();
+    /* Work out variables to set */
+    const gchar * const *envp = environment_get_envp (priv->env);
+
+    pid = fork ();
     if (pid == 0)
     {
         /* Do custom setup */
@@ -247,8 +611,8 @@ process_start (Process *process, gboolean block)
 #else
             environ = NULL;
 #endif
-        for (guint i = 0; i < env_length; i++)
-            setenv (env_keys[i], env_values[i], TRUE);
+        for (const gchar * const *e = envp; *e; e++)
+            putenv ((gchar *) *e);
 
         /* Reset SIGPIPE handler so the child has default behaviour (we disabled it at LightDM start) */
         signal (SIGPIPE, SIG_DFL);
@@ -262,26 +626,31 @@ process_start (Process *process, gboolean block)
     if (pid < 0)
     {
         g_warning ("Failed to fork: %s", strerror (errno));
+        common_metrics_add ("lightdm_process_spawns_total", "method=\"failed\"", 1);
         return FALSE;
     }
 
     g_debug ("Launching process %d: %s", pid, priv->command);
+    common_metrics_add ("lightdm_process_spawns_total", "method=\"fork\"", 1);
 
     priv->pid = pid;
 
-    if (block)
-    {
-        int exit_status;
-        waitpid (priv->pid, &exit_status, 0);
-        process_watch_cb (priv->pid, exit_status, process);
-    }
-    else
-    {
-        g_hash_table_insert (processes, GINT_TO_POINTER (priv->pid), g_object_ref (process));
-        priv->watch = g_child_watch_add (priv->pid, process_watch_cb, process);
-    }
+    return watch_process (process, block);
+}
 
-    return TRUE;
+/* Watch a child that was started before the daemon re-executed itself */
+gboolean
+process_adopt (Process *process, GPid pid)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+
+    g_return_val_if_fail (process != NULL, FALSE);
+    g_return_val_if_fail (priv->pid == 0, FALSE);
+
+    memset (&priv->usage, 0, sizeof (priv->usage));
+    priv->pid = pid;
+
+    return watch_process (process, FALSE);
 }
 
 gboolean
@@ -300,6 +669,17 @@ process_get_pid (Process *process)
     return priv->pid;
 }
 
+/* Resources used so far, sampled if still running */
+const ProcessUsage *
+process_get_usage (Process *process)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+    g_return_val_if_fail (process != NULL, NULL);
+    if (priv->pid > 0 && process != current_process)
+        process_usage_read (priv->pid, &priv->usage);
+    return &priv->usage;
+}
+
 void
 process_signal (Process *process, int signum)
 {
@@ -326,6 +706,7 @@ quit_timeout_cb (Process *process)
     ProcessPrivate *priv = process_get_instance_private (process);
 
     priv->quit_timeout = 0;
+    priv->killed = TRUE;
     process_signal (process, SIGKILL);
 
     return FALSE;
@@ -347,10 +728,174 @@ process_stop (Process *process)
         return;
 
     /* Send SIGTERM, and then SIGKILL if no response */
+    priv->stop_time = g_get_monotonic_time ();
     priv->quit_timeout = g_timeout_add (5000, (GSourceFunc) quit_timeout_cb, process);
     process_signal (process, SIGTERM);
 }
 
+/* Launches waiting for a free slot, one queue per priority */
+struct ProcessLaunch
+{
+    ProcessPriority priority;
+    ProcessLaunchFunc func;
+    gpointer user_data;
+    gint64 queue_time;
+    gboolean started;
+};
+
+static const gchar *priority_labels[PROCESS_PRIORITY_COUNT] =
+{
+    "priority=\"local\"",
+    "priority=\"session\"",
+    "priority=\"remote\"",
+    "priority=\"script\""
+};
+
+static guint max_launches = 0;
+static guint n_launches = 0;
+static GQueue launch_queues[PROCESS_PRIORITY_COUNT];
+static guint launch_idle = 0;
+
+static gboolean
+have_free_launch (void)
+{
+    return max_launches == 0 || n_launches < max_launches;
+}
+
+static void
+start_launch (ProcessLaunch *launch)
+{
+    launch->started = TRUE;
+    n_launches++;
+    common_metrics_observe_since ("lightdm_process_launch_queue_seconds", priority_labels[launch->priority], launch->queue_time);
+}
+
+static gboolean
+launch_idle_cb (gpointer user_data)
+{
+    launch_idle = 0;
+
+    /* Callbacks may free or add launches, so take one at a time */
+    while (have_free_launch ())
+    {
+        ProcessLaunch *launch = NULL;
+        for (int i = 0; i < PROCESS_PRIORITY_COUNT && !launch; i++)
+            launch = g_queue_pop_head (&launch_queues[i]);
+        if (!launch)
+            break;
+
+        start_launch (launch);
+        launch->func (launch->user_data);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_launches (void)
+{
+    if (launch_idle == 0 && have_free_launch ())
+        launch_idle = g_idle_add (launch_idle_cb, NULL);
+}
+
+/* Most launches allowed between starting a process and it being ready, 0 for no limit */
+void
+process_set_max_launches (guint max)
+{
+    max_launches = max;
+    schedule_launches ();
+}
+
+/* Reserve a launch slot, if the returned launch is not started @func is called when it is */
+ProcessLaunch *
+process_launch_new (ProcessPriority priority, ProcessLaunchFunc func, gpointer user_data)
+{
+    g_return_val_if_fail (priority < PROCESS_PRIORITY_COUNT, NULL);
+    g_return_val_if_fail (func != NULL, NULL);
+
+    ProcessLaunch *launch = g_new0 (ProcessLaunch, 1);
+    launch->priority = priority;
+    launch->func = func;
+    launch->user_data = user_data;
+    launch->queue_time = g_get_monotonic_time ();
+
+    /* Don't overtake anything already waiting */
+    gboolean queued = FALSE;
+    for (int i = 0; i < PROCESS_PRIORITY_COUNT; i++)
+        if (!g_queue_is_empty (&launch_queues[i]))
+            queued = TRUE;
+
+    if (!queued && have_free_launch ())
+        start_launch (launch);
+    else
+    {
+        g_debug ("Queueing process launch, %u of %u launches in progress", n_launches, max_launches);
+        g_queue_push_tail (&launch_queues[priority], launch);
+    }
+
+    return launch;
+}
+
+gboolean
+process_launch_get_is_started (ProcessLaunch *launch)
+{
+    g_return_val_if_fail (launch != NULL, FALSE);
+    return launch->started;
+}
+
+/* Release the launch slot once the process is ready, or give up waiting for one */
+void
+process_launch_free (ProcessLaunch *launch)
+{
+    if (!launch)
+        return;
+
+    if (launch->started)
+    {
+        n_launches--;
+        schedule_launches ();
+    }
+    else
+        g_queue_remove (&launch_queues[launch->priority], launch);
+    g_free (launch);
+}
+
+/* Number of child processes being watched */
+guint
+process_get_count (void)
+{
+    return processes ? g_hash_table_size (processes) : 0;
+}
+
+/* The child processes being watched, free the list with g_list_free () */
+GList *
+process_get_all (void)
+{
+    return processes ? g_hash_table_get_values (processes) : NULL;
+}
+
+void
+process_kill_all (void)
+{
+    if (!processes)
+        return;
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init (&iter, processes);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        Process *process = value;
+        ProcessPrivate *priv = process_get_instance_private (process);
+
+        if (priv->quit_timeout)
+            g_source_remove (priv->quit_timeout);
+        priv->quit_timeout = 0;
+        priv->killed = TRUE;
+        process_signal (process, SIGKILL);
+    }
+}
+
 int
 process_get_exit_status (Process *process)
 {
@@ -363,7 +908,8 @@ static void
 process_init (Process *process)
 {
     ProcessPrivate *priv = process_get_instance_private (process);
-    priv->env = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->env = environment_new ();
+    priv->pidfd = -1;
 }
 
 static void
@@ -380,13 +926,19 @@ process_finalize (GObject *object)
     if (priv->pid > 0)
         g_hash_table_remove (processes, GINT_TO_POINTER (priv->pid));
 
+    if (priv->pid)
+        flush_capture (priv);
+    stop_capture (priv);
+    g_clear_pointer (&priv->capture, log_capture_free);
     g_clear_pointer (&priv->log_file, g_free);
     g_clear_pointer (&priv->command, g_free);
-    g_hash_table_unref (priv->env);
+    g_clear_pointer (&priv->env, environment_free);
     if (priv->quit_timeout)
         g_source_remove (priv->quit_timeout);
     if (priv->watch)
         g_source_remove (priv->watch);
+    if (priv->pidfd >= 0)
+        close (priv->pidfd);
 
     if (priv->pid)
         kill (priv->pid, SIGTERM);
@@ -403,33 +955,37 @@ signal_cb (int signum, siginfo_t *info, void *data)
         _exit (EXIT_SUCCESS);
 
     /* Write signal to main thread, if something goes wrong just close the pipe so it is detected on the other end */
-    if (write (signal_pipe[1], &info->si_signo, sizeof (int)) < 0 ||
-        write (signal_pipe[1], &info->si_pid, sizeof (pid_t)) < 0)
+    SignalEvent event = { info->si_signo, info->si_pid };
+    if (write (signal_pipe[1], &event, sizeof (event)) < 0)
         close (signal_pipe[1]);
 }
 
 static gboolean
 handle_signal (GIOChannel *source, GIOCondition condition, gpointer data)
 {
-    errno = 0;
-    int signo;
-    pid_t pid;
-    if (read (signal_pipe[0], &signo, sizeof (int)) != sizeof (int) ||
-        read (signal_pipe[0], &pid, sizeof (pid_t)) != sizeof (pid_t))
+    /* Handle all the signals that arrived since the last wakeup */
+    while (TRUE)
     {
-        g_warning ("Error reading from signal pipe: %s", strerror (errno));
-        return FALSE;
-    }
-
-    g_debug ("Got signal %d from process %d", signo, pid);
+        SignalEvent event;
+        ssize_t n_read = read (signal_pipe[0], &event, sizeof (event));
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read < 0 && errno == EAGAIN)
+            return TRUE;
+        if (n_read != sizeof (event))
+        {
+            g_warning ("Error reading from signal pipe: %s", n_read < 0 ? strerror (errno) : "Short read");
+            return FALSE;
+        }
 
-    Process *process = g_hash_table_lookup (processes, GINT_TO_POINTER (pid));
-    if (process == NULL)
-        process = process_get_current ();
-    if (process)
-        g_signal_emit (process, signals[GOT_SIGNAL], 0, signo);
+        g_debug ("Got signal %d from process %d", event.signo, event.pid);
 
-    return TRUE;
+        Process *process = g_hash_table_lookup (processes, GINT_TO_POINTER (event.pid));
+        if (process == NULL)
+            process = process_get_current ();
+        if (process)
+            g_signal_emit (process, signals[GOT_SIGNAL], 0, event.signo);
+    }
 }
 
 static void
@@ -472,6 +1028,7 @@ process_class_init (ProcessClass *klass)
     if (pipe (signal_pipe) != 0)
         g_critical ("Failed to create signal pipe");
     fcntl (signal_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl (signal_pipe[0], F_SETFL, O_NONBLOCK);
     fcntl (signal_pipe[1], F_SETFD, FD_CLOEXEC);
     g_io_add_watch (g_io_channel_unix_new (signal_pipe[0]), G_IO_IN, handle_signal, NULL);
     action.sa_sigaction = signal_cb;
@@ -481,4 +1038,5 @@ process_class_init (ProcessClass *klass)
     sigaction (SIGINT, &action, NULL);
     sigaction (SIGUSR1, &action, NULL);
     sigaction (SIGUSR2, &action, NULL);
+    sigaction (SIGHUP, &action, NULL);
 }
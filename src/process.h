@@ -15,6 +15,7 @@
 #include <glib-object.h>
 
 #include "log-file.h"
+#include "process-usage.h"
 
 G_BEGIN_DECLS
 
@@ -44,6 +45,20 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC (Process, g_object_unref)
 
 typedef void (*ProcessRunFunc)(Process *process, gpointer user_data);
 
+/* Order launches are started in when the launch limit is reached */
+typedef enum
+{
+    PROCESS_PRIORITY_LOCAL,
+    PROCESS_PRIORITY_SESSION,
+    PROCESS_PRIORITY_REMOTE,
+    PROCESS_PRIORITY_SCRIPT,
+    PROCESS_PRIORITY_COUNT
+} ProcessPriority;
+
+typedef struct ProcessLaunch ProcessLaunch;
+
+typedef void (*ProcessLaunchFunc)(gpointer user_data);
+
 GType process_get_type (void);
 
 Process *process_get_current (void);
@@ -52,6 +67,10 @@ Process *process_new (ProcessRunFunc run_func, gpointer run_func_data);
 
 void process_set_log_file (Process *process, const gchar *path, gboolean log_stdout, LogMode log_mode);
 
+void process_set_log_capture (Process *process, gsize size, gsize rate);
+
+void process_flush_logs (void);
+
 void process_set_clear_environment (Process *process, gboolean clear_environment);
 
 gboolean process_get_clear_environment (Process *process);
@@ -66,16 +85,34 @@ const gchar *process_get_command (Process *process);
 
 gboolean process_start (Process *process, gboolean block);
 
+gboolean process_adopt (Process *process, GPid pid);
+
 gboolean process_get_is_running (Process *process);
 
 GPid process_get_pid (Process *process);
 
+const ProcessUsage *process_get_usage (Process *process);
+
 void process_signal (Process *process, int signum);
 
 void process_stop (Process *process);
 
+void process_kill_all (void);
+
+guint process_get_count (void);
+
+GList *process_get_all (void);
+
 int process_get_exit_status (Process *process);
 
+void process_set_max_launches (guint max_launches);
+
+ProcessLaunch *process_launch_new (ProcessPriority priority, ProcessLaunchFunc func, gpointer user_data);
+
+gboolean process_launch_get_is_started (ProcessLaunch *launch);
+
+void process_launch_free (ProcessLaunch *launch);
+
 G_END_DECLS
 
 #endif /* PROCESS_H_ */
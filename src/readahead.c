@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+
+#include "readahead.h"
+#include "configuration.h"
+
+/* The files a greeter used when it last started are listed one per line
+ * in the cache directory, and read into the page cache in a thread the next
+ * time the daemon starts that greeter */
+#define MAX_FILES 4096
+
+/* Only the start of very large files is read */
+#define MAX_READAHEAD_SIZE (32 * 1024 * 1024)
+
+/* Deepest process tree to look at */
+#define MAX_DEPTH 32
+
+/* Greeters already handled this run, the cache is only cold once after booting */
+static GHashTable *replayed = NULL;
+static GHashTable *recorded = NULL;
+
+typedef struct
+{
+    gchar *name;
+    gchar *path;
+    GPid pid;
+    gint64 start_time;
+} ReadaheadData;
+
+static void
+readahead_data_free (ReadaheadData *data)
+{
+    g_free (data->name);
+    g_free (data->path);
+    g_free (data);
+}
+
+static gchar *
+get_list_path (const gchar *name)
+{
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    g_autofree gchar *filename = g_strdup_printf ("%s.list", name);
+    g_strdelimit (filename, "/", '_');
+    return g_build_filename (cache_dir, "readahead", filename, NULL);
+}
+
+/* Returns TRUE the first time it is called with each name */
+static gboolean
+first_time (GHashTable **names, const gchar *name)
+{
+    if (!*names)
+        *names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    return g_hash_table_add (*names, g_strdup (name));
+}
+
+static ReadaheadData *
+readahead_data_new (const gchar *name, GPid pid)
+{
+    ReadaheadData *data = g_new0 (ReadaheadData, 1);
+    data->name = g_strdup (name);
+    data->path = get_list_path (name);
+    data->pid = pid;
+    data->start_time = g_get_monotonic_time ();
+    return data;
+}
+
+static void
+replay_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    ReadaheadData *data = task_data;
+
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (data->path, &contents, NULL, NULL))
+    {
+        g_task_return_int (task, 0);
+        return;
+    }
+
+    g_auto(GStrv) files = g_strsplit (contents, "\n", -1);
+    gssize n_read = 0;
+    for (int i = 0; files[i] && i < MAX_FILES; i++)
+    {
+        if (files[i][0] != '/')
+            continue;
+
+        int fd = open (files[i], O_RDONLY | O_CLOEXEC | O_NOCTTY);
+        if (fd < 0)
+            continue;
+        struct stat info;
+        if (fstat (fd, &info) == 0 && S_ISREG (info.st_mode) &&
+            posix_fadvise (fd, 0, MIN (info.st_size, MAX_READAHEAD_SIZE), POSIX_FADV_WILLNEED) == 0)
+            n_read++;
+        close (fd);
+    }
+
+    g_task_return_int (task, n_read);
+}
+
+static void
+replay_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    ReadaheadData *data = g_task_get_task_data (G_TASK (result));
+    gssize n_read = g_task_propagate_int (G_TASK (result), NULL);
+    if (n_read > 0)
+        g_debug ("Read ahead %zi files for greeter %s in %" G_GINT64_FORMAT "ms",
+                 n_read, data->name, (g_get_monotonic_time () - data->start_time) / 1000);
+}
+
+/* Start reading the files the greeter used last time so they are cached by the time it runs */
+void
+readahead_replay (const gchar *name)
+{
+    g_return_if_fail (name != NULL);
+
+    if (!config_get_boolean (config_get_instance (), "LightDM", "greeter-readahead") || !first_time (&replayed, name))
+        return;
+
+    g_autoptr(GTask) task = g_task_new (NULL, NULL, replay_cb, NULL);
+    g_task_set_task_data (task, readahead_data_new (name, 0), (GDestroyNotify) readahead_data_free);
+    g_task_run_in_thread (task, replay_thread);
+}
+
+static void
+add_file (GHashTable *seen, GPtrArray *files, const gchar *path)
+{
+    if (files->len >= MAX_FILES || path[0] != '/' ||
+        g_str_has_prefix (path, "/dev/") || g_str_has_prefix (path, "/proc/") || g_str_has_prefix (path, "/sys/") ||
+        g_str_has_prefix (path, "/memfd:") || g_str_has_suffix (path, " (deleted)") ||
+        g_hash_table_contains (seen, path))
+        return;
+
+    if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        return;
+
+    g_hash_table_add (seen, g_strdup (path));
+    g_ptr_array_add (files, g_strdup (path));
+}
+
+static void
+add_process_files (GPid pid, GHashTable *seen, GPtrArray *files, guint depth)
+{
+    /* The program, its libraries and anything else it has mapped like font caches */
+    g_autofree gchar *maps_path = g_strdup_printf ("/proc/%d/maps", pid);
+    g_autofree gchar *maps = NULL;
+    if (g_file_get_contents (maps_path, &maps, NULL, NULL))
+    {
+        g_auto(GStrv) lines = g_strsplit (maps, "\n", -1);
+        for (int i = 0; lines[i]; i++)
+        {
+            /* The path is the only field that can contain a slash */
+            const gchar *path = strchr (lines[i], '/');
+            if (path)
+                add_file (seen, files, path);
+        }
+    }
+
+    /* Files it still has open, like themes and backgrounds being loaded */
+    g_autofree gchar *fd_path = g_strdup_printf ("/proc/%d/fd", pid);
+    g_autoptr(GDir) dir = g_dir_open (fd_path, 0, NULL);
+    const gchar *fd_name;
+    while (dir && (fd_name = g_dir_read_name (dir)))
+    {
+        g_autofree gchar *link_path = g_build_filename (fd_path, fd_name, NULL);
+        g_autofree gchar *target = g_file_read_link (link_path, NULL);
+        if (target)
+            add_file (seen, files, target);
+    }
+
+    if (depth >= MAX_DEPTH)
+        return;
+
+    g_autofree gchar *children_path = g_strdup_printf ("/proc/%d/task/%d/children", pid, pid);
+    g_autofree gchar *children = NULL;
+    if (!g_file_get_contents (children_path, &children, NULL, NULL))
+        return;
+    g_auto(GStrv) child_pids = g_strsplit (g_strstrip (children), " ", -1);
+    for (int i = 0; child_pids[i]; i++)
+    {
+        GPid child_pid = atoi (child_pids[i]);
+        if (child_pid > 0)
+            add_process_files (child_pid, seen, files, depth + 1);
+    }
+}
+
+static void
+record_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    ReadaheadData *data = task_data;
+
+    g_autoptr(GHashTable) seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_autoptr(GPtrArray) files = g_ptr_array_new_with_free_func (g_free);
+    add_process_files (data->pid, seen, files, 0);
+    if (files->len == 0)
+    {
+        g_task_return_int (task, 0);
+        return;
+    }
+
+    g_autoptr(GString) contents = g_string_new (NULL);
+    for (guint i = 0; i < files->len; i++)
+    {
+        g_string_append (contents, g_ptr_array_index (files, i));
+        g_string_append_c (contents, '\n');
+    }
+
+    g_autofree gchar *dir = g_path_get_dirname (data->path);
+    g_autoptr(GError) error = NULL;
+    if (g_mkdir_with_parents (dir, S_IRWXU) < 0 ||
+        !g_file_set_contents (data->path, contents->str, contents->len, &error))
+    {
+        g_task_return_new_error (task, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                                 "Failed to write %s: %s", data->path, error ? error->message : g_strerror (errno));
+        return;
+    }
+
+    g_task_return_int (task, files->len);
+}
+
+static void
+record_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    ReadaheadData *data = g_task_get_task_data (G_TASK (result));
+    g_autoptr(GError) error = NULL;
+    gssize n_files = g_task_propagate_int (G_TASK (result), &error);
+    if (error)
+        g_warning ("Failed to record greeter files for readahead: %s", error->message);
+    else if (n_files > 0)
+        g_debug ("Recorded %zi files used by greeter %s for readahead", n_files, data->name);
+}
+
+/* Save the files used by the greeter running under @pid now it has started */
+void
+readahead_record (const gchar *name, GPid pid)
+{
+    g_return_if_fail (name != NULL);
+
+    if (pid <= 0 || !config_get_boolean (config_get_instance (), "LightDM", "greeter-readahead") || !first_time (&recorded, name))
+        return;
+
+    g_autoptr(GTask) task = g_task_new (NULL, NULL, record_cb, NULL);
+    g_task_set_task_data (task, readahead_data_new (name, pid), (GDestroyNotify) readahead_data_free);
+    g_task_run_in_thread (task, record_thread);
+}
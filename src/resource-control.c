@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <gio/gio.h>
+
+#include "resource-control.h"
+
+/* I/O scheduling classes and how they are packed for ioprio_set() */
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+typedef struct
+{
+    /* Name of the systemd scope processes are put in */
+    gchar *scope_name;
+
+    /* CPUs processes may run on */
+    gboolean have_cpu_affinity;
+#ifdef __linux__
+    cpu_set_t cpu_affinity;
+#endif
+
+    /* Scheduling priority */
+    gboolean have_nice;
+    gint nice;
+
+    /* I/O priority as passed to ioprio_set(), or -1 to leave unchanged */
+    gint io_priority;
+
+    /* Limits for the scope, 0 for no limit */
+    guint64 cpu_quota_usec;
+    guint64 memory_max;
+
+    /* TRUE once the scope has been created */
+    gboolean scope_started;
+
+    GDBusConnection *bus;
+} ResourceControlPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (ResourceControl, resource_control, G_TYPE_OBJECT)
+
+/* A process waiting to be moved into the scope */
+typedef struct
+{
+    ResourceControl *control;
+    GPid pid;
+} ScopeRequest;
+
+ResourceControl *
+resource_control_new (const gchar *name)
+{
+    ResourceControl *control = g_object_new (RESOURCE_CONTROL_TYPE, NULL);
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+
+    /* Unit names can only contain a limited set of characters */
+    g_autofree gchar *unit_name = g_strdup (name);
+    g_strcanon (unit_name, G_CSET_A_2_Z G_CSET_a_2_z G_CSET_DIGITS "-_", '_');
+    priv->scope_name = g_strdup_printf ("lightdm-%s.scope", unit_name);
+
+    return control;
+}
+
+/* Parse a list of CPUs such as "0-3,6" */
+gboolean
+resource_control_set_cpu_affinity (ResourceControl *control, const gchar *cpus)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO (&set);
+
+    g_auto(GStrv) ranges = g_strsplit (cpus, ",", -1);
+    for (int i = 0; ranges[i]; i++)
+    {
+        g_strstrip (ranges[i]);
+        if (ranges[i][0] == '\0')
+            continue;
+
+        gchar *end;
+        guint64 first = g_ascii_strtoull (ranges[i], &end, 10);
+        guint64 last = first;
+        if (end != ranges[i] && *end == '-')
+        {
+            gchar *start = end + 1;
+            last = g_ascii_strtoull (start, &end, 10);
+            if (end == start)
+                return FALSE;
+        }
+        if (end == ranges[i] || *end != '\0' || last < first || last >= CPU_SETSIZE)
+            return FALSE;
+
+        for (guint64 cpu = first; cpu <= last; cpu++)
+            CPU_SET (cpu, &set);
+    }
+    if (CPU_COUNT (&set) == 0)
+        return FALSE;
+
+    priv->cpu_affinity = set;
+    priv->have_cpu_affinity = TRUE;
+
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void
+resource_control_set_nice (ResourceControl *control, gint nice)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+    priv->have_nice = TRUE;
+    priv->nice = CLAMP (nice, -20, 19);
+}
+
+/* Parse an I/O priority of the form "idle", "best-effort:4" or "realtime:0" */
+gboolean
+resource_control_set_io_priority (ResourceControl *control, const gchar *priority)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+
+    g_auto(GStrv) tokens = g_strsplit (priority, ":", 2);
+    gint class;
+    g_strstrip (tokens[0]);
+    if (strcmp (tokens[0], "idle") == 0)
+        class = IOPRIO_CLASS_IDLE;
+    else if (strcmp (tokens[0], "best-effort") == 0)
+        class = IOPRIO_CLASS_BE;
+    else if (strcmp (tokens[0], "realtime") == 0)
+        class = IOPRIO_CLASS_RT;
+    else
+        return FALSE;
+
+    /* Idle has no levels, the kernel default for the others is 4 */
+    gint level = class == IOPRIO_CLASS_IDLE ? 0 : 4;
+    if (class != IOPRIO_CLASS_IDLE && tokens[1])
+    {
+        gchar *end;
+        level = g_ascii_strtoll (tokens[1], &end, 10);
+        if (end == tokens[1] || *end != '\0' || level < 0 || level > 7)
+            return FALSE;
+    }
+
+    priv->io_priority = (class << IOPRIO_CLASS_SHIFT) | level;
+
+    return TRUE;
+}
+
+/* Parse a percentage of one CPU such as "50%" */
+gboolean
+resource_control_set_cpu_quota (ResourceControl *control, const gchar *quota)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+
+    gchar *end;
+    guint64 percent = g_ascii_strtoull (quota, &end, 10);
+    if (end == quota || strcmp (end, "%") != 0 || percent == 0)
+        return FALSE;
+
+    /* Each percent is 10ms of CPU time per second */
+    priv->cpu_quota_usec = percent * 10000;
+
+    return TRUE;
+}
+
+/* Parse a size in bytes with an optional K, M, G or T suffix */
+gboolean
+resource_control_set_memory_max (ResourceControl *control, const gchar *size)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+
+    gchar *end;
+    guint64 value = g_ascii_strtoull (size, &end, 10);
+    if (end == size || value == 0)
+        return FALSE;
+
+    const gchar *suffixes = "KMGT";
+    if (*end != '\0')
+    {
+        const gchar *suffix = strchr (suffixes, g_ascii_toupper (*end));
+        if (!suffix || end[1] != '\0')
+            return FALSE;
+        for (const gchar *s = suffixes; s <= suffix; s++)
+            value *= 1024;
+    }
+
+    priv->memory_max = value;
+
+    return TRUE;
+}
+
+/* TRUE if nothing is set, so there is no need to apply this */
+gboolean
+resource_control_get_is_empty (ResourceControl *control)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+    return !priv->have_cpu_affinity && !priv->have_nice && priv->io_priority < 0 && priv->cpu_quota_usec == 0 && priv->memory_max == 0;
+}
+
+static void
+scope_request_free (ScopeRequest *request)
+{
+    g_object_unref (request->control);
+    g_free (request);
+}
+
+static void start_scope (ScopeRequest *request);
+static void attach_to_scope (ScopeRequest *request);
+
+static void
+start_scope_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    ScopeRequest *request = data;
+    ResourceControlPrivate *priv = resource_control_get_instance_private (request->control);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) r = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (r)
+    {
+        g_debug ("Started scope %s for process %d", priv->scope_name, request->pid);
+        priv->scope_started = TRUE;
+        scope_request_free (request);
+        return;
+    }
+
+    /* Another process already made it */
+    g_autofree gchar *remote_error = g_dbus_error_get_remote_error (error);
+    if (g_strcmp0 (remote_error, "org.freedesktop.systemd1.UnitExists") == 0)
+    {
+        priv->scope_started = TRUE;
+        attach_to_scope (request);
+        return;
+    }
+
+    g_warning ("Failed to start scope %s: %s", priv->scope_name, error->message);
+    scope_request_free (request);
+}
+
+static void
+start_scope (ScopeRequest *request)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (request->control);
+
+    guint32 pid = request->pid;
+    GVariantBuilder properties;
+    g_variant_builder_init (&properties, G_VARIANT_TYPE ("a(sv)"));
+    g_variant_builder_add (&properties, "(sv)", "Description", g_variant_new_string ("LightDM display server and greeter processes"));
+    g_variant_builder_add (&properties, "(sv)", "PIDs", g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, &pid, 1, sizeof (guint32)));
+    if (priv->cpu_quota_usec > 0)
+        g_variant_builder_add (&properties, "(sv)", "CPUQuotaPerSecUSec", g_variant_new_uint64 (priv->cpu_quota_usec));
+    if (priv->memory_max > 0)
+        g_variant_builder_add (&properties, "(sv)", "MemoryMax", g_variant_new_uint64 (priv->memory_max));
+
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.systemd1",
+                            "/org/freedesktop/systemd1",
+                            "org.freedesktop.systemd1.Manager",
+                            "StartTransientUnit",
+                            g_variant_new ("(ssa(sv)@a(sa(sv)))", priv->scope_name, "fail", &properties,
+                                           g_variant_new_array (G_VARIANT_TYPE ("(sa(sv))"), NULL, 0)),
+                            G_VARIANT_TYPE ("(o)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            start_scope_cb,
+                            request);
+}
+
+static void
+attach_to_scope_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    ScopeRequest *request = data;
+    ResourceControlPrivate *priv = resource_control_get_instance_private (request->control);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) r = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (r)
+    {
+        g_debug ("Moved process %d to scope %s", request->pid, priv->scope_name);
+        scope_request_free (request);
+        return;
+    }
+
+    /* The scope goes away when all its processes have stopped */
+    g_autofree gchar *remote_error = g_dbus_error_get_remote_error (error);
+    if (g_strcmp0 (remote_error, "org.freedesktop.systemd1.NoSuchUnit") == 0 ||
+        g_strcmp0 (remote_error, "org.freedesktop.systemd1.UnitInactive") == 0)
+    {
+        priv->scope_started = FALSE;
+        start_scope (request);
+        return;
+    }
+
+    g_warning ("Failed to move process %d to scope %s: %s", request->pid, priv->scope_name, error->message);
+    scope_request_free (request);
+}
+
+static void
+attach_to_scope (ScopeRequest *request)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (request->control);
+
+    guint32 pid = request->pid;
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.systemd1",
+                            "/org/freedesktop/systemd1",
+                            "org.freedesktop.systemd1.Manager",
+                            "AttachProcessesToUnit",
+                            g_variant_new ("(ss@au)", priv->scope_name, "",
+                                           g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, &pid, 1, sizeof (guint32))),
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            attach_to_scope_cb,
+                            request);
+}
+
+/* Apply the settings to a running process, they are inherited by any processes it starts */
+void
+resource_control_apply (ResourceControl *control, GPid pid)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+
+    g_return_if_fail (control != NULL);
+    g_return_if_fail (pid > 0);
+
+#ifdef __linux__
+    if (priv->have_cpu_affinity && sched_setaffinity (pid, sizeof (priv->cpu_affinity), &priv->cpu_affinity) < 0)
+        g_warning ("Failed to set CPU affinity of process %d: %s", pid, strerror (errno));
+#endif
+    if (priv->have_nice && setpriority (PRIO_PROCESS, pid, priv->nice) < 0)
+        g_warning ("Failed to set priority of process %d: %s", pid, strerror (errno));
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    if (priv->io_priority >= 0 && syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, priv->io_priority) < 0)
+        g_warning ("Failed to set I/O priority of process %d: %s", pid, strerror (errno));
+#endif
+
+    if (priv->cpu_quota_usec == 0 && priv->memory_max == 0)
+        return;
+
+    if (!priv->bus)
+    {
+        g_autoptr(GError) error = NULL;
+        priv->bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+        if (!priv->bus)
+        {
+            g_warning ("Failed to connect to system bus to make scope %s: %s", priv->scope_name, error->message);
+            return;
+        }
+    }
+
+    ScopeRequest *request = g_malloc0 (sizeof (ScopeRequest));
+    request->control = g_object_ref (control);
+    request->pid = pid;
+    if (priv->scope_started)
+        attach_to_scope (request);
+    else
+        start_scope (request);
+}
+
+static void
+resource_control_init (ResourceControl *control)
+{
+    ResourceControlPrivate *priv = resource_control_get_instance_private (control);
+    priv->io_priority = -1;
+}
+
+static void
+resource_control_finalize (GObject *object)
+{
+    ResourceControl *self = RESOURCE_CONTROL (object);
+    ResourceControlPrivate *priv = resource_control_get_instance_private (self);
+
+    g_free (priv->scope_name);
+    g_clear_object (&priv->bus);
+
+    G_OBJECT_CLASS (resource_control_parent_class)->finalize (object);
+}
+
+static void
+resource_control_class_init (ResourceControlClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = resource_control_finalize;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef RESOURCE_CONTROL_H_
+#define RESOURCE_CONTROL_H_
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define RESOURCE_CONTROL_TYPE (resource_control_get_type())
+#define RESOURCE_CONTROL(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), RESOURCE_CONTROL_TYPE, ResourceControl))
+
+typedef struct
+{
+    GObject parent_instance;
+} ResourceControl;
+
+typedef struct
+{
+    GObjectClass parent_class;
+} ResourceControlClass;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ResourceControl, g_object_unref)
+
+GType resource_control_get_type (void);
+
+ResourceControl *resource_control_new (const gchar *name);
+
+gboolean resource_control_set_cpu_affinity (ResourceControl *control, const gchar *cpus);
+
+void resource_control_set_nice (ResourceControl *control, gint nice);
+
+gboolean resource_control_set_io_priority (ResourceControl *control, const gchar *priority);
+
+gboolean resource_control_set_cpu_quota (ResourceControl *control, const gchar *quota);
+
+gboolean resource_control_set_memory_max (ResourceControl *control, const gchar *size);
+
+gboolean resource_control_get_is_empty (ResourceControl *control);
+
+void resource_control_apply (ResourceControl *control, GPid pid);
+
+G_END_DECLS
+
+#endif /* RESOURCE_CONTROL_H_ */
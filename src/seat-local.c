@@ -103,6 +103,9 @@ seat_local_start (Seat *seat)
         return display_server_start (DISPLAY_SERVER (priv->xdmcp_x_server));
     }
 
+    /* Get random data for the greeter and session X server cookies in one go */
+    x_authority_reserve_cookies (2);
+
     return SEAT_CLASS (seat_local_parent_class)->start (seat);
 }
 
@@ -175,6 +178,8 @@ create_x_server (SeatLocal *seat)
     if (command)
         x_server_local_set_command (x_server, command);
 
+    x_server_local_set_use_display_fd (x_server, seat_get_boolean_property (SEAT (seat), "xserver-display-fd"));
+
     g_autofree gchar *number = g_strdup_printf ("%d", x_server_get_display_number (X_SERVER (x_server)));
     g_autoptr(XAuthority) cookie = x_authority_new_local_cookie (number);
     x_server_set_authority (X_SERVER (x_server), cookie);
@@ -192,6 +197,8 @@ create_x_server (SeatLocal *seat)
     gboolean allow_tcp = seat_get_boolean_property (SEAT (seat), "xserver-allow-tcp");
     x_server_local_set_allow_tcp (x_server, allow_tcp);
 
+    x_server_set_background (X_SERVER (x_server), seat_get_string_property (SEAT (seat), "xserver-background"));
+
     return g_steal_pointer (&x_server);
 }
 
@@ -224,6 +231,50 @@ seat_local_create_display_server (Seat *s, Session *session)
     }
 }
 
+static DisplayServer *
+seat_local_adopt_display_server (Seat *seat, HandoffSession *session)
+{
+    if (strcmp (session->session_type, "x") == 0 && session->x_server_pid > 0)
+    {
+        g_autoptr(XServerLocal) x_server = x_server_local_new ();
+        if (session->vt >= 0)
+            x_server_local_set_vt (x_server, session->vt);
+        x_server_local_set_xdg_seat (x_server, seat_get_name (seat));
+        x_server_set_background (X_SERVER (x_server), seat_get_string_property (seat, "xserver-background"));
+
+        /* Clients of the session look up the same cookie */
+        if (session->x_authority_data)
+        {
+            g_autofree gchar *number = g_strdup_printf ("%u", session->display_number);
+            g_autoptr(XAuthority) cookie = x_authority_new_local_cookie (number);
+            gsize length;
+            const guint8 *data = g_bytes_get_data (session->x_authority_data, &length);
+            x_authority_set_authorization_name (cookie, session->x_authority_name);
+            x_authority_set_authorization_data (cookie, data, length);
+            x_server_set_authority (X_SERVER (x_server), cookie);
+        }
+
+        if (!x_server_local_adopt (x_server, session->x_server_pid, session->display_number, session->x_authority_file))
+            return NULL;
+
+        return DISPLAY_SERVER (g_steal_pointer (&x_server));
+    }
+    else if (strcmp (session->session_type, "wayland") == 0)
+    {
+        g_autoptr(WaylandSession) wayland_session = wayland_session_new ();
+        if (session->vt >= 0)
+            wayland_session_set_vt (wayland_session, session->vt);
+        display_server_adopt (DISPLAY_SERVER (wayland_session));
+
+        return DISPLAY_SERVER (g_steal_pointer (&wayland_session));
+    }
+    else
+    {
+        l_warning (seat, "Can't take over unsupported display server '%s'", session->session_type);
+        return NULL;
+    }
+}
+
 static gboolean
 seat_local_display_server_is_used (Seat *seat, DisplayServer *display_server)
 {
@@ -248,6 +299,16 @@ seat_local_create_session (Seat *seat)
     return session;
 }
 
+static void
+vt_set_active_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(Seat) seat = data;
+
+    g_autoptr(GError) error = NULL;
+    if (!vt_set_active_finish (result, &error))
+        l_warning (seat, "Failed to switch VT: %s", error->message);
+}
+
 static void
 seat_local_set_active_session (Seat *seat, Session *session)
 {
@@ -255,7 +316,7 @@ seat_local_set_active_session (Seat *seat, Session *session)
 
     gint vt = display_server_get_vt (display_server);
     if (vt >= 0)
-        vt_set_active (vt);
+        vt_set_active_async (vt, NULL, vt_set_active_cb, g_object_ref (seat));
 
     SEAT_CLASS (seat_local_parent_class)->set_active_session (seat, session);
 }
@@ -335,6 +396,7 @@ seat_local_class_init (SeatLocalClass *klass)
     seat_class->setup = seat_local_setup;
     seat_class->start = seat_local_start;
     seat_class->create_display_server = seat_local_create_display_server;
+    seat_class->adopt_display_server = seat_local_adopt_display_server;
     seat_class->display_server_is_used = seat_local_display_server_is_used;
     seat_class->create_greeter_session = seat_local_create_greeter_session;
     seat_class->create_session = seat_local_create_session;
@@ -19,6 +19,7 @@ G_BEGIN_DECLS
 
 #define SEAT_LOCAL_TYPE (seat_local_get_type())
 #define SEAT_LOCAL(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), SEAT_LOCAL_TYPE, SeatLocal))
+#define IS_SEAT_LOCAL(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), SEAT_LOCAL_TYPE))
 
 typedef struct
 {
@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include "seat-xdmcp-session.h"
+#include "configuration.h"
 #include "x-server-remote.h"
 
 typedef struct
@@ -52,6 +53,8 @@ seat_xdmcp_session_create_display_server (Seat *seat, Session *session)
     g_autofree gchar *host = g_inet_address_to_string (xdmcp_session_get_address (priv->session));
 
     priv->x_server = x_server_remote_new (host, xdmcp_session_get_display_number (priv->session), authority);
+    x_server_set_background (X_SERVER (priv->x_server), seat_get_string_property (seat, "xserver-background"));
+    x_server_set_liveness_timeout (X_SERVER (priv->x_server), MAX (config_get_integer (config_get_instance (), "XDMCPServer", "liveness-timeout"), 0));
 
     return g_object_ref (DISPLAY_SERVER (priv->x_server));
 }
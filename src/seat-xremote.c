@@ -39,7 +39,11 @@ seat_xremote_create_display_server (Seat *seat, Session *session)
 
     l_debug (seat, "Starting remote X display %s:%d", hostname ? hostname : "", number);
 
-    return DISPLAY_SERVER (x_server_remote_new (hostname, number, NULL));
+    XServerRemote *x_server = x_server_remote_new (hostname, number, NULL);
+    x_server_set_background (X_SERVER (x_server), seat_get_string_property (seat, "xserver-background"));
+    x_server_set_connect_timeout (X_SERVER (x_server), seat_get_integer_property (seat, "xserver-connect-timeout"));
+
+    return DISPLAY_SERVER (x_server);
 }
 
 static GreeterSession *
@@ -15,11 +15,20 @@
 #include "x-server-xvnc.h"
 #include "configuration.h"
 
+enum {
+    READY,
+    LAST_SIGNAL
+};
+static guint signals[LAST_SIGNAL] = { 0 };
+
 typedef struct
 {
     /* VNC connection */
     GSocket *connection;
 
+    /* Client connection if relayed through the VNC connection */
+    GSocket *client;
+
     /* X server using VNC connection */
     XServerXVNC *x_server;
 } SeatXVNCPrivate;
@@ -36,6 +45,95 @@ SeatXVNC *seat_xvnc_new (GSocket *connection)
     return seat;
 }
 
+void
+seat_xvnc_set_client (SeatXVNC *seat, GSocket *client)
+{
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
+    g_clear_object (&priv->client);
+    priv->client = g_object_ref (client);
+}
+
+static void
+load_geometry (const gchar *section, gint *width, gint *height, gint *depth)
+{
+    if (config_has_key (config_get_instance (), section, "width") &&
+        config_has_key (config_get_instance (), section, "height"))
+    {
+        gint w = config_get_integer (config_get_instance (), section, "width");
+        gint h = config_get_integer (config_get_instance (), section, "height");
+        if (w > 0 && h > 0)
+        {
+            *width = w;
+            *height = h;
+        }
+    }
+    if (config_has_key (config_get_instance (), section, "depth"))
+    {
+        gint d = config_get_integer (config_get_instance (), section, "depth");
+        if (d == 8 || d == 16 || d == 24 || d == 32)
+            *depth = d;
+    }
+}
+
+typedef struct
+{
+    const gchar *section;
+    guint length;
+} SubnetSection;
+
+static gint
+compare_subnet_sections (gconstpointer a, gconstpointer b)
+{
+    const SubnetSection *section_a = a, *section_b = b;
+    return (gint) section_a->length - (gint) section_b->length;
+}
+
+/* Get the geometry and depth for a client, a width, height or depth of 0 means use the Xvnc default.
+ * [VNCServer:<address>/<prefix>] sections override [VNCServer] for clients in that subnet, with the
+ * most specific subnet applied last */
+void
+seat_xvnc_get_client_geometry (GSocket *connection, gint *width, gint *height, gint *depth)
+{
+    *width = *height = *depth = 0;
+    load_geometry ("VNCServer", width, height, depth);
+
+    g_autoptr(GSocketAddress) socket_address = connection ? g_socket_get_remote_address (connection, NULL) : NULL;
+    if (!G_IS_INET_SOCKET_ADDRESS (socket_address))
+        return;
+    GInetAddress *address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (socket_address));
+
+    g_auto(GStrv) groups = config_get_groups (config_get_instance ());
+    g_autoptr(GArray) sections = g_array_new (FALSE, FALSE, sizeof (SubnetSection));
+    for (gchar **group = groups; *group; group++)
+    {
+        if (!g_str_has_prefix (*group, "VNCServer:"))
+            continue;
+
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GInetAddressMask) mask = g_inet_address_mask_new_from_string (*group + strlen ("VNCServer:"), &error);
+        if (!mask)
+        {
+            g_warning ("Ignoring [%s]: %s", *group, error->message);
+            continue;
+        }
+
+        if (g_inet_address_mask_matches (mask, address))
+        {
+            SubnetSection section = { *group, g_inet_address_mask_get_length (mask) };
+            g_array_append_val (sections, section);
+        }
+    }
+    g_array_sort (sections, compare_subnet_sections);
+
+    for (guint i = 0; i < sections->len; i++)
+    {
+        const gchar *section = g_array_index (sections, SubnetSection, i).section;
+        g_debug ("Using VNC geometry from [%s]", section);
+        load_geometry (section, width, height, depth);
+    }
+}
+
 static void
 seat_xvnc_setup (Seat *seat)
 {
@@ -43,6 +141,12 @@ seat_xvnc_setup (Seat *seat)
     SEAT_CLASS (seat_xvnc_parent_class)->setup (seat);
 }
 
+static void
+x_server_ready_cb (DisplayServer *display_server, SeatXVNC *seat)
+{
+    g_signal_emit (seat, signals[READY], 0);
+}
+
 static DisplayServer *
 seat_xvnc_create_display_server (Seat *seat, Session *session)
 {
@@ -57,31 +161,24 @@ seat_xvnc_create_display_server (Seat *seat, Session *session)
 
     g_autoptr(XServerXVNC) x_server = x_server_xvnc_new ();
     priv->x_server = g_object_ref (x_server);
+    x_server_local_set_use_display_fd (X_SERVER_LOCAL (x_server), seat_get_boolean_property (seat, "xserver-display-fd"));
     g_autofree gchar *number = g_strdup_printf ("%d", x_server_get_display_number (X_SERVER (x_server)));
     g_autoptr(XAuthority) cookie = x_authority_new_local_cookie (number);
     x_server_set_authority (X_SERVER (x_server), cookie);
     x_server_xvnc_set_socket (x_server, g_socket_get_fd (priv->connection));
+    x_server_set_background (X_SERVER (x_server), seat_get_string_property (seat, "xserver-background"));
+    g_signal_connect (x_server, DISPLAY_SERVER_SIGNAL_READY, G_CALLBACK (x_server_ready_cb), seat);
 
     const gchar *command = config_get_string (config_get_instance (), "VNCServer", "command");
     if (command)
         x_server_local_set_command (X_SERVER_LOCAL (x_server), command);
 
-    if (config_has_key (config_get_instance (), "VNCServer", "width") &&
-        config_has_key (config_get_instance (), "VNCServer", "height"))
-    {
-        gint width, height;
-        width = config_get_integer (config_get_instance (), "VNCServer", "width");
-        height = config_get_integer (config_get_instance (), "VNCServer", "height");
-        if (height > 0 && width > 0)
-            x_server_xvnc_set_geometry (x_server, width, height);
-    }
-    if (config_has_key (config_get_instance (), "VNCServer", "depth"))
-    {
-        gint depth;
-        depth = config_get_integer (config_get_instance (), "VNCServer", "depth");
-        if (depth == 8 || depth == 16 || depth == 24 || depth == 32)
-            x_server_xvnc_set_depth (x_server, depth);
-    }
+    gint width, height, depth;
+    seat_xvnc_get_client_geometry (priv->connection, &width, &height, &depth);
+    if (width > 0 && height > 0)
+        x_server_xvnc_set_geometry (x_server, width, height);
+    if (depth > 0)
+        x_server_xvnc_set_depth (x_server, depth);
 
     return DISPLAY_SERVER (g_steal_pointer (&x_server));
 }
@@ -92,11 +189,15 @@ seat_xvnc_run_script (Seat *seat, DisplayServer *display_server, Process *script
     SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (SEAT_XVNC (seat));
     XServerXVNC *x_server = X_SERVER_XVNC (display_server);
 
-    GInetSocketAddress *address = G_INET_SOCKET_ADDRESS (g_socket_get_remote_address (priv->connection, NULL));
-    g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (address));
+    /* A pooled server isn't connected to a client until one arrives */
+    g_autoptr(GSocketAddress) address = g_socket_get_remote_address (priv->client ? priv->client : priv->connection, NULL);
+    if (G_IS_INET_SOCKET_ADDRESS (address))
+    {
+        g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (address)));
+        process_set_env (script, "REMOTE_HOST", hostname);
+    }
     const gchar *path = x_server_local_get_authority_file_path (X_SERVER_LOCAL (x_server));
 
-    process_set_env (script, "REMOTE_HOST", hostname);
     process_set_env (script, "DISPLAY", x_server_get_address (X_SERVER (x_server)));
     process_set_env (script, "XAUTHORITY", path);
 
@@ -115,6 +216,9 @@ seat_xvnc_session_finalize (GObject *object)
     SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (self);
 
     g_clear_object (&priv->connection);
+    g_clear_object (&priv->client);
+    if (priv->x_server)
+        g_signal_handlers_disconnect_matched (priv->x_server, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     g_clear_object (&priv->x_server);
 
     G_OBJECT_CLASS (seat_xvnc_parent_class)->finalize (object);
@@ -130,4 +234,13 @@ seat_xvnc_class_init (SeatXVNCClass *klass)
     seat_class->create_display_server = seat_xvnc_create_display_server;
     seat_class->run_script = seat_xvnc_run_script;
     object_class->finalize = seat_xvnc_session_finalize;
+
+    signals[READY] =
+        g_signal_new (SEAT_XVNC_SIGNAL_READY,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SeatXVNCClass, ready),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
 }
@@ -20,6 +20,8 @@ G_BEGIN_DECLS
 #define SEAT_XVNC_TYPE (seat_xvnc_get_type())
 #define SEAT_XVNC(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), SEAT_XVNC_TYPE, SeatXVNC))
 
+#define SEAT_XVNC_SIGNAL_READY "ready"
+
 typedef struct
 {
     Seat parent_instance;
@@ -28,6 +30,8 @@ typedef struct
 typedef struct
 {
     SeatClass parent_class;
+
+    void (*ready)(SeatXVNC *seat);
 } SeatXVNCClass;
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (SeatXVNC, g_object_unref)
@@ -36,6 +40,10 @@ GType seat_xvnc_get_type (void);
 
 SeatXVNC *seat_xvnc_new (GSocket *connection);
 
+void seat_xvnc_set_client (SeatXVNC *seat, GSocket *client);
+
+void seat_xvnc_get_client_geometry (GSocket *connection, gint *width, gint *height, gint *depth);
+
 G_END_DECLS
 
 #endif /* SEAT_XVNC_H_ */
@@ -10,24 +10,92 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
 
 #include "seat.h"
 #include "configuration.h"
 #include "guest-account.h"
 #include "greeter-session.h"
 #include "session-config.h"
+#include "session-index.h"
+#include "shared-data-manager.h"
+#include "login-trace.h"
+#include "readahead.h"
+#include "startup-profile.h"
+#include "service-notify.h"
 
 enum {
     SESSION_ADDED,
     RUNNING_USER_SESSION,
     SESSION_REMOVED,
+    GREETER_CONNECTED,
     STOPPED,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Typed copies of the frequently used properties */
+typedef struct
+{
+    /* Value of properties_generation these were resolved at */
+    guint generation;
+
+    const gchar *user_session;
+    const gchar *guest_session;
+    const gchar *session_wrapper;
+    const gchar *greeter_session;
+    const gchar *greeter_wrapper;
+    const gchar *guest_wrapper;
+    const gchar *pam_service;
+    const gchar *pam_autologin_service;
+    const gchar *pam_greeter_service;
+    const gchar *autologin_user;
+    const gchar *autologin_session;
+
+    gboolean allow_user_switching;
+    gboolean allow_guest;
+    gboolean greeter_allow_guest;
+    gboolean greeter_hide_users;
+    gboolean greeter_show_manual_login;
+    gboolean greeter_show_remote_login;
+    gboolean autologin_guest;
+    gboolean autologin_in_background;
+    gboolean standby_greeter;
+    gboolean freeze_idle_greeter;
+
+    gint autologin_user_timeout;
+
+    /* Limits for display server and greeter processes or NULL if none set */
+    ResourceControl *resource_control;
+} SeatConfig;
+
+/* Called when a script completes with the object it was run for */
+typedef void (*ScriptCallback) (Seat *seat, gboolean success, GObject *object, gpointer data);
+
+typedef struct
+{
+    Process *process;
+    gchar *name;
+    ScriptCallback callback;
+    GObject *object;
+    gpointer data;
+    ProcessLaunch *launch;
+} ScriptRequest;
+
+/* Script run in the background waiting for a launch slot */
+typedef struct
+{
+    Seat *seat;
+    Process *process;
+    gchar *name;
+    ProcessLaunch *launch;
+} BackgroundScript;
+
 typedef struct
 {
     /* XDG name for this seat */
@@ -36,6 +104,12 @@ typedef struct
     /* Configuration for this seat */
     GHashTable *properties;
 
+    /* Incremented each time a property changes */
+    guint properties_generation;
+
+    /* Properties resolved from the configuration */
+    SeatConfig config;
+
     /* TRUE if this seat can run multiple sessions at once */
     gboolean supports_multi_session;
 
@@ -48,6 +122,9 @@ typedef struct
     /* The sessions on this seat */
     GList *sessions;
 
+    /* Sessions authenticating while their display server starts, run once it is set up */
+    GList *early_sessions;
+
     /* The last session set to active */
     Session *active_session;
 
@@ -68,8 +145,60 @@ typedef struct
 
     /* The greeter to be started to replace the current one */
     GreeterSession *replacement_greeter;
+
+    /* Idle session children to use for authentication */
+    SessionChildPool *child_pool;
+
+    /* Timeout to start a standby greeter */
+    guint standby_greeter_timeout;
+
+    /* Timeout to freeze a greeter once it has gone idle */
+    GreeterSession *greeter_to_freeze;
+    guint freeze_greeter_timeout;
+
+    /* Timeout to stop the seat when the greeter has been left unused */
+    guint greeter_idle_timeout;
+
+    /* Number of display servers that have failed in a row and when the last one did */
+    guint greeter_failures;
+    gint64 last_greeter_failure_time;
+
+    /* Timeout to restart the greeter after a failure */
+    guint greeter_restart_timeout;
+    guint greeter_restart_delay;
+
+    /* TRUE if the fallback greeter is being used because the normal one keeps failing */
+    gboolean use_fallback_greeter;
+
+    /* Scripts waiting to run and the one running, run one at a time to keep them in order */
+    GQueue *script_queue;
+    ScriptRequest *running_script;
+
+    /* Idle to report a script that could not be started */
+    guint script_failed_idle;
+
+    /* Timeout to stop a script that is taking too long */
+    guint script_timeout;
+
+    /* Resources used by display servers and sessions that have stopped */
+    ProcessUsage stopped_usage;
+
+    /* Timer to sample the resources used by running processes */
+    guint usage_sample_timeout;
 } SeatPrivate;
 
+/* Seconds to wait after a greeter is used before starting a standby greeter */
+#define STANDBY_GREETER_DELAY 5
+
+/* Seconds to let an idle greeter hide itself before it is frozen */
+#define FREEZE_GREETER_DELAY 2
+
+/* Failures more than this many seconds apart are not counted as being in a row */
+#define GREETER_FAILURE_RESET_TIME 120
+
+/* Longest time in seconds to wait before restarting a failed greeter */
+#define GREETER_RESTART_MAX_DELAY 60
+
 static void seat_logger_iface_init (LoggerInterface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (Seat, seat, G_TYPE_OBJECT,
@@ -87,8 +216,12 @@ static GHashTable *seat_modules = NULL;
 // FIXME: Make a get_display_server() that re-uses display servers if supported
 static DisplayServer *create_display_server (Seat *seat, Session *session);
 static gboolean start_display_server (Seat *seat, DisplayServer *display_server);
+static gboolean start_display_server_for_session (Seat *seat, DisplayServer *display_server, Session *session);
 static GreeterSession *create_greeter_session (Seat *seat);
 static void start_session (Seat *seat, Session *session);
+static void start_session_early (Seat *seat, Session *session);
+static void schedule_standby_greeter (Seat *seat);
+static gboolean usage_sample_cb (gpointer data);
 
 static void
 free_seat_module (gpointer data)
@@ -142,6 +275,7 @@ seat_set_property (Seat *seat, const gchar *name, const gchar *value)
     SeatPrivate *priv = seat_get_instance_private (seat);
     g_return_if_fail (seat != NULL);
     g_hash_table_insert (priv->properties, g_strdup (name), g_strdup (value));
+    priv->properties_generation++;
 }
 
 const gchar *
@@ -160,10 +294,9 @@ seat_get_string_list_property (Seat *seat, const gchar *name)
     return g_strsplit (g_hash_table_lookup (priv->properties, name), ";", 0);
 }
 
-gboolean
-seat_get_boolean_property (Seat *seat, const gchar *name)
+static gboolean
+parse_boolean (const gchar *value)
 {
-    const gchar *value = seat_get_string_property (seat, name);
     if (!value)
         return FALSE;
 
@@ -176,6 +309,12 @@ seat_get_boolean_property (Seat *seat, const gchar *name)
     return strncmp (value, "true", MAX (length, 4)) == 0;
 }
 
+gboolean
+seat_get_boolean_property (Seat *seat, const gchar *name)
+{
+    return parse_boolean (seat_get_string_property (seat, name));
+}
+
 gint
 seat_get_integer_property (Seat *seat, const gchar *name)
 {
@@ -183,6 +322,72 @@ seat_get_integer_property (Seat *seat, const gchar *name)
     return value ? atoi (value) : 0;
 }
 
+static ResourceControl *
+make_resource_control (Seat *seat)
+{
+    g_autoptr(ResourceControl) control = resource_control_new (seat_get_name (seat) ? seat_get_name (seat) : "seat");
+
+    const gchar *value = seat_get_string_property (seat, "resource-cpu-affinity");
+    if (value && value[0] != '\0' && !resource_control_set_cpu_affinity (control, value))
+        l_warning (seat, "Ignoring invalid resource-cpu-affinity %s", value);
+    value = seat_get_string_property (seat, "resource-nice");
+    if (value && value[0] != '\0')
+        resource_control_set_nice (control, atoi (value));
+    value = seat_get_string_property (seat, "resource-io-priority");
+    if (value && value[0] != '\0' && !resource_control_set_io_priority (control, value))
+        l_warning (seat, "Ignoring invalid resource-io-priority %s", value);
+    value = seat_get_string_property (seat, "resource-cpu-quota");
+    if (value && value[0] != '\0' && !resource_control_set_cpu_quota (control, value))
+        l_warning (seat, "Ignoring invalid resource-cpu-quota %s", value);
+    value = seat_get_string_property (seat, "resource-memory-max");
+    if (value && value[0] != '\0' && !resource_control_set_memory_max (control, value))
+        l_warning (seat, "Ignoring invalid resource-memory-max %s", value);
+
+    if (resource_control_get_is_empty (control))
+        return NULL;
+
+    return g_steal_pointer (&control);
+}
+
+/* Get the frequently used properties, resolving them again if any have changed */
+static SeatConfig *
+get_config (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    SeatConfig *config = &priv->config;
+
+    if (config->generation == priv->properties_generation)
+        return config;
+
+    config->user_session = g_hash_table_lookup (priv->properties, "user-session");
+    config->guest_session = g_hash_table_lookup (priv->properties, "guest-session");
+    config->session_wrapper = g_hash_table_lookup (priv->properties, "session-wrapper");
+    config->greeter_session = g_hash_table_lookup (priv->properties, "greeter-session");
+    config->greeter_wrapper = g_hash_table_lookup (priv->properties, "greeter-wrapper");
+    config->guest_wrapper = g_hash_table_lookup (priv->properties, "guest-wrapper");
+    config->pam_service = g_hash_table_lookup (priv->properties, "pam-service");
+    config->pam_autologin_service = g_hash_table_lookup (priv->properties, "pam-autologin-service");
+    config->pam_greeter_service = g_hash_table_lookup (priv->properties, "pam-greeter-service");
+    config->autologin_user = g_hash_table_lookup (priv->properties, "autologin-user");
+    config->autologin_session = g_hash_table_lookup (priv->properties, "autologin-session");
+    config->allow_user_switching = parse_boolean (g_hash_table_lookup (priv->properties, "allow-user-switching"));
+    config->allow_guest = parse_boolean (g_hash_table_lookup (priv->properties, "allow-guest"));
+    config->greeter_allow_guest = parse_boolean (g_hash_table_lookup (priv->properties, "greeter-allow-guest"));
+    config->greeter_hide_users = parse_boolean (g_hash_table_lookup (priv->properties, "greeter-hide-users"));
+    config->greeter_show_manual_login = parse_boolean (g_hash_table_lookup (priv->properties, "greeter-show-manual-login"));
+    config->greeter_show_remote_login = parse_boolean (g_hash_table_lookup (priv->properties, "greeter-show-remote-login"));
+    config->autologin_guest = parse_boolean (g_hash_table_lookup (priv->properties, "autologin-guest"));
+    config->autologin_in_background = parse_boolean (g_hash_table_lookup (priv->properties, "autologin-in-background"));
+    config->standby_greeter = parse_boolean (g_hash_table_lookup (priv->properties, "standby-greeter"));
+    config->freeze_idle_greeter = parse_boolean (g_hash_table_lookup (priv->properties, "freeze-idle-greeter"));
+    config->autologin_user_timeout = seat_get_integer_property (seat, "autologin-user-timeout");
+    g_clear_object (&config->resource_control);
+    config->resource_control = make_resource_control (seat);
+    config->generation = priv->properties_generation;
+
+    return config;
+}
+
 const gchar *
 seat_get_name (Seat *seat)
 {
@@ -215,6 +420,20 @@ seat_start (Seat *seat)
     g_return_val_if_fail (seat != NULL, FALSE);
 
     l_debug (seat, "Starting");
+    login_trace (LOGIN_TRACE_INSTANT, "seat-start", seat_get_name (seat), 0);
+    startup_profile_mark ("seat-started");
+
+    int child_pool_size = seat_get_integer_property (seat, "session-child-pool-size");
+    if (child_pool_size > 0)
+        priv->child_pool = session_child_pool_new (child_pool_size);
+
+    int sample_interval = seat_get_integer_property (seat, "resource-sample-interval");
+    if (sample_interval > 0)
+        priv->usage_sample_timeout = g_timeout_add_seconds (sample_interval, usage_sample_cb, seat);
+
+    /* Get guest accounts ready in advance if configured */
+    if (seat_get_allow_guest (seat))
+        guest_account_prepare ();
 
     SEAT_GET_CLASS (seat)->setup (seat);
     priv->started = SEAT_GET_CLASS (seat)->start (seat);
@@ -237,6 +456,101 @@ set_greeter_idle (gpointer greeter)
     return FALSE;
 }
 
+static void
+cancel_freeze_greeter (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (priv->freeze_greeter_timeout)
+        g_source_remove (priv->freeze_greeter_timeout);
+    priv->freeze_greeter_timeout = 0;
+    g_clear_object (&priv->greeter_to_freeze);
+}
+
+static gboolean
+freeze_greeter_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->freeze_greeter_timeout = 0;
+    GreeterSession *greeter_session = g_steal_pointer (&priv->greeter_to_freeze);
+
+    if (!priv->stopping && SESSION (greeter_session) != priv->active_session &&
+        !session_get_is_stopping (SESSION (greeter_session)))
+    {
+        l_debug (seat, "Freezing idle greeter");
+        session_freeze (SESSION (greeter_session));
+    }
+    g_object_unref (greeter_session);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Stop an idle greeter's processes so it costs nothing until it is reset */
+static void
+schedule_freeze_greeter (Seat *seat, GreeterSession *greeter_session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!get_config (seat)->freeze_idle_greeter)
+        return;
+
+    cancel_freeze_greeter (seat);
+    priv->greeter_to_freeze = g_object_ref (greeter_session);
+    priv->freeze_greeter_timeout = g_timeout_add_seconds (FREEZE_GREETER_DELAY, freeze_greeter_cb, seat);
+}
+
+static void
+cancel_greeter_idle_check (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (priv->greeter_idle_timeout)
+        g_source_remove (priv->greeter_idle_timeout);
+    priv->greeter_idle_timeout = 0;
+}
+
+static void schedule_greeter_idle_check (Seat *seat, gint delay);
+
+static gboolean
+greeter_idle_timeout_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->greeter_idle_timeout = 0;
+
+    Session *session = priv->active_session;
+    gint timeout = seat_get_integer_property (seat, "greeter-idle-timeout");
+    if (priv->stopping || timeout <= 0 || !session || !IS_GREETER_SESSION (session) || session_get_is_stopping (session))
+        return G_SOURCE_REMOVE;
+
+    Greeter *greeter = greeter_session_get_greeter (GREETER_SESSION (session));
+    gint64 idle_time = (g_get_monotonic_time () - greeter_get_last_activity (greeter)) / G_USEC_PER_SEC;
+    if (idle_time < timeout)
+    {
+        schedule_greeter_idle_check (seat, timeout - idle_time);
+        return G_SOURCE_REMOVE;
+    }
+
+    l_debug (seat, "Greeter unused for %" G_GINT64_FORMAT " seconds, stopping seat", idle_time);
+    seat_stop (seat);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Reclaim a remote seat whose greeter nobody is using */
+static void
+schedule_greeter_idle_check (Seat *seat, gint delay)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    cancel_greeter_idle_check (seat);
+    if (delay > 0)
+        priv->greeter_idle_timeout = g_timeout_add_seconds (delay, greeter_idle_timeout_cb, seat);
+}
+
 void
 seat_set_active_session (Seat *seat, Session *session)
 {
@@ -244,6 +558,11 @@ seat_set_active_session (Seat *seat, Session *session)
 
     g_return_if_fail (seat != NULL);
 
+    /* Wake a pooled greeter before showing it */
+    if (priv->greeter_to_freeze && SESSION (priv->greeter_to_freeze) == session)
+        cancel_freeze_greeter (seat);
+    session_thaw (session);
+
     SEAT_GET_CLASS (seat)->set_active_session (seat, session);
 
     /* Stop any greeters */
@@ -267,6 +586,7 @@ seat_set_active_session (Seat *seat, Session *session)
                        request by a greeter.  So they won't expect an IDLE
                        call during that.  Plus, this isn't time-sensitive. */
                     g_idle_add (set_greeter_idle, greeter);
+                    schedule_freeze_greeter (seat, GREETER_SESSION (s));
                 }
             }
             else
@@ -284,6 +604,11 @@ seat_set_active_session (Seat *seat, Session *session)
     session_activate (session);
     g_clear_object (&priv->active_session);
     priv->active_session = g_object_ref (session);
+
+    if (IS_GREETER_SESSION (session))
+        schedule_greeter_idle_check (seat, seat_get_integer_property (seat, "greeter-idle-timeout"));
+    else
+        cancel_greeter_idle_check (seat);
 }
 
 Session *
@@ -355,20 +680,152 @@ seat_get_can_switch (Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
     g_return_val_if_fail (seat != NULL, FALSE);
-    return seat_get_boolean_property (seat, "allow-user-switching") && priv->supports_multi_session;
+    return get_config (seat)->allow_user_switching && priv->supports_multi_session;
 }
 
 gboolean
 seat_get_allow_guest (Seat *seat)
 {
     g_return_val_if_fail (seat != NULL, FALSE);
-    return seat_get_boolean_property (seat, "allow-guest") && guest_account_is_installed ();
+    return get_config (seat)->allow_guest && guest_account_is_installed ();
+}
+
+static void check_stopped (Seat *seat);
+static void script_stopped_cb (Process *process, Seat *seat);
+
+static void
+script_request_free (ScriptRequest *request)
+{
+    g_signal_handlers_disconnect_matched (request->process, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, script_stopped_cb, NULL);
+    g_object_unref (request->process);
+    g_free (request->name);
+    g_clear_object (&request->object);
+    g_clear_pointer (&request->launch, process_launch_free);
+    g_free (request);
+}
+
+static void start_next_script (Seat *seat);
+
+/* Report the result of the running script and start the next one */
+static void
+finish_script (Seat *seat, gboolean success)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    /* The callback might complete stopping the seat */
+    g_autoptr(Seat) self = g_object_ref (seat);
+
+    ScriptRequest *request = priv->running_script;
+    priv->running_script = NULL;
+    if (priv->script_timeout)
+    {
+        g_source_remove (priv->script_timeout);
+        priv->script_timeout = 0;
+    }
+    if (request->callback)
+        request->callback (seat, success, request->object, request->data);
+    script_request_free (request);
+
+    start_next_script (seat);
 }
 
 static gboolean
-run_script (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user)
+script_failed_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->script_failed_idle = 0;
+    finish_script (seat, FALSE);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+script_timeout_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->script_timeout = 0;
+
+    /* The script is reported as failed when it exits */
+    l_warning (seat, "Stopping script %s, it did not complete in %d seconds", priv->running_script->name, seat_get_integer_property (seat, "script-timeout"));
+    process_stop (priv->running_script->process);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+launch_script (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    /* Report failures from the main loop so callers always get the result later */
+    gboolean result = process_start (priv->running_script->process, FALSE);
+    g_clear_pointer (&priv->running_script->launch, process_launch_free);
+    if (!result)
+    {
+        priv->script_failed_idle = g_idle_add (script_failed_cb, seat);
+        return;
+    }
+
+    gint timeout = seat_get_integer_property (seat, "script-timeout");
+    if (timeout > 0)
+        priv->script_timeout = g_timeout_add_seconds (timeout, script_timeout_cb, seat);
+}
+
+static void
+script_launch_cb (gpointer data)
+{
+    launch_script (SEAT (data));
+}
+
+static void
+start_next_script (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (priv->running_script)
+        return;
+
+    if (g_queue_is_empty (priv->script_queue))
+    {
+        check_stopped (seat);
+        return;
+    }
+
+    priv->running_script = g_queue_pop_head (priv->script_queue);
+    g_signal_connect (priv->running_script->process, PROCESS_SIGNAL_STOPPED, G_CALLBACK (script_stopped_cb), seat);
+
+    /* Scripts wait behind display servers that are starting */
+    priv->running_script->launch = process_launch_new (PROCESS_PRIORITY_SESSION, script_launch_cb, seat);
+    if (process_launch_get_is_started (priv->running_script->launch))
+        launch_script (seat);
+}
+
+static void
+script_stopped_cb (Process *process, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    g_return_if_fail (priv->running_script != NULL && priv->running_script->process == process);
+
+    gboolean success = FALSE;
+    int exit_status = process_get_exit_status (process);
+    if (WIFEXITED (exit_status))
+    {
+        l_debug (seat, "Exit status of %s: %d", priv->running_script->name, WEXITSTATUS (exit_status));
+        success = WEXITSTATUS (exit_status) == EXIT_SUCCESS;
+    }
+
+    finish_script (seat, success);
+}
+
+static Process *
+create_script (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user)
 {
-    g_autoptr(Process) script = process_new (NULL, NULL);
+    Process *script = process_new (NULL, NULL);
 
     process_set_command (script, script_name);
 
@@ -400,18 +857,54 @@ run_script (Seat *seat, DisplayServer *display_server, const gchar *script_name,
 
     SEAT_GET_CLASS (seat)->run_script (seat, display_server, script);
 
-    gboolean result = FALSE;
-    if (process_start (script, TRUE))
-    {
-        int exit_status = process_get_exit_status (script);
-        if (WIFEXITED (exit_status))
-        {
-            l_debug (seat, "Exit status of %s: %d", script_name, WEXITSTATUS (exit_status));
-            result = WEXITSTATUS (exit_status) == EXIT_SUCCESS;
-        }
-    }
+    return script;
+}
+
+/* Queue a script to run without blocking the other seats, callback is called with the result */
+static void
+run_script (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user, ScriptCallback callback, gpointer object, gpointer data)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    ScriptRequest *request = g_new0 (ScriptRequest, 1);
+    request->process = create_script (seat, display_server, script_name, user);
+    request->name = g_strdup (script_name);
+    request->callback = callback;
+    request->object = object ? g_object_ref (object) : NULL;
+    request->data = data;
+    g_queue_push_tail (priv->script_queue, request);
+
+    start_next_script (seat);
+}
+
+static void
+background_script_launch_cb (gpointer data)
+{
+    BackgroundScript *script = data;
+
+    if (!process_start (script->process, FALSE))
+        l_warning (script->seat, "Failed to start script %s", script->name);
+
+    process_launch_free (script->launch);
+    g_object_unref (script->seat);
+    g_object_unref (script->process);
+    g_free (script->name);
+    g_free (script);
+}
+
+/* Run a script alongside anything else on the seat without waiting for it */
+static void
+run_script_in_background (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user)
+{
+    BackgroundScript *script = g_new0 (BackgroundScript, 1);
+    script->seat = g_object_ref (seat);
+    script->process = create_script (seat, display_server, script_name, user);
+    script->name = g_strdup (script_name);
 
-    return result;
+    /* These run last when the host is busy starting display servers */
+    script->launch = process_launch_new (PROCESS_PRIORITY_SCRIPT, background_script_launch_cb, script);
+    if (process_launch_get_is_started (script->launch))
+        background_script_launch_cb (script);
 }
 
 static void
@@ -440,7 +933,9 @@ check_stopped (Seat *seat)
     if (priv->stopping &&
         !priv->stopped &&
         g_list_length (priv->display_servers) == 0 &&
-        g_list_length (priv->sessions) == 0)
+        g_list_length (priv->sessions) == 0 &&
+        !priv->running_script &&
+        g_queue_is_empty (priv->script_queue))
     {
         priv->stopped = TRUE;
         l_debug (seat, "Stopped");
@@ -448,25 +943,119 @@ check_stopped (Seat *seat)
     }
 }
 
-static void
-display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
+static gboolean
+restart_greeter_cb (gpointer data)
 {
+    Seat *seat = data;
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    l_debug (seat, "Display server stopped");
+    priv->greeter_restart_timeout = 0;
+    priv->greeter_restart_delay = 0;
 
-    /* Run a script right after stopping the display server */
-    const gchar *script = seat_get_string_property (seat, "display-stopped-script");
-    if (script)
-        run_script (seat, NULL, script, NULL);
+    l_debug (seat, "Restarting greeter");
+    if (!seat_switch_to_greeter (seat))
+    {
+        l_debug (seat, "Stopping; failed to start a greeter");
+        seat_stop (seat);
+    }
 
-    g_signal_handlers_disconnect_matched (display_server, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
-    priv->display_servers = g_list_remove (priv->display_servers, display_server);
+    return G_SOURCE_REMOVE;
+}
+
+/* Start a greeter after a display server failed, backing off if it keeps failing */
+static gboolean
+restart_greeter_after_failure (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    gint64 now = g_get_monotonic_time ();
+    if (priv->greeter_failures > 0 && now - priv->last_greeter_failure_time > GREETER_FAILURE_RESET_TIME * G_USEC_PER_SEC)
+        priv->greeter_failures = 0;
+    priv->greeter_failures++;
+    priv->last_greeter_failure_time = now;
+
+    /* Stop retrying once the limit is reached, unless there is a simpler greeter to try */
+    gint limit = seat_get_integer_property (seat, "greeter-restart-limit");
+    if (limit > 0 && priv->greeter_failures >= (guint) limit)
+    {
+        if (priv->use_fallback_greeter || !seat_get_string_property (seat, "fallback-greeter-session"))
+        {
+            l_warning (seat, "Display server failed %u times in a row, not restarting greeter", priv->greeter_failures);
+            return FALSE;
+        }
+
+        l_warning (seat, "Display server failed %u times in a row, switching to fallback greeter %s", priv->greeter_failures, seat_get_string_property (seat, "fallback-greeter-session"));
+        priv->use_fallback_greeter = TRUE;
+        priv->greeter_failures = 0;
+        return seat_switch_to_greeter (seat);
+    }
+
+    /* Restart straight away the first time, then wait twice as long each time */
+    if (priv->greeter_failures == 1)
+        return seat_switch_to_greeter (seat);
+
+    priv->greeter_restart_delay = MIN (1u << MIN (priv->greeter_failures - 1, 8u), GREETER_RESTART_MAX_DELAY);
+    l_debug (seat, "Display server failed %u times in a row, restarting greeter in %u seconds", priv->greeter_failures, priv->greeter_restart_delay);
+    if (priv->greeter_restart_timeout)
+        g_source_remove (priv->greeter_restart_timeout);
+    priv->greeter_restart_timeout = g_timeout_add_seconds (priv->greeter_restart_delay, restart_greeter_cb, seat);
+
+    return TRUE;
+}
+
+guint
+seat_get_greeter_failures (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    g_return_val_if_fail (seat != NULL, 0);
+    return priv->greeter_failures;
+}
+
+guint
+seat_get_greeter_restart_delay (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    g_return_val_if_fail (seat != NULL, 0);
+    return priv->greeter_restart_delay;
+}
+
+/* Resources used by all the display servers, greeters and sessions this seat has run */
+void
+seat_get_usage (Seat *seat, ProcessUsage *usage)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    g_return_if_fail (seat != NULL);
+
+    *usage = priv->stopped_usage;
+    for (GList *link = priv->display_servers; link; link = link->next)
+    {
+        const ProcessUsage *display_server_usage = display_server_get_usage (DISPLAY_SERVER (link->data));
+        if (display_server_usage)
+            process_usage_add (usage, display_server_usage);
+    }
+    for (GList *link = priv->sessions; link; link = link->next)
+        process_usage_add (usage, session_get_usage (SESSION (link->data)));
+}
+
+/* Sessions are reaped by GLib, so keep recent figures for when they exit */
+static gboolean
+usage_sample_cb (gpointer data)
+{
+    Seat *seat = data;
+    ProcessUsage usage;
+    seat_get_usage (seat, &usage);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+handle_display_server_stopped (Seat *seat, DisplayServer *display_server, gboolean failed)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
 
     if (priv->stopping || !priv->started)
     {
         check_stopped (seat);
-        g_object_unref (display_server);
         return;
     }
 
@@ -503,13 +1092,44 @@ display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
         if (!active_session || session_get_display_server (active_session) == display_server)
         {
             l_debug (seat, "Active display server stopped, starting greeter");
-            if (!seat_switch_to_greeter (seat))
+            if (!(failed ? restart_greeter_after_failure (seat) : seat_switch_to_greeter (seat)))
             {
                 l_debug (seat, "Stopping; failed to start a greeter");
                 seat_stop (seat);
             }
         }
     }
+}
+
+static void
+display_stopped_script_cb (Seat *seat, gboolean success, GObject *object, gpointer data)
+{
+    handle_display_server_stopped (seat, DISPLAY_SERVER (object), GPOINTER_TO_INT (data));
+}
+
+static void
+display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    l_debug (seat, "Display server stopped");
+
+    /* Display servers we didn't stop have crashed or failed to start */
+    gboolean failed = !display_server_get_is_stopping (display_server);
+
+    g_signal_handlers_disconnect_matched (display_server, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
+    priv->display_servers = g_list_remove (priv->display_servers, display_server);
+
+    const ProcessUsage *usage = display_server_get_usage (display_server);
+    if (usage)
+        process_usage_add (&priv->stopped_usage, usage);
+
+    /* Run a script right after stopping the display server, then carry on */
+    const gchar *script = seat_get_string_property (seat, "display-stopped-script");
+    if (script)
+        run_script (seat, NULL, script, NULL, display_stopped_script_cb, display_server, GINT_TO_POINTER (failed));
+    else
+        handle_display_server_stopped (seat, display_server, failed);
 
     g_object_unref (display_server);
 }
@@ -552,15 +1172,82 @@ find_resettable_greeter (Seat *seat)
     return NULL;
 }
 
+/* Largest system file passed to greeters */
+#define MAX_SYSTEM_FILE_LENGTH 16384
+
+/* Contents of a system file shown by greeters, kept until the file changes */
+typedef struct
+{
+    gint64 mtime;
+    goffset size;
+    gchar *contents;
+} SystemFile;
+
+static void
+system_file_free (SystemFile *file)
+{
+    g_free (file->contents);
+    g_free (file);
+}
+
+static const gchar *
+get_system_file (const gchar *path)
+{
+    static GHashTable *files = NULL;
+    if (!files)
+        files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) system_file_free);
+
+    GStatBuf info;
+    if (g_stat (path, &info) < 0 || info.st_size > MAX_SYSTEM_FILE_LENGTH)
+    {
+        g_hash_table_remove (files, path);
+        return "";
+    }
+
+    SystemFile *file = g_hash_table_lookup (files, path);
+    if (file && file->mtime == info.st_mtime && file->size == info.st_size)
+        return file->contents;
+
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+    {
+        g_hash_table_remove (files, path);
+        return "";
+    }
+
+    file = g_new0 (SystemFile, 1);
+    file->mtime = info.st_mtime;
+    file->size = info.st_size;
+    file->contents = g_steal_pointer (&contents);
+    g_hash_table_insert (files, g_strdup (path), file);
+
+    return file->contents;
+}
+
+/* Give greeters the system information so they don't each read it */
+static void
+set_system_hints (Greeter *greeter)
+{
+    gchar hostname[HOST_NAME_MAX + 1];
+    if (gethostname (hostname, sizeof (hostname)) < 0)
+        return;
+    hostname[HOST_NAME_MAX] = '\0';
+
+    greeter_set_hint (greeter, "hostname", hostname);
+    greeter_set_hint (greeter, "os-release", get_system_file ("/etc/os-release"));
+    greeter_set_hint (greeter, "motd", get_system_file ("/etc/motd"));
+}
+
 static void
 set_greeter_hints (Seat *seat, Greeter *greeter)
 {
     greeter_clear_hints (greeter);
-    greeter_set_hint (greeter, "default-session", seat_get_string_property (seat, "user-session"));
-    greeter_set_hint (greeter, "hide-users", seat_get_boolean_property (seat, "greeter-hide-users") ? "true" : "false");
-    greeter_set_hint (greeter, "show-manual-login", seat_get_boolean_property (seat, "greeter-show-manual-login") ? "true" : "false");
-    greeter_set_hint (greeter, "show-remote-login", seat_get_boolean_property (seat, "greeter-show-remote-login") ? "true" : "false");
-    greeter_set_hint (greeter, "has-guest-account", seat_get_allow_guest (seat) && seat_get_boolean_property (seat, "greeter-allow-guest") ? "true" : "false");
+    set_system_hints (greeter);
+    greeter_set_hint (greeter, "default-session", get_config (seat)->user_session);
+    greeter_set_hint (greeter, "hide-users", get_config (seat)->greeter_hide_users ? "true" : "false");
+    greeter_set_hint (greeter, "show-manual-login", get_config (seat)->greeter_show_manual_login ? "true" : "false");
+    greeter_set_hint (greeter, "show-remote-login", get_config (seat)->greeter_show_remote_login ? "true" : "false");
+    greeter_set_hint (greeter, "has-guest-account", seat_get_allow_guest (seat) && get_config (seat)->greeter_allow_guest ? "true" : "false");
 }
 
 static void
@@ -598,12 +1285,14 @@ switch_to_greeter_from_failed_session (Seat *seat, Session *session)
         g_clear_object (&priv->session_to_activate);
         priv->session_to_activate = g_object_ref (SESSION (greeter_session));
 
-        if (can_share_display_server (seat, session_get_display_server (session)))
-            session_set_display_server (SESSION (greeter_session), session_get_display_server (session));
+        DisplayServer *session_display_server = session_get_display_server (session);
+        if (can_share_display_server (seat, session_display_server) &&
+            strcmp (display_server_get_session_type (session_display_server), session_get_session_type (SESSION (greeter_session))) == 0)
+            session_set_display_server (SESSION (greeter_session), session_display_server);
         else
         {
-            DisplayServer *display_server = create_display_server (seat, session);
-            session_set_display_server (session, display_server);
+            DisplayServer *display_server = create_display_server (seat, SESSION (greeter_session));
+            session_set_display_server (SESSION (greeter_session), display_server);
             if (!start_display_server (seat, display_server))
             {
                 l_debug (seat, "Failed to start display server for greeter");
@@ -611,7 +1300,12 @@ switch_to_greeter_from_failed_session (Seat *seat, Session *session)
             }
         }
 
-        start_session (seat, SESSION (greeter_session));
+        /* Authenticate the greeter while a display server starts, it runs when the display server is ready */
+        DisplayServer *greeter_display_server = session_get_display_server (SESSION (greeter_session));
+        if (display_server_get_is_ready (greeter_display_server))
+            start_session (seat, SESSION (greeter_session));
+        else if (display_server_get_has_address (greeter_display_server))
+            start_session_early (seat, SESSION (greeter_session));
     }
 
     /* Stop failed session */
@@ -646,30 +1340,29 @@ start_session (Seat *seat, Session *session)
 }
 
 static void
-run_session (Seat *seat, Session *session)
+run_session_after_setup (Seat *seat, Session *session)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    const gchar *script;
-    if (IS_GREETER_SESSION (session))
-        script = seat_get_string_property (seat, "greeter-setup-script");
-    else
-        script = seat_get_string_property (seat, "session-setup-script");
-    if (script && !run_script (seat, session_get_display_server (session), script, session_get_user (session)))
-    {
-        l_debug (seat, "Switching to greeter due to failed setup script");
-        switch_to_greeter_from_failed_session (seat, session);
-        return;
-    }
-
     if (!IS_GREETER_SESSION (session))
     {
         g_signal_emit (seat, signals[RUNNING_USER_SESSION], 0, session);
         emit_upstart_signal ("desktop-session-start");
+        schedule_standby_greeter (seat);
+        startup_profile_mark ("session-started");
+        service_notify_milestone (SERVICE_NOTIFY_GREETER_READY);
+    }
+    else
+    {
+        login_trace (LOGIN_TRACE_BEGIN, "greeter-connect", seat_get_name (seat), session_get_id (session));
+        startup_profile_mark ("greeter-started");
     }
 
     session_run (session);
 
+    /* Write the preferences chosen in the greeter now the session is on its way */
+    g_object_set_data (G_OBJECT (session), "held-user-settings", NULL);
+
     // FIXME: Wait until the session is ready
 
     if (session == priv->session_to_activate)
@@ -690,6 +1383,40 @@ run_session (Seat *seat, Session *session)
     }
 }
 
+static void
+session_setup_script_cb (Seat *seat, gboolean success, GObject *object, gpointer data)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    Session *session = SESSION (object);
+
+    /* Session went away while the script was running */
+    if (priv->stopping || session_get_is_stopping (session) || !g_list_find (priv->sessions, session))
+        return;
+
+    if (!success)
+    {
+        l_debug (seat, "Switching to greeter due to failed setup script");
+        switch_to_greeter_from_failed_session (seat, session);
+        return;
+    }
+
+    run_session_after_setup (seat, session);
+}
+
+static void
+run_session (Seat *seat, Session *session)
+{
+    const gchar *script;
+    if (IS_GREETER_SESSION (session))
+        script = seat_get_string_property (seat, "greeter-setup-script");
+    else
+        script = seat_get_string_property (seat, "session-setup-script");
+    if (script)
+        run_script (seat, session_get_display_server (session), script, session_get_user (session), session_setup_script_cb, session, NULL);
+    else
+        run_session_after_setup (seat, session);
+}
+
 static Session *
 find_user_session (Seat *seat, const gchar *username, Session *ignore_session)
 {
@@ -712,6 +1439,76 @@ find_user_session (Seat *seat, const gchar *username, Session *ignore_session)
     return NULL;
 }
 
+static const gchar *
+get_greeter_name (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (priv->use_fallback_greeter && seat_get_string_property (seat, "fallback-greeter-session"))
+        return seat_get_string_property (seat, "fallback-greeter-session");
+    return get_config (seat)->greeter_session;
+}
+
+static void
+greeter_connected_cb (Greeter *greeter, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *session = link->data;
+        if (IS_GREETER_SESSION (session) && greeter_session_get_greeter (GREETER_SESSION (session)) == greeter)
+        {
+            login_trace (LOGIN_TRACE_END, "greeter-connect", seat_get_name (seat), session_get_id (session));
+
+            /* The greeter has started, so remember what it needed to load for next boot */
+            if (get_greeter_name (seat))
+                readahead_record (get_greeter_name (seat), session_get_pid (session));
+        }
+    }
+    startup_profile_mark ("greeter-connected");
+    service_notify_milestone (SERVICE_NOTIFY_GREETER_READY);
+
+    g_signal_emit (seat, signals[GREETER_CONNECTED], 0);
+}
+
+static void
+greeter_unresponsive_cb (Greeter *greeter, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    Session *greeter_session = NULL;
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *session = link->data;
+        if (IS_GREETER_SESSION (session) && greeter_session_get_greeter (GREETER_SESSION (session)) == greeter)
+            greeter_session = session;
+    }
+    if (!greeter_session || session_get_is_stopping (greeter_session))
+        return;
+
+    /* Start again on a new display server unless something else is using this one */
+    DisplayServer *display_server = session_get_display_server (greeter_session);
+    gboolean shared = FALSE;
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *session = link->data;
+        if (session != greeter_session && display_server && session_get_display_server (session) == display_server)
+            shared = TRUE;
+    }
+
+    if (display_server && !shared && !display_server_get_is_stopping (display_server))
+    {
+        l_warning (seat, "Greeter is not responding, restarting display server");
+        display_server_stop (display_server);
+    }
+    else
+    {
+        l_warning (seat, "Greeter is not responding, stopping it");
+        session_stop (greeter_session);
+    }
+}
+
 static void
 greeter_active_username_changed_cb (Greeter *greeter, GParamSpec *pspec, Seat *seat)
 {
@@ -727,6 +1524,15 @@ greeter_active_username_changed_cb (Greeter *greeter, GParamSpec *pspec, Seat *s
 static void
 session_authentication_complete_cb (Session *session, Seat *seat)
 {
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (session_get_is_authenticated (session) && g_list_find (priv->early_sessions, session))
+    {
+        l_debug (seat, "Session authenticated, waiting for display server");
+        return;
+    }
+    priv->early_sessions = g_list_remove (priv->early_sessions, session);
+
     if (session_get_is_authenticated (session))
     {
         Session *s = find_user_session (seat, session_get_username (session), session);
@@ -754,6 +1560,66 @@ session_authentication_complete_cb (Session *session, Seat *seat)
     }
 }
 
+/* Stop the display server if no-longer required */
+static void
+stop_unused_display_server (Seat *seat, DisplayServer *display_server)
+{
+    if (display_server && !display_server_get_is_stopping (display_server) &&
+        !SEAT_GET_CLASS (seat)->display_server_is_used (seat, display_server))
+    {
+        l_debug (seat, "Stopping display server, no sessions require it");
+        display_server_stop (display_server);
+    }
+}
+
+static void
+session_cleanup_script_cb (Seat *seat, gboolean success, GObject *object, gpointer data)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!priv->stopping && object && g_list_find (priv->display_servers, object))
+        stop_unused_display_server (seat, DISPLAY_SERVER (object));
+}
+
+/* Reset the display server a user session was using and run the greeter on it instead of starting a new one */
+static gboolean
+recycle_display_server (Seat *seat, DisplayServer *display_server)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!display_server || display_server_get_is_stopping (display_server) ||
+        !seat_get_boolean_property (seat, "xserver-recycle"))
+        return FALSE;
+
+    /* Only do this when the display server would otherwise be replaced with a new greeter */
+    if (SEAT_GET_CLASS (seat)->display_server_is_used (seat, display_server) || find_greeter_session (seat))
+        return FALSE;
+    Session *active_session = seat_get_active_session (seat);
+    if (active_session && session_get_display_server (active_session) != display_server)
+        return FALSE;
+
+    if (!display_server_reset (display_server))
+        return FALSE;
+
+    login_trace (LOGIN_TRACE_BEGIN, "display-server", seat_get_name (seat), 0);
+
+    GreeterSession *greeter_session = create_greeter_session (seat);
+    if (!greeter_session || strcmp (display_server_get_session_type (display_server), session_get_session_type (SESSION (greeter_session))) != 0)
+    {
+        /* Leave it to the display server stopping to start a greeter */
+        if (greeter_session)
+            session_stop (SESSION (greeter_session));
+        display_server_stop (display_server);
+        return TRUE;
+    }
+
+    g_clear_object (&priv->session_to_activate);
+    priv->session_to_activate = g_object_ref (SESSION (greeter_session));
+    session_set_display_server (SESSION (greeter_session), display_server);
+
+    return TRUE;
+}
+
 static void
 session_stopped_cb (Session *session, Seat *seat)
 {
@@ -763,21 +1629,31 @@ session_stopped_cb (Session *session, Seat *seat)
 
     g_signal_handlers_disconnect_matched (session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
     priv->sessions = g_list_remove (priv->sessions, session);
+    priv->early_sessions = g_list_remove (priv->early_sessions, session);
+    process_usage_add (&priv->stopped_usage, session_get_usage (session));
     if (session == priv->active_session)
         g_clear_object (&priv->active_session);
     if (session == priv->next_session)
         g_clear_object (&priv->next_session);
     if (session == priv->session_to_activate)
         g_clear_object (&priv->session_to_activate);
+    if (priv->greeter_to_freeze && SESSION (priv->greeter_to_freeze) == session)
+        cancel_freeze_greeter (seat);
 
     DisplayServer *display_server = session_get_display_server (session);
 
-    /* Cleanup */
+    /* Cleanup, the display server is kept until the script is done with it */
+    gboolean running_cleanup = FALSE;
     if (!IS_GREETER_SESSION (session))
     {
         const gchar *script = seat_get_string_property (seat, "session-cleanup-script");
-        if (script)
-            run_script (seat, display_server, script, session_get_user (session));
+        if (script && seat_get_boolean_property (seat, "session-cleanup-script-background"))
+            run_script_in_background (seat, display_server, script, session_get_user (session));
+        else if (script)
+        {
+            run_script (seat, display_server, script, session_get_user (session), session_cleanup_script_cb, display_server, NULL);
+            running_cleanup = TRUE;
+        }
     }
 
     /* We were waiting for this session, but it didn't start :( */
@@ -846,6 +1722,9 @@ session_stopped_cb (Session *session, Seat *seat)
         l_debug (seat, "Stopping; failed to start a greeter");
         seat_stop (seat);
     }
+    /* Run the greeter on the display server this session was using */
+    else if (!IS_GREETER_SESSION (session) && !running_cleanup && recycle_display_server (seat, display_server))
+        l_debug (seat, "Active session stopped, resetting display server for greeter");
     /* If we were the active session, switch to a greeter */
     else if (!IS_GREETER_SESSION (session) && session == seat_get_active_session (seat))
     {
@@ -857,16 +1736,15 @@ session_stopped_cb (Session *session, Seat *seat)
         }
     }
 
+    /* Replace the greeter that has been used */
+    if (IS_GREETER_SESSION (session))
+        schedule_standby_greeter (seat);
+
     g_signal_emit (seat, signals[SESSION_REMOVED], 0, session);
     g_object_unref (session);
 
-    /* Stop the display server if no-longer required */
-    if (display_server && !display_server_get_is_stopping (display_server) &&
-        !SEAT_GET_CLASS (seat)->display_server_is_used (seat, display_server))
-    {
-        l_debug (seat, "Stopping display server, no sessions require it");
-        display_server_stop (display_server);
-    }
+    if (!running_cleanup)
+        stop_unused_display_server (seat, display_server);
 }
 
 static void
@@ -901,6 +1779,8 @@ create_session (Seat *seat, gboolean autostart)
     SeatPrivate *priv = seat_get_instance_private (seat);
 
     Session *session = SEAT_GET_CLASS (seat)->create_session (seat);
+    session_set_seat_name (session, seat_get_name (seat));
+    session_set_child_pool (session, priv->child_pool);
     priv->sessions = g_list_append (priv->sessions, session);
     if (autostart)
         g_signal_connect (session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (session_authentication_complete_cb), seat);
@@ -952,17 +1832,10 @@ find_session_config (Seat *seat, const gchar *sessions_dir, const gchar *session
     g_return_val_if_fail (sessions_dir != NULL, NULL);
     g_return_val_if_fail (session_name != NULL, NULL);
 
-    g_auto(GStrv) dirs = g_strsplit (sessions_dir, ":", -1);
-    for (int i = 0; dirs[i]; i++)
+    CommonSessionFile *session_file = common_session_index_lookup (sessions_dir, session_name);
+    if (session_file)
     {
-        const gchar *default_session_type = "x";
-        if (dirs[i] != NULL && g_str_has_suffix (dirs[i], "/wayland-sessions") == TRUE)
-            default_session_type = "wayland";
-
-        g_autofree gchar *filename = g_strdup_printf ("%s.desktop", session_name);
-        g_autofree gchar *path = g_build_filename (dirs[i], filename, NULL);
-        g_autoptr(GError) error = NULL;
-        SessionConfig *session_config = session_config_new_from_file (path, default_session_type, &error);
+        SessionConfig *session_config = session_config_new_from_key_file (session_file->key_file, session_file->path, session_file->session_type, NULL);
         if (session_config)
             return session_config;
     }
@@ -972,6 +1845,13 @@ find_session_config (Seat *seat, const gchar *sessions_dir, const gchar *session
     return NULL;
 }
 
+static void
+release_user_settings (User *user)
+{
+    user_release_settings (user);
+    g_object_unref (user);
+}
+
 static void
 configure_session (Session *session, SessionConfig *config, const gchar *session_name, const gchar *language)
 {
@@ -1010,13 +1890,13 @@ create_user_session (Seat *seat, const gchar *username, gboolean autostart)
     /* Override session for autologin if configured */
     if (autostart)
     {
-        const gchar *autologin_session_name = seat_get_string_property (seat, "autologin-session");
+        const gchar *autologin_session_name = get_config (seat)->autologin_session;
         if (autologin_session_name)
             session_name = autologin_session_name;
     }
 
     if (!session_name)
-        session_name = seat_get_string_property (seat, "user-session");
+        session_name = get_config (seat)->user_session;
     g_autofree gchar *sessions_dir = config_get_string (config_get_instance (), "LightDM", "sessions-directory");
     g_autoptr(SessionConfig) session_config = find_session_config (seat, sessions_dir, session_name);
     if (!session_config)
@@ -1029,7 +1909,7 @@ create_user_session (Seat *seat, const gchar *username, gboolean autostart)
     configure_session (session, session_config, session_name, language);
     session_set_username (session, username);
     session_set_do_authenticate (session, TRUE);
-    g_auto(GStrv) argv = get_session_argv (seat, session_config, seat_get_string_property (seat, "session-wrapper"));
+    g_auto(GStrv) argv = get_session_argv (seat, session_config, get_config (seat)->session_wrapper);
     session_set_argv (session, argv);
 
     return g_steal_pointer (&session);
@@ -1054,9 +1934,9 @@ static Session *
 create_guest_session (Seat *seat, const gchar *session_name)
 {
     if (!session_name)
-        session_name = seat_get_string_property (seat, "guest-session");
+        session_name = get_config (seat)->guest_session;
     if (!session_name)
-        session_name = seat_get_string_property (seat, "user-session");
+        session_name = get_config (seat)->user_session;
     g_autofree gchar *sessions_dir = config_get_string (config_get_instance (), "LightDM", "sessions-directory");
     g_autoptr(SessionConfig) session_config = find_session_config (seat, sessions_dir, session_name);
     if (!session_config)
@@ -1069,8 +1949,8 @@ create_guest_session (Seat *seat, const gchar *session_name)
     configure_session (session, session_config, session_name, NULL);
     session_set_do_authenticate (session, TRUE);
     session_set_is_guest (session, TRUE);
-    g_auto(GStrv) argv = get_session_argv (seat, session_config, seat_get_string_property (seat, "session-wrapper"));
-    const gchar *guest_wrapper = seat_get_string_property (seat, "guest-wrapper");
+    g_auto(GStrv) argv = get_session_argv (seat, session_config, get_config (seat)->session_wrapper);
+    const gchar *guest_wrapper = get_config (seat)->guest_wrapper;
     if (guest_wrapper)
     {
         g_autofree gchar *path = g_find_program_in_path (guest_wrapper);
@@ -1125,7 +2005,7 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
         session = g_object_ref (create_guest_session (seat, session_name));
         if (!session)
             return FALSE;
-        session_set_pam_service (session, seat_get_string_property (seat, "pam-autologin-service"));
+        session_set_pam_service (session, get_config (seat)->pam_autologin_service);
     }
     else
     {
@@ -1151,9 +2031,9 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
             const gchar *autologin_username;
 
             /* Override session for autologin if configured */
-            autologin_username = seat_get_string_property (seat, "autologin-user");
+            autologin_username = get_config (seat)->autologin_user;
             if (!session_name && g_strcmp0 (user_get_name (user), autologin_username) == 0)
-                session_name = seat_get_string_property (seat, "autologin-session");
+                session_name = get_config (seat)->autologin_session;
 
             if (!session_name)
                 session_name = user_get_xsession (user);
@@ -1161,9 +2041,15 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
         }
 
         if (!session_name)
-            session_name = seat_get_string_property (seat, "user-session");
+            session_name = get_config (seat)->user_session;
         if (user)
-            user_set_xsession (session_get_user (session), session_name);
+        {
+            /* Save the choices once the session is running, writing them to
+             * the home directory shouldn't hold up starting it */
+            user_hold_settings (user);
+            g_object_set_data_full (G_OBJECT (session), "held-user-settings", g_object_ref (user), (GDestroyNotify) release_user_settings);
+            user_set_xsession (user, session_name);
+        }
 
         g_autoptr(SessionConfig) session_config = find_session_config (seat, sessions_dir, session_name);
         if (!session_config)
@@ -1173,7 +2059,7 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
         }
 
         configure_session (session, session_config, session_name, language);
-        g_auto(GStrv) argv = get_session_argv (seat, session_config, seat_get_string_property (seat, "session-wrapper"));
+        g_auto(GStrv) argv = get_session_argv (seat, session_config, get_config (seat)->session_wrapper);
         session_set_argv (session, argv);
     }
 
@@ -1235,12 +2121,16 @@ create_greeter_session (Seat *seat)
     l_debug (seat, "Creating greeter session");
 
     g_autofree gchar *sessions_dir = config_get_string (config_get_instance (), "LightDM", "greeters-directory");
-    g_autoptr(SessionConfig) session_config = find_session_config (seat, sessions_dir, seat_get_string_property (seat, "greeter-session"));
+    const gchar *greeter_name = get_greeter_name (seat);
+    g_autoptr(SessionConfig) session_config = find_session_config (seat, sessions_dir, greeter_name);
     if (!session_config)
         return NULL;
 
+    /* Warm the page cache with the greeter's files while the display server starts */
+    readahead_replay (greeter_name);
+
     g_auto(GStrv) argv = get_session_argv (seat, session_config, NULL);
-    const gchar *greeter_wrapper = seat_get_string_property (seat, "greeter-wrapper");
+    const gchar *greeter_wrapper = get_config (seat)->greeter_wrapper;
     if (greeter_wrapper)
     {
         g_autofree gchar *path = g_find_program_in_path (greeter_wrapper);
@@ -1249,16 +2139,33 @@ create_greeter_session (Seat *seat)
 
     GreeterSession *greeter_session = SEAT_GET_CLASS (seat)->create_greeter_session (seat);
     Greeter *greeter = greeter_session_get_greeter (greeter_session);
+    session_set_seat_name (SESSION (greeter_session), seat_get_name (seat));
     session_set_config (SESSION (greeter_session), session_config);
+    session_set_child_pool (SESSION (greeter_session), priv->child_pool);
+    session_set_resource_control (SESSION (greeter_session), get_config (seat)->resource_control);
     priv->sessions = g_list_append (priv->sessions, SESSION (greeter_session));
+    g_signal_connect (greeter, GREETER_SIGNAL_CONNECTED, G_CALLBACK (greeter_connected_cb), seat);
     g_signal_connect (greeter, GREETER_SIGNAL_ACTIVE_USERNAME_CHANGED, G_CALLBACK (greeter_active_username_changed_cb), seat);
+    g_signal_connect (greeter, GREETER_SIGNAL_UNRESPONSIVE, G_CALLBACK (greeter_unresponsive_cb), seat);
+    greeter_set_ping (greeter,
+                      MAX (seat_get_integer_property (seat, "greeter-ping-interval"), 0),
+                      MAX (seat_get_integer_property (seat, "greeter-ping-limit"), 1),
+                      seat_get_name (seat));
     g_signal_connect (greeter_session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (session_authentication_complete_cb), seat);
     g_signal_connect (greeter_session, SESSION_SIGNAL_STOPPED, G_CALLBACK (session_stopped_cb), seat);
 
     set_session_env (SESSION (greeter_session));
     session_set_env (SESSION (greeter_session), "XDG_SESSION_CLASS", "greeter");
-
-    session_set_pam_service (SESSION (greeter_session), seat_get_string_property (seat, "pam-greeter-service"));
+    g_autofree gchar *user_list_snapshot = shared_data_manager_get_user_list_snapshot_path (shared_data_manager_get_instance ());
+    session_set_env (SESSION (greeter_session), "LIGHTDM_USER_LIST_SNAPSHOT", user_list_snapshot);
+    g_autofree gchar *locale_names = shared_data_manager_get_locale_names_path (shared_data_manager_get_instance ());
+    session_set_env (SESSION (greeter_session), "LIGHTDM_LOCALE_NAMES", locale_names);
+    g_autofree gchar *sessions_snapshot = shared_data_manager_get_sessions_snapshot_path (shared_data_manager_get_instance ());
+    session_set_env (SESSION (greeter_session), "LIGHTDM_SESSIONS_SNAPSHOT", sessions_snapshot);
+    g_autofree gchar *image_cache = shared_data_manager_get_image_cache_path (shared_data_manager_get_instance ());
+    session_set_env (SESSION (greeter_session), "LIGHTDM_IMAGE_CACHE", image_cache);
+
+    session_set_pam_service (SESSION (greeter_session), get_config (seat)->pam_greeter_service);
     if (getuid () == 0)
     {
         g_autofree gchar *greeter_user = config_get_string (config_get_instance (), "LightDM", "greeter-user");
@@ -1270,10 +2177,11 @@ create_greeter_session (Seat *seat)
         session_set_username (SESSION (greeter_session), user_get_name (accounts_get_current_user ()));
     }
     session_set_argv (SESSION (greeter_session), argv);
+    greeter_session_set_shared (greeter_session, seat_get_boolean_property (seat, "greeter-shared"));
 
     greeter_set_pam_services (greeter,
-                              seat_get_string_property (seat, "pam-service"),
-                              seat_get_string_property (seat, "pam-autologin-service"));
+                              get_config (seat)->pam_service,
+                              get_config (seat)->pam_autologin_service);
     g_signal_connect (greeter, GREETER_SIGNAL_CREATE_SESSION, G_CALLBACK (greeter_create_session_cb), seat);
     g_signal_connect (greeter, GREETER_SIGNAL_START_SESSION, G_CALLBACK (greeter_start_session_cb), seat);
 
@@ -1282,14 +2190,14 @@ create_greeter_session (Seat *seat)
     set_greeter_hints (seat, greeter);
 
     /* Configure for automatic login */
-    const gchar *autologin_username = seat_get_string_property (seat, "autologin-user");
+    const gchar *autologin_username = get_config (seat)->autologin_user;
     if (g_strcmp0 (autologin_username, "") == 0)
         autologin_username = NULL;
-    const gchar *autologin_session = seat_get_string_property (seat, "autologin-session");
+    const gchar *autologin_session = get_config (seat)->autologin_session;
     if (g_strcmp0 (autologin_session, "") == 0)
         autologin_session = NULL;
-    int autologin_timeout = seat_get_integer_property (seat, "autologin-user-timeout");
-    gboolean autologin_guest = seat_get_boolean_property (seat, "autologin-guest");
+    int autologin_timeout = get_config (seat)->autologin_user_timeout;
+    gboolean autologin_guest = get_config (seat)->autologin_guest;
     if (autologin_timeout > 0)
     {
         g_autofree gchar *value = g_strdup_printf ("%d", autologin_timeout);
@@ -1324,22 +2232,26 @@ find_session_for_display_server (Seat *seat, DisplayServer *display_server)
 }
 
 static void
-display_server_ready_cb (DisplayServer *display_server, Seat *seat)
+display_server_setup_complete (Seat *seat, DisplayServer *display_server)
 {
-    /* Run setup script */
-    const gchar *script = seat_get_string_property (seat, "display-setup-script");
-    if (script && !run_script (seat, display_server, script, NULL))
-    {
-        l_debug (seat, "Stopping display server due to failed setup script");
-        display_server_stop (display_server);
-        return;
-    }
+    SeatPrivate *priv = seat_get_instance_private (seat);
 
     emit_upstart_signal ("login-session-start");
 
     /* Start the session waiting for this display server */
     Session *session = find_session_for_display_server (seat, display_server);
-    if (session)
+    if (session && g_list_find (priv->early_sessions, session))
+    {
+        priv->early_sessions = g_list_remove (priv->early_sessions, session);
+        if (session_get_is_authenticated (session))
+        {
+            l_debug (seat, "Display server ready, running authenticated session");
+            run_session (seat, session);
+        }
+        else
+            l_debug (seat, "Display server ready, waiting for session authentication");
+    }
+    else if (session)
     {
         if (session_get_is_authenticated (session))
         {
@@ -1359,6 +2271,51 @@ display_server_ready_cb (DisplayServer *display_server, Seat *seat)
     }
 }
 
+static void
+display_setup_script_cb (Seat *seat, gboolean success, GObject *object, gpointer data)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    DisplayServer *display_server = DISPLAY_SERVER (object);
+
+    /* Display server went away while the script was running */
+    if (priv->stopping || display_server_get_is_stopping (display_server) || !g_list_find (priv->display_servers, display_server))
+        return;
+
+    if (!success)
+    {
+        l_debug (seat, "Stopping display server due to failed setup script");
+        display_server_stop (display_server);
+        return;
+    }
+
+    display_server_setup_complete (seat, display_server);
+}
+
+static void
+display_server_ready_cb (DisplayServer *display_server, Seat *seat)
+{
+    login_trace (LOGIN_TRACE_END, "display-server", seat_get_name (seat), 0);
+    startup_profile_mark ("display-server-ready");
+
+    /* Run setup script */
+    const gchar *script = seat_get_string_property (seat, "display-setup-script");
+    if (script)
+        run_script (seat, display_server, script, NULL, display_setup_script_cb, display_server, NULL);
+    else
+        display_server_setup_complete (seat, display_server);
+}
+
+static void
+add_display_server (Seat *seat, DisplayServer *display_server)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->display_servers = g_list_append (priv->display_servers, display_server);
+    display_server_set_resource_control (display_server, get_config (seat)->resource_control);
+    g_signal_connect (display_server, DISPLAY_SERVER_SIGNAL_READY, G_CALLBACK (display_server_ready_cb), seat);
+    g_signal_connect (display_server, DISPLAY_SERVER_SIGNAL_STOPPED, G_CALLBACK (display_server_stopped_cb), seat);
+}
+
 static DisplayServer *
 create_display_server (Seat *seat, Session *session)
 {
@@ -1372,18 +2329,26 @@ create_display_server (Seat *seat, Session *session)
 
     /* Remember this display server */
     if (!g_list_find (priv->display_servers, display_server))
-    {
-        priv->display_servers = g_list_append (priv->display_servers, display_server);
-        g_signal_connect (display_server, DISPLAY_SERVER_SIGNAL_READY, G_CALLBACK (display_server_ready_cb), seat);
-        g_signal_connect (display_server, DISPLAY_SERVER_SIGNAL_STOPPED, G_CALLBACK (display_server_stopped_cb), seat);
-    }
+        add_display_server (seat, display_server);
 
     return display_server;
 }
 
+/* Start authentication without waiting for the display server, the session is run once both are done */
+static void
+start_session_early (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    l_debug (seat, "Starting session authentication while display server starts");
+    priv->early_sessions = g_list_append (priv->early_sessions, session);
+    start_session (seat, session);
+}
+
 static gboolean
 start_display_server (Seat *seat, DisplayServer *display_server)
 {
+    login_trace (LOGIN_TRACE_BEGIN, "display-server", seat_get_name (seat), 0);
     if (display_server_get_is_ready (display_server))
     {
         display_server_ready_cb (display_server, seat);
@@ -1393,6 +2358,67 @@ start_display_server (Seat *seat, DisplayServer *display_server)
         return display_server_start (display_server);
 }
 
+/* Start the display server for a session, authenticating the session while the display server starts */
+static gboolean
+start_display_server_for_session (Seat *seat, DisplayServer *display_server, Session *session)
+{
+    if (!start_display_server (seat, display_server))
+        return FALSE;
+
+    /* Nothing before running the session needs the display server, so overlap the two */
+    if (seat_get_boolean_property (seat, "early-authentication") &&
+        !display_server_get_is_ready (display_server) &&
+        display_server_get_has_address (display_server) &&
+        !session_get_is_started (session) &&
+        !session_get_is_authenticated (session))
+        start_session_early (seat, session);
+
+    return TRUE;
+}
+
+static gboolean
+standby_greeter_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->standby_greeter_timeout = 0;
+
+    if (priv->stopping || find_greeter_session (seat))
+        return G_SOURCE_REMOVE;
+
+    l_debug (seat, "Starting standby greeter");
+
+    GreeterSession *greeter_session = create_greeter_session (seat);
+    if (!greeter_session)
+        return G_SOURCE_REMOVE;
+
+    DisplayServer *display_server = create_display_server (seat, SESSION (greeter_session));
+    if (!display_server)
+    {
+        session_stop (SESSION (greeter_session));
+        return G_SOURCE_REMOVE;
+    }
+    session_set_display_server (SESSION (greeter_session), display_server);
+    if (!start_display_server_for_session (seat, display_server, SESSION (greeter_session)))
+        l_warning (seat, "Failed to start display server for standby greeter");
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Keep a greeter running in the background so switching to it only needs a VT change */
+static void
+schedule_standby_greeter (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (priv->stopping || priv->standby_greeter_timeout != 0 ||
+        !get_config (seat)->standby_greeter || !seat_get_can_switch (seat))
+        return;
+
+    priv->standby_greeter_timeout = g_timeout_add_seconds (STANDBY_GREETER_DELAY, standby_greeter_cb, seat);
+}
+
 gboolean
 seat_switch_to_greeter (Seat *seat)
 {
@@ -1408,6 +2434,16 @@ seat_switch_to_greeter (Seat *seat)
     if (greeter_session)
     {
         l_debug (seat, "Switching to existing greeter");
+
+        /* A pooled greeter left over from an earlier login starts again from the beginning */
+        Greeter *greeter = greeter_session_get_greeter (greeter_session);
+        if (get_config (seat)->freeze_idle_greeter && greeter_get_resettable (greeter) &&
+            SESSION (greeter_session) != priv->active_session)
+        {
+            set_greeter_hints (seat, greeter);
+            greeter_reset (greeter);
+        }
+
         seat_set_active_session (seat, SESSION (greeter_session));
         return TRUE;
     }
@@ -1426,7 +2462,7 @@ seat_switch_to_greeter (Seat *seat)
     }
     session_set_display_server (SESSION (greeter_session), display_server);
 
-    return start_display_server (seat, display_server);
+    return start_display_server_for_session (seat, display_server, SESSION (greeter_session));
 }
 
 static void
@@ -1462,13 +2498,23 @@ switch_authentication_complete_cb (Session *session, Seat *seat)
 
     /* See if we already have a greeter up and reuse it if so */
     GreeterSession *greeter_session = find_resettable_greeter (seat);
-    gboolean existing = FALSE;
+    gboolean existing = FALSE, running = FALSE;
     if (greeter_session)
     {
         l_debug (seat, "Switching to existing greeter to authenticate session");
         set_greeter_hints (seat, greeter_session_get_greeter (greeter_session));
         existing = TRUE;
     }
+    /* Let the greeter being shown select the user rather than starting another greeter */
+    else if (priv->active_session && IS_GREETER_SESSION (priv->active_session) &&
+             !session_get_is_stopping (priv->active_session) &&
+             greeter_get_accepts_hint_changes (greeter_session_get_greeter (GREETER_SESSION (priv->active_session))))
+    {
+        l_debug (seat, "Using running greeter to authenticate session");
+        greeter_session = GREETER_SESSION (priv->active_session);
+        set_greeter_hints (seat, greeter_session_get_greeter (greeter_session));
+        running = TRUE;
+    }
     else
     {
         l_debug (seat, "Starting greeter to authenticate session");
@@ -1486,14 +2532,14 @@ switch_authentication_complete_cb (Session *session, Seat *seat)
         greeter_reset (greeter);
         seat_set_active_session (seat, SESSION (greeter_session));
     }
-    else
+    else if (!running)
     {
         g_clear_object (&priv->session_to_activate);
         priv->session_to_activate = g_object_ref (SESSION (greeter_session));
 
         DisplayServer *display_server = create_display_server (seat, SESSION (greeter_session));
         session_set_display_server (SESSION (greeter_session), display_server);
-        start_display_server (seat, display_server);
+        start_display_server_for_session (seat, display_server, SESSION (greeter_session));
     }
 }
 
@@ -1518,7 +2564,7 @@ seat_switch_to_user (Seat *seat, const gchar *username, const gchar *session_nam
     /* Attempt to authenticate them */
     session = create_user_session (seat, username, FALSE);
     g_signal_connect (session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (switch_authentication_complete_cb), seat);
-    session_set_pam_service (session, seat_get_string_property (seat, "pam-service"));
+    session_set_pam_service (session, get_config (seat)->pam_service);
 
     return session_start (session);
 }
@@ -1565,10 +2611,10 @@ seat_switch_to_guest (Seat *seat, const gchar *session_name)
 
     g_clear_object (&priv->session_to_activate);
     priv->session_to_activate = g_object_ref (session);
-    session_set_pam_service (session, seat_get_string_property (seat, "pam-autologin-service"));
+    session_set_pam_service (session, get_config (seat)->pam_autologin_service);
     session_set_display_server (session, display_server);
 
-    return start_display_server (seat, display_server);
+    return start_display_server_for_session (seat, display_server, session);
 }
 
 gboolean
@@ -1643,7 +2689,7 @@ seat_lock (Seat *seat, const gchar *username)
             return TRUE;
         }
         else
-            return start_display_server (seat, display_server);
+            return start_display_server_for_session (seat, display_server, SESSION (greeter_session));
     }
 }
 
@@ -1659,9 +2705,38 @@ seat_stop (Seat *seat)
 
     l_debug (seat, "Stopping");
     priv->stopping = TRUE;
+    if (priv->standby_greeter_timeout)
+    {
+        g_source_remove (priv->standby_greeter_timeout);
+        priv->standby_greeter_timeout = 0;
+    }
+    cancel_freeze_greeter (seat);
+    cancel_greeter_idle_check (seat);
+    if (priv->usage_sample_timeout)
+    {
+        g_source_remove (priv->usage_sample_timeout);
+        priv->usage_sample_timeout = 0;
+    }
+    if (priv->greeter_restart_timeout)
+    {
+        g_source_remove (priv->greeter_restart_timeout);
+        priv->greeter_restart_timeout = 0;
+        priv->greeter_restart_delay = 0;
+    }
     SEAT_GET_CLASS (seat)->stop (seat);
 }
 
+void
+seat_kill (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    g_return_if_fail (seat != NULL);
+
+    for (GList *link = priv->sessions; link; link = link->next)
+        session_kill (SESSION (link->data));
+}
+
 gboolean
 seat_get_is_stopping (Seat *seat)
 {
@@ -1675,22 +2750,76 @@ seat_real_setup (Seat *seat)
 {
 }
 
+/* Take over the sessions that were running on this seat before the daemon restarted */
+static void
+adopt_sessions (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    GList *kept_sessions = handoff_take_sessions (seat_get_name (seat));
+    for (GList *link = kept_sessions; link; link = link->next)
+    {
+        HandoffSession *kept = link->data;
+
+        DisplayServer *display_server = SEAT_GET_CLASS (seat)->adopt_display_server (seat, kept);
+        if (!display_server)
+        {
+            l_warning (seat, "Can't take over display server for session from before restart");
+            handoff_session_abandon (kept);
+            continue;
+        }
+        add_display_server (seat, display_server);
+
+        l_debug (seat, "Taking over session for %s from before restart", kept->username);
+
+        Session *session = create_session (seat, FALSE);
+        g_autoptr(SessionConfig) config = session_config_new_for_session_type (kept->session_type);
+        session_set_config (session, config);
+        session_set_display_server (session, display_server);
+
+        /* Keep the D-Bus path the session already has in its environment */
+        if (kept->bus_path)
+            session_set_env (session, "XDG_SESSION_PATH", kept->bus_path);
+
+        session_adopt (session, kept->session_pid, kept->to_child_input, kept->from_child_output,
+                       kept->username, kept->login1_session_id, kept->console_kit_cookie);
+
+        /* Still on screen, so nothing to switch */
+        if (kept->is_active)
+        {
+            g_clear_object (&priv->active_session);
+            priv->active_session = g_object_ref (session);
+        }
+
+        g_signal_emit (seat, signals[RUNNING_USER_SESSION], 0, session);
+
+        handoff_session_free (kept);
+    }
+    g_list_free (kept_sessions);
+}
+
 static gboolean
 seat_real_start (Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
+    /* Carry on with the sessions from before a restart instead of logging in again */
+    adopt_sessions (seat);
+    if (priv->active_session)
+        return TRUE;
+    gboolean have_kept_sessions = priv->sessions != NULL;
+
     /* Get autologin settings */
-    const gchar *autologin_username = seat_get_string_property (seat, "autologin-user");
+    const gchar *autologin_username = get_config (seat)->autologin_user;
     if (g_strcmp0 (autologin_username, "") == 0)
         autologin_username = NULL;
-    int autologin_timeout = seat_get_integer_property (seat, "autologin-user-timeout");
-    gboolean autologin_guest = seat_get_boolean_property (seat, "autologin-guest");
-    gboolean autologin_in_background = seat_get_boolean_property (seat, "autologin-in-background");
+    int autologin_timeout = get_config (seat)->autologin_user_timeout;
+    gboolean autologin_guest = get_config (seat)->autologin_guest;
+    gboolean autologin_in_background = get_config (seat)->autologin_in_background;
 
     /* Autologin if configured */
     Session *session = NULL, *background_session = NULL;
-    if (autologin_timeout == 0 || autologin_in_background)
+    if (!have_kept_sessions && (autologin_timeout == 0 || autologin_in_background))
     {
         if (autologin_guest)
             session = create_guest_session (seat, NULL);
@@ -1698,7 +2827,7 @@ seat_real_start (Seat *seat)
             session = create_user_session (seat, autologin_username, TRUE);
 
         if (session)
-            session_set_pam_service (session, seat_get_string_property (seat, "pam-autologin-service"));
+            session_set_pam_service (session, get_config (seat)->pam_autologin_service);
 
         /* Load in background if required */
         if (autologin_in_background && session)
@@ -1714,7 +2843,7 @@ seat_real_start (Seat *seat)
 
             DisplayServer *display_server = create_display_server (seat, session);
             session_set_display_server (session, display_server);
-            if (!display_server || !start_display_server (seat, display_server))
+            if (!display_server || !start_display_server_for_session (seat, display_server, session))
             {
                 l_debug (seat, "Can't create display server for automatic login");
                 session_stop (session);
@@ -1741,7 +2870,7 @@ seat_real_start (Seat *seat)
 
         DisplayServer *display_server = create_display_server (seat, session);
         session_set_display_server (session, display_server);
-        if (!display_server || !start_display_server (seat, display_server))
+        if (!display_server || !start_display_server_for_session (seat, display_server, session))
         {
             l_debug (seat, "Can't create display server for greeter");
             session_stop (session);
@@ -1763,7 +2892,7 @@ seat_real_start (Seat *seat)
     {
         DisplayServer *background_display_server = create_display_server (seat, background_session);
         session_set_display_server (background_session, background_display_server);
-        if (!start_display_server (seat, background_display_server))
+        if (!start_display_server_for_session (seat, background_display_server, background_session))
             l_warning (seat, "Failed to start display server for background session");
     }
 
@@ -1776,6 +2905,12 @@ seat_real_create_display_server (Seat *seat, Session *session)
     return NULL;
 }
 
+static DisplayServer *
+seat_real_adopt_display_server (Seat *seat, HandoffSession *session)
+{
+    return NULL;
+}
+
 static gboolean
 seat_real_display_server_is_used (Seat *seat, DisplayServer *display_server)
 {
@@ -1814,8 +2949,8 @@ create_greeter_cb (Session *session, Seat *seat)
     g_autoptr(Greeter) greeter = greeter_new ();
 
     greeter_set_pam_services (greeter,
-                              seat_get_string_property (seat, "pam-service"),
-                              seat_get_string_property (seat, "pam-autologin-service"));
+                              get_config (seat)->pam_service,
+                              get_config (seat)->pam_autologin_service);
     g_signal_connect (greeter, GREETER_SIGNAL_CREATE_SESSION, G_CALLBACK (create_session_cb), seat);
     g_signal_connect (greeter, GREETER_SIGNAL_START_SESSION, G_CALLBACK (greeter_start_session_cb), seat);
 
@@ -1897,6 +3032,7 @@ seat_init (Seat *seat)
 
     priv->properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
     priv->share_display_server = TRUE;
+    priv->script_queue = g_queue_new ();
 }
 
 static void
@@ -1919,10 +3055,31 @@ seat_finalize (GObject *object)
         g_signal_handlers_disconnect_matched (session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     }
     g_list_free_full (priv->sessions, g_object_unref);
+    g_list_free (priv->early_sessions);
     g_clear_object (&priv->active_session);
     g_clear_object (&priv->next_session);
     g_clear_object (&priv->session_to_activate);
     g_clear_object (&priv->replacement_greeter);
+    g_clear_object (&priv->child_pool);
+    g_clear_object (&priv->config.resource_control);
+    if (priv->standby_greeter_timeout)
+        g_source_remove (priv->standby_greeter_timeout);
+    if (priv->freeze_greeter_timeout)
+        g_source_remove (priv->freeze_greeter_timeout);
+    g_clear_object (&priv->greeter_to_freeze);
+    if (priv->greeter_idle_timeout)
+        g_source_remove (priv->greeter_idle_timeout);
+    if (priv->greeter_restart_timeout)
+        g_source_remove (priv->greeter_restart_timeout);
+    if (priv->script_failed_idle)
+        g_source_remove (priv->script_failed_idle);
+    if (priv->script_timeout)
+        g_source_remove (priv->script_timeout);
+    if (priv->usage_sample_timeout)
+        g_source_remove (priv->usage_sample_timeout);
+    if (priv->running_script)
+        script_request_free (priv->running_script);
+    g_queue_free_full (priv->script_queue, (GDestroyNotify) script_request_free);
 
     G_OBJECT_CLASS (seat_parent_class)->finalize (object);
 }
@@ -1935,6 +3092,7 @@ seat_class_init (SeatClass *klass)
     klass->setup = seat_real_setup;
     klass->start = seat_real_start;
     klass->create_display_server = seat_real_create_display_server;
+    klass->adopt_display_server = seat_real_adopt_display_server;
     klass->display_server_is_used = seat_real_display_server_is_used;
     klass->create_greeter_session = seat_real_create_greeter_session;
     klass->create_session = seat_real_create_session;
@@ -1970,6 +3128,14 @@ seat_class_init (SeatClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 1, SESSION_TYPE);
+    signals[GREETER_CONNECTED] =
+        g_signal_new (SEAT_SIGNAL_GREETER_CONNECTED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SeatClass, greeter_connected),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
     signals[STOPPED] =
         g_signal_new (SEAT_SIGNAL_STOPPED,
                       G_TYPE_FROM_CLASS (klass),
@@ -1990,4 +3156,5 @@ static void
 seat_logger_iface_init (LoggerInterface *iface)
 {
     iface->logprefix = &seat_real_logprefix;
+    iface->subsystem = LOG_SUBSYSTEM_SEAT;
 }
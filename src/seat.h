@@ -15,6 +15,7 @@
 #include <glib-object.h>
 #include "display-server.h"
 #include "greeter-session.h"
+#include "handoff.h"
 #include "session.h"
 #include "process.h"
 #include "logger.h"
@@ -29,6 +30,7 @@ G_BEGIN_DECLS
 #define SEAT_SIGNAL_SESSION_ADDED        "session-added"
 #define SEAT_SIGNAL_RUNNING_USER_SESSION "running-user-session"
 #define SEAT_SIGNAL_SESSION_REMOVED      "session-removed"
+#define SEAT_SIGNAL_GREETER_CONNECTED    "greeter-connected"
 #define SEAT_SIGNAL_STOPPED              "stopped"
 
 typedef struct
@@ -43,6 +45,7 @@ typedef struct
     void (*setup)(Seat *seat);
     gboolean (*start)(Seat *seat);
     DisplayServer *(*create_display_server) (Seat *seat, Session *session);
+    DisplayServer *(*adopt_display_server) (Seat *seat, HandoffSession *session);
     gboolean (*display_server_is_used) (Seat *seat, DisplayServer *display_server);
     GreeterSession *(*create_greeter_session) (Seat *seat);
     Session *(*create_session) (Seat *seat);
@@ -55,6 +58,7 @@ typedef struct
     void (*session_added)(Seat *seat, Session *session);
     void (*running_user_session)(Seat *seat, Session *session);
     void (*session_removed)(Seat *seat, Session *session);
+    void (*greeter_connected)(Seat *seat);
     void (*stopped)(Seat *seat);
 } SeatClass;
 
@@ -106,6 +110,12 @@ gboolean seat_get_allow_guest (Seat *seat);
 
 gboolean seat_get_greeter_allow_guest (Seat *seat);
 
+guint seat_get_greeter_failures (Seat *seat);
+
+guint seat_get_greeter_restart_delay (Seat *seat);
+
+void seat_get_usage (Seat *seat, ProcessUsage *usage);
+
 gboolean seat_switch_to_greeter (Seat *seat);
 
 gboolean seat_switch_to_user (Seat *seat, const gchar *username, const gchar *session_name);
@@ -116,6 +126,8 @@ gboolean seat_lock (Seat *seat, const gchar *username);
 
 void seat_stop (Seat *seat);
 
+void seat_kill (Seat *seat);
+
 gboolean seat_get_is_stopping (Seat *seat);
 
 G_END_DECLS
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <gcrypt.h>
+
+#include "secure-memory.h"
+
+/* Size of the locked arena secrets are kept in */
+#define ARENA_SIZE (256 * 1024)
+
+/* Allocations are rounded up to a power of two from 32 octets to 16 KiB */
+#define MIN_BLOCK_SHIFT 5
+#define N_BLOCK_CLASSES 10
+
+/* Each block starts with a header recording its size class, which keeps the data aligned */
+#define BLOCK_HEADER_SIZE 16
+
+typedef union
+{
+    guint size_class;
+    guint8 padding[BLOCK_HEADER_SIZE];
+} BlockHeader;
+
+/* Freed blocks form a list through their data */
+typedef struct FreeBlock
+{
+    struct FreeBlock *next;
+} FreeBlock;
+
+static gboolean have_arena = FALSE;
+
+/* Memory locked into RAM and how much of it has been handed out to blocks */
+static guint8 *arena = NULL;
+static gsize arena_used = 0;
+
+/* Blocks released back to each size class */
+static FreeBlock *free_blocks[N_BLOCK_CLASSES];
+
+/* TRUE if have warned about having to use memory outside the arena */
+static gboolean warned_full = FALSE;
+
+static void
+init_arena (void)
+{
+    if (have_arena)
+        return;
+    have_arena = TRUE;
+
+    void *memory = mmap (NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        g_warning ("Failed to allocate secure memory: %s", strerror (errno));
+        return;
+    }
+
+    /* Keep secrets out of swap and core dumps */
+    if (mlock (memory, ARENA_SIZE) < 0)
+        g_warning ("Failed to lock secure memory: %s", strerror (errno));
+#ifdef MADV_DONTDUMP
+    madvise (memory, ARENA_SIZE, MADV_DONTDUMP);
+#endif
+
+    arena = memory;
+}
+
+static gboolean
+is_arena_block (void *ptr)
+{
+    return arena != NULL && (guint8 *) ptr >= arena && (guint8 *) ptr < arena + ARENA_SIZE;
+}
+
+static gsize
+get_block_size (guint size_class)
+{
+    return (gsize) 1 << (size_class + MIN_BLOCK_SHIFT);
+}
+
+static gint
+get_size_class (gsize n)
+{
+    for (guint size_class = 0; size_class < N_BLOCK_CLASSES; size_class++)
+        if (n + BLOCK_HEADER_SIZE <= get_block_size (size_class))
+            return size_class;
+
+    return -1;
+}
+
+static void *
+alloc_block (gsize n)
+{
+    init_arena ();
+    if (!arena)
+        return NULL;
+
+    gint size_class = get_size_class (n);
+    if (size_class < 0)
+        return NULL;
+
+    /* Reuse a freed block, or take a new one from the end of the arena */
+    if (free_blocks[size_class])
+    {
+        FreeBlock *block = free_blocks[size_class];
+        free_blocks[size_class] = block->next;
+        block->next = NULL;
+        return block;
+    }
+
+    gsize block_size = get_block_size (size_class);
+    if (arena_used + block_size > ARENA_SIZE)
+        return NULL;
+
+    BlockHeader *header = (BlockHeader *) (arena + arena_used);
+    arena_used += block_size;
+    header->size_class = size_class;
+
+    return (guint8 *) header + BLOCK_HEADER_SIZE;
+}
+
+static guint
+get_block_class (void *ptr)
+{
+    BlockHeader *header = (BlockHeader *) ((guint8 *) ptr - BLOCK_HEADER_SIZE);
+    return header->size_class;
+}
+
+/* Zero memory in a way the compiler won't optimise away */
+static void
+wipe (void *ptr, gsize n)
+{
+    volatile guint8 *p = ptr;
+    while (n--)
+        *p++ = 0;
+}
+
+/* Allocate zeroed memory for secrets from the locked arena, falling back to
+ * libgcrypt secure memory if the arena is full or the request is too large.
+ * Returns NULL if neither has room */
+void *
+secure_memory_alloc (gsize n)
+{
+    void *ptr = alloc_block (n);
+    if (ptr)
+        return ptr;
+
+    if (arena && !warned_full && get_size_class (n) >= 0)
+    {
+        g_warning ("Secure memory arena full, using libgcrypt secure memory");
+        warned_full = TRUE;
+    }
+
+    ptr = gcry_malloc_secure (n);
+    if (!ptr)
+    {
+        g_warning ("Failed to allocate %zu octets of secure memory", n);
+        return NULL;
+    }
+    memset (ptr, 0, n);
+    return ptr;
+}
+
+/* Resize secure memory keeping the contents.  Like realloc (), returns NULL and
+ * leaves @ptr allocated if there isn't room */
+void *
+secure_memory_realloc (void *ptr, gsize n)
+{
+    if (!ptr)
+        return secure_memory_alloc (n);
+
+    if (!is_arena_block (ptr))
+        return gcry_realloc (ptr, n);
+
+    gsize old_length = get_block_size (get_block_class (ptr)) - BLOCK_HEADER_SIZE;
+    if (n <= old_length)
+        return ptr;
+
+    void *new_ptr = secure_memory_alloc (n);
+    if (!new_ptr)
+        return NULL;
+    memcpy (new_ptr, ptr, old_length);
+    secure_memory_free (ptr);
+
+    return new_ptr;
+}
+
+/* Wipe and release secure memory */
+void
+secure_memory_free (void *ptr)
+{
+    if (!ptr)
+        return;
+
+    if (!is_arena_block (ptr))
+    {
+        gcry_free (ptr);
+        return;
+    }
+
+    guint size_class = get_block_class (ptr);
+    wipe (ptr, get_block_size (size_class) - BLOCK_HEADER_SIZE);
+
+    FreeBlock *block = ptr;
+    block->next = free_blocks[size_class];
+    free_blocks[size_class] = block;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SECURE_MEMORY_H_
+#define SECURE_MEMORY_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void *secure_memory_alloc (gsize n);
+
+void *secure_memory_realloc (void *ptr, gsize n);
+
+void secure_memory_free (void *ptr);
+
+G_END_DECLS
+
+#endif /* SECURE_MEMORY_H_ */
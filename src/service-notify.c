@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "service-notify.h"
+
+/* Readiness and watchdog messages for the service manager (sd_notify(3)),
+ * and a thread that reports what the main loop is stuck on */
+
+static const gchar *milestone_names[] = { "dbus", "started", "greeter" };
+static const gchar *milestone_status[] = { "D-Bus service ready", "Started", "Greeter ready" };
+
+/* Socket to send notifications to, -1 if not run by a service manager */
+static int notify_fd = -1;
+static struct sockaddr_un notify_address;
+static socklen_t notify_address_length = 0;
+
+/* Environment the service manager gave us, passed on if the daemon re-executes */
+static gchar *notify_socket_env = NULL;
+static gchar *watchdog_usec_env = NULL;
+
+static ServiceNotifyMilestone ready_milestone = SERVICE_NOTIFY_STARTED;
+static guint reached_milestones = 0;
+static gboolean ready_sent = FALSE;
+
+/* Microseconds between watchdog pings, 0 if the service manager isn't watching */
+static gint64 watchdog_interval = 0;
+static gint64 last_watchdog = 0;
+static guint heartbeat_timeout = 0;
+
+/* Seconds the main loop may go without running before it is reported, 0 to not check */
+static guint stall_timeout = 0;
+
+/* Shared with the monitor thread */
+static GMutex lock;
+static GCond monitor_cond;
+static GThread *monitor_thread = NULL;
+static gboolean monitor_quit = FALSE;
+static gint64 heartbeat = 0;
+static gint64 reported_heartbeat = 0;
+static const gchar *blocking_call = NULL;
+static gint64 blocking_since = 0;
+static pid_t main_thread_id = 0;
+
+static void
+send_notification (const gchar *state)
+{
+    if (notify_fd < 0)
+        return;
+
+    if (sendto (notify_fd, state, strlen (state), MSG_NOSIGNAL, (struct sockaddr *) &notify_address, notify_address_length) < 0)
+        g_debug ("Failed to notify service manager: %s", strerror (errno));
+}
+
+static void
+open_notify_socket (void)
+{
+    const gchar *path = g_getenv ("NOTIFY_SOCKET");
+    if (!path)
+        return;
+
+    memset (&notify_address, 0, sizeof (notify_address));
+    notify_address.sun_family = AF_UNIX;
+    gsize path_length = strlen (path);
+    if ((path[0] != '/' && path[0] != '@') || path_length < 2 || path_length >= sizeof (notify_address.sun_path))
+    {
+        g_warning ("Ignoring invalid service manager notification socket %s", path);
+        return;
+    }
+    memcpy (notify_address.sun_path, path, path_length);
+
+    /* A leading @ is a socket in the abstract namespace */
+    if (path[0] == '@')
+        notify_address.sun_path[0] = '\0';
+    notify_address_length = offsetof (struct sockaddr_un, sun_path) + path_length;
+
+    notify_fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (notify_fd < 0)
+        g_warning ("Failed to create service manager notification socket: %s", strerror (errno));
+}
+
+static void
+load_watchdog (void)
+{
+    const gchar *usec_text = g_getenv ("WATCHDOG_USEC");
+    const gchar *pid_text = g_getenv ("WATCHDOG_PID");
+    if (!usec_text)
+        return;
+
+    /* The watchdog may be meant for another process */
+    if (pid_text && g_ascii_strtoull (pid_text, NULL, 10) != (guint64) getpid ())
+        return;
+
+    /* Ping twice per timeout so a late ping doesn't count as a hang */
+    watchdog_interval = g_ascii_strtoull (usec_text, NULL, 10) / 2;
+}
+
+static gchar *
+read_task_file (const gchar *name)
+{
+    g_autofree gchar *path = g_strdup_printf ("/proc/self/task/%d/%s", main_thread_id, name);
+    gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return g_strdup ("unknown");
+    return g_strstrip (contents);
+}
+
+static void
+report_stall (gint64 blocked_time, const gchar *description, gint64 description_time)
+{
+    /* The system call shows what the kernel is waiting on, e.g. poll for a D-Bus call */
+    g_autofree gchar *syscall_text = read_task_file ("syscall");
+    g_autofree gchar *wchan = read_task_file ("wchan");
+    g_auto(GStrv) syscall_fields = g_strsplit (syscall_text, " ", 2);
+
+    if (description)
+        g_warning ("Main loop has been blocked for %.1fs, in %s for %.1fs (system call %s, waiting in %s)",
+                   blocked_time / 1000000.0, description, description_time / 1000000.0,
+                   syscall_fields[0] ? syscall_fields[0] : "unknown", wchan);
+    else
+        g_warning ("Main loop has been blocked for %.1fs (system call %s, waiting in %s)",
+                   blocked_time / 1000000.0, syscall_fields[0] ? syscall_fields[0] : "unknown", wchan);
+}
+
+static gpointer
+monitor_thread_cb (gpointer data)
+{
+    g_mutex_lock (&lock);
+    while (!monitor_quit)
+    {
+        g_cond_wait_until (&monitor_cond, &lock, g_get_monotonic_time () + G_TIME_SPAN_SECOND);
+        if (monitor_quit)
+            break;
+
+        /* Report each stall once */
+        gint64 now = g_get_monotonic_time ();
+        if (now - heartbeat <= (gint64) stall_timeout * G_TIME_SPAN_SECOND || reported_heartbeat == heartbeat)
+            continue;
+        reported_heartbeat = heartbeat;
+
+        gint64 blocked_time = now - heartbeat;
+        const gchar *description = blocking_call;
+        gint64 description_time = now - blocking_since;
+        g_mutex_unlock (&lock);
+        report_stall (blocked_time, description, description_time);
+        g_mutex_lock (&lock);
+    }
+    g_mutex_unlock (&lock);
+
+    return NULL;
+}
+
+static gboolean
+heartbeat_cb (gpointer data)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    g_mutex_lock (&lock);
+    gboolean was_reported = reported_heartbeat == heartbeat;
+    gint64 blocked_time = now - heartbeat;
+    heartbeat = now;
+    g_mutex_unlock (&lock);
+    if (was_reported)
+        g_warning ("Main loop running again after being blocked for %.1fs", blocked_time / 1000000.0);
+
+    if (watchdog_interval > 0 && now - last_watchdog >= watchdog_interval)
+    {
+        send_notification ("WATCHDOG=1");
+        last_watchdog = now;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean
+service_notify_parse_milestone (const gchar *name, ServiceNotifyMilestone *milestone)
+{
+    for (guint i = 0; i < G_N_ELEMENTS (milestone_names); i++)
+    {
+        if (g_strcmp0 (name, milestone_names[i]) == 0)
+        {
+            *milestone = i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Talk to the service manager if it started us, READY=1 is sent when @milestone is reached */
+void
+service_notify_start (ServiceNotifyMilestone milestone, guint timeout)
+{
+    open_notify_socket ();
+    if (notify_fd >= 0)
+    {
+        load_watchdog ();
+        notify_socket_env = g_strdup (g_getenv ("NOTIFY_SOCKET"));
+        if (watchdog_interval > 0)
+            watchdog_usec_env = g_strdup (g_getenv ("WATCHDOG_USEC"));
+    }
+
+    /* Don't pass these on to X servers and sessions */
+    g_unsetenv ("NOTIFY_SOCKET");
+    g_unsetenv ("WATCHDOG_USEC");
+    g_unsetenv ("WATCHDOG_PID");
+
+    ready_milestone = milestone;
+    stall_timeout = timeout;
+
+    if (watchdog_interval == 0 && stall_timeout == 0)
+        return;
+
+    /* The main loop shows it's running by ticking often enough for both the watchdog and stall checks */
+    guint interval = stall_timeout > 0 ? 1000 : G_MAXUINT;
+    if (watchdog_interval > 0)
+        interval = MIN (interval, MAX (watchdog_interval / 1000, 1));
+    heartbeat = last_watchdog = g_get_monotonic_time ();
+    heartbeat_timeout = g_timeout_add (interval, heartbeat_cb, NULL);
+    if (watchdog_interval > 0)
+    {
+        g_debug ("Sending watchdog pings to service manager every %" G_GINT64_FORMAT "ms", watchdog_interval / 1000);
+        send_notification ("WATCHDOG=1");
+    }
+
+    if (stall_timeout > 0)
+    {
+        main_thread_id = syscall (SYS_gettid);
+        reported_heartbeat = 0;
+        monitor_quit = FALSE;
+        monitor_thread = g_thread_new ("stall-monitor", monitor_thread_cb, NULL);
+    }
+}
+
+void
+service_notify_milestone (ServiceNotifyMilestone milestone)
+{
+    if (reached_milestones & (1 << milestone))
+        return;
+    reached_milestones |= 1 << milestone;
+
+    /* Later milestones include the earlier ones, e.g. when there is no D-Bus service */
+    g_autofree gchar *state = NULL;
+    if (!ready_sent && milestone >= ready_milestone)
+    {
+        ready_sent = TRUE;
+        state = g_strdup_printf ("READY=1\nSTATUS=%s", milestone_status[milestone]);
+        if (notify_fd >= 0)
+            g_debug ("Notifying service manager the daemon is ready (%s)", milestone_names[milestone]);
+    }
+    else
+        state = g_strdup_printf ("STATUS=%s", milestone_status[milestone]);
+    send_notification (state);
+}
+
+/* Mark a call that stops the main loop running, @description must be a static string */
+void
+service_notify_blocking_begin (const gchar *description)
+{
+    if (!monitor_thread)
+        return;
+
+    g_mutex_lock (&lock);
+    blocking_call = description;
+    blocking_since = g_get_monotonic_time ();
+    g_mutex_unlock (&lock);
+}
+
+void
+service_notify_blocking_end (void)
+{
+    if (!monitor_thread)
+        return;
+
+    g_mutex_lock (&lock);
+    blocking_call = NULL;
+    g_mutex_unlock (&lock);
+}
+
+/* Tell the service manager the daemon is re-executing, the new one keeps the same PID and reports ready again */
+void
+service_notify_restart (void)
+{
+    send_notification ("RELOADING=1\nSTATUS=Restarting");
+
+    if (notify_socket_env)
+        g_setenv ("NOTIFY_SOCKET", notify_socket_env, TRUE);
+    if (watchdog_usec_env)
+    {
+        g_autofree gchar *pid = g_strdup_printf ("%d", getpid ());
+        g_setenv ("WATCHDOG_USEC", watchdog_usec_env, TRUE);
+        g_setenv ("WATCHDOG_PID", pid, TRUE);
+    }
+}
+
+void
+service_notify_cleanup (void)
+{
+    send_notification ("STOPPING=1");
+
+    if (monitor_thread)
+    {
+        g_mutex_lock (&lock);
+        monitor_quit = TRUE;
+        g_cond_signal (&monitor_cond);
+        g_mutex_unlock (&lock);
+        g_thread_join (monitor_thread);
+        monitor_thread = NULL;
+    }
+    if (heartbeat_timeout)
+        g_source_remove (heartbeat_timeout);
+    heartbeat_timeout = 0;
+    if (notify_fd >= 0)
+        close (notify_fd);
+    notify_fd = -1;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 LightDM Developers.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SERVICE_NOTIFY_H_
+#define SERVICE_NOTIFY_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Points during startup the daemon can report being ready at, in the order they are reached */
+typedef enum
+{
+    SERVICE_NOTIFY_DBUS_READY,
+    SERVICE_NOTIFY_STARTED,
+    SERVICE_NOTIFY_GREETER_READY,
+} ServiceNotifyMilestone;
+
+gboolean service_notify_parse_milestone (const gchar *name, ServiceNotifyMilestone *milestone);
+
+void service_notify_start (ServiceNotifyMilestone milestone, guint timeout);
+
+void service_notify_milestone (ServiceNotifyMilestone milestone);
+
+void service_notify_blocking_begin (const gchar *description);
+
+void service_notify_blocking_end (void);
+
+void service_notify_restart (void);
+
+void service_notify_cleanup (void);
+
+G_END_DECLS
+
+#endif /* SERVICE_NOTIFY_H_ */
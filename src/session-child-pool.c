@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2010-2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "session-child-pool.h"
+#include "session-child.h"
+
+/* A session child that has been started but not yet given any work */
+typedef struct
+{
+    SessionChildPool *pool;
+    GPid pid;
+    int to_child_input;
+    int from_child_output;
+    guint child_watch;
+} IdleChild;
+
+typedef struct
+{
+    /* Number of idle children to keep */
+    guint size;
+
+    /* Children waiting to be used */
+    GList *children;
+
+    /* Source to start more children */
+    guint fill_idle;
+} SessionChildPoolPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (SessionChildPool, session_child_pool, G_TYPE_OBJECT)
+
+static void
+idle_child_free (IdleChild *child)
+{
+    if (child->child_watch)
+        g_source_remove (child->child_watch);
+    close (child->to_child_input);
+    close (child->from_child_output);
+    g_free (child);
+}
+
+static void
+idle_child_exited_cb (GPid pid, gint status, gpointer data)
+{
+    IdleChild *child = data;
+    SessionChildPoolPrivate *priv = session_child_pool_get_instance_private (child->pool);
+
+    /* Don't restart the child here, if it failed to start it will just fail again */
+    g_warning ("Idle session child %d exited unexpectedly", pid);
+
+    child->child_watch = 0;
+    priv->children = g_list_remove (priv->children, child);
+    idle_child_free (child);
+}
+
+static gboolean
+fill_cb (gpointer data)
+{
+    SessionChildPool *pool = data;
+    SessionChildPoolPrivate *priv = session_child_pool_get_instance_private (pool);
+
+    priv->fill_idle = 0;
+
+    /* Start one child each iteration so we don't hold up the main loop */
+    if (g_list_length (priv->children) >= priv->size)
+        return G_SOURCE_REMOVE;
+
+    IdleChild *child = g_malloc0 (sizeof (IdleChild));
+    child->pool = pool;
+    if (!session_child_spawn (&child->pid, &child->to_child_input, &child->from_child_output))
+    {
+        g_free (child);
+        return G_SOURCE_REMOVE;
+    }
+    child->child_watch = g_child_watch_add (child->pid, idle_child_exited_cb, child);
+    priv->children = g_list_append (priv->children, child);
+    g_debug ("Started idle session child %d", child->pid);
+
+    if (g_list_length (priv->children) < priv->size)
+        priv->fill_idle = g_idle_add_full (G_PRIORITY_LOW, fill_cb, pool, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_fill (SessionChildPool *pool)
+{
+    SessionChildPoolPrivate *priv = session_child_pool_get_instance_private (pool);
+
+    if (!priv->fill_idle)
+        priv->fill_idle = g_idle_add_full (G_PRIORITY_LOW, fill_cb, pool, NULL);
+}
+
+SessionChildPool *
+session_child_pool_new (guint size)
+{
+    SessionChildPool *pool = g_object_new (SESSION_CHILD_POOL_TYPE, NULL);
+    SessionChildPoolPrivate *priv = session_child_pool_get_instance_private (pool);
+
+    priv->size = size;
+    schedule_fill (pool);
+
+    return pool;
+}
+
+gboolean
+session_child_pool_take (SessionChildPool *pool, GPid *pid, int *to_child_input, int *from_child_output)
+{
+    SessionChildPoolPrivate *priv = session_child_pool_get_instance_private (pool);
+
+    g_return_val_if_fail (pool != NULL, FALSE);
+
+    /* Replace whatever we hand out */
+    schedule_fill (pool);
+
+    if (!priv->children)
+        return FALSE;
+
+    IdleChild *child = priv->children->data;
+    priv->children = g_list_delete_link (priv->children, priv->children);
+
+    /* The new owner will watch the process */
+    g_source_remove (child->child_watch);
+    *pid = child->pid;
+    *to_child_input = child->to_child_input;
+    *from_child_output = child->from_child_output;
+    g_free (child);
+
+    g_debug ("Using idle session child %d", *pid);
+
+    return TRUE;
+}
+
+static void
+reap_child_cb (GPid pid, gint status, gpointer data)
+{
+}
+
+static void
+session_child_pool_init (SessionChildPool *pool)
+{
+}
+
+static void
+session_child_pool_finalize (GObject *object)
+{
+    SessionChildPool *self = SESSION_CHILD_POOL (object);
+    SessionChildPoolPrivate *priv = session_child_pool_get_instance_private (self);
+
+    if (priv->fill_idle)
+        g_source_remove (priv->fill_idle);
+
+    /* Closing the pipes stops the children, but still reap them so they don't remain as zombies */
+    for (GList *link = priv->children; link; link = link->next)
+    {
+        IdleChild *child = link->data;
+        g_source_remove (child->child_watch);
+        child->child_watch = 0;
+        g_child_watch_add (child->pid, reap_child_cb, NULL);
+        kill (child->pid, SIGTERM);
+        idle_child_free (child);
+    }
+    g_list_free (priv->children);
+
+    G_OBJECT_CLASS (session_child_pool_parent_class)->finalize (object);
+}
+
+static void
+session_child_pool_class_init (SessionChildPoolClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = session_child_pool_finalize;
+}
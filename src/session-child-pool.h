@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2010-2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SESSION_CHILD_POOL_H_
+#define SESSION_CHILD_POOL_H_
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SESSION_CHILD_POOL_TYPE           (session_child_pool_get_type())
+#define SESSION_CHILD_POOL(obj)           (G_TYPE_CHECK_INSTANCE_CAST ((obj), SESSION_CHILD_POOL_TYPE, SessionChildPool))
+#define SESSION_CHILD_POOL_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST ((klass), SESSION_CHILD_POOL_TYPE, SessionChildPoolClass))
+#define SESSION_CHILD_POOL_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), SESSION_CHILD_POOL_TYPE, SessionChildPoolClass))
+#define IS_SESSION_CHILD_POOL(obj)        (G_TYPE_CHECK_INSTANCE_TYPE ((obj), SESSION_CHILD_POOL_TYPE))
+
+typedef struct
+{
+    GObject parent_instance;
+} SessionChildPool;
+
+typedef struct
+{
+    GObjectClass parent_class;
+} SessionChildPoolClass;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SessionChildPool, g_object_unref)
+
+GType session_child_pool_get_type (void);
+
+SessionChildPool *session_child_pool_new (guint size);
+
+gboolean session_child_pool_take (SessionChildPool *pool, GPid *pid, int *to_child_input, int *from_child_output);
+
+G_END_DECLS
+
+#endif /* SESSION_CHILD_POOL_H_ */
@@ -8,6 +8,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <pwd.h>
 #include <grp.h>
@@ -16,20 +19,27 @@
 #include <utmp.h>
 #include <utmpx.h>
 #include <sys/mman.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #if HAVE_LIBAUDIT
 #include <libaudit.h>
 #endif
 
+#include "accounting.h"
 #include "configuration.h"
 #include "session-child.h"
 #include "session.h"
 #include "console-kit.h"
 #include "login1.h"
+#include "log-capture.h"
 #include "log-file.h"
 #include "privileges.h"
 #include "x-authority.h"
 #include "configuration.h"
+#include "session-frame.h"
+#include "user-list.h"
 
 /* Child process being run */
 static GPid child_pid = 0;
@@ -43,6 +53,12 @@ static gboolean do_authenticate;
 static gboolean authentication_complete = FALSE;
 static pam_handle_t *pam_handle;
 
+/* TRUE if login records are sent to the daemon to write rather than written here */
+static gboolean delegate_accounting = FALSE;
+
+/* Set when the daemon asks for captured session output to be written out */
+static volatile sig_atomic_t flush_requested = 0;
+
 /* Maximum length of a string to pass between daemon and session */
 #define MAX_STRING_LENGTH 65535
 
@@ -126,31 +142,47 @@ pam_conv_cb (int msg_length, const struct pam_message **msg, struct pam_response
     gchar *username = NULL;
     pam_get_item (pam_handle, PAM_USER, (const void **) &username);
 
-    /* Notify the daemon */
-    write_string (username);
+    /* Notify the daemon, the conversation is sent as a single frame */
+    g_autoptr(GByteArray) request = session_frame_new ();
+    session_frame_add_string (request, username);
     gboolean auth_complete = FALSE;
-    write_data (&auth_complete, sizeof (auth_complete));
-    write_data (&msg_length, sizeof (msg_length));
+    session_frame_add_data (request, &auth_complete, sizeof (auth_complete));
+    session_frame_add_data (request, &msg_length, sizeof (msg_length));
     for (int i = 0; i < msg_length; i++)
     {
         const struct pam_message *m = msg[i];
-        write_data (&m->msg_style, sizeof (m->msg_style));
-        write_string (m->msg);
+        session_frame_add_data (request, &m->msg_style, sizeof (m->msg_style));
+        session_frame_add_string (request, m->msg);
+    }
+    g_autoptr(GError) error = NULL;
+    if (!session_frame_write (to_daemon_input, request, &error))
+    {
+        g_printerr ("Error writing to daemon: %s\n", error->message);
+        return PAM_CONV_ERR;
     }
 
     /* Get response */
-    int error;
-    read_data (&error, sizeof (error));
-    if (error != PAM_SUCCESS)
-        return error;
+    g_autoptr(GByteArray) reply = session_frame_read (from_daemon_output, &error);
+    if (!reply)
+    {
+        if (error)
+            g_printerr ("Error reading from daemon: %s\n", error->message);
+        return PAM_CONV_ERR;
+    }
+    SessionFrameReader reader;
+    session_frame_reader_init (&reader, reply);
+    int result = PAM_CONV_ERR;
+    session_frame_reader_get_data (&reader, &result, sizeof (result));
+    if (result != PAM_SUCCESS)
+        return result;
     struct pam_response *response = calloc (msg_length, sizeof (struct pam_response));
     for (int i = 0; i < msg_length; i++)
     {
         struct pam_response *r = &response[i];
         // callers of this function inside pam will expect to be able to call
         // free() on the strings we give back.  So alloc with malloc.
-        r->resp = read_string_full (malloc);
-        read_data (&r->resp_retcode, sizeof (r->resp_retcode));
+        r->resp = session_frame_reader_get_string_full (&reader, malloc);
+        session_frame_reader_get_data (&reader, &r->resp_retcode, sizeof (r->resp_retcode));
     }
 
     *resp = response;
@@ -167,6 +199,148 @@ signal_cb (int signum)
         exit (EXIT_SUCCESS);
 }
 
+static void
+freeze_signal_cb (int signum)
+{
+    /* Stop or continue the whole process group of the child */
+    if (child_pid > 0)
+        kill (-child_pid, signum == SIGTSTP ? SIGSTOP : SIGCONT);
+}
+
+static void
+flush_signal_cb (int signum)
+{
+    flush_requested = 1;
+}
+
+static void
+child_signal_cb (int signum)
+{
+    /* Only here to interrupt poll () */
+}
+
+/* Install a handler that interrupts blocking calls rather than restarting them */
+static void
+set_interrupting_handler (int signum, void (*handler)(int))
+{
+    struct sigaction action;
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = handler;
+    sigemptyset (&action.sa_mask);
+    sigaction (signum, &action, NULL);
+}
+
+/* Pass the session log file from the session process back to us */
+static void
+send_log_fd (int socket_fd, int log_fd)
+{
+    char data = 0;
+    struct iovec iov = { &data, 1 };
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE (sizeof (int))];
+    } control;
+    memset (&control, 0, sizeof (control));
+    struct msghdr message;
+    memset (&message, 0, sizeof (message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof (control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR (&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (cmsg), &log_fd, sizeof (int));
+    sendmsg (socket_fd, &message, 0);
+}
+
+/* Read session output into the capture, taking the log file if it is sent. Returns 0 on end of file */
+static gssize
+read_capture (LogCapture *capture, int socket_fd, int *log_fd, int flags)
+{
+    guint8 buffer[4096];
+    struct iovec iov = { buffer, sizeof (buffer) };
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE (sizeof (int))];
+    } control;
+    struct msghdr message;
+    memset (&message, 0, sizeof (message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof (control.buffer);
+    gssize n_read = recvmsg (socket_fd, &message, flags | MSG_CMSG_CLOEXEC);
+    if (n_read <= 0)
+        return n_read;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&message); cmsg; cmsg = CMSG_NXTHDR (&message, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int fd;
+        memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+        if (*log_fd < 0)
+            *log_fd = fd;
+        else
+            close (fd);
+
+        /* The byte carrying the file descriptor isn't output */
+        return n_read;
+    }
+
+    log_capture_add (capture, buffer, n_read);
+    return n_read;
+}
+
+/* Wait for the session process to exit, keeping its output in the capture until it is flushed */
+static void
+wait_capturing (LogCapture *capture, int socket_fd, int log_fd, int *child_status)
+{
+    set_interrupting_handler (SIGCHLD, child_signal_cb);
+
+    while (TRUE)
+    {
+        if (flush_requested)
+        {
+            flush_requested = 0;
+            if (log_fd >= 0)
+                log_capture_flush (capture, log_fd);
+        }
+
+        pid_t pid = waitpid (child_pid, child_status, socket_fd >= 0 ? WNOHANG : 0);
+        if (pid == child_pid || (pid < 0 && errno != EINTR))
+            break;
+        if (socket_fd < 0)
+            continue;
+
+        /* Times out in case the session exits between waitpid () and poll () */
+        struct pollfd poll_fd = { socket_fd, POLLIN, 0 };
+        if (poll (&poll_fd, 1, 1000) > 0 && read_capture (capture, socket_fd, &log_fd, 0) == 0)
+        {
+            close (socket_fd);
+            socket_fd = -1;
+        }
+    }
+
+    /* Keep what is left from the session */
+    if (socket_fd >= 0)
+    {
+        while (read_capture (capture, socket_fd, &log_fd, MSG_DONTWAIT) > 0);
+        close (socket_fd);
+    }
+    if (log_fd >= 0)
+    {
+        log_capture_flush (capture, log_fd);
+        close (log_fd);
+    }
+
+    signal (SIGCHLD, SIG_DFL);
+}
+
 static XAuthority *
 read_xauth (void)
 {
@@ -238,6 +412,107 @@ audit_event (int type, const gchar *username, uid_t uid, const gchar *remote_hos
 }
 #endif
 
+static void
+add_account_record (GByteArray *frame, const gchar *wtmp_file, struct utmpx *ut, AccountingEvent event, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success)
+{
+    session_frame_add_string (frame, wtmp_file);
+    session_frame_add_data (frame, ut, sizeof (*ut));
+    session_frame_add_data (frame, &event, sizeof (event));
+    session_frame_add_string (frame, username);
+    session_frame_add_data (frame, &uid, sizeof (uid));
+    session_frame_add_string (frame, remote_host_name);
+    session_frame_add_string (frame, tty);
+    session_frame_add_data (frame, &success, sizeof (success));
+}
+
+/* Record a login in wtmp and the audit log, or have the daemon do it */
+static void
+log_account (const gchar *wtmp_file, struct utmpx *ut, AccountingEvent event, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success)
+{
+    if (delegate_accounting)
+    {
+        g_autoptr(GByteArray) frame = session_frame_new ();
+        add_account_record (frame, wtmp_file, ut, event, username, uid, remote_host_name, tty, success);
+        g_autoptr(GError) error = NULL;
+        if (!session_frame_write (to_daemon_input, frame, &error))
+            g_printerr ("Error writing to daemon: %s\n", error->message);
+        return;
+    }
+
+    updwtmpx (wtmp_file, ut);
+#if HAVE_LIBAUDIT
+    audit_event (event == ACCOUNTING_EVENT_LOGIN ? AUDIT_USER_LOGIN : AUDIT_USER_LOGOUT, username, uid, remote_host_name, tty, success);
+#endif
+}
+
+/* Snapshot of the daemon configuration for session children to load */
+static gchar *config_snapshot_path = NULL;
+
+void
+session_child_set_config_snapshot (const gchar *path)
+{
+    g_free (config_snapshot_path);
+    config_snapshot_path = g_strdup (path);
+}
+
+/* Start a session child process from the daemon. It waits for the daemon to send the session configuration */
+gboolean
+session_child_spawn (GPid *pid, int *to_child_input, int *from_child_output)
+{
+    /* Create pipes to talk to the child */
+    int to_child_pipe[2], from_child_pipe[2];
+    if (pipe (to_child_pipe) < 0)
+    {
+        g_warning ("Failed to create pipe to communicate with session process: %s", strerror (errno));
+        return FALSE;
+    }
+    if (pipe (from_child_pipe) < 0)
+    {
+        g_warning ("Failed to create pipe to communicate with session process: %s", strerror (errno));
+        close (to_child_pipe[0]);
+        close (to_child_pipe[1]);
+        return FALSE;
+    }
+    int to_child_output = to_child_pipe[0];
+    int from_child_input = from_child_pipe[1];
+
+    /* Don't allow the daemon end of the pipes to be accessed in child processes */
+    fcntl (to_child_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl (from_child_pipe[0], F_SETFD, FD_CLOEXEC);
+
+    /* Run the child */
+    g_autofree gchar *arg0 = g_strdup_printf ("%d", to_child_output);
+    g_autofree gchar *arg1 = g_strdup_printf ("%d", from_child_input);
+    GPid child_pid = fork ();
+    if (child_pid == 0)
+    {
+        /* Run us again in session child mode */
+        execlp ("lightdm",
+                "lightdm",
+                "--session-child",
+                arg0, arg1, config_snapshot_path, NULL);
+        _exit (EXIT_FAILURE);
+    }
+
+    /* Close the ends of the pipes we don't need */
+    close (to_child_output);
+    close (from_child_input);
+
+    if (child_pid < 0)
+    {
+        g_debug ("Failed to fork session child process: %s", strerror (errno));
+        close (to_child_pipe[1]);
+        close (from_child_pipe[0]);
+        return FALSE;
+    }
+
+    *pid = child_pid;
+    *to_child_input = to_child_pipe[1];
+    *from_child_output = from_child_pipe[0];
+
+    return TRUE;
+}
+
 int
 session_child_run (int argc, char **argv)
 {
@@ -245,12 +520,25 @@ session_child_run (int argc, char **argv)
     g_type_init ();
 #endif
 
+    /* Use the configuration the daemon is running with */
+    if (argc == 5)
+    {
+        g_autoptr(GError) error = NULL;
+        if (!config_load_snapshot (config_get_instance (), argv[4], NULL, FALSE, NULL, &error))
+            g_printerr ("Failed to load configuration snapshot %s: %s\n", argv[4], error->message);
+    }
+
+    /* Requests to write out captured output mean nothing until a session is running */
+    set_interrupting_handler (SIGUSR1, flush_signal_cb);
+
     if (config_get_boolean (config_get_instance (), "LightDM", "lock-memory"))
     {
         /* Protect memory from being paged to disk, as we deal with passwords */
         mlockall (MCL_CURRENT | MCL_FUTURE);
     }
 
+    delegate_accounting = config_get_integer (config_get_instance (), "LightDM", "accounting-batch-interval") > 0;
+
     /* Make input non-blocking */
     int fd = open ("/dev/null", O_RDONLY);
     dup2 (fd, STDIN_FILENO);
@@ -262,9 +550,9 @@ session_child_run (int argc, char **argv)
     close (fd);
 
     /* Get the pipe from the daemon */
-    if (argc != 4)
+    if (argc != 4 && argc != 5)
     {
-        g_printerr ("Usage: lightdm --session-child INPUTFD OUTPUTFD\n");
+        g_printerr ("Usage: lightdm --session-child INPUTFD OUTPUTFD [CONFIG-SNAPSHOT]\n");
         return EXIT_FAILURE;
     }
     from_daemon_output = atoi (argv[2]);
@@ -292,6 +580,12 @@ session_child_run (int argc, char **argv)
     g_autofree gchar *remote_host_name = read_string ();
     g_autofree gchar *xdisplay = read_string ();
     g_autoptr(XAuthority) x_authority = read_xauth ();
+    gboolean allow_retry = FALSE;
+    if (version >= 4)
+        read_data (&allow_retry, sizeof (allow_retry));
+    gboolean hold = FALSE;
+    if (version >= 5)
+        read_data (&hold, sizeof (hold));
 
     /* Setup PAM */
     struct pam_conv conversation = { pam_conv_cb, NULL };
@@ -324,133 +618,166 @@ session_child_run (int argc, char **argv)
     }
 #endif
 
-    /* Authenticate */
+    /* Authenticate, possibly more than once if the daemon asks to retry after a failure */
     int authentication_result = PAM_SUCCESS;
-    if (do_authenticate)
+    User *user = NULL;
+    while (TRUE)
     {
-        const gchar *new_username;
+        /* Failed login for the daemon to record, sent with the result */
+        struct utmpx failed_ut;
+        gboolean have_failed_ut = FALSE;
 
-        authentication_result = pam_authenticate (pam_handle, 0);
-
-        /* See what user we ended up as */
-        if (pam_get_item (pam_handle, PAM_USER, (const void **) &new_username) != PAM_SUCCESS)
+        if (do_authenticate)
         {
-            pam_end (pam_handle, 0);
-            return EXIT_FAILURE;
-        }
-        g_free (username);
-        username = g_strdup (new_username);
+            const gchar *new_username;
 
-        /* Write record to btmp database */
-        if (authentication_result == PAM_AUTH_ERR)
-        {
-            struct utmpx ut;
-            struct timeval tv;
+            authentication_result = pam_authenticate (pam_handle, 0);
 
-            memset (&ut, 0, sizeof (ut));
-            ut.ut_type = USER_PROCESS;
-            ut.ut_pid = getpid ();
-            if (xdisplay)
-                strncpy (ut.ut_id, xdisplay, sizeof (ut.ut_id));
-            if (tty && g_str_has_prefix (tty, "/dev/"))
-                strncpy (ut.ut_line, tty + strlen ("/dev/"), sizeof (ut.ut_line));
-            strncpy (ut.ut_user, username, sizeof (ut.ut_user));
-            if (xdisplay)
-                strncpy (ut.ut_host, xdisplay, sizeof (ut.ut_host));
-            else if (remote_host_name)
-                strncpy (ut.ut_host, remote_host_name, sizeof (ut.ut_host));
-            gettimeofday (&tv, NULL);
-            ut.ut_tv.tv_sec = tv.tv_sec;
-            ut.ut_tv.tv_usec = tv.tv_usec;
+            /* See what user we ended up as */
+            if (pam_get_item (pam_handle, PAM_USER, (const void **) &new_username) != PAM_SUCCESS)
+            {
+                pam_end (pam_handle, 0);
+                return EXIT_FAILURE;
+            }
+            g_free (username);
+            username = g_strdup (new_username);
 
-            updwtmpx ("/var/log/btmp", &ut);
+            /* Write record to btmp database */
+            if (authentication_result == PAM_AUTH_ERR)
+            {
+                struct utmpx ut;
+                struct timeval tv;
+
+                memset (&ut, 0, sizeof (ut));
+                ut.ut_type = USER_PROCESS;
+                ut.ut_pid = getpid ();
+                if (xdisplay)
+                    strncpy (ut.ut_id, xdisplay, sizeof (ut.ut_id));
+                if (tty && g_str_has_prefix (tty, "/dev/"))
+                    strncpy (ut.ut_line, tty + strlen ("/dev/"), sizeof (ut.ut_line));
+                strncpy (ut.ut_user, username, sizeof (ut.ut_user));
+                if (xdisplay)
+                    strncpy (ut.ut_host, xdisplay, sizeof (ut.ut_host));
+                else if (remote_host_name)
+                    strncpy (ut.ut_host, remote_host_name, sizeof (ut.ut_host));
+                gettimeofday (&tv, NULL);
+                ut.ut_tv.tv_sec = tv.tv_sec;
+                ut.ut_tv.tv_usec = tv.tv_usec;
+
+                if (delegate_accounting)
+                {
+                    failed_ut = ut;
+                    have_failed_ut = TRUE;
+                }
+                else
+                {
+                    updwtmpx ("/var/log/btmp", &ut);
 
 #if HAVE_LIBAUDIT
-            audit_event (AUDIT_USER_LOGIN, username, -1, remote_host_name, tty, FALSE);
+                    audit_event (AUDIT_USER_LOGIN, username, -1, remote_host_name, tty, FALSE);
 #endif
-        }
-
-        /* Check account is valid */
-        if (authentication_result == PAM_SUCCESS)
-            authentication_result = pam_acct_mgmt (pam_handle, 0);
-        if (authentication_result == PAM_NEW_AUTHTOK_REQD)
-            authentication_result = pam_chauthtok (pam_handle, PAM_CHANGE_EXPIRED_AUTHTOK);
-    }
-    else
-        authentication_result = PAM_SUCCESS;
-    authentication_complete = TRUE;
+                }
+            }
 
-    User *user = NULL;
-    if (authentication_result == PAM_SUCCESS)
-    {
-        /* Fail authentication if user doesn't actually exist */
-        user = accounts_get_user_by_name (username);
-        if (!user)
-        {
-            g_printerr ("Failed to get information on user %s: %s\n", username, strerror (errno));
-            authentication_result = PAM_USER_UNKNOWN;
+            /* Check account is valid */
+            if (authentication_result == PAM_SUCCESS)
+                authentication_result = pam_acct_mgmt (pam_handle, 0);
+            if (authentication_result == PAM_NEW_AUTHTOK_REQD)
+                authentication_result = pam_chauthtok (pam_handle, PAM_CHANGE_EXPIRED_AUTHTOK);
         }
         else
+            authentication_result = PAM_SUCCESS;
+        authentication_complete = TRUE;
+
+        if (authentication_result == PAM_SUCCESS)
         {
-            /* Set POSIX variables */
-            pam_putenv (pam_handle, "PATH=/usr/local/bin:/usr/bin:/bin");
-            pam_putenv (pam_handle, g_strdup_printf ("USER=%s", username));
-            pam_putenv (pam_handle, g_strdup_printf ("LOGNAME=%s", username));
-            pam_putenv (pam_handle, g_strdup_printf ("HOME=%s", user_get_home_directory (user)));
-            pam_putenv (pam_handle, g_strdup_printf ("SHELL=%s", user_get_shell (user)));
-
-            /* Let the greeter and user session inherit the system default locale */
-            static const gchar * const locale_var_names[] = {
-                "LC_PAPER",
-                "LC_NAME",
-                "LC_ADDRESS",
-                "LC_TELEPHONE",
-                "LC_MEASUREMENT",
-                "LC_IDENTIFICATION",
-                "LC_COLLATE",
-                "LC_CTYPE",
-                "LC_MONETARY",
-                "LC_NUMERIC",
-                "LC_TIME",
-                "LC_MESSAGES",
-                "LC_ALL",
-                "LANG",
-                NULL
-            };
-            for (int i = 0; locale_var_names[i] != NULL; i++)
+            /* Fail authentication if user doesn't actually exist */
+            user = accounts_get_user_by_name (username);
+            if (!user)
+            {
+                g_printerr ("Failed to get information on user %s: %s\n", username, strerror (errno));
+                authentication_result = PAM_USER_UNKNOWN;
+            }
+            else
             {
-                const gchar *locale_value;
-                if ((locale_value = g_getenv (locale_var_names[i])) != NULL)
+                /* Set POSIX variables */
+                pam_putenv (pam_handle, "PATH=/usr/local/bin:/usr/bin:/bin");
+                pam_putenv (pam_handle, g_strdup_printf ("USER=%s", username));
+                pam_putenv (pam_handle, g_strdup_printf ("LOGNAME=%s", username));
+                pam_putenv (pam_handle, g_strdup_printf ("HOME=%s", user_get_home_directory (user)));
+                pam_putenv (pam_handle, g_strdup_printf ("SHELL=%s", user_get_shell (user)));
+
+                /* Let the greeter and user session inherit the system default locale */
+                static const gchar * const locale_var_names[] = {
+                    "LC_PAPER",
+                    "LC_NAME",
+                    "LC_ADDRESS",
+                    "LC_TELEPHONE",
+                    "LC_MEASUREMENT",
+                    "LC_IDENTIFICATION",
+                    "LC_COLLATE",
+                    "LC_CTYPE",
+                    "LC_MONETARY",
+                    "LC_NUMERIC",
+                    "LC_TIME",
+                    "LC_MESSAGES",
+                    "LC_ALL",
+                    "LANG",
+                    NULL
+                };
+                for (int i = 0; locale_var_names[i] != NULL; i++)
                 {
-                    g_autofree gchar *locale_var = g_strdup_printf ("%s=%s", locale_var_names[i], locale_value);
-                    pam_putenv (pam_handle, locale_var);
+                    const gchar *locale_value;
+                    if ((locale_value = g_getenv (locale_var_names[i])) != NULL)
+                    {
+                        g_autofree gchar *locale_var = g_strdup_printf ("%s=%s", locale_var_names[i], locale_value);
+                        pam_putenv (pam_handle, locale_var);
+                    }
                 }
             }
         }
-    }
 
-    g_autofree gchar *authentication_result_string = g_strdup (pam_strerror (pam_handle, authentication_result));
+        g_autofree gchar *authentication_result_string = g_strdup (pam_strerror (pam_handle, authentication_result));
+
+        /* Report authentication result */
+        g_autoptr(GByteArray) result_frame = session_frame_new ();
+        session_frame_add_string (result_frame, username);
+        gboolean auth_complete = TRUE;
+        session_frame_add_data (result_frame, &auth_complete, sizeof (auth_complete));
+        session_frame_add_data (result_frame, &authentication_result, sizeof (authentication_result));
+        session_frame_add_string (result_frame, authentication_result_string);
+        session_frame_add_data (result_frame, &have_failed_ut, sizeof (have_failed_ut));
+        if (have_failed_ut)
+            add_account_record (result_frame, "/var/log/btmp", &failed_ut, ACCOUNTING_EVENT_LOGIN, username, -1, remote_host_name, tty, FALSE);
+        g_autoptr(GError) frame_error = NULL;
+        if (!session_frame_write (to_daemon_input, result_frame, &frame_error))
+            g_printerr ("Error writing to daemon: %s\n", frame_error->message);
+
+        /* Check we got a valid user */
+        if (!username)
+        {
+            g_printerr ("No user selected during authentication\n");
+            pam_end (pam_handle, 0);
+            return EXIT_FAILURE;
+        }
 
-    /* Report authentication result */
-    write_string (username);
-    gboolean auth_complete = TRUE;
-    write_data (&auth_complete, sizeof (auth_complete));
-    write_data (&authentication_result, sizeof (authentication_result));
-    write_string (authentication_result_string);
+        /* Stop if we didn't authenticated, unless the daemon wants to try again */
+        if (authentication_result != PAM_SUCCESS)
+        {
+            int command = SESSION_CHILD_COMMAND_STOP;
+            if (allow_retry && authentication_result == PAM_AUTH_ERR &&
+                read_data (&command, sizeof (command)) == sizeof (command) &&
+                command == SESSION_CHILD_COMMAND_RETRY)
+            {
+                authentication_complete = FALSE;
+                continue;
+            }
 
-    /* Check we got a valid user */
-    if (!username)
-    {
-        g_printerr ("No user selected during authentication\n");
-        pam_end (pam_handle, 0);
-        return EXIT_FAILURE;
-    }
+            pam_end (pam_handle, 0);
+            return EXIT_FAILURE;
+        }
 
-    /* Stop if we didn't authenticated */
-    if (authentication_result != PAM_SUCCESS)
-    {
-        pam_end (pam_handle, 0);
-        return EXIT_FAILURE;
+        break;
     }
 
     /* Get the command to run (blocks) */
@@ -464,6 +791,9 @@ session_child_run (int argc, char **argv)
         tty = read_string ();
     }
     g_autofree gchar *x_authority_filename = read_string ();
+    gboolean x_authority_use_runtime_dir = FALSE;
+    if (version >= 6)
+        read_data (&x_authority_use_runtime_dir, sizeof (x_authority_use_runtime_dir));
     if (version >= 1)
     {
         g_free (xdisplay);
@@ -492,6 +822,7 @@ session_child_run (int argc, char **argv)
     }
 
     /* Redirect stderr to a log file */
+    gboolean have_log = log_filename != NULL;
     if (log_filename)
     {
         if (g_path_is_absolute (log_filename))
@@ -537,20 +868,16 @@ session_child_run (int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    /* Open a connection to the system bus for ConsoleKit - we must keep it open or CK will close the session */
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-    if (error)
-        g_printerr ("Unable to contact system bus: %s", error->message);
-    if (!bus)
-    {
-        pam_end (pam_handle, 0);
-        return EXIT_FAILURE;
-    }
+    /* The password is no longer needed, so drop it and stop keeping the rest of
+     * this process in memory for the lifetime of the session */
+    pam_set_item (pam_handle, PAM_AUTHTOK, NULL);
+    if (config_get_boolean (config_get_instance (), "LightDM", "lock-memory"))
+        munlockall ();
 
     /* Check what logind session we are, or fallback to ConsoleKit */
     const gchar *login1_session_id = pam_getenv (pam_handle, "XDG_SESSION_ID");
     g_autofree gchar *console_kit_cookie = NULL;
+    g_autoptr(GDBusConnection) bus = NULL;
     if (login1_session_id)
     {
         write_string (login1_session_id);
@@ -559,6 +886,17 @@ session_child_run (int argc, char **argv)
     }
     else
     {
+        /* Open a connection to the system bus for ConsoleKit - we must keep it open or CK will close the session */
+        g_autoptr(GError) error = NULL;
+        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+        if (error)
+            g_printerr ("Unable to contact system bus: %s", error->message);
+        if (!bus)
+        {
+            pam_end (pam_handle, 0);
+            return EXIT_FAILURE;
+        }
+
         GVariantBuilder ck_parameters;
         g_variant_builder_init (&ck_parameters, G_VARIANT_TYPE ("(a(sv))"));
         g_variant_builder_open (&ck_parameters, G_VARIANT_TYPE ("a(sv)"));
@@ -598,7 +936,22 @@ session_child_run (int argc, char **argv)
         }
     }
 
-    /* Write X authority */
+    /* Write X authority, to a file of its own in the runtime directory logind
+     * made for this session if possible so the home directory isn't touched */
+    gboolean x_authority_in_runtime_dir = FALSE;
+    if (x_authority && x_authority_use_runtime_dir && xdisplay &&
+        g_strcmp0 (pam_getenv (pam_handle, "XDG_SESSION_CLASS"), "greeter") != 0)
+    {
+        const gchar *runtime_dir = pam_getenv (pam_handle, "XDG_RUNTIME_DIR");
+        if (runtime_dir && g_file_test (runtime_dir, G_FILE_TEST_IS_DIR))
+        {
+            g_autofree gchar *name = g_strconcat ("xauthority-", xdisplay, NULL);
+            g_strdelimit (name, "/", '_');
+            g_free (x_authority_filename);
+            x_authority_filename = g_build_filename (runtime_dir, name, NULL);
+            x_authority_in_runtime_dir = TRUE;
+        }
+    }
     if (x_authority)
     {
         gboolean drop_privileges = geteuid () == 0;
@@ -606,7 +959,7 @@ session_child_run (int argc, char **argv)
             privileges_drop (user_get_uid (user), user_get_gid (user));
 
         g_autoptr(GError) error = NULL;
-        gboolean result = x_authority_write (x_authority, XAUTH_WRITE_MODE_REPLACE, x_authority_filename, &error);
+        gboolean result = x_authority_write (x_authority, x_authority_in_runtime_dir ? XAUTH_WRITE_MODE_SET : XAUTH_WRITE_MODE_REPLACE, x_authority_filename, &error);
         if (drop_privileges)
             privileges_reclaim ();
 
@@ -622,15 +975,46 @@ session_child_run (int argc, char **argv)
         pam_putenv (pam_handle, value);
     }
 
+    /* Keep the session open for a greeter running in another process until the daemon stops it */
+    if (hold)
+    {
+        sigset_t mask;
+        sigemptyset (&mask);
+        sigaddset (&mask, SIGTERM);
+        sigprocmask (SIG_BLOCK, &mask, NULL);
+        int signum;
+        sigwait (&mask, &signum);
+    }
+
     /* Catch terminate signal and pass it to the child */
     signal (SIGTERM, signal_cb);
 
+    /* The daemon freezes idle greeters with SIGTSTP and thaws them with SIGCONT */
+    signal (SIGTSTP, freeze_signal_cb);
+    signal (SIGCONT, freeze_signal_cb);
+
+    /* Hold the session output in memory if configured to */
+    g_autoptr(LogCapture) capture = NULL;
+    int capture_sockets[2] = { -1, -1 };
+    gint capture_size = config_get_integer (config_get_instance (), "LightDM", "log-capture-size");
+    if (have_log && capture_size > 0 && !hold)
+    {
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, capture_sockets) == 0)
+        {
+            gint capture_rate = config_get_integer (config_get_instance (), "LightDM", "log-capture-rate");
+            capture = log_capture_new ((gsize) capture_size * 1024, (gsize) MAX (capture_rate, 0) * 1024);
+        }
+        else
+            g_printerr ("Failed to make socket to capture session output: %s\n", strerror (errno));
+    }
+
     /* Run the command as the authenticated user */
     uid_t uid = user_get_uid (user);
     gid_t gid = user_get_gid (user);
     const gchar *home_directory = user_get_home_directory (user);
-    child_pid = fork ();
-    if (child_pid == 0)
+    if (!hold)
+        child_pid = fork ();
+    if (child_pid == 0 && !hold)
     {
         /* Make this process its own session */
         if (setsid () < 0)
@@ -656,12 +1040,19 @@ session_child_run (int argc, char **argv)
         if (log_filename)
         {
             int fd = log_file_open (log_filename, log_mode);
-            if (fd >= 0)
+            if (fd >= 0 && capture)
+            {
+                send_log_fd (capture_sockets[1], fd);
+                close (fd);
+            }
+            else if (fd >= 0)
             {
                 dup2 (fd, STDERR_FILENO);
                 close (fd);
             }
         }
+        if (capture)
+            dup2 (capture_sockets[1], STDERR_FILENO);
 
         /* Reset SIGPIPE handler so the child has default behaviour (we disabled it at LightDM start) */
         signal (SIGPIPE, SIG_DFL);
@@ -679,6 +1070,20 @@ session_child_run (int argc, char **argv)
         return_code = EXIT_FAILURE;
     }
 
+    /* Only the PAM handle and what is needed to close the session are used
+     * while the command runs, so free everything else for the lifetime of
+     * the session */
+    if (child_pid > 0)
+    {
+        g_clear_pointer (&command_argv, g_strfreev);
+        g_clear_object (&user);
+        common_user_list_cleanup ();
+        config_cleanup ();
+#ifdef __GLIBC__
+        malloc_trim (0);
+#endif
+    }
+
     /* Wait for the command to complete (blocks) */
     if (child_pid > 0)
     {
@@ -708,15 +1113,18 @@ session_child_run (int argc, char **argv)
             if (!pututxline (&ut))
                 g_printerr ("Failed to write utmpx: %s\n", strerror (errno));
             endutxent ();
-            updwtmpx ("/var/log/wtmp", &ut);
-
-#if HAVE_LIBAUDIT
-            audit_event (AUDIT_USER_LOGIN, username, uid, remote_host_name, tty, TRUE);
-#endif
+            log_account ("/var/log/wtmp", &ut, ACCOUNTING_EVENT_LOGIN, username, uid, remote_host_name, tty, TRUE);
         }
 
         int child_status;
-        waitpid (child_pid, &child_status, 0);
+        if (capture)
+        {
+            close (capture_sockets[1]);
+            /* An absolute log file is already our stderr, otherwise the session sends it */
+            wait_capturing (capture, capture_sockets[0], log_filename ? -1 : dup (STDERR_FILENO), &child_status);
+        }
+        else
+            waitpid (child_pid, &child_status, 0);
         child_pid = 0;
         if (WIFEXITED (child_status))
             return_code = WEXITSTATUS (child_status);
@@ -749,11 +1157,7 @@ session_child_run (int argc, char **argv)
             if (!pututxline (&ut))
                 g_printerr ("Failed to write utmpx: %s\n", strerror (errno));
             endutxent ();
-            updwtmpx ("/var/log/wtmp", &ut);
-
-#if HAVE_LIBAUDIT
-            audit_event (AUDIT_USER_LOGOUT, username, uid, remote_host_name, tty, TRUE);
-#endif
+            log_account ("/var/log/wtmp", &ut, ACCOUNTING_EVENT_LOGOUT, username, uid, remote_host_name, tty, TRUE);
         }
     }
 
@@ -762,10 +1166,16 @@ session_child_run (int argc, char **argv)
     {
         gboolean drop_privileges = geteuid () == 0;
         if (drop_privileges)
-            privileges_drop (user_get_uid (user), user_get_gid (user));
+            privileges_drop (uid, gid);
 
         g_autoptr(GError) error = NULL;
-        x_authority_write (x_authority, XAUTH_WRITE_MODE_REMOVE, x_authority_filename, &error);
+        if (x_authority_in_runtime_dir)
+        {
+            if (unlink (x_authority_filename) < 0 && errno != ENOENT)
+                g_set_error (&error, G_FILE_ERROR, g_file_error_from_errno (errno), "Failed to remove %s: %s", x_authority_filename, g_strerror (errno));
+        }
+        else
+            x_authority_write (x_authority, XAUTH_WRITE_MODE_REMOVE, x_authority_filename, &error);
         if (drop_privileges)
             privileges_reclaim ();
 
@@ -12,6 +12,16 @@
 #ifndef SESSION_CHILD_H_
 #define SESSION_CHILD_H_
 
+#include <glib.h>
+
+/* Commands the daemon can send a child after authentication failed */
+#define SESSION_CHILD_COMMAND_STOP  0
+#define SESSION_CHILD_COMMAND_RETRY 1
+
 int session_child_run (int argc, char **argv);
 
+void session_child_set_config_snapshot (const gchar *path);
+
+gboolean session_child_spawn (GPid *pid, int *to_child_input, int *from_child_output);
+
 #endif /* SESSION_CHILD_H_ */
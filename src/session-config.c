@@ -34,6 +34,13 @@ session_config_new_from_file (const gchar *filename, const gchar *default_sessio
     g_autoptr(GKeyFile) desktop_file = g_key_file_new ();
     if (!g_key_file_load_from_file (desktop_file, filename, G_KEY_FILE_NONE, error))
         return NULL;
+
+    return session_config_new_from_key_file (desktop_file, filename, default_session_type, error);
+}
+
+SessionConfig *
+session_config_new_from_key_file (GKeyFile *desktop_file, const gchar *filename, const gchar *default_session_type, GError **error)
+{
     g_autofree gchar *command = g_key_file_get_string (desktop_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
     if (!command)
     {
@@ -69,6 +76,16 @@ session_config_new_from_file (const gchar *filename, const gchar *default_sessio
     return g_steal_pointer (&config);
 }
 
+/* Config for a session that is already running, only the type is known */
+SessionConfig *
+session_config_new_for_session_type (const gchar *session_type)
+{
+    SessionConfig *config = g_object_new (SESSION_CONFIG_TYPE, NULL);
+    SessionConfigPrivate *priv = session_config_get_instance_private (config);
+    priv->session_type = g_strdup (session_type);
+    return config;
+}
+
 const gchar *
 session_config_get_command (SessionConfig *config)
 {
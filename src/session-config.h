@@ -37,6 +37,10 @@ GType session_config_get_type (void);
 
 SessionConfig *session_config_new_from_file (const gchar *filename, const gchar *default_session_type, GError **error);
 
+SessionConfig *session_config_new_from_key_file (GKeyFile *desktop_file, const gchar *filename, const gchar *default_session_type, GError **error);
+
+SessionConfig *session_config_new_for_session_type (const gchar *session_type);
+
 const gchar *session_config_get_command (SessionConfig *config);
 
 const gchar *session_config_get_session_type (SessionConfig *config);
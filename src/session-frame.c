@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <gio/gio.h>
+
+#include "session-frame.h"
+
+/* Maximum size of a frame, enough for a PAM conversation with many long messages */
+#define MAX_FRAME_LENGTH (1024 * 1024)
+
+/* Maximum length of a string to pass between daemon and session */
+#define MAX_STRING_LENGTH 65535
+
+GByteArray *
+session_frame_new (void)
+{
+    GByteArray *frame = g_byte_array_sized_new (256);
+
+    /* Space for the length, filled in when written */
+    guint32 length = 0;
+    g_byte_array_append (frame, (const guint8 *) &length, sizeof (length));
+
+    return frame;
+}
+
+void
+session_frame_add_data (GByteArray *frame, const void *buf, gsize count)
+{
+    g_byte_array_append (frame, buf, count);
+}
+
+void
+session_frame_add_string (GByteArray *frame, const gchar *value)
+{
+    int length = value ? strlen (value) : -1;
+    session_frame_add_data (frame, &length, sizeof (length));
+    if (value)
+        session_frame_add_data (frame, value, sizeof (char) * length);
+}
+
+gboolean
+session_frame_write (int fd, GByteArray *frame, GError **error)
+{
+    guint32 length = frame->len - sizeof (guint32);
+    memcpy (frame->data, &length, sizeof (length));
+
+    /* Written in one go, only a frame larger than the pipe buffer gets split */
+    gsize offset = 0;
+    while (offset < frame->len)
+    {
+        ssize_t n_written = write (fd, frame->data + offset, frame->len - offset);
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno), "%s", strerror (errno));
+            return FALSE;
+        }
+        offset += n_written;
+    }
+
+    return TRUE;
+}
+
+static gssize
+read_all (int fd, guint8 *buf, gsize count, GError **error)
+{
+    gsize offset = 0;
+    while (offset < count)
+    {
+        ssize_t n_read = read (fd, buf + offset, count - offset);
+        if (n_read < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno), "%s", strerror (errno));
+            return -1;
+        }
+        if (n_read == 0)
+            break;
+        offset += n_read;
+    }
+
+    return offset;
+}
+
+/* Returns NULL without setting @error if the other end closed the pipe */
+GByteArray *
+session_frame_read (int fd, GError **error)
+{
+    guint32 length;
+    gssize n_read = read_all (fd, (guint8 *) &length, sizeof (length), error);
+    if (n_read <= 0)
+        return NULL;
+    if (n_read != sizeof (length))
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "Truncated frame header");
+        return NULL;
+    }
+    if (length > MAX_FRAME_LENGTH)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid frame length %u", length);
+        return NULL;
+    }
+
+    g_autoptr(GByteArray) frame = g_byte_array_sized_new (length);
+    g_byte_array_set_size (frame, length);
+    n_read = read_all (fd, frame->data, length, error);
+    if (n_read < 0)
+        return NULL;
+    if (n_read != length)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "Truncated frame, got %zi of %u bytes", n_read, length);
+        return NULL;
+    }
+
+    return g_steal_pointer (&frame);
+}
+
+void
+session_frame_reader_init (SessionFrameReader *reader, GByteArray *frame)
+{
+    reader->data = frame->data;
+    reader->length = frame->len;
+    reader->offset = 0;
+}
+
+gboolean
+session_frame_reader_get_data (SessionFrameReader *reader, void *buf, gsize count)
+{
+    if (reader->length - reader->offset < count)
+    {
+        memset (buf, 0, count);
+        reader->offset = reader->length;
+        return FALSE;
+    }
+
+    memcpy (buf, reader->data + reader->offset, count);
+    reader->offset += count;
+    return TRUE;
+}
+
+gchar *
+session_frame_reader_get_string_full (SessionFrameReader *reader, void *(*alloc_fn)(size_t n))
+{
+    int length;
+    if (!session_frame_reader_get_data (reader, &length, sizeof (length)))
+        return NULL;
+    if (length < 0)
+        return NULL;
+    if (length > MAX_STRING_LENGTH || length > reader->length - reader->offset)
+    {
+        g_warning ("Invalid string length %d in frame", length);
+        reader->offset = reader->length;
+        return NULL;
+    }
+
+    gchar *value = (*alloc_fn) (sizeof (gchar) * (length + 1));
+    memcpy (value, reader->data + reader->offset, length);
+    value[length] = '\0';
+    reader->offset += length;
+
+    return value;
+}
+
+gchar *
+session_frame_reader_get_string (SessionFrameReader *reader)
+{
+    return session_frame_reader_get_string_full (reader, g_malloc);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SESSION_FRAME_H_
+#define SESSION_FRAME_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Frames passed between the daemon and the session child, a length header followed by the payload */
+typedef struct
+{
+    const guint8 *data;
+    gsize length;
+    gsize offset;
+} SessionFrameReader;
+
+GByteArray *session_frame_new (void);
+
+void session_frame_add_data (GByteArray *frame, const void *buf, gsize count);
+
+void session_frame_add_string (GByteArray *frame, const gchar *value);
+
+gboolean session_frame_write (int fd, GByteArray *frame, GError **error);
+
+GByteArray *session_frame_read (int fd, GError **error);
+
+void session_frame_reader_init (SessionFrameReader *reader, GByteArray *frame);
+
+gboolean session_frame_reader_get_data (SessionFrameReader *reader, void *buf, gsize count);
+
+gchar *session_frame_reader_get_string_full (SessionFrameReader *reader, void *(*alloc_fn)(size_t n));
+
+gchar *session_frame_reader_get_string (SessionFrameReader *reader);
+
+G_END_DECLS
+
+#endif /* SESSION_FRAME_H_ */
@@ -16,18 +16,26 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <glib/gstdio.h>
 #include <grp.h>
 #include <pwd.h>
 
 #include "session.h"
+#include "accounting.h"
+#include "session-child.h"
+#include "session-frame.h"
+#include "environment.h"
 #include "configuration.h"
 #include "console-kit.h"
 #include "login1.h"
 #include "guest-account.h"
 #include "shared-data-manager.h"
 #include "greeter-socket.h"
+#include "login-trace.h"
+#include "metrics.h"
 
 enum {
     CREATE_GREETER,
@@ -40,6 +48,12 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 typedef struct
 {
+    /* Unique ID to identify this session in traces */
+    guint id;
+
+    /* Seat this session is on */
+    gchar *seat_name;
+
     /* Configuration for this session */
     SessionConfig *config;
 
@@ -49,11 +63,20 @@ typedef struct
     /* PID of child process */
     GPid pid;
 
+    /* Pool of idle session children to use */
+    SessionChildPool *child_pool;
+
+    /* Limits to apply to the session child and the processes it runs */
+    ResourceControl *resource_control;
+
     /* Pipes to talk to child */
     int to_child_input;
     int from_child_output;
     GIOChannel *from_child_channel;
     guint from_child_watch;
+
+    /* TRUE if the watch on the child is reading login records to write */
+    gboolean reading_account_records;
     guint child_watch;
 
     /* User to authenticate as */
@@ -74,6 +97,12 @@ typedef struct
     /* TRUE if can handle PAM prompts */
     gboolean is_interactive;
 
+    /* TRUE if the child should wait to try again after a failed authentication */
+    gboolean allow_retry;
+
+    /* TRUE if the child should keep the session open instead of running the command */
+    gboolean hold;
+
     /* Messages being requested by PAM */
     int messages_length;
     struct pam_message *messages;
@@ -84,6 +113,9 @@ typedef struct
     int authentication_result;
     gchar *authentication_result_string;
 
+    /* Time authentication started for metrics */
+    gint64 authentication_start_time;
+
     /* File to log to */
     gchar *log_filename;
     LogMode log_mode;
@@ -95,6 +127,8 @@ typedef struct
     gchar *xdisplay;
     XAuthority *x_authority;
     gboolean x_authority_use_system_location;
+    gboolean x_authority_use_runtime_dir;
+    gchar *x_authority_filename;
 
     /* Socket to allow greeters to connect to (if allowed) */
     GreeterSocket *greeter_socket;
@@ -109,22 +143,35 @@ typedef struct
     gchar *login1_session_id;
 
     /* Environment to set in child */
-    GList *env;
+    Environment *env;
 
     /* Command to run in child */
     gchar **argv;
 
+    /* Data being collected to write to the child in one go */
+    GByteArray *write_buffer;
+
     /* True if have run command */
     gboolean command_run;
 
     /* TRUE if stopping this session */
     gboolean stopping;
+
+    /* TRUE if the session processes have been stopped with session_freeze () */
+    gboolean frozen;
+
+    /* Resources used by the session child and the session it runs, as of the last sample */
+    ProcessUsage usage;
 } SessionPrivate;
 
 /* Maximum length of a string to pass between daemon and session */
 #define MAX_STRING_LENGTH 65535
 
+/* Last ID given to a session */
+static guint last_session_id = 0;
+
 static void session_logger_iface_init (LoggerInterface *iface);
+static gboolean read_account_record_frame (Session *session);
 
 G_DEFINE_TYPE_WITH_CODE (Session, session, G_TYPE_OBJECT,
                          G_ADD_PRIVATE (Session)
@@ -164,6 +211,55 @@ session_get_session_type (Session *session)
     return session_config_get_session_type (priv->config);
 }
 
+guint
+session_get_id (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, 0);
+    return priv->id;
+}
+
+GPid
+session_get_pid (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, 0);
+    return priv->pid;
+}
+
+void
+session_get_child_fds (Session *session, int *to_child_input, int *from_child_output)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    *to_child_input = priv->to_child_input;
+    *from_child_output = priv->from_child_output;
+}
+
+void
+session_set_seat_name (Session *session, const gchar *seat_name)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    g_free (priv->seat_name);
+    priv->seat_name = g_strdup (seat_name);
+}
+
+const gchar *
+session_get_seat_name (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, NULL);
+    return priv->seat_name;
+}
+
+static void
+trace (Session *session, LoginTracePoint point, const gchar *phase)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    login_trace (point, phase, priv->seat_name, priv->id);
+}
+
 void
 session_set_pam_service (Session *session, const gchar *pam_service)
 {
@@ -198,6 +294,22 @@ session_set_is_interactive (Session *session, gboolean is_interactive)
     priv->is_interactive = is_interactive;
 }
 
+void
+session_set_allow_retry (Session *session, gboolean allow_retry)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    priv->allow_retry = allow_retry;
+}
+
+void
+session_set_hold (Session *session, gboolean hold)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    priv->hold = hold;
+}
+
 void
 session_set_is_guest (Session *session, gboolean is_guest)
 {
@@ -224,6 +336,17 @@ session_set_log_file (Session *session, const gchar *filename, LogMode log_mode)
     priv->log_mode = log_mode;
 }
 
+void
+session_flush_log (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+
+    /* The session child holds the captured output */
+    if (priv->pid > 0 && priv->log_filename && config_get_integer (config_get_instance (), "LightDM", "log-capture-size") > 0)
+        kill (priv->pid, SIGUSR1);
+}
+
 void
 session_set_display_server (Session *session, DisplayServer *display_server)
 {
@@ -249,6 +372,28 @@ session_get_display_server (Session *session)
     return priv->display_server;
 }
 
+void
+session_set_child_pool (Session *session, SessionChildPool *pool)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    if (pool)
+        g_object_ref (pool);
+    g_clear_object (&priv->child_pool);
+    priv->child_pool = pool;
+}
+
+void
+session_set_resource_control (Session *session, ResourceControl *control)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    if (control)
+        g_object_ref (control);
+    g_clear_object (&priv->resource_control);
+    priv->resource_control = control;
+}
+
 void
 session_set_tty (Session *session, const gchar *tty)
 {
@@ -268,7 +413,7 @@ session_set_xdisplay (Session *session, const gchar *xdisplay)
 }
 
 void
-session_set_x_authority (Session *session, XAuthority *authority, gboolean use_system_location)
+session_set_x_authority (Session *session, XAuthority *authority, gboolean use_system_location, gboolean use_runtime_dir)
 {
     SessionPrivate *priv = session_get_instance_private (session);
     g_return_if_fail (session != NULL);
@@ -276,6 +421,15 @@ session_set_x_authority (Session *session, XAuthority *authority, gboolean use_s
     if (authority)
         priv->x_authority = g_object_ref (authority);
     priv->x_authority_use_system_location = use_system_location;
+    priv->x_authority_use_runtime_dir = use_runtime_dir;
+}
+
+const gchar *
+session_get_x_authority_filename (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, NULL);
+    return priv->x_authority_filename;
 }
 
 void
@@ -287,22 +441,6 @@ session_set_remote_host_name (Session *session, const gchar *remote_host_name)
     priv->remote_host_name = g_strdup (remote_host_name);
 }
 
-static GList *
-find_env_entry (Session *session, const gchar *name)
-{
-    SessionPrivate *priv = session_get_instance_private (session);
-
-    for (GList *link = priv->env; link; link = link->next)
-    {
-        const gchar *entry = link->data;
-
-        if (g_str_has_prefix (entry, name) && entry[strlen (name)] == '=')
-            return link;
-    }
-
-    return NULL;
-}
-
 void
 session_set_env (Session *session, const gchar *name, const gchar *value)
 {
@@ -311,28 +449,15 @@ session_set_env (Session *session, const gchar *name, const gchar *value)
     g_return_if_fail (session != NULL);
     g_return_if_fail (value != NULL);
 
-    gchar *entry = g_strdup_printf ("%s=%s", name, value);
-
-    GList *link = find_env_entry (session, name);
-    if (link)
-    {
-        g_free (link->data);
-        link->data = entry;
-    }
-    else
-        priv->env = g_list_append (priv->env, entry);
+    environment_set (priv->env, name, value);
 }
 
 const gchar *
 session_get_env (Session *session, const gchar *name)
 {
-    GList *link = find_env_entry (session, name);
-    if (!link)
-        return NULL;
-
-    gchar *entry = link->data;
-
-    return entry + strlen (name) + 1;
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, NULL);
+    return environment_get (priv->env, name);
 }
 
 void
@@ -342,12 +467,7 @@ session_unset_env (Session *session, const gchar *name)
 
     g_return_if_fail (session != NULL);
 
-    GList *link = find_env_entry (session, name);
-    if (!link)
-        return;
-
-    g_free (link->data);
-    priv->env = g_list_delete_link (priv->env, link);
+    environment_unset (priv->env, name);
 }
 
 void
@@ -378,10 +498,50 @@ static void
 write_data (Session *session, const void *buf, size_t count)
 {
     SessionPrivate *priv = session_get_instance_private (session);
+
+    if (priv->write_buffer)
+    {
+        g_byte_array_append (priv->write_buffer, buf, count);
+        return;
+    }
+
     if (write (priv->to_child_input, buf, count) != count)
         l_warning (session, "Error writing to session: %s", strerror (errno));
 }
 
+/* Collect writes so a whole message goes to the child in one write */
+static void
+begin_writes (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    if (!priv->write_buffer)
+        priv->write_buffer = g_byte_array_sized_new (1024);
+}
+
+static void
+flush_writes (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_autoptr(GByteArray) buffer = g_steal_pointer (&priv->write_buffer);
+    if (!buffer)
+        return;
+
+    gsize offset = 0;
+    while (offset < buffer->len)
+    {
+        ssize_t n_written = write (priv->to_child_input, buffer->data + offset, buffer->len - offset);
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            l_warning (session, "Error writing to session: %s", strerror (errno));
+            return;
+        }
+        offset += n_written;
+    }
+}
+
 static void
 write_string (Session *session, const char *value)
 {
@@ -391,6 +551,15 @@ write_string (Session *session, const char *value)
         write_data (session, value, sizeof (char) * length);
 }
 
+static void
+write_frame (Session *session, GByteArray *frame)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_autoptr(GError) error = NULL;
+    if (!session_frame_write (priv->to_child_input, frame, &error))
+        l_warning (session, "Error writing to session: %s", error->message);
+}
+
 static void
 write_xauth (Session *session, XAuthority *x_authority)
 {
@@ -454,6 +623,13 @@ session_watch_cb (GPid pid, gint status, gpointer data)
 
     priv->child_watch = 0;
 
+    /* Take the logout record the child wrote before exiting */
+    if (priv->reading_account_records && priv->from_child_watch)
+    {
+        struct pollfd poll_fd = { priv->from_child_output, POLLIN, 0 };
+        while (poll (&poll_fd, 1, 0) > 0 && (poll_fd.revents & POLLIN) && read_account_record_frame (session));
+    }
+
     if (WIFEXITED (status))
         l_debug (session, "Exited with return value %d", WEXITSTATUS (status));
     else if (WIFSIGNALED (status))
@@ -483,6 +659,74 @@ session_watch_cb (GPid pid, gint status, gpointer data)
     g_object_unref (session);
 }
 
+/* Queue a wtmp/btmp record from the child, see log_account () in session-child.c */
+static void
+read_account_record (Session *session, SessionFrameReader *reader)
+{
+    g_autofree gchar *wtmp_file = session_frame_reader_get_string (reader);
+    struct utmpx ut;
+    AccountingEvent event = ACCOUNTING_EVENT_NONE;
+    uid_t uid = -1;
+    gboolean success = FALSE;
+    g_autofree gchar *username = NULL;
+    g_autofree gchar *remote_host_name = NULL;
+    g_autofree gchar *tty = NULL;
+    gboolean valid = session_frame_reader_get_data (reader, &ut, sizeof (ut)) &&
+                     session_frame_reader_get_data (reader, &event, sizeof (event));
+    if (valid)
+    {
+        username = session_frame_reader_get_string (reader);
+        valid = session_frame_reader_get_data (reader, &uid, sizeof (uid));
+    }
+    if (valid)
+    {
+        remote_host_name = session_frame_reader_get_string (reader);
+        tty = session_frame_reader_get_string (reader);
+        valid = session_frame_reader_get_data (reader, &success, sizeof (success));
+    }
+    if (!valid || (g_strcmp0 (wtmp_file, "/var/log/wtmp") != 0 && g_strcmp0 (wtmp_file, "/var/log/btmp") != 0))
+    {
+        l_warning (session, "Invalid login record from child");
+        return;
+    }
+
+    accounting_add (wtmp_file, &ut, event, username, uid, remote_host_name, tty, success);
+}
+
+static gboolean
+read_account_record_frame (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GByteArray) frame = session_frame_read (priv->from_child_output, &error);
+    if (error)
+        l_debug (session, "Error reading from child: %s", error->message);
+    if (!frame)
+        return FALSE;
+
+    SessionFrameReader reader;
+    session_frame_reader_init (&reader, frame);
+    read_account_record (session, &reader);
+
+    return TRUE;
+}
+
+static gboolean
+account_records_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    Session *session = data;
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    if (!(condition & G_IO_IN) || !read_account_record_frame (session))
+    {
+        priv->from_child_watch = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static gboolean
 from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
 {
@@ -496,8 +740,21 @@ from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
         return FALSE;
     }
 
+    /* Each round of the conversation arrives as a single frame */
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GByteArray) frame = session_frame_read (priv->from_child_output, &error);
+    if (error)
+        l_debug (session, "Error reading from child: %s", error->message);
+    if (!frame)
+    {
+        priv->from_child_watch = 0;
+        return FALSE;
+    }
+    SessionFrameReader reader;
+    session_frame_reader_init (&reader, frame);
+
     /* Get the username currently being authenticated (may change during authentication) */
-    g_autofree gchar *username = read_string_from_child (session);
+    g_autofree gchar *username = session_frame_reader_get_string (&reader);
     if (g_strcmp0 (username, priv->username) != 0)
     {
         g_free (priv->username);
@@ -506,12 +763,10 @@ from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
     }
 
     /* Check if authentication completed */
-    gboolean auth_complete;
-    ssize_t n_read = read_from_child (session, &auth_complete, sizeof (auth_complete));
-    if (n_read < 0)
-        l_debug (session, "Error reading from child: %s", strerror (errno));
-    if (n_read <= 0)
+    gboolean auth_complete = FALSE;
+    if (!session_frame_reader_get_data (&reader, &auth_complete, sizeof (auth_complete)))
     {
+        l_warning (session, "Invalid conversation frame from child");
         priv->from_child_watch = 0;
         return FALSE;
     }
@@ -519,11 +774,23 @@ from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
     if (auth_complete)
     {
         priv->authentication_complete = TRUE;
-        read_from_child (session, &priv->authentication_result, sizeof (priv->authentication_result));
+        session_frame_reader_get_data (&reader, &priv->authentication_result, sizeof (priv->authentication_result));
         g_free (priv->authentication_result_string);
-        priv->authentication_result_string = read_string_from_child (session);
+        priv->authentication_result_string = session_frame_reader_get_string (&reader);
+
+        /* A failed login is recorded by the daemon when batching login records */
+        gboolean have_record = FALSE;
+        if (session_frame_reader_get_data (&reader, &have_record, sizeof (have_record)) && have_record)
+            read_account_record (session, &reader);
 
         l_debug (session, "Authentication complete with return value %d: %s", priv->authentication_result, priv->authentication_result_string);
+        trace (session, LOGIN_TRACE_END, "authentication");
+        if (priv->do_authenticate)
+        {
+            common_metrics_add ("lightdm_authentication_attempts_total",
+                                priv->authentication_result == PAM_SUCCESS ? "result=\"success\"" : "result=\"failure\"", 1);
+            common_metrics_observe_since ("lightdm_authentication_duration_seconds", NULL, priv->authentication_start_time);
+        }
 
         /* No longer expect any more messages */
         priv->from_child_watch = 0;
@@ -535,13 +802,19 @@ from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
     else
     {
         priv->messages_length = 0;
-        read_from_child (session, &priv->messages_length, sizeof (priv->messages_length));
+        session_frame_reader_get_data (&reader, &priv->messages_length, sizeof (priv->messages_length));
+        /* Each message takes at least a style and a string length */
+        if (priv->messages_length < 0 || (gsize) priv->messages_length > (reader.length - reader.offset) / (sizeof (int) * 2))
+        {
+            l_warning (session, "Invalid message count %d from child", priv->messages_length);
+            priv->messages_length = 0;
+        }
         priv->messages = calloc (priv->messages_length, sizeof (struct pam_message));
         for (int i = 0; i < priv->messages_length; i++)
         {
             struct pam_message *m = &priv->messages[i];
-            read_from_child (session, &m->msg_style, sizeof (m->msg_style));
-            m->msg = read_string_from_child (session);
+            session_frame_reader_get_data (&reader, &m->msg_style, sizeof (m->msg_style));
+            m->msg = session_frame_reader_get_string (&reader);
         }
 
         l_debug (session, "Got %d message(s) from PAM", priv->messages_length);
@@ -566,6 +839,17 @@ session_get_is_started (Session *session)
     return priv->pid != 0;
 }
 
+/* The child is reaped by GLib, so once it has stopped this is the last sample taken */
+const ProcessUsage *
+session_get_usage (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, NULL);
+    if (priv->pid > 0)
+        process_usage_read (priv->pid, &priv->usage);
+    return &priv->usage;
+}
+
 static Greeter *
 create_greeter_cb (GreeterSocket *socket, Session *session)
 {
@@ -575,61 +859,21 @@ create_greeter_cb (GreeterSocket *socket, Session *session)
 }
 
 static gboolean
-session_real_start (Session *session)
+start_child (Session *session)
 {
     SessionPrivate *priv = session_get_instance_private (session);
 
-    g_return_val_if_fail (priv->pid == 0, FALSE);
-
-    if (priv->display_server)
-        display_server_connect_session (priv->display_server, session);
-
-    /* Create pipes to talk to the child */
-    int to_child_pipe[2], from_child_pipe[2];
-    if (pipe (to_child_pipe) < 0 || pipe (from_child_pipe) < 0)
-    {
-        g_warning ("Failed to create pipe to communicate with session process: %s", strerror (errno));
+    /* Use an already running child if one is available */
+    GPid pid;
+    if (!(priv->child_pool && session_child_pool_take (priv->child_pool, &pid, &priv->to_child_input, &priv->from_child_output)) &&
+        !session_child_spawn (&pid, &priv->to_child_input, &priv->from_child_output))
         return FALSE;
-    }
-    int to_child_output = to_child_pipe[0];
-    priv->to_child_input = to_child_pipe[1];
-    priv->from_child_output = from_child_pipe[0];
-    int from_child_input = from_child_pipe[1];
+    priv->pid = pid;
+    if (priv->resource_control)
+        resource_control_apply (priv->resource_control, pid);
     priv->from_child_channel = g_io_channel_unix_new (priv->from_child_output);
     priv->from_child_watch = g_io_add_watch (priv->from_child_channel, G_IO_IN | G_IO_HUP, from_child_cb, session);
 
-    /* Don't allow the daemon end of the pipes to be accessed in child processes */
-    fcntl (priv->to_child_input, F_SETFD, FD_CLOEXEC);
-    fcntl (priv->from_child_output, F_SETFD, FD_CLOEXEC);
-
-    /* Create the guest account if it is one */
-    if (priv->is_guest && priv->username == NULL)
-    {
-        priv->username = guest_account_setup ();
-        if (!priv->username)
-            return FALSE;
-    }
-
-    /* Run the child */
-    g_autofree gchar *arg0 = g_strdup_printf ("%d", to_child_output);
-    g_autofree gchar *arg1 = g_strdup_printf ("%d", from_child_input);
-    priv->pid = fork ();
-    if (priv->pid == 0)
-    {
-        /* Run us again in session child mode */
-        execlp ("lightdm",
-                "lightdm",
-                "--session-child",
-                arg0, arg1, NULL);
-        _exit (EXIT_FAILURE);
-    }
-
-    if (priv->pid < 0)
-    {
-        g_debug ("Failed to fork session child process: %s", strerror (errno));
-        return FALSE;
-    }
-
     /* Hold a reference on this object until the child process terminates so we
      * can handle the watch callback even if it is no longer used. Otherwise a
      * zombie process will remain */
@@ -639,12 +883,9 @@ session_real_start (Session *session)
     priv->authentication_started = TRUE;
     priv->child_watch = g_child_watch_add (priv->pid, session_watch_cb, session);
 
-    /* Close the ends of the pipes we don't need */
-    close (to_child_output);
-    close (from_child_input);
-
     /* Indicate what version of the protocol we are using */
-    int version = 3;
+    begin_writes (session);
+    int version = 6;
     write_data (session, &version, sizeof (version));
 
     /* Send configuration */
@@ -657,12 +898,118 @@ session_real_start (Session *session)
     write_string (session, priv->remote_host_name);
     write_string (session, priv->xdisplay);
     write_xauth (session, priv->x_authority);
+    write_data (session, &priv->allow_retry, sizeof (priv->allow_retry));
+    write_data (session, &priv->hold, sizeof (priv->hold));
+    flush_writes (session);
 
     l_debug (session, "Started with service '%s', username '%s'", priv->pam_service, priv->username);
+    trace (session, LOGIN_TRACE_BEGIN, "authentication");
+    priv->authentication_start_time = g_get_monotonic_time ();
 
     return TRUE;
 }
 
+static void
+guest_account_setup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(Session) session = data;
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *username = guest_account_setup_finish (result, &error);
+    trace (session, LOGIN_TRACE_END, "guest-account-setup");
+    if (error)
+        l_warning (session, "Failed to set up guest account: %s", error->message);
+
+    /* Stopped while waiting for the account */
+    if (priv->stopping)
+    {
+        if (username)
+            guest_account_cleanup (username);
+        return;
+    }
+
+    if (username)
+    {
+        priv->username = g_steal_pointer (&username);
+        if (start_child (session))
+            return;
+        guest_account_cleanup (priv->username);
+    }
+
+    /* Report the failure the same way as a failed authentication */
+    priv->authentication_started = TRUE;
+    priv->authentication_complete = TRUE;
+    priv->authentication_result = PAM_SYSTEM_ERR;
+    g_free (priv->authentication_result_string);
+    priv->authentication_result_string = g_strdup ("Failed to set up guest account");
+    g_signal_emit (G_OBJECT (session), signals[AUTHENTICATION_COMPLETE], 0);
+}
+
+static gboolean
+session_real_start (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_val_if_fail (priv->pid == 0, FALSE);
+
+    if (priv->display_server)
+        display_server_connect_session (priv->display_server, session);
+
+    /* Create the guest account if it is one, this runs a script so don't block while it does */
+    if (priv->is_guest && priv->username == NULL)
+    {
+        trace (session, LOGIN_TRACE_BEGIN, "guest-account-setup");
+        guest_account_setup_async (guest_account_setup_cb, g_object_ref (session));
+        return TRUE;
+    }
+
+    return start_child (session);
+}
+
+/* Take over a session child that was already running its command before the daemon re-executed itself */
+void
+session_adopt (Session *session, GPid pid, int to_child_input, int from_child_output,
+               const gchar *username, const gchar *login1_session_id, const gchar *console_kit_cookie)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+    g_return_if_fail (priv->pid == 0);
+
+    priv->pid = pid;
+    priv->to_child_input = to_child_input;
+    priv->from_child_output = from_child_output;
+    priv->from_child_channel = g_io_channel_unix_new (priv->from_child_output);
+    g_free (priv->username);
+    priv->username = g_strdup (username);
+    g_clear_object (&priv->user);
+    priv->login1_session_id = g_strdup (login1_session_id);
+    priv->console_kit_cookie = g_strdup (console_kit_cookie);
+
+    /* It got this far by authenticating and running */
+    priv->authentication_started = TRUE;
+    priv->authentication_complete = TRUE;
+    priv->authentication_result = PAM_SUCCESS;
+    priv->authentication_result_string = g_strdup ("Success");
+    priv->command_run = TRUE;
+
+    if (priv->display_server)
+        display_server_connect_session (priv->display_server, session);
+
+    /* Held until the child exits, as in start_child () */
+    g_object_ref (session);
+    priv->child_watch = g_child_watch_add (priv->pid, session_watch_cb, session);
+
+    if (accounting_get_enabled ())
+    {
+        priv->reading_account_records = TRUE;
+        priv->from_child_watch = g_io_add_watch (priv->from_child_channel, G_IO_IN | G_IO_HUP, account_records_cb, session);
+    }
+
+    l_debug (session, "Took over session child %d for %s", pid, username);
+}
+
 const gchar *
 session_get_username (Session *session)
 {
@@ -694,13 +1041,15 @@ session_respond (Session *session, struct pam_response *response)
 
     g_return_if_fail (session != NULL);
 
+    g_autoptr(GByteArray) frame = session_frame_new ();
     int error = PAM_SUCCESS;
-    write_data (session, &error, sizeof (error));
+    session_frame_add_data (frame, &error, sizeof (error));
     for (int i = 0; i < priv->messages_length; i++)
     {
-        write_string (session, response[i].resp);
-        write_data (session, &response[i].resp_retcode, sizeof (response[i].resp_retcode));
+        session_frame_add_string (frame, response[i].resp);
+        session_frame_add_data (frame, &response[i].resp_retcode, sizeof (response[i].resp_retcode));
     }
+    write_frame (session, frame);
 
     /* Delete the old messages */
     for (int i = 0; i < priv->messages_length; i++)
@@ -710,13 +1059,42 @@ session_respond (Session *session, struct pam_response *response)
     priv->messages_length = 0;
 }
 
+gboolean
+session_retry_authentication (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_val_if_fail (session != NULL, FALSE);
+
+    /* Only a child waiting after a wrong password can try again */
+    if (!priv->allow_retry || priv->stopping || priv->pid == 0 ||
+        !priv->authentication_complete || priv->authentication_result != PAM_AUTH_ERR)
+        return FALSE;
+
+    priv->authentication_complete = FALSE;
+    priv->authentication_result = 0;
+    g_clear_pointer (&priv->authentication_result_string, g_free);
+
+    int command = SESSION_CHILD_COMMAND_RETRY;
+    write_data (session, &command, sizeof (command));
+    priv->from_child_watch = g_io_add_watch (priv->from_child_channel, G_IO_IN | G_IO_HUP, from_child_cb, session);
+
+    l_debug (session, "Retrying authentication");
+    trace (session, LOGIN_TRACE_BEGIN, "authentication");
+    priv->authentication_start_time = g_get_monotonic_time ();
+
+    return TRUE;
+}
+
 void
 session_respond_error (Session *session, int error)
 {
     g_return_if_fail (session != NULL);
     g_return_if_fail (error != PAM_SUCCESS);
 
-    write_data (session, &error, sizeof (error));
+    g_autoptr(GByteArray) frame = session_frame_new ();
+    session_frame_add_data (frame, &error, sizeof (error));
+    write_frame (session, frame);
 }
 
 int
@@ -793,9 +1171,10 @@ session_real_run (Session *session)
 
     g_autofree gchar *command = g_strjoinv (" ", priv->argv);
     l_debug (session, "Running command %s", command);
+    trace (session, LOGIN_TRACE_BEGIN, "session-open");
 
     /* Create authority location */
-    g_autofree gchar *x_authority_filename = NULL;
+    g_clear_pointer (&priv->x_authority_filename, g_free);
     if (priv->x_authority_use_system_location)
     {
         g_autofree gchar *run_dir = config_get_string (config_get_instance (), "LightDM", "run-directory");
@@ -809,10 +1188,10 @@ session_real_run (Session *session)
                 l_warning (session, "Failed to set ownership of user authority dir: %s", strerror (errno));
         }
 
-        x_authority_filename = g_build_filename (dir, "xauthority", NULL);
+        priv->x_authority_filename = g_build_filename (dir, "xauthority", NULL);
     }
     else
-        x_authority_filename = g_build_filename (user_get_home_directory (session_get_user (session)), ".Xauthority", NULL);
+        priv->x_authority_filename = g_build_filename (user_get_home_directory (session_get_user (session)), ".Xauthority", NULL);
 
     /* Make sure shared user directory for this user exists */
     if (!priv->remote_host_name)
@@ -838,6 +1217,7 @@ session_real_run (Session *session)
 
         g_autofree gchar *path = g_build_filename (dir, "greeter-socket", NULL);
         priv->greeter_socket = greeter_socket_new (path);
+        greeter_socket_set_max_greeters (priv->greeter_socket, MAX (config_get_integer (config_get_instance (), "LightDM", "max-session-greeters"), 1));
         g_signal_connect (priv->greeter_socket, GREETER_SOCKET_SIGNAL_CREATE_GREETER, G_CALLBACK (create_greeter_cb), session);
         session_set_env (session, "LIGHTDM_GREETER_PIPE", path);
 
@@ -848,23 +1228,35 @@ session_real_run (Session *session)
 
     if (priv->log_filename)
         l_debug (session, "Logging to %s", priv->log_filename);
+    begin_writes (session);
     write_string (session, priv->log_filename);
     write_data (session, &priv->log_mode, sizeof (priv->log_mode));
     write_string (session, priv->tty);
-    write_string (session, x_authority_filename);
+    write_string (session, priv->x_authority_filename);
+    write_data (session, &priv->x_authority_use_runtime_dir, sizeof (priv->x_authority_use_runtime_dir));
     write_string (session, priv->xdisplay);
     write_xauth (session, priv->x_authority);
-    gsize argc = g_list_length (priv->env);
+    gsize argc = environment_get_length (priv->env);
     write_data (session, &argc, sizeof (argc));
-    for (GList *link = priv->env; link; link = link->next)
-        write_string (session, (gchar *) link->data);
+    for (const gchar * const *e = environment_get_envp (priv->env); *e; e++)
+        write_string (session, *e);
     argc = g_strv_length (priv->argv);
     write_data (session, &argc, sizeof (argc));
     for (gsize i = 0; i < argc; i++)
         write_string (session, priv->argv[i]);
+    flush_writes (session);
 
+    /* The child replies once PAM has opened the session and it is registered */
     priv->login1_session_id = read_string_from_child (session);
     priv->console_kit_cookie = read_string_from_child (session);
+    trace (session, LOGIN_TRACE_END, "session-open");
+
+    /* The child then sends its login records for us to write */
+    if (accounting_get_enabled ())
+    {
+        priv->reading_account_records = TRUE;
+        priv->from_child_watch = g_io_add_watch (priv->from_child_channel, G_IO_IN | G_IO_HUP, account_records_cb, session);
+    }
 }
 
 void
@@ -908,13 +1300,54 @@ session_activate (Session *session)
 
     if (getuid () == 0)
     {
+        trace (session, LOGIN_TRACE_BEGIN, "activate");
         if (priv->login1_session_id)
             login1_service_activate_session (login1_service_get_instance (), priv->login1_session_id);
         else if (priv->console_kit_cookie)
             ck_activate_session (priv->console_kit_cookie);
+        trace (session, LOGIN_TRACE_END, "activate");
     }
 }
 
+void
+session_freeze (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+
+    if (priv->frozen || priv->stopping || priv->pid <= 0)
+        return;
+
+    l_debug (session, "Freezing session");
+    priv->frozen = TRUE;
+    kill (priv->pid, SIGTSTP);
+}
+
+void
+session_thaw (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+
+    if (!priv->frozen)
+        return;
+
+    l_debug (session, "Thawing session");
+    priv->frozen = FALSE;
+    if (priv->pid > 0)
+        kill (priv->pid, SIGCONT);
+}
+
+gboolean
+session_get_is_frozen (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, FALSE);
+    return priv->frozen;
+}
+
 void
 session_stop (Session *session)
 {
@@ -924,6 +1357,10 @@ session_stop (Session *session)
 
     if (priv->stopping)
         return;
+
+    /* A stopped process won't act on SIGTERM */
+    session_thaw (session);
+
     priv->stopping = TRUE;
 
     /* Kill remaining processes in our logind session to avoid them leaking
@@ -935,6 +1372,7 @@ session_stop (Session *session)
     if (session_get_is_authenticated (session) && !priv->command_run)
     {
         priv->command_run = TRUE;
+        begin_writes (session);
         write_string (session, NULL); // log filename
         LogMode log_mode = LOG_MODE_INVALID;
         write_data (session, &log_mode, sizeof (log_mode)); // log mode
@@ -945,6 +1383,7 @@ session_stop (Session *session)
         gsize n = 0;
         write_data (session, &n, sizeof (n)); // environment
         write_data (session, &n, sizeof (n)); // command
+        flush_writes (session);
         return;
     }
 
@@ -968,6 +1407,21 @@ session_real_stop (Session *session)
         g_signal_emit (G_OBJECT (session), signals[STOPPED], 0);
 }
 
+void
+session_kill (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+
+    if (priv->pid <= 0)
+        return;
+
+    session_thaw (session);
+    l_debug (session, "Sending SIGKILL");
+    kill (priv->pid, SIGKILL);
+}
+
 gboolean
 session_get_is_stopping (Session *session)
 {
@@ -981,10 +1435,12 @@ session_init (Session *session)
 {
     SessionPrivate *priv = session_get_instance_private (session);
 
+    priv->id = ++last_session_id;
     priv->log_filename = g_strdup (".xsession-errors");
     priv->log_mode = LOG_MODE_BACKUP_AND_TRUNCATE;
     priv->to_child_input = -1;
     priv->from_child_output = -1;
+    priv->env = environment_new ();
 }
 
 static void
@@ -993,7 +1449,10 @@ session_finalize (GObject *object)
     Session *self = SESSION (object);
     SessionPrivate *priv = session_get_instance_private (self);
 
+    g_free (priv->seat_name);
     g_clear_object (&priv->config);
+    g_clear_object (&priv->child_pool);
+    g_clear_object (&priv->resource_control);
     g_clear_object (&priv->display_server);
     if (priv->pid)
         kill (priv->pid, SIGKILL);
@@ -1014,11 +1473,15 @@ session_finalize (GObject *object)
     g_clear_pointer (&priv->log_filename, g_free);
     g_clear_pointer (&priv->tty, g_free);
     g_clear_pointer (&priv->xdisplay, g_free);
+    g_clear_pointer (&priv->x_authority_filename, g_free);
     g_clear_object (&priv->x_authority);
     g_clear_pointer (&priv->remote_host_name, g_free);
     g_clear_pointer (&priv->login1_session_id, g_free);
+    if (priv->console_kit_cookie)
+        ck_forget_session (priv->console_kit_cookie);
     g_clear_pointer (&priv->console_kit_cookie, g_free);
-    g_list_free_full (priv->env, g_free);
+    g_clear_pointer (&priv->env, environment_free);
+    g_clear_pointer (&priv->write_buffer, g_byte_array_unref);
     g_clear_pointer (&priv->argv, g_strfreev);
 
     G_OBJECT_CLASS (session_parent_class)->finalize (object);
@@ -1088,4 +1551,5 @@ static void
 session_logger_iface_init (LoggerInterface *iface)
 {
     iface->logprefix = &session_real_logprefix;
+    iface->subsystem = LOG_SUBSYSTEM_SESSION;
 }
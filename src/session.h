@@ -31,6 +31,9 @@ typedef enum
 #include "logger.h"
 #include "log-file.h"
 #include "greeter.h"
+#include "session-child-pool.h"
+#include "resource-control.h"
+#include "process-usage.h"
 
 G_BEGIN_DECLS
 
@@ -75,6 +78,16 @@ SessionConfig *session_get_config (Session *session);
 
 const gchar *session_get_session_type (Session *session);
 
+guint session_get_id (Session *session);
+
+GPid session_get_pid (Session *session);
+
+void session_get_child_fds (Session *session, int *to_child_input, int *from_child_output);
+
+void session_set_seat_name (Session *session, const gchar *seat_name);
+
+const gchar *session_get_seat_name (Session *session);
+
 void session_set_pam_service (Session *session, const gchar *pam_service);
 
 void session_set_username (Session *session, const gchar *username);
@@ -83,21 +96,33 @@ void session_set_do_authenticate (Session *session, gboolean do_authenticate);
 
 void session_set_is_interactive (Session *session, gboolean is_interactive);
 
+void session_set_allow_retry (Session *session, gboolean allow_retry);
+
+void session_set_hold (Session *session, gboolean hold);
+
 void session_set_is_guest (Session *session, gboolean is_guest);
 
 gboolean session_get_is_guest (Session *session);
 
 void session_set_log_file (Session *session, const gchar *filename, LogMode log_mode);
 
+void session_flush_log (Session *session);
+
 void session_set_display_server (Session *session, DisplayServer *display_server);
 
 DisplayServer *session_get_display_server (Session *session);
 
+void session_set_child_pool (Session *session, SessionChildPool *pool);
+
+void session_set_resource_control (Session *session, ResourceControl *control);
+
 void session_set_tty (Session *session, const gchar *tty);
 
 void session_set_xdisplay (Session *session, const gchar *xdisplay);
 
-void session_set_x_authority (Session *session, XAuthority *authority, gboolean use_system_location);
+void session_set_x_authority (Session *session, XAuthority *authority, gboolean use_system_location, gboolean use_runtime_dir);
+
+const gchar *session_get_x_authority_filename (Session *session);
 
 void session_set_remote_host_name (Session *session, const gchar *remote_host_name);
 
@@ -116,6 +141,11 @@ gboolean session_start (Session *session);
 
 gboolean session_get_is_started (Session *session);
 
+void session_adopt (Session *session, GPid pid, int to_child_input, int from_child_output,
+                    const gchar *username, const gchar *login1_session_id, const gchar *console_kit_cookie);
+
+const ProcessUsage *session_get_usage (Session *session);
+
 const gchar *session_get_username (Session *session);
 
 const gchar *session_get_login1_session_id (Session *session);
@@ -126,6 +156,8 @@ void session_respond (Session *session, struct pam_response *response);
 
 void session_respond_error (Session *session, int error);
 
+gboolean session_retry_authentication (Session *session);
+
 int session_get_messages_length (Session *session);
 
 const struct pam_message *session_get_messages (Session *session);
@@ -146,8 +178,16 @@ void session_unlock (Session *session);
 
 void session_activate (Session *session);
 
+void session_freeze (Session *session);
+
+void session_thaw (Session *session);
+
+gboolean session_get_is_frozen (Session *session);
+
 void session_stop (Session *session);
 
+void session_kill (Session *session);
+
 gboolean session_get_is_stopping (Session *session);
 
 G_END_DECLS
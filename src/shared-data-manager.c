@@ -10,24 +10,88 @@
  */
 
 #include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <locale.h>
 #include <pwd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include "configuration.h"
+#include "locale-names.h"
+#include "nss.h"
+#include "session-index.h"
 #include "shared-data-manager.h"
 #include "user-list.h"
 
 #define NUM_ENUMERATION_FILES 100
 
+/* Time to wait for the user list to settle before writing a snapshot */
+#define USER_LIST_SNAPSHOT_DELAY 1
+
+/* Time to wait for session files to settle before writing a snapshot */
+#define SESSIONS_SNAPSHOT_DELAY 1
+
+/* Time in milliseconds to wait between deleting unused user directories */
+#define DELETE_DELAY_MS 250
+
+/* Largest avatar or background that is copied for greeters */
+#define MAX_CACHED_IMAGE_SIZE (8 * 1024 * 1024)
+
+/* Cached images are only readable by the greeter group */
+#define CACHED_IMAGE_MODE (S_IRUSR | S_IWUSR | S_IRGRP)
+
+/* State of a directory when it was last checked */
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+} VerifiedDir;
+
 typedef struct
 {
     gchar *greeter_user;
     guint32 greeter_gid;
     GHashTable *starting_dirs;
+
+    /* Directories known to be correct, keyed by user name.  Written by worker threads */
+    GMutex verified_dirs_lock;
+    GHashTable *verified_dirs;
+
+    /* Users whose directories are waiting to be deleted, one is deleted at a time */
+    GQueue *delete_queue;
+    GPid delete_pid;
+    guint delete_timeout;
+
+    /* Timeout to write the user list snapshot */
+    guint user_list_snapshot_timeout;
+
+    /* Timeout to write the sessions snapshot */
+    guint sessions_snapshot_timeout;
+
+    /* TRUE while images are being copied, and if they need copying again after */
+    gboolean image_cache_running;
+    gboolean image_cache_pending;
 } SharedDataManagerPrivate;
 
+/* Directory to be created or repaired */
+typedef struct
+{
+    SharedDataManager *manager;
+    gchar *user;
+    gchar *path;
+    uid_t uid;
+    gid_t gid;
+} EnsureDirRequest;
+
 struct OwnerInfo
 {
     SharedDataManager *manager;
@@ -38,6 +102,8 @@ G_DEFINE_TYPE_WITH_PRIVATE (SharedDataManager, shared_data_manager, G_TYPE_OBJEC
 
 static SharedDataManager *singleton = NULL;
 
+static void update_image_cache (SharedDataManager *manager);
+
 SharedDataManager *
 shared_data_manager_get_instance (void)
 {
@@ -52,73 +118,282 @@ shared_data_manager_cleanup (void)
     g_clear_object (&singleton);
 }
 
+static void forget_user_dir (SharedDataManager *manager, const gchar *user);
+static void start_next_delete (SharedDataManager *manager);
+
+static gboolean
+delete_timeout_cb (gpointer data)
+{
+    SharedDataManager *manager = data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    priv->delete_timeout = 0;
+    start_next_delete (manager);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+delete_exited_cb (GPid pid, gint status, gpointer data)
+{
+    SharedDataManager *manager = data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    g_spawn_close_pid (pid);
+    priv->delete_pid = 0;
+
+    /* Space out the deletions so they don't compete with starting sessions */
+    if (!g_queue_is_empty (priv->delete_queue))
+        priv->delete_timeout = g_timeout_add (DELETE_DELAY_MS, delete_timeout_cb, manager);
+
+    g_object_unref (manager);
+}
+
+static void
+start_next_delete (SharedDataManager *manager)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    while (priv->delete_pid == 0 && priv->delete_timeout == 0 && !g_queue_is_empty (priv->delete_queue))
+    {
+        g_autofree gchar *user = g_queue_pop_head (priv->delete_queue);
+
+        /* For this operation, we just need a fire and forget rm -rf.  Since
+           recursively deleting in GIO is a huge pain in the butt, we'll just drop
+           to shell for this. */
+        g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
+        gchar *argv[] = { "/bin/rm", "-rf", path, NULL };
+
+        g_debug ("Deleting unused user data directory %s", path);
+        g_autoptr(GError) error = NULL;
+        GPid pid;
+        if (!g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error))
+        {
+            g_warning ("Could not delete unused user data directory %s: %s", path, error->message);
+            continue;
+        }
+
+        priv->delete_pid = pid;
+        g_child_watch_add (pid, delete_exited_cb, g_object_ref (manager));
+    }
+}
+
 static void
 delete_unused_user (gpointer key, gpointer value, gpointer user_data)
 {
     const gchar *user = (const gchar *)key;
+    SharedDataManager *manager = user_data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
 
-    /* For this operation, we just need a fire and forget rm -rf.  Since
-       recursively deleting in GIO is a huge pain in the butt, we'll just drop
-       to shell for this. */
+    forget_user_dir (manager, user);
+    g_queue_push_tail (priv->delete_queue, g_strdup (user));
+    start_next_delete (manager);
+}
 
-    g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
-    g_autofree gchar *quoted_path = g_shell_quote (path);
-    g_autofree gchar *cmd = g_strdup_printf ("/bin/rm -rf %s", quoted_path);
+static void
+forget_user_dir (SharedDataManager *manager, const gchar *user)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
 
-    g_autoptr(GError) error = NULL;
-    g_spawn_command_line_async (cmd, &error);
-    if (error)
-        g_warning ("Could not delete unused user data directory %s: %s", path, error->message);
+    g_mutex_lock (&priv->verified_dirs_lock);
+    g_hash_table_remove (priv->verified_dirs, user);
+    g_mutex_unlock (&priv->verified_dirs_lock);
 }
 
-gchar *
-shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *user)
+/* Check if a directory is unchanged since we last made sure it is correct */
+static gboolean
+user_dir_is_verified (SharedDataManager *manager, const gchar *user, const gchar *path)
 {
     SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
 
-    struct passwd *entry = getpwnam (user);
-    if (!entry)
-        return NULL;
+    g_mutex_lock (&priv->verified_dirs_lock);
+    VerifiedDir *verified = g_hash_table_lookup (priv->verified_dirs, user);
+    VerifiedDir expected;
+    if (verified)
+        expected = *verified;
+    g_mutex_unlock (&priv->verified_dirs_lock);
+    if (!verified)
+        return FALSE;
+
+    GStatBuf buf;
+    if (g_stat (path, &buf) < 0)
+        return FALSE;
+
+    return buf.st_dev == expected.dev &&
+           buf.st_ino == expected.ino &&
+           buf.st_uid == expected.uid &&
+           buf.st_gid == expected.gid &&
+           (buf.st_mode & 07777) == expected.mode;
+}
 
-    g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
-    g_autoptr(GFile) file = g_file_new_for_path (path);
+static void
+ensure_dir_request_free (EnsureDirRequest *request)
+{
+    g_object_unref (request->manager);
+    g_free (request->user);
+    g_free (request->path);
+    g_free (request);
+}
 
-    g_debug ("Creating shared data directory %s", path);
+/* Create or fix a directory, this is safe to call from a worker thread */
+static gboolean
+ensure_dir (EnsureDirRequest *request, GError **error)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (request->manager);
 
-    g_autoptr(GError) error = NULL;
-    gboolean result = g_file_make_directory (file, NULL, &error);
-    if (error)
+    g_debug ("Creating shared data directory %s", request->path);
+
+    if (g_mkdir (request->path, 0770) < 0 && errno != EEXIST)
     {
-        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS))
-        {
-            g_clear_error (&error);
-            result = TRUE;
-        }
-        else
-            g_warning ("Could not create user data directory %s: %s", path, error->message);
+        int e = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not create user data directory %s: %s", request->path, strerror (e));
+        return FALSE;
     }
-    if (!result)
+
+    GStatBuf buf;
+    if (g_stat (request->path, &buf) < 0)
     {
-        g_clear_pointer (&path, g_free);
-        return NULL;
+        int e = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not check user data directory %s: %s", request->path, strerror (e));
+        return FALSE;
     }
 
     /* Even if the directory already exists, we want to re-affirm the owners
        because the greeter gid is configuration based and may change between
        runs. */
-    g_autoptr(GFileInfo) info = g_file_info_new ();
-    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID, entry->pw_uid);
-    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID, priv->greeter_gid);
-    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE, 0770);
-    result = g_file_set_attributes_from_info (file, info, G_FILE_QUERY_INFO_NONE, NULL, &error);
-    if (error)
-        g_warning ("Could not chown user data directory %s: %s", path, error->message);
+    gboolean changed = FALSE;
+    if (buf.st_uid != request->uid || buf.st_gid != request->gid)
+    {
+        if (chown (request->path, request->uid, request->gid) < 0)
+        {
+            int e = errno;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not chown user data directory %s: %s", request->path, strerror (e));
+            return FALSE;
+        }
+        changed = TRUE;
+    }
+    if ((buf.st_mode & 07777) != 0770)
+    {
+        if (g_chmod (request->path, 0770) < 0)
+        {
+            int e = errno;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not chmod user data directory %s: %s", request->path, strerror (e));
+            return FALSE;
+        }
+        changed = TRUE;
+    }
+    if (changed && g_stat (request->path, &buf) < 0)
+        return TRUE;
+
+    /* Remember what it looks like so we don't have to do this again */
+    VerifiedDir *verified = g_malloc0 (sizeof (VerifiedDir));
+    verified->dev = buf.st_dev;
+    verified->ino = buf.st_ino;
+    verified->uid = buf.st_uid;
+    verified->gid = buf.st_gid;
+    verified->mode = buf.st_mode & 07777;
+    g_mutex_lock (&priv->verified_dirs_lock);
+    g_hash_table_insert (priv->verified_dirs, g_strdup (request->user), verified);
+    g_mutex_unlock (&priv->verified_dirs_lock);
+
+    return TRUE;
+}
+
+static EnsureDirRequest *
+ensure_dir_request_new (SharedDataManager *manager, const gchar *user, const struct passwd *entry)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    EnsureDirRequest *request = g_malloc0 (sizeof (EnsureDirRequest));
+    request->manager = g_object_ref (manager);
+    request->user = g_strdup (user);
+    request->path = g_build_filename (USERS_DIR, user, NULL);
+    request->uid = entry->pw_uid;
+    request->gid = priv->greeter_gid;
+
+    return request;
+}
+
+gchar *
+shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *user)
+{
+    g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
+    if (user_dir_is_verified (manager, user, path))
+        return g_steal_pointer (&path);
+
+    g_autoptr(CommonPasswd) entry = common_nss_get_user_by_name (user);
+    if (!entry)
+        return NULL;
+    EnsureDirRequest *request = ensure_dir_request_new (manager, user, entry);
+
+    g_autoptr(GError) error = NULL;
+    gboolean result = ensure_dir (request, &error);
+    ensure_dir_request_free (request);
     if (!result)
+    {
+        g_warning ("%s", error->message);
         return NULL;
+    }
 
     return g_steal_pointer (&path);
 }
 
+static void
+ensure_dir_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    EnsureDirRequest *request = task_data;
+
+    GError *error = NULL;
+    if (ensure_dir (request, &error))
+        g_task_return_pointer (task, g_strdup (request->path), g_free);
+    else
+        g_task_return_error (task, error);
+}
+
+static void
+ensure_dir_user_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GTask) task = data;
+    SharedDataManager *manager = g_task_get_source_object (task);
+    const gchar *user = g_task_get_task_data (task);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(CommonPasswd) entry = common_nss_get_user_finish (result, &error);
+    if (!entry)
+    {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "Unknown user %s", user);
+        return;
+    }
+
+    EnsureDirRequest *request = ensure_dir_request_new (manager, user, entry);
+    g_task_set_task_data (task, request, (GDestroyNotify) ensure_dir_request_free);
+    g_task_run_in_thread (task, ensure_dir_thread);
+}
+
+void
+shared_data_manager_ensure_user_dir_async (SharedDataManager *manager, const gchar *user, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_autoptr(GTask) task = g_task_new (manager, NULL, callback, user_data);
+
+    /* Directories that are already correct don't need a thread */
+    g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
+    if (user_dir_is_verified (manager, user, path))
+    {
+        g_task_return_pointer (task, g_steal_pointer (&path), g_free);
+        return;
+    }
+
+    /* Look the user up in the NSS worker, a slow name service mustn't block the main loop */
+    g_task_set_task_data (task, g_strdup (user), g_free);
+    common_nss_get_user_by_name_async (user, NULL, ensure_dir_user_cb, g_object_ref (task));
+}
+
+gchar *
+shared_data_manager_ensure_user_dir_finish (SharedDataManager *manager, GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 static void
 next_user_dirs_cb (GObject *object, GAsyncResult *res, gpointer user_data)
 {
@@ -185,10 +460,414 @@ list_user_dirs_cb (GObject *object, GAsyncResult *res, gpointer user_data)
                                         next_user_dirs_cb, g_steal_pointer (&manager));
 }
 
+gchar *
+shared_data_manager_get_user_list_snapshot_path (SharedDataManager *manager)
+{
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, "user-list.snapshot", NULL);
+}
+
+gchar *
+shared_data_manager_get_locale_names_path (SharedDataManager *manager)
+{
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, "locale-names.cache", NULL);
+}
+
+gchar *
+shared_data_manager_get_sessions_snapshot_path (SharedDataManager *manager)
+{
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, "sessions.snapshot", NULL);
+}
+
+gchar *
+shared_data_manager_get_image_cache_path (SharedDataManager *manager)
+{
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, "images", NULL);
+}
+
+static gchar *
+get_cached_image_path (const gchar *cache_dir, const gchar *username, const gchar *kind)
+{
+    g_autofree gchar *name = g_strdup_printf ("%s-%s", username, kind);
+    return g_build_filename (cache_dir, name, NULL);
+}
+
+/* Images of one user to copy into the cache */
+typedef struct
+{
+    gchar *name;
+    uid_t uid;
+    gchar *image;
+    gchar *background;
+} ImageCacheUser;
+
+/* Images to copy in a worker thread */
+typedef struct
+{
+    gchar *cache_dir;
+    gid_t gid;
+    GPtrArray *users;
+} ImageCacheUpdate;
+
+static void
+image_cache_user_free (ImageCacheUser *user)
+{
+    g_free (user->name);
+    g_free (user->image);
+    g_free (user->background);
+    g_free (user);
+}
+
 static void
-user_removed_cb (CommonUserList *list, CommonUser *user, SharedDataManager *manager)
+image_cache_update_free (ImageCacheUpdate *update)
 {
-    delete_unused_user ((gpointer) common_user_get_name (user), NULL, manager);
+    g_free (update->cache_dir);
+    g_ptr_array_unref (update->users);
+    g_free (update);
+}
+
+/* Read an image only if the user could have shown it to the greeter themselves */
+static GBytes *
+read_user_image (const gchar *path, uid_t uid, struct stat *info)
+{
+    int fd = open (path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat (fd, info) < 0 ||
+        !S_ISREG (info->st_mode) ||
+        (info->st_uid != uid && !(info->st_uid == 0 && (info->st_mode & S_IROTH))) ||
+        info->st_size > MAX_CACHED_IMAGE_SIZE)
+    {
+        close (fd);
+        return NULL;
+    }
+
+    gsize length = info->st_size;
+    g_autofree gchar *data = g_malloc (length + 1);
+    gsize n_read = 0;
+    while (n_read < length)
+    {
+        ssize_t n = read (fd, data + n_read, length - n_read);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        n_read += n;
+    }
+    close (fd);
+    if (n_read != length)
+        return NULL;
+
+    return g_bytes_new_take (g_steal_pointer (&data), length);
+}
+
+/* Write a copy only the greeter group can read, it isn't visible to anyone else while being written */
+static gboolean
+write_cached_image (const gchar *path, GBytes *data, const struct stat *info, gid_t gid, GError **error)
+{
+    g_autofree gchar *tmp_path = g_strdup_printf ("%s.tmp", path);
+    g_unlink (tmp_path);
+    int fd = open (tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        int e = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not create %s: %s", tmp_path, strerror (e));
+        return FALSE;
+    }
+
+    gsize length;
+    const gchar *contents = g_bytes_get_data (data, &length);
+    gsize n_written = 0;
+    while (n_written < length)
+    {
+        ssize_t n = write (fd, contents + n_written, length - n_written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        n_written += n;
+    }
+
+    struct timeval times[2] = { { info->st_atime, 0 }, { info->st_mtime, 0 } };
+    gboolean result = n_written == length &&
+                      fchown (fd, (uid_t) -1, gid) == 0 &&
+                      fchmod (fd, CACHED_IMAGE_MODE) == 0 &&
+                      futimes (fd, times) == 0;
+    int e = errno;
+    if (close (fd) < 0 && result)
+    {
+        result = FALSE;
+        e = errno;
+    }
+    if (!result)
+    {
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not write %s: %s", tmp_path, strerror (e));
+        g_unlink (tmp_path);
+        return FALSE;
+    }
+
+    if (g_rename (tmp_path, path) < 0)
+    {
+        e = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (e), "Could not rename %s: %s", tmp_path, strerror (e));
+        g_unlink (tmp_path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Keep a copy of a user's avatar or background that greeters can read without access to their home */
+static void
+update_cached_image (ImageCacheUpdate *update, ImageCacheUser *user, const gchar *source, const gchar *kind)
+{
+    g_autofree gchar *path = get_cached_image_path (update->cache_dir, user->name, kind);
+
+    g_autofree gchar *filename = NULL;
+    if (source && g_str_has_prefix (source, "file://"))
+        filename = g_filename_from_uri (source, NULL, NULL);
+    else if (source && g_path_is_absolute (source))
+        filename = g_strdup (source);
+    if (!filename)
+    {
+        g_unlink (path);
+        return;
+    }
+
+    /* Cached copies carry the time and size of their source, so unchanged images aren't read again */
+    GStatBuf source_info, cached_info;
+    if (g_stat (filename, &source_info) == 0 && g_lstat (path, &cached_info) == 0 &&
+        S_ISREG (cached_info.st_mode) &&
+        cached_info.st_size == source_info.st_size &&
+        cached_info.st_mtime == source_info.st_mtime &&
+        cached_info.st_gid == update->gid &&
+        (cached_info.st_mode & 07777) == CACHED_IMAGE_MODE)
+        return;
+
+    struct stat info;
+    g_autoptr(GBytes) data = read_user_image (filename, user->uid, &info);
+    if (!data)
+    {
+        g_unlink (path);
+        return;
+    }
+
+    g_debug ("Caching %s for user %s", filename, user->name);
+    g_autoptr(GError) error = NULL;
+    if (!write_cached_image (path, data, &info, update->gid, &error))
+    {
+        g_warning ("Failed to write cached image %s: %s", path, error->message);
+        g_unlink (path);
+    }
+}
+
+static void
+update_image_cache_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    ImageCacheUpdate *update = task_data;
+
+    if (g_mkdir_with_parents (update->cache_dir, 0750) < 0 ||
+        chown (update->cache_dir, (uid_t) -1, update->gid) < 0 ||
+        g_chmod (update->cache_dir, 0750) < 0)
+    {
+        g_warning ("Failed to create image cache directory %s: %s", update->cache_dir, g_strerror (errno));
+        g_task_return_boolean (task, FALSE);
+        return;
+    }
+
+    for (guint i = 0; i < update->users->len; i++)
+    {
+        ImageCacheUser *user = g_ptr_array_index (update->users, i);
+        update_cached_image (update, user, user->image, "image");
+        update_cached_image (update, user, user->background, "background");
+    }
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+image_cache_updated_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    SharedDataManager *manager = SHARED_DATA_MANAGER (object);
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    priv->image_cache_running = FALSE;
+    if (priv->image_cache_pending)
+    {
+        priv->image_cache_pending = FALSE;
+        update_image_cache (manager);
+    }
+}
+
+/* Copy the images in a worker, only one update runs at a time and changes while
+ * it runs are picked up by a single update when it finishes */
+static void
+update_image_cache (SharedDataManager *manager)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    if (priv->image_cache_running)
+    {
+        priv->image_cache_pending = TRUE;
+        return;
+    }
+    priv->image_cache_running = TRUE;
+
+    /* Only use the images already known, looking in every home directory here
+     * would block the main loop on them */
+    ImageCacheUpdate *update = g_malloc0 (sizeof (ImageCacheUpdate));
+    update->cache_dir = shared_data_manager_get_image_cache_path (manager);
+    update->gid = priv->greeter_gid;
+    update->users = g_ptr_array_new_with_free_func ((GDestroyNotify) image_cache_user_free);
+    for (GList *link = common_user_list_get_users (common_user_list_get_instance ()); link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        ImageCacheUser *cache_user = g_malloc0 (sizeof (ImageCacheUser));
+        cache_user->name = g_strdup (common_user_get_name (user));
+        cache_user->uid = common_user_get_uid (user);
+        cache_user->image = g_strdup (common_user_get_cached_image (user));
+        cache_user->background = g_strdup (common_user_get_background (user));
+        g_ptr_array_add (update->users, cache_user);
+    }
+
+    g_autoptr(GTask) task = g_task_new (manager, NULL, image_cache_updated_cb, NULL);
+    g_task_set_task_data (task, update, (GDestroyNotify) image_cache_update_free);
+    g_task_run_in_thread (task, update_image_cache_thread);
+}
+
+static void
+remove_cached_images (SharedDataManager *manager, const gchar *username)
+{
+    g_autofree gchar *cache_dir = shared_data_manager_get_image_cache_path (manager);
+    g_autofree gchar *image_path = get_cached_image_path (cache_dir, username, "image");
+    g_unlink (image_path);
+    g_autofree gchar *background_path = get_cached_image_path (cache_dir, username, "background");
+    g_unlink (background_path);
+}
+
+static void
+write_locale_names (SharedDataManager *manager)
+{
+    g_autofree gchar *path = shared_data_manager_get_locale_names_path (manager);
+
+    /* Translate the names into the system language, which greeters start in */
+    g_autofree gchar *messages_locale = g_strdup (setlocale (LC_MESSAGES, NULL));
+    setlocale (LC_MESSAGES, "");
+
+    g_autoptr(GError) error = NULL;
+    if (!common_locale_names_save_cache (path, &error))
+        g_warning ("Failed to write locale name cache %s: %s", path, error->message);
+
+    setlocale (LC_MESSAGES, messages_locale);
+}
+
+static gboolean
+write_user_list_snapshot_cb (gpointer data)
+{
+    SharedDataManager *manager = data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    priv->user_list_snapshot_timeout = 0;
+
+    /* Looking the users up here would block the main loop, so load them in the
+     * background and write the snapshot when they are all there */
+    CommonUserList *user_list = common_user_list_get_instance ();
+    if (!common_user_list_get_is_loaded (user_list))
+    {
+        common_user_list_load_async (user_list);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_autofree gchar *path = shared_data_manager_get_user_list_snapshot_path (manager);
+    g_debug ("Writing user list snapshot %s", path);
+    g_autoptr(GError) error = NULL;
+    if (!common_user_list_save_snapshot (user_list, path, &error))
+        g_warning ("Failed to write user list snapshot %s: %s", path, error->message);
+
+    /* Images are checked at the same time, as that is when users have changed */
+    update_image_cache (manager);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_user_list_snapshot (SharedDataManager *manager)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    if (priv->user_list_snapshot_timeout)
+        g_source_remove (priv->user_list_snapshot_timeout);
+    priv->user_list_snapshot_timeout = g_timeout_add_seconds (USER_LIST_SNAPSHOT_DELAY, write_user_list_snapshot_cb, manager);
+}
+
+static gboolean
+write_sessions_snapshot_cb (gpointer data)
+{
+    SharedDataManager *manager = data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    priv->sessions_snapshot_timeout = 0;
+
+    /* Greeters look up both local and remote sessions */
+    g_autofree gchar *sessions_dir = config_get_string (config_get_instance (), "LightDM", "sessions-directory");
+    g_autofree gchar *remote_sessions_dir = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
+    g_autofree gchar *dirs = g_strdup_printf ("%s:%s", sessions_dir, remote_sessions_dir);
+
+    g_autofree gchar *path = shared_data_manager_get_sessions_snapshot_path (manager);
+    g_debug ("Writing sessions snapshot %s", path);
+    g_autoptr(GError) error = NULL;
+    if (!common_session_index_save_snapshot (dirs, path, &error))
+        g_warning ("Failed to write sessions snapshot %s: %s", path, error->message);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+sessions_changed_cb (gpointer data)
+{
+    SharedDataManager *manager = data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    if (priv->sessions_snapshot_timeout)
+        g_source_remove (priv->sessions_snapshot_timeout);
+    priv->sessions_snapshot_timeout = g_timeout_add_seconds (SESSIONS_SNAPSHOT_DELAY, write_sessions_snapshot_cb, manager);
+}
+
+static void
+users_loaded_cb (CommonUserList *list, SharedDataManager *manager)
+{
+    schedule_user_list_snapshot (manager);
+}
+
+static void
+users_added_cb (CommonUserList *list, GPtrArray *users, SharedDataManager *manager)
+{
+    schedule_user_list_snapshot (manager);
+}
+
+static void
+users_changed_cb (CommonUserList *list, GPtrArray *users, SharedDataManager *manager)
+{
+    /* The users' IDs may have changed, so check the directories again next time */
+    for (guint i = 0; i < users->len; i++)
+        forget_user_dir (manager, common_user_get_name (g_ptr_array_index (users, i)));
+    schedule_user_list_snapshot (manager);
+}
+
+static void
+users_removed_cb (CommonUserList *list, GPtrArray *users, SharedDataManager *manager)
+{
+    for (guint i = 0; i < users->len; i++)
+    {
+        const gchar *name = common_user_get_name (g_ptr_array_index (users, i));
+        delete_unused_user ((gpointer) name, NULL, manager);
+        remove_cached_images (manager, name);
+    }
+    schedule_user_list_snapshot (manager);
 }
 
 void
@@ -202,7 +881,20 @@ shared_data_manager_start (SharedDataManager *manager)
                                      list_user_dirs_cb, g_object_ref (manager));
 
     /* And listen for user removals. */
-    g_signal_connect (common_user_list_get_instance (), USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (user_removed_cb), manager);
+    g_signal_connect (common_user_list_get_instance (), USER_LIST_SIGNAL_USERS_REMOVED, G_CALLBACK (users_removed_cb), manager);
+
+    /* Keep a snapshot of the users for greeters to start from */
+    g_signal_connect (common_user_list_get_instance (), USER_LIST_SIGNAL_USERS_LOADED, G_CALLBACK (users_loaded_cb), manager);
+    g_signal_connect (common_user_list_get_instance (), USER_LIST_SIGNAL_USERS_ADDED, G_CALLBACK (users_added_cb), manager);
+    g_signal_connect (common_user_list_get_instance (), USER_LIST_SIGNAL_USERS_CHANGED, G_CALLBACK (users_changed_cb), manager);
+    schedule_user_list_snapshot (manager);
+
+    /* Keep a snapshot of the session files so greeters don't have to read them all again */
+    common_session_index_set_changed_func (sessions_changed_cb, manager);
+    write_sessions_snapshot_cb (manager);
+
+    /* Translate the language names once for all greeters */
+    write_locale_names (manager);
 }
 
 static void
@@ -210,9 +902,13 @@ shared_data_manager_init (SharedDataManager *manager)
 {
     SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
 
+    g_mutex_init (&priv->verified_dirs_lock);
+    priv->verified_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->delete_queue = g_queue_new ();
+
     /* Grab current greeter-user gid */
     priv->greeter_user = config_get_string (config_get_instance (), "LightDM", "greeter-user");
-    struct passwd *greeter_entry = getpwnam (priv->greeter_user);
+    g_autoptr(CommonPasswd) greeter_entry = common_nss_get_user_by_name (priv->greeter_user);
     if (greeter_entry)
         priv->greeter_gid = greeter_entry->pw_gid;
 }
@@ -227,6 +923,19 @@ shared_data_manager_finalize (GObject *object)
 
     g_signal_handlers_disconnect_by_data (common_user_list_get_instance (), self);
 
+    if (priv->user_list_snapshot_timeout)
+        g_source_remove (priv->user_list_snapshot_timeout);
+    if (priv->sessions_snapshot_timeout)
+        g_source_remove (priv->sessions_snapshot_timeout);
+    common_session_index_set_changed_func (NULL, NULL);
+    if (priv->delete_timeout)
+        g_source_remove (priv->delete_timeout);
+
+    /* Directories still waiting to be deleted will be found again on the next start */
+    g_queue_free_full (priv->delete_queue, g_free);
+    g_hash_table_unref (priv->verified_dirs);
+    g_mutex_clear (&priv->verified_dirs_lock);
+
     if (priv->starting_dirs)
         g_hash_table_destroy (priv->starting_dirs);
 
@@ -12,7 +12,7 @@
 #ifndef SHARED_DATA_MANAGER_H_
 #define SHARED_DATA_MANAGER_H_
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 typedef struct SharedDataManager SharedDataManager;
 
@@ -45,6 +45,18 @@ void shared_data_manager_cleanup (void);
 
 gchar *shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *user);
 
+void shared_data_manager_ensure_user_dir_async (SharedDataManager *manager, const gchar *user, GAsyncReadyCallback callback, gpointer user_data);
+
+gchar *shared_data_manager_ensure_user_dir_finish (SharedDataManager *manager, GAsyncResult *result, GError **error);
+
+gchar *shared_data_manager_get_user_list_snapshot_path (SharedDataManager *manager);
+
+gchar *shared_data_manager_get_locale_names_path (SharedDataManager *manager);
+
+gchar *shared_data_manager_get_sessions_snapshot_path (SharedDataManager *manager);
+
+gchar *shared_data_manager_get_image_cache_path (SharedDataManager *manager);
+
 G_END_DECLS
 
 #endif /* SHARED_DATA_MANAGER_H_ */
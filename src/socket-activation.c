@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "socket-activation.h"
+
+/* First file descriptor passed by the service manager (sd_listen_fds(3)) */
+#define LISTEN_FDS_START 3
+
+static gboolean have_listen_fds = FALSE;
+
+/* Sockets passed to us that haven't been claimed yet */
+static GList *listen_sockets = NULL;
+
+static void
+load_listen_fds (void)
+{
+    if (have_listen_fds)
+        return;
+    have_listen_fds = TRUE;
+
+    const gchar *pid_text = g_getenv ("LISTEN_PID");
+    const gchar *fds_text = g_getenv ("LISTEN_FDS");
+    if (!pid_text || !fds_text)
+        return;
+
+    /* Ignore sockets meant for another process */
+    guint64 pid = g_ascii_strtoull (pid_text, NULL, 10);
+    gint n_fds = atoi (fds_text);
+    g_unsetenv ("LISTEN_PID");
+    g_unsetenv ("LISTEN_FDS");
+    g_unsetenv ("LISTEN_FDNAMES");
+    if (pid != (guint64) getpid () || n_fds <= 0)
+        return;
+
+    for (int fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + n_fds; fd++)
+    {
+        /* Don't leak these into child processes */
+        fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+        g_autoptr(GError) error = NULL;
+        GSocket *socket = g_socket_new_from_fd (fd, &error);
+        if (!socket)
+        {
+            g_warning ("Ignoring passed file descriptor %d: %s", fd, error->message);
+            continue;
+        }
+        listen_sockets = g_list_append (listen_sockets, socket);
+    }
+
+    g_debug ("Inherited %d socket(s) from service manager", g_list_length (listen_sockets));
+}
+
+static gboolean
+socket_matches (GSocket *socket, GSocketFamily family, GSocketType type, guint16 port)
+{
+    if (g_socket_get_family (socket) != family || g_socket_get_socket_type (socket) != type)
+        return FALSE;
+
+    g_autoptr(GSocketAddress) address = g_socket_get_local_address (socket, NULL);
+    return address && G_IS_INET_SOCKET_ADDRESS (address) &&
+           g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address)) == port;
+}
+
+/* Take a socket passed by the service manager (e.g. systemd socket activation), if one matches */
+GSocket *
+socket_activation_take (GSocketFamily family, GSocketType type, guint16 port)
+{
+    load_listen_fds ();
+
+    for (GList *link = listen_sockets; link; link = link->next)
+    {
+        GSocket *socket = link->data;
+        if (socket_matches (socket, family, type, port))
+        {
+            listen_sockets = g_list_delete_link (listen_sockets, link);
+
+            /* Listeners read until there is nothing left */
+            g_socket_set_blocking (socket, FALSE);
+
+            return socket;
+        }
+    }
+
+    return NULL;
+}
+
+void
+socket_activation_cleanup (void)
+{
+    if (listen_sockets)
+        g_debug ("Closing %d unused socket(s) from service manager", g_list_length (listen_sockets));
+    g_list_free_full (listen_sockets, g_object_unref);
+    listen_sockets = NULL;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SOCKET_ACTIVATION_H_
+#define SOCKET_ACTIVATION_H_
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+GSocket *socket_activation_take (GSocketFamily family, GSocketType type, guint16 port);
+
+void socket_activation_cleanup (void);
+
+G_END_DECLS
+
+#endif /* SOCKET_ACTIVATION_H_ */
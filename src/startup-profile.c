@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "startup-profile.h"
+
+typedef struct
+{
+    const gchar *milestone;
+    gint64 timestamp;
+} StartupMilestone;
+
+/* Monotonic time main started at, or 0 when not profiling */
+static gint64 profile_start_time = 0;
+
+/* Milestones in the order they were first reached */
+static GArray *milestones = NULL;
+
+static gchar *profile_file = NULL;
+static gboolean finished = FALSE;
+
+/* TRUE if startup got as far as a greeter or session */
+static gboolean complete = FALSE;
+
+void
+startup_profile_start (gint64 start_time)
+{
+    profile_start_time = start_time;
+    if (!milestones)
+        milestones = g_array_new (FALSE, FALSE, sizeof (StartupMilestone));
+}
+
+/* Milestones must be static strings, only the first time each is reached is kept */
+void
+startup_profile_mark (const gchar *milestone)
+{
+    if (profile_start_time == 0 || finished)
+        return;
+
+    for (guint i = 0; i < milestones->len; i++)
+        if (strcmp (g_array_index (milestones, StartupMilestone, i).milestone, milestone) == 0)
+            return;
+
+    StartupMilestone m = { milestone, g_get_monotonic_time () };
+    g_array_append_val (milestones, m);
+    g_debug ("Startup milestone %s at %.3fs", milestone, (m.timestamp - profile_start_time) / 1000000.0);
+
+    /* Startup is over when there is something to log in with */
+    if (strcmp (milestone, "greeter-connected") == 0 || strcmp (milestone, "session-started") == 0)
+    {
+        complete = TRUE;
+        startup_profile_finish ();
+    }
+}
+
+void
+startup_profile_set_file (const gchar *filename)
+{
+    g_free (profile_file);
+    profile_file = g_strdup (filename);
+}
+
+/* Write each step as a span from the previous milestone in Trace Event Format */
+void
+startup_profile_finish (void)
+{
+    if (profile_start_time == 0 || finished)
+        return;
+    finished = TRUE;
+
+    if (!profile_file)
+        return;
+
+    g_autoptr(GString) json = g_string_new ("{\"traceEvents\": [\n");
+    gint64 previous = profile_start_time;
+    for (guint i = 0; i < milestones->len; i++)
+    {
+        StartupMilestone *m = &g_array_index (milestones, StartupMilestone, i);
+        g_string_append_printf (json,
+                                "{\"name\": \"%s\", \"cat\": \"startup\", \"ph\": \"X\", \"ts\": %" G_GINT64_FORMAT ", \"dur\": %" G_GINT64_FORMAT ", \"pid\": %d, \"tid\": 0, \"args\": {\"since-start-ms\": %.3f}},\n",
+                                m->milestone, previous - profile_start_time, m->timestamp - previous, getpid (),
+                                (m->timestamp - profile_start_time) / 1000.0);
+        previous = m->timestamp;
+    }
+    /* Mark the end, so a daemon that stopped before a greeter connected can be told apart */
+    g_string_append_printf (json,
+                            "{\"name\": \"%s\", \"cat\": \"startup\", \"ph\": \"i\", \"s\": \"g\", \"ts\": %" G_GINT64_FORMAT ", \"pid\": %d, \"tid\": 0}\n",
+                            complete ? "startup-complete" : "startup-incomplete", previous - profile_start_time, getpid ());
+    g_string_append (json, "], \"displayTimeUnit\": \"ms\"}\n");
+
+    g_autoptr(GError) error = NULL;
+    if (g_file_set_contents (profile_file, json->str, json->len, &error))
+        g_debug ("Wrote startup profile to %s", profile_file);
+    else
+        g_warning ("Failed to write startup profile: %s", error->message);
+}
+
+void
+startup_profile_cleanup (void)
+{
+    startup_profile_finish ();
+    g_clear_pointer (&milestones, g_array_unref);
+    g_clear_pointer (&profile_file, g_free);
+    profile_start_time = 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef STARTUP_PROFILE_H_
+#define STARTUP_PROFILE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void startup_profile_start (gint64 start_time);
+
+void startup_profile_mark (const gchar *milestone);
+
+void startup_profile_set_file (const gchar *filename);
+
+void startup_profile_finish (void);
+
+void startup_profile_cleanup (void);
+
+G_END_DECLS
+
+#endif /* STARTUP_PROFILE_H_ */
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <gio/gio.h>
+
+#include "vnc-pool.h"
+#include "logger.h"
+
+enum {
+    CREATE_SEAT,
+    LAST_SIGNAL
+};
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* Size of the buffer for each direction of a relayed connection */
+#define RELAY_BUFFER_SIZE 65536
+
+typedef struct PooledServer PooledServer;
+
+/* Data being copied from one socket to another */
+typedef struct
+{
+    PooledServer *server;
+    GSocket *from;
+    GSocket *to;
+    GSource *source;
+    guint8 buffer[RELAY_BUFFER_SIZE];
+    gsize offset;
+    gsize length;
+} RelayDirection;
+
+struct PooledServer
+{
+    VNCPool *pool;
+
+    /* Geometry and depth the server was started with */
+    gchar *key;
+
+    SeatXVNC *seat;
+
+    /* Our end of the connection given to Xvnc */
+    GSocket *socket;
+
+    /* TRUE once the X server is running */
+    gboolean ready;
+
+    /* TRUE if the pool doesn't need this server any more */
+    gboolean stopping;
+
+    /* Client connection once handed off */
+    GSocket *client;
+    RelayDirection *to_server;
+    RelayDirection *to_client;
+};
+
+typedef struct
+{
+    /* Number of waiting servers to keep for each geometry */
+    guint size;
+
+    /* All the pooled servers, waiting or handed off */
+    GList *servers;
+} VNCPoolPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (VNCPool, vnc_pool, G_TYPE_OBJECT)
+
+static void relay_watch (RelayDirection *direction);
+
+VNCPool *
+vnc_pool_new (void)
+{
+    return g_object_new (VNC_POOL_TYPE, NULL);
+}
+
+/* Servers are only handed out to clients that would get the same geometry and depth */
+static gchar *
+get_bucket_key (GSocket *client)
+{
+    gint width, height, depth;
+    seat_xvnc_get_client_geometry (client, &width, &height, &depth);
+    return g_strdup_printf ("%dx%dx%d", width, height, depth);
+}
+
+static void
+relay_direction_free (RelayDirection *direction)
+{
+    if (!direction)
+        return;
+
+    if (direction->source)
+    {
+        g_source_destroy (direction->source);
+        g_source_unref (direction->source);
+    }
+    g_free (direction);
+}
+
+static void
+pooled_server_free (PooledServer *server)
+{
+    g_signal_handlers_disconnect_matched (server->seat, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, server);
+    relay_direction_free (server->to_server);
+    relay_direction_free (server->to_client);
+    if (server->client)
+        g_socket_close (server->client, NULL);
+    g_clear_object (&server->client);
+    if (server->socket)
+        g_socket_close (server->socket, NULL);
+    g_clear_object (&server->socket);
+    g_clear_object (&server->seat);
+    g_free (server->key);
+    g_free (server);
+}
+
+/* Stop relaying, the X server exits when its connection closes */
+static void
+relay_close (PooledServer *server)
+{
+    g_clear_pointer (&server->to_server, relay_direction_free);
+    g_clear_pointer (&server->to_client, relay_direction_free);
+    if (server->client)
+        g_socket_close (server->client, NULL);
+    if (server->socket)
+        g_socket_close (server->socket, NULL);
+}
+
+static gboolean
+relay_cb (GSocket *socket, GIOCondition condition, gpointer data)
+{
+    RelayDirection *direction = data;
+    PooledServer *server = direction->server;
+
+    /* Read more when the buffer has been sent */
+    if (direction->offset == direction->length)
+    {
+        g_autoptr(GError) error = NULL;
+        gssize n_read = g_socket_receive (direction->from, (gchar *) direction->buffer, RELAY_BUFFER_SIZE, NULL, &error);
+        if (n_read < 0 && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            return G_SOURCE_CONTINUE;
+        if (n_read <= 0)
+        {
+            if (error)
+                log_debug (LOG_SUBSYSTEM_VNC, "Closing VNC relay: %s", error->message);
+            relay_close (server);
+            return G_SOURCE_REMOVE;
+        }
+        direction->offset = 0;
+        direction->length = n_read;
+    }
+
+    g_autoptr(GError) error = NULL;
+    gssize n_sent = g_socket_send (direction->to, (const gchar *) direction->buffer + direction->offset, direction->length - direction->offset, NULL, &error);
+    if (n_sent < 0 && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+    {
+        log_debug (LOG_SUBSYSTEM_VNC, "Closing VNC relay: %s", error->message);
+        relay_close (server);
+        return G_SOURCE_REMOVE;
+    }
+    if (n_sent > 0)
+        direction->offset += n_sent;
+
+    /* Switch between waiting for data and waiting for space to send it */
+    relay_watch (direction);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+relay_watch (RelayDirection *direction)
+{
+    if (direction->source)
+    {
+        g_source_destroy (direction->source);
+        g_source_unref (direction->source);
+    }
+
+    if (direction->offset == direction->length)
+        direction->source = g_socket_create_source (direction->from, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    else
+        direction->source = g_socket_create_source (direction->to, G_IO_OUT | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback (direction->source, (GSourceFunc) relay_cb, direction, NULL);
+    g_source_attach (direction->source, NULL);
+}
+
+static RelayDirection *
+relay_direction_new (PooledServer *server, GSocket *from, GSocket *to)
+{
+    RelayDirection *direction = g_malloc0 (sizeof (RelayDirection));
+    direction->server = server;
+    direction->from = from;
+    direction->to = to;
+    relay_watch (direction);
+
+    return direction;
+}
+
+static void fill (VNCPool *pool);
+
+static void
+seat_ready_cb (SeatXVNC *seat, PooledServer *server)
+{
+    log_debug (LOG_SUBSYSTEM_VNC, "Pooled VNC server ready");
+    server->ready = TRUE;
+}
+
+static void
+seat_stopped_cb (Seat *seat, PooledServer *server)
+{
+    VNCPool *pool = server->pool;
+    VNCPoolPrivate *priv = vnc_pool_get_instance_private (pool);
+
+    priv->servers = g_list_remove (priv->servers, server);
+
+    /* Replace servers that stop while waiting, unless they never started */
+    gboolean refill = !server->client && !server->stopping && server->ready;
+    if (!server->client && !server->stopping && !server->ready)
+        g_warning ("Pooled VNC server failed to start, not replacing it");
+    pooled_server_free (server);
+
+    if (refill)
+        fill (pool);
+}
+
+static gboolean
+start_server (VNCPool *pool, const gchar *key)
+{
+    VNCPoolPrivate *priv = vnc_pool_get_instance_private (pool);
+
+    /* Xvnc gets one end of a socket pair in place of a client connection */
+    int fds[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+        g_warning ("Failed to make socket pair for pooled VNC server: %s", strerror (errno));
+        return FALSE;
+    }
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSocket) socket = g_socket_new_from_fd (fds[0], &error);
+    if (!socket)
+    {
+        g_warning ("Failed to make socket for pooled VNC server: %s", error->message);
+        close (fds[0]);
+        close (fds[1]);
+        return FALSE;
+    }
+    g_autoptr(GSocket) server_socket = g_socket_new_from_fd (fds[1], &error);
+    if (!server_socket)
+    {
+        g_warning ("Failed to make socket for pooled VNC server: %s", error->message);
+        close (fds[1]);
+        return FALSE;
+    }
+    g_socket_set_blocking (socket, FALSE);
+
+    SeatXVNC *seat = NULL;
+    g_signal_emit (pool, signals[CREATE_SEAT], 0, server_socket, &seat);
+    if (!seat)
+        return FALSE;
+
+    PooledServer *server = g_malloc0 (sizeof (PooledServer));
+    server->pool = pool;
+    server->key = g_strdup (key);
+    server->seat = seat;
+    server->socket = g_steal_pointer (&socket);
+    g_signal_connect (seat, SEAT_XVNC_SIGNAL_READY, G_CALLBACK (seat_ready_cb), server);
+    g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (seat_stopped_cb), server);
+    priv->servers = g_list_append (priv->servers, server);
+
+    return TRUE;
+}
+
+/* Start servers until there are enough waiting */
+static void
+fill (VNCPool *pool)
+{
+    VNCPoolPrivate *priv = vnc_pool_get_instance_private (pool);
+
+    g_autofree gchar *key = get_bucket_key (NULL);
+    guint n_waiting = 0;
+    g_autoptr(GList) unneeded = NULL;
+    for (GList *link = priv->servers; link; link = link->next)
+    {
+        PooledServer *server = link->data;
+
+        if (server->client || server->stopping)
+            continue;
+
+        /* Stop servers started with old settings */
+        if (strcmp (server->key, key) != 0 || n_waiting >= priv->size)
+        {
+            server->stopping = TRUE;
+            unneeded = g_list_append (unneeded, g_object_ref (server->seat));
+        }
+        else
+            n_waiting++;
+    }
+    for (GList *link = unneeded; link; link = link->next)
+    {
+        seat_stop (SEAT (link->data));
+        g_object_unref (link->data);
+    }
+
+    for (; n_waiting < priv->size; n_waiting++)
+        if (!start_server (pool, key))
+            break;
+}
+
+void
+vnc_pool_set_size (VNCPool *pool, guint size)
+{
+    VNCPoolPrivate *priv = vnc_pool_get_instance_private (pool);
+    priv->size = size;
+}
+
+void
+vnc_pool_start (VNCPool *pool)
+{
+    log_debug (LOG_SUBSYSTEM_VNC, "Starting VNC server pool");
+    fill (pool);
+}
+
+gboolean
+vnc_pool_take (VNCPool *pool, GSocket *client)
+{
+    VNCPoolPrivate *priv = vnc_pool_get_instance_private (pool);
+
+    g_autofree gchar *key = get_bucket_key (client);
+    PooledServer *server = NULL;
+    for (GList *link = priv->servers; link && !server; link = link->next)
+    {
+        PooledServer *s = link->data;
+        if (!s->client && s->ready && strcmp (s->key, key) == 0)
+            server = s;
+    }
+    if (!server)
+    {
+        log_debug (LOG_SUBSYSTEM_VNC, "No pooled VNC server ready for %s", key);
+        return FALSE;
+    }
+
+    log_debug (LOG_SUBSYSTEM_VNC, "Handing VNC connection to pooled server on seat %s", seat_get_name (SEAT (server->seat)));
+
+    server->client = g_object_ref (client);
+    g_socket_set_blocking (client, FALSE);
+    seat_xvnc_set_client (server->seat, client);
+    server->to_server = relay_direction_new (server, client, server->socket);
+    server->to_client = relay_direction_new (server, server->socket, client);
+
+    /* Replace the server that was taken */
+    fill (pool);
+
+    return TRUE;
+}
+
+static void
+vnc_pool_init (VNCPool *pool)
+{
+}
+
+static void
+vnc_pool_finalize (GObject *object)
+{
+    VNCPool *self = VNC_POOL (object);
+    VNCPoolPrivate *priv = vnc_pool_get_instance_private (self);
+
+    g_list_free_full (priv->servers, (GDestroyNotify) pooled_server_free);
+
+    G_OBJECT_CLASS (vnc_pool_parent_class)->finalize (object);
+}
+
+static void
+vnc_pool_class_init (VNCPoolClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = vnc_pool_finalize;
+
+    signals[CREATE_SEAT] =
+        g_signal_new (VNC_POOL_SIGNAL_CREATE_SEAT,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (VNCPoolClass, create_seat),
+                      g_signal_accumulator_first_wins,
+                      NULL,
+                      NULL,
+                      SEAT_XVNC_TYPE, 1, G_TYPE_SOCKET);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef VNC_POOL_H_
+#define VNC_POOL_H_
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "seat-xvnc.h"
+
+G_BEGIN_DECLS
+
+#define VNC_POOL_TYPE (vnc_pool_get_type())
+#define VNC_POOL(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), VNC_POOL_TYPE, VNCPool))
+
+#define VNC_POOL_SIGNAL_CREATE_SEAT "create-seat"
+
+typedef struct
+{
+    GObject parent_instance;
+} VNCPool;
+
+typedef struct
+{
+    GObjectClass parent_class;
+
+    SeatXVNC *(*create_seat)(VNCPool *pool, GSocket *connection);
+} VNCPoolClass;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VNCPool, g_object_unref)
+
+GType vnc_pool_get_type (void);
+
+VNCPool *vnc_pool_new (void);
+
+void vnc_pool_set_size (VNCPool *pool, guint size);
+
+void vnc_pool_start (VNCPool *pool);
+
+gboolean vnc_pool_take (VNCPool *pool, GSocket *client);
+
+G_END_DECLS
+
+#endif /* VNC_POOL_H_ */
@@ -9,9 +9,14 @@
  * license.
  */
 
+#include <string.h>
+#include <sys/socket.h>
 #include <gio/gio.h>
 
 #include "vnc-server.h"
+#include "metrics.h"
+#include "socket-activation.h"
+#include "logger.h"
 
 enum {
     NEW_CONNECTION,
@@ -29,8 +34,80 @@ typedef struct
 
     /* Listening sockets */
     GSocket *socket, *socket6;
+
+    /* Maximum number of X servers to be starting at once (0 for no limit) */
+    guint max_launches;
+
+    /* Maximum number of connections per minute from one address (0 for no limit) */
+    guint rate_limit;
+
+    /* Milliseconds a connection has to wait quietly before it is launched (0 to launch straight away) */
+    guint admission_timeout;
+
+    /* Connections waiting to be admitted */
+    GHashTable *probes;
+
+    /* Connections waiting to be launched */
+    GQueue *queue;
+
+    /* Connections being launched, keyed by socket with the time they were accepted */
+    GHashTable *launches;
+
+    /* Connection counts for each remote address in the current rate limit window */
+    GHashTable *address_counts;
+    gint64 rate_window_start;
+
+    /* Statistics */
+    guint n_rejected;
+    guint n_launched;
+    gint64 total_launch_time;
 } VNCServerPrivate;
 
+typedef struct
+{
+    VNCServer *server;
+    GSocket *socket;
+    gchar *hostname;
+    gint64 accept_time;
+
+    /* Sources watching the connection before it is admitted */
+    GSource *read_source;
+    GSource *timeout_source;
+} PendingConnection;
+
+static void
+clear_source (GSource **source)
+{
+    if (!*source)
+        return;
+    g_source_destroy (*source);
+    g_clear_pointer (source, g_source_unref);
+}
+
+static void
+pending_connection_free (PendingConnection *connection)
+{
+    clear_source (&connection->read_source);
+    clear_source (&connection->timeout_source);
+    g_object_unref (connection->socket);
+    g_free (connection->hostname);
+    g_free (connection);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PendingConnection, pending_connection_free)
+
+/* Maximum number of connections to accept in one main loop iteration */
+#define MAX_ACCEPTS 32
+
+/* Maximum number of connections to hold waiting for a launch slot */
+#define MAX_QUEUED_CONNECTIONS 256
+
+/* Length of time rate limits apply over in microseconds */
+#define RATE_LIMIT_WINDOW (60 * G_USEC_PER_SEC)
+
+/* Maximum number of connections from one address waiting to be admitted */
+#define MAX_PROBES_PER_ADDRESS 8
+
 G_DEFINE_TYPE_WITH_PRIVATE (VNCServer, vnc_server, G_TYPE_OBJECT)
 
 VNCServer *
@@ -74,23 +151,265 @@ vnc_server_get_listen_address (VNCServer *server)
     return priv->listen_address;
 }
 
+void
+vnc_server_set_max_launches (VNCServer *server, guint max_launches)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->max_launches = max_launches;
+}
+
+void
+vnc_server_set_rate_limit (VNCServer *server, guint rate_limit)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->rate_limit = rate_limit;
+}
+
+void
+vnc_server_set_admission_timeout (VNCServer *server, guint timeout)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->admission_timeout = timeout;
+}
+
+guint
+vnc_server_get_queue_length (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, 0);
+    return g_queue_get_length (priv->queue);
+}
+
+guint
+vnc_server_get_active_launches (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, 0);
+    return g_hash_table_size (priv->launches);
+}
+
+guint
+vnc_server_get_rejected_connections (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, 0);
+    return priv->n_rejected;
+}
+
+guint
+vnc_server_get_average_launch_time (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, 0);
+    if (priv->n_launched == 0)
+        return 0;
+    return priv->total_launch_time / priv->n_launched / 1000;
+}
+
+static void
+start_launches (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    while (!g_queue_is_empty (priv->queue) &&
+           (priv->max_launches == 0 || g_hash_table_size (priv->launches) < priv->max_launches))
+    {
+        g_autoptr(PendingConnection) connection = g_queue_pop_head (priv->queue);
+
+        gint64 *accept_time = g_malloc (sizeof (gint64));
+        *accept_time = connection->accept_time;
+        g_hash_table_insert (priv->launches, g_object_ref (connection->socket), accept_time);
+        g_signal_emit (server, signals[NEW_CONNECTION], 0, connection->socket);
+    }
+}
+
+void
+vnc_server_launch_complete (VNCServer *server, GSocket *socket)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+    g_return_if_fail (socket != NULL);
+
+    gint64 *accept_time = g_hash_table_lookup (priv->launches, socket);
+    if (!accept_time)
+        return;
+
+    gint64 launch_time = g_get_monotonic_time () - *accept_time;
+    log_debug (LOG_SUBSYSTEM_VNC, "VNC connection launched in %" G_GINT64_FORMAT "ms", launch_time / 1000);
+    priv->n_launched++;
+    priv->total_launch_time += launch_time;
+    common_metrics_observe ("lightdm_vnc_launch_duration_seconds", NULL, launch_time / (gdouble) G_USEC_PER_SEC);
+    g_hash_table_remove (priv->launches, socket);
+
+    start_launches (server);
+}
+
 static gboolean
-read_cb (GSocket *socket, GIOCondition condition, VNCServer *server)
+check_rate_limit (VNCServer *server, const gchar *hostname)
 {
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GSocket) client_socket = g_socket_accept (socket, NULL, &error);
-    if (error)
-        g_warning ("Failed to get connection from from VNC socket: %s", error->message);
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    if (priv->rate_limit == 0)
+        return TRUE;
 
-    if (client_socket)
+    gint64 now = g_get_monotonic_time ();
+    if (now - priv->rate_window_start >= RATE_LIMIT_WINDOW)
     {
-        GInetSocketAddress *address = G_INET_SOCKET_ADDRESS (g_socket_get_remote_address (client_socket, NULL));
-        g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (address));
-        g_debug ("Got VNC connection from %s:%d", hostname, g_inet_socket_address_get_port (address));
+        g_hash_table_remove_all (priv->address_counts);
+        priv->rate_window_start = now;
+    }
+
+    guint count = GPOINTER_TO_UINT (g_hash_table_lookup (priv->address_counts, hostname));
+    if (count >= priv->rate_limit)
+        return FALSE;
+    g_hash_table_insert (priv->address_counts, g_strdup (hostname), GUINT_TO_POINTER (count + 1));
 
-        g_signal_emit (server, signals[NEW_CONNECTION], 0, client_socket);
+    return TRUE;
+}
+
+static gboolean
+queue_connection (VNCServer *server, PendingConnection *connection)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    if (g_queue_get_length (priv->queue) >= MAX_QUEUED_CONNECTIONS)
+    {
+        log_debug (LOG_SUBSYSTEM_VNC, "Rejecting VNC connection from %s, too many connections waiting", connection->hostname);
+        priv->n_rejected++;
+        common_metrics_add ("lightdm_vnc_connections_total", "result=\"queue-full\"", 1);
+        pending_connection_free (connection);
+        return FALSE;
     }
 
+    common_metrics_add ("lightdm_vnc_connections_total", "result=\"accepted\"", 1);
+    g_queue_push_tail (priv->queue, connection);
+
+    return TRUE;
+}
+
+/* VNC clients wait for the server to speak first, so anything that sends
+ * data or hangs up before then isn't worth starting an X server for */
+static gboolean
+probe_read_cb (GSocket *socket, GIOCondition condition, PendingConnection *connection)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (connection->server);
+
+    gchar buffer;
+    gboolean closed = (condition & (G_IO_HUP | G_IO_ERR)) != 0 || recv (g_socket_get_fd (socket), &buffer, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+    log_debug (LOG_SUBSYSTEM_VNC, "Rejecting VNC connection from %s, it %s before the handshake", connection->hostname, closed ? "closed" : "sent data");
+    priv->n_rejected++;
+    common_metrics_add ("lightdm_vnc_connections_total", "result=\"handshake-failed\"", 1);
+
+    g_clear_pointer (&connection->read_source, g_source_unref);
+    g_hash_table_remove (priv->probes, connection);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+probe_timeout_cb (PendingConnection *connection)
+{
+    VNCServer *server = connection->server;
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    g_clear_pointer (&connection->timeout_source, g_source_unref);
+    clear_source (&connection->read_source);
+    g_hash_table_steal (priv->probes, connection);
+    if (queue_connection (server, connection))
+        start_launches (server);
+
+    return G_SOURCE_REMOVE;
+}
+
+static guint
+count_probes (VNCServer *server, const gchar *hostname)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    guint count = 0;
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init (&iter, priv->probes);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        PendingConnection *connection = key;
+        if (strcmp (connection->hostname, hostname) == 0)
+            count++;
+    }
+
+    return count;
+}
+
+static void
+start_probe (VNCServer *server, PendingConnection *connection)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    connection->read_source = g_socket_create_source (connection->socket, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback (connection->read_source, (GSourceFunc) probe_read_cb, connection, NULL);
+    g_source_attach (connection->read_source, NULL);
+    connection->timeout_source = g_timeout_source_new (priv->admission_timeout);
+    g_source_set_callback (connection->timeout_source, (GSourceFunc) probe_timeout_cb, connection, NULL);
+    g_source_attach (connection->timeout_source, NULL);
+    g_hash_table_add (priv->probes, connection);
+}
+
+static gboolean
+read_cb (GSocket *socket, GIOCondition condition, VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    /* Take everything waiting in the backlog, within reason so other sources get to run */
+    for (int i = 0; i < MAX_ACCEPTS; i++)
+    {
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GSocket) client_socket = g_socket_accept (socket, NULL, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            break;
+        if (error)
+            g_warning ("Failed to get connection from from VNC socket: %s", error->message);
+        if (!client_socket)
+            break;
+
+        g_autoptr(GSocketAddress) address = g_socket_get_remote_address (client_socket, NULL);
+        if (!address)
+            continue;
+        GInetSocketAddress *inet_address = G_INET_SOCKET_ADDRESS (address);
+        g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (inet_address));
+        log_debug (LOG_SUBSYSTEM_VNC, "Got VNC connection from %s:%d", hostname, g_inet_socket_address_get_port (inet_address));
+
+        if (!check_rate_limit (server, hostname))
+        {
+            log_debug (LOG_SUBSYSTEM_VNC, "Rejecting VNC connection from %s, too many connections", hostname);
+            priv->n_rejected++;
+            common_metrics_add ("lightdm_vnc_connections_total", "result=\"rate-limited\"", 1);
+            continue;
+        }
+        if (priv->admission_timeout > 0 && count_probes (server, hostname) >= MAX_PROBES_PER_ADDRESS)
+        {
+            log_debug (LOG_SUBSYSTEM_VNC, "Rejecting VNC connection from %s, too many connections being checked", hostname);
+            priv->n_rejected++;
+            common_metrics_add ("lightdm_vnc_connections_total", "result=\"rate-limited\"", 1);
+            continue;
+        }
+
+        PendingConnection *connection = g_malloc0 (sizeof (PendingConnection));
+        connection->server = server;
+        connection->socket = g_steal_pointer (&client_socket);
+        connection->hostname = g_steal_pointer (&hostname);
+        connection->accept_time = g_get_monotonic_time ();
+        if (priv->admission_timeout > 0)
+            start_probe (server, connection);
+        else
+            queue_connection (server, connection);
+    }
+
+    start_launches (server);
+
     return TRUE;
 }
 
@@ -116,6 +435,9 @@ open_tcp_socket (GSocketFamily family, guint port, const gchar *listen_address,
         !g_socket_listen (socket, error))
         return NULL;
 
+    /* Accept until the backlog is empty */
+    g_socket_set_blocking (socket, FALSE);
+
     return g_steal_pointer (&socket);
 }
 
@@ -126,10 +448,23 @@ vnc_server_start (VNCServer *server)
 
     g_return_val_if_fail (server != NULL, FALSE);
 
-    g_autoptr(GError) ipv4_error = NULL;
-    priv->socket = open_tcp_socket (G_SOCKET_FAMILY_IPV4, priv->port, priv->listen_address, &ipv4_error);
-    if (ipv4_error)
-        g_warning ("Failed to create IPv4 VNC socket: %s", ipv4_error->message);
+    /* Use sockets passed by the service manager if we were socket activated */
+    priv->socket = socket_activation_take (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, priv->port);
+    priv->socket6 = socket_activation_take (G_SOCKET_FAMILY_IPV6, G_SOCKET_TYPE_STREAM, priv->port);
+    if (priv->socket || priv->socket6)
+        log_debug (LOG_SUBSYSTEM_VNC, "Using VNC socket(s) passed by service manager");
+    else
+    {
+        g_autoptr(GError) ipv4_error = NULL;
+        priv->socket = open_tcp_socket (G_SOCKET_FAMILY_IPV4, priv->port, priv->listen_address, &ipv4_error);
+        if (ipv4_error)
+            g_warning ("Failed to create IPv4 VNC socket: %s", ipv4_error->message);
+
+        g_autoptr(GError) ipv6_error = NULL;
+        priv->socket6 = open_tcp_socket (G_SOCKET_FAMILY_IPV6, priv->port, priv->listen_address, &ipv6_error);
+        if (ipv6_error)
+            g_warning ("Failed to create IPv6 VNC socket: %s", ipv6_error->message);
+    }
 
     if (priv->socket)
     {
@@ -138,11 +473,6 @@ vnc_server_start (VNCServer *server)
         g_source_attach (source, NULL);
     }
 
-    g_autoptr(GError) ipv6_error = NULL;
-    priv->socket6 = open_tcp_socket (G_SOCKET_FAMILY_IPV6, priv->port, priv->listen_address, &ipv6_error);
-    if (ipv6_error)
-        g_warning ("Failed to create IPv6 VNC socket: %s", ipv6_error->message);
-
     if (priv->socket6)
     {
         GSource *source = g_socket_create_source (priv->socket6, G_IO_IN, NULL);
@@ -161,6 +491,10 @@ vnc_server_init (VNCServer *server)
 {
     VNCServerPrivate *priv = vnc_server_get_instance_private (server);
     priv->port = 5900;
+    priv->queue = g_queue_new ();
+    priv->launches = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, g_free);
+    priv->address_counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->probes = g_hash_table_new_full (g_direct_hash, g_direct_equal, (GDestroyNotify) pending_connection_free, NULL);
 }
 
 static void
@@ -172,6 +506,10 @@ vnc_server_finalize (GObject *object)
     g_clear_pointer (&priv->listen_address, g_free);
     g_clear_object (&priv->socket);
     g_clear_object (&priv->socket6);
+    g_queue_free_full (priv->queue, (GDestroyNotify) pending_connection_free);
+    g_hash_table_unref (priv->launches);
+    g_hash_table_unref (priv->address_counts);
+    g_hash_table_unref (priv->probes);
 
     G_OBJECT_CLASS (vnc_server_parent_class)->finalize (object);
 }
@@ -45,8 +45,24 @@ void vnc_server_set_listen_address (VNCServer *server, const gchar *listen_addre
 
 const gchar *vnc_server_get_listen_address (VNCServer *server);
 
+void vnc_server_set_max_launches (VNCServer *server, guint max_launches);
+
+void vnc_server_set_rate_limit (VNCServer *server, guint rate_limit);
+
+void vnc_server_set_admission_timeout (VNCServer *server, guint timeout);
+
 gboolean vnc_server_start (VNCServer *server);
 
+void vnc_server_launch_complete (VNCServer *server, GSocket *socket);
+
+guint vnc_server_get_queue_length (VNCServer *server);
+
+guint vnc_server_get_active_launches (VNCServer *server);
+
+guint vnc_server_get_rejected_connections (VNCServer *server);
+
+guint vnc_server_get_average_launch_time (VNCServer *server);
+
 G_END_DECLS
 
 #endif /* VNC_SERVER_H_ */
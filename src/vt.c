@@ -23,7 +23,18 @@
 #include "vt.h"
 #include "configuration.h"
 
-static GList *used_vts = NULL;
+/* Highest VT number the kernel supports */
+#define VT_MAX 63
+
+#define VT_MASK(number) (G_GUINT64_CONSTANT (1) << (number))
+
+/* VTs we are using (bit n for VT n) and how many users each has */
+static guint64 used_vts = 0;
+static guint vt_ref_counts[VT_MAX + 1];
+
+/* VTs the kernel has allocated to something other than us */
+static guint64 kernel_vts = 0;
+static gboolean have_kernel_vts = FALSE;
 
 static gint
 open_tty (void)
@@ -70,57 +81,144 @@ vt_get_active (void)
 #endif
 }
 
+#ifdef __linux__
+typedef struct
+{
+    gint number;
+    gint tty_fd;
+} VTSwitch;
+
+static void
+wait_active_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    VTSwitch *vt_switch = task_data;
+    gint tty_fd = vt_switch->tty_fd;
+    gint number = vt_switch->number;
+
+    /* Wait for the VT to become active to avoid a suspected
+     * race condition somewhere between LightDM, X, ConsoleKit and the kernel.
+     * See https://bugs.launchpad.net/bugs/851612 */
+    /* This call sometimes get interrupted (not sure what signal is causing it), so retry if that is the case */
+    while (ioctl (tty_fd, VT_WAITACTIVE, number) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        int e = errno;
+        close (tty_fd);
+        g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (e), "Error using VT_WAITACTIVE %d on /dev/tty0: %s", number, strerror (e));
+        return;
+    }
+
+    close (tty_fd);
+    g_task_return_boolean (task, TRUE);
+}
+#endif
+
+/* Switch VT; the switch is requested straight away and waiting for the kernel
+ * to complete it is done in a worker thread so the main loop is not blocked */
 void
-vt_set_active (gint number)
+vt_set_active_async (gint number, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
 {
+    g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+
 #ifdef __linux__
     g_debug ("Activating VT %d", number);
 
     /* Pretend always active */
     if (getuid () != 0)
+    {
+        g_task_return_boolean (task, TRUE);
         return;
+    }
 
     gint tty_fd = open_tty ();
-    if (tty_fd >= 0)
+    if (tty_fd < 0)
     {
-        int n = number;
-        if (ioctl (tty_fd, VT_ACTIVATE, n) < 0)
-        {
-            g_warning ("Error using VT_ACTIVATE %d on /dev/tty0: %s", n, strerror (errno));
-            close (tty_fd);
-            return;
-        }
-
-        /* Wait for the VT to become active to avoid a suspected
-         * race condition somewhere between LightDM, X, ConsoleKit and the kernel.
-         * See https://bugs.launchpad.net/bugs/851612 */
-        /* This call sometimes get interrupted (not sure what signal is causing it), so retry if that is the case */
-        while (TRUE)
-        {
-            if (ioctl (tty_fd, VT_WAITACTIVE, n) < 0) 
-            {
-                if (errno == EINTR)
-                    continue;
-                g_warning ("Error using VT_WAITACTIVE %d on /dev/tty0: %s", n, strerror (errno));
-            }
-            break;
-        }
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Unable to open /dev/tty0");
+        return;
+    }
 
+    if (ioctl (tty_fd, VT_ACTIVATE, number) < 0)
+    {
+        int e = errno;
         close (tty_fd);
+        g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (e), "Error using VT_ACTIVATE %d on /dev/tty0: %s", number, strerror (e));
+        return;
+    }
+
+    VTSwitch *vt_switch = g_malloc0 (sizeof (VTSwitch));
+    vt_switch->number = number;
+    vt_switch->tty_fd = tty_fd;
+    g_task_set_task_data (task, vt_switch, g_free);
+    g_task_run_in_thread (task, wait_active_thread);
+#else
+    g_task_return_boolean (task, TRUE);
+#endif
+}
+
+gboolean
+vt_set_active_finish (GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Find which VTs are allocated before we start using any */
+static void
+load_kernel_vts (void)
+{
+    if (have_kernel_vts)
+        return;
+    have_kernel_vts = TRUE;
+
+#ifdef __linux__
+    gint tty_fd = open_tty ();
+    if (tty_fd < 0)
+        return;
+
+    /* VT_GETSTATE reports the first 15 VTs, bit 0 is always set */
+    struct vt_stat vt_state = { 0 };
+    if (ioctl (tty_fd, VT_GETSTATE, &vt_state) < 0)
+        g_warning ("Error using VT_GETSTATE on /dev/tty0: %s", strerror (errno));
+    else
+        kernel_vts |= vt_state.v_state & ~1;
+
+    /* VT_OPENQRY reports the first free VT, so everything below it is allocated */
+    int first_free = -1;
+    if (ioctl (tty_fd, VT_OPENQRY, &first_free) == 0)
+    {
+        for (int n = 16; n < first_free && n <= VT_MAX; n++)
+            kernel_vts |= VT_MASK (n);
     }
+
+    close (tty_fd);
+
+    if (kernel_vts != 0)
+        g_debug ("Kernel has VTs allocated: 0x%" G_GINT64_MODIFIER "x", kernel_vts);
 #endif
 }
 
+/* Check if a VT the kernel has allocated is still being used by another program */
 static gboolean
-vt_is_used (gint number)
+kernel_vt_is_used (gint number)
 {
-    for (GList *link = used_vts; link; link = link->next)
+    if ((kernel_vts & VT_MASK (number)) == 0)
+        return FALSE;
+
+#ifdef __linux__
+    /* VTs left allocated by programs that have exited can be freed, ones still open can't */
+    gint tty_fd = open_tty ();
+    if (tty_fd < 0)
+        return TRUE;
+    gboolean result = ioctl (tty_fd, VT_DISALLOCATE, number) < 0;
+    close (tty_fd);
+    if (result)
     {
-        int n = GPOINTER_TO_INT (link->data);
-        if (n == number)
-            return TRUE;
+        g_debug ("VT %d is in use by another program", number);
+        return TRUE;
     }
+#endif
 
+    kernel_vts &= ~VT_MASK (number);
     return FALSE;
 }
 
@@ -140,23 +238,42 @@ vt_get_unused (void)
     if (getuid () != 0)
         return -1;
 
-    gint number = vt_get_min ();
-    while (vt_is_used (number))
-        number++;
+    load_kernel_vts ();
 
-    return number;
+    for (gint number = vt_get_min (); number <= VT_MAX; number++)
+    {
+        if ((used_vts & VT_MASK (number)) == 0 && !kernel_vt_is_used (number))
+            return number;
+    }
+
+    g_warning ("No free VTs");
+    return -1;
 }
 
 void
 vt_ref (gint number)
 {
     g_debug ("Using VT %d", number);
-    used_vts = g_list_append (used_vts, GINT_TO_POINTER (number));
+
+    g_return_if_fail (number > 0 && number <= VT_MAX);
+
+    vt_ref_counts[number]++;
+    used_vts |= VT_MASK (number);
+
+    /* Once we have had it, the kernel state for it is ours */
+    kernel_vts &= ~VT_MASK (number);
 }
 
 void
 vt_unref (gint number)
 {
     g_debug ("Releasing VT %d", number);
-    used_vts = g_list_remove (used_vts, GINT_TO_POINTER (number));
+
+    g_return_if_fail (number > 0 && number <= VT_MAX);
+
+    if (vt_ref_counts[number] == 0)
+        return;
+    vt_ref_counts[number]--;
+    if (vt_ref_counts[number] == 0)
+        used_vts &= ~VT_MASK (number);
 }
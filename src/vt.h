@@ -12,7 +12,7 @@
 #ifndef VT_H_
 #define VT_H_
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 gboolean vt_can_multi_seat (void);
 
@@ -26,6 +26,8 @@ void vt_ref (gint number);
 
 void vt_unref (gint number);
 
-void vt_set_active (gint number);
+void vt_set_active_async (gint number, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean vt_set_active_finish (GAsyncResult *result, GError **error);
 
 #endif /* VT_H_ */
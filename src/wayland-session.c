@@ -53,6 +53,19 @@ wayland_session_get_vt (DisplayServer *server)
     return priv->vt;
 }
 
+static const gchar *
+wayland_session_get_session_type (DisplayServer *server)
+{
+    return "wayland";
+}
+
+static gboolean
+wayland_session_get_can_share (DisplayServer *server)
+{
+    /* The compositor belongs to the session, so the VT can be handed from the greeter straight to the user */
+    return TRUE;
+}
+
 static void
 wayland_session_connect_session (DisplayServer *display_server, Session *session)
 {
@@ -98,6 +111,8 @@ wayland_session_class_init (WaylandSessionClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
     DisplayServerClass *display_server_class = DISPLAY_SERVER_CLASS (klass);
 
+    display_server_class->get_session_type = wayland_session_get_session_type;
+    display_server_class->get_can_share = wayland_session_get_can_share;
     display_server_class->get_vt = wayland_session_get_vt;
     display_server_class->connect_session = wayland_session_connect_session;
     display_server_class->disconnect_session = wayland_session_disconnect_session;
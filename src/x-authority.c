@@ -15,10 +15,23 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <config.h>
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
 #include <glib/gstdio.h>
 
 #include "x-authority.h"
 
+/* Length of MIT-MAGIC-COOKIE-1 data */
+#define COOKIE_LENGTH 16
+
+/* Random data for cookies, read in blocks so a burst of new cookies doesn't need a system call for each */
+#define COOKIE_POOL_SIZE (COOKIE_LENGTH * 64)
+static guint8 cookie_pool[COOKIE_POOL_SIZE];
+static gsize cookie_pool_offset = COOKIE_POOL_SIZE;
+static pid_t cookie_pool_pid = 0;
+
 typedef struct
 {
     /* Protocol family */
@@ -55,14 +68,89 @@ x_authority_new (guint16 family, const guint8 *address, gsize address_length, co
     return auth;
 }
 
+static gboolean
+read_random (guint8 *data, gsize length)
+{
+#ifdef HAVE_GETRANDOM
+    gsize n_read = 0;
+    while (n_read < length)
+    {
+        ssize_t n = getrandom (data + n_read, length - n_read, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        n_read += n;
+    }
+    if (n_read == length)
+        return TRUE;
+#endif
+
+    int fd = open ("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return FALSE;
+    gsize n_read_urandom = 0;
+    while (n_read_urandom < length)
+    {
+        ssize_t n = read (fd, data + n_read_urandom, length - n_read_urandom);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        n_read_urandom += n;
+    }
+    close (fd);
+
+    return n_read_urandom == length;
+}
+
+/* Make sure the pool has at least length bytes, topping it up in a single read */
+static void
+fill_cookie_pool (gsize length)
+{
+    /* Don't share the pool with a forked child */
+    if (cookie_pool_pid != getpid ())
+    {
+        explicit_bzero (cookie_pool, COOKIE_POOL_SIZE);
+        cookie_pool_offset = COOKIE_POOL_SIZE;
+        cookie_pool_pid = getpid ();
+    }
+
+    gsize n_unused = COOKIE_POOL_SIZE - cookie_pool_offset;
+    if (n_unused >= length)
+        return;
+
+    /* Keep any unused data at the front */
+    memmove (cookie_pool, cookie_pool + cookie_pool_offset, n_unused);
+    cookie_pool_offset = 0;
+    if (!read_random (cookie_pool + n_unused, COOKIE_POOL_SIZE - n_unused))
+    {
+        g_warning ("Failed to read random data for X authority cookies, using weak random numbers: %s", strerror (errno));
+        for (gsize i = n_unused; i < COOKIE_POOL_SIZE; i++)
+            cookie_pool[i] = g_random_int () & 0xFF;
+    }
+}
+
+void
+x_authority_reserve_cookies (guint n_cookies)
+{
+    fill_cookie_pool (MIN ((gsize) n_cookies * COOKIE_LENGTH, COOKIE_POOL_SIZE));
+}
+
 XAuthority *
 x_authority_new_cookie (guint16 family, const guint8 *address, gsize address_length, const gchar *number)
 {
-    guint8 cookie[16];
-    for (gint i = 0; i < 16; i++)
-        cookie[i] = g_random_int () & 0xFF;
+    /* Take the random data out of the pool, it is wiped so it can't be handed out twice */
+    guint8 cookie[COOKIE_LENGTH];
+    fill_cookie_pool (COOKIE_LENGTH);
+    memcpy (cookie, cookie_pool + cookie_pool_offset, COOKIE_LENGTH);
+    explicit_bzero (cookie_pool + cookie_pool_offset, COOKIE_LENGTH);
+    cookie_pool_offset += COOKIE_LENGTH;
+
+    XAuthority *auth = x_authority_new (family, address, address_length, number, "MIT-MAGIC-COOKIE-1", cookie, COOKIE_LENGTH);
+    explicit_bzero (cookie, COOKIE_LENGTH);
 
-    return x_authority_new (family, address, address_length, number, "MIT-MAGIC-COOKIE-1", cookie, 16);
+    return auth;
 }
 
 XAuthority *
@@ -189,8 +277,35 @@ x_authority_get_authorization_data_length (XAuthority *auth)
     return priv->authorization_data_length;
 }
 
+/* Location of a record in an Xauthority file */
+typedef struct
+{
+    /* Bytes the record covers */
+    gsize start;
+    gsize end;
+
+    guint16 family;
+    const guint8 *address;
+    guint16 address_length;
+    const gchar *number;
+    guint16 number_length;
+    const gchar *authorization_name;
+    guint16 authorization_name_length;
+
+    /* Offset of the authorization data */
+    gsize authorization_data_offset;
+    guint16 authorization_data_length;
+} XAuthRecord;
+
+/* A record that matches an authority being written */
+typedef struct
+{
+    XAuthRecord record;
+    XAuthority *auth;
+} XAuthMatch;
+
 static gboolean
-read_uint16 (gchar *data, gsize data_length, gsize *offset, guint16 *value)
+read_uint16 (const guint8 *data, gsize data_length, gsize *offset, guint16 *value)
 {
     if (data_length - *offset < 2)
         return FALSE;
@@ -202,164 +317,329 @@ read_uint16 (gchar *data, gsize data_length, gsize *offset, guint16 *value)
 }
 
 static gboolean
-read_data (gchar *data, gsize data_length, gsize *offset, guint16 length, guint8 **value)
+read_data (const guint8 *data, gsize data_length, gsize *offset, guint16 *length, const guint8 **value)
 {
-    g_free (*value);
-    *value = NULL;
-
-    if (data_length - *offset < length)
+    if (!read_uint16 (data, data_length, offset, length))
+        return FALSE;
+    if (data_length - *offset < *length)
         return FALSE;
 
-    *value = g_malloc0 (length + 1);
-    for (int i = 0; i < length; i++)
-        (*value)[i] = data[*offset + i];
-    *offset += length;
-    (*value)[length] = 0;
+    *value = data + *offset;
+    *offset += *length;
 
     return TRUE;
 }
 
+/* Find the record at @offset without copying it */
 static gboolean
-read_string (gchar *data, gsize data_length, gsize *offset, gchar **value)
+read_record (const guint8 *data, gsize data_length, gsize offset, XAuthRecord *record)
 {
-    guint16 length;
-    if (!read_uint16 (data, data_length, offset, &length))
+    const guint8 *authorization_data;
+
+    record->start = offset;
+    if (!read_uint16 (data, data_length, &offset, &record->family) ||
+        !read_data (data, data_length, &offset, &record->address_length, &record->address) ||
+        !read_data (data, data_length, &offset, &record->number_length, (const guint8 **) &record->number) ||
+        !read_data (data, data_length, &offset, &record->authorization_name_length, (const guint8 **) &record->authorization_name) ||
+        !read_data (data, data_length, &offset, &record->authorization_data_length, &authorization_data))
         return FALSE;
-    return read_data (data, data_length, offset, length, (guint8 **) value);
+    record->authorization_data_offset = authorization_data - data;
+    record->end = offset;
+
+    return TRUE;
 }
 
 static gboolean
-write_uint16 (int fd, guint16 value)
+record_matches (XAuthority *auth, XAuthRecord *record)
+{
+    XAuthorityPrivate *priv = x_authority_get_instance_private (auth);
+
+    return priv->family == record->family &&
+           priv->address_length == record->address_length &&
+           memcmp (priv->address, record->address, record->address_length) == 0 &&
+           strlen (priv->number) == record->number_length &&
+           memcmp (priv->number, record->number, record->number_length) == 0;
+}
+
+static void
+append_uint16 (GByteArray *buffer, guint16 value)
 {
     guint8 v[2];
     v[0] = value >> 8;
     v[1] = value & 0xFF;
-    return write (fd, v, 2) == 2;
+    g_byte_array_append (buffer, v, 2);
+}
+
+static void
+append_data (GByteArray *buffer, const guint8 *value, gsize value_length)
+{
+    append_uint16 (buffer, value_length);
+    g_byte_array_append (buffer, value, value_length);
+}
+
+static void
+append_string (GByteArray *buffer, const gchar *value)
+{
+    append_data (buffer, (const guint8 *) value, value ? strlen (value) : 0);
 }
 
 static gboolean
-write_data (int fd, const guint8 *value, gsize value_length)
+write_all (int fd, const guint8 *data, gsize data_length)
 {
-    return write (fd, value, value_length) == value_length;
+    while (data_length > 0)
+    {
+        ssize_t n_written = write (fd, data, data_length);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return FALSE;
+        data += n_written;
+        data_length -= n_written;
+    }
+
+    return TRUE;
 }
 
 static gboolean
-write_string (int fd, const gchar *value)
+write_buffer (int fd, GByteArray *buffer)
 {
-    size_t value_length = strlen (value);
-    return write_uint16 (fd, value_length) && write_data (fd, (guint8 *) value, value_length);
+    gboolean result = write_all (fd, buffer->data, buffer->len);
+    g_byte_array_set_size (buffer, 0);
+    return result;
 }
 
+/* Write the existing records with the matches patched or removed, then any new records */
+static gboolean
+write_records (int fd, const guint8 *input, gsize input_length, GArray *matches, GList *new_auths, XAuthWriteMode mode)
+{
+    g_autoptr(GByteArray) buffer = g_byte_array_new ();
+    gsize offset = 0;
+
+    for (guint i = 0; i < matches->len; i++)
+    {
+        XAuthMatch *match = &g_array_index (matches, XAuthMatch, i);
+        XAuthorityPrivate *priv = x_authority_get_instance_private (match->auth);
+
+        /* Copy the unchanged records before this one as they are */
+        if (!write_all (fd, input + offset, match->record.start - offset))
+            return FALSE;
+        offset = match->record.end;
+
+        if (mode == XAUTH_WRITE_MODE_REMOVE)
+            continue;
+
+        /* Keep the existing authorization scheme and update the data */
+        append_uint16 (buffer, match->record.family);
+        append_data (buffer, match->record.address, match->record.address_length);
+        append_data (buffer, (const guint8 *) match->record.number, match->record.number_length);
+        append_data (buffer, (const guint8 *) match->record.authorization_name, match->record.authorization_name_length);
+        append_data (buffer, priv->authorization_data, priv->authorization_data_length);
+        if (!write_buffer (fd, buffer))
+            return FALSE;
+    }
+    if (!write_all (fd, input + offset, input_length - offset))
+        return FALSE;
+
+    for (GList *link = new_auths; link; link = link->next)
+    {
+        XAuthorityPrivate *priv = x_authority_get_instance_private (link->data);
+
+        append_uint16 (buffer, priv->family);
+        append_data (buffer, priv->address, priv->address_length);
+        append_string (buffer, priv->number);
+        append_string (buffer, priv->authorization_name);
+        append_data (buffer, priv->authorization_data, priv->authorization_data_length);
+    }
+
+    return write_buffer (fd, buffer);
+}
+
+/* Update the authorization data of matched records without rewriting the file */
+static gboolean
+patch_records (const gchar *filename, GArray *matches)
+{
+    int fd = g_open (filename, O_WRONLY, 0);
+    if (fd < 0)
+        return FALSE;
+
+    gboolean result = TRUE;
+    for (guint i = 0; i < matches->len && result; i++)
+    {
+        XAuthMatch *match = &g_array_index (matches, XAuthMatch, i);
+        XAuthorityPrivate *priv = x_authority_get_instance_private (match->auth);
+        result = pwrite (fd, priv->authorization_data, priv->authorization_data_length, match->record.authorization_data_offset) == (ssize_t) priv->authorization_data_length;
+    }
+
+    fsync (fd);
+    close (fd);
+
+    return result;
+}
+
+/**
+ * x_authority_write:
+ * @auth: An #XAuthority
+ * @mode: How to update the file
+ * @filename: Xauthority file to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write a single record to an Xauthority file.  See x_authority_write_all().
+ *
+ * Return value: %TRUE if the file was written.
+ **/
 gboolean
 x_authority_write (XAuthority *auth, XAuthWriteMode mode, const gchar *filename, GError **error)
 {
-    XAuthorityPrivate *priv = x_authority_get_instance_private (auth);
-
     g_return_val_if_fail (auth != NULL, FALSE);
     g_return_val_if_fail (filename != NULL, FALSE);
 
-    /* Read out existing records */
-    g_autofree gchar *input = NULL;
-    gsize input_length = 0, input_offset = 0;
+    GList auths = { auth, NULL, NULL };
+    return x_authority_write_all (&auths, mode, filename, error);
+}
+
+/**
+ * x_authority_write_all:
+ * @auths: (element-type XAuthority): records to write
+ * @mode: How to update the file
+ * @filename: Xauthority file to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Update an Xauthority file with several records in one pass.  The existing
+ * records are scanned in place; the first record matching each of @auths is
+ * updated (or removed if @mode is %XAUTH_WRITE_MODE_REMOVE), and records that
+ * don't exist are added.  If only the authorization data changes and it is the
+ * same size it is patched in place, otherwise the new file is written
+ * alongside and renamed over the old one.
+ *
+ * Return value: %TRUE if the file was written.
+ **/
+gboolean
+x_authority_write_all (GList *auths, XAuthWriteMode mode, const gchar *filename, GError **error)
+{
+    g_return_val_if_fail (filename != NULL, FALSE);
+
+    /* Map the existing records */
+    g_autoptr(GMappedFile) input_file = NULL;
+    const guint8 *input = NULL;
+    gsize input_length = 0;
     if (mode != XAUTH_WRITE_MODE_SET)
     {
         g_autoptr(GError) read_error = NULL;
-        g_file_get_contents (filename, &input, &input_length, &read_error);
+        input_file = g_mapped_file_new (filename, FALSE, &read_error);
         if (read_error && !g_error_matches (read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
             g_warning ("Error reading existing Xauthority: %s", read_error->message);
-    }
-    GList *records = NULL;
-    gboolean matched = FALSE;
-    while (input_offset != input_length)
-    {
-        g_autoptr(XAuthority) a = g_object_new (X_AUTHORITY_TYPE, NULL);
-        XAuthorityPrivate *a_priv = x_authority_get_instance_private (a);
-
-        guint16 address_length = 0;
-        guint16 authorization_data_length = 0;
-        gboolean result = read_uint16 (input, input_length, &input_offset, &a_priv->family) &&
-                          read_uint16 (input, input_length, &input_offset, &address_length) &&
-                          read_data (input, input_length, &input_offset, address_length, &a_priv->address) &&
-                          read_string (input, input_length, &input_offset, &a_priv->number) &&
-                          read_string (input, input_length, &input_offset, &a_priv->authorization_name) &&
-                          read_uint16 (input, input_length, &input_offset, &authorization_data_length) &&
-                          read_data (input, input_length, &input_offset, authorization_data_length, &a_priv->authorization_data);
-        a_priv->address_length = address_length;
-        a_priv->authorization_data_length = authorization_data_length;
-
-        if (!result)
-            break;
-
-        gboolean address_matches = FALSE;
-        if (priv->address_length == a_priv->address_length)
+        if (input_file)
         {
-            guint16 i;
-            for (i = 0; i < priv->address_length && priv->address[i] == a_priv->address[i]; i++);
-            address_matches = i == priv->address_length;
+            input = (const guint8 *) g_mapped_file_get_contents (input_file);
+            input_length = g_mapped_file_get_length (input_file);
         }
+    }
 
-        /* If this record matches, then update or delete it */
-        if (!matched &&
-            priv->family == a_priv->family &&
-            address_matches &&
-            strcmp (priv->number, a_priv->number) == 0)
+    /* Find the first record matching each authority, dropping anything after a corrupt record */
+    g_autoptr(GArray) matches = g_array_new (FALSE, FALSE, sizeof (XAuthMatch));
+    g_autoptr(GList) new_auths = g_list_copy (auths);
+    gsize valid_length = 0;
+    XAuthRecord record;
+    while (new_auths && read_record (input, input_length, valid_length, &record))
+    {
+        valid_length = record.end;
+        for (GList *link = new_auths; link; link = link->next)
         {
-            matched = TRUE;
-            if (mode == XAUTH_WRITE_MODE_REMOVE)
-                continue;
-            else
-                x_authority_set_authorization_data (a, priv->authorization_data, priv->authorization_data_length);
+            if (record_matches (link->data, &record))
+            {
+                XAuthMatch match = { record, link->data };
+                g_array_append_val (matches, match);
+                new_auths = g_list_delete_link (new_auths, link);
+                break;
+            }
         }
+    }
+    while (read_record (input, input_length, valid_length, &record))
+        valid_length = record.end;
 
-        records = g_list_append (records, g_steal_pointer (&a));
+    /* Nothing to add when removing */
+    if (mode == XAUTH_WRITE_MODE_REMOVE)
+    {
+        g_clear_pointer (&new_auths, g_list_free);
+        if (matches->len == 0 && valid_length == input_length)
+            return TRUE;
     }
 
-    /* If didn't exist, then add a new one */
-    if (!matched)
-        records = g_list_append (records, g_object_ref (auth));
+    /* Overwrite cookies of the same size where they are */
+    gboolean can_patch = mode == XAUTH_WRITE_MODE_REPLACE && !new_auths && valid_length == input_length;
+    for (guint i = 0; i < matches->len && can_patch; i++)
+    {
+        XAuthMatch *match = &g_array_index (matches, XAuthMatch, i);
+        XAuthorityPrivate *priv = x_authority_get_instance_private (match->auth);
+        can_patch = match->record.authorization_data_length == priv->authorization_data_length;
+    }
+    if (can_patch && matches->len > 0 && patch_records (filename, matches))
+        return TRUE;
+
+    /* Write a new file and move it into place, unless the file is a link or
+     * belongs to someone else so has to be written through */
+    g_autofree gchar *temporary_filename = NULL;
+    int output_fd = -1;
+    GStatBuf info;
+    gboolean exists = g_lstat (filename, &info) == 0;
+    if (!exists || (!S_ISLNK (info.st_mode) && info.st_uid == geteuid ()))
+    {
+        temporary_filename = g_strdup_printf ("%s.XXXXXX", filename);
+        output_fd = g_mkstemp_full (temporary_filename, O_WRONLY, S_IRUSR | S_IWUSR);
+        if (output_fd < 0)
+            g_clear_pointer (&temporary_filename, g_free);
+        else if (exists)
+            fchmod (output_fd, info.st_mode & 07777);
+    }
 
-    /* Write records back */
-    errno = 0;
-    int output_fd = g_open (filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+    g_autofree guint8 *input_copy = NULL;
     if (output_fd < 0)
     {
-        g_set_error (error,
-                     G_FILE_ERROR,
-                     g_file_error_from_errno (errno),
-                     "Failed to open X authority %s: %s",
-                     filename,
-                     g_strerror (errno));
-        return FALSE;
+        /* The old records have to be kept in memory as truncating the file would invalidate the mapping */
+        if (valid_length > 0)
+        {
+            input_copy = g_malloc (valid_length);
+            memcpy (input_copy, input, valid_length);
+            input = input_copy;
+        }
+        g_clear_pointer (&input_file, g_mapped_file_unref);
+
+        errno = 0;
+        output_fd = g_open (filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (output_fd < 0)
+        {
+            g_set_error (error,
+                         G_FILE_ERROR,
+                         g_file_error_from_errno (errno),
+                         "Failed to open X authority %s: %s",
+                         filename,
+                         g_strerror (errno));
+            return FALSE;
+        }
     }
 
     errno = 0;
-    gboolean result = TRUE;
-    for (GList *link = records; link && result; link = link->next)
+    gboolean result = write_records (output_fd, input, valid_length, matches, new_auths, mode) &&
+                      fsync (output_fd) == 0;
+    int write_errno = errno;
+    close (output_fd);
+
+    if (result && temporary_filename)
     {
-        XAuthority *a = link->data;
-        XAuthorityPrivate *a_priv = x_authority_get_instance_private (a);
-
-        result = write_uint16 (output_fd, a_priv->family) &&
-                 write_uint16 (output_fd, a_priv->address_length) &&
-                 write_data (output_fd, a_priv->address, a_priv->address_length) &&
-                 write_string (output_fd, a_priv->number) &&
-                 write_string (output_fd, a_priv->authorization_name) &&
-                 write_uint16 (output_fd, a_priv->authorization_data_length) &&
-                 write_data (output_fd, a_priv->authorization_data, a_priv->authorization_data_length);
+        result = g_rename (temporary_filename, filename) == 0;
+        write_errno = errno;
     }
-    g_list_free_full (records, g_object_unref);
-
-    fsync (output_fd);
-    close (output_fd);
+    if (!result && temporary_filename)
+        g_unlink (temporary_filename);
 
     if (!result)
     {
         g_set_error (error,
                      G_FILE_ERROR,
-                     g_file_error_from_errno (errno),
+                     g_file_error_from_errno (write_errno),
                      "Failed to write X authority %s: %s",
                      filename,
-                     g_strerror (errno));
+                     g_strerror (write_errno));
         return FALSE;
     }
 
@@ -55,6 +55,8 @@ XAuthority *x_authority_new (guint16 family, const guint8 *address, gsize addres
 
 XAuthority *x_authority_new_cookie (guint16 family, const guint8 *address, gsize address_length, const gchar *number);
 
+void x_authority_reserve_cookies (guint n_cookies);
+
 XAuthority *x_authority_new_local_cookie (const gchar *number);
 
 void x_authority_set_family (XAuthority *auth, guint16 family);
@@ -85,6 +87,8 @@ gsize x_authority_get_authorization_data_length (XAuthority *auth);
 
 gboolean x_authority_write (XAuthority *auth, XAuthWriteMode mode, const gchar *filename, GError **error);
 
+gboolean x_authority_write_all (GList *auths, XAuthWriteMode mode, const gchar *filename, GError **error);
+
 G_END_DECLS
 
 #endif /* X_AUTHORITY_H_ */
@@ -9,6 +9,7 @@
  * license.
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 #include <string.h>
 #include <fcntl.h>
@@ -16,6 +17,10 @@
 #include <errno.h>
 #include <glib/gstdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "x-server-local.h"
 #include "configuration.h"
@@ -27,12 +32,28 @@ typedef struct
     /* X server process */
     Process *x_server_process;
 
+    /* Launch slot held until the X server is ready */
+    ProcessLaunch *launch;
+    ProcessPriority launch_priority;
+
     /* Command to run the X server */
     gchar *command;
 
     /* Display number to use */
     guint display_number;
 
+    /* TRUE if display_number is allocated, or has been reported by the X server */
+    gboolean have_display_number;
+
+    /* TRUE to let the X server choose its display number and report it with -displayfd */
+    gboolean use_display_fd;
+
+    /* Pipe the X server reports its display number on */
+    int display_fd_child;
+    GIOChannel *display_fd_channel;
+    guint display_fd_watch;
+    GString *display_fd_text;
+
     /* Config file to use */
     gchar *config_file;
 
@@ -74,9 +95,25 @@ G_DEFINE_TYPE_WITH_CODE (XServerLocal, x_server_local, X_SERVER_TYPE,
                          G_ADD_PRIVATE (XServerLocal)
                          G_IMPLEMENT_INTERFACE (LOGGER_TYPE, x_server_local_logger_iface_init))
 
+/* Number to name logs of servers started before their display number is known */
+static guint last_display_fd_log = 0;
+
+static gboolean have_version = FALSE;
 static gchar *version = NULL;
 static guint version_major = 0, version_minor = 0;
-static GList *display_numbers = NULL;
+
+/* Bitmaps of display numbers we have allocated and that have lock files in /tmp */
+static GArray *allocated_display_numbers = NULL;
+static GArray *locked_display_numbers = NULL;
+
+/* Lowest display number that may not be allocated */
+static guint display_number_hint = 0;
+
+/* inotify watch on /tmp to keep locked_display_numbers up to date */
+static int lock_watch_fd = -1;
+static gboolean lock_watch_started = FALSE;
+
+#define BITS_PER_WORD (sizeof (gulong) * 8)
 
 #define XORG_VERSION_PREFIX "X.Org X Server "
 
@@ -89,23 +126,86 @@ find_version (const gchar *line)
     return g_strdup (line + strlen (XORG_VERSION_PREFIX));
 }
 
-static const gchar *
-x_server_local_get_version (void)
+static gchar *
+probe_version (void)
 {
-    if (version)
-        return version;
-
     g_autofree gchar *stderr_text = NULL;
     gint exit_status;
     if (!g_spawn_command_line_sync ("X -version", NULL, &stderr_text, &exit_status, NULL))
         return NULL;
-    if (exit_status == EXIT_SUCCESS)
+    if (exit_status != EXIT_SUCCESS)
+        return NULL;
+
+    gchar *result = NULL;
+    g_auto(GStrv) lines = g_strsplit (stderr_text, "\n", -1);
+    for (int i = 0; lines[i] && !result; i++)
+        result = find_version (lines[i]);
+
+    return result;
+}
+
+static gchar *
+get_version_cache_path (void)
+{
+    g_autofree gchar *run_dir = config_get_string (config_get_instance (), "LightDM", "run-directory");
+    return g_build_filename (run_dir, "x-server-version", NULL);
+}
+
+/* Get the version from 'X -version', reusing the result from previous runs
+ * of the daemon if the binary is the same */
+static gchar *
+get_cached_version (void)
+{
+    g_autofree gchar *binary = g_find_program_in_path ("X");
+    GStatBuf info;
+    if (!binary || g_stat (binary, &info) != 0)
+        return probe_version ();
+
+    g_autofree gchar *cache_path = get_version_cache_path ();
+    g_autoptr(GKeyFile) cache = g_key_file_new ();
+    if (g_key_file_load_from_file (cache, cache_path, G_KEY_FILE_NONE, NULL))
     {
-        g_auto(GStrv) lines = g_strsplit (stderr_text, "\n", -1);
-        for (int i = 0; lines[i] && !version; i++)
-            version = find_version (lines[i]);
+        g_autofree gchar *cached_binary = g_key_file_get_string (cache, "X", "path", NULL);
+        guint64 inode = g_key_file_get_uint64 (cache, "X", "inode", NULL);
+        gint64 mtime = g_key_file_get_int64 (cache, "X", "mtime", NULL);
+        if (g_strcmp0 (cached_binary, binary) == 0 && inode == (guint64) info.st_ino && mtime == (gint64) info.st_mtime)
+        {
+            gchar *cached_version = g_key_file_get_string (cache, "X", "version", NULL);
+            if (cached_version)
+            {
+                g_debug ("Using cached X server version %s", cached_version);
+                return cached_version;
+            }
+        }
     }
 
+    gchar *result = probe_version ();
+    if (!result)
+        return NULL;
+
+    g_key_file_set_string (cache, "X", "path", binary);
+    g_key_file_set_uint64 (cache, "X", "inode", info.st_ino);
+    g_key_file_set_int64 (cache, "X", "mtime", info.st_mtime);
+    g_key_file_set_string (cache, "X", "version", result);
+    g_autoptr(GError) error = NULL;
+    if (!g_key_file_save_to_file (cache, cache_path, &error))
+        g_debug ("Failed to write X server version cache %s: %s", cache_path, error->message);
+
+    return result;
+}
+
+static const gchar *
+x_server_local_get_version (void)
+{
+    /* Probe once for all seats, even if it fails */
+    if (have_version)
+        return version;
+    have_version = TRUE;
+
+    version = get_cached_version ();
+    if (!version)
+        return NULL;
+
     g_auto(GStrv) tokens = g_strsplit (version, ".", 3);
     guint n_tokens = g_strv_length (tokens);
     version_major = n_tokens > 0 ? atoi (tokens[0]) : 0;
@@ -125,16 +225,140 @@ x_server_local_version_compare (guint major, guint minor)
 }
 
 static gboolean
-display_number_in_use (guint display_number)
+bitmap_get (GArray *bitmap, guint n)
+{
+    guint word = n / BITS_PER_WORD;
+    if (!bitmap || word >= bitmap->len)
+        return FALSE;
+    return (g_array_index (bitmap, gulong, word) & (1UL << (n % BITS_PER_WORD))) != 0;
+}
+
+static void
+bitmap_set (GArray **bitmap, guint n, gboolean value)
 {
-    /* See if we know we are managing a server with that number */
-    for (GList *link = display_numbers; link; link = link->next)
+    if (!*bitmap)
+        *bitmap = g_array_new (FALSE, TRUE, sizeof (gulong));
+
+    guint word = n / BITS_PER_WORD;
+    if (word >= (*bitmap)->len)
     {
-        guint number = GPOINTER_TO_UINT (link->data);
-        if (number == display_number)
-            return TRUE;
+        if (!value)
+            return;
+        g_array_set_size (*bitmap, word + 1);
     }
 
+    if (value)
+        g_array_index (*bitmap, gulong, word) |= 1UL << (n % BITS_PER_WORD);
+    else
+        g_array_index (*bitmap, gulong, word) &= ~(1UL << (n % BITS_PER_WORD));
+}
+
+static gboolean
+parse_lock_filename (const gchar *name, guint *display_number)
+{
+    if (!g_str_has_prefix (name, ".X") || !g_ascii_isdigit (name[2]))
+        return FALSE;
+
+    gchar *end;
+    guint64 number = g_ascii_strtoull (name + 2, &end, 10);
+    if (strcmp (end, "-lock") != 0 || number > G_MAXINT)
+        return FALSE;
+
+    *display_number = number;
+    return TRUE;
+}
+
+static void
+scan_lock_files (void)
+{
+    if (locked_display_numbers)
+        g_array_set_size (locked_display_numbers, 0);
+
+    g_autoptr(GDir) dir = g_dir_open ("/tmp", 0, NULL);
+    if (!dir)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        guint number;
+        if (parse_lock_filename (name, &number))
+            bitmap_set (&locked_display_numbers, number, TRUE);
+    }
+}
+
+#ifdef __linux__
+static gboolean
+lock_files_changed_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    gchar buffer[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    ssize_t n_read = read (lock_watch_fd, buffer, sizeof (buffer));
+    if (n_read < 0)
+        return errno == EINTR || errno == EAGAIN;
+
+    for (gchar *p = buffer; p < buffer + n_read; )
+    {
+        const struct inotify_event *event = (const struct inotify_event *) p;
+        p += sizeof (struct inotify_event) + event->len;
+
+        /* Lost events, start again */
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+            scan_lock_files ();
+            continue;
+        }
+
+        guint number;
+        if (event->len == 0 || !parse_lock_filename (event->name, &number))
+            continue;
+
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            bitmap_set (&locked_display_numbers, number, TRUE);
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            bitmap_set (&locked_display_numbers, number, FALSE);
+    }
+
+    return TRUE;
+}
+#endif
+
+static void
+watch_lock_files (void)
+{
+    if (lock_watch_started)
+        return;
+    lock_watch_started = TRUE;
+
+#ifdef __linux__
+    /* Watch before scanning so no lock file is missed */
+    lock_watch_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (lock_watch_fd < 0)
+    {
+        g_warning ("Failed to watch X lock files: %s", strerror (errno));
+        return;
+    }
+    if (inotify_add_watch (lock_watch_fd, "/tmp", IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR) < 0)
+    {
+        g_warning ("Failed to watch X lock files: %s", strerror (errno));
+        close (lock_watch_fd);
+        lock_watch_fd = -1;
+        return;
+    }
+
+    g_autoptr(GIOChannel) channel = g_io_channel_unix_new (lock_watch_fd);
+    g_io_add_watch (channel, G_IO_IN, lock_files_changed_cb, NULL);
+
+    scan_lock_files ();
+#endif
+}
+
+static gboolean
+display_number_locked (guint display_number)
+{
+    /* When watching only numbers with lock files need to be checked */
+    if (lock_watch_fd >= 0 && !bitmap_get (locked_display_numbers, display_number))
+        return FALSE;
+
     /* See if an X server that we don't know of has a lock on that number */
     g_autofree gchar *path = g_strdup_printf ("/tmp/.X%d-lock", display_number);
     gboolean in_use = g_file_test (path, G_FILE_TEST_EXISTS);
@@ -156,11 +380,35 @@ display_number_in_use (guint display_number)
 static guint
 x_server_local_get_unused_display_number (void)
 {
-    guint number = config_get_integer (config_get_instance (), "LightDM", "minimum-display-number");
-    while (display_number_in_use (number))
+    watch_lock_files ();
+
+    guint minimum = config_get_integer (config_get_instance (), "LightDM", "minimum-display-number");
+    guint number = MAX (minimum, display_number_hint);
+    while (TRUE)
+    {
+        /* Skip whole words of numbers we already have */
+        guint word = number / BITS_PER_WORD;
+        gulong free_mask = allocated_display_numbers && word < allocated_display_numbers->len ? ~g_array_index (allocated_display_numbers, gulong, word) : ~0UL;
+        free_mask &= ~0UL << (number % BITS_PER_WORD);
+        gint bit = g_bit_nth_lsf (free_mask, -1);
+        if (bit < 0)
+        {
+            number = (word + 1) * BITS_PER_WORD;
+            continue;
+        }
+
+        number = word * BITS_PER_WORD + bit;
+        if (!display_number_locked (number))
+            break;
         number++;
+    }
 
-    display_numbers = g_list_append (display_numbers, GUINT_TO_POINTER (number));
+    bitmap_set (&allocated_display_numbers, number, TRUE);
+    if (number == display_number_hint)
+    {
+        while (bitmap_get (allocated_display_numbers, display_number_hint))
+            display_number_hint++;
+    }
 
     return number;
 }
@@ -168,15 +416,9 @@ x_server_local_get_unused_display_number (void)
 static void
 x_server_local_release_display_number (guint display_number)
 {
-    for (GList *link = display_numbers; link; link = link->next)
-    {
-        guint number = GPOINTER_TO_UINT (link->data);
-        if (number == display_number)
-        {
-            display_numbers = g_list_delete_link (display_numbers, link);
-            return;
-        }
-    }
+    bitmap_set (&allocated_display_numbers, display_number, FALSE);
+    if (display_number < display_number_hint)
+        display_number_hint = display_number;
 }
 
 XServerLocal *
@@ -247,6 +489,30 @@ x_server_local_set_allow_tcp (XServerLocal *server, gboolean allow_tcp)
     priv->allow_tcp = allow_tcp;
 }
 
+void
+x_server_local_set_use_display_fd (XServerLocal *server, gboolean use_display_fd)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+    g_return_if_fail (priv->x_server_process == NULL);
+
+    priv->use_display_fd = use_display_fd;
+
+    /* The X server chooses the number, so don't hold one for it */
+    if (use_display_fd && priv->have_display_number)
+    {
+        x_server_local_release_display_number (priv->display_number);
+        priv->have_display_number = FALSE;
+        priv->display_number = 0;
+    }
+    else if (!use_display_fd && !priv->have_display_number)
+    {
+        priv->display_number = x_server_local_get_unused_display_number ();
+        priv->have_display_number = TRUE;
+    }
+}
+
 void
 x_server_local_set_xdmcp_server (XServerLocal *server, const gchar *hostname)
 {
@@ -290,6 +556,14 @@ x_server_local_set_xdmcp_key (XServerLocal *server, const gchar *key)
     x_server_set_authority (X_SERVER (server), NULL);
 }
 
+void
+x_server_local_set_launch_priority (XServerLocal *server, ProcessPriority priority)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->launch_priority = priority;
+}
+
 void
 x_server_local_set_background (XServerLocal *server, const gchar *background)
 {
@@ -313,6 +587,13 @@ x_server_local_get_vt (DisplayServer *server)
     return priv->vt;
 }
 
+static gboolean
+x_server_local_get_has_address (DisplayServer *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (X_SERVER_LOCAL (server));
+    return priv->have_display_number;
+}
+
 const gchar *
 x_server_local_get_authority_file_path (XServerLocal *server)
 {
@@ -321,6 +602,14 @@ x_server_local_get_authority_file_path (XServerLocal *server)
     return priv->authority_file;
 }
 
+GPid
+x_server_local_get_pid (XServerLocal *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, 0);
+    return priv->x_server_process ? process_get_pid (priv->x_server_process) : 0;
+}
+
 static gchar *
 get_absolute_command (const gchar *command)
 {
@@ -362,6 +651,110 @@ x_server_local_get_log_stdout (XServerLocal *server)
     return TRUE;
 }
 
+/* Keep the reporting end of the display number pipe open over exec, then do the sub-class setup */
+static void
+x_server_local_run_child (Process *process, gpointer user_data)
+{
+    XServerLocal *server = user_data;
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    if (priv->display_fd_child >= 0)
+        fcntl (priv->display_fd_child, F_SETFD, 0);
+
+    ProcessRunFunc run_cb = X_SERVER_LOCAL_GET_CLASS (server)->get_run_function (server);
+    if (run_cb)
+        run_cb (process, user_data);
+}
+
+static void
+close_display_fd (XServerLocal *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    if (priv->display_fd_child >= 0)
+        close (priv->display_fd_child);
+    priv->display_fd_child = -1;
+    if (priv->display_fd_watch)
+        g_source_remove (priv->display_fd_watch);
+    priv->display_fd_watch = 0;
+    g_clear_pointer (&priv->display_fd_channel, g_io_channel_unref);
+    if (priv->display_fd_text)
+        g_string_free (priv->display_fd_text, TRUE);
+    priv->display_fd_text = NULL;
+}
+
+/* The X server is ready once it has signalled and we know where to connect to it */
+static void
+check_ready (XServerLocal *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    if (!priv->got_signal || !priv->have_display_number)
+        return;
+
+    g_clear_pointer (&priv->launch, process_launch_free);
+
+    // FIXME: Check return value
+    DISPLAY_SERVER_CLASS (x_server_local_parent_class)->start (DISPLAY_SERVER (server));
+}
+
+static void
+set_reported_display_number (XServerLocal *server, guint display_number)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    l_debug (server, "X server chose display :%d", display_number);
+
+    /* Don't give this number to a server we choose the number for */
+    bitmap_set (&allocated_display_numbers, display_number, TRUE);
+    priv->display_number = display_number;
+    priv->have_display_number = TRUE;
+    x_server_reset_address (X_SERVER (server));
+
+    /* The X server accepts the cookie for any number, but clients look it up by number */
+    XAuthority *authority = x_server_get_authority (X_SERVER (server));
+    if (authority)
+    {
+        g_autofree gchar *number = g_strdup_printf ("%d", display_number);
+        x_authority_set_number (authority, number);
+    }
+}
+
+static gboolean
+display_fd_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    XServerLocal *server = data;
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    /* The X server writes the number followed by a newline */
+    gchar buffer[16];
+    ssize_t n_read = read (g_io_channel_unix_get_fd (source), buffer, sizeof (buffer));
+    if (n_read < 0 && errno == EINTR)
+        return G_SOURCE_CONTINUE;
+    if (n_read > 0)
+        g_string_append_len (priv->display_fd_text, buffer, n_read);
+    if (n_read > 0 && !strchr (priv->display_fd_text->str, '\n') && priv->display_fd_text->len < 16)
+        return G_SOURCE_CONTINUE;
+
+    gchar *end = NULL;
+    guint64 display_number = g_ascii_strtoull (priv->display_fd_text->str, &end, 10);
+    gboolean valid = end != priv->display_fd_text->str && (*end == '\n' || *end == '\0') && display_number <= G_MAXINT;
+
+    priv->display_fd_watch = 0;
+    close_display_fd (server);
+
+    if (!valid)
+    {
+        l_warning (server, "X server did not report a display number");
+        return G_SOURCE_REMOVE;
+    }
+
+    set_reported_display_number (server, display_number);
+    check_ready (server);
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
 got_signal_cb (Process *process, int signum, XServerLocal *server)
 {
@@ -370,10 +763,12 @@ got_signal_cb (Process *process, int signum, XServerLocal *server)
     if (signum == SIGUSR1 && !priv->got_signal)
     {
         priv->got_signal = TRUE;
-        l_debug (server, "Got signal from X server :%d", priv->display_number);
+        if (priv->have_display_number)
+            l_debug (server, "Got signal from X server :%d", priv->display_number);
+        else
+            l_debug (server, "Got signal from X server, waiting for display number");
 
-        // FIXME: Check return value
-        DISPLAY_SERVER_CLASS (x_server_local_parent_class)->start (DISPLAY_SERVER (server));
+        check_ready (server);
     }
 }
 
@@ -384,13 +779,19 @@ stopped_cb (Process *process, XServerLocal *server)
 
     l_debug (server, "X server stopped");
 
+    g_clear_pointer (&priv->launch, process_launch_free);
+    close_display_fd (server);
+
     /* Release VT and display number for re-use */
     if (priv->have_vt_ref)
     {
         vt_unref (priv->vt);
         priv->have_vt_ref = FALSE;
     }
-    x_server_local_release_display_number (priv->display_number);
+    if (priv->have_display_number)
+        x_server_local_release_display_number (priv->display_number);
+    if (priv->use_display_fd)
+        priv->have_display_number = FALSE;
 
     if (x_server_get_authority (X_SERVER (server)) && priv->authority_file)
     {
@@ -425,7 +826,21 @@ write_authority_file (XServerLocal *server)
         if (g_mkdir_with_parents (dir, S_IRWXU) < 0)
             l_warning (server, "Failed to make authority directory %s: %s", dir, strerror (errno));
 
-        priv->authority_file = g_build_filename (dir, x_server_get_address (X_SERVER (server)), NULL);
+        /* The X server reads the same file on reset, so it keeps a name that doesn't need the display number */
+        if (priv->have_display_number)
+            priv->authority_file = g_build_filename (dir, x_server_get_address (X_SERVER (server)), NULL);
+        else
+        {
+            g_autofree gchar *path = g_build_filename (dir, "xauth-XXXXXX", NULL);
+            int fd = g_mkstemp_full (path, O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (fd < 0)
+            {
+                l_warning (server, "Failed to make authority file: %s", strerror (errno));
+                return;
+            }
+            close (fd);
+            priv->authority_file = g_steal_pointer (&path);
+        }
     }
 
     l_debug (server, "Writing X server authority to %s", priv->authority_file);
@@ -437,29 +852,26 @@ write_authority_file (XServerLocal *server)
 }
 
 static gboolean
-x_server_local_start (DisplayServer *display_server)
+start_process (XServerLocal *server)
 {
-    XServerLocal *server = X_SERVER_LOCAL (display_server);
+    DisplayServer *display_server = DISPLAY_SERVER (server);
     XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
 
-    g_return_val_if_fail (priv->x_server_process == NULL, FALSE);
-
-    priv->got_signal = FALSE;
-
-    g_return_val_if_fail (priv->command != NULL, FALSE);
-
-    ProcessRunFunc run_cb = X_SERVER_LOCAL_GET_CLASS (server)->get_run_function (server);
-    priv->x_server_process = process_new (run_cb, server);
-    process_set_clear_environment (priv->x_server_process, TRUE);
-    g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_GOT_SIGNAL, G_CALLBACK (got_signal_cb), server);
-    g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_STOPPED, G_CALLBACK (stopped_cb), server);
-
     /* Setup logging */
-    g_autofree gchar *filename = g_strdup_printf ("x-%d.log", x_server_get_display_number (X_SERVER (server)));
+    g_autofree gchar *filename = NULL;
+    if (priv->have_display_number)
+        filename = g_strdup_printf ("x-%d.log", priv->display_number);
+    else if (priv->xdg_seat)
+        filename = g_strdup_printf ("x-%s.log", priv->xdg_seat);
+    else
+        filename = g_strdup_printf ("x-auto%u.log", last_display_fd_log++);
     g_autofree gchar *dir = config_get_string (config_get_instance (), "LightDM", "log-directory");
     g_autofree gchar *log_file = g_build_filename (dir, filename, NULL);
     gboolean backup_logs = config_get_boolean (config_get_instance (), "LightDM", "backup-logs");
     process_set_log_file (priv->x_server_process, log_file, X_SERVER_LOCAL_GET_CLASS (server)->get_log_stdout (server), backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND);
+    gint capture_size = config_get_integer (config_get_instance (), "LightDM", "log-capture-size");
+    if (capture_size > 0)
+        process_set_log_capture (priv->x_server_process, (gsize) capture_size * 1024, (gsize) MAX (config_get_integer (config_get_instance (), "LightDM", "log-capture-rate"), 0) * 1024);
     l_debug (display_server, "Logging to %s", log_file);
 
     g_autofree gchar *absolute_command = get_absolute_command (priv->command);
@@ -471,7 +883,23 @@ x_server_local_start (DisplayServer *display_server)
     }
     g_autoptr(GString) command = g_string_new (absolute_command);
 
-    g_string_append_printf (command, " :%d", priv->display_number);
+    if (priv->use_display_fd)
+    {
+        int fds[2];
+        if (pipe2 (fds, O_CLOEXEC) < 0)
+        {
+            l_warning (display_server, "Failed to make display number pipe: %s", strerror (errno));
+            stopped_cb (priv->x_server_process, X_SERVER_LOCAL (server));
+            return FALSE;
+        }
+        priv->display_fd_child = fds[1];
+        priv->display_fd_channel = g_io_channel_unix_new (fds[0]);
+        g_io_channel_set_close_on_unref (priv->display_fd_channel, TRUE);
+        priv->display_fd_text = g_string_new ("");
+        g_string_append_printf (command, " -displayfd %d", fds[1]);
+    }
+    else
+        g_string_append_printf (command, " :%d", priv->display_number);
 
     if (priv->config_file)
         g_string_append_printf (command, " -config %s", priv->config_file);
@@ -543,7 +971,17 @@ x_server_local_start (DisplayServer *display_server)
         process_set_env (priv->x_server_process, "LIGHTDM_TEST_ROOT", g_getenv ("LIGHTDM_TEST_ROOT"));
 
     gboolean result = process_start (priv->x_server_process, FALSE);
-    if (result)
+    ResourceControl *resource_control = display_server_get_resource_control (display_server);
+    if (result && resource_control)
+        resource_control_apply (resource_control, process_get_pid (priv->x_server_process));
+    if (result && priv->use_display_fd)
+    {
+        close (priv->display_fd_child);
+        priv->display_fd_child = -1;
+        priv->display_fd_watch = g_io_add_watch (priv->display_fd_channel, G_IO_IN | G_IO_HUP | G_IO_ERR, display_fd_cb, server);
+        l_debug (display_server, "Waiting for display number and ready signal from X server");
+    }
+    else if (result)
         l_debug (display_server, "Waiting for ready signal from X server :%d", priv->display_number);
     else
         stopped_cb (priv->x_server_process, X_SERVER_LOCAL (server));
@@ -551,13 +989,124 @@ x_server_local_start (DisplayServer *display_server)
     return result;
 }
 
+static void
+launch_cb (gpointer user_data)
+{
+    start_process (X_SERVER_LOCAL (user_data));
+}
+
+static gboolean
+x_server_local_start (DisplayServer *display_server)
+{
+    XServerLocal *server = X_SERVER_LOCAL (display_server);
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    g_return_val_if_fail (priv->x_server_process == NULL, FALSE);
+
+    priv->got_signal = FALSE;
+
+    g_return_val_if_fail (priv->command != NULL, FALSE);
+
+    priv->x_server_process = process_new (x_server_local_run_child, server);
+    process_set_clear_environment (priv->x_server_process, TRUE);
+    g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_GOT_SIGNAL, G_CALLBACK (got_signal_cb), server);
+    g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_STOPPED, G_CALLBACK (stopped_cb), server);
+
+    /* Wait for a launch slot when lots of servers are starting */
+    priv->launch = process_launch_new (priv->launch_priority, launch_cb, server);
+    if (!process_launch_get_is_started (priv->launch))
+    {
+        l_debug (display_server, "Waiting to launch X server");
+        return TRUE;
+    }
+
+    return start_process (server);
+}
+
+/* Take over an X server that was started before the daemon re-executed itself */
+gboolean
+x_server_local_adopt (XServerLocal *server, GPid pid, guint display_number, const gchar *authority_file)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    g_return_val_if_fail (server != NULL, FALSE);
+    g_return_val_if_fail (priv->x_server_process == NULL, FALSE);
+
+    /* Swap the number given out when this was made for the one the X server is using */
+    if (priv->have_display_number)
+        x_server_local_release_display_number (priv->display_number);
+    bitmap_set (&allocated_display_numbers, display_number, TRUE);
+    priv->display_number = display_number;
+    priv->have_display_number = TRUE;
+    x_server_reset_address (X_SERVER (server));
+
+    g_free (priv->authority_file);
+    priv->authority_file = g_strdup (authority_file);
+
+    priv->x_server_process = process_new (x_server_local_run_child, server);
+    g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_GOT_SIGNAL, G_CALLBACK (got_signal_cb), server);
+    g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_STOPPED, G_CALLBACK (stopped_cb), server);
+    if (!process_adopt (priv->x_server_process, pid))
+        return FALSE;
+
+    l_debug (server, "Took over X server %d on display :%d", pid, display_number);
+    priv->got_signal = TRUE;
+    display_server_adopt (DISPLAY_SERVER (server));
+
+    return TRUE;
+}
+
+static gboolean
+x_server_local_reset (DisplayServer *display_server)
+{
+    XServerLocal *server = X_SERVER_LOCAL (display_server);
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    /* XDMCP servers are managed by the remote host */
+    if (!priv->x_server_process || !priv->got_signal || priv->xdmcp_server)
+        return FALSE;
+
+    /* Replace the cookie so clients from the previous session can't connect again */
+    if (x_server_get_authority (X_SERVER (server)))
+    {
+        g_autofree gchar *number = g_strdup_printf ("%d", priv->display_number);
+        g_autoptr(XAuthority) cookie = x_authority_new_local_cookie (number);
+        x_server_set_authority (X_SERVER (server), cookie);
+        write_authority_file (server);
+    }
+
+    /* On SIGHUP the X server closes all clients, resets the root window and
+     * re-reads the authority, then sends SIGUSR1 again when ready */
+    l_debug (server, "Resetting X server");
+    x_server_disconnect (X_SERVER (server));
+    priv->got_signal = FALSE;
+    process_signal (priv->x_server_process, SIGHUP);
+
+    return TRUE;
+}
+
 static void
 x_server_local_stop (DisplayServer *server)
 {
     XServerLocalPrivate *priv = x_server_local_get_instance_private (X_SERVER_LOCAL (server));
+
+    /* Never launched, so there's nothing to wait for */
+    if (priv->launch && !process_launch_get_is_started (priv->launch))
+    {
+        stopped_cb (priv->x_server_process, X_SERVER_LOCAL (server));
+        return;
+    }
+
     process_stop (priv->x_server_process);
 }
 
+static const ProcessUsage *
+x_server_local_get_usage (DisplayServer *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (X_SERVER_LOCAL (server));
+    return priv->x_server_process ? process_get_usage (priv->x_server_process) : NULL;
+}
+
 static void
 x_server_local_init (XServerLocal *server)
 {
@@ -565,6 +1114,8 @@ x_server_local_init (XServerLocal *server)
     priv->vt = -1;
     priv->command = g_strdup ("X");
     priv->display_number = x_server_local_get_unused_display_number ();
+    priv->have_display_number = TRUE;
+    priv->display_fd_child = -1;
 }
 
 static void
@@ -576,6 +1127,8 @@ x_server_local_finalize (GObject *object)
     if (priv->x_server_process)
         g_signal_handlers_disconnect_matched (priv->x_server_process, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     g_clear_object (&priv->x_server_process);
+    g_clear_pointer (&priv->launch, process_launch_free);
+    close_display_fd (self);
     g_clear_pointer (&priv->command, g_free);
     g_clear_pointer (&priv->config_file, g_free);
     g_clear_pointer (&priv->layout, g_free);
@@ -601,8 +1154,11 @@ x_server_local_class_init (XServerLocalClass *klass)
     klass->get_log_stdout = x_server_local_get_log_stdout;
     x_server_class->get_display_number = x_server_local_get_display_number;
     display_server_class->get_vt = x_server_local_get_vt;
+    display_server_class->get_has_address = x_server_local_get_has_address;
     display_server_class->start = klass->start = x_server_local_start;
+    display_server_class->reset = x_server_local_reset;
     display_server_class->stop = x_server_local_stop;
+    display_server_class->get_usage = x_server_local_get_usage;
     object_class->finalize = x_server_local_finalize;
 }
 
@@ -611,6 +1167,8 @@ x_server_local_real_logprefix (Logger *self, gchar *buf, gulong buflen)
 {
     XServerLocal *server = X_SERVER_LOCAL (self);
     XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+    if (!priv->have_display_number)
+        return g_snprintf (buf, buflen, "XServer: ");
     return g_snprintf (buf, buflen, "XServer %d: ", priv->display_number);
 }
 
@@ -618,4 +1176,5 @@ static void
 x_server_local_logger_iface_init (LoggerInterface *iface)
 {
     iface->logprefix = &x_server_local_real_logprefix;
+    iface->subsystem = LOG_SUBSYSTEM_DISPLAY_SERVER;
 }
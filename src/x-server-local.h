@@ -55,6 +55,8 @@ void x_server_local_set_xdg_seat (XServerLocal *server, const gchar *xdg_seat);
 
 void x_server_local_set_allow_tcp (XServerLocal *server, gboolean allow_tcp);
 
+void x_server_local_set_use_display_fd (XServerLocal *server, gboolean use_display_fd);
+
 void x_server_local_set_xdmcp_server (XServerLocal *server, const gchar *hostname);
 
 const gchar *x_server_local_get_xdmcp_server (XServerLocal *server);
@@ -67,8 +69,14 @@ void x_server_local_set_xdmcp_key (XServerLocal *server, const gchar *key);
 
 void x_server_local_set_background (XServerLocal *server, const gchar *background);
 
+void x_server_local_set_launch_priority (XServerLocal *server, ProcessPriority priority);
+
 const gchar *x_server_local_get_authority_file_path (XServerLocal *server);
 
+GPid x_server_local_get_pid (XServerLocal *server);
+
+gboolean x_server_local_adopt (XServerLocal *server, GPid pid, guint display_number, const gchar *authority_file);
+
 G_END_DECLS
 
 #endif /* X_SERVER_LOCAL_H_ */
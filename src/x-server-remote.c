@@ -42,6 +42,24 @@ x_server_remote_get_display_number (XServer *server)
     return priv->display_number;
 }
 
+/* Keep the connection open between sessions, just preparing the root window again */
+static gboolean
+x_server_remote_reset (DisplayServer *display_server)
+{
+    if (!x_server_get_is_connected (X_SERVER (display_server)))
+        return FALSE;
+
+    return DISPLAY_SERVER_CLASS (x_server_remote_parent_class)->start (display_server);
+}
+
+/* The remote display has gone away, so nothing can run on it any more */
+static void
+x_server_remote_disconnected (XServer *server)
+{
+    if (!display_server_get_is_stopping (DISPLAY_SERVER (server)))
+        display_server_stop (DISPLAY_SERVER (server));
+}
+
 static void
 x_server_remote_init (XServerRemote *server)
 {
@@ -50,7 +68,10 @@ x_server_remote_init (XServerRemote *server)
 static void
 x_server_remote_class_init (XServerRemoteClass *klass)
 {
-    XServerClass *x_server_class = X_SERVER_CLASS (klass);  
+    DisplayServerClass *display_server_class = DISPLAY_SERVER_CLASS (klass);
+    XServerClass *x_server_class = X_SERVER_CLASS (klass);
 
+    display_server_class->reset = x_server_remote_reset;
     x_server_class->get_display_number = x_server_remote_get_display_number;
+    x_server_class->disconnected = x_server_remote_disconnected;
 }
@@ -106,6 +106,13 @@ x_server_xvnc_get_can_share (DisplayServer *server)
     return TRUE;
 }
 
+static gboolean
+x_server_xvnc_reset (DisplayServer *server)
+{
+    /* Each server only lives as long as its VNC connection */
+    return FALSE;
+}
+
 static void
 x_server_xvnc_add_args (XServerLocal *x_server, GString *command)
 {
@@ -128,6 +135,7 @@ x_server_xvnc_init (XServerXVNC *server)
     priv->width = 1024;
     priv->height = 768;
     priv->depth = 8;
+    x_server_local_set_launch_priority (X_SERVER_LOCAL (server), PROCESS_PRIORITY_REMOTE);
 }
 
 static void
@@ -140,4 +148,5 @@ x_server_xvnc_class_init (XServerXVNCClass *klass)
     x_server_local_class->get_log_stdout = x_server_xvnc_get_log_stdout;
     x_server_local_class->add_args = x_server_xvnc_add_args;
     display_server_class->get_can_share = x_server_xvnc_get_can_share;
+    display_server_class->reset = x_server_xvnc_reset;
 }
@@ -10,7 +10,14 @@
  */
 
 #include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <xcb/xcb.h>
 
 #include "x-server.h"
@@ -27,10 +34,48 @@ typedef struct
     /* Authority */
     XAuthority *authority;
 
+    /* Colour to set the root window to before the server is used */
+    gchar *background;
+
     /* Connection to this X server */
     xcb_connection_t *connection;
+
+    /* Watch on the connection */
+    guint connection_watch;
+
+    /* Seconds to wait for the server to accept a connection, 0 to wait forever */
+    guint connect_timeout;
+    guint connect_timeout_source;
+    GCancellable *connect_cancellable;
+
+    /* Seconds a remote server can go without answering before it is
+     * considered gone, 0 to rely on the connection closing */
+    guint liveness_timeout;
+    guint ping_source;
+    gboolean ping_pending;
+    unsigned int ping_sequence;
+    gint64 ping_time;
 } XServerPrivate;
 
+/* Connection being opened in a worker thread */
+typedef struct
+{
+    /* Existing connection to prepare instead of opening a new one */
+    xcb_connection_t *connection;
+
+    gchar *address;
+    gchar *authorization_name;
+    guint8 *authorization_data;
+    gsize authorization_data_length;
+
+    /* TRUE if the root window should be prepared */
+    gboolean prepare_root;
+    guint16 red, green, blue;
+} ConnectRequest;
+
+/* Glyph in the X cursor font for the default arrow cursor */
+#define XC_LEFT_PTR 68
+
 G_DEFINE_TYPE_WITH_PRIVATE (XServer, x_server, DISPLAY_SERVER_TYPE)
 
 void
@@ -79,6 +124,15 @@ x_server_get_address (XServer *server)
     return priv->address;
 }
 
+/* Called by subclasses when the display number changes */
+void
+x_server_reset_address (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_clear_pointer (&priv->address, g_free);
+}
+
 void
 x_server_set_authority (XServer *server, XAuthority *authority)
 {
@@ -99,6 +153,41 @@ x_server_get_authority (XServer *server)
     return priv->authority;
 }
 
+void
+x_server_set_background (XServer *server, const gchar *background)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+
+    g_free (priv->background);
+    priv->background = g_strdup (background);
+}
+
+void
+x_server_set_connect_timeout (XServer *server, guint timeout)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->connect_timeout = timeout;
+}
+
+void
+x_server_set_liveness_timeout (XServer *server, guint timeout)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->liveness_timeout = timeout;
+}
+
+gboolean
+x_server_get_is_connected (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, FALSE);
+    return priv->connection != NULL && !xcb_connection_has_error (priv->connection);
+}
+
 static const gchar *
 x_server_get_session_type (DisplayServer *server)
 {
@@ -111,32 +200,320 @@ x_server_get_can_share (DisplayServer *server)
     return TRUE;
 }
 
+static void
+connect_request_free (ConnectRequest *request)
+{
+    g_free (request->address);
+    g_free (request->authorization_name);
+    g_free (request->authorization_data);
+    g_free (request);
+}
+
+/* Set the background and cursor on each screen so the greeter starts on a prepared display */
+static void
+prepare_root_windows (xcb_connection_t *connection, ConnectRequest *request)
+{
+    xcb_font_t font = xcb_generate_id (connection);
+    xcb_open_font (connection, font, strlen ("cursor"), "cursor");
+    xcb_cursor_t cursor = xcb_generate_id (connection);
+    xcb_create_glyph_cursor (connection, cursor, font, font, XC_LEFT_PTR, XC_LEFT_PTR + 1, 0, 0, 0, 0xFFFF, 0xFFFF, 0xFFFF);
+    xcb_close_font (connection, font);
+
+    for (xcb_screen_iterator_t iter = xcb_setup_roots_iterator (xcb_get_setup (connection)); iter.rem; xcb_screen_next (&iter))
+    {
+        xcb_screen_t *screen = iter.data;
+
+        uint32_t pixel = screen->black_pixel;
+        xcb_alloc_color_reply_t *reply = xcb_alloc_color_reply (connection, xcb_alloc_color (connection, screen->default_colormap, request->red, request->green, request->blue), NULL);
+        if (reply)
+            pixel = reply->pixel;
+        free (reply);
+
+        uint32_t values[] = { pixel, cursor };
+        xcb_change_window_attributes (connection, screen->root, XCB_CW_BACK_PIXEL | XCB_CW_CURSOR, values);
+        xcb_clear_area (connection, 0, screen->root, 0, 0, 0, 0);
+    }
+
+    xcb_free_cursor (connection, cursor);
+
+    /* Wait until the server has processed the changes */
+    free (xcb_get_input_focus_reply (connection, xcb_get_input_focus (connection), NULL));
+}
+
+static void
+connect_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    ConnectRequest *request = task_data;
+
+    if (request->connection)
+    {
+        if (request->prepare_root)
+            prepare_root_windows (request->connection, request);
+        g_task_return_pointer (task, request->connection, NULL);
+        return;
+    }
+
+    xcb_auth_info_t *auth = NULL, a;
+    if (request->authorization_name)
+    {
+        a.namelen = strlen (request->authorization_name);
+        a.name = request->authorization_name;
+        a.datalen = request->authorization_data_length;
+        a.data = (char *) request->authorization_data;
+        auth = &a;
+    }
+
+    xcb_connection_t *connection = xcb_connect_to_display_with_auth_info (request->address, auth, NULL);
+    if (xcb_connection_has_error (connection))
+    {
+        xcb_disconnect (connection);
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Error connecting to XServer %s", request->address);
+        return;
+    }
+
+    if (request->prepare_root)
+        prepare_root_windows (connection, request);
+
+    g_task_return_pointer (task, connection, (GDestroyNotify) xcb_disconnect);
+}
+
+static void
+stop_ping (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    if (priv->ping_source)
+        g_source_remove (priv->ping_source);
+    priv->ping_source = 0;
+    priv->ping_pending = FALSE;
+}
+
+static void
+connection_lost (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    if (priv->connection_watch)
+        g_source_remove (priv->connection_watch);
+    priv->connection_watch = 0;
+    stop_ping (server);
+    if (X_SERVER_GET_CLASS (server)->disconnected)
+        X_SERVER_GET_CLASS (server)->disconnected (server);
+}
+
+static gboolean
+connection_cb (gint fd, GIOCondition condition, gpointer data)
+{
+    XServer *server = data;
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    /* No events are selected, but errors and replies still need to be read */
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event (priv->connection)))
+        free (event);
+
+    if (xcb_connection_has_error (priv->connection))
+    {
+        l_debug (server, "Connection to XServer %s closed", x_server_get_address (server));
+        priv->connection_watch = 0;
+        connection_lost (server);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Make a round trip to the server, a terminal that was switched off won't answer */
+static gboolean
+ping_cb (gpointer data)
+{
+    XServer *server = data;
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    if (priv->ping_pending)
+    {
+        void *reply = NULL;
+        xcb_generic_error_t *error = NULL;
+        if (xcb_poll_for_reply (priv->connection, priv->ping_sequence, &reply, &error))
+        {
+            free (reply);
+            free (error);
+            priv->ping_pending = FALSE;
+        }
+        else if (xcb_connection_has_error (priv->connection) ||
+                 g_get_monotonic_time () - priv->ping_time >= (gint64) priv->liveness_timeout * G_USEC_PER_SEC)
+        {
+            l_warning (server, "XServer %s has not responded for %u seconds, treating it as gone", x_server_get_address (server), priv->liveness_timeout);
+            priv->ping_source = 0;
+            connection_lost (server);
+            return G_SOURCE_REMOVE;
+        }
+    }
+
+    if (!priv->ping_pending)
+    {
+        priv->ping_sequence = xcb_get_input_focus (priv->connection).sequence;
+        xcb_flush (priv->connection);
+        priv->ping_pending = TRUE;
+        priv->ping_time = g_get_monotonic_time ();
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Have the kernel give up on the connection within the liveness timeout, so
+ * writes to a vanished terminal fail instead of being retried for minutes */
+static void
+set_keepalive (int fd, guint timeout)
+{
+    int enable = 1;
+    setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof (enable));
+    if (timeout == 0)
+        return;
+
+    int interval = MAX (timeout / 3, 1);
+#ifdef TCP_KEEPIDLE
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE, &interval, sizeof (interval));
+#endif
+#ifdef TCP_KEEPINTVL
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof (interval));
+#endif
+#ifdef TCP_KEEPCNT
+    int count = 3;
+    setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof (count));
+#endif
+#ifdef TCP_USER_TIMEOUT
+    unsigned int user_timeout = timeout * 1000;
+    setsockopt (fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof (user_timeout));
+#endif
+}
+
+static void
+connect_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    XServer *server = X_SERVER (object);
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    if (priv->connect_timeout_source)
+        g_source_remove (priv->connect_timeout_source);
+    priv->connect_timeout_source = 0;
+    g_clear_object (&priv->connect_cancellable);
+
+    g_autoptr(GError) error = NULL;
+    xcb_connection_t *connection = g_task_propagate_pointer (G_TASK (result), &error);
+    if (!connection)
+    {
+        /* Cancelled connections have already been given up on */
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            return;
+        l_debug (server, "%s", error->message);
+        display_server_stop (DISPLAY_SERVER (server));
+        return;
+    }
+
+    /* Server was stopped while connecting */
+    if (display_server_get_is_stopping (DISPLAY_SERVER (server)))
+    {
+        if (connection != priv->connection)
+            xcb_disconnect (connection);
+        return;
+    }
+
+    if (connection != priv->connection)
+    {
+        priv->connection = connection;
+        priv->connection_watch = g_unix_fd_add (xcb_get_file_descriptor (connection), G_IO_IN | G_IO_HUP | G_IO_ERR, connection_cb, server);
+
+        /* Notice remote servers that go away without closing the connection */
+        if (priv->hostname)
+        {
+            set_keepalive (xcb_get_file_descriptor (connection), priv->liveness_timeout);
+            if (priv->liveness_timeout > 0)
+                priv->ping_source = g_timeout_add_seconds (MAX (priv->liveness_timeout / 3, 1), ping_cb, server);
+        }
+    }
+
+    DISPLAY_SERVER_CLASS (x_server_parent_class)->start (DISPLAY_SERVER (server));
+}
+
+static gboolean
+connect_timeout_cb (gpointer data)
+{
+    XServer *server = data;
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    priv->connect_timeout_source = 0;
+
+    l_warning (server, "Timed out connecting to XServer %s after %u seconds", x_server_get_address (server), priv->connect_timeout);
+    g_cancellable_cancel (priv->connect_cancellable);
+    display_server_stop (DISPLAY_SERVER (server));
+
+    return G_SOURCE_REMOVE;
+}
+
 static gboolean
 x_server_start (DisplayServer *display_server)
 {
     XServer *server = X_SERVER (display_server);
     XServerPrivate *priv = x_server_get_instance_private (server);
 
-    xcb_auth_info_t *auth = NULL, a;
+    ConnectRequest *request = g_malloc0 (sizeof (ConnectRequest));
+    if (x_server_get_is_connected (server))
+        request->connection = priv->connection;
+    request->address = g_strdup (x_server_get_address (server));
     if (priv->authority)
     {
-        a.namelen = strlen (x_authority_get_authorization_name (priv->authority));
-        a.name = (char *) x_authority_get_authorization_name (priv->authority);
-        a.datalen = x_authority_get_authorization_data_length (priv->authority);
-        a.data = (char *) x_authority_get_authorization_data (priv->authority);
-        auth = &a;
+        request->authorization_name = g_strdup (x_authority_get_authorization_name (priv->authority));
+        request->authorization_data_length = x_authority_get_authorization_data_length (priv->authority);
+        request->authorization_data = g_malloc (request->authorization_data_length);
+        memcpy (request->authorization_data, x_authority_get_authorization_data (priv->authority), request->authorization_data_length);
+    }
+    if (priv->background)
+    {
+        guint red, green, blue;
+        if (sscanf (priv->background, "#%02x%02x%02x", &red, &green, &blue) == 3)
+        {
+            request->prepare_root = TRUE;
+            request->red = red * 0x101;
+            request->green = green * 0x101;
+            request->blue = blue * 0x101;
+        }
+        else
+            l_warning (server, "Ignoring invalid X server background colour '%s'", priv->background);
     }
 
-    /* Open connection */
-    l_debug (server, "Connecting to XServer %s", x_server_get_address (server));
-    priv->connection = xcb_connect_to_display_with_auth_info (x_server_get_address (server), auth, NULL);
-    if (xcb_connection_has_error (priv->connection))
+    /* Connect in a thread so an unresponsive server doesn't block the daemon */
+    if (request->connection)
+        l_debug (server, "Reusing connection to XServer %s", x_server_get_address (server));
+    else
+        l_debug (server, "Connecting to XServer %s", x_server_get_address (server));
+    g_clear_object (&priv->connect_cancellable);
+    priv->connect_cancellable = g_cancellable_new ();
+    g_autoptr(GTask) task = g_task_new (server, priv->connect_cancellable, connect_cb, NULL);
+    g_task_set_task_data (task, request, (GDestroyNotify) connect_request_free);
+    g_task_run_in_thread (task, connect_thread);
+    if (priv->connect_timeout > 0)
     {
-        l_debug (server, "Error connecting to XServer %s", x_server_get_address (server));
-        return FALSE;
+        if (priv->connect_timeout_source)
+            g_source_remove (priv->connect_timeout_source);
+        priv->connect_timeout_source = g_timeout_add_seconds (priv->connect_timeout, connect_timeout_cb, server);
     }
 
-    return DISPLAY_SERVER_CLASS (x_server_parent_class)->start (display_server);
+    return TRUE;
+}
+
+void
+x_server_disconnect (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+
+    if (priv->connection_watch)
+        g_source_remove (priv->connection_watch);
+    priv->connection_watch = 0;
+    stop_ping (server);
+    g_clear_pointer (&priv->connection, xcb_disconnect);
 }
 
 static void
@@ -166,7 +543,8 @@ x_server_connect_session (DisplayServer *display_server, Session *session)
     session_set_remote_host_name (session, x_server_get_hostname (X_SERVER (display_server)));
     session_set_x_authority (session,
                              x_server_get_authority (X_SERVER (display_server)),
-                             config_get_boolean (config_get_instance (), "LightDM", "user-authority-in-system-dir"));
+                             config_get_boolean (config_get_instance (), "LightDM", "user-authority-in-system-dir"),
+                             config_get_boolean (config_get_instance (), "LightDM", "user-authority-in-runtime-dir"));
 }
 
 static void
@@ -182,7 +560,7 @@ x_server_disconnect_session (DisplayServer *display_server, Session *session)
     session_unset_env (session, "DISPLAY");
     session_set_xdisplay (session, NULL);
     session_set_remote_host_name (session, NULL);
-    session_set_x_authority (session, NULL, FALSE);
+    session_set_x_authority (session, NULL, FALSE, FALSE);
 }
 
 void
@@ -199,6 +577,16 @@ x_server_finalize (GObject *object)
     g_clear_pointer (&priv->hostname, g_free);
     g_clear_pointer (&priv->address, g_free);
     g_clear_object (&priv->authority);
+    g_clear_pointer (&priv->background, g_free);
+    if (priv->connect_timeout_source)
+        g_source_remove (priv->connect_timeout_source);
+    if (priv->connect_cancellable)
+        g_cancellable_cancel (priv->connect_cancellable);
+    g_clear_object (&priv->connect_cancellable);
+    if (priv->connection_watch)
+        g_source_remove (priv->connection_watch);
+    if (priv->ping_source)
+        g_source_remove (priv->ping_source);
     if (priv->connection)
         xcb_disconnect (priv->connection);
     priv->connection = NULL;
@@ -33,6 +33,7 @@ typedef struct
 {
     DisplayServerClass parent_class;
     guint (*get_display_number) (XServer *server);
+    void (*disconnected) (XServer *server);
 } XServerClass;
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (XServer, g_object_unref)
@@ -47,6 +48,8 @@ guint x_server_get_display_number (XServer *server);
 
 const gchar *x_server_get_address (XServer *server);
 
+void x_server_reset_address (XServer *server);
+
 const gchar *x_server_get_authentication_name (XServer *server);
 
 const guint8 *x_server_get_authentication_data (XServer *server);
@@ -57,6 +60,16 @@ void x_server_set_authority (XServer *server, XAuthority *authority);
 
 XAuthority *x_server_get_authority (XServer *server);
 
+void x_server_set_background (XServer *server, const gchar *background);
+
+void x_server_set_connect_timeout (XServer *server, guint timeout);
+
+void x_server_set_liveness_timeout (XServer *server, guint timeout);
+
+gboolean x_server_get_is_connected (XServer *server);
+
+void x_server_disconnect (XServer *server);
+
 G_END_DECLS
 
 #endif /* X_SERVER_H_ */
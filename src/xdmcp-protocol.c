@@ -20,17 +20,31 @@ typedef struct
     const guint8 *data;
     guint16 remaining;
     gboolean overflow;
+
+    /* Space after the packet in the same allocation that fields are copied into */
+    guint8 *arena;
+    gsize arena_remaining;
 } PacketReader;
 
-static guint8
-read_card8 (PacketReader *reader)
+static gboolean
+check_remaining (PacketReader *reader, gsize length)
 {
-    if (reader->remaining < 1)
+    if (reader->remaining < length)
     {
         reader->overflow = TRUE;
-        return 0;
+        reader->remaining = 0;
+        return FALSE;
     }
 
+    return TRUE;
+}
+
+static guint8
+read_card8 (PacketReader *reader)
+{
+    if (!check_remaining (reader, 1))
+        return 0;
+
     guint8 value = reader->data[0];
     reader->data++;
     reader->remaining--;
@@ -41,33 +55,81 @@ read_card8 (PacketReader *reader)
 static guint16
 read_card16 (PacketReader *reader)
 {
-    return read_card8 (reader) << 8 | read_card8 (reader);
+    if (!check_remaining (reader, 2))
+        return 0;
+
+    guint16 value;
+    memcpy (&value, reader->data, 2);
+    reader->data += 2;
+    reader->remaining -= 2;
+
+    return GUINT16_FROM_BE (value);
 }
 
 static guint32
 read_card32 (PacketReader *reader)
 {
-    return read_card8 (reader) << 24 | read_card8 (reader) << 16 | read_card8 (reader) << 8 | read_card8 (reader);
+    if (!check_remaining (reader, 4))
+        return 0;
+
+    guint32 value;
+    memcpy (&value, reader->data, 4);
+    reader->data += 4;
+    reader->remaining -= 4;
+
+    return GUINT32_FROM_BE (value);
+}
+
+static gpointer
+arena_alloc (PacketReader *reader, gsize size, gsize alignment)
+{
+    gsize padding = (alignment - (GPOINTER_TO_SIZE (reader->arena) % alignment)) % alignment;
+    if (reader->arena_remaining < padding + size)
+    {
+        reader->overflow = TRUE;
+        return NULL;
+    }
+
+    gpointer value = reader->arena + padding;
+    reader->arena += padding + size;
+    reader->arena_remaining -= padding + size;
+
+    return value;
 }
 
 static void
 read_data (PacketReader *reader, XDMCPData *data)
 {
     data->length = read_card16 (reader);
-    data->data = g_malloc (sizeof (guint8) * data->length);
-    for (guint16 i = 0; i < data->length; i++)
-        data->data[i] = read_card8 (reader);
+    data->data = NULL;
+    if (!check_remaining (reader, data->length))
+    {
+        data->length = 0;
+        return;
+    }
+
+    data->data = arena_alloc (reader, data->length, 1);
+    if (data->data)
+        memcpy (data->data, reader->data, data->length);
+    reader->data += data->length;
+    reader->remaining -= data->length;
 }
 
 static gchar *
 read_string (PacketReader *reader)
 {
     guint16 length = read_card16 (reader);
-    gchar *string = g_malloc (sizeof (gchar) * (length + 1));
-    guint16 i;
-    for (i = 0; i < length; i++)
-        string[i] = (gchar) read_card8 (reader);
-    string[i] = '\0';
+    if (!check_remaining (reader, length))
+        return NULL;
+
+    gchar *string = arena_alloc (reader, length + 1, 1);
+    if (string)
+    {
+        memcpy (string, reader->data, length);
+        string[length] = '\0';
+    }
+    reader->data += length;
+    reader->remaining -= length;
 
     return string;
 }
@@ -76,7 +138,14 @@ static gchar **
 read_string_array (PacketReader *reader)
 {
     guint8 n_strings = read_card8 (reader);
-    gchar **strings = g_malloc (sizeof (gchar *) * (n_strings + 1));
+
+    /* Each string takes at least two octets, check before making space for them */
+    if (!check_remaining (reader, n_strings * 2))
+        return NULL;
+
+    gchar **strings = arena_alloc (reader, sizeof (gchar *) * (n_strings + 1), sizeof (gchar *));
+    if (!strings)
+        return NULL;
     guint8 i;
     for (i = 0; i < n_strings; i++)
         strings[i] = read_string (reader);
@@ -106,36 +175,57 @@ write_card8 (PacketWriter *writer, guint8 value)
     writer->remaining--;
 }
 
+static gboolean
+check_space (PacketWriter *writer, gsize length)
+{
+    if (writer->remaining < length)
+    {
+        writer->overflow = TRUE;
+        writer->remaining = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+write_bytes (PacketWriter *writer, const void *value, gsize length)
+{
+    if (length == 0 || !check_space (writer, length))
+        return;
+
+    memcpy (writer->data, value, length);
+    writer->data += length;
+    writer->remaining -= length;
+}
+
 static void
 write_card16 (PacketWriter *writer, guint16 value)
 {
-    write_card8 (writer, value >> 8);
-    write_card8 (writer, value & 0xFF);
+    guint16 data = GUINT16_TO_BE (value);
+    write_bytes (writer, &data, 2);
 }
 
 static void
 write_card32 (PacketWriter *writer, guint32 value)
 {
-    write_card8 (writer, (value >> 24) & 0xFF);
-    write_card8 (writer, (value >> 16) & 0xFF);
-    write_card8 (writer, (value >> 8) & 0xFF);
-    write_card8 (writer, value & 0xFF);
+    guint32 data = GUINT32_TO_BE (value);
+    write_bytes (writer, &data, 4);
 }
 
 static void
 write_data (PacketWriter *writer, const XDMCPData *value)
 {
     write_card16 (writer, value->length);
-    for (guint16 i = 0; i < value->length; i++)
-        write_card8 (writer, value->data[i]);
+    write_bytes (writer, value->data, value->length);
 }
 
 static void
 write_string (PacketWriter *writer, const gchar *value)
 {
-    write_card16 (writer, strlen (value));
-    for (const gchar *c = value; *c; c++)
-        write_card8 (writer, *c);
+    gsize length = strlen (value);
+    write_card16 (writer, length);
+    write_bytes (writer, value, length);
 }
 
 static void
@@ -162,6 +252,8 @@ xdmcp_packet_decode (const guint8 *data, gsize data_length)
     reader.data = data;
     reader.remaining = data_length;
     reader.overflow = FALSE;
+    reader.arena = NULL;
+    reader.arena_remaining = 0;
 
     guint16 version = read_card16 (&reader);
     guint16 opcode = read_card16 (&reader);
@@ -183,7 +275,16 @@ xdmcp_packet_decode (const guint8 *data, gsize data_length)
         return NULL;
     }
 
-    XDMCPPacket *packet = xdmcp_packet_alloc (opcode);
+    /* The fields are copied into the same allocation as the packet. No field
+     * needs more than eight times the octets it takes in the packet (a
+     * connection is 24 bytes for four octets), with some extra for padding
+     * and the terminators of string arrays */
+    gsize arena_size = length * 8 + 64;
+    XDMCPPacket *packet = g_malloc0 (sizeof (XDMCPPacket) + arena_size);
+    packet->opcode = opcode;
+    packet->single_allocation = TRUE;
+    reader.arena = (guint8 *) (packet + 1);
+    reader.arena_remaining = arena_size;
     gboolean failed = FALSE;
     switch (packet->opcode)
     {
@@ -209,7 +310,11 @@ xdmcp_packet_decode (const guint8 *data, gsize data_length)
     case XDMCP_Request:
         packet->Request.display_number = read_card16 (&reader);
         packet->Request.n_connections = read_card8 (&reader);
-        packet->Request.connections = g_malloc (sizeof (XDMCPConnection) * packet->Request.n_connections);
+        packet->Request.connections = NULL;
+        if (check_remaining (&reader, packet->Request.n_connections * 2))
+            packet->Request.connections = arena_alloc (&reader, sizeof (XDMCPConnection) * packet->Request.n_connections, sizeof (gpointer));
+        if (!packet->Request.connections)
+            packet->Request.n_connections = 0;
         for (int i = 0; i < packet->Request.n_connections; i++)
             packet->Request.connections[i].type = read_card16 (&reader);
         if (read_card8 (&reader) != packet->Request.n_connections)
@@ -363,6 +468,7 @@ xdmcp_packet_encode (XDMCPPacket *packet, guint8 *data, gsize max_length)
         break;
     }
 
+    gboolean overflow = writer.overflow;
     guint16 length = max_length - 6 - writer.remaining;
 
     /* Write header */
@@ -373,7 +479,7 @@ xdmcp_packet_encode (XDMCPPacket *packet, guint8 *data, gsize max_length)
     write_card16(&writer, packet->opcode);
     write_card16(&writer, length);
 
-    if (writer.overflow)
+    if (overflow || writer.overflow)
     {
         g_warning ("Overflow writing response");
         return -1;
@@ -512,6 +618,13 @@ xdmcp_packet_free (XDMCPPacket *packet)
     if (packet == NULL)
         return;
 
+    /* Decoded packets store their fields with the packet */
+    if (packet->single_allocation)
+    {
+        g_free (packet);
+        return;
+    }
+
     switch (packet->opcode)
     {
     case XDMCP_BroadcastQuery:
@@ -50,6 +50,9 @@ typedef struct
 {
     XDMCPOpcode opcode;
 
+    /* TRUE if the fields are in the same allocation as the packet (i.e. it was decoded) */
+    gboolean single_allocation;
+
     union
     {
         struct
@@ -9,8 +9,17 @@
  * license.
  */
 
+#define _GNU_SOURCE
+#include <config.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <X11/X.h>
 #define HASXDMAUTH
 #include <X11/Xdmcp.h>
@@ -19,6 +28,9 @@
 #include "xdmcp-server.h"
 #include "xdmcp-protocol.h"
 #include "x-authority.h"
+#include "metrics.h"
+#include "socket-activation.h"
+#include "logger.h"
 
 enum {
     NEW_SESSION,
@@ -26,6 +38,66 @@ enum {
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+typedef enum
+{
+    REPLY_WILLING,
+    REPLY_UNWILLING,
+    REPLY_FULL
+} QueryReplyType;
+
+typedef struct
+{
+    GSocket *socket;
+    GSocketAddress *address;
+    gboolean willing;
+} QueryReply;
+
+/* A reply held back because this host is busy */
+typedef struct
+{
+    GSocket *socket;
+    GSocketAddress *address;
+    gchar *address_string;
+    GBytes *data;
+    gchar *text;
+} DelayedReply;
+
+typedef struct
+{
+    /* Packet ready to send */
+    GBytes *data;
+
+    /* Description of the packet for logging */
+    gchar *text;
+} EncodedPacket;
+
+/* Reads packets from one socket, either in the main loop or in a thread of its own */
+typedef struct
+{
+    XDMCPServer *server;
+    GSocket *socket;
+
+    /* Context and thread the socket is read in (NULL for the main loop) */
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+
+    /* Buffer to receive packets into */
+    guint8 *receive_buffer;
+
+    /* Replies to queries received in this read, keyed by address */
+    GHashTable *query_replies;
+} XDMCPReader;
+
+/* A packet read in a worker thread that has to be handled in the main loop */
+typedef struct
+{
+    XDMCPServer *server;
+    GSocket *socket;
+    GSocketAddress *address;
+    XDMCPPacket *packet;
+} QueuedPacket;
+
 typedef struct
 {
     /* Port to listen on */
@@ -34,8 +106,14 @@ typedef struct
     /* Address to listen on */
     gchar *listen_address;
 
-    /* Listening sockets */
-    GSocket *socket, *socket6;
+    /* Number of threads to read packets in per address family (0 to use the main loop) */
+    guint worker_threads;
+
+    /* Listening sockets (XDMCPReader) */
+    GPtrArray *readers;
+
+    /* Protects the session IDs, reply cache and authentication settings shared with the worker threads */
+    GMutex lock;
 
     /* Hostname to report to client */
     gchar *hostname;
@@ -46,8 +124,56 @@ typedef struct
     /* XDM-AUTHENTICATION-1 key */
     gchar *key;
 
+    /* DES key decoded from key */
+    guint8 key_data[8];
+
     /* Known XDMCP sessions */
     GHashTable *sessions;
+
+    /* Sessions waiting for a Manage packet, oldest first */
+    GQueue *pending_sessions;
+
+    /* Timer for the oldest pending session expiring */
+    guint pending_timeout;
+
+    /* Maximum number of sessions to be starting at once (0 for no limit) */
+    guint max_launches;
+
+    /* Display classes to start before others, highest priority first */
+    gchar **priority_classes;
+
+    /* Managed sessions waiting to be started, in priority order */
+    GQueue *launch_queue;
+
+    /* Sessions being started */
+    GHashTable *launches;
+
+    /* Encoded Willing packets keyed by authentication name and the Unwilling packets */
+    GHashTable *willing_cache;
+    EncodedPacket *unwilling_cache;
+    EncodedPacket *full_cache;
+
+    /* TRUE to report the number of sessions and host load in Willing packets */
+    gboolean report_load;
+
+    /* Number of sessions after which queries are answered Unwilling (0 for no limit) */
+    guint max_sessions;
+
+    /* Load average above which Willing replies are delayed by busy_delay milliseconds (0 to never delay) */
+    gdouble busy_load;
+    guint busy_delay;
+
+    /* Subnets of this host's interfaces (LocalSubnet), rebuilt after netlink reports an address change */
+    GArray *local_subnets;
+    gboolean local_subnets_valid;
+    GSocket *netlink_socket;
+    guint netlink_watch;
+
+    /* Last sample of the host load and when it was taken */
+    gint64 load_time;
+    gdouble load_average;
+    guint64 available_memory;
+    gchar *load_status;
 } XDMCPServerPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (XDMCPServer, xdmcp_server, G_TYPE_OBJECT)
@@ -55,12 +181,42 @@ G_DEFINE_TYPE_WITH_PRIVATE (XDMCPServer, xdmcp_server, G_TYPE_OBJECT)
 /* Maximum number of milliseconds client will resend manage requests before giving up */
 #define MANAGE_TIMEOUT 126000
 
-/* Address sort support structure */
+/* Maximum number of sessions that can be waiting for a Manage packet */
+#define MAX_PENDING_SESSIONS 256
+
+/* Maximum number of packets to handle in one main loop iteration */
+#define MAX_PACKETS_PER_READ 32
+
+/* Microseconds the host load is sampled for before being read again */
+#define LOAD_SAMPLE_INTERVAL G_USEC_PER_SEC
+
+/* An address on one of this host's interfaces */
 typedef struct
 {
-    gsize index;
-    GInetAddress *address;
-} AddrSortItem;
+    guint8 address[16];
+    gsize length;
+    guint prefix_length;
+} LocalSubnet;
+
+static void
+encoded_packet_free (EncodedPacket *packet)
+{
+    if (!packet)
+        return;
+    g_bytes_unref (packet->data);
+    g_free (packet->text);
+    g_free (packet);
+}
+
+static void
+clear_reply_cache (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_hash_table_remove_all (priv->willing_cache);
+    g_clear_pointer (&priv->unwilling_cache, encoded_packet_free);
+    g_clear_pointer (&priv->full_cache, encoded_packet_free);
+}
 
 XDMCPServer *
 xdmcp_server_new (void)
@@ -106,8 +262,11 @@ xdmcp_server_set_hostname (XDMCPServer *server, const gchar *hostname)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
     g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
     g_free (priv->hostname);
     priv->hostname = g_strdup (hostname);
+    clear_reply_cache (server);
+    g_mutex_unlock (&priv->lock);
 }
 
 const gchar *
@@ -123,8 +282,11 @@ xdmcp_server_set_status (XDMCPServer *server, const gchar *status)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
     g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
     g_free (priv->status);
     priv->status = g_strdup (status);
+    clear_reply_cache (server);
+    g_mutex_unlock (&priv->lock);
 }
 
 const gchar *
@@ -135,60 +297,266 @@ xdmcp_server_get_status (XDMCPServer *server)
     return priv->status;
 }
 
+guint
+xdmcp_server_get_n_sessions (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_val_if_fail (server != NULL, 0);
+    return g_hash_table_size (priv->sessions);
+}
+
+static guint8
+atox (char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return 0;
+}
+
+static void
+decode_key (const gchar *key, guint8 *data)
+{
+    memset (data, 0, 8);
+    if (strncmp (key, "0x", 2) == 0 || strncmp (key, "0X", 2) == 0)
+    {
+        for (gint i = 0; i < 8; i++)
+        {
+            if (key[i*2] == '\0')
+                break;
+            data[i] |= atox (key[i*2]) << 8;
+            if (key[i*2+1] == '\0')
+                break;
+            data[i] |= atox (key[i*2+1]);
+        }
+    }
+    else
+    {
+        for (gint i = 1; i < 8 && key[i-1]; i++)
+           data[i] = key[i-1];
+    }
+}
+
 void
 xdmcp_server_set_key (XDMCPServer *server, const gchar *key)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
     g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
     g_free (priv->key);
     priv->key = g_strdup (key);
+    if (key)
+        decode_key (key, priv->key_data);
+    else
+        memset (priv->key_data, 0, sizeof (priv->key_data));
+    clear_reply_cache (server);
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_report_load (XDMCPServer *server, gboolean report_load)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->report_load = report_load;
+    clear_reply_cache (server);
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_max_sessions (XDMCPServer *server, guint max_sessions)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->max_sessions = max_sessions;
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_busy_load (XDMCPServer *server, gdouble busy_load, guint busy_delay)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->busy_load = busy_load;
+    priv->busy_delay = busy_delay;
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_worker_threads (XDMCPServer *server, guint worker_threads)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->worker_threads = worker_threads;
+}
+
+void
+xdmcp_server_set_max_launches (XDMCPServer *server, guint max_launches)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->max_launches = max_launches;
+}
+
+void
+xdmcp_server_set_priority_classes (XDMCPServer *server, gchar **display_classes)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_strfreev (priv->priority_classes);
+    priv->priority_classes = g_strdupv (display_classes);
 }
 
 typedef struct
 {
     XDMCPServer *server;
     XDMCPSession *session;
-    guint timeout_source;
+
+    /* Time this session stops waiting for a Manage packet */
+    gint64 manage_deadline;
+
+    /* Link in pending_sessions or NULL if managed */
+    GList *pending_link;
+
+    /* Where the Manage came from, to report a failure to start */
+    GSocket *manage_socket;
+    GSocketAddress *manage_address;
+
+    /* Position of the display class in the priority list */
+    guint priority;
+
+    /* TRUE once a seat has been started for the display, protected by lock */
+    gboolean running;
 } SessionData;
 
+static void
+query_reply_free (QueryReply *reply)
+{
+    g_object_unref (reply->socket);
+    g_object_unref (reply->address);
+    g_free (reply);
+}
+
 static void
 session_data_free (SessionData *data)
 {
     g_object_unref (data->session);
-    if (data->timeout_source != 0)
-        g_source_remove (data->timeout_source);
+    g_clear_object (&data->manage_socket);
+    g_clear_object (&data->manage_address);
     g_free (data);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (SessionData, session_data_free)
+static void schedule_pending_timeout (XDMCPServer *server);
 
-static gboolean
-session_timeout_cb (gpointer user_data)
+static void
+remove_pending (XDMCPServer *server, SessionData *data)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!data->pending_link)
+        return;
+
+    gboolean was_oldest = data->pending_link == priv->pending_sessions->head;
+    g_queue_delete_link (priv->pending_sessions, data->pending_link);
+    data->pending_link = NULL;
+    if (was_oldest)
+        schedule_pending_timeout (server);
+}
+
+static void
+remove_session (XDMCPServer *server, SessionData *data)
 {
-    g_autoptr(SessionData) data = user_data;
-    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (data->server);
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
-    g_debug ("Timing out unmanaged session %d", xdmcp_session_get_id (data->session));
+    remove_pending (server, data);
+    g_mutex_lock (&priv->lock);
     g_hash_table_remove (priv->sessions, GINT_TO_POINTER ((gint) xdmcp_session_get_id (data->session)));
+    g_mutex_unlock (&priv->lock);
+}
+
+static gboolean
+pending_timeout_cb (gpointer user_data)
+{
+    XDMCPServer *server = user_data;
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    priv->pending_timeout = 0;
+
+    /* Sessions all wait the same time, so expired ones are at the head of the queue */
+    gint64 now = g_get_monotonic_time ();
+    while (!g_queue_is_empty (priv->pending_sessions))
+    {
+        SessionData *data = g_queue_peek_head (priv->pending_sessions);
+        if (data->manage_deadline > now)
+            break;
+
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Timing out unmanaged session %d", xdmcp_session_get_id (data->session));
+        g_queue_pop_head (priv->pending_sessions);
+        data->pending_link = NULL;
+        g_mutex_lock (&priv->lock);
+        g_hash_table_remove (priv->sessions, GINT_TO_POINTER ((gint) xdmcp_session_get_id (data->session)));
+        g_mutex_unlock (&priv->lock);
+    }
+
+    schedule_pending_timeout (server);
+
     return G_SOURCE_REMOVE;
 }
 
+static void
+schedule_pending_timeout (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (priv->pending_timeout != 0)
+        g_source_remove (priv->pending_timeout);
+    priv->pending_timeout = 0;
+
+    SessionData *oldest = g_queue_peek_head (priv->pending_sessions);
+    if (!oldest)
+        return;
+
+    gint64 delay = (oldest->manage_deadline - g_get_monotonic_time ()) / 1000;
+    priv->pending_timeout = g_timeout_add (MAX (delay, 0) + 1, pending_timeout_cb, server);
+}
+
 static XDMCPSession *
 add_session (XDMCPServer *server, GInetAddress *address, guint16 display_number, XAuthority *authority)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
+    /* Drop the oldest request if too many clients haven't followed up */
+    if (g_queue_get_length (priv->pending_sessions) >= MAX_PENDING_SESSIONS)
+    {
+        SessionData *oldest = g_queue_peek_head (priv->pending_sessions);
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Too many unmanaged sessions, dropping session %d", xdmcp_session_get_id (oldest->session));
+        remove_session (server, oldest);
+    }
+
     guint16 id;
     do
     {
-        id = g_random_int () & 0xFFFFFFFF;
+        id = g_random_int () & 0xFFFF;
     } while (g_hash_table_lookup (priv->sessions, GINT_TO_POINTER ((gint) id)));
 
     SessionData *data = g_malloc0 (sizeof (SessionData));
     data->server = server;
     data->session = xdmcp_session_new (id, address, display_number, authority);
-    data->timeout_source = g_timeout_add (MANAGE_TIMEOUT, session_timeout_cb, data);
+    data->manage_deadline = g_get_monotonic_time () + MANAGE_TIMEOUT * 1000;
+    g_mutex_lock (&priv->lock);
     g_hash_table_insert (priv->sessions, GINT_TO_POINTER ((gint) id), data);
+    g_mutex_unlock (&priv->lock);
+
+    g_queue_push_tail (priv->pending_sessions, data);
+    data->pending_link = priv->pending_sessions->tail;
+    if (priv->pending_sessions->length == 1)
+        schedule_pending_timeout (server);
 
     return data->session;
 }
@@ -207,22 +575,47 @@ socket_address_to_string (GSocketAddress *address)
     return g_strdup_printf ("%s:%d", inet_text, g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address)));
 }
 
+static void
+send_data (GSocket *socket, GSocketAddress *address, const guint8 *data, gsize length)
+{
+    g_autoptr(GError) error = NULL;
+    g_socket_send_to (socket, address, (const gchar *) data, length, NULL, &error);
+    if (error)
+        g_warning ("Error sending packet: %s", error->message);
+}
+
+static void
+count_packet (const gchar *direction, guint16 opcode)
+{
+    static const gchar *opcode_names[] =
+    {
+        NULL, "BroadcastQuery", "Query", "IndirectQuery", "ForwardQuery", "Willing", "Unwilling", "Request",
+        "Accept", "Decline", "Manage", "Refuse", "Failed", "KeepAlive", "Alive"
+    };
+    const gchar *name = opcode < G_N_ELEMENTS (opcode_names) && opcode_names[opcode] ? opcode_names[opcode] : "unknown";
+
+    g_autofree gchar *labels = g_strdup_printf ("direction=\"%s\",opcode=\"%s\"", direction, name);
+    common_metrics_add ("lightdm_xdmcp_packets_total", labels, 1);
+}
+
 static void
 send_packet (GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
 {
-    g_autofree gchar *address_string = socket_address_to_string (address);
-    g_debug ("Send %s to %s", xdmcp_packet_tostring (packet), address_string);
+    if (logger_level_enabled (LOG_SUBSYSTEM_XDMCP, G_LOG_LEVEL_DEBUG))
+    {
+        g_autofree gchar *packet_string = xdmcp_packet_tostring (packet);
+        g_autofree gchar *address_string = socket_address_to_string (address);
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Send %s to %s", packet_string, address_string);
+    }
 
-    guint8 data[1024];
-    gssize n_written = xdmcp_packet_encode (packet, data, 1024);
+    guint8 data[XDM_MAX_MSGLEN];
+    gssize n_written = xdmcp_packet_encode (packet, data, XDM_MAX_MSGLEN);
     if (n_written < 0)
         g_critical ("Failed to encode XDMCP packet");
     else
     {
-        g_autoptr(GError) error = NULL;
-        g_socket_send_to (socket, address, (gchar *) data, n_written, NULL, &error);
-        if (error)
-            g_warning ("Error sending packet: %s", error->message);
+        count_packet ("sent", packet->opcode);
+        send_data (socket, address, data, n_written);
     }
 }
 
@@ -237,51 +630,245 @@ get_authentication_name (XDMCPServer *server)
 }
 
 static void
-handle_query (XDMCPServer *server, GSocket *socket, GSocketAddress *address, gchar **authentication_names)
+handle_query (XDMCPReader *reader, GSocketAddress *address, gchar **authentication_names)
 {
-    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (reader->server);
+
+    g_mutex_lock (&priv->lock);
 
     /* If no authentication requested and we are configured for none then allow */
-    const gchar *authentication_name = NULL;
-    if (authentication_names[0] == NULL && priv->key == NULL)
-        authentication_name = "";
+    gboolean willing = authentication_names[0] == NULL && priv->key == NULL;
 
-    for (gchar **i = authentication_names; *i; i++)
+    for (gchar **i = authentication_names; *i && !willing; i++)
     {
-        if (strcmp (*i, get_authentication_name (server)) == 0 && priv->key != NULL)
-        {
-            authentication_name = *i;
-            break;
-        }
+        if (strcmp (*i, get_authentication_name (reader->server)) == 0 && priv->key != NULL)
+            willing = TRUE;
+    }
+
+    g_mutex_unlock (&priv->lock);
+
+    /* Reply once all the queries that have arrived have been read, a client
+     * broadcasting on multiple interfaces or resending only gets one answer */
+    g_autofree gchar *address_string = socket_address_to_string (address);
+    if (g_hash_table_contains (reader->query_replies, address_string))
+        return;
+
+    QueryReply *reply = g_malloc0 (sizeof (QueryReply));
+    reply->socket = g_object_ref (reader->socket);
+    reply->address = g_object_ref (address);
+    reply->willing = willing;
+    g_hash_table_insert (reader->query_replies, g_steal_pointer (&address_string), reply);
+}
+
+static EncodedPacket *
+encode_packet (XDMCPPacket *packet)
+{
+    guint8 data[XDM_MAX_MSGLEN];
+    gssize length = xdmcp_packet_encode (packet, data, XDM_MAX_MSGLEN);
+    if (length < 0)
+    {
+        g_critical ("Failed to encode XDMCP packet");
+        return NULL;
+    }
+
+    EncodedPacket *encoded = g_malloc0 (sizeof (EncodedPacket));
+    encoded->data = g_bytes_new (data, length);
+    encoded->text = xdmcp_packet_tostring (packet);
+
+    return encoded;
+}
+
+/* Called with the lock held */
+static EncodedPacket *
+get_query_reply (XDMCPServer *server, QueryReplyType type)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    /* Replies only change when the server configuration or reported load does, so they are built once */
+    const gchar *authentication_name = get_authentication_name (server);
+    EncodedPacket *encoded = NULL;
+    switch (type)
+    {
+    case REPLY_WILLING:
+        encoded = g_hash_table_lookup (priv->willing_cache, authentication_name);
+        break;
+    case REPLY_UNWILLING:
+        encoded = priv->unwilling_cache;
+        break;
+    case REPLY_FULL:
+        encoded = priv->full_cache;
+        break;
     }
+    if (encoded)
+        return encoded;
 
     XDMCPPacket *response;
-    if (authentication_name)
+    if (type == REPLY_WILLING)
     {
         response = xdmcp_packet_alloc (XDMCP_Willing);
         response->Willing.authentication_name = g_strdup (authentication_name);
         response->Willing.hostname = g_strdup (priv->hostname);
-        response->Willing.status = g_strdup (priv->status);
+        response->Willing.status = g_strdup (priv->report_load && priv->load_status ? priv->load_status : priv->status);
+    }
+    else if (type == REPLY_FULL)
+    {
+        response = xdmcp_packet_alloc (XDMCP_Unwilling);
+        response->Unwilling.hostname = g_strdup (priv->hostname);
+        response->Unwilling.status = g_strdup_printf ("Too many sessions, limit is %u", priv->max_sessions);
     }
     else
     {
         response = xdmcp_packet_alloc (XDMCP_Unwilling);
         response->Unwilling.hostname = g_strdup (priv->hostname);
         if (priv->key)
-            response->Unwilling.status = g_strdup_printf ("No matching authentication, server requires %s", get_authentication_name (server));
+            response->Unwilling.status = g_strdup_printf ("No matching authentication, server requires %s", authentication_name);
         else
             response->Unwilling.status = g_strdup ("No matching authentication");
     }
+    encoded = encode_packet (response);
+    xdmcp_packet_free (response);
+    if (!encoded)
+        return NULL;
 
-    send_packet (socket, address, response);
+    if (type == REPLY_WILLING)
+        g_hash_table_insert (priv->willing_cache, g_strdup (authentication_name), encoded);
+    else if (type == REPLY_FULL)
+        priv->full_cache = encoded;
+    else
+        priv->unwilling_cache = encoded;
 
-    xdmcp_packet_free (response);
+    return encoded;
+}
+
+static guint64
+get_available_memory (void)
+{
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents ("/proc/meminfo", &contents, NULL, NULL))
+        return 0;
+
+    const gchar *line = strstr (contents, "MemAvailable:");
+    if (!line)
+        return 0;
+
+    return g_ascii_strtoull (line + strlen ("MemAvailable:"), NULL, 10) * 1024;
+}
+
+/* Called with the lock held */
+static void
+update_load (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!priv->report_load && priv->busy_load <= 0)
+        return;
+
+    /* A query storm only reads the load once a second */
+    gint64 now = g_get_monotonic_time ();
+    if (priv->load_time != 0 && now - priv->load_time < LOAD_SAMPLE_INTERVAL)
+        return;
+    priv->load_time = now;
+
+    double load_average = 0;
+    if (getloadavg (&load_average, 1) < 1)
+        load_average = 0;
+    priv->load_average = load_average;
+    priv->available_memory = get_available_memory ();
+
+    if (!priv->report_load)
+        return;
+
+    g_autofree gchar *status = g_strdup_printf ("%u sessions, load %.2f, %" G_GUINT64_FORMAT " MiB free",
+                                                g_hash_table_size (priv->sessions), priv->load_average, priv->available_memory / (1024 * 1024));
+    if (g_strcmp0 (status, priv->load_status) == 0)
+        return;
+
+    g_free (priv->load_status);
+    priv->load_status = g_steal_pointer (&status);
+    g_hash_table_remove_all (priv->willing_cache);
+}
+
+static void
+delayed_reply_free (DelayedReply *reply)
+{
+    g_object_unref (reply->socket);
+    g_object_unref (reply->address);
+    g_free (reply->address_string);
+    g_bytes_unref (reply->data);
+    g_free (reply->text);
+    g_free (reply);
+}
+
+static gboolean
+delayed_reply_cb (gpointer user_data)
+{
+    DelayedReply *reply = user_data;
+
+    log_debug (LOG_SUBSYSTEM_XDMCP, "Send %s to %s", reply->text, reply->address_string);
+    gsize length;
+    const guint8 *data = g_bytes_get_data (reply->data, &length);
+    send_data (reply->socket, reply->address, data, length);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+send_query_replies (XDMCPReader *reader)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (reader->server);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init (&iter, reader->query_replies);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        const gchar *address_string = key;
+        QueryReply *reply = value;
+
+        /* Take a reference as the cache can be cleared by the main loop once unlocked */
+        g_mutex_lock (&priv->lock);
+        update_load (reader->server);
+        QueryReplyType type = REPLY_UNWILLING;
+        if (reply->willing)
+            type = priv->max_sessions > 0 && g_hash_table_size (priv->sessions) >= priv->max_sessions ? REPLY_FULL : REPLY_WILLING;
+        EncodedPacket *encoded = get_query_reply (reader->server, type);
+        g_autoptr(GBytes) data = encoded ? g_bytes_ref (encoded->data) : NULL;
+        g_autofree gchar *text = encoded ? g_strdup (encoded->text) : NULL;
+        guint delay = type == REPLY_WILLING && priv->busy_load > 0 && priv->load_average >= priv->busy_load ? priv->busy_delay : 0;
+        g_mutex_unlock (&priv->lock);
+        if (!data)
+            continue;
+
+        /* Let less loaded hosts answer a broadcast first */
+        if (delay > 0)
+        {
+            log_debug (LOG_SUBSYSTEM_XDMCP, "Delaying reply to %s by %ums, host is busy", address_string, delay);
+            DelayedReply *delayed = g_malloc0 (sizeof (DelayedReply));
+            delayed->socket = g_object_ref (reply->socket);
+            delayed->address = g_object_ref (reply->address);
+            delayed->address_string = g_strdup (address_string);
+            delayed->data = g_steal_pointer (&data);
+            delayed->text = g_steal_pointer (&text);
+            GSource *source = g_timeout_source_new (delay);
+            g_source_set_callback (source, delayed_reply_cb, delayed, (GDestroyNotify) delayed_reply_free);
+            g_source_attach (source, reader->context);
+            g_source_unref (source);
+            continue;
+        }
+
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Send %s to %s", text, address_string);
+        gsize length;
+        const guint8 *packet_data = g_bytes_get_data (data, &length);
+        send_data (reply->socket, reply->address, packet_data, length);
+    }
+
+    g_hash_table_remove_all (reader->query_replies);
 }
 
 static void
-handle_forward_query (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
+handle_forward_query (XDMCPReader *reader, XDMCPPacket *packet)
 {
-    GSocketFamily family = g_socket_get_family (socket);
+    GSocketFamily family = g_socket_get_family (reader->socket);
     switch (family)
     {
     case G_SOCKET_FAMILY_IPV4:
@@ -303,49 +890,14 @@ handle_forward_query (XDMCPServer *server, GSocket *socket, GSocketAddress *addr
         return;
     }
 
-    guint16 port = 0;
-    for (int i = 0; i < packet->ForwardQuery.client_port.length; i++)
-        port = port << 8 | packet->ForwardQuery.client_port.data[i];
-
-    g_autoptr(GInetAddress) client_inet_address = g_inet_address_new_from_bytes (packet->ForwardQuery.client_address.data, family);
-    g_autoptr(GSocketAddress) client_address = g_inet_socket_address_new (client_inet_address, port);
-
-    handle_query (server, socket, client_address, packet->ForwardQuery.authentication_names);
-}
-
-static guint8
-atox (char c)
-{
-    if (c >= '0' && c <= '9')
-        return c - '0';
-    if (c >= 'a' && c <= 'f')
-        return c - 'a' + 10;
-    if (c >= 'A' && c <= 'F')
-        return c - 'A' + 10;
-    return 0;
-}
-
-static void
-decode_key (const gchar *key, guint8 *data)
-{
-    memset (data, 0, 8);
-    if (strncmp (key, "0x", 2) == 0 || strncmp (key, "0X", 2) == 0)
-    {
-        for (gint i = 0; i < 8; i++)
-        {
-            if (key[i*2] == '\0')
-                break;
-            data[i] |= atox (key[i*2]) << 8;
-            if (key[i*2+1] == '\0')
-                break;
-            data[i] |= atox (key[i*2+1]);
-        }
-    }
-    else
-    {
-        for (gint i = 1; i < 8 && key[i-1]; i++)
-           data[i] = key[i-1];
-    }
+    guint16 port = 0;
+    for (int i = 0; i < packet->ForwardQuery.client_port.length; i++)
+        port = port << 8 | packet->ForwardQuery.client_port.data[i];
+
+    g_autoptr(GInetAddress) client_inet_address = g_inet_address_new_from_bytes (packet->ForwardQuery.client_address.data, family);
+    g_autoptr(GSocketAddress) client_address = g_inet_socket_address_new (client_inet_address, port);
+
+    handle_query (reader, client_address, packet->ForwardQuery.authentication_names);
 }
 
 static GInetAddress *
@@ -368,82 +920,206 @@ connection_to_address (XDMCPConnection *connection)
     }
 }
 
-/* Sort function to order XDMCP addresses by which is best to connect to */
-static gint
-compare_addresses (gconstpointer a, gconstpointer b, gpointer user_data)
+static guint
+count_prefix_length (const guint8 *mask, gsize length)
 {
-    const AddrSortItem *item_a = a;
-    const AddrSortItem *item_b = b;
-    GInetAddress *source_address = user_data;
+    guint prefix_length = 0;
+    for (gsize i = 0; i < length; i++)
+    {
+        for (guint8 bit = 0x80; bit != 0 && (mask[i] & bit); bit >>= 1)
+            prefix_length++;
+        if (mask[i] != 0xFF)
+            break;
+    }
+    return prefix_length;
+}
+
+static void
+load_local_subnets (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
-    /* Prefer non link-local addresses */
-    gboolean is_link_local = g_inet_address_get_is_link_local (item_a->address);
-    if (is_link_local != g_inet_address_get_is_link_local (item_b->address))
-        return is_link_local ? 1 : -1;
+    g_array_set_size (priv->local_subnets, 0);
+    priv->local_subnets_valid = TRUE;
 
-    /* Prefer the source address family */
-    GSocketFamily family_a = g_inet_address_get_family (item_a->address);
-    GSocketFamily family_b = g_inet_address_get_family (item_b->address);
-    if (family_a != family_b)
+    struct ifaddrs *interfaces;
+    if (getifaddrs (&interfaces) < 0)
     {
-        GSocketFamily family = g_inet_address_get_family (source_address);
-        if (family_a == family)
-            return -1;
-        if (family_b == family)
-            return 1;
-        return family_a < family_b ? -1 : 1;
+        g_warning ("Failed to get interface addresses: %s", g_strerror (errno));
+        return;
     }
 
-    /* Check equality */
-    if (g_inet_address_equal (item_a->address, item_b->address))
-        return 0;
+    for (struct ifaddrs *i = interfaces; i; i = i->ifa_next)
+    {
+        if (!i->ifa_addr || !i->ifa_netmask)
+            continue;
+
+        LocalSubnet subnet = { { 0 }, 0, 0 };
+        if (i->ifa_addr->sa_family == AF_INET)
+        {
+            subnet.length = 4;
+            memcpy (subnet.address, &((struct sockaddr_in *) i->ifa_addr)->sin_addr, subnet.length);
+            subnet.prefix_length = count_prefix_length ((const guint8 *) &((struct sockaddr_in *) i->ifa_netmask)->sin_addr, subnet.length);
+        }
+        else if (i->ifa_addr->sa_family == AF_INET6)
+        {
+            subnet.length = 16;
+            memcpy (subnet.address, &((struct sockaddr_in6 *) i->ifa_addr)->sin6_addr, subnet.length);
+            subnet.prefix_length = count_prefix_length ((const guint8 *) &((struct sockaddr_in6 *) i->ifa_netmask)->sin6_addr, subnet.length);
+        }
+        else
+            continue;
 
-    /* Prefer the source address */
-    if (g_inet_address_equal (source_address, item_a->address))
-        return -1;
-    if (g_inet_address_equal (source_address, item_b->address))
-        return 1;
+        g_array_append_val (priv->local_subnets, subnet);
+    }
 
-    /* Addresses are not equal, but preferences are: order is undefined */
-    return 0;
+    freeifaddrs (interfaces);
+    log_debug (LOG_SUBSYSTEM_XDMCP, "Loaded %u local XDMCP subnets", priv->local_subnets->len);
 }
 
-static XDMCPConnection *
-choose_connection (XDMCPPacket *packet, GInetAddress *source_address)
+static gboolean
+netlink_cb (GSocket *socket, GIOCondition condition, XDMCPServer *server)
 {
-    gsize addresses_length = packet->Request.n_connections;
-    if (addresses_length == 0)
-        return NULL;
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
-    AddrSortItem addr;
-    GArray *addresses = g_array_sized_new (FALSE, FALSE, sizeof addr, addresses_length);
-    if (!addresses)
-        return NULL;
+    /* The messages themselves aren't needed, the table is reloaded from scratch on next use */
+    gchar buffer[4096];
+    while (g_socket_receive (socket, buffer, sizeof (buffer), NULL, NULL) > 0);
+    priv->local_subnets_valid = FALSE;
 
-    for (gsize i = 0; i < addresses_length; i++)
+    return G_SOURCE_CONTINUE;
+}
+
+/* Watch for interface addresses changing so the subnet table is only read when it is out of date */
+static void
+watch_local_subnets (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    int fd = socket (AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0)
     {
-        addr.address = connection_to_address (&packet->Request.connections[i]);
-        if (addr.address)
-        {
-            addr.index = i;
-            g_array_append_val (addresses, addr);
-        }
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Failed to open netlink socket, local subnets will be read on every request: %s", g_strerror (errno));
+        return;
+    }
+
+    struct sockaddr_nl address;
+    memset (&address, 0, sizeof (address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind (fd, (struct sockaddr *) &address, sizeof (address)) < 0)
+    {
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Failed to bind netlink socket, local subnets will be read on every request: %s", g_strerror (errno));
+        close (fd);
+        return;
+    }
+
+    priv->netlink_socket = g_socket_new_from_fd (fd, NULL);
+    if (!priv->netlink_socket)
+    {
+        close (fd);
+        return;
+    }
+
+    GSource *source = g_socket_create_source (priv->netlink_socket, G_IO_IN, NULL);
+    g_source_set_callback (source, (GSourceFunc) netlink_cb, server, NULL);
+    priv->netlink_watch = g_source_attach (source, NULL);
+    g_source_unref (source);
+}
+
+static gboolean
+is_on_local_subnet (XDMCPServer *server, const guint8 *address, gsize length)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!priv->local_subnets_valid || !priv->netlink_socket)
+        load_local_subnets (server);
+
+    for (guint i = 0; i < priv->local_subnets->len; i++)
+    {
+        LocalSubnet *subnet = &g_array_index (priv->local_subnets, LocalSubnet, i);
+        if (subnet->length != length)
+            continue;
+
+        guint n_bytes = subnet->prefix_length / 8, n_bits = subnet->prefix_length % 8;
+        if (memcmp (subnet->address, address, n_bytes) != 0)
+            continue;
+        if (n_bits == 0)
+            return TRUE;
+        guint8 mask = 0xFF << (8 - n_bits);
+        if ((subnet->address[n_bytes] & mask) == (address[n_bytes] & mask))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+is_link_local (const guint8 *address, gsize length)
+{
+    if (length == 4)
+        return address[0] == 169 && address[1] == 254;
+    else
+        return address[0] == 0xFE && (address[1] & 0xC0) == 0x80;
+}
+
+/* Score how good an address is to connect back to, higher is better */
+static guint
+rank_connection (XDMCPServer *server, XDMCPConnection *connection, const guint8 *source_address, gsize source_length)
+{
+    gsize length;
+    switch (connection->type)
+    {
+    case XAUTH_FAMILY_INTERNET:
+        length = 4;
+        break;
+    case XAUTH_FAMILY_INTERNET6:
+        length = 16;
+        break;
+    default:
+        return 0;
     }
+    if (connection->address.length != length)
+        return 0;
+
+    const guint8 *address = connection->address.data;
+    guint rank = 1;
+
+    /* Prefer non link-local addresses, then the source address family, then the source address, then ones on our subnets */
+    if (!is_link_local (address, length))
+        rank |= 1 << 4;
+    if (length == source_length)
+    {
+        rank |= 1 << 3;
+        if (memcmp (address, source_address, length) == 0)
+            rank |= 1 << 2;
+    }
+    if (is_on_local_subnet (server, address, length))
+        rank |= 1 << 1;
 
-    /* Sort the addresses according to our preferences */
-    g_array_sort_with_data (addresses, compare_addresses, source_address);
+    return rank;
+}
 
-    /* Use the best address */
-    gssize index = -1;
-    if (addresses->len)
-        index = g_array_index (addresses, AddrSortItem, 0).index;
+static XDMCPConnection *
+choose_connection (XDMCPServer *server, XDMCPPacket *packet, GInetAddress *source_address)
+{
+    const guint8 *source_bytes = g_inet_address_to_bytes (source_address);
+    gsize source_length = g_inet_address_get_native_size (source_address);
 
-    /* Free the local sort array and items */
-    for (gsize i = 0; i < addresses->len; i++)
-        g_object_unref (g_array_index (addresses, AddrSortItem, i).address);
-    g_array_unref (addresses);
+    /* Use the best address, the first offered if several are as good */
+    XDMCPConnection *best = NULL;
+    guint best_rank = 0;
+    for (gsize i = 0; i < packet->Request.n_connections; i++)
+    {
+        guint rank = rank_connection (server, &packet->Request.connections[i], source_bytes, source_length);
+        if (rank > best_rank)
+        {
+            best = &packet->Request.connections[i];
+            best_rank = rank;
+        }
+    }
 
-    return index >= 0 ? &packet->Request.connections[index] : NULL;
+    return best;
 }
 
 static gboolean
@@ -481,21 +1157,18 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
     {
         if (packet->Request.authentication_data.length == 8)
         {
-            guint8 input[8], key[8];
+            guint8 input[8];
 
             memcpy (input, packet->Request.authentication_data.data, packet->Request.authentication_data.length);
 
-            /* Setup key */
-            decode_key (priv->key, key);
-
             /* Decode message from server */
             authentication_name = g_strdup ("XDM-AUTHENTICATION-1");
             authentication_data = g_malloc (sizeof (guint8) * 8);
             authentication_data_length = 8;
 
-            XdmcpUnwrap (input, key, rho.data, authentication_data_length);
+            XdmcpUnwrap (input, priv->key_data, rho.data, authentication_data_length);
             XdmcpIncrementKey (&rho);
-            XdmcpWrap (rho.data, key, authentication_data, authentication_data_length);
+            XdmcpWrap (rho.data, priv->key_data, authentication_data, authentication_data_length);
 
             if (!has_string (packet->Request.authorization_names, "XDM-AUTHORIZATION-1"))
                 decline_status = g_strdup ("No matching authorization, server requires XDM-AUTHORIZATION-1");
@@ -514,7 +1187,7 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
     }
 
     /* Choose an address to connect back on */
-    XDMCPConnection *connection = choose_connection (packet, g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (address)));
+    XDMCPConnection *connection = choose_connection (server, packet, g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (address)));
     if (!connection && !decline_status)
         decline_status = g_strdup ("No valid address found");
 
@@ -542,10 +1215,6 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
     gsize session_authorization_data_length = 0;
     if (priv->key)
     {
-        /* Setup key */
-        guint8 key[8];
-        decode_key (priv->key, key);
-
         /* Generate a private session key */
         // FIXME: Pick a good DES key?
         guint8 session_key[8];
@@ -556,7 +1225,7 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
         /* Encrypt the session key and send it to the server */
         authorization_data = g_malloc (8);
         authorization_data_length = 8;
-        XdmcpWrap (session_key, key, authorization_data, authorization_data_length);
+        XdmcpWrap (session_key, priv->key_data, authorization_data, authorization_data_length);
 
         /* Authorization data is the number received from the client followed by the private session key */
         authorization_name = g_strdup ("XDM-AUTHORIZATION-1");
@@ -619,11 +1288,101 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
     xdmcp_packet_free (response);
 }
 
+static guint
+get_class_priority (XDMCPServer *server, const gchar *display_class)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    guint i = 0;
+    for (; priv->priority_classes && priv->priority_classes[i]; i++)
+        if (g_strcmp0 (priv->priority_classes[i], display_class) == 0)
+            break;
+
+    return i;
+}
+
+static gint
+compare_launch_priority (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const SessionData *data_a = a, *data_b = b;
+    return (gint) data_a->priority - (gint) data_b->priority;
+}
+
+static void
+start_launches (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    while (!g_queue_is_empty (priv->launch_queue) &&
+           (priv->max_launches == 0 || g_hash_table_size (priv->launches) < priv->max_launches))
+    {
+        SessionData *data = g_queue_pop_head (priv->launch_queue);
+
+        g_hash_table_add (priv->launches, g_object_ref (data->session));
+        gboolean result = FALSE;
+        g_signal_emit (server, signals[NEW_SESSION], 0, data->session, &result);
+        if (result)
+        {
+            g_mutex_lock (&priv->lock);
+            data->running = TRUE;
+            g_mutex_unlock (&priv->lock);
+            continue;
+        }
+
+        g_hash_table_remove (priv->launches, data->session);
+
+        XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Failed);
+        response->Failed.session_id = xdmcp_session_get_id (data->session);
+        response->Failed.status = g_strdup_printf ("Failed to connect to display :%d", xdmcp_session_get_display_number (data->session));
+        send_packet (data->manage_socket, data->manage_address, response);
+        xdmcp_packet_free (response);
+
+        remove_session (server, data);
+    }
+}
+
+void
+xdmcp_server_launch_complete (XDMCPServer *server, XDMCPSession *session)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+    g_return_if_fail (session != NULL);
+
+    if (!g_hash_table_remove (priv->launches, session))
+        return;
+
+    start_launches (server);
+}
+
+void
+xdmcp_server_session_ended (XDMCPServer *server, XDMCPSession *session)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+    g_return_if_fail (session != NULL);
+
+    SessionData *data = get_session_data (server, xdmcp_session_get_id (session));
+    if (!data || data->session != session)
+        return;
+
+    /* Forget the session so it no longer counts towards the load and KeepAlive reports it dead */
+    g_queue_remove (priv->launch_queue, data);
+    gboolean was_launching = g_hash_table_remove (priv->launches, session);
+    remove_session (server, data);
+
+    if (was_launching)
+        start_launches (server);
+}
+
 static void
 handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
 {
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
     SessionData *data = get_session_data (server, packet->Manage.session_id);
-    if (!data->session)
+    if (!data)
     {
         XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Refuse);
         response->Refuse.session_id = packet->Manage.session_id;
@@ -633,11 +1392,11 @@ handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XD
     }
 
     /* Ignore duplicate requests */
-    if (data->timeout_source == 0)
+    if (!data->pending_link)
     {
         if (xdmcp_session_get_display_number (data->session) != packet->Manage.display_number ||
             strcmp (xdmcp_session_get_display_class (data->session), packet->Manage.display_class) != 0)
-            g_debug ("Ignoring duplicate Manage with different data");
+            log_debug (LOG_SUBSYSTEM_XDMCP, "Ignoring duplicate Manage with different data");
         return;
     }
 
@@ -646,7 +1405,7 @@ handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XD
     {
         XDMCPPacket *response;
 
-        g_debug ("Received Manage for display number %d, but Request was %d", packet->Manage.display_number, xdmcp_session_get_display_number (data->session));
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Received Manage for display number %d, but Request was %d", packet->Manage.display_number, xdmcp_session_get_display_number (data->session));
         response = xdmcp_packet_alloc (XDMCP_Refuse);
         response->Refuse.session_id = packet->Manage.session_id;
         send_packet (socket, address, response);
@@ -655,34 +1414,30 @@ handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XD
 
     xdmcp_session_set_display_class (data->session, packet->Manage.display_class);
 
-    gboolean result = FALSE;
-    g_signal_emit (server, signals[NEW_SESSION], 0, data->session, &result);
-    if (result)
-    {
-        /* Cancel the inactive timer */
-        if (data->timeout_source != 0)
-            g_source_remove (data->timeout_source);
-        data->timeout_source = 0;
-    }
-    else
-    {
-        XDMCPPacket *response;
+    /* Stop waiting for the session to be managed, repeated Manage packets are now ignored */
+    remove_pending (server, data);
 
-        response = xdmcp_packet_alloc (XDMCP_Failed);
-        response->Failed.session_id = packet->Manage.session_id;
-        response->Failed.status = g_strdup_printf ("Failed to connect to display :%d", packet->Manage.display_number);
-        send_packet (socket, address, response);
-        xdmcp_packet_free (response);
-    }
+    /* Queue the session so a lot of displays managed at once start a few at a time */
+    data->manage_socket = g_object_ref (socket);
+    data->manage_address = g_object_ref (address);
+    data->priority = get_class_priority (server, packet->Manage.display_class);
+    g_queue_insert_sorted (priv->launch_queue, data, compare_launch_priority, NULL);
+    if (priv->max_launches != 0 && g_hash_table_size (priv->launches) >= priv->max_launches)
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Queueing session %d, %u sessions waiting to start", xdmcp_session_get_id (data->session), g_queue_get_length (priv->launch_queue));
+
+    start_launches (server);
 }
 
 static void
 handle_keep_alive (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
 {
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    /* Sessions still waiting for a Manage or to be started aren't running yet */
+    g_mutex_lock (&priv->lock);
     SessionData *data = get_session_data (server, packet->KeepAlive.session_id);
-    gboolean alive = FALSE;
-    if (data)
-        alive = TRUE; // FIXME: xdmcp_session_get_alive (session);
+    gboolean alive = data && data->running && xdmcp_session_get_display_number (data->session) == packet->KeepAlive.display_number;
+    g_mutex_unlock (&priv->lock);
 
     XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Alive);
     response->Alive.session_running = alive;
@@ -691,65 +1446,217 @@ handle_keep_alive (XDMCPServer *server, GSocket *socket, GSocketAddress *address
     xdmcp_packet_free (response);
 }
 
+static void
+queued_packet_free (QueuedPacket *queued)
+{
+    g_object_unref (queued->server);
+    g_object_unref (queued->socket);
+    g_object_unref (queued->address);
+    xdmcp_packet_free (queued->packet);
+    g_free (queued);
+}
+
 static gboolean
-read_cb (GSocket *socket, GIOCondition condition, XDMCPServer *server)
+queued_packet_cb (gpointer user_data)
 {
-    GSocketAddress *address;
-    gchar data[1024];
-    g_autoptr(GError) error = NULL;
-    gssize n_read;
+    QueuedPacket *queued = user_data;
 
-    n_read = g_socket_receive_from (socket, &address, data, 1024, NULL, &error);
-    if (error)
-        g_warning ("Failed to read from XDMCP socket: %s", error->message);
+    if (queued->packet->opcode == XDMCP_Request)
+        handle_request (queued->server, queued->socket, queued->address, queued->packet);
+    else
+        handle_manage (queued->server, queued->socket, queued->address, queued->packet);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+handle_packet (XDMCPReader *reader, GSocketAddress *address, const guint8 *data, gsize length)
+{
+    XDMCPPacket *packet = xdmcp_packet_decode (data, length);
+    if (!packet)
+    {
+        common_metrics_add ("lightdm_xdmcp_packets_total", "direction=\"received\",opcode=\"invalid\"", 1);
+        return;
+    }
+    count_packet ("received", packet->opcode);
 
-    if (n_read > 0)
+    /* Describing every packet is costly, so only do it if it will be logged */
+    if (logger_level_enabled (LOG_SUBSYSTEM_XDMCP, G_LOG_LEVEL_DEBUG))
     {
-        XDMCPPacket *packet;
+        g_autofree gchar *packet_string = xdmcp_packet_tostring (packet);
+        g_autofree gchar *address_string = socket_address_to_string (address);
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Got %s from %s", packet_string, address_string);
+    }
 
-        packet = xdmcp_packet_decode ((guint8 *)data, n_read);
-        if (packet)
+    switch (packet->opcode)
+    {
+    case XDMCP_BroadcastQuery:
+    case XDMCP_Query:
+    case XDMCP_IndirectQuery:
+        handle_query (reader, address, packet->Query.authentication_names);
+        break;
+    case XDMCP_ForwardQuery:
+        handle_forward_query (reader, packet);
+        break;
+    case XDMCP_Request:
+    case XDMCP_Manage:
+        /* Sessions are only created and started in the main loop */
+        if (reader->thread)
         {
-            g_autofree gchar *packet_string = NULL;
-            g_autofree gchar *address_string = NULL;
+            QueuedPacket *queued = g_malloc0 (sizeof (QueuedPacket));
+            queued->server = g_object_ref (reader->server);
+            queued->socket = g_object_ref (reader->socket);
+            queued->address = g_object_ref (address);
+            queued->packet = g_steal_pointer (&packet);
+            g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT, queued_packet_cb, queued, (GDestroyNotify) queued_packet_free);
+        }
+        else if (packet->opcode == XDMCP_Request)
+            handle_request (reader->server, reader->socket, address, packet);
+        else
+            handle_manage (reader->server, reader->socket, address, packet);
+        break;
+    case XDMCP_KeepAlive:
+        handle_keep_alive (reader->server, reader->socket, address, packet);
+        break;
+    default:
+        g_warning ("Got unexpected XDMCP packet %d", packet->opcode);
+        break;
+    }
 
-            packet_string = xdmcp_packet_tostring (packet);
-            address_string = socket_address_to_string (address);
-            g_debug ("Got %s from %s", packet_string, address_string);
+    if (packet)
+        xdmcp_packet_free (packet);
+}
 
-            switch (packet->opcode)
-            {
-            case XDMCP_BroadcastQuery:
-            case XDMCP_Query:
-            case XDMCP_IndirectQuery:
-                handle_query (server, socket, address, packet->Query.authentication_names);
-                break;
-            case XDMCP_ForwardQuery:
-                handle_forward_query (server, socket, address, packet);
-                break;
-            case XDMCP_Request:
-                handle_request (server, socket, address, packet);
-                break;
-            case XDMCP_Manage:
-                handle_manage (server, socket, address, packet);
-                break;
-            case XDMCP_KeepAlive:
-                handle_keep_alive (server, socket, address, packet);
-                break;
-            default:
-                g_warning ("Got unexpected XDMCP packet %d", packet->opcode);
-                break;
-            }
+#ifdef HAVE_RECVMMSG
+static void
+read_packets (XDMCPReader *reader)
+{
+    struct mmsghdr messages[MAX_PACKETS_PER_READ];
+    struct iovec vectors[MAX_PACKETS_PER_READ];
+    struct sockaddr_storage addresses[MAX_PACKETS_PER_READ];
+    memset (messages, 0, sizeof (messages));
+    for (int i = 0; i < MAX_PACKETS_PER_READ; i++)
+    {
+        vectors[i].iov_base = reader->receive_buffer + i * XDM_MAX_MSGLEN;
+        vectors[i].iov_len = XDM_MAX_MSGLEN;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &addresses[i];
+        messages[i].msg_hdr.msg_namelen = sizeof (addresses[i]);
+    }
 
-            xdmcp_packet_free (packet);
-        }
+    int n_messages = recvmmsg (g_socket_get_fd (reader->socket), messages, MAX_PACKETS_PER_READ, MSG_DONTWAIT, NULL);
+    if (n_messages < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            g_warning ("Failed to read from XDMCP socket: %s", g_strerror (errno));
+        return;
+    }
+
+    for (int i = 0; i < n_messages; i++)
+    {
+        if (messages[i].msg_len == 0 || (messages[i].msg_hdr.msg_flags & MSG_TRUNC))
+            continue;
+
+        g_autoptr(GSocketAddress) address = g_socket_address_new_from_native (&addresses[i], messages[i].msg_hdr.msg_namelen);
+        if (address)
+            handle_packet (reader, address, vectors[i].iov_base, messages[i].msg_len);
+    }
+}
+#else
+static void
+read_packets (XDMCPReader *reader)
+{
+    for (int i = 0; i < MAX_PACKETS_PER_READ; i++)
+    {
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autoptr(GError) error = NULL;
+        gssize n_read = g_socket_receive_from (reader->socket, &address, (gchar *) reader->receive_buffer, XDM_MAX_MSGLEN, NULL, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            break;
+        if (error)
+            g_warning ("Failed to read from XDMCP socket: %s", error->message);
+        if (n_read < 0)
+            break;
+
+        if (n_read > 0)
+            handle_packet (reader, address, reader->receive_buffer, n_read);
     }
+}
+#endif
+
+static gboolean
+read_cb (GSocket *socket, GIOCondition condition, XDMCPReader *reader)
+{
+    /* Only allocated once there is something to read, most servers never get a packet */
+    if (!reader->receive_buffer)
+        reader->receive_buffer = g_malloc (MAX_PACKETS_PER_READ * XDM_MAX_MSGLEN);
+
+    read_packets (reader);
+    send_query_replies (reader);
 
     return TRUE;
 }
 
+static gpointer
+reader_thread (gpointer data)
+{
+    XDMCPReader *reader = data;
+
+    g_main_context_push_thread_default (reader->context);
+    g_main_loop_run (reader->loop);
+    g_main_context_pop_thread_default (reader->context);
+
+    return NULL;
+}
+
+static void
+reader_free (XDMCPReader *reader)
+{
+    if (reader->thread)
+    {
+        g_main_loop_quit (reader->loop);
+        g_thread_join (reader->thread);
+    }
+    g_clear_pointer (&reader->loop, g_main_loop_unref);
+    g_clear_pointer (&reader->context, g_main_context_unref);
+    g_clear_object (&reader->socket);
+    g_clear_pointer (&reader->receive_buffer, g_free);
+    g_clear_pointer (&reader->query_replies, g_hash_table_unref);
+    g_free (reader);
+}
+
+/* Start reading from a socket, in a new thread if threaded is TRUE */
+static void
+add_reader (XDMCPServer *server, GSocket *socket, gboolean threaded)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    XDMCPReader *reader = g_malloc0 (sizeof (XDMCPReader));
+    reader->server = server;
+    reader->socket = socket;
+    reader->query_replies = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) query_reply_free);
+    if (threaded)
+    {
+        reader->context = g_main_context_new ();
+        reader->loop = g_main_loop_new (reader->context, FALSE);
+    }
+    g_ptr_array_add (priv->readers, reader);
+
+    GSource *source = g_socket_create_source (socket, G_IO_IN, NULL);
+    g_source_set_callback (source, (GSourceFunc) read_cb, reader, NULL);
+    g_source_attach (source, reader->context);
+    g_source_unref (source);
+
+    if (threaded)
+    {
+        g_autofree gchar *name = g_strdup_printf ("xdmcp-%u", priv->readers->len);
+        reader->thread = g_thread_new (name, reader_thread, reader);
+    }
+}
+
 static GSocket *
-open_udp_socket (GSocketFamily family, guint port, const gchar *listen_address, GError **error)
+open_udp_socket (GSocketFamily family, guint port, const gchar *listen_address, gboolean reuse_port, GError **error)
 {
     g_autoptr(GSocket) socket = NULL;
     g_autoptr(GSocketAddress) address = NULL;
@@ -771,10 +1678,26 @@ open_udp_socket (GSocketFamily family, guint port, const gchar *listen_address,
     }
     else
         address = g_inet_socket_address_new (g_inet_address_new_any (family), port);
+
+    /* Let several sockets share the port, the kernel spreads clients across them */
+    if (reuse_port)
+    {
+        int value = 1;
+        if (setsockopt (g_socket_get_fd (socket), SOL_SOCKET, SO_REUSEPORT, &value, sizeof (value)) < 0)
+        {
+            int errsv = errno;
+            g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv), "Failed to set SO_REUSEPORT: %s", g_strerror (errsv));
+            return NULL;
+        }
+    }
+
     result = g_socket_bind (socket, address, TRUE, error);
     if (!result)
         return NULL;
 
+    /* Read until there are no packets left */
+    g_socket_set_blocking (socket, FALSE);
+
     return g_steal_pointer (&socket);
 }
 
@@ -785,34 +1708,45 @@ xdmcp_server_start (XDMCPServer *server)
 
     g_return_val_if_fail (server != NULL, FALSE);
 
-    g_autoptr(GError) ipv4_error = NULL;
-    priv->socket = open_udp_socket (G_SOCKET_FAMILY_IPV4, priv->port, priv->listen_address, &ipv4_error);
-    if (ipv4_error)
-        g_warning ("Failed to create IPv4 XDMCP socket: %s", ipv4_error->message);
+    watch_local_subnets (server);
 
-    if (priv->socket)
+    /* Use sockets passed by the service manager if we were socket activated */
+    GSocket *socket = socket_activation_take (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, priv->port);
+    GSocket *socket6 = socket_activation_take (G_SOCKET_FAMILY_IPV6, G_SOCKET_TYPE_DATAGRAM, priv->port);
+    if (socket || socket6)
     {
-        GSource *source = g_socket_create_source (priv->socket, G_IO_IN, NULL);
-        g_source_set_callback (source, (GSourceFunc) read_cb, server, NULL);
-        g_source_attach (source, NULL);
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Using XDMCP socket(s) passed by service manager");
+        if (priv->worker_threads > 0)
+            log_debug (LOG_SUBSYSTEM_XDMCP, "Reading passed XDMCP sockets in the main loop, worker threads need their own sockets");
+        if (socket)
+            add_reader (server, socket, FALSE);
+        if (socket6)
+            add_reader (server, socket6, FALSE);
+        return TRUE;
     }
 
-    g_autoptr(GError) ipv6_error = NULL;
-    priv->socket6 = open_udp_socket (G_SOCKET_FAMILY_IPV6, priv->port, priv->listen_address, &ipv6_error);
-    if (ipv6_error)
-        g_warning ("Failed to create IPv6 XDMCP socket: %s", ipv6_error->message);
-
-    if (priv->socket6)
+    /* Each worker thread gets its own socket on the port */
+    gboolean threaded = priv->worker_threads > 0;
+    guint n_sockets = MAX (priv->worker_threads, 1);
+    const GSocketFamily families[] = { G_SOCKET_FAMILY_IPV4, G_SOCKET_FAMILY_IPV6 };
+    for (gsize i = 0; i < G_N_ELEMENTS (families); i++)
     {
-        GSource *source = g_socket_create_source (priv->socket6, G_IO_IN, NULL);
-        g_source_set_callback (source, (GSourceFunc) read_cb, server, NULL);
-        g_source_attach (source, NULL);
+        for (guint j = 0; j < n_sockets; j++)
+        {
+            g_autoptr(GError) error = NULL;
+            GSocket *s = open_udp_socket (families[i], priv->port, priv->listen_address, threaded, &error);
+            if (!s)
+            {
+                g_warning ("Failed to create %s XDMCP socket: %s", families[i] == G_SOCKET_FAMILY_IPV4 ? "IPv4" : "IPv6", error->message);
+                break;
+            }
+            add_reader (server, s, threaded);
+        }
     }
+    if (threaded)
+        log_debug (LOG_SUBSYSTEM_XDMCP, "Reading XDMCP packets in %u worker threads", priv->readers->len);
 
-    if (!priv->socket && !priv->socket6)
-        return FALSE;
-
-    return TRUE;
+    return priv->readers->len > 0;
 }
 
 static void
@@ -824,6 +1758,13 @@ xdmcp_server_init (XDMCPServer *server)
     priv->hostname = g_strdup ("");
     priv->status = g_strdup ("");
     priv->sessions = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) session_data_free);
+    priv->pending_sessions = g_queue_new ();
+    priv->launch_queue = g_queue_new ();
+    priv->launches = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, NULL);
+    priv->readers = g_ptr_array_new_with_free_func ((GDestroyNotify) reader_free);
+    priv->local_subnets = g_array_new (FALSE, FALSE, sizeof (LocalSubnet));
+    g_mutex_init (&priv->lock);
+    priv->willing_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) encoded_packet_free);
 }
 
 static void
@@ -832,13 +1773,29 @@ xdmcp_server_finalize (GObject *object)
     XDMCPServer *self = XDMCP_SERVER (object);
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (self);
 
-    g_clear_object (&priv->socket);
-    g_clear_object (&priv->socket6);
+    /* Stop the worker threads before anything they use is freed */
+    g_clear_pointer (&priv->readers, g_ptr_array_unref);
     g_clear_pointer (&priv->listen_address, g_free);
     g_clear_pointer (&priv->hostname, g_free);
     g_clear_pointer (&priv->status, g_free);
     g_clear_pointer (&priv->key, g_free);
+    memset (priv->key_data, 0, sizeof (priv->key_data));
+    if (priv->pending_timeout != 0)
+        g_source_remove (priv->pending_timeout);
+    g_queue_free (priv->pending_sessions);
+    g_queue_free (priv->launch_queue);
+    g_clear_pointer (&priv->launches, g_hash_table_unref);
+    g_clear_pointer (&priv->priority_classes, g_strfreev);
     g_clear_pointer (&priv->sessions, g_hash_table_unref);
+    g_clear_pointer (&priv->willing_cache, g_hash_table_unref);
+    g_clear_pointer (&priv->unwilling_cache, encoded_packet_free);
+    g_clear_pointer (&priv->full_cache, encoded_packet_free);
+    g_clear_pointer (&priv->load_status, g_free);
+    g_clear_pointer (&priv->local_subnets, g_array_unref);
+    if (priv->netlink_watch)
+        g_source_remove (priv->netlink_watch);
+    g_clear_object (&priv->netlink_socket);
+    g_mutex_clear (&priv->lock);
 
     G_OBJECT_CLASS (xdmcp_server_parent_class)->finalize (object);
 }
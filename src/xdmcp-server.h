@@ -57,6 +57,24 @@ const gchar *xdmcp_server_get_status (XDMCPServer *server);
 
 void xdmcp_server_set_key (XDMCPServer *server, const gchar *key);
 
+void xdmcp_server_set_max_launches (XDMCPServer *server, guint max_launches);
+
+void xdmcp_server_set_priority_classes (XDMCPServer *server, gchar **display_classes);
+
+void xdmcp_server_set_report_load (XDMCPServer *server, gboolean report_load);
+
+void xdmcp_server_set_max_sessions (XDMCPServer *server, guint max_sessions);
+
+void xdmcp_server_set_busy_load (XDMCPServer *server, gdouble busy_load, guint busy_delay);
+
+void xdmcp_server_set_worker_threads (XDMCPServer *server, guint worker_threads);
+
+void xdmcp_server_launch_complete (XDMCPServer *server, XDMCPSession *session);
+
+void xdmcp_server_session_ended (XDMCPServer *server, XDMCPSession *session);
+
+guint xdmcp_server_get_n_sessions (XDMCPServer *server);
+
 gboolean xdmcp_server_start (XDMCPServer *server);
 
 G_END_DECLS
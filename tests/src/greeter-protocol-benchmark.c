@@ -0,0 +1,525 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <lightdm.h>
+
+/*
+ * Measures the greeter protocol as seen by liblightdm-gobject. A thread plays
+ * the daemon on the other end of a pair of socket pairs, answering CONNECT,
+ * AUTHENTICATE and CONTINUE_AUTHENTICATION with CONNECTED, PROMPT_AUTHENTICATION
+ * and END_AUTHENTICATION. The daemon thread only uses stack buffers so the
+ * allocation counts are those of the library. The results are written as a
+ * JSON object to stdout or appended to $BENCHMARK_OUTPUT.
+ */
+
+#define HEADER_SIZE 8
+#define MAX_MESSAGE_LENGTH 1024
+
+/* Values from the library and daemon */
+#define GREETER_MESSAGE_CONNECT 0
+#define GREETER_MESSAGE_AUTHENTICATE 1
+#define GREETER_MESSAGE_CONTINUE_AUTHENTICATION 3
+#define GREETER_MESSAGE_SET_LANGUAGE 6
+#define SERVER_MESSAGE_PROMPT_AUTHENTICATION 1
+#define SERVER_MESSAGE_END_AUTHENTICATION 2
+#define SERVER_MESSAGE_IDLE 5
+#define SERVER_MESSAGE_CONNECTED_V2 7
+#define PAM_PROMPT_ECHO_OFF 1
+
+/* Username that makes the daemon thread answer with a burst of prompts */
+#define FLOOD_USERNAME "flood"
+
+static int n_round_trips = 1000;
+static int n_flood = 10000;
+static int n_encode = 10000;
+
+/* Daemon thread end of the connection to the greeter */
+static int to_greeter_fd = -1;
+
+#ifdef __GLIBC__
+/* Count allocations by wrapping the C library allocator, which GLib uses */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gint n_allocations = 0;
+
+void *
+malloc (size_t size)
+{
+    g_atomic_int_inc (&n_allocations);
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members, size_t size)
+{
+    g_atomic_int_inc (&n_allocations);
+    return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+    g_atomic_int_inc (&n_allocations);
+    return __libc_realloc (ptr, size);
+}
+
+static gint
+get_allocations (void)
+{
+    return g_atomic_int_get (&n_allocations);
+}
+#else
+static gint
+get_allocations (void)
+{
+    return -1;
+}
+#endif
+
+static void
+write_int (guint8 *buffer, gsize *offset, guint32 value)
+{
+    buffer[*offset] = value >> 24;
+    buffer[*offset+1] = (value >> 16) & 0xFF;
+    buffer[*offset+2] = (value >> 8) & 0xFF;
+    buffer[*offset+3] = value & 0xFF;
+    *offset += 4;
+}
+
+static void
+write_string (guint8 *buffer, gsize *offset, const gchar *value)
+{
+    gsize length = strlen (value);
+    write_int (buffer, offset, length);
+    memcpy (buffer + *offset, value, length);
+    *offset += length;
+}
+
+static guint32
+read_int (const guint8 *buffer, gsize length, gsize *offset)
+{
+    if (*offset + 4 > length)
+        return 0;
+    const guint8 *data = buffer + *offset;
+    *offset += 4;
+    return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+/* Copies a string into a fixed buffer, truncating it if necessary */
+static void
+read_string (const guint8 *buffer, gsize length, gsize *offset, gchar *value, gsize value_length)
+{
+    guint32 string_length = read_int (buffer, length, offset);
+    if (*offset + string_length > length)
+        string_length = length - *offset;
+    gsize n = MIN (string_length, value_length - 1);
+    memcpy (value, buffer + *offset, n);
+    value[n] = '\0';
+    *offset += string_length;
+}
+
+static gboolean
+read_all (int fd, guint8 *buffer, gsize length)
+{
+    gsize n_read = 0;
+    while (n_read < length)
+    {
+        ssize_t n = read (fd, buffer + n_read, length - n_read);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        n_read += n;
+    }
+    return TRUE;
+}
+
+static gboolean
+write_all (int fd, const guint8 *buffer, gsize length)
+{
+    gsize n_written = 0;
+    while (n_written < length)
+    {
+        ssize_t n = write (fd, buffer + n_written, length - n_written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        n_written += n;
+    }
+    return TRUE;
+}
+
+/* Fill in the header once the payload is written */
+static gboolean
+send_message (int fd, guint8 *buffer, guint32 id, gsize length)
+{
+    gsize offset = 0;
+    write_int (buffer, &offset, id);
+    write_int (buffer, &offset, length - HEADER_SIZE);
+    return write_all (fd, buffer, length);
+}
+
+static gboolean
+send_prompt (int fd, guint32 sequence_number, const gchar *username)
+{
+    guint8 buffer[MAX_MESSAGE_LENGTH];
+    gsize offset = HEADER_SIZE;
+    write_int (buffer, &offset, sequence_number);
+    write_string (buffer, &offset, username);
+    write_int (buffer, &offset, 1);
+    write_int (buffer, &offset, PAM_PROMPT_ECHO_OFF);
+    write_string (buffer, &offset, "Password:");
+    return send_message (fd, buffer, SERVER_MESSAGE_PROMPT_AUTHENTICATION, offset);
+}
+
+static gpointer
+daemon_thread (gpointer data)
+{
+    int from_greeter = GPOINTER_TO_INT (data);
+    guint32 sequence_number = 0;
+    gchar username[256] = "";
+    int n_languages = 0;
+
+    while (TRUE)
+    {
+        guint8 header[HEADER_SIZE];
+        if (!read_all (from_greeter, header, HEADER_SIZE))
+            break;
+        gsize offset = 0;
+        guint32 id = read_int (header, HEADER_SIZE, &offset);
+        guint32 length = read_int (header, HEADER_SIZE, &offset);
+        guint8 message[MAX_MESSAGE_LENGTH];
+        if (length > MAX_MESSAGE_LENGTH || !read_all (from_greeter, message, length))
+            break;
+
+        guint8 reply[MAX_MESSAGE_LENGTH];
+        gsize reply_length = HEADER_SIZE;
+        offset = 0;
+        gboolean result = TRUE;
+        switch (id)
+        {
+        case GREETER_MESSAGE_CONNECT:
+            write_int (reply, &reply_length, 3);
+            write_string (reply, &reply_length, "benchmark");
+            write_int (reply, &reply_length, 0);
+            result = send_message (to_greeter_fd, reply, SERVER_MESSAGE_CONNECTED_V2, reply_length);
+            break;
+        case GREETER_MESSAGE_AUTHENTICATE:
+            sequence_number = read_int (message, length, &offset);
+            read_string (message, length, &offset, username, sizeof (username));
+            if (strcmp (username, FLOOD_USERNAME) == 0)
+            {
+                for (int i = 0; i < n_flood && result; i++)
+                    result = send_prompt (to_greeter_fd, sequence_number, username);
+            }
+            else
+                result = send_prompt (to_greeter_fd, sequence_number, username);
+            break;
+        case GREETER_MESSAGE_CONTINUE_AUTHENTICATION:
+            write_int (reply, &reply_length, sequence_number);
+            write_string (reply, &reply_length, username);
+            write_int (reply, &reply_length, 0);
+            result = send_message (to_greeter_fd, reply, SERVER_MESSAGE_END_AUTHENTICATION, reply_length);
+            break;
+        case GREETER_MESSAGE_SET_LANGUAGE:
+            /* Tell the greeter when all the messages it encoded have arrived */
+            n_languages++;
+            if (n_languages == n_encode)
+            {
+                n_languages = 0;
+                result = send_message (to_greeter_fd, reply, SERVER_MESSAGE_IDLE, reply_length);
+            }
+            break;
+        }
+        if (!result)
+            break;
+    }
+
+    close (from_greeter);
+    close (to_greeter_fd);
+
+    return NULL;
+}
+
+typedef enum
+{
+    PHASE_ROUND_TRIP,
+    PHASE_FLOOD,
+    PHASE_ENCODE,
+    PHASE_DONE
+} Phase;
+
+static GMainLoop *loop = NULL;
+static LightDMGreeter *greeter = NULL;
+static Phase phase = PHASE_ROUND_TRIP;
+static gint64 start_time = 0;
+static gint start_allocations = 0;
+static int n_done = 0;
+static GArray *round_trip_samples = NULL;
+static GArray *connect_samples = NULL;
+static gdouble round_trip_allocations = 0;
+static gdouble flood_rate = 0, flood_allocations = 0;
+static gdouble encode_rate = 0, encode_allocations = 0;
+
+static gint
+compare_sample (gconstpointer a, gconstpointer b)
+{
+    gdouble sample_a = *((const gdouble *) a), sample_b = *((const gdouble *) b);
+    return sample_a < sample_b ? -1 : sample_a > sample_b ? 1 : 0;
+}
+
+static void
+append_samples (GString *json, const gchar *name, GArray *samples)
+{
+    g_string_append_printf (json, ", \"%s\": {\"count\": %u", name, samples->len);
+    if (samples->len > 0)
+    {
+        g_array_sort (samples, compare_sample);
+
+        gdouble total = 0;
+        for (guint i = 0; i < samples->len; i++)
+            total += g_array_index (samples, gdouble, i);
+
+        g_string_append_printf (json, ", \"min\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"max\": %.3f, \"mean\": %.3f",
+                                g_array_index (samples, gdouble, 0),
+                                g_array_index (samples, gdouble, samples->len / 2),
+                                g_array_index (samples, gdouble, MIN (samples->len - 1, samples->len * 95 / 100)),
+                                g_array_index (samples, gdouble, samples->len - 1),
+                                total / samples->len);
+    }
+    g_string_append (json, "}");
+}
+
+static void
+report (void)
+{
+    g_autoptr(GString) json = g_string_new ("");
+    g_string_append (json, "{\"benchmark\": \"greeter-protocol\"");
+    append_samples (json, "connect-ms", connect_samples);
+    append_samples (json, "round-trip-ms", round_trip_samples);
+    g_string_append_printf (json, ", \"round-trip-allocations\": %.1f", round_trip_allocations);
+    g_string_append_printf (json, ", \"decode-messages-per-second\": %.0f, \"decode-allocations\": %.1f", flood_rate, flood_allocations);
+    g_string_append_printf (json, ", \"encode-messages-per-second\": %.0f, \"encode-allocations\": %.1f", encode_rate, encode_allocations);
+    g_string_append (json, "}\n");
+
+    /* Results are appended so they collect with the other benchmarks */
+    const gchar *output_path = g_getenv ("BENCHMARK_OUTPUT");
+    if (output_path)
+    {
+        FILE *output = fopen (output_path, "a");
+        if (output)
+        {
+            fputs (json->str, output);
+            fclose (output);
+        }
+        else
+            g_printerr ("Failed to write benchmark results to %s: %s\n", output_path, strerror (errno));
+    }
+    else
+        g_print ("%s", json->str);
+}
+
+static void
+start_phase (Phase next_phase)
+{
+    phase = next_phase;
+    n_done = 0;
+    start_time = g_get_monotonic_time ();
+    start_allocations = get_allocations ();
+
+    g_autoptr(GError) error = NULL;
+    gboolean result = TRUE;
+    switch (phase)
+    {
+    case PHASE_ROUND_TRIP:
+        result = lightdm_greeter_authenticate (greeter, "user", &error);
+        break;
+    case PHASE_FLOOD:
+        result = lightdm_greeter_authenticate (greeter, FLOOD_USERNAME, &error);
+        break;
+    case PHASE_ENCODE:
+        for (int i = 0; i < n_encode && result; i++)
+            result = lightdm_greeter_set_language (greeter, "en_US.UTF-8", &error);
+        break;
+    case PHASE_DONE:
+        report ();
+        g_main_loop_quit (loop);
+        break;
+    }
+
+    if (!result)
+    {
+        g_printerr ("Failed to send greeter message: %s\n", error->message);
+        exit (EXIT_FAILURE);
+    }
+}
+
+static gdouble
+get_allocations_per_message (int n_messages)
+{
+    if (start_allocations < 0 || n_messages == 0)
+        return -1;
+    return (gdouble) (get_allocations () - start_allocations) / n_messages;
+}
+
+static gdouble
+get_rate (int n_messages)
+{
+    gdouble seconds = (g_get_monotonic_time () - start_time) / 1000000.0;
+    return seconds > 0 ? n_messages / seconds : 0;
+}
+
+static void
+show_prompt_cb (LightDMGreeter *greeter, const gchar *text, LightDMPromptType type)
+{
+    if (phase == PHASE_ROUND_TRIP)
+    {
+        lightdm_greeter_respond (greeter, "password", NULL);
+        return;
+    }
+
+    if (phase == PHASE_FLOOD)
+    {
+        n_done++;
+        if (n_done == n_flood)
+        {
+            flood_rate = get_rate (n_flood);
+            flood_allocations = get_allocations_per_message (n_flood);
+            lightdm_greeter_cancel_authentication (greeter, NULL);
+            start_phase (PHASE_ENCODE);
+        }
+    }
+}
+
+static void
+authentication_complete_cb (LightDMGreeter *greeter)
+{
+    if (phase != PHASE_ROUND_TRIP)
+        return;
+
+    gdouble ms = (g_get_monotonic_time () - start_time) / 1000.0;
+    g_array_append_val (round_trip_samples, ms);
+    n_done++;
+    if (n_done < n_round_trips)
+    {
+        start_time = g_get_monotonic_time ();
+        g_autoptr(GError) error = NULL;
+        if (!lightdm_greeter_authenticate (greeter, "user", &error))
+        {
+            g_printerr ("Failed to authenticate: %s\n", error->message);
+            exit (EXIT_FAILURE);
+        }
+        return;
+    }
+
+    /* Each round trip is AUTHENTICATE, PROMPT, CONTINUE_AUTHENTICATION and END_AUTHENTICATION */
+    round_trip_allocations = get_allocations_per_message (n_round_trips * 4);
+    start_phase (PHASE_FLOOD);
+}
+
+static void
+idle_cb (LightDMGreeter *greeter)
+{
+    if (phase != PHASE_ENCODE)
+        return;
+
+    encode_rate = get_rate (n_encode);
+    encode_allocations = get_allocations_per_message (n_encode);
+    start_phase (PHASE_DONE);
+}
+
+static void
+usage (void)
+{
+    g_printerr ("Usage: greeter-protocol-benchmark [-round-trips N] [-flood N] [-encode N]\n");
+}
+
+int
+main (int argc, char **argv)
+{
+#if !defined(GLIB_VERSION_2_36)
+    g_type_init ();
+#endif
+
+    for (int i = 1; i < argc; i++)
+    {
+        char *arg = argv[i];
+
+        if (i + 1 >= argc)
+        {
+            usage ();
+            return EXIT_FAILURE;
+        }
+
+        if (strcmp (arg, "-round-trips") == 0)
+            n_round_trips = atoi (argv[++i]);
+        else if (strcmp (arg, "-flood") == 0)
+            n_flood = atoi (argv[++i]);
+        else if (strcmp (arg, "-encode") == 0)
+            n_encode = atoi (argv[++i]);
+        else
+        {
+            usage ();
+            return EXIT_FAILURE;
+        }
+    }
+    if (n_round_trips <= 0 || n_flood <= 0 || n_encode <= 0)
+    {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    /* The library finds the daemon through the same variables the daemon sets for greeters */
+    int to_greeter[2], from_greeter[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, to_greeter) < 0 ||
+        socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, from_greeter) < 0)
+    {
+        g_printerr ("Failed to make socket pairs: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+    to_greeter_fd = to_greeter[0];
+    g_autofree gchar *to_server_fd = g_strdup_printf ("%d", from_greeter[0]);
+    g_autofree gchar *from_server_fd = g_strdup_printf ("%d", to_greeter[1]);
+    g_setenv ("LIGHTDM_TO_SERVER_FD", to_server_fd, TRUE);
+    g_setenv ("LIGHTDM_FROM_SERVER_FD", from_server_fd, TRUE);
+    g_unsetenv ("LIGHTDM_GREETER_PIPE");
+
+    g_autoptr(GThread) thread = g_thread_new ("daemon", daemon_thread, GINT_TO_POINTER (from_greeter[1]));
+
+    loop = g_main_loop_new (NULL, FALSE);
+    round_trip_samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    connect_samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+    greeter = lightdm_greeter_new ();
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_SHOW_PROMPT, G_CALLBACK (show_prompt_cb), NULL);
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), NULL);
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_IDLE, G_CALLBACK (idle_cb), NULL);
+
+    gint64 connect_start = g_get_monotonic_time ();
+    g_autoptr(GError) error = NULL;
+    if (!lightdm_greeter_connect_to_daemon_sync (greeter, &error))
+    {
+        g_printerr ("Failed to connect to daemon thread: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    gdouble connect_ms = (g_get_monotonic_time () - connect_start) / 1000.0;
+    g_array_append_val (connect_samples, connect_ms);
+
+    start_phase (PHASE_ROUND_TRIP);
+    g_main_loop_run (loop);
+
+    /* Closing our end stops the daemon thread */
+    g_clear_object (&greeter);
+    close (from_greeter[0]);
+    close (to_greeter[1]);
+    g_thread_join (g_steal_pointer (&thread));
+
+    return EXIT_SUCCESS;
+}
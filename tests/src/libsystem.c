@@ -3,6 +3,7 @@
 
 #include <config.h>
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -16,6 +17,7 @@
 #include <pwd.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/inotify.h>
 #include <grp.h>
 #include <security/pam_appl.h>
 #include <fcntl.h>
@@ -37,6 +39,9 @@
 
 #define LOGIN_PROMPT "login:"
 
+/* Abstract socket the daemon connects to Plymouth on */
+#define PLYMOUTH_SOCKET_PATH "/org/freedesktop/plymouthd"
+
 static int tty_fd = -1;
 
 static GList *user_entries = NULL;
@@ -86,11 +91,25 @@ getuid (void)
     return 0;
 }
 
-/*uid_t
+/* Effective user ID when pretending to run as root, changed by the set*uid calls */
+static uid_t fake_euid = 0;
+
+static gboolean
+fake_root (void)
+{
+    return g_getenv ("LIGHTDM_TEST_ROOT_SQUASH") != NULL;
+}
+
+uid_t
 geteuid (void)
 {
-    return 0;
-}*/
+    uid_t (*_geteuid) (void) = dlsym (RTLD_NEXT, "geteuid");
+
+    if (fake_root ())
+        return fake_euid;
+
+    return _geteuid ();
+}
 
 int
 initgroups (const char *user, gid_t group)
@@ -163,21 +182,63 @@ setresgid (gid_t rgid, gid_t ugid, gid_t sgid)
 int
 setuid (uid_t uid)
 {
+    fake_euid = uid;
     return 0;
 }
 
 int
 seteuid (uid_t uid)
 {
+    if (uid != (uid_t) -1)
+        fake_euid = uid;
     return 0;
 }
 
 int
-setresuid (uid_t ruid, uid_t uuid, uid_t suid)
+setresuid (uid_t ruid, uid_t euid, uid_t suid)
 {
+    if (euid != (uid_t) -1)
+        fake_euid = euid;
     return 0;
 }
 
+/* Sleep for the number of ms in an environment variable set by the test runner */
+static void
+inject_latency (const gchar *variable)
+{
+    const gchar *value = g_getenv (variable);
+    if (!value)
+        return;
+    gint ms = atoi (value);
+    if (ms > 0)
+        g_usleep (ms * 1000);
+}
+
+/* Simulate home directories on a slow network filesystem */
+static void
+delay_home_access (const gchar *path)
+{
+    const gchar *root = g_getenv ("LIGHTDM_TEST_ROOT");
+    if (!root || !g_getenv ("LIGHTDM_TEST_HOME_DIR_LATENCY"))
+        return;
+
+    g_autofree gchar *home_dir = g_build_filename (root, "home", NULL);
+    if (g_str_has_prefix (path, home_dir) && (path[strlen (home_dir)] == '/' || path[strlen (home_dir)] == '\0'))
+        inject_latency ("LIGHTDM_TEST_HOME_DIR_LATENCY");
+}
+
+/* Simulate home directories on a network filesystem that maps root to nobody */
+static gboolean
+deny_home_access (const gchar *path)
+{
+    const gchar *root = g_getenv ("LIGHTDM_TEST_ROOT");
+    if (!root || !fake_root () || fake_euid != 0)
+        return FALSE;
+
+    g_autofree gchar *home_dir = g_build_filename (root, "home", NULL);
+    return g_str_has_prefix (path, home_dir) && path[strlen (home_dir)] == '/';
+}
+
 static gchar *
 redirect_path (const gchar *path)
 {
@@ -230,6 +291,12 @@ open_wrapper (const char *func, const char *pathname, int flags, mode_t mode)
     }
 
     g_autofree gchar *new_path = redirect_path (pathname);
+    delay_home_access (new_path);
+    if (deny_home_access (new_path))
+    {
+        errno = EACCES;
+        return -1;
+    }
     return _open (new_path, flags, mode);
 }
 
@@ -267,6 +334,7 @@ fopen (const char *path, const char *mode)
     FILE *(*_fopen) (const char *pathname, const char *mode) = dlsym (RTLD_NEXT, "fopen");
 
     g_autofree gchar *new_path = redirect_path (path);
+    delay_home_access (new_path);
     return _fopen (new_path, mode);
 }
 
@@ -308,6 +376,7 @@ access (const char *pathname, int mode)
         return F_OK;
 
     g_autofree gchar *new_path = redirect_path (pathname);
+    delay_home_access (new_path);
     return _access (new_path, mode);
 }
 
@@ -317,6 +386,7 @@ stat (const char *path, struct stat *buf)
     int (*_stat) (const char *path, struct stat *buf) = dlsym (RTLD_NEXT, "stat");
 
     g_autofree gchar *new_path = redirect_path (path);
+    delay_home_access (new_path);
     return _stat (new_path, buf);
 }
 
@@ -326,6 +396,7 @@ stat64 (const char *path, struct stat64 *buf)
     int (*_stat64) (const char *path, struct stat64 *buf) = dlsym (RTLD_NEXT, "stat64");
 
     g_autofree gchar *new_path = redirect_path (path);
+    delay_home_access (new_path);
     return _stat64 (new_path, buf);
 }
 
@@ -335,6 +406,7 @@ __xstat (int version, const char *path, struct stat *buf)
     int (*___xstat) (int version, const char *path, struct stat *buf) = dlsym (RTLD_NEXT, "__xstat");
 
     g_autofree gchar *new_path = redirect_path (path);
+    delay_home_access (new_path);
     return ___xstat (version, new_path, buf);
 }
 
@@ -344,6 +416,7 @@ __xstat64 (int version, const char *path, struct stat64 *buf)
     int (*___xstat64) (int version, const char *path, struct stat64 *buf) = dlsym (RTLD_NEXT, "__xstat64");
 
     g_autofree gchar *new_path = redirect_path (path);
+    delay_home_access (new_path);
     return ___xstat64 (version, new_path, buf);
 }
 
@@ -371,9 +444,19 @@ opendir (const char *name)
     DIR *(*_opendir) (const char *name) = dlsym (RTLD_NEXT, "opendir");
 
     g_autofree gchar *new_path = redirect_path (name);
+    delay_home_access (new_path);
     return _opendir (new_path);
 }
 
+int
+inotify_add_watch (int fd, const char *pathname, uint32_t mask)
+{
+    int (*_inotify_add_watch) (int fd, const char *pathname, uint32_t mask) = dlsym (RTLD_NEXT, "inotify_add_watch");
+
+    g_autofree gchar *new_path = redirect_path (pathname);
+    return _inotify_add_watch (fd, new_path, mask);
+}
+
 int
 mkdir (const char *pathname, mode_t mode)
 {
@@ -564,6 +647,17 @@ connect (int sockfd, const struct sockaddr *addr, socklen_t addrlen)
             strncpy (temp_addr_un.sun_path, new_path, sizeof (temp_addr_un.sun_path) - 1);
             modified_addr = (struct sockaddr *) &temp_addr_un;
         }
+        else if (addrlen == offsetof (struct sockaddr_un, sun_path) + 1 + strlen (PLYMOUTH_SOCKET_PATH) &&
+                 memcmp (path + 1, PLYMOUTH_SOCKET_PATH, strlen (PLYMOUTH_SOCKET_PATH)) == 0)
+        {
+            /* Plymouth is provided by the test runner */
+            g_autofree gchar *new_path = g_build_filename (g_getenv ("LIGHTDM_TEST_ROOT"), ".p", NULL);
+            memset (&temp_addr_un, 0, sizeof (temp_addr_un));
+            temp_addr_un.sun_family = AF_UNIX;
+            strncpy (temp_addr_un.sun_path, new_path, sizeof (temp_addr_un.sun_path) - 1);
+            modified_addr = (struct sockaddr *) &temp_addr_un;
+            addrlen = sizeof (temp_addr_un);
+        }
         break;
     case AF_INET:
         port = ntohs (((const struct sockaddr_in *) addr)->sin_port);
@@ -705,6 +799,7 @@ getpwent (void)
 {
     if (getpwent_link == NULL)
     {
+        inject_latency ("LIGHTDM_TEST_NSS_LATENCY");
         load_passwd_file ();
         if (user_entries == NULL)
             return NULL;
@@ -720,9 +815,17 @@ getpwent (void)
     return getpwent_link->data;
 }
 
+/* The daemon reads the password database from a worker thread as well as the main thread.
+ * An enumeration holds the lock from setpwent () to endpwent () so the entries aren't reloaded under it */
+static GRecMutex passwd_lock;
+static __thread gboolean enumerating_passwd = FALSE;
+
 void
 setpwent (void)
 {
+    if (!enumerating_passwd)
+        g_rec_mutex_lock (&passwd_lock);
+    enumerating_passwd = TRUE;
     getpwent_link = NULL;
 }
 
@@ -730,11 +833,38 @@ void
 endpwent (void)
 {
     getpwent_link = NULL;
+    if (enumerating_passwd)
+        g_rec_mutex_unlock (&passwd_lock);
+    enumerating_passwd = FALSE;
+}
+
+/* Copy the strings of an entry into a buffer supplied by the caller */
+static int
+copy_passwd_entry (struct passwd *entry, struct passwd *pwd, char *buf, size_t buflen, struct passwd **result)
+{
+    const gchar *fields[] = { entry->pw_name, entry->pw_passwd, entry->pw_gecos, entry->pw_dir, entry->pw_shell };
+    gchar **values[] = { &pwd->pw_name, &pwd->pw_passwd, &pwd->pw_gecos, &pwd->pw_dir, &pwd->pw_shell };
+    size_t offset = 0;
+    for (gsize i = 0; i < G_N_ELEMENTS (fields); i++)
+    {
+        size_t length = strlen (fields[i]) + 1;
+        if (offset + length > buflen)
+            return ERANGE;
+        memcpy (buf + offset, fields[i], length);
+        *values[i] = buf + offset;
+        offset += length;
+    }
+    pwd->pw_uid = entry->pw_uid;
+    pwd->pw_gid = entry->pw_gid;
+    *result = pwd;
+
+    return 0;
 }
 
 struct passwd *
 getpwnam (const char *name)
 {
+    inject_latency ("LIGHTDM_TEST_NSS_LATENCY");
     load_passwd_file ();
 
     for (GList *link = user_entries; link; link = link->next)
@@ -747,9 +877,23 @@ getpwnam (const char *name)
     return NULL;
 }
 
+int
+getpwnam_r (const char *name, struct passwd *pwd, char *buf, size_t buflen, struct passwd **result)
+{
+    *result = NULL;
+
+    g_rec_mutex_lock (&passwd_lock);
+    struct passwd *entry = getpwnam (name);
+    int e = entry ? copy_passwd_entry (entry, pwd, buf, buflen, result) : 0;
+    g_rec_mutex_unlock (&passwd_lock);
+
+    return e;
+}
+
 struct passwd *
 getpwuid (uid_t uid)
 {
+    inject_latency ("LIGHTDM_TEST_NSS_LATENCY");
     load_passwd_file ();
 
     for (GList *link = user_entries; link; link = link->next)
@@ -762,6 +906,19 @@ getpwuid (uid_t uid)
     return NULL;
 }
 
+int
+getpwuid_r (uid_t uid, struct passwd *pwd, char *buf, size_t buflen, struct passwd **result)
+{
+    *result = NULL;
+
+    g_rec_mutex_lock (&passwd_lock);
+    struct passwd *entry = getpwuid (uid);
+    int e = entry ? copy_passwd_entry (entry, pwd, buf, buflen, result) : 0;
+    g_rec_mutex_unlock (&passwd_lock);
+
+    return e;
+}
+
 static void
 free_group (gpointer data)
 {
@@ -810,6 +967,7 @@ load_group_file (void)
 struct group *
 getgrnam (const char *name)
 {
+    inject_latency ("LIGHTDM_TEST_NSS_LATENCY");
     load_group_file ();
 
     for (GList *link = group_entries; link; link = link->next)
@@ -825,6 +983,7 @@ getgrnam (const char *name)
 struct group *
 getgrgid (gid_t gid)
 {
+    inject_latency ("LIGHTDM_TEST_NSS_LATENCY");
     load_group_file ();
 
     for (GList *link = group_entries; link; link = link->next)
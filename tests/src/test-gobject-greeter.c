@@ -64,6 +64,30 @@ sigterm_cb (gpointer user_data)
     return TRUE;
 }
 
+static gboolean
+hang_sigterm_cb (gpointer user_data)
+{
+    gboolean *terminated = user_data;
+    *terminated = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+/* Stop running the main loop, so nothing from the daemon is answered, until terminated */
+static void
+hang (void)
+{
+    g_autoptr(GMainContext) context = g_main_context_new ();
+    g_autoptr(GSource) source = g_unix_signal_source_new (SIGTERM);
+    gboolean terminated = FALSE;
+    g_source_set_callback (source, hang_sigterm_cb, &terminated, NULL);
+    g_source_attach (source, context);
+    while (!terminated)
+        g_main_context_iteration (context, TRUE);
+
+    status_notify ("%s TERMINATE SIGNAL=%d", greeter_id, SIGTERM);
+    exit (EXIT_SUCCESS);
+}
+
 static void
 notify_hints (LightDMGreeter *greeter)
 {
@@ -184,6 +208,9 @@ request_cb (const gchar *name, GHashTable *params)
     if (strcmp (name, "CRASH") == 0)
         kill (getpid (), SIGSEGV);
 
+    else if (strcmp (name, "HANG") == 0)
+        hang ();
+
     else if (strcmp (name, "AUTHENTICATE") == 0)
     {
         g_autoptr(GError) error = NULL;
@@ -410,6 +437,62 @@ connect_finished (GObject *object, GAsyncResult *result, gpointer data)
     notify_hints (greeter);
 }
 
+static void
+shared_connect_finished (GObject *object, GAsyncResult *result, gpointer data)
+{
+    LightDMGreeter *greeter = LIGHTDM_GREETER (object);
+    g_autofree gchar *seat_name = data;
+    g_autoptr(GError) error = NULL;
+
+    if (!lightdm_greeter_connect_to_daemon_finish (greeter, result, &error))
+    {
+        status_notify ("%s FAIL-CONNECT-DAEMON SEAT=%s ERROR=%s", greeter_id, seat_name, error->message);
+        return;
+    }
+
+    status_notify ("%s CONNECTED-TO-DAEMON SEAT=%s", greeter_id, seat_name);
+}
+
+static void
+display_added_cb (LightDMGreeter *greeter, const gchar *seat_name, const gchar *display, const gchar *x_authority, gpointer user_data)
+{
+    status_notify ("%s ADD-DISPLAY SEAT=%s DISPLAY=%s", greeter_id, seat_name, display);
+    lightdm_greeter_connect_to_daemon (greeter, NULL, shared_connect_finished, g_strdup (seat_name));
+}
+
+static void
+display_removed_cb (LightDMGreeter *greeter, const gchar *seat_name, const gchar *display, const gchar *x_authority, gpointer user_data)
+{
+    status_notify ("%s REMOVE-DISPLAY SEAT=%s", greeter_id, seat_name);
+}
+
+/* Serve the greeters for several seats over the daemon's shared greeter socket */
+static int
+serve_displays (const gchar *path)
+{
+    greeter_id = g_strdup ("GREETER-SHARED");
+
+    loop = g_main_loop_new (NULL, FALSE);
+
+    g_unix_signal_add (SIGINT, sigint_cb, NULL);
+    g_unix_signal_add (SIGTERM, sigterm_cb, NULL);
+
+    status_connect (request_cb, greeter_id);
+    status_notify ("%s START", greeter_id);
+
+    g_autoptr(GError) error = NULL;
+    if (!lightdm_greeter_serve_displays (path, display_added_cb, display_removed_cb, NULL, &error))
+    {
+        status_notify ("%s FAIL-CONNECT-HOST ERROR=%s", greeter_id, error->message);
+        return EXIT_FAILURE;
+    }
+    status_notify ("%s CONNECTED-TO-HOST", greeter_id);
+
+    g_main_loop_run (loop);
+
+    return exit_code;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -417,6 +500,9 @@ main (int argc, char **argv)
     g_type_init ();
 #endif
 
+    if (argc == 3 && strcmp (argv[1], "--serve-displays") == 0)
+        return serve_displays (argv[2]);
+
     const gchar *display = getenv ("DISPLAY");
     const gchar *xdg_seat = getenv ("XDG_SEAT");
     const gchar *xdg_vtnr = getenv ("XDG_VTNR");
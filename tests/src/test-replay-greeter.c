@@ -0,0 +1,391 @@
+/*
+ * Greeter that sends the daemon the messages from a recorded greeter trace
+ * (greeter-trace-directory) in place of a real greeter.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib-unix.h>
+
+#include "status.h"
+#include "greeter-trace.h"
+
+#define HEADER_SIZE 8
+
+/* Message IDs that need special handling, from src/greeter.c */
+#define GREETER_MESSAGE_CONTINUE_AUTHENTICATION 3
+#define GREETER_MESSAGE_PONG 9
+#define SERVER_MESSAGE_PING 11
+
+/* Seconds to wait for a reply the daemon sent in the trace before carrying on without it */
+#define STALL_TIMEOUT 5
+
+static gchar *greeter_id;
+static GMainLoop *loop;
+
+static int to_server_fd = -1;
+static int from_server_fd = -1;
+
+static GPtrArray *records = NULL;
+static guint next_record = 0;
+static gdouble speed = 1.0;
+static gchar *secret = NULL;
+static gboolean replaying = FALSE;
+
+/* Time in the trace of the last record handled, and when it was handled in this run */
+static gint64 last_record_time = 0;
+static gint64 last_event_time = 0;
+
+/* Messages from the daemon, not counting pings */
+static GByteArray *read_buffer = NULL;
+static guint n_expected = 0;
+static guint n_received = 0;
+static guint n_sent = 0;
+static guint n_stalls = 0;
+
+static guint step_timeout = 0;
+static gint64 start_time = 0;
+
+static void step (void);
+
+static guint32
+peek_int (const guint8 *buffer)
+{
+    return buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+}
+
+static void
+append_int (GByteArray *message, guint32 value)
+{
+    guint8 buffer[4] = { value >> 24, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF };
+    g_byte_array_append (message, buffer, 4);
+}
+
+static void
+fail (const gchar *message)
+{
+    status_notify ("%s FAIL-REPLAY ERROR=%s", greeter_id, message);
+    replaying = FALSE;
+}
+
+static gboolean
+send_data (const guint8 *data, gsize length)
+{
+    gsize offset = 0;
+    while (offset < length)
+    {
+        ssize_t n_written = write (to_server_fd, data + offset, length - offset);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return FALSE;
+        offset += n_written;
+    }
+    return TRUE;
+}
+
+/* Put a response back into each prompt the trace left empty */
+static GByteArray *
+unredact (const guint8 *data, gsize length)
+{
+    GByteArray *message = g_byte_array_new ();
+    append_int (message, GREETER_MESSAGE_CONTINUE_AUTHENTICATION);
+    append_int (message, 0);
+
+    guint32 n_secrets = length >= HEADER_SIZE + 4 ? peek_int (data + HEADER_SIZE) : 0;
+    append_int (message, n_secrets);
+    gsize offset = HEADER_SIZE + 4;
+    for (guint32 i = 0; i < n_secrets && offset + 4 <= length; i++)
+    {
+        guint32 secret_length = peek_int (data + offset);
+        offset += 4;
+        if (secret_length == 0)
+        {
+            append_int (message, strlen (secret));
+            g_byte_array_append (message, (const guint8 *) secret, strlen (secret));
+        }
+        else if (offset + secret_length <= length)
+        {
+            append_int (message, secret_length);
+            g_byte_array_append (message, data + offset, secret_length);
+            offset += secret_length;
+        }
+    }
+
+    guint32 payload_length = message->len - HEADER_SIZE;
+    message->data[4] = payload_length >> 24;
+    message->data[5] = (payload_length >> 16) & 0xFF;
+    message->data[6] = (payload_length >> 8) & 0xFF;
+    message->data[7] = payload_length & 0xFF;
+
+    return message;
+}
+
+static gboolean
+send_record (GreeterTraceRecord *record)
+{
+    gsize length;
+    const guint8 *data = g_bytes_get_data (record->data, &length);
+    if (length >= HEADER_SIZE && peek_int (data) == GREETER_MESSAGE_CONTINUE_AUTHENTICATION)
+    {
+        g_autoptr(GByteArray) message = unredact (data, length);
+        return send_data (message->data, message->len);
+    }
+
+    return send_data (data, length);
+}
+
+static gboolean
+stall_cb (gpointer data)
+{
+    /* Carry on as if the daemon had replied, the count shows where it got stuck */
+    step_timeout = 0;
+    n_stalls++;
+    n_received = n_expected + 1;
+    g_printerr ("Daemon didn't send message %u in time, continuing\n", n_expected + 1);
+    step ();
+    return FALSE;
+}
+
+static gboolean
+delay_cb (gpointer data)
+{
+    step_timeout = 0;
+    step ();
+    return FALSE;
+}
+
+/* Handle records in order until the daemon needs to reply or it's time to send the next one */
+static void
+step (void)
+{
+    if (!replaying || step_timeout)
+        return;
+
+    while (next_record < records->len)
+    {
+        GreeterTraceRecord *record = g_ptr_array_index (records, next_record);
+        gsize length;
+        const guint8 *data = g_bytes_get_data (record->data, &length);
+        guint32 id = length >= HEADER_SIZE ? peek_int (data) : 0;
+
+        /* Pings are answered as they arrive, not replayed */
+        if ((record->direction == GREETER_TRACE_TO_GREETER && id == SERVER_MESSAGE_PING) ||
+            (record->direction == GREETER_TRACE_FROM_GREETER && id == GREETER_MESSAGE_PONG))
+        {
+            next_record++;
+            continue;
+        }
+
+        if (record->direction == GREETER_TRACE_TO_GREETER)
+        {
+            if (n_received <= n_expected)
+            {
+                step_timeout = g_timeout_add_seconds (STALL_TIMEOUT, stall_cb, NULL);
+                return;
+            }
+            n_expected++;
+        }
+        else
+        {
+            if (speed > 0)
+            {
+                gint64 due = last_event_time + (record->time - last_record_time) / speed;
+                gint64 now = g_get_monotonic_time ();
+                if (now < due)
+                {
+                    step_timeout = g_timeout_add (MAX ((due - now) / 1000, 1), delay_cb, NULL);
+                    return;
+                }
+            }
+
+            if (!send_record (record))
+            {
+                fail ("Failed to write to daemon");
+                return;
+            }
+            n_sent++;
+        }
+
+        last_record_time = record->time;
+        last_event_time = g_get_monotonic_time ();
+        next_record++;
+    }
+
+    replaying = FALSE;
+    status_notify ("%s REPLAY-DONE SENT=%u RECEIVED=%u STALLS=%u TIME=%" G_GINT64_FORMAT,
+                   greeter_id, n_sent, n_received, n_stalls, (g_get_monotonic_time () - start_time) / 1000);
+}
+
+static void
+process_messages (void)
+{
+    while (read_buffer->len >= HEADER_SIZE)
+    {
+        guint32 id = peek_int (read_buffer->data);
+        gsize length = HEADER_SIZE + peek_int (read_buffer->data + 4);
+        if (read_buffer->len < length)
+            return;
+
+        if (id == SERVER_MESSAGE_PING && length >= HEADER_SIZE + 4)
+        {
+            g_autoptr(GByteArray) pong = g_byte_array_new ();
+            append_int (pong, GREETER_MESSAGE_PONG);
+            append_int (pong, 4);
+            append_int (pong, peek_int (read_buffer->data + HEADER_SIZE));
+            send_data (pong->data, pong->len);
+        }
+        else
+            n_received++;
+        g_byte_array_remove_range (read_buffer, 0, length);
+    }
+}
+
+static gboolean
+read_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+    guint8 buffer[4096];
+    ssize_t n_read = read (fd, buffer, sizeof (buffer));
+    if (n_read < 0 && errno == EINTR)
+        return G_SOURCE_CONTINUE;
+    if (n_read <= 0)
+    {
+        if (replaying)
+            fail ("Daemon closed connection");
+        return G_SOURCE_REMOVE;
+    }
+
+    g_byte_array_append (read_buffer, buffer, n_read);
+    process_messages ();
+
+    /* A reply we were waiting for */
+    if (replaying && step_timeout && n_received > n_expected)
+    {
+        g_source_remove (step_timeout);
+        step_timeout = 0;
+        step ();
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+connect_to_daemon (void)
+{
+    const gchar *to_fd = g_getenv ("LIGHTDM_TO_SERVER_FD");
+    const gchar *from_fd = g_getenv ("LIGHTDM_FROM_SERVER_FD");
+    const gchar *pipe_path = g_getenv ("LIGHTDM_GREETER_PIPE");
+    if (to_fd && from_fd)
+    {
+        to_server_fd = atoi (to_fd);
+        from_server_fd = atoi (from_fd);
+    }
+    else if (pipe_path)
+    {
+        struct sockaddr_un address;
+        memset (&address, 0, sizeof (address));
+        address.sun_family = AF_UNIX;
+        if (strlen (pipe_path) >= sizeof (address.sun_path))
+            return FALSE;
+        strcpy (address.sun_path, pipe_path);
+
+        to_server_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (to_server_fd < 0 || connect (to_server_fd, (struct sockaddr *) &address, sizeof (address)) < 0)
+            return FALSE;
+        from_server_fd = to_server_fd;
+    }
+    else
+        return FALSE;
+
+    read_buffer = g_byte_array_new ();
+    g_unix_fd_add (from_server_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, read_cb, NULL);
+
+    return TRUE;
+}
+
+static void
+start_replay (GHashTable *params)
+{
+    const gchar *path = g_hash_table_lookup (params, "FILE");
+    if (!path)
+    {
+        fail ("No trace file");
+        return;
+    }
+
+    g_autoptr(GError) error = NULL;
+    records = greeter_trace_load (path, &error);
+    if (!records)
+    {
+        fail (error->message);
+        return;
+    }
+
+    const gchar *value = g_hash_table_lookup (params, "SPEED");
+    if (value)
+        speed = g_ascii_strtod (value, NULL);
+    g_free (secret);
+    secret = g_strdup (g_hash_table_lookup (params, "SECRET") ? g_hash_table_lookup (params, "SECRET") : "password");
+
+    if (!connect_to_daemon ())
+    {
+        fail ("Unable to connect to daemon");
+        return;
+    }
+
+    replaying = TRUE;
+    start_time = last_event_time = g_get_monotonic_time ();
+    step ();
+}
+
+static void
+request_cb (const gchar *name, GHashTable *params)
+{
+    if (!name)
+    {
+        g_main_loop_quit (loop);
+        return;
+    }
+
+    if (strcmp (name, "REPLAY") == 0 && !replaying && !records)
+        start_replay (params);
+}
+
+static gboolean
+sigterm_cb (gpointer user_data)
+{
+    status_notify ("%s TERMINATE SIGNAL=%d", greeter_id, GPOINTER_TO_INT (user_data));
+    g_main_loop_quit (loop);
+    return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+    const gchar *display = g_getenv ("DISPLAY");
+    if (display)
+        greeter_id = g_strdup_printf ("GREETER-X-%s", display[0] == ':' ? display + 1 : display);
+    else if (g_strcmp0 (g_getenv ("XDG_SESSION_TYPE"), "wayland") == 0)
+        greeter_id = g_strdup ("GREETER-WAYLAND");
+    else
+        greeter_id = g_strdup ("GREETER-?");
+
+    loop = g_main_loop_new (NULL, FALSE);
+
+    g_unix_signal_add (SIGINT, sigterm_cb, GINT_TO_POINTER (SIGINT));
+    g_unix_signal_add (SIGTERM, sigterm_cb, GINT_TO_POINTER (SIGTERM));
+
+    status_connect (request_cb, greeter_id);
+
+    status_notify ("%s START", greeter_id);
+    status_notify ("%s REPLAY-READY", greeter_id);
+
+    g_main_loop_run (loop);
+
+    return EXIT_SUCCESS;
+}
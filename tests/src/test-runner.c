@@ -3,6 +3,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glib-unix.h>
@@ -31,7 +32,13 @@ typedef struct
 static GList *script = NULL;
 static guint status_timeout = 0;
 static gchar *temp_dir = NULL;
+static const gchar *script_name = NULL;
+static gint64 script_start_time = 0;
 static int service_count;
+
+/* Time in ms the mock services take to answer method calls */
+static gint login1_latency = 0;
+static gint accounts_latency = 0;
 typedef struct
 {
     pid_t pid;
@@ -103,6 +110,41 @@ typedef struct
 } StatusClient;
 static GList *status_clients = NULL;
 
+/* Benchmark mode, where the runner generates load instead of following a script */
+static gboolean benchmark = FALSE;
+static gchar *benchmark_name = NULL;
+static gint benchmark_users = 0;
+static gint benchmark_seats = 1;
+static gint benchmark_xdmcp_clients = 0;
+static gint benchmark_vnc_clients = 0;
+static gint benchmark_xdmcp_terminals = 0;
+static gint benchmark_groups = 0;
+static gboolean benchmark_xdmcp_load_done = TRUE;
+typedef struct
+{
+    gchar *id;
+    gint64 user_list_time;
+    gint64 authenticate_time;
+    gint64 replay_time;
+    gboolean done;
+} BenchmarkGreeter;
+static GHashTable *benchmark_greeters = NULL;
+static GHashTable *benchmark_display_start_times = NULL;
+static GHashTable *benchmark_vnc_started = NULL;
+static GArray *benchmark_greeter_times = NULL;
+static GArray *benchmark_user_list_times = NULL;
+static GArray *benchmark_authentication_times = NULL;
+static GArray *benchmark_replay_times = NULL;
+static gint64 benchmark_start_time = 0;
+static gint benchmark_expected_greeters = 0;
+static gint benchmark_greeters_done = 0;
+static gint benchmark_failures = 0;
+static gint benchmark_next_user = 0;
+static gboolean benchmark_finished = FALSE;
+
+/* Display numbers used for the XDMCP clients, above any allocated by the daemon */
+#define BENCHMARK_XDMCP_DISPLAY_BASE 1000
+
 static void ready (void);
 static void quit (int status);
 static gboolean status_timeout_cb (gpointer data);
@@ -111,6 +153,7 @@ static AccountsUser *get_accounts_user_by_uid (guint uid);
 static AccountsUser *get_accounts_user_by_name (const gchar *username);
 static void accounts_user_set_hidden (AccountsUser *user, gboolean hidden, gboolean emit_signal);
 static Login1Session *find_login1_session (const gchar *id);
+static void benchmark_status (const gchar *status);
 
 static gboolean
 kill_timeout_cb (gpointer data)
@@ -192,6 +235,32 @@ watch_process (pid_t pid)
     return process;
 }
 
+/* Report how long the script took so slow tests stand out */
+static void
+report_duration (int status)
+{
+    if (!script_name)
+        return;
+
+    gdouble seconds = (g_get_monotonic_time () - script_start_time) / 1000000.0;
+    g_printerr ("%s %s in %.2fs\n", script_name, status == EXIT_SUCCESS ? "passed" : "failed", seconds);
+
+    /* Runs in parallel append to the same file, one write per line keeps them whole */
+    const gchar *timings_path = g_getenv ("TEST_TIMINGS");
+    if (!timings_path)
+        return;
+    int fd = open (timings_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        g_warning ("Failed to open %s: %s", timings_path, strerror (errno));
+        return;
+    }
+    g_autofree gchar *line = g_strdup_printf ("%.3f %s %s\n", seconds, script_name, status == EXIT_SUCCESS ? "passed" : "failed");
+    if (write (fd, line, strlen (line)) < 0)
+        g_warning ("Failed to write %s: %s", timings_path, strerror (errno));
+    close (fd);
+}
+
 static void
 quit (int status)
 {
@@ -232,6 +301,8 @@ quit (int status)
             perror ("Failed to delete temp directory");
     }
 
+    report_duration (status);
+
     exit (status);
 }
 
@@ -341,6 +412,20 @@ switch_to_guest_done_cb (GObject *bus, GAsyncResult *result, gpointer data)
     }
 }
 
+static void
+restart_daemon_done_cb (GObject *bus, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) r = g_dbus_connection_call_finish (G_DBUS_CONNECTION (bus), result, &error);
+    if (r)
+        check_status ("RUNNER RESTART-DAEMON");
+    else
+    {
+        g_warning ("Failed to restart daemon: %s\n", error->message);
+        check_status ("RUNNER RESTART-DAEMON FAILED");
+    }
+}
+
 static void
 handle_command (const gchar *command)
 {
@@ -731,8 +816,66 @@ handle_command (const gchar *command)
                                 switch_to_guest_done_cb,
                                 NULL);
     }
+    else if (strcmp (name, "RESTART-DAEMON") == 0)
+    {
+        /* The daemon re-executes itself, so keeps the same process */
+        g_dbus_connection_call (g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL),
+                                "org.freedesktop.DisplayManager",
+                                "/org/freedesktop/DisplayManager",
+                                "org.freedesktop.DisplayManager",
+                                "Restart",
+                                g_variant_new ("()"),
+                                G_VARIANT_TYPE ("()"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                G_MAXINT,
+                                NULL,
+                                restart_daemon_done_cb,
+                                NULL);
+    }
     else if (strcmp (name, "STOP-DAEMON") == 0)
         stop_process (lightdm_process);
+    else if (strcmp (name, "DECODE-LOG") == 0)
+    {
+        /* Convert a binary daemon log back to text and count the lines that match */
+        const gchar *match = g_hash_table_lookup (params, "MATCH");
+        g_autofree gchar *decoder = g_build_filename (BUILDDIR, "src", "lightdm-log-decode", NULL);
+        g_autofree gchar *log_path = g_build_filename (temp_dir, "var", "log", "lightdm", "lightdm.log.bin", NULL);
+        gchar *argv[] = { decoder, log_path, NULL };
+
+        g_autofree gchar *output = NULL;
+        gint exit_status;
+        g_autoptr(GError) error = NULL;
+        if (!g_spawn_sync (NULL, argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &output, NULL, &exit_status, &error) ||
+            !g_spawn_check_exit_status (exit_status, &error))
+        {
+            g_debug ("Failed to decode %s: %s", log_path, error->message);
+            check_status ("RUNNER DECODE-LOG FAILED");
+        }
+        else
+        {
+            g_auto(GStrv) lines = g_strsplit (output, "\n", -1);
+            int n_matches = 0;
+            for (int i = 0; lines[i]; i++)
+                if (match && g_regex_match_simple (match, lines[i], 0, 0))
+                    n_matches++;
+
+            g_autofree gchar *status_text = g_strdup_printf ("RUNNER DECODE-LOG MATCHES=%d", n_matches);
+            check_status (status_text);
+        }
+    }
+    else if (strcmp (name, "COUNT-STATUSES") == 0)
+    {
+        /* Count the statuses received so far that match, so scripts can check something hasn't happened yet */
+        const gchar *match = g_hash_table_lookup (params, "MATCH");
+        g_autofree gchar *full_pattern = g_strdup_printf ("^%s$", match ? match : "");
+        int n_matches = 0;
+        for (GList *link = statuses; link; link = link->next)
+            if (g_regex_match_simple (full_pattern, (const gchar *) link->data, 0, 0))
+                n_matches++;
+
+        g_autofree gchar *status_text = g_strdup_printf ("RUNNER COUNT-STATUSES MATCHES=%d", n_matches);
+        check_status (status_text);
+    }
     // FIXME: Make generic RUN-COMMAND
     else if (strcmp (name, "START-XSERVER") == 0)
     {
@@ -756,6 +899,25 @@ handle_command (const gchar *command)
             g_hash_table_insert (children, GINT_TO_POINTER (process->pid), process);
         }
     }
+    else if (strcmp (name, "START-SHARED-GREETER") == 0)
+    {
+        const gchar *path = g_hash_table_lookup (params, "PATH");
+        g_autofree gchar *greeter_path = g_build_filename (BUILDDIR, "tests", "src", "test-gobject-greeter", NULL);
+        gchar *argv[] = { greeter_path, "--serve-displays", (gchar *) path, NULL };
+
+        GPid pid;
+        g_autoptr(GError) error = NULL;
+        if (!path || !g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error))
+        {
+            g_printerr ("Error starting shared greeter: %s", error ? error->message : "No PATH given");
+            quit (EXIT_FAILURE);
+        }
+        else
+        {
+            Process *process = watch_process (pid);
+            g_hash_table_insert (children, GINT_TO_POINTER (process->pid), process);
+        }
+    }
     else if (strcmp (name, "START-VNC-CLIENT") == 0)
     {
         const gchar *vnc_client_args = g_hash_table_lookup (params, "ARGS");
@@ -960,6 +1122,12 @@ check_status (const gchar *status)
     if (getenv ("DEBUG"))
         g_print ("%s\n", status);
 
+    if (benchmark)
+    {
+        benchmark_status (status);
+        return;
+    }
+
     /* Try and match against expected */
     g_autofree gchar *prefix = get_prefix (status);
     gboolean result = FALSE;
@@ -1041,6 +1209,128 @@ status_connect_cb (gpointer data)
     return TRUE;
 }
 
+#define PLYMOUTH_RESPONSE_ACK 0x06
+#define PLYMOUTH_RESPONSE_NAK 0x15
+
+typedef struct
+{
+    GSocket *socket;
+    GByteArray *buffer;
+} PlymouthClient;
+
+static guint8
+handle_plymouth_request (gchar command, const gchar *argument)
+{
+    gboolean result = TRUE;
+
+    switch (command)
+    {
+    case 'P':
+        result = g_key_file_get_boolean (config, "test-plymouth-config", "active", NULL);
+        check_status (result ? "PLYMOUTH PING ACTIVE=TRUE" : "PLYMOUTH PING ACTIVE=FALSE");
+        break;
+    case 'V':
+        result = g_key_file_get_boolean (config, "test-plymouth-config", "has-active-vt", NULL);
+        check_status (result ? "PLYMOUTH HAS-ACTIVE-VT=TRUE" : "PLYMOUTH HAS-ACTIVE-VT=FALSE");
+        break;
+    case 'D':
+        check_status ("PLYMOUTH DEACTIVATE");
+        break;
+    case 'Q':
+        if (argument && argument[0] != '\0')
+            check_status ("PLYMOUTH QUIT RETAIN-SPLASH=TRUE");
+        else
+            check_status ("PLYMOUTH QUIT RETAIN-SPLASH=FALSE");
+        break;
+    default:
+        result = FALSE;
+        break;
+    }
+
+    return result ? PLYMOUTH_RESPONSE_ACK : PLYMOUTH_RESPONSE_NAK;
+}
+
+static gboolean
+plymouth_request_cb (GSocket *socket, GIOCondition condition, PlymouthClient *client)
+{
+    gchar data[1024];
+    g_autoptr(GError) error = NULL;
+    gssize n_read = g_socket_receive (socket, data, sizeof (data), NULL, &error);
+    if (n_read < 0 && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED))
+        g_warning ("Error reading from Plymouth socket: %s", error->message);
+    if (n_read <= 0)
+    {
+        g_object_unref (client->socket);
+        g_byte_array_unref (client->buffer);
+        g_free (client);
+        return FALSE;
+    }
+    g_byte_array_append (client->buffer, (guint8 *) data, n_read);
+
+    /* Requests are a command byte then either a nul or \002, the argument length and the argument */
+    while (client->buffer->len >= 2)
+    {
+        const guint8 *request = client->buffer->data;
+        const gchar *argument = NULL;
+        gsize length = 2;
+        if (request[1] == '\002')
+        {
+            if (client->buffer->len < 3 || client->buffer->len < 3 + request[2])
+                break;
+            argument = (const gchar *) request + 3;
+            length = 3 + request[2];
+        }
+
+        guint8 response = handle_plymouth_request (request[0], argument);
+        g_socket_send (socket, (const gchar *) &response, 1, NULL, NULL);
+        g_byte_array_remove_range (client->buffer, 0, length);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+plymouth_connect_cb (GSocket *socket, GIOCondition condition, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    GSocket *client_socket = g_socket_accept (socket, NULL, &error);
+    if (!client_socket)
+    {
+        g_warning ("Failed to accept Plymouth connection: %s", error->message);
+        return TRUE;
+    }
+
+    PlymouthClient *client = g_malloc0 (sizeof (PlymouthClient));
+    client->socket = client_socket;
+    client->buffer = g_byte_array_new ();
+    GSource *source = g_socket_create_source (client_socket, G_IO_IN, NULL);
+    g_source_set_callback (source, (GSourceFunc) plymouth_request_cb, client, NULL);
+    g_source_attach (source, NULL);
+
+    return TRUE;
+}
+
+/* Listen on the socket libsystem redirects the Plymouth control socket to */
+static void
+start_plymouth (void)
+{
+    g_autofree gchar *path = g_build_filename (temp_dir, ".p", NULL);
+    g_autoptr(GError) error = NULL;
+    GSocket *socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, &error);
+    g_autoptr(GSocketAddress) address = g_unix_socket_address_new (path);
+    if (!socket ||
+        !g_socket_bind (socket, address, FALSE, &error) ||
+        !g_socket_listen (socket, &error))
+    {
+        g_warning ("Error creating Plymouth socket %s: %s", path, error->message);
+        quit (EXIT_FAILURE);
+    }
+
+    GSource *source = g_socket_create_source (socket, G_IO_IN, NULL);
+    g_source_set_callback (source, (GSourceFunc) plymouth_connect_cb, NULL, NULL);
+    g_source_attach (source, NULL);
+}
+
 static void
 load_script (const gchar *filename)
 {
@@ -1441,6 +1731,71 @@ start_console_kit_daemon (void)
                     NULL);
 }
 
+typedef struct
+{
+    GDBusInterfaceMethodCallFunc handler;
+    GDBusConnection *connection;
+    gchar *sender;
+    gchar *object_path;
+    gchar *interface_name;
+    gchar *method_name;
+    GVariant *parameters;
+    GDBusMethodInvocation *invocation;
+    gpointer user_data;
+} DelayedCall;
+static gboolean delivering_delayed_call = FALSE;
+
+static gboolean
+delayed_call_cb (gpointer data)
+{
+    DelayedCall *call = data;
+
+    delivering_delayed_call = TRUE;
+    call->handler (call->connection, call->sender, call->object_path, call->interface_name, call->method_name, call->parameters, call->invocation, call->user_data);
+    delivering_delayed_call = FALSE;
+
+    g_object_unref (call->connection);
+    g_free (call->sender);
+    g_free (call->object_path);
+    g_free (call->interface_name);
+    g_free (call->method_name);
+    g_variant_unref (call->parameters);
+    g_free (call);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Answer a method call later without blocking the other services, returns TRUE if the call was deferred */
+static gboolean
+delay_call (gint latency,
+            GDBusInterfaceMethodCallFunc handler,
+            GDBusConnection       *connection,
+            const gchar           *sender,
+            const gchar           *object_path,
+            const gchar           *interface_name,
+            const gchar           *method_name,
+            GVariant              *parameters,
+            GDBusMethodInvocation *invocation,
+            gpointer               user_data)
+{
+    if (latency <= 0 || delivering_delayed_call)
+        return FALSE;
+
+    DelayedCall *call = g_malloc0 (sizeof (DelayedCall));
+    call->handler = handler;
+    call->connection = g_object_ref (connection);
+    call->sender = g_strdup (sender);
+    call->object_path = g_strdup (object_path);
+    call->interface_name = g_strdup (interface_name);
+    call->method_name = g_strdup (method_name);
+    call->parameters = g_variant_ref (parameters);
+    call->invocation = invocation;
+    call->user_data = user_data;
+    g_timeout_add (latency, delayed_call_cb, call);
+
+    return TRUE;
+}
+
 static void
 handle_login1_seat_call (GDBusConnection       *connection,
                          const gchar           *sender,
@@ -1451,6 +1806,9 @@ handle_login1_seat_call (GDBusConnection       *connection,
                          GDBusMethodInvocation *invocation,
                          gpointer               user_data)
 {
+    if (delay_call (login1_latency, handle_login1_seat_call, connection, sender, object_path, interface_name, method_name, parameters, invocation, user_data))
+        return;
+
     g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "No such method: %s", method_name);
 }
 
@@ -1590,6 +1948,9 @@ handle_login1_session_call (GDBusConnection       *connection,
                             GDBusMethodInvocation *invocation,
                             gpointer               user_data)
 {
+    if (delay_call (login1_latency, handle_login1_session_call, connection, sender, object_path, interface_name, method_name, parameters, invocation, user_data))
+        return;
+
     /*Login1Session *session = user_data;*/
     g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "No such method: %s", method_name);
 }
@@ -1655,6 +2016,9 @@ handle_login1_call (GDBusConnection       *connection,
                     GDBusMethodInvocation *invocation,
                     gpointer               user_data)
 {
+    if (delay_call (login1_latency, handle_login1_call, connection, sender, object_path, interface_name, method_name, parameters, invocation, user_data))
+        return;
+
     if (strcmp (method_name, "ListSeats") == 0)
     {
         GVariantBuilder seats;
@@ -1884,6 +2248,13 @@ login1_name_acquired_cb (GDBusConnection *connection,
     if (g_key_file_has_key (config, "test-runner-config", "seat0-can-multi-session", NULL))
         seat0->can_multi_session = g_key_file_get_boolean (config, "test-runner-config", "seat0-can-multi-session", NULL);
 
+    /* Extra seats to benchmark */
+    for (int i = 1; i < benchmark_seats; i++)
+    {
+        g_autofree gchar *id = g_strdup_printf ("seat%d", i);
+        add_login1_seat (connection, id, FALSE);
+    }
+
     service_count--;
     if (service_count == 0)
         ready ();
@@ -1939,6 +2310,9 @@ handle_user_call (GDBusConnection       *connection,
                   GDBusMethodInvocation *invocation,
                   gpointer               user_data)
 {
+    if (delay_call (accounts_latency, handle_user_call, connection, sender, object_path, interface_name, method_name, parameters, invocation, user_data))
+        return;
+
     AccountsUser *user = user_data;
 
     if (strcmp (method_name, "SetXSession") == 0)
@@ -2205,6 +2579,9 @@ handle_accounts_call (GDBusConnection       *connection,
                       GDBusMethodInvocation *invocation,
                       gpointer               user_data)
 {
+    if (delay_call (accounts_latency, handle_accounts_call, connection, sender, object_path, interface_name, method_name, parameters, invocation, user_data))
+        return;
+
     if (strcmp (method_name, "ListCachedUsers") == 0)
     {
         GVariantBuilder builder;
@@ -2307,10 +2684,434 @@ start_accounts_service_daemon (void)
                     NULL);
 }
 
+static gint
+get_benchmark_parameter (const gchar *key, const gchar *variable, gint default_value)
+{
+    /* Environment overrides the script so the same script can be run at different scales */
+    const gchar *value = g_getenv (variable);
+    if (value)
+        return atoi (value);
+    if (g_key_file_has_key (config, "test-runner-config", key, NULL))
+        return g_key_file_get_integer (config, "test-runner-config", key, NULL);
+    return default_value;
+}
+
+static gchar *
+get_benchmark_string (const gchar *key, const gchar *variable, const gchar *default_value)
+{
+    const gchar *value = g_getenv (variable);
+    if (value)
+        return g_strdup (value);
+    if (g_key_file_has_key (config, "test-runner-config", key, NULL))
+        return g_key_file_get_string (config, "test-runner-config", key, NULL);
+    return g_strdup (default_value);
+}
+
+static void
+benchmark_set_display_start_time (gchar *display_id)
+{
+    gint64 *start_time = g_malloc (sizeof (gint64));
+    *start_time = g_get_monotonic_time ();
+    g_hash_table_insert (benchmark_display_start_times, display_id, start_time);
+}
+
+static void
+benchmark_add_sample (GArray *samples, gint64 start_time)
+{
+    gdouble ms = (g_get_monotonic_time () - start_time) / 1000.0;
+    g_array_append_val (samples, ms);
+}
+
+static gint
+compare_sample (gconstpointer a, gconstpointer b)
+{
+    gdouble sample_a = *((const gdouble *) a), sample_b = *((const gdouble *) b);
+    return sample_a < sample_b ? -1 : sample_a > sample_b ? 1 : 0;
+}
+
+static void
+benchmark_append_samples (GString *json, const gchar *name, GArray *samples)
+{
+    g_string_append_printf (json, ", \"%s\": {\"count\": %u", name, samples->len);
+    if (samples->len > 0)
+    {
+        g_array_sort (samples, compare_sample);
+
+        gdouble total = 0;
+        for (guint i = 0; i < samples->len; i++)
+            total += g_array_index (samples, gdouble, i);
+
+        g_string_append_printf (json, ", \"min\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"max\": %.3f, \"mean\": %.3f",
+                                g_array_index (samples, gdouble, 0),
+                                g_array_index (samples, gdouble, samples->len / 2),
+                                g_array_index (samples, gdouble, MIN (samples->len - 1, samples->len * 95 / 100)),
+                                g_array_index (samples, gdouble, samples->len - 1),
+                                total / samples->len);
+    }
+    g_string_append (json, "}");
+}
+
+static void
+benchmark_append_daemon_usage (GString *json)
+{
+    if (!lightdm_process)
+        return;
+
+    g_autofree gchar *status_path = g_strdup_printf ("/proc/%d/status", lightdm_process->pid);
+    g_autofree gchar *status_data = NULL;
+    if (g_file_get_contents (status_path, &status_data, NULL, NULL))
+    {
+        g_auto(GStrv) lines = g_strsplit (status_data, "\n", -1);
+        for (int i = 0; lines[i]; i++)
+        {
+            if (g_str_has_prefix (lines[i], "VmRSS:"))
+                g_string_append_printf (json, ", \"daemon-rss-kb\": %d", atoi (lines[i] + strlen ("VmRSS:")));
+            else if (g_str_has_prefix (lines[i], "VmHWM:"))
+                g_string_append_printf (json, ", \"daemon-peak-rss-kb\": %d", atoi (lines[i] + strlen ("VmHWM:")));
+        }
+    }
+
+    /* User and system time are the 14th and 15th fields, counted after the process name which may contain spaces */
+    g_autofree gchar *stat_path = g_strdup_printf ("/proc/%d/stat", lightdm_process->pid);
+    g_autofree gchar *stat_data = NULL;
+    const gchar *fields_start = NULL;
+    if (g_file_get_contents (stat_path, &stat_data, NULL, NULL))
+        fields_start = strrchr (stat_data, ')');
+    if (fields_start)
+    {
+        g_auto(GStrv) fields = g_strsplit (g_strstrip ((gchar *) fields_start + 1), " ", -1);
+        if (g_strv_length (fields) > 12)
+        {
+            gdouble ticks = g_ascii_strtod (fields[11], NULL) + g_ascii_strtod (fields[12], NULL);
+            g_string_append_printf (json, ", \"daemon-cpu-ms\": %.0f", ticks * 1000 / sysconf (_SC_CLK_TCK));
+        }
+    }
+}
+
+static void
+benchmark_finish (void)
+{
+    if (benchmark_finished)
+        return;
+    benchmark_finished = TRUE;
+
+    g_autoptr(GString) json = g_string_new ("");
+    g_string_append_printf (json, "{\"benchmark\": \"%s\"", benchmark_name);
+    g_string_append_printf (json, ", \"users\": %d, \"seats\": %d, \"xdmcp-clients\": %d, \"vnc-clients\": %d, \"xdmcp-terminals\": %d",
+                            benchmark_users, benchmark_seats, benchmark_xdmcp_clients, benchmark_vnc_clients, benchmark_xdmcp_terminals);
+    g_string_append_printf (json, ", \"groups\": %d, \"login1-latency-ms\": %d, \"accounts-service-latency-ms\": %d",
+                            benchmark_groups, login1_latency, accounts_latency);
+    g_string_append_printf (json, ", \"greeters\": %d, \"expected-greeters\": %d, \"failures\": %d",
+                            benchmark_greeters_done, benchmark_expected_greeters, benchmark_failures);
+    g_string_append_printf (json, ", \"duration-ms\": %.3f", (g_get_monotonic_time () - benchmark_start_time) / 1000.0);
+    benchmark_append_samples (json, "time-to-greeter-ms", benchmark_greeter_times);
+    benchmark_append_samples (json, "user-list-load-ms", benchmark_user_list_times);
+    benchmark_append_samples (json, "authentication-ms", benchmark_authentication_times);
+    benchmark_append_samples (json, "replay-ms", benchmark_replay_times);
+    benchmark_append_daemon_usage (json);
+    g_string_append (json, "}\n");
+
+    /* Results are appended so a set of benchmarks can collect into one file */
+    const gchar *output_path = g_getenv ("BENCHMARK_OUTPUT");
+    if (output_path)
+    {
+        FILE *output = fopen (output_path, "a");
+        if (output)
+        {
+            fputs (json->str, output);
+            fclose (output);
+        }
+        else
+            g_printerr ("Failed to write benchmark results to %s: %s\n", output_path, strerror (errno));
+    }
+    else
+        g_print ("%s", json->str);
+
+    if (lightdm_process)
+        stop_process (lightdm_process);
+    else
+        quit (benchmark_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static gboolean
+benchmark_timeout_cb (gpointer data)
+{
+    g_printerr ("Benchmark timed out with %d of %d greeters complete\n", benchmark_greeters_done, benchmark_expected_greeters);
+    benchmark_failures++;
+    benchmark_finish ();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+benchmark_greeter_done (BenchmarkGreeter *greeter, gboolean success)
+{
+    if (greeter && greeter->done)
+        return;
+    if (greeter)
+        greeter->done = TRUE;
+
+    if (!success)
+        benchmark_failures++;
+    benchmark_greeters_done++;
+    if (benchmark_greeters_done >= benchmark_expected_greeters && benchmark_xdmcp_load_done)
+        benchmark_finish ();
+}
+
+static void
+benchmark_send (const gchar *format, ...) G_GNUC_PRINTF (1, 2);
+
+static void
+benchmark_send (const gchar *format, ...)
+{
+    va_list ap;
+    va_start (ap, format);
+    g_autofree gchar *command = g_strdup_vprintf (format, ap);
+    va_end (ap);
+
+    handle_command (command);
+}
+
+/* Simulated XDMCP terminals that only exchange packets with the daemon, the
+ * load generator writes its own results */
+static void
+benchmark_start_xdmcp_load (void)
+{
+    gint port = 177;
+    if (g_key_file_has_key (config, "XDMCPServer", "port", NULL))
+        port = g_key_file_get_integer (config, "XDMCPServer", "port", NULL);
+    g_autofree gchar *mix = g_strdup (g_getenv ("BENCHMARK_XDMCP_MIX"));
+    if (!mix)
+        mix = g_key_file_get_string (config, "test-runner-config", "benchmark-xdmcp-mix", NULL);
+
+    g_autoptr(GPtrArray) argv = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (argv, g_build_filename (BUILDDIR, "tests", "src", "xdmcp-load", NULL));
+    g_ptr_array_add (argv, g_strdup ("-port"));
+    g_ptr_array_add (argv, g_strdup_printf ("%d", port));
+    g_ptr_array_add (argv, g_strdup ("-terminals"));
+    g_ptr_array_add (argv, g_strdup_printf ("%d", benchmark_xdmcp_terminals));
+    g_ptr_array_add (argv, g_strdup ("-duration"));
+    g_ptr_array_add (argv, g_strdup_printf ("%d", get_benchmark_parameter ("benchmark-xdmcp-duration", "BENCHMARK_XDMCP_DURATION", 10)));
+    if (mix)
+    {
+        g_ptr_array_add (argv, g_strdup ("-mix"));
+        g_ptr_array_add (argv, g_strdup (mix));
+    }
+    if (lightdm_process)
+    {
+        g_ptr_array_add (argv, g_strdup ("-pid"));
+        g_ptr_array_add (argv, g_strdup_printf ("%d", lightdm_process->pid));
+    }
+    g_ptr_array_add (argv, NULL);
+
+    GPid pid;
+    g_autoptr(GError) error = NULL;
+    if (!g_spawn_async (NULL, (gchar **) argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error))
+    {
+        g_printerr ("Error starting XDMCP load generator: %s\n", error->message);
+        benchmark_failures++;
+        benchmark_finish ();
+        return;
+    }
+
+    Process *process = watch_process (pid);
+    g_hash_table_insert (children, GINT_TO_POINTER (process->pid), process);
+}
+
+static gboolean
+benchmark_start_clients_cb (gpointer data)
+{
+    for (int i = 0; i < benchmark_xdmcp_clients; i++)
+    {
+        int display_number = BENCHMARK_XDMCP_DISPLAY_BASE + i;
+        benchmark_set_display_start_time (g_strdup_printf ("X-127.0.0.1:%d", display_number));
+        benchmark_send ("START-XSERVER ARGS=\":%d -query 127.0.0.1 -nolisten unix\"", display_number);
+    }
+
+    /* The Xvnc servers are started by the daemon and timed from there */
+    for (int i = 0; i < benchmark_vnc_clients; i++)
+        handle_command ("START-VNC-CLIENT");
+
+    if (benchmark_xdmcp_terminals > 0)
+        benchmark_start_xdmcp_load ();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+benchmark_start (void)
+{
+    benchmark_greeters = g_hash_table_new (g_str_hash, g_str_equal);
+    benchmark_display_start_times = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    benchmark_vnc_started = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    benchmark_greeter_times = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    benchmark_user_list_times = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    benchmark_authentication_times = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    benchmark_replay_times = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+    gboolean start_default_seat = TRUE;
+    if (g_key_file_has_key (config, "LightDM", "start-default-seat", NULL))
+        start_default_seat = g_key_file_get_boolean (config, "LightDM", "start-default-seat", NULL);
+    benchmark_expected_greeters = (start_default_seat ? benchmark_seats : 0) + benchmark_xdmcp_clients + benchmark_vnc_clients;
+    benchmark_xdmcp_load_done = benchmark_xdmcp_terminals == 0;
+
+    g_timeout_add_seconds (get_benchmark_parameter ("benchmark-timeout", "BENCHMARK_TIMEOUT", 120), benchmark_timeout_cb, NULL);
+
+    benchmark_start_time = g_get_monotonic_time ();
+    handle_command ("START-DAEMON");
+
+    /* Give the daemon time to start listening for remote displays */
+    if (benchmark_xdmcp_clients > 0 || benchmark_vnc_clients > 0 || benchmark_xdmcp_terminals > 0)
+        g_timeout_add_seconds (1, benchmark_start_clients_cb, NULL);
+
+    if (benchmark_expected_greeters == 0 && benchmark_xdmcp_load_done)
+        benchmark_finish ();
+}
+
+static void
+benchmark_status (const gchar *status)
+{
+    g_autofree gchar *prefix = get_prefix (status);
+    const gchar *event = status + strlen (prefix);
+    while (*event == ' ')
+        event++;
+
+    if (strcmp (prefix, "RUNNER") == 0)
+    {
+        if (g_str_has_prefix (event, "DAEMON-EXIT") || g_str_has_prefix (event, "DAEMON-TERMINATE"))
+        {
+            if (!benchmark_finished)
+            {
+                g_printerr ("Daemon stopped during benchmark: %s\n", status);
+                benchmark_failures++;
+                benchmark_finish ();
+            }
+            quit (benchmark_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+    else if (g_str_has_prefix (prefix, "XSERVER-"))
+    {
+        int display_number = atoi (prefix + strlen ("XSERVER-"));
+        gboolean is_xdmcp_client = display_number >= BENCHMARK_XDMCP_DISPLAY_BASE && display_number < BENCHMARK_XDMCP_DISPLAY_BASE + benchmark_xdmcp_clients;
+
+        if (g_str_has_prefix (event, "START"))
+        {
+            if (is_xdmcp_client)
+                benchmark_send ("%s SEND-QUERY", prefix);
+            else
+            {
+                benchmark_set_display_start_time (g_strdup_printf ("X-%d", display_number));
+                benchmark_send ("%s INDICATE-READY", prefix);
+            }
+        }
+        else if (g_str_has_prefix (event, "GOT-WILLING"))
+            benchmark_send ("%s SEND-REQUEST ADDRESSES=\"127.0.0.1\" AUTHORIZATION-NAMES=\"MIT-MAGIC-COOKIE-1\"", prefix);
+        else if (g_str_has_prefix (event, "GOT-ACCEPT"))
+            benchmark_send ("%s SEND-MANAGE", prefix);
+        else if (g_str_has_prefix (event, "GOT-UNWILLING") || g_str_has_prefix (event, "GOT-DECLINE") || g_str_has_prefix (event, "GOT-FAILED"))
+        {
+            g_printerr ("XDMCP client failed: %s\n", status);
+            benchmark_greeter_done (NULL, FALSE);
+        }
+    }
+    else if (strcmp (prefix, "XDMCP-LOAD") == 0)
+    {
+        if (g_str_has_prefix (event, "DONE"))
+        {
+            if (strstr (event, "FAILED=TRUE"))
+            {
+                g_printerr ("XDMCP load failed: %s\n", status);
+                benchmark_failures++;
+            }
+            benchmark_xdmcp_load_done = TRUE;
+
+            /* Finish if the greeters are done, passing a NULL greeter would count another one */
+            if (benchmark_greeters_done >= benchmark_expected_greeters)
+                benchmark_finish ();
+        }
+    }
+    else if (g_str_has_prefix (prefix, "XVNC-"))
+    {
+        if (g_str_has_prefix (event, "START"))
+        {
+            benchmark_set_display_start_time (g_strdup_printf ("X-%s", prefix + strlen ("XVNC-")));
+            benchmark_send ("%s INDICATE-READY", prefix);
+        }
+        /* Negotiate VNC once the daemon has connected */
+        else if (g_str_has_prefix (event, "ACCEPT-CONNECT") && !g_hash_table_contains (benchmark_vnc_started, prefix))
+        {
+            g_hash_table_add (benchmark_vnc_started, g_strdup (prefix));
+            benchmark_send ("%s START-VNC", prefix);
+        }
+    }
+    else if (g_str_has_prefix (prefix, "GREETER-"))
+    {
+        BenchmarkGreeter *greeter = g_hash_table_lookup (benchmark_greeters, prefix);
+        if (!greeter)
+        {
+            greeter = g_malloc0 (sizeof (BenchmarkGreeter));
+            greeter->id = g_strdup (prefix);
+            g_hash_table_insert (benchmark_greeters, greeter->id, greeter);
+        }
+
+        if (strcmp (event, "CONNECTED-TO-DAEMON") == 0)
+        {
+            gint64 *start_time = g_hash_table_lookup (benchmark_display_start_times, prefix + strlen ("GREETER-"));
+            benchmark_add_sample (benchmark_greeter_times, start_time ? *start_time : benchmark_start_time);
+
+            /* The first access to the user list loads it */
+            greeter->user_list_time = g_get_monotonic_time ();
+            benchmark_send ("%s LOG-USER-LIST-LENGTH", prefix);
+        }
+        else if (g_str_has_prefix (event, "LOG-USER-LIST-LENGTH"))
+        {
+            benchmark_add_sample (benchmark_user_list_times, greeter->user_list_time);
+
+            g_autofree gchar *username = NULL;
+            if (benchmark_users > 0)
+                username = g_strdup_printf ("bench-user%d", benchmark_next_user++ % benchmark_users);
+            else
+                username = g_strdup ("have-password1");
+            greeter->authenticate_time = g_get_monotonic_time ();
+            benchmark_send ("%s AUTHENTICATE USERNAME=%s", prefix, username);
+        }
+        else if (g_str_has_prefix (event, "SHOW-PROMPT"))
+            benchmark_send ("%s RESPOND TEXT=\"password\"", prefix);
+        /* Recorded greeter traces are played back by test-replay-greeter */
+        else if (strcmp (event, "REPLAY-READY") == 0)
+        {
+            g_autofree gchar *trace = get_benchmark_string ("benchmark-replay-trace", "BENCHMARK_REPLAY_TRACE", DATADIR "/traces/login.trace");
+            g_autofree gchar *speed = get_benchmark_string ("benchmark-replay-speed", "BENCHMARK_REPLAY_SPEED", "1");
+            greeter->replay_time = g_get_monotonic_time ();
+            benchmark_send ("%s REPLAY FILE=\"%s\" SPEED=%s", prefix, trace, speed);
+        }
+        else if (g_str_has_prefix (event, "REPLAY-DONE"))
+        {
+            benchmark_add_sample (benchmark_replay_times, greeter->replay_time);
+            if (!strstr (event, "STALLS=0"))
+                g_printerr ("Daemon didn't reply to the replayed greeter in time: %s\n", status);
+            benchmark_greeter_done (greeter, strstr (event, "STALLS=0") != NULL);
+        }
+        else if (g_str_has_prefix (event, "AUTHENTICATION-COMPLETE"))
+        {
+            benchmark_add_sample (benchmark_authentication_times, greeter->authenticate_time);
+            benchmark_greeter_done (greeter, strstr (event, "AUTHENTICATED=TRUE") != NULL);
+        }
+        else if (g_str_has_prefix (event, "FAIL-"))
+        {
+            g_printerr ("Greeter failed: %s\n", status);
+            benchmark_greeter_done (greeter, FALSE);
+        }
+    }
+}
+
 static void
 ready (void)
 {
-    run_commands ();
+    if (benchmark)
+        benchmark_start ();
+    else
+        run_commands ();
 }
 
 static gboolean
@@ -2385,6 +3186,146 @@ dbus_signal_cb (GDBusConnection *connection,
     check_status (status->str);
 }
 
+/* Directories from DATADIR every sandbox gets a copy of */
+static const gchar *fixture_dirs[] = { "sessions", "remote-sessions", "greeters", NULL };
+
+static gboolean
+copy_file (const gchar *from, const gchar *to)
+{
+    g_autofree gchar *data = NULL;
+    gsize data_length;
+    g_autoptr(GError) error = NULL;
+    if (!g_file_get_contents (from, &data, &data_length, &error) ||
+        !g_file_set_contents (to, data, data_length, &error))
+    {
+        g_warning ("Failed to copy %s to %s: %s", from, to, error->message);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Copy the files in a directory, linking them instead if possible */
+static gboolean
+copy_fixture_dir (const gchar *from, const gchar *to, gboolean use_links)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GDir) dir = g_dir_open (from, 0, &error);
+    if (!dir)
+    {
+        g_warning ("Failed to open %s: %s", from, error->message);
+        return FALSE;
+    }
+
+    g_mkdir_with_parents (to, 0755);
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        g_autofree gchar *from_path = g_build_filename (from, name, NULL);
+        g_autofree gchar *to_path = g_build_filename (to, name, NULL);
+        if (g_file_test (from_path, G_FILE_TEST_IS_DIR))
+            continue;
+        if (use_links && link (from_path, to_path) == 0)
+            continue;
+        if (!copy_file (from_path, to_path))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Identify the fixture files by name, size and modification time so changes get a new cache */
+static guint
+get_fixture_hash (void)
+{
+    g_autoptr(GString) text = g_string_new ("");
+    g_autofree gchar *keys_path = g_build_filename (SRCDIR, "tests", "data", "keys.conf", NULL);
+    g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (paths, g_strdup (keys_path));
+    for (int i = 0; fixture_dirs[i]; i++)
+    {
+        g_autofree gchar *dir_path = g_build_filename (DATADIR, fixture_dirs[i], NULL);
+        g_autoptr(GDir) dir = g_dir_open (dir_path, 0, NULL);
+        const gchar *name;
+        while (dir && (name = g_dir_read_name (dir)))
+            g_ptr_array_add (paths, g_build_filename (dir_path, name, NULL));
+    }
+
+    for (guint i = 0; i < paths->len; i++)
+    {
+        const gchar *path = g_ptr_array_index (paths, i);
+        GStatBuf info;
+        if (g_stat (path, &info) == 0)
+            g_string_append_printf (text, "%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", path, (gint64) info.st_size, (gint64) info.st_mtime);
+    }
+
+    return g_str_hash (text->str);
+}
+
+/* Build the files shared by all sandboxes once, the first runner to finish building it wins */
+static gchar *
+get_fixture_cache (void)
+{
+    g_autofree gchar *name = g_strdup_printf (".rf%d-%08x", getuid (), get_fixture_hash ());
+    g_autofree gchar *path = g_build_filename ("/tmp", name, NULL);
+    if (g_file_test (path, G_FILE_TEST_IS_DIR))
+        return g_steal_pointer (&path);
+
+    g_autofree gchar *build_path = g_build_filename ("/tmp", ".rfXXXXXX", NULL);
+    if (!g_mkdtemp (build_path))
+    {
+        g_warning ("Failed to make fixture cache: %s", strerror (errno));
+        return NULL;
+    }
+    g_chmod (build_path, 0755);
+
+    gboolean result = TRUE;
+    for (int i = 0; fixture_dirs[i] && result; i++)
+    {
+        g_autofree gchar *from = g_build_filename (DATADIR, fixture_dirs[i], NULL);
+        g_autofree gchar *to = g_build_filename (build_path, fixture_dirs[i], NULL);
+        result = copy_fixture_dir (from, to, FALSE);
+    }
+    if (result)
+    {
+        g_autofree gchar *from = g_build_filename (SRCDIR, "tests", "data", "keys.conf", NULL);
+        g_autofree gchar *to = g_build_filename (build_path, "keys.conf", NULL);
+        result = copy_file (from, to);
+    }
+
+    if (result && rename (build_path, path) == 0)
+        return g_steal_pointer (&path);
+
+    g_autofree gchar *command = g_strdup_printf ("rm -rf %s", build_path);
+    if (system (command))
+        perror ("Failed to delete fixture cache");
+
+    /* Another runner may have got there first */
+    if (g_file_test (path, G_FILE_TEST_IS_DIR))
+        return g_steal_pointer (&path);
+
+    return NULL;
+}
+
+/* Put the session, greeter and key files in the sandbox */
+static void
+install_fixtures (void)
+{
+    g_autofree gchar *cache = get_fixture_cache ();
+
+    for (int i = 0; fixture_dirs[i]; i++)
+    {
+        g_autofree gchar *from = g_build_filename (cache ? cache : DATADIR, fixture_dirs[i], NULL);
+        g_autofree gchar *to = g_build_filename (temp_dir, "usr", "share", "lightdm", fixture_dirs[i], NULL);
+        copy_fixture_dir (from, to, cache != NULL);
+    }
+
+    g_autofree gchar *keys_from = cache ? g_build_filename (cache, "keys.conf", NULL) : g_build_filename (SRCDIR, "tests", "data", "keys.conf", NULL);
+    g_autofree gchar *keys_to = g_build_filename (temp_dir, "etc", "lightdm", "keys.conf", NULL);
+    if (!cache || link (keys_from, keys_to) < 0)
+        copy_file (keys_from, keys_to);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -2404,7 +3345,8 @@ main (int argc, char **argv)
         g_printerr ("Usage %s SCRIPT-NAME GREETER\n", argv[0]);
         quit (EXIT_FAILURE);
     }
-    const gchar *script_name = argv[1];
+    script_name = argv[1];
+    script_start_time = g_get_monotonic_time ();
     g_autofree gchar *config_file = g_strdup_printf ("%s.conf", script_name);
     config_path = g_build_filename (SRCDIR, "tests", "scripts", config_file, NULL);
 
@@ -2413,6 +3355,38 @@ main (int argc, char **argv)
 
     load_script (config_path);
 
+    benchmark = g_key_file_get_boolean (config, "test-runner-config", "benchmark", NULL);
+    if (benchmark)
+    {
+        benchmark_name = g_strdup (script_name);
+        benchmark_users = get_benchmark_parameter ("benchmark-users", "BENCHMARK_USERS", 0);
+        benchmark_seats = get_benchmark_parameter ("benchmark-seats", "BENCHMARK_SEATS", 1);
+        benchmark_xdmcp_clients = get_benchmark_parameter ("benchmark-xdmcp-clients", "BENCHMARK_XDMCP_CLIENTS", 0);
+        benchmark_vnc_clients = get_benchmark_parameter ("benchmark-vnc-clients", "BENCHMARK_VNC_CLIENTS", 0);
+        benchmark_xdmcp_terminals = get_benchmark_parameter ("benchmark-xdmcp-terminals", "BENCHMARK_XDMCP_TERMINALS", 0);
+        benchmark_groups = get_benchmark_parameter ("benchmark-groups", "BENCHMARK_GROUPS", 0);
+    }
+
+    /* Make the mock services and name lookups slow to reproduce production systems */
+    login1_latency = get_benchmark_parameter ("login1-latency", "BENCHMARK_LOGIN1_LATENCY", 0);
+    accounts_latency = get_benchmark_parameter ("accounts-service-latency", "BENCHMARK_ACCOUNTS_SERVICE_LATENCY", 0);
+    gint nss_latency = get_benchmark_parameter ("nss-latency", "BENCHMARK_NSS_LATENCY", 0);
+    if (nss_latency > 0)
+    {
+        g_autofree gchar *value = g_strdup_printf ("%d", nss_latency);
+        g_setenv ("LIGHTDM_TEST_NSS_LATENCY", value, TRUE);
+    }
+    gint home_latency = get_benchmark_parameter ("home-dir-latency", "BENCHMARK_HOME_DIR_LATENCY", 0);
+    if (home_latency > 0)
+    {
+        g_autofree gchar *value = g_strdup_printf ("%d", home_latency);
+        g_setenv ("LIGHTDM_TEST_HOME_DIR_LATENCY", value, TRUE);
+    }
+
+    /* Run as root with home directories that root isn't allowed to read */
+    if (g_key_file_get_boolean (config, "test-runner-config", "root-squash-home-dirs", NULL))
+        g_setenv ("LIGHTDM_TEST_ROOT_SQUASH", "1", TRUE);
+
     gchar cwd[1024];
     if (!getcwd (cwd, 1024))
     {
@@ -2445,16 +3419,23 @@ main (int argc, char **argv)
 
     /* Run in a temporary directory inside the build directory */
     /* Note we have to pick a name that is short since Unix sockets in this directory have a 108 character limit on their paths */
+    /* Creating the directory is atomic so runners started in parallel never share one */
     int i = 0;
     while (TRUE) {
         g_autofree gchar *name = g_strdup_printf (".r%d", i);
-        g_free (temp_dir);
-        temp_dir = g_build_filename ("/tmp", name, NULL);
-        if (!g_file_test (temp_dir, G_FILE_TEST_EXISTS))
+        g_autofree gchar *path = g_build_filename ("/tmp", name, NULL);
+        if (g_mkdir (path, 0755) == 0)
+        {
+            temp_dir = g_steal_pointer (&path);
             break;
+        }
+        if (errno != EEXIST)
+        {
+            g_printerr ("Failed to make test directory %s: %s\n", path, strerror (errno));
+            quit (EXIT_FAILURE);
+        }
         i++;
     }
-    g_mkdir_with_parents (temp_dir, 0755);
     g_setenv ("LIGHTDM_TEST_ROOT", temp_dir, TRUE);
 
     /* Open socket for status */
@@ -2480,6 +3461,10 @@ main (int argc, char **argv)
     g_source_set_callback (status_source, status_connect_cb, NULL, NULL);
     g_source_attach (status_source, NULL);
 
+    /* Provide a Plymouth daemon */
+    if (g_key_file_get_boolean (config, "test-plymouth-config", "enabled", NULL))
+        start_plymouth ();
+
     /* Set up a skeleton file system */
     g_mkdir_with_parents (g_strdup_printf ("%s/etc", temp_dir), 0755);
     g_mkdir_with_parents (g_strdup_printf ("%s/run", temp_dir), 0755);
@@ -2497,8 +3482,6 @@ main (int argc, char **argv)
     if (!g_key_file_has_key (config, "test-runner-config", "have-config", NULL) || g_key_file_get_boolean (config, "test-runner-config", "have-config", NULL))
         if (system (g_strdup_printf ("cp %s %s/etc/lightdm/lightdm.conf", config_path, temp_dir)))
             perror ("Failed to copy configuration");
-    if (system (g_strdup_printf ("cp %s/tests/data/keys.conf %s/etc/lightdm/", SRCDIR, temp_dir)))
-        perror ("Failed to copy key configuration");
 
     g_autofree gchar *additional_system_config = g_key_file_get_string (config, "test-runner-config", "additional-system-config", NULL);
     if (additional_system_config)
@@ -2549,12 +3532,7 @@ main (int argc, char **argv)
         perror ("Failed to copy configuration");
 
     /* Copy over the greeter files */
-    if (system (g_strdup_printf ("cp %s/sessions/* %s/usr/share/lightdm/sessions", DATADIR, temp_dir)))
-        perror ("Failed to copy sessions");
-    if (system (g_strdup_printf ("cp %s/remote-sessions/* %s/usr/share/lightdm/remote-sessions", DATADIR, temp_dir)))
-        perror ("Failed to copy remote sessions");
-    if (system (g_strdup_printf ("cp %s/greeters/* %s/usr/share/lightdm/greeters", DATADIR, temp_dir)))
-        perror ("Failed to copy greeters");
+    install_fixtures ();
 
     /* Set up the default greeter */
     g_autofree gchar *greeter_path = g_build_filename (temp_dir, "usr", "share", "lightdm", "greeters", "default.desktop", NULL);
@@ -2701,9 +3679,34 @@ main (int argc, char **argv)
         /* Add group file entry */
         g_string_append_printf (group_data, "%s:x:%d:%s\n", users[i].user_name, users[i].uid, users[i].user_name);
     }
+
+    /* Make users to benchmark with */
+    for (int i = 0; i < benchmark_users; i++)
+    {
+        g_autofree gchar *user_name = g_strdup_printf ("bench-user%d", i);
+        int uid = 10000 + i;
+
+        g_autofree gchar *path = g_build_filename (home_dir, user_name, NULL);
+        g_mkdir_with_parents (path, 0755);
+        if (chown (path, uid, uid) < 0)
+          g_debug ("chown (%s) failed: %s", path, strerror (errno));
+
+        g_string_append_printf (passwd_data, "%s:password:%d:%d:Benchmark User %d:%s/home/%s:/bin/sh\n", user_name, uid, uid, i, temp_dir, user_name);
+        g_string_append_printf (group_data, "%s:x:%d:%s\n", user_name, uid, user_name);
+    }
+
     g_autofree gchar *passwd_path = g_build_filename (temp_dir, "etc", "passwd", NULL);
     g_file_set_contents (passwd_path, passwd_data->str, -1, NULL);
 
+    /* Make groups to benchmark with, sharing the benchmark users out between them */
+    for (int i = 0; i < benchmark_groups; i++)
+    {
+        g_string_append_printf (group_data, "bench-group%d:x:%d:", i, 20000 + i);
+        for (int j = i; j < benchmark_users; j += benchmark_groups)
+            g_string_append_printf (group_data, "%sbench-user%d", j == i ? "" : ",", j);
+        g_string_append (group_data, "\n");
+    }
+
     /* Add an extra test group */
     g_string_append_printf (group_data, "test-group:x:111:\n");
 
@@ -0,0 +1,589 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "user-list.h"
+#include "dmrc.h"
+#include "nss.h"
+
+/*
+ * Measures CommonUserList and dmrc_load against synthetic user databases.
+ * Users come from a passwd file written into $LIGHTDM_TEST_ROOT, read
+ * through libsystem, or from an AccountsService stand-in owned on the system
+ * bus by a thread in this process. Each size is loaded from scratch, then one
+ * user is changed to measure the reload. Run under dbus-env with libsystem
+ * preloaded; the results are written as JSON objects to stdout or appended
+ * to $BENCHMARK_OUTPUT.
+ *
+ * BENCHMARK_USER_LIST_SIZES overrides the sizes loaded.
+ * BENCHMARK_NSS_LATENCY and BENCHMARK_HOME_DIR_LATENCY are passed on to
+ * libsystem, BENCHMARK_ACCOUNTS_SERVICE_LATENCY delays each user the
+ * AccountsService stand-in returns. All are in ms.
+ */
+
+#define FIRST_UID 1000
+
+/* Longest to wait for a change to be reported */
+#define RELOAD_TIMEOUT_MS 10000
+
+static gchar *sizes = NULL;
+static gint n_dmrc = 1000;
+static gchar *backend = NULL;
+
+static const gchar *root = NULL;
+
+typedef enum
+{
+    COUNT_USER_ADDED,
+    COUNT_USER_CHANGED,
+    COUNT_USER_REMOVED,
+    COUNT_USERS_ADDED,
+    COUNT_USERS_CHANGED,
+    COUNT_USERS_REMOVED,
+    N_COUNTS
+} Count;
+
+static const gchar *count_names[N_COUNTS] =
+{
+    USER_LIST_SIGNAL_USER_ADDED,
+    USER_LIST_SIGNAL_USER_CHANGED,
+    USER_LIST_SIGNAL_USER_REMOVED,
+    USER_LIST_SIGNAL_USERS_ADDED,
+    USER_LIST_SIGNAL_USERS_CHANGED,
+    USER_LIST_SIGNAL_USERS_REMOVED,
+};
+
+static gint counts[N_COUNTS];
+
+/* Running while waiting for a reload to be reported */
+static GMainLoop *reload_loop = NULL;
+
+/* AccountsService stand-in */
+static GDBusConnection *accounts_bus = NULL;
+static gint accounts_n_users = 0;
+static gint accounts_changed_uid = -1;
+static gint accounts_latency = 0;
+
+static const gchar accounts_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.Accounts'>"
+    "    <method name='ListCachedUsers'>"
+    "      <arg name='users' direction='out' type='ao'/>"
+    "    </method>"
+    "    <signal name='UserAdded'>"
+    "      <arg name='user' type='o'/>"
+    "    </signal>"
+    "    <signal name='UserDeleted'>"
+    "      <arg name='user' type='o'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
+
+static const gchar accounts_user_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.Accounts.User'>"
+    "    <property name='UserName' type='s' access='read'/>"
+    "    <property name='RealName' type='s' access='read'/>"
+    "    <property name='HomeDirectory' type='s' access='read'/>"
+    "    <property name='Shell' type='s' access='read'/>"
+    "    <property name='SystemAccount' type='b' access='read'/>"
+    "    <property name='Uid' type='t' access='read'/>"
+    "    <signal name='Changed'/>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.DisplayManager.AccountsService'>"
+    "    <property name='BackgroundFile' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+/* Reported by the stand-in thread once it is running, queues can't hold zero */
+enum
+{
+    STARTED = 1,
+    FAILED
+};
+
+static GDBusNodeInfo *accounts_info = NULL;
+static GDBusNodeInfo *accounts_user_info = NULL;
+
+static gchar *
+get_real_name (guint uid)
+{
+    if ((gint) uid == g_atomic_int_get (&accounts_changed_uid))
+        return g_strdup_printf ("User %u (changed)", uid);
+    return g_strdup_printf ("User %u", uid);
+}
+
+static gchar *
+get_home_directory (guint uid)
+{
+    g_autofree gchar *name = g_strdup_printf ("user%u", uid);
+    return g_build_filename (root, "home", name, NULL);
+}
+
+static void
+accounts_method_call (GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                      const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+                      GDBusMethodInvocation *invocation, gpointer user_data)
+{
+    if (g_strcmp0 (method_name, "ListCachedUsers") != 0)
+    {
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
+        return;
+    }
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+    gint n_users = g_atomic_int_get (&accounts_n_users);
+    for (gint i = 0; i < n_users; i++)
+    {
+        g_autofree gchar *path = g_strdup_printf ("/org/freedesktop/Accounts/User%d", FIRST_UID + i);
+        g_variant_builder_add (&builder, "o", path);
+    }
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(ao)", &builder));
+}
+
+static GVariant *
+accounts_user_get_property (GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                            const gchar *interface_name, const gchar *property_name, GError **error, gpointer user_data)
+{
+    guint uid = GPOINTER_TO_UINT (user_data);
+
+    /* Once for each interface a client gets all the properties of */
+    if (g_strcmp0 (property_name, "UserName") == 0 || g_strcmp0 (property_name, "BackgroundFile") == 0)
+    {
+        if (accounts_latency > 0)
+            g_usleep (accounts_latency * 1000);
+    }
+
+    if (g_strcmp0 (property_name, "UserName") == 0)
+        return g_variant_new_take_string (g_strdup_printf ("user%u", uid));
+    else if (g_strcmp0 (property_name, "RealName") == 0)
+        return g_variant_new_take_string (get_real_name (uid));
+    else if (g_strcmp0 (property_name, "HomeDirectory") == 0)
+        return g_variant_new_take_string (get_home_directory (uid));
+    else if (g_strcmp0 (property_name, "Shell") == 0)
+        return g_variant_new_string ("/bin/sh");
+    else if (g_strcmp0 (property_name, "SystemAccount") == 0)
+        return g_variant_new_boolean (FALSE);
+    else if (g_strcmp0 (property_name, "Uid") == 0)
+        return g_variant_new_uint64 (uid);
+    else if (g_strcmp0 (property_name, "BackgroundFile") == 0)
+        return g_variant_new_string ("");
+
+    return NULL;
+}
+
+static const GDBusInterfaceVTable accounts_vtable = { accounts_method_call, NULL, NULL };
+static const GDBusInterfaceVTable accounts_user_vtable = { NULL, accounts_user_get_property, NULL };
+
+static gchar **
+accounts_enumerate (GDBusConnection *connection, const gchar *sender, const gchar *object_path, gpointer user_data)
+{
+    return g_new0 (gchar *, 1);
+}
+
+static GDBusInterfaceInfo **
+accounts_introspect (GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *node, gpointer user_data)
+{
+    GPtrArray *interfaces = g_ptr_array_new ();
+    GDBusNodeInfo *info = node == NULL ? accounts_info : g_str_has_prefix (node, "User") ? accounts_user_info : NULL;
+    for (int i = 0; info && info->interfaces[i]; i++)
+        g_ptr_array_add (interfaces, g_dbus_interface_info_ref (info->interfaces[i]));
+    g_ptr_array_add (interfaces, NULL);
+    return (GDBusInterfaceInfo **) g_ptr_array_free (interfaces, FALSE);
+}
+
+static const GDBusInterfaceVTable *
+accounts_dispatch (GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                   const gchar *interface_name, const gchar *node, gpointer *out_user_data, gpointer user_data)
+{
+    if (node == NULL)
+        return &accounts_vtable;
+
+    guint uid;
+    if (sscanf (node, "User%u", &uid) != 1)
+        return NULL;
+    *out_user_data = GUINT_TO_POINTER (uid);
+    return &accounts_user_vtable;
+}
+
+static const GDBusSubtreeVTable accounts_subtree_vtable = { accounts_enumerate, accounts_introspect, accounts_dispatch };
+
+static gpointer
+accounts_thread (gpointer data)
+{
+    GAsyncQueue *ready = data;
+
+    g_autoptr(GMainContext) context = g_main_context_new ();
+    g_main_context_push_thread_default (context);
+
+    /* The stand-in has its own connection so it answers while the main thread makes blocking calls */
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (address)
+        accounts_bus = g_dbus_connection_new_for_address_sync (address,
+                                                               G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                               NULL, NULL, &error);
+    if (accounts_bus &&
+        g_dbus_connection_register_subtree (accounts_bus, "/org/freedesktop/Accounts", &accounts_subtree_vtable,
+                                            G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES, NULL, NULL, &error) != 0)
+    {
+        g_autoptr(GVariant) result = g_dbus_connection_call_sync (accounts_bus,
+                                                                  "org.freedesktop.DBus",
+                                                                  "/org/freedesktop/DBus",
+                                                                  "org.freedesktop.DBus",
+                                                                  "RequestName",
+                                                                  g_variant_new ("(su)", "org.freedesktop.Accounts", 0),
+                                                                  G_VARIANT_TYPE ("(u)"),
+                                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                                  -1,
+                                                                  NULL,
+                                                                  &error);
+        if (result)
+        {
+            g_async_queue_push (ready, GINT_TO_POINTER (STARTED));
+            g_autoptr(GMainLoop) loop = g_main_loop_new (context, FALSE);
+            g_main_loop_run (loop);
+            return NULL;
+        }
+    }
+
+    g_printerr ("Failed to start AccountsService stand-in: %s\n", error ? error->message : "no system bus");
+    g_async_queue_push (ready, GINT_TO_POINTER (FAILED));
+    return NULL;
+}
+
+static gboolean
+start_accounts_service (void)
+{
+    accounts_info = g_dbus_node_info_new_for_xml (accounts_xml, NULL);
+    accounts_user_info = g_dbus_node_info_new_for_xml (accounts_user_xml, NULL);
+
+    const gchar *latency = g_getenv ("BENCHMARK_ACCOUNTS_SERVICE_LATENCY");
+    if (latency)
+        accounts_latency = atoi (latency);
+
+    g_autoptr(GAsyncQueue) ready = g_async_queue_new ();
+    g_thread_unref (g_thread_new ("accounts-service", accounts_thread, ready));
+    return GPOINTER_TO_INT (g_async_queue_pop (ready)) == STARTED;
+}
+
+/* Users are user1000, user1001, ..., with uid_to_change given a different real name */
+static gboolean
+write_passwd (gint n_users, gint uid_to_change)
+{
+    g_autoptr(GString) data = g_string_sized_new (n_users * 64);
+    for (gint i = 0; i < n_users; i++)
+    {
+        guint uid = FIRST_UID + i;
+        g_autofree gchar *home_directory = get_home_directory (uid);
+        g_string_append_printf (data, "user%u:x:%u:%u:User %u%s:%s:/bin/sh\n",
+                                uid, uid, uid, uid, (gint) uid == uid_to_change ? " (changed)" : "", home_directory);
+    }
+
+    g_autofree gchar *etc_dir = g_build_filename (root, "etc", NULL);
+    g_autofree gchar *path = g_build_filename (etc_dir, "passwd", NULL);
+    g_autoptr(GError) error = NULL;
+    if (g_mkdir_with_parents (etc_dir, 0755) < 0 ||
+        !g_file_set_contents (path, data->str, data->len, &error))
+    {
+        g_printerr ("Failed to write %s: %s\n", path, error ? error->message : strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+write_dmrc_files (gint n_users)
+{
+    for (gint i = 0; i < n_users; i++)
+    {
+        g_autofree gchar *home_directory = get_home_directory (FIRST_UID + i);
+        g_autofree gchar *path = g_build_filename (home_directory, ".dmrc", NULL);
+        if (g_file_test (path, G_FILE_TEST_EXISTS))
+            continue;
+        g_mkdir_with_parents (home_directory, 0755);
+        g_file_set_contents (path, "[Desktop]\nSession=default\nLanguage=en_US.UTF-8\n", -1, NULL);
+    }
+}
+
+/* Resident memory in kB */
+static glong
+get_rss (void)
+{
+    g_autofree gchar *data = NULL;
+    if (!g_file_get_contents ("/proc/self/statm", &data, NULL, NULL))
+        return 0;
+    g_auto(GStrv) fields = g_strsplit (data, " ", -1);
+    if (g_strv_length (fields) < 2)
+        return 0;
+    return atol (fields[1]) * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static void
+count_cb (CommonUserList *user_list, gpointer arg, gpointer data)
+{
+    counts[GPOINTER_TO_INT (data)]++;
+}
+
+static void
+users_changed_cb (CommonUserList *user_list, GPtrArray *users, gpointer data)
+{
+    if (reload_loop)
+        g_main_loop_quit (reload_loop);
+}
+
+static gboolean
+reload_timeout_cb (gpointer data)
+{
+    g_main_loop_quit (reload_loop);
+    return G_SOURCE_REMOVE;
+}
+
+static gint
+compare_sample (gconstpointer a, gconstpointer b)
+{
+    gdouble sample_a = *((gdouble *) a), sample_b = *((gdouble *) b);
+    return sample_a < sample_b ? -1 : sample_a > sample_b ? 1 : 0;
+}
+
+static void
+append_samples (GString *json, const gchar *name, GArray *samples)
+{
+    g_string_append_printf (json, ", \"%s\": {\"count\": %u", name, samples->len);
+    if (samples->len > 0)
+    {
+        g_array_sort (samples, compare_sample);
+
+        gdouble total = 0;
+        for (guint i = 0; i < samples->len; i++)
+            total += g_array_index (samples, gdouble, i);
+
+        g_string_append_printf (json, ", \"min\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"max\": %.3f, \"mean\": %.3f",
+                                g_array_index (samples, gdouble, 0),
+                                g_array_index (samples, gdouble, samples->len / 2),
+                                g_array_index (samples, gdouble, MIN (samples->len - 1, samples->len * 95 / 100)),
+                                g_array_index (samples, gdouble, samples->len - 1),
+                                total / samples->len);
+    }
+    g_string_append (json, "}");
+}
+
+static void
+append_counts (GString *json, const gchar *name)
+{
+    g_string_append_printf (json, ", \"%s\": {", name);
+    for (int i = 0; i < N_COUNTS; i++)
+        g_string_append_printf (json, "%s\"%s\": %d", i > 0 ? ", " : "", count_names[i], counts[i]);
+    g_string_append (json, "}");
+}
+
+static void
+report (GString *json)
+{
+    /* Results are appended so they collect with the other benchmarks */
+    const gchar *output_path = g_getenv ("BENCHMARK_OUTPUT");
+    if (output_path)
+    {
+        FILE *output = fopen (output_path, "a");
+        if (output)
+        {
+            fputs (json->str, output);
+            fclose (output);
+        }
+        else
+            g_printerr ("Failed to write benchmark results to %s: %s\n", output_path, strerror (errno));
+    }
+    else
+        g_print ("%s", json->str);
+}
+
+/* Change one user in the backend the list was loaded from */
+static void
+change_user (gboolean use_accounts_service, gint n_users)
+{
+    gint uid = FIRST_UID + n_users / 2;
+
+    if (use_accounts_service)
+    {
+        g_atomic_int_set (&accounts_changed_uid, uid);
+        g_autofree gchar *path = g_strdup_printf ("/org/freedesktop/Accounts/User%d", uid);
+        g_dbus_connection_emit_signal (accounts_bus, NULL, path, "org.freedesktop.Accounts.User", "Changed", g_variant_new ("()"), NULL);
+        g_dbus_connection_flush_sync (accounts_bus, NULL, NULL);
+    }
+    else
+        write_passwd (n_users, uid);
+}
+
+static gboolean
+run (gboolean use_accounts_service, gint n_users)
+{
+    g_printerr ("Loading %d users from %s\n", n_users, use_accounts_service ? "AccountsService" : "passwd");
+
+    g_atomic_int_set (&accounts_n_users, use_accounts_service ? n_users : 0);
+    g_atomic_int_set (&accounts_changed_uid, -1);
+    if (!write_passwd (use_accounts_service ? 0 : n_users, -1))
+        return FALSE;
+    gint n_dmrc_users = MIN (n_dmrc, n_users);
+    write_dmrc_files (n_dmrc_users);
+
+    /* Nothing is kept from the last run */
+    common_user_list_cleanup ();
+    common_nss_clear_cache ();
+    dmrc_cleanup ();
+
+    CommonUserList *user_list = common_user_list_get_instance ();
+    for (int i = 0; i < N_COUNTS; i++)
+    {
+        counts[i] = 0;
+        g_signal_connect (user_list, count_names[i], G_CALLBACK (count_cb), GINT_TO_POINTER (i));
+    }
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USERS_CHANGED, G_CALLBACK (users_changed_cb), NULL);
+
+    glong rss_before = get_rss ();
+    gint64 load_start = g_get_monotonic_time ();
+    GList *users = common_user_list_get_users (user_list);
+    gdouble load_ms = (g_get_monotonic_time () - load_start) / 1000.0;
+    glong memory = get_rss () - rss_before;
+    gint n_loaded = g_list_length (users);
+
+    g_autoptr(GArray) dmrc_samples = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    GList *link = users;
+    for (gint i = 0; i < n_dmrc_users && link; i++, link = link->next)
+    {
+        gint64 start = g_get_monotonic_time ();
+        g_autoptr(GKeyFile) dmrc_file = dmrc_load (link->data);
+        gdouble ms = (g_get_monotonic_time () - start) / 1000.0;
+        g_array_append_val (dmrc_samples, ms);
+    }
+
+    /* Let anything still pending from loading go out before counting the reload */
+    while (g_main_context_iteration (NULL, FALSE));
+    g_autoptr(GString) json = g_string_new ("");
+    g_string_append_printf (json, "{\"benchmark\": \"user-list\", \"backend\": \"%s\", \"users\": %d, \"loaded-users\": %d",
+                            use_accounts_service ? "accounts-service" : "passwd", n_users, n_loaded);
+    g_string_append_printf (json, ", \"load-ms\": %.3f, \"memory-kb\": %ld", load_ms, memory);
+    append_samples (json, "dmrc-load-ms", dmrc_samples);
+    append_counts (json, "load-signals");
+
+    for (int i = 0; i < N_COUNTS; i++)
+        counts[i] = 0;
+    gint64 reload_start = g_get_monotonic_time ();
+    change_user (use_accounts_service, n_users);
+    reload_loop = g_main_loop_new (NULL, FALSE);
+    guint timeout = g_timeout_add (RELOAD_TIMEOUT_MS, reload_timeout_cb, NULL);
+    g_main_loop_run (reload_loop);
+    g_clear_pointer (&reload_loop, g_main_loop_unref);
+    if (counts[COUNT_USERS_CHANGED] > 0)
+    {
+        g_source_remove (timeout);
+        g_string_append_printf (json, ", \"reload-ms\": %.3f", (g_get_monotonic_time () - reload_start) / 1000.0);
+    }
+    else
+        g_string_append (json, ", \"reload-ms\": null");
+    append_counts (json, "reload-signals");
+    g_string_append (json, "}\n");
+
+    g_signal_handlers_disconnect_matched (user_list, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, count_cb, NULL);
+    g_signal_handlers_disconnect_matched (user_list, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, users_changed_cb, NULL);
+
+    report (json);
+
+    return TRUE;
+}
+
+static void
+usage (void)
+{
+    g_printerr ("Usage: user-list-benchmark [-sizes N,N,...] [-dmrc N] [-backend passwd|accounts-service|all]\n");
+}
+
+int
+main (int argc, char **argv)
+{
+#if !defined(GLIB_VERSION_2_36)
+    g_type_init ();
+#endif
+
+    for (int i = 1; i < argc; i++)
+    {
+        char *arg = argv[i];
+
+        if (i + 1 >= argc)
+        {
+            usage ();
+            return EXIT_FAILURE;
+        }
+
+        if (strcmp (arg, "-sizes") == 0)
+            sizes = g_strdup (argv[++i]);
+        else if (strcmp (arg, "-dmrc") == 0)
+            n_dmrc = atoi (argv[++i]);
+        else if (strcmp (arg, "-backend") == 0)
+            backend = g_strdup (argv[++i]);
+        else
+        {
+            usage ();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!sizes)
+        sizes = g_strdup (g_getenv ("BENCHMARK_USER_LIST_SIZES") ? g_getenv ("BENCHMARK_USER_LIST_SIZES") : "1000,10000,100000");
+    if (!backend)
+        backend = g_strdup ("all");
+    gboolean use_passwd = strcmp (backend, "all") == 0 || strcmp (backend, "passwd") == 0;
+    gboolean use_accounts_service = strcmp (backend, "all") == 0 || strcmp (backend, "accounts-service") == 0;
+    if (n_dmrc < 0 || (!use_passwd && !use_accounts_service))
+    {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    /* Users are written where libsystem reads them from */
+    root = g_getenv ("LIGHTDM_TEST_ROOT");
+    g_autofree gchar *temporary_root = NULL;
+    if (!root)
+    {
+        temporary_root = g_dir_make_tmp ("user-list-benchmark-XXXXXX", NULL);
+        if (!temporary_root)
+        {
+            g_printerr ("Failed to make test root\n");
+            return EXIT_FAILURE;
+        }
+        g_setenv ("LIGHTDM_TEST_ROOT", temporary_root, TRUE);
+        root = temporary_root;
+    }
+    if (g_getenv ("BENCHMARK_NSS_LATENCY"))
+        g_setenv ("LIGHTDM_TEST_NSS_LATENCY", g_getenv ("BENCHMARK_NSS_LATENCY"), TRUE);
+    if (g_getenv ("BENCHMARK_HOME_DIR_LATENCY"))
+        g_setenv ("LIGHTDM_TEST_HOME_DIR_LATENCY", g_getenv ("BENCHMARK_HOME_DIR_LATENCY"), TRUE);
+
+    g_auto(GStrv) size_list = g_strsplit (sizes, ",", -1);
+
+    /* Without AccountsService on the bus the list falls back to the passwd file */
+    if (use_passwd)
+    {
+        for (int i = 0; size_list[i]; i++)
+            if (atoi (size_list[i]) > 0 && !run (FALSE, atoi (size_list[i])))
+                return EXIT_FAILURE;
+    }
+
+    if (use_accounts_service)
+    {
+        if (!start_accounts_service ())
+            return EXIT_FAILURE;
+        for (int i = 0; size_list[i]; i++)
+            if (atoi (size_list[i]) > 0 && !run (TRUE, atoi (size_list[i])))
+                return EXIT_FAILURE;
+    }
+
+    common_user_list_cleanup ();
+
+    return EXIT_SUCCESS;
+}
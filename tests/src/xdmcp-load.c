@@ -0,0 +1,700 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <gio/gio.h>
+
+#include "status.h"
+#include "x-common.h"
+
+/*
+ * Simulates many XDMCP terminals talking to a display manager at once. Each
+ * terminal sends one packet at a time, picked at random from a weighted mix,
+ * and sends the next when the reply arrives or the request times out. The
+ * results are written as a JSON object to stdout or appended to
+ * $BENCHMARK_OUTPUT.
+ */
+
+#define XDMCP_VERSION 1
+#define MAXIMUM_REQUEST_LENGTH 65535
+
+/* Display numbers of the simulated terminals start from here */
+#define DISPLAY_NUMBER_BASE 2000
+
+typedef enum
+{
+    XDMCP_BroadcastQuery = 1,
+    XDMCP_Query          = 2,
+    XDMCP_IndirectQuery  = 3,
+    XDMCP_ForwardQuery   = 4,
+    XDMCP_Willing        = 5,
+    XDMCP_Unwilling      = 6,
+    XDMCP_Request        = 7,
+    XDMCP_Accept         = 8,
+    XDMCP_Decline        = 9,
+    XDMCP_Manage         = 10,
+    XDMCP_Refuse         = 11,
+    XDMCP_Failed         = 12,
+    XDMCP_KeepAlive      = 13,
+    XDMCP_Alive          = 14
+} XDMCPOpcode;
+
+/* Packets that can be in the mix */
+typedef enum
+{
+    LOAD_BROADCAST_QUERY,
+    LOAD_REQUEST,
+    LOAD_MANAGE,
+    LOAD_KEEP_ALIVE,
+    LOAD_N_TYPES
+} LoadType;
+
+static const gchar *load_type_names[LOAD_N_TYPES] = { "broadcast-query", "request", "manage", "keep-alive" };
+
+typedef struct
+{
+    guint16 display_number;
+
+    /* Session ID from the last Accept or 0 */
+    guint32 session_id;
+
+    /* Socket this terminal sends from */
+    struct LoadSocket *socket;
+
+    /* TRUE if waiting for a reply */
+    gboolean waiting;
+} Terminal;
+
+typedef struct
+{
+    Terminal *terminal;
+    LoadType type;
+    gint64 send_time;
+} PendingPacket;
+
+typedef struct LoadSocket
+{
+    GSocket *socket;
+
+    /* Packets sent from this socket that haven't been answered yet, oldest first */
+    GQueue pending;
+} LoadSocket;
+
+static GMainLoop *loop = NULL;
+static GRand *rand_ = NULL;
+static Terminal *terminals = NULL;
+static gint n_terminals = 100;
+static LoadSocket *sockets = NULL;
+static gint n_sockets = 64;
+static guint weights[LOAD_N_TYPES] = { 1, 1, 0, 8 };
+static guint total_weight = 0;
+static gint64 timeout_ms = 1000;
+static gint duration = 10;
+static GPid daemon_pid = 0;
+static gboolean stopping = FALSE;
+static GInetAddress *local_address = NULL;
+
+/* Counts for each packet type */
+static guint64 n_sent[LOAD_N_TYPES];
+static guint64 n_answered[LOAD_N_TYPES];
+static guint64 n_rejected[LOAD_N_TYPES];
+static guint64 n_lost[LOAD_N_TYPES];
+static GArray *latencies[LOAD_N_TYPES];
+static guint64 n_unexpected = 0;
+
+static gint daemon_rss_start = -1;
+static gint daemon_rss_peak = -1;
+
+static void send_next (Terminal *terminal);
+
+static gint
+get_daemon_rss (void)
+{
+    if (daemon_pid == 0)
+        return -1;
+
+    g_autofree gchar *status_path = g_strdup_printf ("/proc/%d/status", daemon_pid);
+    g_autofree gchar *status_data = NULL;
+    if (!g_file_get_contents (status_path, &status_data, NULL, NULL))
+        return -1;
+
+    const gchar *line = strstr (status_data, "VmRSS:");
+    if (!line)
+        return -1;
+
+    return atoi (line + strlen ("VmRSS:"));
+}
+
+static gboolean
+parse_mix (const gchar *mix)
+{
+    memset (weights, 0, sizeof (weights));
+
+    g_auto(GStrv) items = g_strsplit (mix, ",", -1);
+    for (int i = 0; items[i]; i++)
+    {
+        g_auto(GStrv) tokens = g_strsplit (items[i], "=", 2);
+        if (g_strv_length (tokens) != 2)
+        {
+            g_printerr ("Invalid mix item '%s', expected <packet>=<weight>\n", items[i]);
+            return FALSE;
+        }
+
+        int type;
+        for (type = 0; type < LOAD_N_TYPES && strcmp (g_strstrip (tokens[0]), load_type_names[type]) != 0; type++);
+        if (type == LOAD_N_TYPES)
+        {
+            g_printerr ("Unknown packet '%s' in mix\n", tokens[0]);
+            return FALSE;
+        }
+        weights[type] = atoi (tokens[1]);
+    }
+
+    return TRUE;
+}
+
+static void
+send_packet (Terminal *terminal, LoadType type, const guint8 *buffer, gsize buffer_length)
+{
+    LoadSocket *socket = terminal->socket;
+
+    g_autoptr(GError) error = NULL;
+    if (g_socket_send (socket->socket, (const gchar *) buffer, buffer_length, NULL, &error) < 0)
+    {
+        /* Count a full send buffer as a lost packet so the terminal keeps going */
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            g_printerr ("Failed to send XDMCP packet: %s\n", error->message);
+    }
+
+    PendingPacket *pending = g_malloc0 (sizeof (PendingPacket));
+    pending->terminal = terminal;
+    pending->type = type;
+    pending->send_time = g_get_monotonic_time ();
+    g_queue_push_tail (&socket->pending, pending);
+    n_sent[type]++;
+}
+
+static void
+send_broadcast_query (Terminal *terminal)
+{
+    guint8 buffer[MAXIMUM_REQUEST_LENGTH];
+    gsize offset = 0;
+
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_VERSION, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_BroadcastQuery, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 1, &offset);
+    write_card8 (buffer, MAXIMUM_REQUEST_LENGTH, 0, &offset);
+
+    send_packet (terminal, LOAD_BROADCAST_QUERY, buffer, offset);
+}
+
+static void
+send_request (Terminal *terminal)
+{
+    const gchar *authorization_name = "MIT-MAGIC-COOKIE-1";
+    gsize address_length = g_inet_address_get_native_size (local_address);
+    const guint8 *address = g_inet_address_to_bytes (local_address);
+
+    guint8 buffer[MAXIMUM_REQUEST_LENGTH];
+    gsize offset = 0;
+
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_VERSION, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_Request, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 17 + address_length + strlen (authorization_name), &offset);
+
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, terminal->display_number, &offset);
+    write_card8 (buffer, MAXIMUM_REQUEST_LENGTH, 1, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 0, &offset); /* FamilyInternet */
+    write_card8 (buffer, MAXIMUM_REQUEST_LENGTH, 1, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, address_length, &offset);
+    write_string8 (buffer, MAXIMUM_REQUEST_LENGTH, address, address_length, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 0, &offset); /* No authentication */
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 0, &offset);
+    write_card8 (buffer, MAXIMUM_REQUEST_LENGTH, 1, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, strlen (authorization_name), &offset);
+    write_string (buffer, MAXIMUM_REQUEST_LENGTH, authorization_name, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 0, &offset); /* No manufacturer display ID */
+
+    send_packet (terminal, LOAD_REQUEST, buffer, offset);
+}
+
+static void
+send_manage (Terminal *terminal)
+{
+    const gchar *display_class = "";
+    guint8 buffer[MAXIMUM_REQUEST_LENGTH];
+    gsize offset = 0;
+
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_VERSION, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_Manage, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 8 + strlen (display_class), &offset);
+
+    write_card32 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, terminal->session_id, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, terminal->display_number, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, strlen (display_class), &offset);
+    write_string (buffer, MAXIMUM_REQUEST_LENGTH, display_class, &offset);
+
+    send_packet (terminal, LOAD_MANAGE, buffer, offset);
+
+    /* A successful Manage has no reply, so it is only answered if refused */
+    terminal->session_id = 0;
+}
+
+static void
+send_keep_alive (Terminal *terminal)
+{
+    guint8 buffer[MAXIMUM_REQUEST_LENGTH];
+    gsize offset = 0;
+
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_VERSION, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, XDMCP_KeepAlive, &offset);
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, 6, &offset);
+
+    write_card16 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, terminal->display_number, &offset);
+    write_card32 (buffer, MAXIMUM_REQUEST_LENGTH, X_BYTE_ORDER_MSB, terminal->session_id, &offset);
+
+    send_packet (terminal, LOAD_KEEP_ALIVE, buffer, offset);
+}
+
+static gboolean
+send_next_cb (gpointer data)
+{
+    send_next (data);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+send_next (Terminal *terminal)
+{
+    if (stopping)
+        return;
+
+    guint value = g_rand_int_range (rand_, 0, total_weight);
+    LoadType type;
+    for (type = 0; value >= weights[type]; type++)
+        value -= weights[type];
+
+    switch (type)
+    {
+    case LOAD_BROADCAST_QUERY:
+        send_broadcast_query (terminal);
+        break;
+    case LOAD_REQUEST:
+        send_request (terminal);
+        break;
+    case LOAD_MANAGE:
+        send_manage (terminal);
+        break;
+    case LOAD_KEEP_ALIVE:
+        send_keep_alive (terminal);
+        break;
+    default:
+        break;
+    }
+
+    /* Don't wait for a Manage, it usually has no reply */
+    terminal->waiting = type != LOAD_MANAGE;
+    if (!terminal->waiting)
+        g_idle_add (send_next_cb, terminal);
+}
+
+static void
+complete_packet (LoadSocket *socket, GList *link, gboolean rejected)
+{
+    PendingPacket *pending = link->data;
+    g_queue_delete_link (&socket->pending, link);
+
+    gdouble ms = (g_get_monotonic_time () - pending->send_time) / 1000.0;
+    g_array_append_val (latencies[pending->type], ms);
+    n_answered[pending->type]++;
+    if (rejected)
+        n_rejected[pending->type]++;
+
+    Terminal *terminal = pending->terminal;
+    if (terminal->waiting)
+    {
+        terminal->waiting = FALSE;
+        send_next (terminal);
+    }
+    g_free (pending);
+}
+
+/* Find the oldest packet of a type that is waiting for a reply */
+static GList *
+find_pending (LoadSocket *socket, LoadType type)
+{
+    for (GList *link = socket->pending.head; link; link = link->next)
+    {
+        PendingPacket *pending = link->data;
+        if (pending->type == type)
+            return link;
+    }
+
+    return NULL;
+}
+
+static void
+handle_reply (LoadSocket *socket, guint16 opcode, const guint8 *buffer, gsize buffer_length)
+{
+    gsize offset = 0;
+    GList *link;
+
+    switch (opcode)
+    {
+    case XDMCP_Willing:
+    case XDMCP_Unwilling:
+    {
+        /* The server only answers an address once for queries that arrive
+         * together. Collect them first as completing one sends the next packet */
+        g_autoptr(GList) queries = NULL;
+        for (link = socket->pending.head; link; link = link->next)
+        {
+            PendingPacket *pending = link->data;
+            if (pending->type == LOAD_BROADCAST_QUERY)
+                queries = g_list_prepend (queries, link);
+        }
+        if (!queries)
+            n_unexpected++;
+        queries = g_list_reverse (queries);
+        for (GList *l = queries; l; l = l->next)
+            complete_packet (socket, l->data, opcode == XDMCP_Unwilling);
+        break;
+    }
+
+    case XDMCP_Accept:
+    case XDMCP_Decline:
+        link = find_pending (socket, LOAD_REQUEST);
+        if (!link)
+        {
+            n_unexpected++;
+            break;
+        }
+        if (opcode == XDMCP_Accept)
+        {
+            PendingPacket *pending = link->data;
+            pending->terminal->session_id = read_card32 (buffer, buffer_length, X_BYTE_ORDER_MSB, &offset);
+        }
+        complete_packet (socket, link, opcode == XDMCP_Decline);
+        break;
+
+    case XDMCP_Refuse:
+    case XDMCP_Failed:
+        link = find_pending (socket, LOAD_MANAGE);
+        if (link)
+            complete_packet (socket, link, TRUE);
+        else
+            n_unexpected++;
+        break;
+
+    case XDMCP_Alive:
+        link = find_pending (socket, LOAD_KEEP_ALIVE);
+        if (link)
+            complete_packet (socket, link, FALSE);
+        else
+            n_unexpected++;
+        break;
+
+    default:
+        n_unexpected++;
+        break;
+    }
+}
+
+static gboolean
+socket_read_cb (GSocket *gsocket, GIOCondition condition, gpointer data)
+{
+    LoadSocket *socket = data;
+
+    while (TRUE)
+    {
+        guint8 buffer[MAXIMUM_REQUEST_LENGTH];
+        g_autoptr(GError) error = NULL;
+        gssize n_read = g_socket_receive (gsocket, (gchar *) buffer, MAXIMUM_REQUEST_LENGTH, NULL, &error);
+        if (n_read < 0)
+        {
+            if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+                g_printerr ("Error reading from XDMCP socket: %s\n", error->message);
+            return G_SOURCE_CONTINUE;
+        }
+
+        gsize offset = 0;
+        guint16 version = read_card16 (buffer, n_read, X_BYTE_ORDER_MSB, &offset);
+        guint16 opcode = read_card16 (buffer, n_read, X_BYTE_ORDER_MSB, &offset);
+        guint16 length = read_card16 (buffer, n_read, X_BYTE_ORDER_MSB, &offset);
+        if (version != XDMCP_VERSION || 6 + length > n_read)
+        {
+            n_unexpected++;
+            continue;
+        }
+
+        handle_reply (socket, opcode, buffer + offset, n_read - offset);
+    }
+}
+
+static gboolean
+timeout_cb (gpointer data)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    for (int i = 0; i < n_sockets; i++)
+    {
+        LoadSocket *socket = &sockets[i];
+        while (TRUE)
+        {
+            PendingPacket *pending = g_queue_peek_head (&socket->pending);
+            if (!pending || now - pending->send_time < timeout_ms * 1000)
+                break;
+            g_queue_pop_head (&socket->pending);
+
+            /* A Manage without a reply was accepted */
+            if (pending->type != LOAD_MANAGE)
+                n_lost[pending->type]++;
+
+            Terminal *terminal = pending->terminal;
+            if (terminal->waiting)
+            {
+                terminal->waiting = FALSE;
+                send_next (terminal);
+            }
+            g_free (pending);
+        }
+    }
+
+    gint rss = get_daemon_rss ();
+    if (rss > daemon_rss_peak)
+        daemon_rss_peak = rss;
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gint
+compare_sample (gconstpointer a, gconstpointer b)
+{
+    gdouble sample_a = *((const gdouble *) a), sample_b = *((const gdouble *) b);
+    return sample_a < sample_b ? -1 : sample_a > sample_b ? 1 : 0;
+}
+
+static void
+append_latencies (GString *json, const gchar *name, GArray *samples)
+{
+    g_string_append_printf (json, "\"%s\": {\"count\": %u", name, samples->len);
+    if (samples->len > 0)
+    {
+        g_array_sort (samples, compare_sample);
+
+        gdouble total = 0;
+        for (guint i = 0; i < samples->len; i++)
+            total += g_array_index (samples, gdouble, i);
+
+        g_string_append_printf (json, ", \"min\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f",
+                                g_array_index (samples, gdouble, 0),
+                                g_array_index (samples, gdouble, samples->len / 2),
+                                g_array_index (samples, gdouble, MIN (samples->len - 1, samples->len * 95 / 100)),
+                                g_array_index (samples, gdouble, MIN (samples->len - 1, samples->len * 99 / 100)),
+                                g_array_index (samples, gdouble, samples->len - 1),
+                                total / samples->len);
+    }
+    g_string_append (json, "}");
+}
+
+static gboolean
+finish_cb (gpointer data)
+{
+    gint64 start_time = *((gint64 *) data);
+    gdouble seconds = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+    stopping = TRUE;
+
+    guint64 total_sent = 0, total_answered = 0, total_lost = 0;
+    g_autoptr(GArray) all_latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+    for (int i = 0; i < LOAD_N_TYPES; i++)
+    {
+        total_sent += n_sent[i];
+        total_answered += n_answered[i];
+        total_lost += n_lost[i];
+        g_array_append_vals (all_latencies, latencies[i]->data, latencies[i]->len);
+    }
+
+    g_autoptr(GString) json = g_string_new ("");
+    g_string_append_printf (json, "{\"benchmark\": \"xdmcp-load\", \"terminals\": %d, \"sockets\": %d", n_terminals, n_sockets);
+    g_string_append (json, ", \"mix\": {");
+    for (int i = 0; i < LOAD_N_TYPES; i++)
+        g_string_append_printf (json, "%s\"%s\": %u", i == 0 ? "" : ", ", load_type_names[i], weights[i]);
+    g_string_append_printf (json, "}, \"duration-ms\": %.3f", seconds * 1000);
+    g_string_append_printf (json, ", \"sent\": %" G_GUINT64_FORMAT ", \"answered\": %" G_GUINT64_FORMAT ", \"lost\": %" G_GUINT64_FORMAT ", \"unexpected\": %" G_GUINT64_FORMAT,
+                            total_sent, total_answered, total_lost, n_unexpected);
+    g_string_append_printf (json, ", \"packets-per-second\": %.1f, \"replies-per-second\": %.1f", total_sent / seconds, total_answered / seconds);
+    g_string_append (json, ", ");
+    append_latencies (json, "latency-ms", all_latencies);
+    for (int i = 0; i < LOAD_N_TYPES; i++)
+    {
+        if (n_sent[i] == 0)
+            continue;
+        g_string_append_printf (json, ", \"%s\": {\"sent\": %" G_GUINT64_FORMAT ", \"answered\": %" G_GUINT64_FORMAT ", \"rejected\": %" G_GUINT64_FORMAT ", \"lost\": %" G_GUINT64_FORMAT ", ",
+                                load_type_names[i], n_sent[i], n_answered[i], n_rejected[i], n_lost[i]);
+        append_latencies (json, "latency-ms", latencies[i]);
+        g_string_append (json, "}");
+    }
+    gint daemon_rss_end = get_daemon_rss ();
+    if (daemon_rss_start >= 0 && daemon_rss_end >= 0)
+        g_string_append_printf (json, ", \"daemon-rss-kb-start\": %d, \"daemon-rss-kb-end\": %d, \"daemon-rss-kb-peak\": %d, \"daemon-rss-kb-growth\": %d",
+                                daemon_rss_start, daemon_rss_end, MAX (daemon_rss_peak, daemon_rss_end), daemon_rss_end - daemon_rss_start);
+    g_string_append (json, "}\n");
+
+    /* Results are appended so they collect with the other benchmarks */
+    const gchar *output_path = g_getenv ("BENCHMARK_OUTPUT");
+    if (output_path)
+    {
+        FILE *output = fopen (output_path, "a");
+        if (output)
+        {
+            fputs (json->str, output);
+            fclose (output);
+        }
+        else
+            g_printerr ("Failed to write benchmark results to %s: %s\n", output_path, strerror (errno));
+    }
+    else
+        g_print ("%s", json->str);
+
+    /* Fail if the server stopped answering */
+    gboolean failed = total_answered == 0 && total_sent > 0;
+    status_notify ("XDMCP-LOAD DONE SENT=%" G_GUINT64_FORMAT " ANSWERED=%" G_GUINT64_FORMAT " LOST=%" G_GUINT64_FORMAT " FAILED=%s",
+                   total_sent, total_answered, total_lost, failed ? "TRUE" : "FALSE");
+
+    g_main_loop_quit (loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+usage (void)
+{
+    g_printerr ("Usage: xdmcp-load [-host HOST] [-port PORT] [-terminals N] [-sockets N] [-duration SECONDS]\n"
+                "                  [-mix broadcast-query=N,request=N,manage=N,keep-alive=N] [-timeout MS]\n"
+                "                  [-seed N] [-pid DAEMON-PID]\n");
+}
+
+int
+main (int argc, char **argv)
+{
+#if !defined(GLIB_VERSION_2_36)
+    g_type_init ();
+#endif
+
+    const gchar *host = "127.0.0.1";
+    guint port = 177;
+    guint32 seed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        char *arg = argv[i];
+
+        if (i + 1 >= argc)
+        {
+            usage ();
+            return EXIT_FAILURE;
+        }
+
+        if (strcmp (arg, "-host") == 0)
+            host = argv[++i];
+        else if (strcmp (arg, "-port") == 0)
+            port = atoi (argv[++i]);
+        else if (strcmp (arg, "-terminals") == 0)
+            n_terminals = atoi (argv[++i]);
+        else if (strcmp (arg, "-sockets") == 0)
+            n_sockets = atoi (argv[++i]);
+        else if (strcmp (arg, "-duration") == 0)
+            duration = atoi (argv[++i]);
+        else if (strcmp (arg, "-mix") == 0)
+        {
+            if (!parse_mix (argv[++i]))
+                return EXIT_FAILURE;
+        }
+        else if (strcmp (arg, "-timeout") == 0)
+            timeout_ms = atoi (argv[++i]);
+        else if (strcmp (arg, "-seed") == 0)
+            seed = atoi (argv[++i]);
+        else if (strcmp (arg, "-pid") == 0)
+            daemon_pid = atoi (argv[++i]);
+        else
+        {
+            usage ();
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < LOAD_N_TYPES; i++)
+        total_weight += weights[i];
+    if (n_terminals <= 0 || total_weight == 0)
+    {
+        g_printerr ("Need at least one terminal and a packet in the mix\n");
+        return EXIT_FAILURE;
+    }
+    n_sockets = CLAMP (n_sockets, 1, n_terminals);
+
+    /* Only report to the test runner when run from it */
+    if (g_getenv ("LIGHTDM_TEST_ROOT"))
+        status_connect (NULL, NULL);
+
+    loop = g_main_loop_new (NULL, FALSE);
+    rand_ = seed != 0 ? g_rand_new_with_seed (seed) : g_rand_new ();
+    for (int i = 0; i < LOAD_N_TYPES; i++)
+        latencies[i] = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+    g_autoptr(GInetAddress) host_address = g_inet_address_new_from_string (host);
+    if (!host_address)
+    {
+        g_printerr ("Invalid host address %s\n", host);
+        return EXIT_FAILURE;
+    }
+    g_autoptr(GSocketAddress) address = g_inet_socket_address_new (host_address, port);
+
+    sockets = g_new0 (LoadSocket, n_sockets);
+    for (int i = 0; i < n_sockets; i++)
+    {
+        LoadSocket *socket = &sockets[i];
+
+        g_autoptr(GError) error = NULL;
+        socket->socket = g_socket_new (g_inet_address_get_family (host_address), G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error);
+        if (!socket->socket || !g_socket_connect (socket->socket, address, NULL, &error))
+        {
+            g_printerr ("Failed to open XDMCP socket: %s\n", error->message);
+            return EXIT_FAILURE;
+        }
+        g_socket_set_blocking (socket->socket, FALSE);
+        g_queue_init (&socket->pending);
+
+        GSource *source = g_socket_create_source (socket->socket, G_IO_IN, NULL);
+        g_source_set_callback (source, (GSourceFunc) socket_read_cb, socket, NULL);
+        g_source_attach (source, NULL);
+        g_source_unref (source);
+
+        if (!local_address)
+        {
+            g_autoptr(GSocketAddress) socket_address = g_socket_get_local_address (socket->socket, NULL);
+            if (socket_address)
+                local_address = g_object_ref (g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (socket_address)));
+        }
+    }
+    if (!local_address)
+        local_address = g_inet_address_new_loopback (g_inet_address_get_family (host_address));
+
+    daemon_rss_start = daemon_rss_peak = get_daemon_rss ();
+
+    terminals = g_new0 (Terminal, n_terminals);
+    for (int i = 0; i < n_terminals; i++)
+    {
+        Terminal *terminal = &terminals[i];
+        terminal->display_number = DISPLAY_NUMBER_BASE + i;
+        terminal->socket = &sockets[i % n_sockets];
+        send_next (terminal);
+    }
+
+    gint64 start_time = g_get_monotonic_time ();
+    g_timeout_add (100, timeout_cb, NULL);
+    g_timeout_add_seconds (duration, finish_cb, &start_time);
+
+    g_main_loop_run (loop);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "xdmcp-protocol.h"
+
+/*
+ * libFuzzer entry point for the daemon XDMCP packet decoder. Anything that
+ * decodes must encode again, and decode from that to the same packet.
+ */
+
+int LLVMFuzzerInitialize (int *argc, char ***argv);
+int LLVMFuzzerTestOneInput (const guint8 *data, size_t size);
+
+static void
+log_cb (const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer data)
+{
+    /* The decoder warns about every invalid packet */
+}
+
+int
+LLVMFuzzerInitialize (int *argc, char ***argv)
+{
+    g_log_set_default_handler (log_cb, NULL);
+    return 0;
+}
+
+int
+LLVMFuzzerTestOneInput (const guint8 *data, size_t size)
+{
+    XDMCPPacket *packet = xdmcp_packet_decode (data, size);
+    if (!packet)
+        return 0;
+
+    g_autofree gchar *text = xdmcp_packet_tostring (packet);
+
+    guint8 encoded[65536];
+    gssize encoded_length = xdmcp_packet_encode (packet, encoded, sizeof (encoded));
+    if (encoded_length >= 0)
+    {
+        XDMCPPacket *decoded = xdmcp_packet_decode (encoded, encoded_length);
+        if (!decoded)
+            abort ();
+        g_autofree gchar *decoded_text = xdmcp_packet_tostring (decoded);
+        if (strcmp (text, decoded_text) != 0)
+            abort ();
+        xdmcp_packet_free (decoded);
+    }
+
+    xdmcp_packet_free (packet);
+
+    return 0;
+}